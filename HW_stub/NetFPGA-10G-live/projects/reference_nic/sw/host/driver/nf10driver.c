@@ -226,12 +226,9 @@ static int __devinit nf10_probe(struct pci_dev *pdev, const struct pci_device_id
     for(i = 0; i < card->host_rx_dne.cl_size; i++)
         *(((uint64_t*)card->host_rx_dne_ptr) + i * 8 + 7) = 0xffffffffffffffffULL;
 
-    // initialize work queue
-    if(!(card->wq = create_workqueue("int_hndlr"))){
-        printk(KERN_ERR "nf10: workqueue failed\n");
-    }
-    INIT_WORK((struct work_struct*)&card->work, work_handler);
-    card->work.card = card;
+    // ring locks (NAPI is set up with the network devices)
+    spin_lock_init(&card->tx_ring_lock);
+    spin_lock_init(&card->rx_ring_lock);
 
     // allocate book keeping structures
     card->tx_bk_skb = (struct sk_buff**)kmalloc(card->mem_tx_dsc.cl_size*sizeof(struct sk_buff*), GFP_KERNEL);
@@ -47,26 +47,22 @@
 #include <linux/netdevice.h> 
 #include <linux/cdev.h>
 #include <asm/atomic.h>
-#include <linux/workqueue.h>
+#include "nf10ring.h"
 
-void work_handler(struct work_struct *w);
+// max RX completions handled per NAPI poll
+#define NF10_NAPI_WEIGHT 64
 
-struct nf10mem{
-    uint64_t wr_ptr;
-    uint64_t rd_ptr;
-    atomic64_t cnt;
-    uint64_t mask;
-    uint64_t cl_size;
-} __attribute__ ((aligned(64)));
+struct nf10_card{
+    // one NAPI context cleans both completion buffers; the card raises a
+    // single MSI for them so there is nothing to spread across contexts
+    struct napi_struct napi;
 
-struct my_work_t{
-    struct work_struct work;
-    struct nf10_card *card;
-};
+    // ring locks, held only while a reservation moves the write pointers
+    spinlock_t tx_ring_lock;
+    spinlock_t rx_ring_lock;
 
-struct nf10_card{
-    struct workqueue_struct *wq;
-    struct my_work_t work;
+    // bit i set => port i stopped its queue because the TX ring was full
+    unsigned long tx_stopped;
 
     volatile void *cfg_addr;   // kernel virtual address of the card BAR0 space
     volatile void *tx_dsc;     // kernel virtual address of the card tx descriptor space
@@ -88,7 +84,7 @@ struct nf10_card{
     struct pci_dev *pdev;
     struct cdev cdev; // char device structure (for /dev/nf10)
 
-    struct net_device *ndev[4]; // network devices
+    struct net_device *ndev[NF10_NUM_PORTS]; // network devices
     
     // memory buffers
     struct nf10mem mem_tx_dsc;
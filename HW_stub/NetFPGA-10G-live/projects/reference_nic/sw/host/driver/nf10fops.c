@@ -75,6 +75,8 @@ long nf10fops_ioctl (struct file *f, unsigned int cmd, unsigned long arg){
     struct nf10_card *card = (struct nf10_card *)f->private_data;
     uint64_t addr, val;
     unsigned long flags;
+    struct nf10_reg_batch batch;
+    uint32_t i;
 
     switch(cmd){
     case NF10_IOCTL_CMD_READ_STAT:
@@ -139,6 +141,20 @@ long nf10fops_ioctl (struct file *f, unsigned int cmd, unsigned long arg){
         axi_wr_cnt = 0;
         spin_unlock_irqrestore(&axi_lock, flags);
         break;
+    case NF10_IOCTL_CMD_READ_REGS:
+        if(copy_from_user(&batch, (struct nf10_reg_batch*)arg, sizeof(batch))) return -EFAULT;
+        if(batch.count > NF10_REG_BATCH_MAX) return -EINVAL;
+        // one lock hold for the whole range so counters are sampled together
+        spin_lock_irqsave(&axi_lock, flags);
+        for(i = 0; i < batch.count; i++){
+            *(((uint64_t*)card->cfg_addr) + 129) = ((uint64_t)(batch.addr + 4*i) << 32);
+            batch.val[i] = *(((uint64_t*)card->cfg_addr) + 129) & 0xffffffff;
+        }
+        axi_wr_cnt = 0;
+        spin_unlock_irqrestore(&axi_lock, flags);
+        batch.done = batch.count;
+        if(copy_to_user((struct nf10_reg_batch*)arg, &batch, sizeof(batch))) return -EFAULT;
+        break;
     default:
         printk(KERN_ERR "nf10: unknown ioctl\n");
         break;
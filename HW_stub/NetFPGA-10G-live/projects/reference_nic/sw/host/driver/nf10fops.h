@@ -45,6 +45,20 @@
 #define NF10_IOCTL_CMD_READ_STAT (SIOCDEVPRIVATE+0)
 #define NF10_IOCTL_CMD_WRITE_REG (SIOCDEVPRIVATE+1)
 #define NF10_IOCTL_CMD_READ_REG (SIOCDEVPRIVATE+2)
+#define NF10_IOCTL_CMD_READ_REGS (SIOCDEVPRIVATE+3)
+
+// max registers read by one NF10_IOCTL_CMD_READ_REGS
+#define NF10_REG_BATCH_MAX 32
+
+// argument of NF10_IOCTL_CMD_READ_REGS: count consecutive 32-bit registers
+// starting at addr are read under a single hold of the AXI lock; done is set
+// to the number of registers read
+struct nf10_reg_batch {
+    uint32_t addr;
+    uint32_t count;
+    uint32_t done;
+    uint32_t val[NF10_REG_BATCH_MAX];
+};
 
 int nf10fops_open (struct inode *n, struct file *f);
 long nf10fops_ioctl (struct file *f, unsigned int cmd, unsigned long arg);
@@ -54,7 +54,11 @@ irqreturn_t int_handler(int irq, void *dev_id){
     struct pci_dev *pdev = dev_id;
     struct nf10_card *card = (struct nf10_card*)pci_get_drvdata(pdev);
     
-    queue_work(card->wq, (struct work_struct*)&card->work);
+    // interrupts stay off until the poll function has drained the card
+    if(napi_schedule_prep(&card->napi)){
+        nf10priv_irq_enable(card, 0);
+        __napi_schedule(&card->napi);
+    }
 
     return IRQ_HANDLED;
 }
@@ -147,14 +151,8 @@ int nf10iface_probe(struct pci_dev *pdev, struct nf10_card *card){
     
     char *devname = "nf%d";
     
-    // request IRQ
-    if(request_irq(pdev->irq, int_handler, 0, DEVICE_NAME, pdev) != 0){
-        printk(KERN_ERR "nf10: request_irq failed\n");
-        goto err_out_free_none;
-    }
-
     // Set up the network device...
-    for (i = 0; i < 4; i++){
+    for (i = 0; i < NF10_NUM_PORTS; i++){
         netdev = card->ndev[i] = alloc_netdev(sizeof(struct nf10_ndev_priv),
                                               devname, nf10iface_init);
         if(netdev == NULL){
@@ -179,39 +177,55 @@ int nf10iface_probe(struct pci_dev *pdev, struct nf10_card *card){
         netif_start_queue(netdev);
     }
 
+    // the completion buffers are shared by all ports, so a single NAPI
+    // context (hung off the first port) polls them for the whole card
+    netif_napi_add(card->ndev[0], &card->napi, nf10priv_poll, NF10_NAPI_WEIGHT);
+    napi_enable(&card->napi);
+
     // give some descriptors to the card
     for(i = 0; i < card->mem_rx_dsc.cl_size-2; i++){
         nf10priv_send_rx_dsc(card);
     }
 
+    // request IRQ
+    if(request_irq(pdev->irq, int_handler, 0, DEVICE_NAME, pdev) != 0){
+        printk(KERN_ERR "nf10: request_irq failed\n");
+        goto err_out_del_napi;
+    }
+
     // yay
     return 0;
     
     // fail
+ err_out_del_napi:
+    napi_disable(&card->napi);
+    netif_napi_del(&card->napi);
  err_out_free_dev:
-    for (i = 0; i < 4; i++){
+    for (i = 0; i < NF10_NUM_PORTS; i++){
         if(card->ndev[i]){
             unregister_netdev(card->ndev[i]);
             free_netdev(card->ndev[i]);
         }
     }
     
- err_out_free_none:
     return ret;
 }
 
 int nf10iface_remove(struct pci_dev *pdev, struct nf10_card *card){
     int i;
 
-    for (i = 0; i < 4; i++){
+    free_irq(pdev->irq, pdev);
+
+    napi_disable(&card->napi);
+    netif_napi_del(&card->napi);
+
+    for (i = 0; i < NF10_NUM_PORTS; i++){
         if(card->ndev[i]){
             unregister_netdev(card->ndev[i]);
             free_netdev(card->ndev[i]);
         }
     }
 
-    free_irq(pdev->irq, pdev);
-
     return 0;
 }
 
@@ -15,8 +15,8 @@
  *        These functions control the card tx/rx operation. 
  *        nf10priv_xmit -- gets called for every transmitted packet
  *                         (on any nf interface)
- *        work_handler  -- gets called when the interrupt handler puts work
- *                         on the queue
+ *        nf10priv_poll -- NAPI poll function, scheduled by the interrupt
+ *                         handler; cleans the TX and RX completion buffers
  *        nf10priv_send_rx_dsc -- allocates and sends a receive descriptor
  *                                to the nic
  *
@@ -74,83 +74,61 @@
 
 //#define LOOPBACK_MODE
 
-static DEFINE_SPINLOCK(tx_lock);
-static DEFINE_SPINLOCK(work_lock);
-static DEFINE_SPINLOCK(rx_dsc_lock);
-
-DECLARE_WORK(wq, work_handler);
+// Stops port's queue because the TX ring is (nearly) full. The completion path
+// wakes every port whose bit is set in tx_stopped once there is room again.
+static void nf10priv_stop_queue(struct nf10_card *card, int port){
+    netif_stop_queue(card->ndev[port]);
+    set_bit(port, &card->tx_stopped);
+    smp_mb();
+
+    // the completion path may have made room before it could see our bit
+    if(nf10ring_has_room(&card->mem_tx_dsc, &card->mem_tx_pkt, 8, 4*NF10_MAX_PKT_CL) &&
+       test_and_clear_bit(port, &card->tx_stopped)){
+        netif_wake_queue(card->ndev[port]);
+    }
+}
 
 int nf10priv_xmit(struct nf10_card *card, struct sk_buff *skb, int port){
     uint8_t* data = skb->data;
     uint32_t len = skb->len;
-    unsigned long flags;
     uint64_t pkt_addr = 0, pkt_addr_fixed = 0;
     uint64_t dsc_addr = 0, dsc_index = 0;
     uint64_t cl_size = (len + 2*63) / 64; // need engouh room for data in any alignment case
-    uint64_t port_decoded = 0;
     uint64_t dsc_l0, dsc_l1;
     uint64_t dma_addr;
+    int low = 0;
 
     if(len > 1514)
         printk(KERN_ERR "nf10: ERROR too big packet. TX size: %d\n", len);
 
-    // packet buffer management
-    spin_lock_irqsave(&tx_lock, flags);
+    // get physical address of the data; done before taking the ring lock so
+    // that ports only serialize on the pointer update
+    dma_addr = pci_map_single(card->pdev, data, len, PCI_DMA_TODEVICE);
+    
+    if(pci_dma_mapping_error(card->pdev, dma_addr)){
+        printk(KERN_ERR "nf10: dma mapping error");
+        return -1;
+    }
 
     // make sure we fit in the descriptor ring and packet buffer
-    if( (atomic64_read(&card->mem_tx_dsc.cnt) + 1 <= card->mem_tx_dsc.cl_size) &&
-        (atomic64_read(&card->mem_tx_pkt.cnt) + cl_size <= card->mem_tx_pkt.cl_size)){
-        
-        pkt_addr = card->mem_tx_pkt.wr_ptr;
-        card->mem_tx_pkt.wr_ptr = (pkt_addr + 64*cl_size) & card->mem_tx_pkt.mask;
-
-        dsc_addr = card->mem_tx_dsc.wr_ptr;
-        card->mem_tx_dsc.wr_ptr = (dsc_addr + 64) & card->mem_tx_dsc.mask;
-
-        // get physical address of the data
-        dma_addr = pci_map_single(card->pdev, data, len, PCI_DMA_TODEVICE);
-        
-        if(pci_dma_mapping_error(card->pdev, dma_addr)){
-            printk(KERN_ERR "nf10: dma mapping error");
-            spin_unlock_irqrestore(&tx_lock, flags);
-            return -1;
-        }
-
-        atomic64_inc(&card->mem_tx_dsc.cnt);
-        atomic64_add(cl_size, &card->mem_tx_pkt.cnt);
-        
-        // there is space in the descriptor ring and at least 2k space in the pkt buffer
-        if( !(( atomic64_read(&card->mem_tx_dsc.cnt) + 1 <= card->mem_tx_dsc.cl_size  ) &&
-              ( atomic64_read(&card->mem_tx_pkt.cnt) + 32 <= card->mem_tx_pkt.cl_size )) ){   
-
-            netif_stop_queue(card->ndev[port]);
-        }
-
-    } 
-    else{
-        spin_unlock_irqrestore(&tx_lock, flags);
+    if(nf10ring_reserve(&card->tx_ring_lock, &card->mem_tx_dsc, &card->mem_tx_pkt,
+                        cl_size, &dsc_addr, &pkt_addr, &low)){
+        pci_unmap_single(card->pdev, dma_addr, len, PCI_DMA_TODEVICE);
+        nf10priv_stop_queue(card, port);
         return -1;
     }
-    
-    spin_unlock_irqrestore(&tx_lock, flags);
+
+    // not enough space left for another packet
+    if(low)
+        nf10priv_stop_queue(card, port);
 
     dsc_index = dsc_addr / 64;
     
-    // figure out ports
-    if(port == 0)
-        port_decoded = 0x0102;
-    else if(port == 1)
-        port_decoded = 0x0408;
-    else if(port == 2)
-        port_decoded = 0x1020;
-    else if(port == 3)
-        port_decoded = 0x4080;
-
     // fix address for alignment issues
     pkt_addr_fixed = pkt_addr + (dma_addr & 0x3fULL);
 
     // prepare TX descriptor
-    dsc_l0 = ((uint64_t)len << 48) + ((uint64_t)port_decoded << 32) + (pkt_addr_fixed & 0xffffffff);
+    dsc_l0 = ((uint64_t)len << 48) + (nf10ring_port_encode(port) << 32) + (pkt_addr_fixed & 0xffffffff);
     dsc_l1 = dma_addr;
 
     // book keeping
@@ -168,185 +146,175 @@ int nf10priv_xmit(struct nf10_card *card, struct sk_buff *skb, int port){
     return 0;
 }
 
-void work_handler(struct work_struct *w){
-    struct nf10_card * card = ((struct my_work_t *)w)->card;
-    int irq_done = 0;
-    uint32_t tx_int;
-    uint64_t rx_int;
-    uint64_t addr;
+void nf10priv_irq_enable(struct nf10_card *card, int enable){
+    mb();
+    *(((uint64_t*)card->cfg_addr)+25) = enable; // TX interrupts
+    *(((uint64_t*)card->cfg_addr)+26) = enable; // RX interrupts
+    mb();
+}
+
+// Frees every sent packet and wakes the queues stopped for lack of ring space.
+static int nf10priv_clean_tx(struct nf10_card *card){
     uint64_t index;
-    struct sk_buff *skb;
-    uint64_t len;
-    int port = -1;
-    uint64_t port_encoded;
-    unsigned long flags;
+    int done = 0;
+    int i;
+
+    while(nf10ring_tx_dne_valid(card->host_tx_dne_ptr, &card->host_tx_dne)){
+        // manage host completion buffer
+        index = nf10ring_dne_next(&card->host_tx_dne);
+        
+        // clean up the skb
+        pci_unmap_single(card->pdev, card->tx_bk_dma_addr[index], card->tx_bk_skb[index]->len, PCI_DMA_TODEVICE);
+        dev_kfree_skb_any(card->tx_bk_skb[index]);
+        nf10ring_release(&card->mem_tx_dsc, &card->mem_tx_pkt, card->tx_bk_size[index]);
+        
+        // invalidate host tx completion buffer
+        *nf10ring_tx_dne_entry(card->host_tx_dne_ptr, index) = 0xffffffff;
+
+        done++;
+    }
+
+    if(done){
+        // pairs with nf10priv_stop_queue: release the space before looking
+        // at who is waiting for it
+        smp_mb();
+
+        // restart queues if needed
+        if(card->tx_stopped &&
+           nf10ring_has_room(&card->mem_tx_dsc, &card->mem_tx_pkt, 8, 4*NF10_MAX_PKT_CL)){
+            
+            for(i = 0; i < NF10_NUM_PORTS; i++){
+                if(test_and_clear_bit(i, &card->tx_stopped))
+                    netif_wake_queue(card->ndev[i]);
+            }
+        }
+    }
+
+    return done;
+}
+
+// Hands a received packet to the stack.
+static void nf10priv_rx_skb(struct nf10_card *card, struct sk_buff *skb, uint64_t len, int port){
 #ifdef LOOPBACK_MODE
     struct iphdr *iph;
     struct tcphdr *th;
     struct sock sck;
     struct inet_sock *isck;
 #endif
-    int work_counter = 0;
-    int tcnt = 1;
-    int int_enabled = 1;
-    int i;
 
-    spin_lock_irqsave(&work_lock, flags);
+    if(len > 1514 || len < 60 || port < 0 || port >= NF10_NUM_PORTS){
+        printk(KERN_ERR"nf10: invalid pakcet\n");
+        kfree_skb(skb);
+        return;
+    }
+
+    if(!((struct nf10_ndev_priv*)netdev_priv(card->ndev[port]))->port_up){
+        // down port, drop packet
+        card->ndev[port]->stats.rx_dropped++;
+        kfree_skb(skb);
+        return;
+    }
+
+    // update skb with port information
+    skb_put(skb, len);            
+    
+    skb->dev = card->ndev[port];
+    skb->protocol = eth_type_trans(skb, card->ndev[port]);
+    skb->ip_summed = CHECKSUM_NONE;
 
-    while(tcnt){
+    // update stats
+    card->ndev[port]->stats.rx_packets++;
+    card->ndev[port]->stats.rx_bytes += skb->len;
 
-        if((int_enabled == 1) && work_counter > 0){
-            int_enabled = 0;
-            mb();
-            *(((uint64_t*)card->cfg_addr)+25) = 0; // disable TX interrupts
-            *(((uint64_t*)card->cfg_addr)+26) = 0; // disable RX interrupts
-            mb();
+#ifdef LOOPBACK_MODE
+    iph = (struct iphdr *)skb->data;
+    if(skb->protocol == htons(ETH_P_IP)){
+        ((uint8_t*)skb->data)[14] ^= 0x1;
+        ((uint8_t*)skb->data)[18] ^= 0x1;
+        ip_send_check(iph);
+        if(((uint8_t*)skb->data)[9] == 6){
+            memset(&sck, 0, sizeof(sck));
+            th = tcp_hdr(skb);
+            th->check = 0;
+            skb->ip_summed = CHECKSUM_PARTIAL;
+            isck = inet_sk(&sck);
+            isck->inet_saddr = iph->saddr;
+            isck->inet_daddr = iph->daddr;
+            tcp_v4_send_check(&sck, skb);
         }
 
-        irq_done = 1;
+        if(((uint8_t*)skb->data)[9] == 17){
+            ((uint8_t*)skb->data)[26] = 0;
+            ((uint8_t*)skb->data)[27] = 0;
+        }
+   
+        netif_receive_skb(skb);
         
-        // read the host completion buffers
-        tx_int = *(((uint32_t*)card->host_tx_dne_ptr) + (card->host_tx_dne.rd_ptr)/4);
-        rx_int = *(((uint64_t*)card->host_rx_dne_ptr) + (card->host_rx_dne.rd_ptr)/8 + 7);
+    }
+    else{
+        kfree_skb(skb);
+    }
+#else
+    netif_receive_skb(skb);
+#endif            
+}
 
-        if( (tx_int & 0xffff) == 1 ){
-            irq_done = 0;
-            
-            // manage host completion buffer
-            addr = card->host_tx_dne.rd_ptr;
-            card->host_tx_dne.rd_ptr = (addr + 64) & card->host_tx_dne.mask;
-            index = addr / 64;
-            
-            // clean up the skb
-            pci_unmap_single(card->pdev, card->tx_bk_dma_addr[index], card->tx_bk_skb[index]->len, PCI_DMA_TODEVICE);
-            dev_kfree_skb_any(card->tx_bk_skb[index]);
-            atomic64_sub(card->tx_bk_size[index], &card->mem_tx_pkt.cnt);
-            atomic64_dec(&card->mem_tx_dsc.cnt);
-            
-            // invalidate host tx completion buffer
-            *(((uint32_t*)card->host_tx_dne_ptr) + index * 16) = 0xffffffff;
-
-            // restart queue if needed
-            if( ((atomic64_read(&card->mem_tx_dsc.cnt) + 8*1) <= card->mem_tx_dsc.cl_size) &&
-                ((atomic64_read(&card->mem_tx_pkt.cnt) + 4*32) <= card->mem_tx_pkt.cl_size) ){
-                
-                for(i = 0; i < 4; i++){
-                    if(netif_queue_stopped(card->ndev[i]))
-                        netif_wake_queue(card->ndev[i]);
-                }
+// Receives up to budget packets.
+static int nf10priv_clean_rx(struct nf10_card *card, int budget){
+    uint64_t rx_int;
+    uint64_t index;
+    struct sk_buff *skb;
+    int done = 0;
 
-            }
-        }
+    while(done < budget && nf10ring_rx_dne_valid(card->host_rx_dne_ptr, &card->host_rx_dne)){
+        // manage host completion buffer
+        index = nf10ring_dne_next(&card->host_rx_dne);
+        rx_int = *nf10ring_rx_dne_entry(card->host_rx_dne_ptr, index);
         
-        if( ((rx_int >> 48) & 0xffff) != 0xffff ){
-            irq_done = 0;
-                
-            // manage host completion buffer
-            addr = card->host_rx_dne.rd_ptr;
-            card->host_rx_dne.rd_ptr = (addr + 64) & card->host_rx_dne.mask;
-            index = addr / 64;
-            
-            // invalidate host rx completion buffer
-            *(((uint64_t*)card->host_rx_dne_ptr) + index * 8 + 7) = 0xffffffffffffffffULL;
-
-            // skb is now ready
-            skb = card->rx_bk_skb[index];
-            pci_unmap_single(card->pdev, card->rx_bk_dma_addr[index], skb->len, PCI_DMA_FROMDEVICE);
-            atomic64_sub(card->rx_bk_size[index], &card->mem_rx_pkt.cnt);
-            atomic64_dec(&card->mem_rx_dsc.cnt);
-            
-            // give the card a new RX descriptor
-            nf10priv_send_rx_dsc(card);
+        // invalidate host rx completion buffer
+        *nf10ring_rx_dne_entry(card->host_rx_dne_ptr, index) = 0xffffffffffffffffULL;
 
-            // read data from the completion buffer
-            len = rx_int & 0xffff;
-            port_encoded = (rx_int >> 16) & 0xffff;
-            
-            if(port_encoded & 0x0200)
-                port = 0;
-            else if(port_encoded & 0x0800)
-                port = 1;
-            else if(port_encoded & 0x2000)
-                port = 2;
-            else if(port_encoded & 0x8000)
-                port = 3;
-            else 
-                port = -1;
-
-            //printk(KERN_ERR "rec %d\n", len);
-
-            if(len > 1514 || len < 60 || port < 0 || port > 3){
-                printk(KERN_ERR"nf10: invalid pakcet\n");
-            }
-            else if(((struct nf10_ndev_priv*)netdev_priv(card->ndev[port]))->port_up){
+        // skb is now ready
+        skb = card->rx_bk_skb[index];
+        pci_unmap_single(card->pdev, card->rx_bk_dma_addr[index], SK_BUFF_ALLOC_SIZE, PCI_DMA_FROMDEVICE);
+        nf10ring_release(&card->mem_rx_dsc, &card->mem_rx_pkt, card->rx_bk_size[index]);
+        
+        // give the card a new RX descriptor
+        nf10priv_send_rx_dsc(card);
 
-                // update skb with port information
-                skb_put(skb, len);            
-                
-                skb->dev = card->ndev[port];
-                skb->protocol = eth_type_trans(skb, card->ndev[port]);
-                skb->ip_summed = CHECKSUM_NONE;
+        // length and port come from the completion buffer
+        nf10priv_rx_skb(card, skb, rx_int & 0xffff, nf10ring_port_decode((rx_int >> 16) & 0xffff));
 
-                // update stats
-                card->ndev[port]->stats.rx_packets++;
-                card->ndev[port]->stats.rx_bytes += skb->len;
+        done++;
+    }
 
-#ifdef LOOPBACK_MODE
-                iph = (struct iphdr *)skb->data;
-                if(skb->protocol == htons(ETH_P_IP)){
-                    ((uint8_t*)skb->data)[14] ^= 0x1;
-                    ((uint8_t*)skb->data)[18] ^= 0x1;
-                    ip_send_check(iph);
-                    if(((uint8_t*)skb->data)[9] == 6){
-                        memset(&sck, 0, sizeof(sck));
-                        th = tcp_hdr(skb);
-                        th->check = 0;
-                        skb->ip_summed = CHECKSUM_PARTIAL;
-                        isck = inet_sk(&sck);
-                        isck->inet_saddr = iph->saddr;
-                        isck->inet_daddr = iph->daddr;
-                        tcp_v4_send_check(&sck, skb);
-                    }
-
-                    if(((uint8_t*)skb->data)[9] == 17){
-                        ((uint8_t*)skb->data)[26] = 0;
-                        ((uint8_t*)skb->data)[27] = 0;
-                    }
-               
-                    netif_receive_skb(skb);
-                    
-                }
-                else{
-                    kfree_skb(skb);
-                }
-#else
-                netif_receive_skb(skb);
-#endif            
-            }
-            else{ // invalid or down port, drop packet
-                kfree_skb(skb);
-            }
-        }
+    return done;
+}
 
-        work_counter++;
-
-        if(irq_done)
-            tcnt--;
-        else if(tcnt < 10000)
-            tcnt++;
-
-        if((tcnt <= 1) && (int_enabled == 0)){
-            work_counter = 0;
-            tcnt = 1;
-            int_enabled = 1;
-            mb();
-            *(((uint64_t*)card->cfg_addr)+25) = 1; // enable TX interrupts
-            *(((uint64_t*)card->cfg_addr)+26) = 1; // enable RX interrupts
-            mb();
+// NAPI poll. Runs with the card's interrupts disabled until both completion
+// buffers are drained; at most budget packets are received per call so one
+// busy card cannot starve the rest of the softirq work on this CPU.
+int nf10priv_poll(struct napi_struct *napi, int budget){
+    struct nf10_card *card = container_of(napi, struct nf10_card, napi);
+    int work_done;
+
+    nf10priv_clean_tx(card);
+    work_done = nf10priv_clean_rx(card, budget);
+
+    if(work_done < budget){
+        napi_complete(napi);
+        nf10priv_irq_enable(card, 1);
+
+        // a completion written after the last check but before the interrupts
+        // were enabled raises no interrupt, so look once more
+        if((nf10ring_tx_dne_valid(card->host_tx_dne_ptr, &card->host_tx_dne) ||
+            nf10ring_rx_dne_valid(card->host_rx_dne_ptr, &card->host_rx_dne)) &&
+           napi_reschedule(napi)){
+            nf10priv_irq_enable(card, 0);
         }
     }
 
-    spin_unlock_irqrestore(&work_lock, flags);
+    return work_done;
 }
 
 int nf10priv_send_rx_dsc(struct nf10_card *card){
@@ -355,40 +323,25 @@ int nf10priv_send_rx_dsc(struct nf10_card *card){
     uint64_t pkt_addr = 0, pkt_addr_fixed = 0;
     uint64_t dsc_addr = 0, dsc_index = 0;
     uint64_t cl_size = (SK_BUFF_ALLOC_SIZE + 66) / 64;
-    unsigned long flags;
     uint64_t dsc_l0, dsc_l1;
 
-    // packet buffer management
-    spin_lock_irqsave(&rx_dsc_lock, flags);
-
-    // make sure we fit in the descriptor ring and packet buffer
-    if( (atomic64_read(&card->mem_rx_dsc.cnt) + 1 <= card->mem_rx_dsc.cl_size) &&
-        (atomic64_read(&card->mem_rx_pkt.cnt) + cl_size <= card->mem_rx_pkt.cl_size)){
-        
-        skb = dev_alloc_skb(SK_BUFF_ALLOC_SIZE + 2);
-        if(!skb) {
-            printk(KERN_ERR "nf10: skb alloc failed\n");
-            spin_unlock_irqrestore(&rx_dsc_lock, flags);
-            return -1;
-        }
-        skb_reserve(skb, 2); /* align IP on 16B boundary */   
-
-        pkt_addr = card->mem_rx_pkt.wr_ptr;
-        card->mem_rx_pkt.wr_ptr = (pkt_addr + 64*cl_size) & card->mem_rx_pkt.mask;
-
-        dsc_addr = card->mem_rx_dsc.wr_ptr;
-        card->mem_rx_dsc.wr_ptr = (dsc_addr + 64) & card->mem_rx_dsc.mask;
+    // cheap check first so a full ring does not cost an skb allocation
+    if(!nf10ring_has_room(&card->mem_rx_dsc, &card->mem_rx_pkt, 1, cl_size))
+        return -1;
 
-        atomic64_inc(&card->mem_rx_dsc.cnt);
-        atomic64_add(cl_size, &card->mem_rx_pkt.cnt);
-        
-    } 
-    else{
-        spin_unlock_irqrestore(&rx_dsc_lock, flags);
+    skb = dev_alloc_skb(SK_BUFF_ALLOC_SIZE + 2);
+    if(!skb) {
+        printk(KERN_ERR "nf10: skb alloc failed\n");
         return -1;
     }
+    skb_reserve(skb, 2); /* align IP on 16B boundary */   
 
-    spin_unlock_irqrestore(&rx_dsc_lock, flags);
+    // make sure we fit in the descriptor ring and packet buffer
+    if(nf10ring_reserve(&card->rx_ring_lock, &card->mem_rx_dsc, &card->mem_rx_pkt,
+                        cl_size, &dsc_addr, &pkt_addr, NULL)){
+        kfree_skb(skb);
+        return -1;
+    }
 
     dsc_index = dsc_addr / 64;
 
@@ -42,7 +42,8 @@
 #include "nf10driver.h"
 
 int nf10priv_xmit(struct nf10_card *card, struct sk_buff *skb, int port);
-void work_handler(struct work_struct *w);
+int nf10priv_poll(struct napi_struct *napi, int budget);
+void nf10priv_irq_enable(struct nf10_card *card, int enable);
 int nf10priv_send_rx_dsc(struct nf10_card *card);
 
 
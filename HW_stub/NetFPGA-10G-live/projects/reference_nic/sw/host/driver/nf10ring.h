@@ -0,0 +1,184 @@
+/*******************************************************************************
+ *
+ *  NetFPGA-10G http://www.netfpga.org
+ *
+ *  File:
+ *        nf10ring.h
+ *
+ *  Project:
+ *        nic
+ *
+ *  Description:
+ *        Book keeping for the DMA rings shared by the host and the card.
+ *        The card has one TX and one RX descriptor ring, each with a packet
+ *        buffer, and writes completions to one host buffer per direction.
+ *        These helpers reserve ring space and consume completions; they
+ *        are shared by the driver and by the user-space ring model
+ *        (nf10ringsim.c), which is why they are written against the small
+ *        compatibility layer below instead of kernel headers directly.
+ *
+ *  Copyright notice:
+ *        Copyright (C) 2010, 2011 The Board of Trustees of The Leland Stanford
+ *                                 Junior University
+ *
+ *  Licence:
+ *        This file is part of the NetFPGA 10G development base package.
+ *
+ *        This file is free code: you can redistribute it and/or modify it under
+ *        the terms of the GNU Lesser General Public License version 2.1 as
+ *        published by the Free Software Foundation.
+ *
+ *        This package is distributed in the hope that it will be useful, but
+ *        WITHOUT ANY WARRANTY; without even the implied warranty of
+ *        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *        Lesser General Public License for more details.
+ *
+ *        You should have received a copy of the GNU Lesser General Public
+ *        License along with the NetFPGA source package.  If not, see
+ *        http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef NF10RING_H
+#define NF10RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <asm/atomic.h>
+#else
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct { volatile int64_t counter; } atomic64_t;
+#define atomic64_read(v)    ((v)->counter)
+#define atomic64_set(v, i)  ((v)->counter = (i))
+#define atomic64_add(i, v)  ((void)__sync_fetch_and_add(&(v)->counter, (i)))
+#define atomic64_sub(i, v)  ((void)__sync_fetch_and_sub(&(v)->counter, (i)))
+#define atomic64_inc(v)     atomic64_add(1, v)
+#define atomic64_dec(v)     atomic64_sub(1, v)
+
+typedef pthread_spinlock_t spinlock_t;
+#define spin_lock_init(l)                 pthread_spin_init(l, PTHREAD_PROCESS_PRIVATE)
+#define spin_lock_irqsave(l, flags)       do { (flags) = 0; pthread_spin_lock(l); } while(0)
+#define spin_unlock_irqrestore(l, flags)  do { (void)(flags); pthread_spin_unlock(l); } while(0)
+
+#define mb() __sync_synchronize()
+#endif
+
+// number of ports (and network devices) on the card
+#define NF10_NUM_PORTS 4
+
+// worst case packet buffer use of one packet, in 64B cache lines
+#define NF10_MAX_PKT_CL 32
+
+struct nf10mem{
+    uint64_t wr_ptr;
+    uint64_t rd_ptr;
+    atomic64_t cnt;
+    uint64_t mask;
+    uint64_t cl_size;
+} __attribute__ ((aligned(64)));
+
+// are there n free descriptors and cl free packet buffer cache lines?
+static inline int nf10ring_has_room(struct nf10mem *dsc, struct nf10mem *pkt,
+                                    uint64_t n, uint64_t cl){
+    return (atomic64_read(&dsc->cnt) + n <= dsc->cl_size) &&
+           (atomic64_read(&pkt->cnt) + cl <= pkt->cl_size);
+}
+
+// Reserves one descriptor and cl_size packet buffer cache lines. The lock only
+// covers moving the write pointers, because the card consumes packet buffer
+// space in descriptor order and the two must be allocated together. Anything
+// slow (DMA mapping, writing the descriptor) is done by the caller outside it.
+// Returns 0 on success with the byte offsets of the reservation, or -1 if the
+// ring is full. *low is set if the ring no longer has room for a worst case
+// packet, i.e. the caller should stop its queue.
+static inline int nf10ring_reserve(spinlock_t *lock, struct nf10mem *dsc, struct nf10mem *pkt,
+                                   uint64_t cl_size, uint64_t *dsc_addr, uint64_t *pkt_addr,
+                                   int *low){
+    unsigned long flags;
+
+    spin_lock_irqsave(lock, flags);
+
+    if(!nf10ring_has_room(dsc, pkt, 1, cl_size)){
+        spin_unlock_irqrestore(lock, flags);
+        return -1;
+    }
+
+    *pkt_addr = pkt->wr_ptr;
+    pkt->wr_ptr = (*pkt_addr + 64*cl_size) & pkt->mask;
+
+    *dsc_addr = dsc->wr_ptr;
+    dsc->wr_ptr = (*dsc_addr + 64) & dsc->mask;
+
+    atomic64_inc(&dsc->cnt);
+    atomic64_add(cl_size, &pkt->cnt);
+
+    spin_unlock_irqrestore(lock, flags);
+
+    if(low)
+        *low = !nf10ring_has_room(dsc, pkt, 1, NF10_MAX_PKT_CL);
+
+    return 0;
+}
+
+// Returns a completed descriptor's space to the ring. Lock free: only the
+// completion path releases space, and it only touches the counters.
+static inline void nf10ring_release(struct nf10mem *dsc, struct nf10mem *pkt, uint64_t cl_size){
+    atomic64_sub(cl_size, &pkt->cnt);
+    atomic64_dec(&dsc->cnt);
+}
+
+// Consumes the next 64B entry of a host completion buffer and returns its
+// index. The caller must have checked that the entry is valid.
+static inline uint64_t nf10ring_dne_next(struct nf10mem *dne){
+    uint64_t addr = dne->rd_ptr;
+
+    dne->rd_ptr = (addr + 64) & dne->mask;
+    return addr / 64;
+}
+
+// TX completion entries: the low 16 bits of the first word of the entry are 1
+// once the card has sent the descriptor, and the host invalidates the entry
+// with all ones after consuming it
+static inline uint32_t *nf10ring_tx_dne_entry(void *host_tx_dne_ptr, uint64_t index){
+    return ((uint32_t*)host_tx_dne_ptr) + index * 16;
+}
+
+static inline int nf10ring_tx_dne_valid(void *host_tx_dne_ptr, struct nf10mem *dne){
+    return (*nf10ring_tx_dne_entry(host_tx_dne_ptr, dne->rd_ptr / 64) & 0xffff) == 1;
+}
+
+// RX completion entries: the last 64-bit word of the entry holds the length
+// (bits 0-15), the encoded source port (bits 16-31) and all ones in bits 48-63
+// until the card has filled it in
+static inline uint64_t *nf10ring_rx_dne_entry(void *host_rx_dne_ptr, uint64_t index){
+    return ((uint64_t*)host_rx_dne_ptr) + index * 8 + 7;
+}
+
+static inline int nf10ring_rx_dne_valid(void *host_rx_dne_ptr, struct nf10mem *dne){
+    return ((*nf10ring_rx_dne_entry(host_rx_dne_ptr, dne->rd_ptr / 64) >> 48) & 0xffff) != 0xffff;
+}
+
+// port numbering used in TX descriptors and RX completions
+static inline uint64_t nf10ring_port_encode(int port){
+    static const uint64_t encoded[NF10_NUM_PORTS] = {0x0102, 0x0408, 0x1020, 0x4080};
+
+    return (port >= 0 && port < NF10_NUM_PORTS) ? encoded[port] : 0;
+}
+
+static inline int nf10ring_port_decode(uint64_t port_encoded){
+    if(port_encoded & 0x0200)
+        return 0;
+    else if(port_encoded & 0x0800)
+        return 1;
+    else if(port_encoded & 0x2000)
+        return 2;
+    else if(port_encoded & 0x8000)
+        return 3;
+    else
+        return -1;
+}
+
+#endif
@@ -0,0 +1,447 @@
+/*******************************************************************************
+ *
+ *  NetFPGA-10G http://www.netfpga.org
+ *
+ *  File:
+ *        nf10ringsim.c
+ *
+ *  Project:
+ *        nic
+ *
+ *  Description:
+ *        User-space model of the driver's DMA queueing, for benchmarking it
+ *        without a card. The ring book keeping is the driver's own
+ *        (nf10ring.h); the rest of the driver is modelled by threads:
+ *
+ *          port threads  -- one per port, stand in for nf10priv_xmit: reserve
+ *                           TX ring space, write descriptors, and stop/wake
+ *                           their queue like the driver does
+ *          card thread   -- consumes TX and RX descriptors in ring order and
+ *                           writes the host completion buffers in the same
+ *                           format as the DMA engine; raises an "interrupt"
+ *                           when interrupts are enabled
+ *          poll thread   -- stands in for nf10priv_poll: cleans the TX
+ *                           completions, receives up to budget packets per
+ *                           poll and re-posts RX descriptors
+ *
+ *        Every TX packet must complete on the port that sent it and every RX
+ *        packet must arrive on the port the card received it on; the program
+ *        exits non-zero otherwise.
+ *
+ *        Usage: nf10ringsim [-p ports] [-b budget] [-n packets] [-s size]
+ *        Without -p/-b a matrix of port counts and budgets is run.
+ *
+ *  Copyright notice:
+ *        Copyright (C) 2010, 2011 The Board of Trustees of The Leland Stanford
+ *                                 Junior University
+ *
+ *  Licence:
+ *        This file is part of the NetFPGA 10G development base package.
+ *
+ *        This file is free code: you can redistribute it and/or modify it under
+ *        the terms of the GNU Lesser General Public License version 2.1 as
+ *        published by the Free Software Foundation.
+ *
+ *        This package is distributed in the hope that it will be useful, but
+ *        WITHOUT ANY WARRANTY; without even the implied warranty of
+ *        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *        Lesser General Public License for more details.
+ *
+ *        You should have received a copy of the GNU Lesser General Public
+ *        License along with the NetFPGA source package.  If not, see
+ *        http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include "nf10ring.h"
+
+// same as nf10priv.c
+#define SK_BUFF_ALLOC_SIZE  1533
+
+// ring sizes the driver programs at probe (nf10driver.c)
+#define DSC_MASK 0x000007ffULL
+#define PKT_MASK 0x00007fffULL
+
+struct sim;
+
+struct port{
+    struct sim *sim;
+    int port;
+    pthread_t tid;
+
+    uint64_t sent;
+    uint64_t full;      // reservations refused (the driver drops these)
+    uint64_t stops;     // times the queue was stopped
+};
+
+struct sim{
+    // driver side
+    struct nf10mem mem_tx_dsc;
+    struct nf10mem mem_tx_pkt;
+    struct nf10mem mem_rx_dsc;
+    struct nf10mem mem_rx_pkt;
+    struct nf10mem host_tx_dne;
+    struct nf10mem host_rx_dne;
+    spinlock_t tx_ring_lock;
+    spinlock_t rx_ring_lock;
+    volatile unsigned long tx_stopped;
+    uint64_t tx_bk_size[(DSC_MASK+1)/64];
+    uint64_t tx_bk_port[(DSC_MASK+1)/64];
+    uint64_t rx_bk_size[(DSC_MASK+1)/64];
+
+    // card side
+    volatile uint64_t tx_dsc[(DSC_MASK+1)/8];
+    volatile uint64_t rx_dsc[(DSC_MASK+1)/8];
+    uint8_t host_tx_dne_buf[DSC_MASK+1] __attribute__ ((aligned(64)));
+    uint8_t host_rx_dne_buf[DSC_MASK+1] __attribute__ ((aligned(64)));
+    volatile int irq_enabled;
+    volatile int irq_pending;
+    volatile int done;
+
+    // parameters
+    int num_ports;
+    int budget;
+    uint64_t num_pkts;  // per port, in each direction
+    uint32_t pkt_len;
+
+    // results
+    struct port port[NF10_NUM_PORTS];
+    uint64_t tx_cleaned[NF10_NUM_PORTS];
+    uint64_t rx_received[NF10_NUM_PORTS];
+    uint64_t bad;       // descriptors or completions with the wrong contents
+    uint64_t irqs;
+    uint64_t polls;
+};
+
+static uint64_t now_nsec(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void nf10mem_init(struct nf10mem *m, uint64_t mask){
+    m->wr_ptr = 0;
+    m->rd_ptr = 0;
+    atomic64_set(&m->cnt, 0);
+    m->mask = mask;
+    m->cl_size = (mask+1)/64;
+}
+
+// nf10priv_stop_queue
+static void sim_stop_queue(struct sim *s, struct port *p){
+    unsigned long bit = 1UL << p->port;
+
+    __sync_fetch_and_or(&s->tx_stopped, bit);
+    p->stops++;
+    mb();
+
+    if(nf10ring_has_room(&s->mem_tx_dsc, &s->mem_tx_pkt, 8, 4*NF10_MAX_PKT_CL))
+        __sync_fetch_and_and(&s->tx_stopped, ~bit);
+}
+
+// nf10priv_xmit, called by the stack as long as the queue is not stopped
+static void *port_main(void *arg){
+    struct port *p = arg;
+    struct sim *s = p->sim;
+    uint64_t cl_size = (s->pkt_len + 2*63) / 64;
+    uint64_t dsc_addr, pkt_addr, dsc_index;
+    int low;
+
+    while(p->sent < s->num_pkts){
+        if(s->tx_stopped & (1UL << p->port)){
+            sched_yield();
+            continue;
+        }
+
+        if(nf10ring_reserve(&s->tx_ring_lock, &s->mem_tx_dsc, &s->mem_tx_pkt,
+                            cl_size, &dsc_addr, &pkt_addr, &low)){
+            p->full++;
+            sim_stop_queue(s, p);
+            continue;
+        }
+        if(low)
+            sim_stop_queue(s, p);
+
+        dsc_index = dsc_addr / 64;
+        s->tx_bk_size[dsc_index] = cl_size;
+        s->tx_bk_port[dsc_index] = p->port;
+
+        mb();
+        s->tx_dsc[8 * dsc_index + 0] = ((uint64_t)s->pkt_len << 48) +
+                                       (nf10ring_port_encode(p->port) << 32) +
+                                       (pkt_addr & 0xffffffff);
+        mb();
+        s->tx_dsc[8 * dsc_index + 1] = 0x1000 + dsc_addr; // stands in for the DMA address
+        mb();
+
+        p->sent++;
+    }
+
+    return NULL;
+}
+
+// nf10priv_send_rx_dsc
+static int sim_send_rx_dsc(struct sim *s){
+    uint64_t cl_size = (SK_BUFF_ALLOC_SIZE + 66) / 64;
+    uint64_t dsc_addr, pkt_addr, dsc_index;
+
+    if(nf10ring_reserve(&s->rx_ring_lock, &s->mem_rx_dsc, &s->mem_rx_pkt,
+                        cl_size, &dsc_addr, &pkt_addr, NULL))
+        return -1;
+
+    dsc_index = dsc_addr / 64;
+    s->rx_bk_size[dsc_index] = cl_size;
+
+    mb();
+    s->rx_dsc[8 * dsc_index + 0] = ((uint64_t)SK_BUFF_ALLOC_SIZE << 48) + (pkt_addr & 0xffffffff);
+    mb();
+    s->rx_dsc[8 * dsc_index + 1] = 0x1000 + dsc_addr;
+    mb();
+
+    return 0;
+}
+
+// the DMA engine: one descriptor per direction per pass, in ring order
+static void *card_main(void *arg){
+    struct sim *s = arg;
+    uint64_t tx_rd = 0, rx_rd = 0;
+    uint64_t rx_gen = 0, rx_total = s->num_pkts * s->num_ports;
+    uint64_t index, dsc_l0;
+    int port, work;
+
+    while(!s->done){
+        work = 0;
+
+        index = tx_rd / 64;
+        if(s->tx_dsc[8 * index + 1]){
+            mb();
+            dsc_l0 = s->tx_dsc[8 * index + 0];
+            s->tx_dsc[8 * index + 1] = 0;
+
+            // the completion carries no port; the host looks it up by index
+            if(((dsc_l0 >> 48) & 0xffff) != s->pkt_len)
+                s->bad++;
+            mb();
+            *nf10ring_tx_dne_entry(s->host_tx_dne_buf, index) = 1;
+            tx_rd = (tx_rd + 64) & DSC_MASK;
+            work = 1;
+        }
+
+        index = rx_rd / 64;
+        if(rx_gen < rx_total && s->rx_dsc[8 * index + 1]){
+            s->rx_dsc[8 * index + 1] = 0;
+            port = rx_gen % s->num_ports;
+            mb();
+            *nf10ring_rx_dne_entry(s->host_rx_dne_buf, index) =
+                s->pkt_len + ((0x0200ULL << (2*port)) << 16);
+            rx_rd = (rx_rd + 64) & DSC_MASK;
+            rx_gen++;
+            work = 1;
+        }
+
+        if(work){
+            // pairs with the re-check in sim_poll
+            mb();
+            if(s->irq_enabled && !s->irq_pending){
+                s->irq_pending = 1;
+                s->irqs++;
+            }
+        }
+        else
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void sim_irq_enable(struct sim *s, int enable){
+    mb();
+    s->irq_enabled = enable;
+    mb();
+}
+
+// nf10priv_poll; returns the work done, or budget if it rescheduled itself
+static int sim_poll(struct sim *s){
+    uint64_t index, rx_int;
+    int work_done = 0;
+    int port;
+
+    while(nf10ring_tx_dne_valid(s->host_tx_dne_buf, &s->host_tx_dne)){
+        index = nf10ring_dne_next(&s->host_tx_dne);
+        s->tx_cleaned[s->tx_bk_port[index]]++;
+        nf10ring_release(&s->mem_tx_dsc, &s->mem_tx_pkt, s->tx_bk_size[index]);
+        *nf10ring_tx_dne_entry(s->host_tx_dne_buf, index) = 0xffffffff;
+    }
+    mb();
+    if(s->tx_stopped && nf10ring_has_room(&s->mem_tx_dsc, &s->mem_tx_pkt, 8, 4*NF10_MAX_PKT_CL))
+        __sync_fetch_and_and(&s->tx_stopped, 0);
+
+    while(work_done < s->budget && nf10ring_rx_dne_valid(s->host_rx_dne_buf, &s->host_rx_dne)){
+        index = nf10ring_dne_next(&s->host_rx_dne);
+        rx_int = *nf10ring_rx_dne_entry(s->host_rx_dne_buf, index);
+        *nf10ring_rx_dne_entry(s->host_rx_dne_buf, index) = 0xffffffffffffffffULL;
+        nf10ring_release(&s->mem_rx_dsc, &s->mem_rx_pkt, s->rx_bk_size[index]);
+        sim_send_rx_dsc(s);
+
+        port = nf10ring_port_decode((rx_int >> 16) & 0xffff);
+        if((rx_int & 0xffff) != s->pkt_len || port < 0 || port >= s->num_ports)
+            s->bad++;
+        else
+            s->rx_received[port]++;
+        work_done++;
+    }
+
+    if(work_done < s->budget){
+        sim_irq_enable(s, 1);
+        if(nf10ring_tx_dne_valid(s->host_tx_dne_buf, &s->host_tx_dne) ||
+           nf10ring_rx_dne_valid(s->host_rx_dne_buf, &s->host_rx_dne)){
+            sim_irq_enable(s, 0);
+            return s->budget;
+        }
+    }
+
+    return work_done;
+}
+
+static int sim_finished(struct sim *s){
+    int i;
+
+    for(i = 0; i < s->num_ports; i++){
+        if(s->tx_cleaned[i] < s->num_pkts || s->rx_received[i] < s->num_pkts)
+            return 0;
+    }
+    return 1;
+}
+
+// Runs one configuration and returns the number of errors found.
+static uint64_t run(int num_ports, int budget, uint64_t num_pkts, uint32_t pkt_len){
+    static struct sim s;
+    pthread_t card_tid;
+    uint64_t start, elapsed, errors, full = 0, stops = 0;
+    int i;
+
+    memset(&s, 0, sizeof(s));
+    s.num_ports = num_ports;
+    s.budget = budget;
+    s.num_pkts = num_pkts;
+    s.pkt_len = pkt_len;
+
+    nf10mem_init(&s.mem_tx_dsc, DSC_MASK);
+    nf10mem_init(&s.mem_tx_pkt, PKT_MASK);
+    nf10mem_init(&s.mem_rx_dsc, DSC_MASK);
+    nf10mem_init(&s.mem_rx_pkt, PKT_MASK);
+    nf10mem_init(&s.host_tx_dne, DSC_MASK);
+    nf10mem_init(&s.host_rx_dne, DSC_MASK);
+    spin_lock_init(&s.tx_ring_lock);
+    spin_lock_init(&s.rx_ring_lock);
+
+    for(i = 0; i < s.host_tx_dne.cl_size; i++)
+        *nf10ring_tx_dne_entry(s.host_tx_dne_buf, i) = 0xffffffff;
+    for(i = 0; i < s.host_rx_dne.cl_size; i++)
+        *nf10ring_rx_dne_entry(s.host_rx_dne_buf, i) = 0xffffffffffffffffULL;
+
+    // as nf10iface_probe does
+    for(i = 0; i < s.mem_rx_dsc.cl_size-2; i++)
+        sim_send_rx_dsc(&s);
+    s.irq_enabled = 1;
+
+    start = now_nsec();
+    pthread_create(&card_tid, NULL, card_main, &s);
+    for(i = 0; i < num_ports; i++){
+        s.port[i].sim = &s;
+        s.port[i].port = i;
+        pthread_create(&s.port[i].tid, NULL, port_main, &s.port[i]);
+    }
+
+    // interrupt handler + NAPI
+    while(!sim_finished(&s)){
+        if(!s.irq_pending){
+            sched_yield();
+            continue;
+        }
+        sim_irq_enable(&s, 0);
+        s.irq_pending = 0;
+
+        do{
+            s.polls++;
+        } while(sim_poll(&s) == budget);
+    }
+    elapsed = now_nsec() - start;
+
+    s.done = 1;
+    pthread_join(card_tid, NULL);
+    for(i = 0; i < num_ports; i++){
+        pthread_join(s.port[i].tid, NULL);
+        full += s.port[i].full;
+        stops += s.port[i].stops;
+    }
+
+    errors = s.bad;
+    for(i = 0; i < num_ports; i++){
+        if(s.tx_cleaned[i] != num_pkts || s.rx_received[i] != num_pkts)
+            errors++;
+    }
+
+    printf("ports %d budget %3d: TX %6.3f Mpps RX %6.3f Mpps  %8llu irqs %8llu polls "
+           "%5.1f pkts/poll  %llu full %llu stops  %llu errors\n",
+           num_ports, budget,
+           num_pkts * num_ports * 1000.0 / elapsed, num_pkts * num_ports * 1000.0 / elapsed,
+           (unsigned long long)s.irqs, (unsigned long long)s.polls,
+           (double)num_pkts * num_ports / s.polls,
+           (unsigned long long)full, (unsigned long long)stops,
+           (unsigned long long)errors);
+
+    return errors;
+}
+
+int main(int argc, char **argv){
+    static const int matrix_ports[] = {1, 2, 4};
+    static const int matrix_budget[] = {8, 64};
+    uint64_t num_pkts = 100000, errors = 0;
+    uint32_t pkt_len = 60;
+    int num_ports = 0, budget = 0;
+    int c, i, j;
+
+    while((c = getopt(argc, argv, "p:b:n:s:")) != -1){
+        switch(c){
+        case 'p': num_ports = atoi(optarg); break;
+        case 'b': budget = atoi(optarg); break;
+        case 'n': num_pkts = strtoull(optarg, NULL, 0); break;
+        case 's': pkt_len = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p ports] [-b budget] [-n packets] [-s size]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(num_ports < 0 || num_ports > NF10_NUM_PORTS || budget < 0 ||
+       pkt_len < 60 || pkt_len > 1514){
+        fprintf(stderr, "%s: need 1-%d ports, a positive budget and 60-1514 byte packets\n",
+                argv[0], NF10_NUM_PORTS);
+        return 1;
+    }
+
+    printf("%llu packets of %u bytes per port in each direction\n",
+           (unsigned long long)num_pkts, pkt_len);
+
+    for(i = 0; i < sizeof(matrix_ports)/sizeof(matrix_ports[0]); i++){
+        if(num_ports && i > 0)
+            break;
+        for(j = 0; j < sizeof(matrix_budget)/sizeof(matrix_budget[0]); j++){
+            if(budget && j > 0)
+                break;
+            errors += run(num_ports ? num_ports : matrix_ports[i],
+                          budget ? budget : matrix_budget[j], num_pkts, pkt_len);
+        }
+    }
+
+    printf("%s (%llu errors)\n", errors ? "FAILED" : "PASSED", (unsigned long long)errors);
+    return errors ? 1 : 0;
+}
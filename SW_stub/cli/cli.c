@@ -13,6 +13,7 @@
 #include "../sr_base_internal.h" /* struct sr_instance                */
 #include "../sr_common.h"        /* ...                               */
 #include "../sr_router.h"        /* router_*()                        */
+#include "lwip/stats.h"          /* stats_memp_to_string()            */
 
 /** whether to shutdown the server or not */
 static bool router_shutdown;
@@ -183,6 +184,7 @@ void cli_show_hw() {
     cli_show_hw_arp();
     cli_show_hw_intf();
     cli_show_hw_route();
+    cli_show_hw_stats();
 }
 
 void cli_show_hw_about() {
@@ -202,6 +204,19 @@ void cli_show_hw_intf() {
 
 void cli_show_hw_route() {
 }
+
+void cli_show_hw_stats() {
+    char buf[STR_HW_STATS_MAX_LEN + STR_DECAP_MAX_LEN + STR_ENCAP_MAX_LEN];
+    hw_stats_to_string( &ROUTER->hw_stats, buf, STR_HW_STATS_MAX_LEN );
+    cli_send_str( buf );
+    cli_send_str( "Decapsulation (CPU path):\n" );
+    pthread_rwlock_rdlock( &ROUTER->decap_lock );
+    decap_to_string( &ROUTER->decap, buf, STR_DECAP_MAX_LEN );
+    pthread_rwlock_unlock( &ROUTER->decap_lock );
+    cli_send_str( buf );
+    cli_send_str( "Encapsulation (CPU path):\n" );
+    cli_show_ip_tunnel();
+}
 #endif
 
 void cli_show_ip() {
@@ -212,12 +227,50 @@ void cli_show_ip() {
 }
 
 void cli_show_ip_arp() {
+    char* buf;
+    int len;
+
+    pthread_rwlock_rdlock( &ROUTER->arp_lock );
+    len = STR_ARP_MAX_LEN( &ROUTER->arp );
+    buf = malloc_or_die( len );
+    arp_to_string( &ROUTER->arp, router_now_ms(), buf, len );
+    pthread_rwlock_unlock( &ROUTER->arp_lock );
+
+    cli_send_str( buf );
+    free( buf );
 }
 
 void cli_show_ip_intf() {
 }
 
 void cli_show_ip_route() {
+    char* buf;
+    int len;
+
+    pthread_rwlock_rdlock( &ROUTER->fib_lock );
+    len = STR_FIB_MAX_LEN( &ROUTER->fib );
+    buf = malloc_or_die( len );
+    fib_to_string( &ROUTER->fib, buf, len );
+    pthread_rwlock_unlock( &ROUTER->fib_lock );
+
+    cli_send_str( buf );
+    free( buf );
+}
+
+void cli_show_ip_stats() {
+    char buf[STATS_MEMP_STR_MAX_LEN];
+    stats_memp_to_string( buf, STATS_MEMP_STR_MAX_LEN );
+    cli_send_str( buf );
+}
+
+void cli_show_ip_tunnel() {
+    char buf[STR_ENCAP_MAX_LEN];
+
+    pthread_rwlock_rdlock( &ROUTER->encap_lock );
+    encap_to_string( &ROUTER->encap, buf, STR_ENCAP_MAX_LEN );
+    pthread_rwlock_unlock( &ROUTER->encap_lock );
+
+    cli_send_str( buf );
 }
 
 void cli_show_opt() {
@@ -240,9 +293,51 @@ void cli_show_ospf() {
 }
 
 void cli_show_ospf_neighbors() {
+    char* buf;
+    uint64_t now_ms;
+    unsigned i;
+    int len;
+
+    buf = malloc_or_die( STR_INTF_NEIGHBOR_HDR_MAX_LEN );
+    intf_neighbor_header_to_string( buf, STR_INTF_NEIGHBOR_HDR_MAX_LEN );
+    cli_send_str( buf );
+    free( buf );
+
+    now_ms = router_now_ms();
+    for( i=0; i<ROUTER->num_interfaces; i++ ) {
+        pthread_mutex_lock( &ROUTER->ospf_lock );
+        len = STR_INTF_NEIGHBOR_MAX_LEN( &ROUTER->interface[i] );
+        buf = malloc_or_die( len );
+        intf_neighbor_to_string( &ROUTER->interface[i], now_ms, buf, len );
+        pthread_mutex_unlock( &ROUTER->ospf_lock );
+
+        cli_send_str( buf );
+        free( buf );
+    }
 }
 
 void cli_show_ospf_topo() {
+    char* buf;
+    int len, n;
+
+    pthread_mutex_lock( &ROUTER->ospf_lock );
+    len = STR_LSDB_MAX_LEN( &ROUTER->lsdb );
+    buf = malloc_or_die( len );
+    lsdb_to_string( &ROUTER->lsdb, buf, len );
+    pthread_mutex_unlock( &ROUTER->ospf_lock );
+
+    cli_send_str( buf );
+    free( buf );
+
+    len = STR_SPF_THROTTLE_MAX_LEN + STR_FLOOD_MAX_LEN;
+    buf = malloc_or_die( len );
+    pthread_mutex_lock( &ROUTER->ospf_lock );
+    n = spf_throttle_to_string( &ROUTER->spf_throttle, buf, len );
+    flood_to_string( &ROUTER->flood, buf + n, len - n );
+    pthread_mutex_unlock( &ROUTER->ospf_lock );
+
+    cli_send_str( buf );
+    free( buf );
 }
 
 #ifndef _VNS_MODE_
@@ -291,18 +386,48 @@ void cli_show_vns_vhost() {
 #endif
 
 void cli_manip_ip_arp_add( gross_arp_t* data ) {
+    pthread_rwlock_wrlock( &ROUTER->arp_lock );
+    arp_add_static( &ROUTER->arp, data->ip, data->mac );
+    pthread_rwlock_unlock( &ROUTER->arp_lock );
 }
 
 void cli_manip_ip_arp_del( gross_arp_t* data ) {
+    char str_ip[STRLEN_IP];
+    bool found;
+
+    pthread_rwlock_wrlock( &ROUTER->arp_lock );
+    found = arp_remove( &ROUTER->arp, data->ip );
+    pthread_rwlock_unlock( &ROUTER->arp_lock );
+
+    if( !found ) {
+        ip_to_string( str_ip, data->ip );
+        cli_send_strs( 2, str_ip, " is not in the ARP cache\n" );
+    }
+}
+
+/** Purges the static and/or dynamic ARP entries and says how many went. */
+static void cli_manip_ip_arp_purge( bool purge_static, bool purge_dynamic ) {
+    char buf[32];
+    unsigned n;
+
+    pthread_rwlock_wrlock( &ROUTER->arp_lock );
+    n = arp_purge( &ROUTER->arp, purge_static, purge_dynamic );
+    pthread_rwlock_unlock( &ROUTER->arp_lock );
+
+    snprintf( buf, sizeof(buf), "%u entries removed\n", n );
+    cli_send_str( buf );
 }
 
 void cli_manip_ip_arp_purge_all() {
+    cli_manip_ip_arp_purge( TRUE, TRUE );
 }
 
 void cli_manip_ip_arp_purge_dyn() {
+    cli_manip_ip_arp_purge( FALSE, TRUE );
 }
 
 void cli_manip_ip_arp_purge_sta() {
+    cli_manip_ip_arp_purge( TRUE, FALSE );
 }
 
 void cli_manip_ip_intf_set( gross_intf_t* data ) {
@@ -350,6 +475,103 @@ void cli_manip_ip_route_purge_dyn() {
 void cli_manip_ip_route_purge_sta() {
 }
 
+void cli_manip_ip_tunnel_add( gross_tunnel_t* data ) {
+    interface_t* intf;
+    addr_ip_t src_ip;
+    addr_mac_t src_mac;
+    int ret;
+
+    intf = router_lookup_interface_via_name( ROUTER, data->intf_name );
+    if( !intf ) {
+        cli_send_strs( 2, data->intf_name, " is not a valid interface\n" );
+        return;
+    }
+
+    pthread_mutex_lock( &ROUTER->intf_lock );
+    src_ip = intf->ip;
+    src_mac = intf->mac;
+    pthread_mutex_unlock( &ROUTER->intf_lock );
+
+    /* the outer header carries what the hardware defaults to */
+    pthread_rwlock_wrlock( &ROUTER->encap_lock );
+    ret = encap_set_tunnel( &ROUTER->encap, intf - ROUTER->interface,
+                            src_mac, data->remote_mac, src_ip, data->remote_ip,
+                            ENCAP_DEFAULT_PROTO, ENCAP_DEFAULT_TTL, 0 );
+    pthread_rwlock_unlock( &ROUTER->encap_lock );
+
+    if( ret != 0 )
+        cli_send_strs( 2, data->intf_name, " cannot have a tunnel\n" );
+}
+
+void cli_manip_ip_tunnel_del( gross_tunnel_t* data ) {
+    interface_t* intf;
+
+    intf = router_lookup_interface_via_name( ROUTER, data->intf_name );
+    if( !intf ) {
+        cli_send_strs( 2, data->intf_name, " is not a valid interface\n" );
+        return;
+    }
+
+    pthread_rwlock_wrlock( &ROUTER->encap_lock );
+    encap_clear_tunnel( &ROUTER->encap, intf - ROUTER->interface );
+    pthread_rwlock_unlock( &ROUTER->encap_lock );
+}
+
+void cli_manip_ip_decap_add( gross_decap_t* data ) {
+#ifdef _CPUMODE_
+    interface_t* intf;
+    decap_inner_t inner;
+    int ret;
+
+    if( data->proto < 0 || data->proto > 255 ) {
+        cli_send_str( "the protocol must be between 0 and 255\n" );
+        return;
+    }
+
+    if( !data->inner_name || !strcmp( data->inner_name, "ip" ) )
+        inner = DECAP_INNER_IP;
+    else if( !strcmp( data->inner_name, "eth" ) )
+        inner = DECAP_INNER_ETH;
+    else {
+        cli_send_strs( 2, data->inner_name, " is not a payload type (eth or ip)\n" );
+        return;
+    }
+
+    intf = router_lookup_interface_via_name( ROUTER, data->intf_name );
+    if( !intf ) {
+        cli_send_strs( 2, data->intf_name, " is not a valid interface\n" );
+        return;
+    }
+
+    /* accepted on every port, like the defaults sr_integ_hw_setup() adds */
+    pthread_rwlock_wrlock( &ROUTER->decap_lock );
+    decap_remove_tunnel( &ROUTER->decap, data->proto, data->remote_ip );
+    ret = decap_add_tunnel( &ROUTER->decap, data->proto, data->remote_ip, ~0U,
+                            inner, intf );
+    pthread_rwlock_unlock( &ROUTER->decap_lock );
+
+    if( ret < 0 )
+        cli_send_str( "the decapsulation table is full\n" );
+#else
+    cli_send_no_hw_str();
+#endif
+}
+
+void cli_manip_ip_decap_del( gross_decap_t* data ) {
+#ifdef _CPUMODE_
+    int ret;
+
+    pthread_rwlock_wrlock( &ROUTER->decap_lock );
+    ret = decap_remove_tunnel( &ROUTER->decap, data->proto, data->remote_ip );
+    pthread_rwlock_unlock( &ROUTER->decap_lock );
+
+    if( ret != 0 )
+        cli_send_str( "no such tunnel is terminated\n" );
+#else
+    cli_send_no_hw_str();
+#endif
+}
+
 void cli_date() {
     char str_time[STRLEN_TIME];
     struct timeval now;
@@ -405,6 +627,32 @@ void cli_ping_flood( gross_ip_int_t* data ) {
     skip_next_prompt = TRUE;
 }
 
+/** Returns the name sr is known by. */
+static const char* cli_router_name( struct sr_instance* sr ) {
+#ifdef MININET_MODE
+    return sr->router_name;
+#else
+    return sr->vhost;
+#endif
+}
+
+void cli_router( gross_router_t* data ) {
+#ifdef _STANDALONE_CLI_
+    cli_send_str( "the standalone CLI has only one router\n" );
+#else
+    struct sr_instance* sr = sr_get_instance( data->name );
+
+    if( sr )
+        sr_get_global_instance( sr ); /* this client's thread serves sr now */
+    else
+        cli_send_strs( 2, data->name, " is not a router in this process\n" );
+#endif
+}
+
+void cli_router_show() {
+    cli_send_strs( 3, "Router: ", cli_router_name( SR ), "\n" );
+}
+
 void cli_shutdown() {
     cli_send_str( "Shutting down the router ...\n" );
     router_shutdown = TRUE;
@@ -42,6 +42,23 @@ typedef struct {
     const char* intf_name;
 } gross_route_t;
 
+typedef struct {
+    const char* intf_name;
+    addr_ip_t remote_ip;
+    addr_mac_t remote_mac;
+} gross_tunnel_t;
+
+typedef struct {
+    int proto;
+    addr_ip_t remote_ip;
+    const char* intf_name;
+    const char* inner_name; /* NULL for the default */
+} gross_decap_t;
+
+typedef struct {
+    const char* name;
+} gross_router_t;
+
 typedef struct {
     addr_ip_t ip;
 } gross_ip_t;
@@ -95,18 +112,22 @@ void cli_show_all();
 #   define cli_show_hw_arp   cli_send_no_hw_str
 #   define cli_show_hw_intf  cli_send_no_hw_str
 #   define cli_show_hw_route cli_send_no_hw_str
+#   define cli_show_hw_stats cli_send_no_hw_str
 #else
     void cli_show_hw();
     void cli_show_hw_about();
     void cli_show_hw_arp();
     void cli_show_hw_intf();
     void cli_show_hw_route();
+    void cli_show_hw_stats();
 #endif
 
 void cli_show_ip();
 void cli_show_ip_arp();
 void cli_show_ip_intf();
 void cli_show_ip_route();
+void cli_show_ip_stats();
+void cli_show_ip_tunnel();
 
 void cli_show_opt();
 void cli_show_opt_verbose();
@@ -142,6 +163,12 @@ void cli_manip_ip_route_purge_all();
 void cli_manip_ip_route_purge_dyn();
 void cli_manip_ip_route_purge_sta();
 
+void cli_manip_ip_tunnel_add( gross_tunnel_t* data );
+void cli_manip_ip_tunnel_del( gross_tunnel_t* data );
+
+void cli_manip_ip_decap_add( gross_decap_t* data );
+void cli_manip_ip_decap_del( gross_decap_t* data );
+
 /* Display the current date and time. */
 void cli_date();
 
@@ -152,6 +179,12 @@ void cli_exit();
 void cli_ping( gross_ip_t* data );
 void cli_ping_flood( gross_ip_int_t* data );
 
+/** Directs this client's later commands at the router named name. */
+void cli_router( gross_router_t* data );
+
+/** Shows which router this client's commands are directed at. */
+void cli_router_show();
+
 /** Processes a shutdown command from a client. */
 void cli_shutdown();
 
@@ -48,13 +48,14 @@ HELP_SHOW_VNS );
 
           case HELP_SHOW_HW:
               return cli_send_multi_help( fd, "\
-show <hw | hardware | cpu> [arp, interface (intf), route (rt),]: display \n\
+show <hw | hardware | cpu> [arp, interface (intf), route (rt), stats]: display \n\
 information about the router's HW state\n",
-4,
+5,
 HELP_SHOW_HW_ABOUT,
 HELP_SHOW_HW_ARP,
 HELP_SHOW_HW_INTF,
-HELP_SHOW_HW_ROUTE );
+HELP_SHOW_HW_ROUTE,
+HELP_SHOW_HW_STATS );
 
            case HELP_SHOW_HW_ABOUT:
                 return 0==writenstr( fd, "\
@@ -72,14 +73,21 @@ show hw interface: displays the HW's information about its interfaces\n" );
                 return 0==writenstr( fd, "\
 show hw route: displays the HW routing table\n" );
 
+           case HELP_SHOW_HW_STATS:
+                return 0==writenstr( fd, "\
+show hw stats: displays the HW counters and their rates (sampled periodically)\n\
+  and the CPU path decapsulation and encapsulation counters\n" );
+
           case HELP_SHOW_IP:
               return cli_send_multi_help( fd, "\
-show ip [arp, interface (intf), route (rt),]: display information about the\n\
-  router's IP state\n",
-3,
+show ip [arp, interface (intf), route (rt), stats, tunnel]: display information\n\
+  about the router's IP state\n",
+5,
 HELP_SHOW_IP_ARP,
 HELP_SHOW_IP_INTF,
-HELP_SHOW_IP_ROUTE );
+HELP_SHOW_IP_ROUTE,
+HELP_SHOW_IP_STATS,
+HELP_SHOW_IP_TUNNEL );
 
            case HELP_SHOW_IP_ARP:
                 return 0==writenstr( fd, "\
@@ -93,6 +101,16 @@ show ip interface: displays the router's interfaces\n" );
                 return 0==writenstr( fd, "\
 show ip route: displays the routing table sorted by longest prefixes first\n" );
 
+           case HELP_SHOW_IP_STATS:
+                return 0==writenstr( fd, "\
+show ip stats: displays the use of the TCP stack's memory pools and how often\n\
+  allocations from them were served by a thread's cache\n" );
+
+           case HELP_SHOW_IP_TUNNEL:
+                return 0==writenstr( fd, "\
+show ip tunnel: displays the tunnels frames are encapsulated in on output and\n\
+  how many frames each has carried\n" );
+
           case HELP_SHOW_OPT:
               return cli_send_multi_help( fd, "\
 show opt [verbose]: display information about options' current values\n",
@@ -155,12 +173,15 @@ show vns vhost: displays the VNS virtual host address\n" );
 
           case HELP_MANIP_IP:
             return cli_send_multi_help( fd, "\
-ip [arp | interface (intf) | ospf | route (rt)] <command>: update the router's state\n",
-4,
+ip [arp | interface (intf) | ospf | route (rt) | tunnel | decap] <command>:\n\
+  update the router's state\n",
+6,
 HELP_MANIP_IP_ARP,
 HELP_MANIP_IP_INTF,
 HELP_MANIP_IP_OSPF,
-HELP_MANIP_IP_ROUTE );
+HELP_MANIP_IP_ROUTE,
+HELP_MANIP_IP_TUNNEL,
+HELP_MANIP_IP_DECAP );
 
            case HELP_MANIP_IP_ARP:
                return cli_send_multi_help( fd, "\
@@ -263,13 +284,51 @@ ip route purge <dyn|dynamic>: remove all dynamic routes in the routing table\n"
                  return 0==writenstr( fd, "\
 ip route purge <sta|static>: remove all static routes in the routing table\n" );
 
+           case HELP_MANIP_IP_TUNNEL:
+               return cli_send_multi_help( fd, "\
+ip tunnel {add | del} [<options>]: modify the tunnels frames are sent in\n",
+2,
+HELP_MANIP_IP_TUNNEL_ADD,
+HELP_MANIP_IP_TUNNEL_DEL );
+
+             case HELP_MANIP_IP_TUNNEL_ADD:
+                 return 0==writenstr( fd, "\
+ip tunnel add <interface name> <remote IP> <remote MAC>: encapsulate every frame\n\
+  sent out of <interface name> in an IP packet from the interface to <remote IP>,\n\
+  sent to <remote MAC> (replaces any tunnel the interface had)\n" );
+
+             case HELP_MANIP_IP_TUNNEL_DEL:
+                 return 0==writenstr( fd, "\
+ip tunnel del <interface name>: stop encapsulating frames sent out of\n\
+  <interface name>\n" );
+
+           case HELP_MANIP_IP_DECAP:
+               return cli_send_multi_help( fd, "\
+ip decap {add | del} [<options>]: modify the tunnels terminated on the CPU path\n",
+2,
+HELP_MANIP_IP_DECAP_ADD,
+HELP_MANIP_IP_DECAP_DEL );
+
+             case HELP_MANIP_IP_DECAP_ADD:
+                 return 0==writenstr( fd, "\
+ip decap add <protocol> <remote IP> <interface name> [eth | ip]: strip the outer\n\
+  header from IP packets of <protocol> arriving from <remote IP> (0.0.0.0 for\n\
+  any) and send the payload, an Ethernet frame or an IP packet (the default),\n\
+  out of <interface name> (replaces any such tunnel)\n" );
+
+             case HELP_MANIP_IP_DECAP_DEL:
+                 return 0==writenstr( fd, "\
+ip decap del <protocol> <remote IP>: stop terminating the tunnel of <protocol>\n\
+  from <remote IP>\n" );
+
 
         case HELP_ACTION:
             return cli_send_multi_help( fd, "",
-5, /* intentionally omitting HELP_ACTION_HELP */
+6, /* intentionally omitting HELP_ACTION_HELP */
 HELP_ACTION_DATE,
 HELP_ACTION_EXIT,
 HELP_ACTION_PING,
+HELP_ACTION_ROUTER,
 HELP_ACTION_SHUTDOWN,
 HELP_ACTION_TRACE );
 
@@ -304,6 +363,12 @@ Available Commands:\n\
               return 0==writenstr( fd, "\
 sping <dest IP>: send an ICMP Echo Request to <dest IP>\n" );
 
+          case HELP_ACTION_ROUTER:
+              return 0==writenstr( fd, "\
+router [<name>]: direct the rest of this session's commands at the router named\n\
+  <name> when this process hosts several routers (without <name>, show which\n\
+  router they are directed at)\n" );
+
           case HELP_ACTION_SHUTDOWN:
               return 0==writenstr( fd, "\
 shutdown: power off the router\n" );
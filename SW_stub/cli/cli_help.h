@@ -18,10 +18,13 @@ typedef enum cli_help_t {
        HELP_SHOW_HW_ARP,
        HELP_SHOW_HW_INTF,
        HELP_SHOW_HW_ROUTE,
+       HELP_SHOW_HW_STATS,
       HELP_SHOW_IP,
        HELP_SHOW_IP_ARP,
        HELP_SHOW_IP_INTF,
        HELP_SHOW_IP_ROUTE,
+       HELP_SHOW_IP_STATS,
+       HELP_SHOW_IP_TUNNEL,
       HELP_SHOW_OPT,
        HELP_SHOW_OPT_VERBOSE,
       HELP_SHOW_OSPF,
@@ -55,12 +58,19 @@ typedef enum cli_help_t {
          HELP_MANIP_IP_ROUTE_PURGE_ALL,
          HELP_MANIP_IP_ROUTE_PURGE_DYN,
          HELP_MANIP_IP_ROUTE_PURGE_STA,
+       HELP_MANIP_IP_TUNNEL,
+         HELP_MANIP_IP_TUNNEL_ADD,
+         HELP_MANIP_IP_TUNNEL_DEL,
+       HELP_MANIP_IP_DECAP,
+         HELP_MANIP_IP_DECAP_ADD,
+         HELP_MANIP_IP_DECAP_DEL,
 
     HELP_ACTION,
       HELP_ACTION_DATE,
       HELP_ACTION_EXIT,
       HELP_ACTION_HELP,
       HELP_ACTION_PING,
+      HELP_ACTION_ROUTER,
       HELP_ACTION_SHUTDOWN,
       HELP_ACTION_TRACE,
 
@@ -38,6 +38,7 @@ char token_err[128];
 #define ERR_IP    ERR("expected IP address")
 #define ERR_MAC   ERR("expected MAC address")
 #define ERR_INTF  ERR("expected interface name")
+#define ERR_INT   ERR("expected number")
 #define ERR_NO_USAGE(desc) parse_error(desc); meh_force = TRUE; meh_has_usage = FALSE; meh_ignore = FALSE;
 #define ERR_IGNORE meh_ignore = TRUE;
 
@@ -49,6 +50,9 @@ gross_object_t gobj;
 gross_arp_t garp;
 gross_intf_t gintf;
 gross_route_t grt;
+gross_tunnel_t gtun;
+gross_decap_t gdec;
+gross_router_t grtr;
 gross_ip_t gip;
 gross_ip_int_t giip;
 gross_option_t gopt;
@@ -60,6 +64,11 @@ gross_option_t gopt;
 #define SETC_INTF_SET(func,name,xip,sm) SETC_INTF(func,name); gintf.ip=xip; gintf.subnet_mask=sm
 #define SETC_RT(func,xdest,xmask) SETC_FUNC1(func); gobj.data=&grt; grt.dest=xdest; grt.mask=xmask
 #define SETC_RT_ADD(func,dest,xgw,mask,intf) SETC_RT(func,dest,mask); grt.gw=xgw; grt.intf_name=intf
+#define SETC_TUN(func,name) SETC_FUNC1(func); gobj.data=&gtun; gtun.intf_name=name
+#define SETC_TUN_ADD(func,name,xip,xmac) SETC_TUN(func,name); gtun.remote_ip=xip; gtun.remote_mac=xmac
+#define SETC_DEC(func,xproto,xip) SETC_FUNC1(func); gobj.data=&gdec; gdec.proto=xproto; gdec.remote_ip=xip
+#define SETC_DEC_ADD(func,proto,ip,intf,xinner) SETC_DEC(func,proto,ip); gdec.intf_name=intf; gdec.inner_name=xinner
+#define SETC_ROUTER(func,xname) SETC_FUNC1(func); gobj.data=&grtr; grtr.name=xname
 #define SETC_IP(func,xip) SETC_FUNC1(func); gobj.data=&gip; gip.ip=xip
 #define SETC_IP_INT(func,xip,xn) SETC_FUNC1(func); gobj.data=&giip; giip.ip=xip; giip.count=xn
 #define SETC_OPT(func) SETC_FUNC1(func); gobj.data=&gopt
@@ -88,9 +97,9 @@ static void run_command();
 /* Terminals with no attribute value */
 %token  T_SHOW T_QUESTION T_NEWLINE T_ALL
 %token  T_VNS T_USER T_SERVER T_VHOST T_LHOST T_TOPOLOGY
-%token  T_IP T_ROUTE T_INTF T_ARP T_OSPF T_HW T_NEIGHBORS
-%token  T_ADD T_DEL T_UP T_DOWN T_PURGE T_STATIC T_DYNAMIC T_ABOUT
-%token  T_PING T_TRACE T_HELP T_EXIT T_SHUTDOWN T_FLOOD
+%token  T_IP T_ROUTE T_INTF T_ARP T_OSPF T_HW T_NEIGHBORS T_TUNNEL T_DECAP
+%token  T_ADD T_DEL T_UP T_DOWN T_PURGE T_STATIC T_DYNAMIC T_ABOUT T_STATS
+%token  T_PING T_TRACE T_HELP T_EXIT T_SHUTDOWN T_FLOOD T_ROUTER
 %token  T_SET T_UNSET T_OPTION T_VERBOSE T_DATE
 
 /* Terminals which evaluate to some attribute value */
@@ -133,6 +142,8 @@ ShowTypeHW : /* empty: show all */                { SETC_FUNC0(cli_show_hw); }
            | T_INTF TMIorQ                        { HELP(HELP_SHOW_HW_INTF); }
            | T_ROUTE                              { SETC_FUNC0(cli_show_hw_route); }
            | T_ROUTE TMIorQ                       { HELP(HELP_SHOW_HW_ROUTE); }
+           | T_STATS                              { SETC_FUNC0(cli_show_hw_stats); }
+           | T_STATS TMIorQ                       { HELP(HELP_SHOW_HW_STATS); }
            | WrongOrQ                             { HELP(HELP_SHOW_HW); }
            ;
 
@@ -143,6 +154,10 @@ ShowTypeIP : /* empty: show all */                { SETC_FUNC0(cli_show_ip); }
            | T_INTF TMIorQ                        { HELP(HELP_SHOW_IP_INTF); }
            | T_ROUTE                              { SETC_FUNC0(cli_show_ip_route); }
            | T_ROUTE TMIorQ                       { HELP(HELP_SHOW_IP_ROUTE); }
+           | T_STATS                              { SETC_FUNC0(cli_show_ip_stats); }
+           | T_STATS TMIorQ                       { HELP(HELP_SHOW_IP_STATS); }
+           | T_TUNNEL                             { SETC_FUNC0(cli_show_ip_tunnel); }
+           | T_TUNNEL TMIorQ                      { HELP(HELP_SHOW_IP_TUNNEL); }
            | WrongOrQ                             { HELP(HELP_SHOW_IP); }
            ;
 
@@ -183,6 +198,8 @@ ManipTypeIP : T_ARP ManipTypeIPARP
             | T_INTF ManipTypeIPInterface
             | T_OSPF ManipTypeIPOSPF
             | T_ROUTE ManipTypeIPRoute
+            | T_TUNNEL ManipTypeIPTunnel
+            | T_DECAP ManipTypeIPDecap
             ;
 
 ManipTypeIPARP : WrongOrQ                         { HELP(HELP_MANIP_IP_ARP); }
@@ -253,10 +270,54 @@ RouteDelOrQ : HelpOrQ                             { HELP(HELP_MANIP_IP_ROUTE_DEL
             | TAV_IP TAV_IP TMIorQ                { HELP(HELP_MANIP_IP_ROUTE_DEL); }
             ;
 
+ManipTypeIPTunnel : WrongOrQ                      { HELP(HELP_MANIP_IP_TUNNEL); }
+                  | T_ADD TunnelAddOrQ
+                  | T_DEL TunnelDelOrQ
+                  ;
+
+TunnelAddOrQ : HelpOrQ                             { HELP(HELP_MANIP_IP_TUNNEL_ADD); }
+             | {ERR_INTF} error                    { HELP(HELP_MANIP_IP_TUNNEL_ADD); }
+             | TAV_STR {ERR_IP} error              { HELP(HELP_MANIP_IP_TUNNEL_ADD); }
+             | TAV_STR TAV_IP {ERR_MAC} error      { HELP(HELP_MANIP_IP_TUNNEL_ADD); }
+             | TAV_STR TAV_IP TAV_MAC              { SETC_TUN_ADD(cli_manip_ip_tunnel_add,$1,$2,$3); }
+             | TAV_STR TAV_IP TAV_MAC TMIorQ       { HELP(HELP_MANIP_IP_TUNNEL_ADD); }
+             ;
+
+TunnelDelOrQ : HelpOrQ                             { HELP(HELP_MANIP_IP_TUNNEL_DEL); }
+             | {ERR_INTF} error                    { HELP(HELP_MANIP_IP_TUNNEL_DEL); }
+             | TAV_STR                             { SETC_TUN(cli_manip_ip_tunnel_del,$1); }
+             | TAV_STR TMIorQ                      { HELP(HELP_MANIP_IP_TUNNEL_DEL); }
+             ;
+
+ManipTypeIPDecap : WrongOrQ                       { HELP(HELP_MANIP_IP_DECAP); }
+                 | T_ADD DecapAddOrQ
+                 | T_DEL DecapDelOrQ
+                 ;
+
+DecapAddOrQ : HelpOrQ                               { HELP(HELP_MANIP_IP_DECAP_ADD); }
+            | {ERR_INT} error                       { HELP(HELP_MANIP_IP_DECAP_ADD); }
+            | TAV_INT {ERR_IP} error                { HELP(HELP_MANIP_IP_DECAP_ADD); }
+            | TAV_INT TAV_IP {ERR_INTF} error       { HELP(HELP_MANIP_IP_DECAP_ADD); }
+            | TAV_INT TAV_IP TAV_STR                { SETC_DEC_ADD(cli_manip_ip_decap_add,$1,$2,$3,NULL); }
+            | TAV_INT TAV_IP TAV_STR T_IP           { SETC_DEC_ADD(cli_manip_ip_decap_add,$1,$2,$3,"ip"); }
+            | TAV_INT TAV_IP TAV_STR TAV_STR        { SETC_DEC_ADD(cli_manip_ip_decap_add,$1,$2,$3,$4); }
+            | TAV_INT TAV_IP TAV_STR TMIorQ         { HELP(HELP_MANIP_IP_DECAP_ADD); }
+            | TAV_INT TAV_IP TAV_STR T_IP TMIorQ    { HELP(HELP_MANIP_IP_DECAP_ADD); }
+            | TAV_INT TAV_IP TAV_STR TAV_STR TMIorQ { HELP(HELP_MANIP_IP_DECAP_ADD); }
+            ;
+
+DecapDelOrQ : HelpOrQ                             { HELP(HELP_MANIP_IP_DECAP_DEL); }
+            | {ERR_INT} error                     { HELP(HELP_MANIP_IP_DECAP_DEL); }
+            | TAV_INT {ERR_IP} error              { HELP(HELP_MANIP_IP_DECAP_DEL); }
+            | TAV_INT TAV_IP                      { SETC_DEC(cli_manip_ip_decap_del,$1,$2); }
+            | TAV_INT TAV_IP TMIorQ               { HELP(HELP_MANIP_IP_DECAP_DEL); }
+            ;
+
 ActionCommand : T_PING ActionPing
               | T_TRACE ActionTrace
               | ActionDate
               | ActionExit
+              | ActionRouter
               | ActionShutdown
               | ActionHelp
               ;
@@ -285,6 +346,12 @@ ActionExit : T_EXIT                               { SETC_FUNC0(cli_exit); }
            | T_EXIT TMIorQ                        { HELP(HELP_ACTION_EXIT); }
            ;
 
+ActionRouter : T_ROUTER                           { SETC_FUNC0(cli_router_show); }
+             | T_ROUTER HelpOrQ                   { HELP(HELP_ACTION_ROUTER); }
+             | T_ROUTER TAV_STR                   { SETC_ROUTER(cli_router,$2); }
+             | T_ROUTER TAV_STR TMIorQ            { HELP(HELP_ACTION_ROUTER); }
+             ;
+
 ActionShutdown : T_SHUTDOWN                       { SETC_FUNC0(cli_shutdown); }
                | T_SHUTDOWN TMIorQ                { HELP(HELP_ACTION_SHUTDOWN); }
                ;
@@ -298,10 +365,13 @@ ActionHelp : HelpOrQ                              { HELP(HELP_ACTION_HELP); }
            | HelpOrQ T_SHOW T_HW T_ARP            { HELP(HELP_SHOW_HW_ARP); }
            | HelpOrQ T_SHOW T_HW T_INTF           { HELP(HELP_SHOW_HW_INTF); }
            | HelpOrQ T_SHOW T_HW T_ROUTE          { HELP(HELP_SHOW_HW_ROUTE); }
+           | HelpOrQ T_SHOW T_HW T_STATS          { HELP(HELP_SHOW_HW_STATS); }
            | HelpOrQ T_SHOW T_IP                  { HELP(HELP_SHOW_IP); }
            | HelpOrQ T_SHOW T_IP T_ARP            { HELP(HELP_SHOW_IP_ARP); }
            | HelpOrQ T_SHOW T_IP T_INTF           { HELP(HELP_SHOW_IP_INTF); }
            | HelpOrQ T_SHOW T_IP T_ROUTE          { HELP(HELP_SHOW_IP_ROUTE); }
+           | HelpOrQ T_SHOW T_IP T_STATS          { HELP(HELP_SHOW_IP_STATS); }
+           | HelpOrQ T_SHOW T_IP T_TUNNEL         { HELP(HELP_SHOW_IP_TUNNEL); }
            | HelpOrQ T_SHOW T_OPTION              { HELP(HELP_SHOW_OPT); }
            | HelpOrQ T_SHOW T_OPTION T_VERBOSE    { HELP(HELP_SHOW_OPT_VERBOSE); }
            | HelpOrQ T_SHOW T_OSPF                { HELP(HELP_SHOW_OSPF); }
@@ -329,8 +399,15 @@ ActionHelp : HelpOrQ                              { HELP(HELP_ACTION_HELP); }
            | HelpOrQ T_IP T_ROUTE T_PURGE         { HELP(HELP_MANIP_IP_ROUTE_PURGE_ALL); }
            | HelpOrQ T_IP T_ROUTE T_DYNAMIC       { HELP(HELP_MANIP_IP_ROUTE_PURGE_DYN); }
            | HelpOrQ T_IP T_ROUTE T_STATIC        { HELP(HELP_MANIP_IP_ROUTE_PURGE_STA); }
+           | HelpOrQ T_IP T_TUNNEL                { HELP(HELP_MANIP_IP_TUNNEL); }
+           | HelpOrQ T_IP T_TUNNEL T_ADD          { HELP(HELP_MANIP_IP_TUNNEL_ADD); }
+           | HelpOrQ T_IP T_TUNNEL T_DEL          { HELP(HELP_MANIP_IP_TUNNEL_DEL); }
+           | HelpOrQ T_IP T_DECAP                 { HELP(HELP_MANIP_IP_DECAP); }
+           | HelpOrQ T_IP T_DECAP T_ADD           { HELP(HELP_MANIP_IP_DECAP_ADD); }
+           | HelpOrQ T_IP T_DECAP T_DEL           { HELP(HELP_MANIP_IP_DECAP_DEL); }
            | HelpOrQ T_DATE                       { HELP(HELP_ACTION_DATE); }
            | HelpOrQ T_EXIT                       { HELP(HELP_ACTION_EXIT); }
+           | HelpOrQ T_ROUTER                     { HELP(HELP_ACTION_ROUTER); }
            | HelpOrQ T_PING                       { HELP(HELP_ACTION_PING); }
            | HelpOrQ T_SHUTDOWN                   { HELP(HELP_ACTION_SHUTDOWN); }
            | HelpOrQ T_TRACE                      { HELP(HELP_ACTION_TRACE); }
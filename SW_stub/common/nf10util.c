@@ -17,6 +17,7 @@
 #define NF10_IOCTL_CMD_READ_STAT (SIOCDEVPRIVATE+0)
 #define NF10_IOCTL_CMD_WRITE_REG (SIOCDEVPRIVATE+1)
 #define NF10_IOCTL_CMD_READ_REG (SIOCDEVPRIVATE+2)
+#define NF10_IOCTL_CMD_READ_REGS (SIOCDEVPRIVATE+3)
 #define MASK_VALUE 0xffffffff
 
 
@@ -51,3 +52,36 @@ int writeReg(int f, uint32_t addr, uint32_t val)
 	return 0;
 }
 
+/* Reads count consecutive registers starting at addr into vals using as few
+ * ioctls as possible, so that a set of counters is sampled (nearly)
+ * atomically.  Falls back to one readReg() per register on drivers without
+ * NF10_IOCTL_CMD_READ_REGS. */
+int readRegs(int f, uint32_t addr, uint32_t count, uint32_t *vals)
+{
+	static int batch_unsupported = 0;
+	struct nf10_reg_batch b;
+	uint32_t i, n;
+
+	while(count > 0){
+		n = count < NF10_REG_BATCH_MAX ? count : NF10_REG_BATCH_MAX;
+
+		b.addr = addr;
+		b.count = n;
+		b.done = 0;
+		if(batch_unsupported || ioctl(f, NF10_IOCTL_CMD_READ_REGS, &b) < 0 || b.done != n){
+			/* older drivers ignore unknown ioctls, leaving done at 0 */
+			batch_unsupported = 1;
+			for(i = 0; i < n; i++)
+				if(readReg(f, addr + 4*i, &vals[i]))
+					return 1;
+		}
+		else
+			memcpy(vals, b.val, n * sizeof(uint32_t));
+
+		addr += 4*n;
+		vals += n;
+		count -= n;
+	}
+
+	return 0;
+}
@@ -7,14 +7,33 @@
  *
  */
 
+#ifndef NF10UTIL_H
+#define NF10UTIL_H
+
 #include <stdint.h>
 
 
 #define NF10_IOCTL_CMD_READ_STAT (SIOCDEVPRIVATE+0)
 #define NF10_IOCTL_CMD_WRITE_REG (SIOCDEVPRIVATE+1)
 #define NF10_IOCTL_CMD_READ_REG (SIOCDEVPRIVATE+2)
+#define NF10_IOCTL_CMD_READ_REGS (SIOCDEVPRIVATE+3)
 #define MASK_VALUE 0xffffffff
 
+/* max registers read by one NF10_IOCTL_CMD_READ_REGS (see nf10fops.h) */
+#define NF10_REG_BATCH_MAX 32
+
+/* argument of NF10_IOCTL_CMD_READ_REGS: count consecutive 32-bit registers
+ * starting at addr; the driver sets done to the number actually read */
+struct nf10_reg_batch {
+	uint32_t addr;
+	uint32_t count;
+	uint32_t done;
+	uint32_t val[NF10_REG_BATCH_MAX];
+};
+
 
 int readReg(int f, uint32_t addr, uint32_t *val);
 int writeReg(int f, uint32_t addr, uint32_t val);
+int readRegs(int f, uint32_t addr, uint32_t count, uint32_t *vals);
+
+#endif
@@ -199,6 +199,18 @@ netbuf_fromport(struct netbuf *buf)
 /*-----------------------------------------------------------------------------------*/
 struct
 netconn *netconn_new(enum netconn_type t)
+{
+  return netconn_new_with_callback(t, NULL);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Creates a netconn whose callback is told each time something is
+   posted to its mailboxes and taken from them, and each time there
+   is room to send, so that it can be waited on with others. */
+struct
+netconn *netconn_new_with_callback(enum netconn_type t,
+				   void (* callback)(struct netconn *conn,
+						     enum netconn_evt evt,
+						     uint16_t len))
 {
   struct netconn *conn;
 
@@ -217,6 +229,8 @@ netconn *netconn_new(enum netconn_type t)
   conn->acceptmbox = SYS_MBOX_NULL;
   conn->sem = SYS_SEM_NULL;
   conn->state = NETCONN_NONE;
+  conn->socket = -1;
+  conn->callback = callback;
   return conn;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -416,6 +430,9 @@ netconn_accept(struct netconn *conn)
   
   sys_mbox_fetch(conn->acceptmbox, (void **)&newconn);
 
+  /* Register event with callback */
+  API_EVENT(conn, NETCONN_EVT_RCVMINUS, 0);
+
   return newconn;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -454,6 +471,9 @@ netconn_recv(struct netconn *conn)
     }
     
     sys_mbox_fetch(conn->recvmbox, (void **)&p);
+
+    /* Register event with callback */
+    API_EVENT(conn, NETCONN_EVT_RCVMINUS, p != NULL ? p->tot_len : 0);
     
     /* If we are closed, we indicate that we no longer wish to recieve
        data by setting conn->recvmbox to SYS_MBOX_NULL. */
@@ -469,7 +489,9 @@ netconn_recv(struct netconn *conn)
     buf->fromport = 0;
     buf->fromaddr = NULL;
 
-    /* Let the stack know that we have taken the data. */
+    /* Let the stack know that we have taken the data. There is
+       nothing to wait for, so the transport thread frees the message,
+       and gets it before any message about conn sent after it. */
     if((msg = memp_mallocp(MEMP_API_MSG)) == NULL) {
       conn->err = ERR_MEM;
       return buf;
@@ -482,11 +504,9 @@ netconn_recv(struct netconn *conn)
       msg->msg.msg.len = 1;
     }
     api_msg_post(msg);
-
-    sys_mbox_fetch(conn->mbox, NULL);
-    memp_freep(MEMP_API_MSG, msg);
   } else {
     sys_mbox_fetch(conn->recvmbox, (void **)&buf);
+    API_EVENT(conn, NETCONN_EVT_RCVMINUS, buf != NULL ? buf->p->tot_len : 0);
   }
 
   
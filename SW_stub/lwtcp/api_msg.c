@@ -56,8 +56,13 @@ recv_tcp(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
   }
   
   if(conn->recvmbox != SYS_MBOX_NULL) {
+    /* The transport thread must not wait on the application, so if
+       it is too far behind to take p, TCP keeps it for now. */
+    if(sys_mbox_trypost(conn->recvmbox, p) != ERR_OK) {
+      return ERR_MEM;
+    }
     conn->err = err;
-    sys_mbox_post(conn->recvmbox, p);
+    API_EVENT(conn, NETCONN_EVT_RCVPLUS, p != NULL ? p->tot_len : 0);
   }  
   return ERR_OK;
 }
@@ -88,7 +93,12 @@ recv_udp(void *arg, struct udp_pcb *pcb, struct pbuf *p,
       buf->fromport = port;
     }
     
-    sys_mbox_post(conn->recvmbox, buf);
+    if(sys_mbox_trypost(conn->recvmbox, buf) != ERR_OK) {
+      pbuf_free(p);
+      memp_freep(MEMP_NETBUF, buf);
+    } else {
+      API_EVENT(conn, NETCONN_EVT_RCVPLUS, p->tot_len);
+    }
   }
 }
 /*-----------------------------------------------------------------------------------*/
@@ -107,7 +117,7 @@ poll_tcp(void *arg, struct tcp_pcb *pcb)
 }
 /*-----------------------------------------------------------------------------------*/
 static err_t
-sent_tcp(void *arg, struct tcp_pcb *pcb, uint16_t len)
+sent_tcp(void *arg, struct tcp_pcb *pcb, uint32_t len)
 {
   struct netconn *conn;
 
@@ -115,6 +125,9 @@ sent_tcp(void *arg, struct tcp_pcb *pcb, uint16_t len)
   if(conn != NULL && conn->sem != SYS_SEM_NULL) {
     sys_sem_signal(conn->sem);
   }
+  if(conn != NULL && tcp_sndbuf(pcb) > 0) {
+    API_EVENT(conn, NETCONN_EVT_SENDPLUS, len);
+  }
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -128,19 +141,26 @@ err_tcp(void *arg, err_t err)
   conn->pcb.tcp = NULL;
 
   
+  /* Wake anyone waiting. A mailbox too full to take the wakeup has
+     nobody waiting on it, and whoever fetches from it next sees
+     conn->err first. */
   conn->err = err;
   if(conn->recvmbox != SYS_MBOX_NULL) {
-    sys_mbox_post(conn->recvmbox, NULL);
+    if(sys_mbox_trypost(conn->recvmbox, NULL) == ERR_OK) {
+      API_EVENT(conn, NETCONN_EVT_RCVPLUS, 0);
+    }
   }
   if(conn->mbox != SYS_MBOX_NULL) {
-    sys_mbox_post(conn->mbox, NULL);
+    sys_mbox_trypost(conn->mbox, NULL);
   }
   if(conn->acceptmbox != SYS_MBOX_NULL) {
-    sys_mbox_post(conn->acceptmbox, NULL);
+    sys_mbox_trypost(conn->acceptmbox, NULL);
   }
   if(conn->sem != SYS_SEM_NULL) {
     sys_sem_signal(conn->sem);
   }
+  /* Whoever waits to send must hear of the error too. */
+  API_EVENT(conn, NETCONN_EVT_ERROR, 0);
 }
 /*-----------------------------------------------------------------------------------*/
 static void
@@ -159,7 +179,7 @@ setup_tcp(struct netconn *conn)
 static err_t
 accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
 {
-  sys_mbox_t *mbox;
+  struct netconn *conn;
   struct netconn *newconn;
   
 #if API_MSG_DEBUG
@@ -167,14 +187,14 @@ accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
   tcp_debug_print_state(newpcb->state);
 #endif /* TCP_DEBUG */
 #endif /* API_MSG_DEBUG */
-  mbox = (sys_mbox_t *)arg;
+  conn = (struct netconn *)arg;
   newconn = memp_mallocp(MEMP_NETCONN);
   if(newconn == NULL) {
     return ERR_MEM;
   }
   newconn->type = NETCONN_TCP;
+  newconn->state = NETCONN_NONE;
   newconn->pcb.tcp = newpcb;
-  setup_tcp(newconn);
   newconn->recvmbox = sys_mbox_new();
   if(newconn->recvmbox == SYS_MBOX_NULL) {
     memp_free(MEMP_NETCONN, newconn);
@@ -195,7 +215,23 @@ accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
   }
   newconn->acceptmbox = SYS_MBOX_NULL;
   newconn->err = err;
-  sys_mbox_post(*mbox, newconn);
+  /* The new connection reports to the listener's callback, and has
+     no socket until it is accepted. */
+  newconn->callback = conn->callback;
+  newconn->socket = -1;
+  if(sys_mbox_trypost(conn->acceptmbox, newconn) != ERR_OK) {
+    /* The application is not accepting connections as fast as they
+       arrive. */
+    sys_sem_free(newconn->sem);
+    sys_mbox_free(newconn->recvmbox);
+    sys_mbox_free(newconn->mbox);
+    memp_free(MEMP_NETCONN, newconn);
+    return ERR_MEM;
+  }
+  /* Only now that it has a netconn for good may the pcb call back
+     with it: if accepting fails, TCP aborts the pcb. */
+  setup_tcp(newconn);
+  API_EVENT(conn, NETCONN_EVT_RCVPLUS, 0);
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -295,6 +331,7 @@ do_connected(void *arg, struct tcp_pcb *pcb, err_t err)
 
   if(conn->type == NETCONN_TCP && err == ERR_OK) {
     setup_tcp(conn);
+    API_EVENT(conn, NETCONN_EVT_SENDPLUS, 0);
   }    
   
   sys_mbox_post(conn->mbox, NULL);
@@ -388,7 +425,7 @@ do_listen(struct api_msg_msg *msg)
 	    break;
 	  }
 	}
-	tcp_arg(msg->conn->pcb.tcp, (void *)&(msg->conn->acceptmbox));
+	tcp_arg(msg->conn->pcb.tcp, msg->conn);
 	tcp_accept(msg->conn->pcb.tcp, accept_function);
       }
       break;
@@ -442,7 +479,7 @@ do_recv(struct api_msg_msg *msg)
       tcp_recved(msg->conn->pcb.tcp, msg->msg.len);
     }
   }
-  sys_mbox_post(msg->conn->mbox, NULL);
+  /* Nobody waits for this one; api_msg_input() frees the message. */
 }
 /*-----------------------------------------------------------------------------------*/
 static void
@@ -469,6 +506,10 @@ do_write(struct api_msg_msg *msg)
 	tcp_output(msg->conn->pcb.tcp);
       }
       msg->conn->err = err;
+      /* Not writable until sent_tcp() finds room again. */
+      if(err == ERR_MEM || tcp_sndbuf(msg->conn->pcb.tcp) == 0) {
+	API_EVENT(msg->conn, NETCONN_EVT_SENDMINUS, msg->msg.w.len);
+      }
       break;
     }
   }
@@ -516,7 +557,13 @@ static api_msg_decode decode[API_MSG_MAX] = {
 void
 api_msg_input(struct api_msg *msg)
 {  
-  decode[msg->type](&(msg->msg));
+  enum api_msg_type type = msg->type;
+
+  /* once woken, the caller may free msg; only a RECV is left to us */
+  decode[type](&(msg->msg));
+  if(type == API_MSG_RECV) {
+    memp_freep(MEMP_API_MSG, msg);
+  }
 }
 /*-----------------------------------------------------------------------------------*/
 void
@@ -65,6 +65,18 @@ enum netconn_state {
   NETCONN_CLOSE
 };
 
+/* What a netconn's callback is told has happened: something was
+   posted to one of its mailboxes for the application to take, the
+   application took it, there is room to send again, the send buffer
+   has filled up, or the connection has failed (with conn->err). */
+enum netconn_evt {
+  NETCONN_EVT_RCVPLUS,
+  NETCONN_EVT_RCVMINUS,
+  NETCONN_EVT_SENDPLUS,
+  NETCONN_EVT_SENDMINUS,
+  NETCONN_EVT_ERROR
+};
+
 struct netbuf {
   struct pbuf *p, *ptr;
   struct ip_addr *fromaddr;
@@ -84,8 +96,14 @@ struct netconn {
   sys_mbox_t recvmbox;
   sys_mbox_t acceptmbox;
   sys_sem_t sem;
+  int socket;
+  void (* callback)(struct netconn *conn, enum netconn_evt evt, uint16_t len);
 };
 
+#define API_EVENT(c,e,l) if((c)->callback) { \
+                           (*(c)->callback)(c, e, l); \
+                         }
+
 /* Network buffer functions: */
 struct netbuf *   netbuf_new      (void);
 void              netbuf_delete   (struct netbuf *buf);
@@ -109,6 +127,10 @@ uint16_t             netbuf_fromport (struct netbuf *buf);
 
 /* Network connection functions: */
 struct netconn *  netconn_new     (enum netconn_type type);
+struct netconn *  netconn_new_with_callback(enum netconn_type type,
+				   void (* callback)(struct netconn *conn,
+						     enum netconn_evt evt,
+						     uint16_t len));
 err_t             netconn_delete  (struct netconn *conn);
 enum netconn_type netconn_type    (struct netconn *conn);
 err_t             netconn_peer    (struct netconn *conn,
@@ -36,6 +36,7 @@
 #define __LWIP_DEF_H__
 
 #define UMAX(a, b)      ((a) > (b) ? (a) : (b))
+#define UMIN(a, b)      ((a) < (b) ? (a) : (b))
 
 #ifndef NULL
 #define NULL ((void *)0)
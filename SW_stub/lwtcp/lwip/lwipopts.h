@@ -45,41 +45,69 @@
 a lot of data that needs to be copied, this should be set high. */
 #define MEM_SIZE                5120000 
 
+/* MEM_SLAB_SIZE: the heap is handed out to size classes in slabs of
+   this many bytes. Allocations larger than a quarter of a slab take a
+   run of whole slabs. */
+#define MEM_SLAB_SIZE           65536
+
+/* MEM_MAG_SIZE: the most free heap objects of one size class each
+   thread keeps for itself, so that it need not lock the heap. */
+#define MEM_MAG_SIZE            32
+
 /* MEMP_NUM_PBUF: the number of memp struct pbufs. If the application
    sends a lot of data out of ROM (or other static memory), this
-   should be set high. */
-#define MEMP_NUM_PBUF           512 
+   should be set high. Each connection may have a few received
+   segments waiting for the application. */
+#define MEMP_NUM_PBUF           4096
 /* MEMP_NUM_UDP_PCB: the number of UDP protocol control blocks. One
    per active UDP "connection". */
 #define MEMP_NUM_UDP_PCB        4
 /* MEMP_NUM_TCP_PCB: the number of simulatenously active TCP
-   connections. */
-#define MEMP_NUM_TCP_PCB        12 
+   connections. Services on the router may hold a couple of
+   thousand, multiplexed with lwip_epoll_wait(). */
+#define MEMP_NUM_TCP_PCB        2048
 /* MEMP_NUM_TCP_PCB_LISTEN: the number of listening TCP
    connections. */
 #define MEMP_NUM_TCP_PCB_LISTEN 8
 /* MEMP_NUM_TCP_SEG: the number of simultaneously queued TCP
-   segments. */
-#define MEMP_NUM_TCP_SEG        8
+   segments, sent or received out of order. A connection with full
+   buffers queues a few hundred, and every connection one or two. */
+#define MEMP_NUM_TCP_SEG        4096
 /* MEMP_NUM_SYS_TIMEOUT: the number of simulateously active
-   timeouts. */
-#define MEMP_NUM_SYS_TIMEOUT    3
+   timeouts. Each thread using sys may have a few pending, and keeps
+   up to MEMP_CACHE_SIZE free ones besides. */
+#define MEMP_NUM_SYS_TIMEOUT    2048
 
 
 /* The following four are used only with the sequential API and can be
    set to 0 if the application only will use the raw API. */
-/* MEMP_NUM_NETBUF: the number of struct netbufs. */
-#define MEMP_NUM_NETBUF         32 
-/* MEMP_NUM_NETCONN: the number of struct netconns. */
-#define MEMP_NUM_NETCONN        32 
+/* MEMP_NUM_NETBUF: the number of struct netbufs. Each thread waiting
+   in netconn_recv() holds one, and may have another in its cache. */
+#define MEMP_NUM_NETBUF         4096
+/* MEMP_NUM_NETCONN: the number of struct netconns, and so of
+   sockets. */
+#define MEMP_NUM_NETCONN        2048
 /* MEMP_NUM_APIMSG: the number of struct api_msg, used for
    communication between the TCP/IP stack and the sequential
-   programs. */
-#define MEMP_NUM_API_MSG        8
+   programs. Each thread using a netconn holds one while it waits
+   for the stack, and may have another in its cache. */
+#define MEMP_NUM_API_MSG        4096
 /* MEMP_NUM_TCPIPMSG: the number of struct tcpip_msg, which is used
    for sequential API communication and incoming packets. Used in
    src/api/tcpip.c. */
-#define MEMP_NUM_TCPIP_MSG      8
+#define MEMP_NUM_TCPIP_MSG      4096
+
+/* MEMP_CACHE_SIZE: the most free elements of one pool each thread
+   keeps for itself, so that it need not lock the pool. A thread
+   caches at most a sixteenth of a pool, and none of the smallest. */
+#define MEMP_CACHE_SIZE         16
+
+/* SYS_MBOX_SIZE: the most messages a mailbox holds, a power of two.
+   The transport thread's mailbox takes every incoming segment and
+   API call, and a connection's receive mailbox every segment the
+   application has yet to read: threads posting to a full one wait,
+   or for segments, are dropped or left with TCP for later. */
+#define SYS_MBOX_SIZE           256
 
 /* These two control is reclaimer functions should be compiled
    in. Should always be turned on (1). */
@@ -94,8 +122,10 @@ a lot of data that needs to be copied, this should be set high. */
 #define PBUF_POOL_BUFSIZE       128
 
 /* PBUF_LINK_HLEN: the number of bytes that should be allocated for a
-   link level header. */
-#define PBUF_LINK_HLEN          16
+   link level header. Segments go to the router with room in front for
+   it to add the Ethernet header and a tunnel header (14 + 34 bytes)
+   in place. */
+#define PBUF_LINK_HLEN          48
 
 /* ---------- TCP options ---------- */
 #define LWIP_TCP                1
@@ -105,18 +135,24 @@ a lot of data that needs to be copied, this should be set high. */
    order. Define to 0 if your device is low on memory. */
 #define TCP_QUEUE_OOSEQ         1
 
-/* TCP Maximum segment size. */
-#define TCP_MSS                 128
+/* TCP Maximum segment size. A connection's MSS is what fits the MTU
+   of the interface it is routed out of, up to this. */
+#define TCP_MSS                 8960
 
-/* TCP sender buffer space (bytes). */
-#define TCP_SND_BUF             256
+/* TCP sender buffer space (bytes): what a connection starts with, and
+   the most it grows to while the windows allow more in flight. */
+#define TCP_SND_BUF             16384
+#define TCP_SND_BUF_MAX         262144
 
 /* TCP sender buffer space (pbufs). This must be at least = 2 *
-   TCP_SND_BUF/TCP_MSS for things to work. */
-#define TCP_SND_QUEUELEN        4 * TCP_SND_BUF/TCP_MSS
+   TCP_SND_BUF_MAX/MSS for things to work. */
+#define TCP_SND_QUEUELEN        512
 
-/* TCP receive window. */
-#define TCP_WND                 1024
+/* TCP receive window: what a connection starts with, and the most it
+   grows to while the sender fills it and the application keeps up.
+   Windows over 64 KB need the peer to scale windows (RFC 7323). */
+#define TCP_WND                 32768
+#define TCP_WND_MAX             262144
 
 /* Maximum number of retransmissions of data segments. */
 #define TCP_MAXRTX              12
@@ -124,6 +160,17 @@ a lot of data that needs to be copied, this should be set high. */
 /* Maximum number of retransmissions of SYN segments. */
 #define TCP_SYNMAXRTX           4
 
+/* Chains in the hash tables which incoming segments are matched to
+   connections (by address and ports) and to listeners (by port)
+   with. Both must be powers of two. */
+#define TCP_PCB_HASH_SIZE       4096
+#define TCP_LISTEN_HASH_SIZE    64
+
+/* Slots on the wheel that connections' timers are kept on, one per
+   500 ms tick, a power of two. Timers further off than a turn of the
+   wheel are passed over on each turn until they are due. */
+#define TCP_TIMER_WHEEL_SIZE    256
+
 /* ---------- ARP options ---------- */
 #define ARP_TABLE_SIZE 10
 
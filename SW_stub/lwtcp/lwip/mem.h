@@ -72,7 +72,7 @@ void mem_reclaim(unsigned int size);
                              ((((size) % MEM_ALIGNMENT) == 0)? 0 : \
                              (MEM_ALIGNMENT - ((size) % MEM_ALIGNMENT))))
 
-#define MEM_ALIGN(addr) (void *)MEM_ALIGN_SIZE((uint32_t)addr)
+#define MEM_ALIGN(addr) (void *)MEM_ALIGN_SIZE((unsigned long)addr)
 
 #endif /* __LWIP_MEM_H__ */
 
@@ -59,6 +59,14 @@
 #define TCP_WND                 2048
 #endif 
 
+#ifndef TCP_WND_MAX
+#define TCP_WND_MAX             TCP_WND
+#endif
+
+#ifndef TCP_SND_BUF_MAX
+#define TCP_SND_BUF_MAX         TCP_SND_BUF
+#endif
+
 #ifndef TCP_MAXRTX
 #define TCP_MAXRTX              12
 #endif
@@ -67,10 +75,38 @@
 #define TCP_SYNMAXRTX           6
 #endif
 
+#ifndef TCP_PCB_HASH_SIZE
+#define TCP_PCB_HASH_SIZE       64
+#endif
+
+#ifndef TCP_LISTEN_HASH_SIZE
+#define TCP_LISTEN_HASH_SIZE    16
+#endif
+
+#ifndef TCP_TIMER_WHEEL_SIZE
+#define TCP_TIMER_WHEEL_SIZE    256
+#endif
+
 #ifndef MEM_ALIGNMENT
 #define MEM_ALIGNMENT           1
 #endif
 
+#ifndef MEM_SLAB_SIZE
+#define MEM_SLAB_SIZE           65536
+#endif
+
+#ifndef MEM_MAG_SIZE
+#define MEM_MAG_SIZE            32
+#endif
+
+#ifndef MEMP_CACHE_SIZE
+#define MEMP_CACHE_SIZE         16
+#endif
+
+#ifndef SYS_MBOX_SIZE
+#define SYS_MBOX_SIZE           128
+#endif
+
 #ifndef PBUF_POOL_SIZE
 #define PBUF_POOL_SIZE          16
 #endif
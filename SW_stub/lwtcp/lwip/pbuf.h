@@ -62,6 +62,8 @@ typedef enum {
 #define PBUF_FLAG_ROM   0x01    /* Flags that pbuf data is stored in ROM. */
 #define PBUF_FLAG_POOL  0x02    /* Flags that the pbuf comes from the
 				   pbuf pool. */
+#define PBUF_FLAG_REF   0x03    /* Flags that pbuf data is stored in a
+				   buffer owned by someone else. */
 
 struct pbuf {
   struct pbuf *next;
@@ -77,6 +79,15 @@ struct pbuf {
   
 };
 
+/* A pbuf made by pbuf_alloc_ref(). Headers may be prepended down to
+   base, and release(arg) gives the buffer back once it is freed. */
+struct ref_pbuf {
+  struct pbuf pbuf;
+  void *base;
+  void (* release)(void *arg);
+  void *arg;
+};
+
 /* pbuf_init():
 
    Initializes the pbuf module. The num parameter determines how many
@@ -104,6 +115,15 @@ void pbuf_init(void);
                 the pbuf pool that is allocated during pbuf_init().  */
 struct pbuf *pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag);
 
+/* pbuf_alloc_ref():
+
+   Wraps size bytes at payload, in a buffer starting at base which
+   belongs to the caller, in a pbuf without copying them. The bytes
+   from base to payload may be used for headers. When the pbuf is
+   freed, release(arg) is called to give the buffer back. */
+struct pbuf *pbuf_alloc_ref(void *base, void *payload, uint16_t size,
+			    void (* release)(void *arg), void *arg);
+
 /* pbuf_realloc():
 
    Shrinks the pbuf to the size given by the size parameter. 
@@ -40,6 +40,8 @@
 #include "lwip/arch.h"
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 #ifndef IPPROTO_TCP
 #define IPPROTO_TCP     6
@@ -62,6 +64,18 @@ int lwip_sendto(int s, void *dataptr, int size, unsigned int flags,
 		struct sockaddr *to, int tolen);
 int lwip_socket(int domain, int type, int protocol);
 int lwip_write(int s, void *dataptr, int size);
+int lwip_fcntl(int s, int cmd, int val);
+
+/* Readiness: sockets report EPOLLIN, EPOLLOUT, EPOLLERR and EPOLLHUP
+   (or the POLL* flags of the same values) as Linux's do, and an epoll
+   set is closed with lwip_close(). */
+int lwip_epoll_create(int size);
+int lwip_epoll_ctl(int epfd, int op, int s, struct epoll_event *event);
+int lwip_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		    int timeout);
+int lwip_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+void lwip_socket_init(void);
 
 #ifdef LWIP_COMPAT_SOCKETS
 #define accept(a,b,c)         lwip_accept(a,b,c)
@@ -76,6 +90,11 @@ int lwip_write(int s, void *dataptr, int size);
 #define sendto(a,b,c,d,e,f)   lwip_sendto(a,b,c,d,e,f)
 #define socket(a,b,c)         lwip_socket(a,b,c)
 #define write(a,b,c)          lwip_write(a,b,c)
+#define fcntl(a,b,c)          lwip_fcntl(a,b,c)
+#define epoll_create(a)       lwip_epoll_create(a)
+#define epoll_ctl(a,b,c,d)    lwip_epoll_ctl(a,b,c,d)
+#define epoll_wait(a,b,c,d)   lwip_epoll_wait(a,b,c,d)
+#define poll(a,b,c)           lwip_poll(a,b,c)
 #endif /* LWIP_NO_COMPAT_SOCKETS */
 
 #endif /* __LWIP_SOCKETS_H__ */
@@ -59,11 +59,13 @@ struct stats_proto {
 };
 
 struct stats_mem {
-  uint16_t avail;
-  uint16_t used;
-  uint16_t max;  
-  uint16_t err;
-  uint16_t reclaimed;
+  uint32_t avail;
+  uint32_t used;
+  uint32_t max;  
+  uint32_t err;
+  uint32_t reclaimed;
+  uint32_t cachehit;    /* allocations served from a thread's cache */
+  uint32_t cachemiss;   /* and those which went to the pool */
 };
 
 struct stats_pbuf {
@@ -104,7 +106,11 @@ extern struct stats_ stats;
 
 #endif /* STATS */
 
+/* longest string stats_memp_to_string() writes */
+#define STATS_MEMP_STR_MAX_LEN (80 * (MEMP_MAX + 1))
+
 void stats_init(void);
+void stats_memp_to_string(char *buf, int len);
 #endif /* __LWIP_STATS_H__ */
 
 
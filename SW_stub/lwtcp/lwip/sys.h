@@ -36,6 +36,7 @@
 #define __LWIP_SYS_H__
 
 #include "lwip/arch.h"
+#include "lwip/err.h"
 
 #define SYS_MBOX_NULL NULL
 #define SYS_SEM_NULL  NULL
@@ -64,6 +65,10 @@ struct sys_timeouts {
 
 /* sys_init() must be called before anthing else. */
 void sys_init(void);
+/* Registers the calling thread with sys. Threads not started by
+   sys_thread_new() are registered the first time they need to be
+   anyway; each is forgotten, and its pending timeouts freed, as it
+   exits. */
 void sys_thread_init();
 
 /*
@@ -89,6 +94,7 @@ void sys_sem_wait(sys_sem_t sem);
 /* Mailbox functions. */
 sys_mbox_t sys_mbox_new(void);
 void sys_mbox_post(sys_mbox_t mbox, void *msg);
+err_t sys_mbox_trypost(sys_mbox_t mbox, void *msg);
 uint16_t sys_arch_mbox_fetch(sys_mbox_t mbox, void **msg, uint16_t timeout);
 void sys_mbox_free(sys_mbox_t mbox);
 
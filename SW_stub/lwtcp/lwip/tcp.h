@@ -56,7 +56,13 @@ void             tcp_init    (void);  /* Must be called first to
 					 initialize TCP. */
 void             tcp_tmr     (void);  /* Must be called every
 					 TCP_TMR_INTERVAL
-					 ms. (Typically 100 ms). */
+					 ms. (Typically 100 ms)
+					 while
+					 tcp_timers_pending(). */
+int              tcp_timers_pending(void);
+/* Provided by the system, and called whenever a timer is started, so
+   that tcp_tmr() is called again if it had stopped being. */
+void             tcp_timer_needed(void);
 /* Application program's interface: */
 struct tcp_pcb * tcp_new     (void);
 
@@ -69,7 +75,7 @@ void             tcp_recv    (struct tcp_pcb *pcb,
 				  struct pbuf *p, err_t err));
 void             tcp_sent    (struct tcp_pcb *pcb,
 			      err_t (* sent)(void *arg, struct tcp_pcb *tpcb,
-					     uint16_t len));
+					     uint32_t len));
 void             tcp_poll    (struct tcp_pcb *pcb,
 			      err_t (* poll)(void *arg, struct tcp_pcb *tpcb),
 			      uint8_t interval);
@@ -78,6 +84,17 @@ void             tcp_err     (struct tcp_pcb *pcb,
 
 #define          tcp_sndbuf(pcb)   ((pcb)->snd_buf)
 
+/* Fix the size of a connection's send buffer or receive window,
+   which otherwise grow to TCP_SND_BUF_MAX and TCP_WND_MAX as the
+   connection needs. Best called before connecting. */
+void             tcp_setsndbuf(struct tcp_pcb *pcb, uint32_t size);
+void             tcp_setrcvbuf(struct tcp_pcb *pcb, uint32_t size);
+
+/* Whether a connection offers selective acknowledgements (RFC 2018)
+   when it connects, which it does unless told not to. Must be called
+   before connecting. */
+void             tcp_setsack (struct tcp_pcb *pcb, int on);
+
 void             tcp_recved  (struct tcp_pcb *pcb, uint16_t len);
 err_t            tcp_bind    (struct tcp_pcb *pcb, struct ip_addr *ipaddr,
 			      uint16_t port);
@@ -120,6 +137,15 @@ err_t            tcp_output  (struct tcp_pcb *pcb);
 /* Length of the TCP header, excluding options. */
 #define TCP_HLEN 20
 
+/* The MSS assumed when the MTU towards a host is not known (RFC 879),
+   and the largest window scale (RFC 7323). */
+#define TCP_DEFAULT_MSS 536
+#define TCP_MAX_WND_SCALE 14
+
+/* The most SACK blocks an ACK carries, which with two NOPs is 36 of
+   the 40 bytes options may take (RFC 2018). */
+#define TCP_SACK_BLOCKS 4
+
 #define TCP_TMR_INTERVAL       100  /* The TCP timer interval in
 				       milliseconds. */
 
@@ -172,6 +198,7 @@ enum tcp_state {
 /* the TCP protocol control block */
 struct tcp_pcb {
   struct tcp_pcb *next;   /* for the linked list */
+  struct tcp_pcb *hash_next; /* for the chain in tcp_pcb_hash[] */
 
   enum tcp_state state;   /* TCP state */
 
@@ -188,23 +215,43 @@ struct tcp_pcb {
   
   /* receiver varables */
   uint32_t rcv_nxt;   /* next seqno expected */
-  uint16_t rcv_wnd;   /* receiver window */
+  uint32_t rcv_wnd;   /* receiver window */
+  uint32_t rcv_wnd_max; /* size of the receiver window, when all is consumed */
+  uint32_t rcv_wnd_lim; /* most rcv_wnd_max may be grown to */
+  uint32_t rcv_adv;   /* right edge of a window advertised, until it is used up */
+  uint32_t rcv_sack;  /* seqno of the latest segment queued out of
+			 sequence, whose SACK block is reported first */
 
-  /* Timers */
-  uint16_t tmr;
+  /* Timers, as the tcp_ticks they last (re)started at. */
+  uint32_t tmr;
 
   /* Retransmission timer. */
-  uint8_t rtime;
+  uint32_t rtime;
+
+  /* While any of its timers runs, it is in the slot of the timer
+     wheel for wheel_tick, the tcp_ticks the earliest expires on. While
+     it has a delayed ACK or refused data, it is on tcp_fast_pcbs. */
+  struct tcp_pcb *wheel_next, **wheel_pprev;
+  uint32_t wheel_tick;
+  struct tcp_pcb *fast_next, **fast_pprev;
   
   uint16_t mss;   /* maximum segment size */
 
-  uint8_t flags;
+  uint16_t flags;
 #define TF_ACK_DELAY 0x01   /* Delayed ACK. */
 #define TF_ACK_NOW   0x02   /* Immediate ACK. */
 #define TF_INFR      0x04   /* In fast recovery. */
 #define TF_RESET     0x08   /* Connection was reset. */
 #define TF_CLOSED    0x10   /* Connection was sucessfully closed. */
 #define TF_GOT_FIN   0x20   /* Connection was closed by the remote end. */
+#define TF_WND_SCALE 0x40   /* Window scale option received. */
+#define TF_FIN_REFUSED 0x80 /* The application has yet to take the FIN. */
+#define TF_SACK      0x100  /* Both ends agreed to selective acknowledgements. */
+#define TF_NOSACK    0x200  /* Selective acknowledgements are not to be offered. */
+
+  /* Window scaling: the shifts applied to the windows the peer
+     advertises and those we advertise. */
+  uint8_t snd_scale, rcv_scale;
   
   /* RTT estimation variables. */
   uint16_t rttest; /* RTT estimate in 500ms ticks */
@@ -217,10 +264,12 @@ struct tcp_pcb {
   /* fast retransmit/recovery */
   uint32_t lastack; /* Highest acknowledged seqno. */
   uint8_t dupacks;
+  uint32_t recover; /* snd_max when loss recovery began; with SACK, it
+		       ends once this is acknowledged (RFC 6675). */
   
   /* congestion avoidance/control variables */
-  uint16_t cwnd;  
-  uint16_t ssthresh;
+  uint32_t cwnd;  
+  uint32_t ssthresh;
 
   /* sender variables */
   uint32_t snd_nxt,       /* next seqno to be sent */
@@ -229,16 +278,20 @@ struct tcp_pcb {
     snd_wl1, snd_wl2,
     snd_lbb;      
 
-  uint16_t snd_buf;   /* Avaliable buffer space for sending. */
-  uint8_t snd_queuelen;
+  uint32_t snd_buf;   /* Avaliable buffer space for sending. */
+  uint32_t snd_buf_max; /* Size of the send buffer. */
+  uint32_t snd_buf_lim; /* Most snd_buf_max may be grown to. */
+  uint16_t snd_queuelen;
 
   /* Function to be called when more send buffer space is avaliable. */
-  err_t (* sent)(void *arg, struct tcp_pcb *pcb, uint16_t space);
-  uint16_t acked;
+  err_t (* sent)(void *arg, struct tcp_pcb *pcb, uint32_t space);
+  uint32_t acked;
   
   /* Function to be called when (in-sequence) data has arrived. */
   err_t (* recv)(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err);
   struct pbuf *recv_data;
+  /* Data the application had no room for, offered to it again. */
+  struct pbuf *refused_data;
 
   /* Function to be called when a connection has been set up. */
   err_t (* connected)(void *arg, struct tcp_pcb *pcb, err_t err);
@@ -249,7 +302,8 @@ struct tcp_pcb {
   /* Function to be called whenever a fatal error occurs. */
   void (* errf)(void *arg, err_t err);
   
-  uint8_t polltmr, pollinterval;
+  uint32_t polltmr;
+  uint8_t pollinterval;
   
   /* These are ordered by sequence number: */
   struct tcp_seg *unsent;   /* Unsent (queued) segments. */
@@ -262,6 +316,7 @@ struct tcp_pcb {
 
 struct tcp_pcb_listen {  
   struct tcp_pcb_listen *next;   /* for the linked list */
+  struct tcp_pcb_listen *hash_next; /* for the chain in tcp_listen_hash[] */
   
   enum tcp_state state;   /* TCP state */
 
@@ -281,13 +336,30 @@ struct tcp_seg {
   void *dataptr;           /* pointer to the TCP data in the pbuf */
   uint16_t len;               /* the TCP length of this segment */
   struct tcp_hdr *tcphdr;  /* the TCP header */
+  uint8_t flags;           /* the sender's scoreboard, on ->unacked: */
+#define TF_SEG_SACKED 0x01 /* Selectively acknowledged. */
+#define TF_SEG_LOST   0x02 /* Presumed lost, by what was SACKed above it. */
+#define TF_SEG_REXMIT 0x04 /* Retransmitted in this loss recovery. */
 };
 
 /* Internal functions and global variables: */
 struct tcp_pcb *tcp_pcb_copy(struct tcp_pcb *pcb);
 void tcp_pcb_purge(struct tcp_pcb *pcb);
+err_t tcp_refused_data(struct tcp_pcb *pcb);
+void tcp_timer_update(struct tcp_pcb *pcb);
+void tcp_timer_cancel(struct tcp_pcb *pcb);
 void tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb);
 
+uint16_t tcp_mss_for(struct ip_addr *remote_ip);
+uint8_t tcp_syn_options(struct tcp_pcb *pcb, uint32_t *optdata);
+uint32_t tcp_sack_pipe(struct tcp_pcb *pcb);
+
+void tcp_pcb_hash_add(struct tcp_pcb **pcblist, struct tcp_pcb *pcb);
+void tcp_pcb_hash_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb);
+struct tcp_pcb *tcp_pcb_lookup(struct ip_addr *remote_ip, uint16_t remote_port,
+			       struct ip_addr *local_ip, uint16_t local_port);
+struct tcp_pcb_listen *tcp_listen_lookup(struct ip_addr *local_ip, uint16_t local_port);
+
 uint8_t tcp_segs_free(struct tcp_seg *seg);
 uint8_t tcp_seg_free(struct tcp_seg *seg);
 struct tcp_seg *tcp_seg_copy(struct tcp_seg *seg);
@@ -308,6 +380,7 @@ err_t tcp_enqueue(struct tcp_pcb *pcb, void *dataptr, uint16_t len,
                 uint8_t *optdata, uint8_t optlen);
 
 void tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg);
+void tcp_sack_rexmit(struct tcp_pcb *pcb, struct tcp_seg *seg);
 
 void tcp_rst(uint32_t seqno, uint32_t ackno,
 	     struct ip_addr *local_ip, struct ip_addr *remote_ip,
@@ -337,15 +410,24 @@ extern struct tcp_pcb *tcp_tw_pcbs;      /* List of all TCP PCBs in TIME-WAIT. *
 
 extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 
+/* The PCB hash tables, which tcp_input() demultiplexes segments with. */
+extern struct tcp_pcb *tcp_pcb_hash[TCP_PCB_HASH_SIZE];
+extern struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+
 /* Axoims about the above lists:   
    1) Every TCP PCB that is not CLOSED is in one of the lists.
    2) A PCB is only in one of the lists.
    3) All PCBs in the tcp_listen_pcbs list is in LISTEN state.
    4) All PCBs in the tcp_tw_pcbs list is in TIME-WAIT state.
+   5) A PCB in tcp_active_pcbs or tcp_tw_pcbs is also in the
+      tcp_pcb_hash[] chain for its remote address and ports, and a PCB
+      in tcp_listen_pcbs is in the tcp_listen_hash[] chain for its
+      local port.
 */
 
 /* Define two macros, TCP_REG and TCP_RMV that registers a TCP PCB
-   with a PCB list or removes a PCB from a list, respectively. */
+   with a PCB list or removes a PCB from a list, respectively. Both
+   keep the PCB hash tables in step with the lists. */
 #ifdef LWIP_DEBUG
 #define TCP_REG(pcbs, npcb) do {\
                             DEBUGF(TCP_DEBUG, ("TCP_REG %p local port %d\n", npcb, npcb->local_port)); \
@@ -358,6 +440,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                             npcb->next = *pcbs; \
                             ASSERT("TCP_REG: npcb->next != npcb", npcb->next != npcb); \
                             *pcbs = npcb; \
+                            tcp_pcb_hash_add(pcbs, npcb); \
                             ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
                             } while(0)
 #define TCP_RMV(pcbs, npcb) do { \
@@ -372,6 +455,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                                } \
                             } \
                             npcb->next = NULL; \
+                            tcp_pcb_hash_remove(pcbs, npcb); \
                             ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
                             DEBUGF(TCP_DEBUG, ("TCP_RMV: removed %p from %p\n", npcb, *pcbs)); \
                             } while(0)
@@ -380,6 +464,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 #define TCP_REG(pcbs, npcb) do { \
                             npcb->next = *pcbs; \
                             *pcbs = npcb; \
+                            tcp_pcb_hash_add(pcbs, npcb); \
                             } while(0)
 #define TCP_RMV(pcbs, npcb) do { \
                             if(*pcbs == npcb) { \
@@ -391,6 +476,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                                } \
                             } \
                             npcb->next = NULL; \
+                            tcp_pcb_hash_remove(pcbs, npcb); \
                             } while(0)
 #endif /* LWIP_DEBUG */
 #endif /* __LWIP_TCP_H__ */
@@ -38,12 +38,29 @@
  *
  * Memory manager.
  *
+ * The heap is handed out in slabs of MEM_SLAB_SIZE bytes.  A slab holds
+ * objects of one size class at a time, so objects need no header: the
+ * slab an object is in gives its size.  Allocations too large for any
+ * class take a run of whole slabs.  A slab all of whose objects are free
+ * again goes back to the free slabs, where it can serve any size, so
+ * that memory freed by one kind of allocation is not stranded away from
+ * the others as holes in a first-fit heap are.
+ *
+ * Each thread keeps a magazine of up to MEM_MAG_SIZE free objects per
+ * class.  mem_malloc() and mem_free() use only the calling thread's
+ * magazines, and take mem_sem just to move half a magazine from or to
+ * the slabs, so that threads allocating at once seldom contend.  An
+ * object may be freed by a thread other than the one which allocated
+ * it.  stats.mem.used counts the objects in magazines as used.
+ *
  */
 /*-----------------------------------------------------------------------------------*/
 #include "lwip/debug.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "lwip/arch.h"
 #include "lwip/opt.h"
@@ -62,94 +79,423 @@ struct mem_reclaim_ {
 };
 #endif /* MEM_RECLAIM */
 
+#define MEM_NUM_SLABS (MEM_SIZE / MEM_SLAB_SIZE)
+#if MEM_NUM_SLABS == 0
+#error "MEM_SIZE must be at least MEM_SLAB_SIZE"
+#endif /* MEM_NUM_SLABS == 0 */
+
+/* class sizes are multiples of MEM_QUANTUM, from MIN_SIZE up to a
+   quarter of a slab, four to each doubling */
+#define MEM_QUANTUM 8
+#define MIN_SIZE 32
+#define MAX_SIZE (MEM_SLAB_SIZE / 4)
+#define MEM_MAX_CLASSES 64
+
+/* a magazine of a class holds at most this many bytes of objects (and
+   at least one object) */
+#define MEM_MAG_BYTES 8192
+
+/* the class of a slab which is not divided into objects */
+#define SLAB_FREE  0xff   /* free */
+#define SLAB_LARGE 0xfe   /* first of a run holding one large allocation */
+#define SLAB_TAIL  0xfd   /* the rest of such a run */
+
+/* a free object */
 struct mem {
-  mem_size_t next, prev;
-  uint8_t used;
-#if MEM_ALIGNMENT == 2
-  uint8_t dummy;
-#endif /* MEM_ALIGNEMNT == 2 */
+  struct mem *next;
+};
+
+struct slab {
+  struct slab *next, *prev;   /* among the partial slabs of its class */
+  struct mem *free;           /* freed objects not in any magazine */
+  mem_size_t carved;          /* objects ever handed out of the slab */
+  mem_size_t used;            /* objects out of the slab, or slabs in a run */
+  uint8_t class;
+};
+
+struct magazine {
+  unsigned int n;
+  struct mem *obj[MEM_MAG_SIZE];
+};
+
+/* the magazines of a thread */
+struct mem_cache {
+  struct magazine mag[MEM_MAX_CLASSES];
+  int registered;             /* to be emptied when the thread exits */
 };
 
-static struct mem *ram_end;
-static uint8_t ram[MEM_ALIGN_SIZE(MEM_SIZE + sizeof(struct mem))];
+static uint8_t ram[MEM_NUM_SLABS * MEM_SLAB_SIZE] __attribute__ ((aligned (64)));
+static struct slab slabs[MEM_NUM_SLABS];
 
-#define MIN_SIZE 12
-#define SIZEOF_STRUCT_MEM MEM_ALIGN_SIZE(sizeof(struct mem))
-/*#define SIZEOF_STRUCT_MEM (sizeof(struct mem) + \
-                          (((sizeof(struct mem) % MEM_ALIGNMENT) == 0)? 0 : \
-                          (4 - (sizeof(struct mem) % MEM_ALIGNMENT))))*/
+static unsigned int num_classes;
+static mem_size_t class_size[MEM_MAX_CLASSES];
+static mem_size_t class_objs[MEM_MAX_CLASSES];    /* per slab */
+static unsigned int class_mag[MEM_MAX_CLASSES];   /* magazine capacity */
+static uint8_t size_class[MAX_SIZE / MEM_QUANTUM + 1];
 
+static struct slab *partial[MEM_MAX_CLASSES];     /* slabs with free objects */
 
-static struct mem *lfree;   /* pointer to the lowest free block */
+static __thread struct mem_cache mem_cache;
+static pthread_key_t mem_cache_key;
 
 #if MEM_RECLAIM
 static struct mem_reclaim_ *mrlist;
 #endif /* MEM_RECLAIM */
 
+/* guards the slabs: never held while calling out */
 static sys_sem_t mem_sem;
 
+/*-----------------------------------------------------------------------------------*/
+static uint8_t *
+slab_ram(struct slab *s)
+{
+  return &ram[(s - slabs) * MEM_SLAB_SIZE];
+}
+/*-----------------------------------------------------------------------------------*/
+static struct slab *
+slab_of(void *rmem)
+{
+  return &slabs[((uint8_t *)rmem - ram) / MEM_SLAB_SIZE];
+}
 /*-----------------------------------------------------------------------------------*/
 static void
-plug_holes(struct mem *mem)
+slab_link(struct slab *s)
 {
-  struct mem *nmem;
-  struct mem *pmem;
+  s->prev = NULL;
+  s->next = partial[s->class];
+  if(s->next != NULL) {
+    s->next->prev = s;
+  }
+  partial[s->class] = s;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+slab_unlink(struct slab *s)
+{
+  if(s->prev != NULL) {
+    s->prev->next = s->next;
+  } else {
+    partial[s->class] = s->next;
+  }
+  if(s->next != NULL) {
+    s->next->prev = s->prev;
+  }
+  s->next = s->prev = NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Frees the empty slabs which classes keep in reserve.  mem_sem must be
+   held. */
+static int
+slab_reclaim(void)
+{
+  int i, n;
 
-  ASSERT("plug_holes: mem >= ram", (uint8_t *)mem >= ram);
-  ASSERT("plug_holes: mem < ram_end", (uint8_t *)mem < (uint8_t *)ram_end);
-  ASSERT("plug_holes: mem->used == 0", mem->used == 0);
-  
-  /* plug hole forward */
-  ASSERT("plug_holes: mem->next <= MEM_SIZE", mem->next <= MEM_SIZE);
-  
-  nmem = (struct mem *)&ram[mem->next];
-  if(mem != nmem && nmem->used == 0 && (uint8_t *)nmem != (uint8_t *)ram_end) {
-    if(lfree == nmem) {
-      lfree = mem;
+  for(i = 0, n = 0; i < MEM_NUM_SLABS; i++) {
+    if(slabs[i].class < num_classes && slabs[i].used == 0) {
+      slab_unlink(&slabs[i]);
+      slabs[i].class = SLAB_FREE;
+      n++;
+    }
+  }
+  return n;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Takes a free slab for class c.  Slabs are taken from the top of the
+   heap, leaving the bottom to the runs of large allocations. */
+static struct slab *
+slab_new(uint8_t c)
+{
+  struct slab *s;
+  int i;
+
+  for(i = MEM_NUM_SLABS - 1; i >= 0 && slabs[i].class != SLAB_FREE; i--);
+  if(i < 0) {
+    if(slab_reclaim() == 0) {
+      return NULL;
+    }
+    return slab_new(c);
+  }
+  s = &slabs[i];
+  s->class = c;
+  s->free = NULL;
+  s->carved = s->used = 0;
+  slab_link(s);
+  return s;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Moves up to n free objects of class c from the slabs to obj, and
+   returns how many it moved.  mem_sem must be held. */
+static unsigned int
+slab_get(uint8_t c, struct mem **obj, unsigned int n)
+{
+  struct slab *s;
+  unsigned int i;
+
+  i = 0;
+  while(i < n) {
+    s = partial[c];
+    if(s == NULL && (s = slab_new(c)) == NULL) {
+      break;
+    }
+    while(i < n && s->free != NULL) {
+      obj[i++] = s->free;
+      s->free = s->free->next;
+      s->used++;
+    }
+    while(i < n && s->carved < class_objs[c]) {
+      obj[i++] = (struct mem *)(slab_ram(s) + s->carved++ * class_size[c]);
+      s->used++;
     }
-    mem->next = nmem->next;
-    ((struct mem *)&ram[nmem->next])->prev = (uint8_t *)mem - ram;
+    if(s->free == NULL && s->carved == class_objs[c]) {
+      slab_unlink(s);
+    }
+  }
+#ifdef MEM_STATS
+  stats.mem.used += i * class_size[c];
+  if(stats.mem.max < stats.mem.used) {
+    stats.mem.max = stats.mem.used;
   }
+#endif /* MEM_STATS */
+  return i;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Returns the n objects in obj to their slabs, freeing each slab which
+   empties unless it is the last partial one of its class.  mem_sem must
+   be held. */
+static void
+slab_put(struct mem **obj, unsigned int n)
+{
+  struct slab *s;
+  unsigned int i;
 
-  /* plug hole backward */
-  pmem = (struct mem *)&ram[mem->prev];
-  if(pmem != mem && pmem->used == 0) {
-    if(lfree == mem) {
-      lfree = pmem;
+  for(i = 0; i < n; i++) {
+    s = slab_of(obj[i]);
+    if(s->free == NULL && s->carved == class_objs[s->class]) {
+      slab_link(s);
+    }
+    obj[i]->next = s->free;
+    s->free = obj[i];
+#ifdef MEM_STATS
+    stats.mem.used -= class_size[s->class];
+#endif /* MEM_STATS */
+    if(--s->used == 0 && (partial[s->class] != s || s->next != NULL)) {
+      slab_unlink(s);
+      s->class = SLAB_FREE;
     }
-    pmem->next = mem->next;
-    ((struct mem *)&ram[mem->next])->prev = (uint8_t *)pmem - ram;
   }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Empties every magazine of mc.  mem_sem must be held. */
+static void
+mem_cache_drain(struct mem_cache *mc)
+{
+  unsigned int c;
 
+  for(c = 0; c < num_classes; c++) {
+    slab_put(mc->mag[c].obj, mc->mag[c].n);
+    mc->mag[c].n = 0;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Called as a thread exits with the magazines it used. */
+static void
+mem_cache_release(void *arg)
+{
+  /* anything freed by a later destructor registers the magazines again */
+  ((struct mem_cache *)arg)->registered = 0;
+  sys_arch_sem_wait(mem_sem, 0);
+  mem_cache_drain((struct mem_cache *)arg);
+  sys_sem_signal(mem_sem);
+}
+/*-----------------------------------------------------------------------------------*/
+static struct mem_cache *
+mem_cache_get(void)
+{
+  struct mem_cache *mc = &mem_cache;
+
+  if(!mc->registered) {
+    pthread_setspecific(mem_cache_key, mc);
+    mc->registered = 1;
+  }
+  return mc;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Fills half the magazine of class c from the slabs.  If they are out
+   of memory, the other magazines of the thread are emptied first in
+   case that frees a slab. */
+static unsigned int
+mem_cache_fill(struct mem_cache *mc, uint8_t c)
+{
+  struct magazine *mag = &mc->mag[c];
+
+  sys_arch_sem_wait(mem_sem, 0);
+  mag->n = slab_get(c, mag->obj, (class_mag[c] + 1) / 2);
+  if(mag->n == 0) {
+    mem_cache_drain(mc);
+    mag->n = slab_get(c, mag->obj, (class_mag[c] + 1) / 2);
+  }
+#ifdef MEM_STATS
+  if(mag->n == 0) {
+    ++stats.mem.err;
+  }
+#endif /* MEM_STATS */
+  sys_sem_signal(mem_sem);
+  return mag->n;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Returns the older half of the full magazine of class c to the slabs. */
+static void
+mem_cache_flush(struct mem_cache *mc, uint8_t c)
+{
+  struct magazine *mag = &mc->mag[c];
+  unsigned int n = (mag->n + 1) / 2;
+
+  sys_arch_sem_wait(mem_sem, 0);
+  slab_put(mag->obj, n);
+  sys_sem_signal(mem_sem);
+  mag->n -= n;
+  memmove(mag->obj, mag->obj + n, mag->n * sizeof(mag->obj[0]));
+}
+/*-----------------------------------------------------------------------------------*/
+/* Returns the first of n free slabs in a row, or -1.  mem_sem must be
+   held. */
+static int
+slab_run(unsigned int n)
+{
+  unsigned int run;
+  int i;
+
+  for(i = 0, run = 0; i < MEM_NUM_SLABS; i++) {
+    run = (slabs[i].class == SLAB_FREE) ? run + 1 : 0;
+    if(run == n) {
+      return i - (n - 1);
+    }
+  }
+  return -1;
+}
+/*-----------------------------------------------------------------------------------*/
+static void *
+mem_malloc_large(mem_size_t size)
+{
+  unsigned int n, i;
+  int first;
+
+  n = (size + MEM_SLAB_SIZE - 1) / MEM_SLAB_SIZE;
+
+  sys_arch_sem_wait(mem_sem, 0);
+  first = slab_run(n);
+  if(first < 0) {
+    mem_cache_drain(mem_cache_get());
+    slab_reclaim();
+    first = slab_run(n);
+  }
+  if(first < 0) {
+    DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
+#ifdef MEM_STATS
+    ++stats.mem.err;
+#endif /* MEM_STATS */
+    sys_sem_signal(mem_sem);
+    return NULL;
+  }
+
+  slabs[first].class = SLAB_LARGE;
+  slabs[first].used = n;
+  for(i = 1; i < n; i++) {
+    slabs[first + i].class = SLAB_TAIL;
+  }
+#ifdef MEM_STATS
+  stats.mem.used += n * MEM_SLAB_SIZE;
+  if(stats.mem.max < stats.mem.used) {
+    stats.mem.max = stats.mem.used;
+  }
+#endif /* MEM_STATS */
+  sys_sem_signal(mem_sem);
+  return slab_ram(&slabs[first]);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Frees the slabs after the first n of the run starting at s.  mem_sem
+   must be held. */
+static void
+mem_free_run(struct slab *s, mem_size_t n)
+{
+  mem_size_t i;
+
+#ifdef MEM_STATS
+  stats.mem.used -= (s->used - n) * MEM_SLAB_SIZE;
+#endif /* MEM_STATS */
+  for(i = n; i < s->used; i++) {
+    s[i].class = SLAB_FREE;
+  }
+  s->used = n;
+  if(n == 0) {
+    s->class = SLAB_FREE;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Returns how many bytes rmem has room for. */
+static mem_size_t
+mem_capacity(void *rmem)
+{
+  struct slab *s = slab_of(rmem);
+
+  if(s->class == SLAB_LARGE) {
+    return s->used * MEM_SLAB_SIZE;
+  }
+  return class_size[s->class];
 }
 /*-----------------------------------------------------------------------------------*/
 void
 mem_init(void)
 {
-  struct mem *mem;
-
-  bzero(ram, MEM_SIZE);
-  mem = (struct mem *)ram;
-  mem->next = MEM_SIZE;
-  mem->prev = 0;
-  mem->used = 0;
-  ram_end = (struct mem *)&ram[MEM_SIZE];
-  ram_end->used = 1;
-  ram_end->next = MEM_SIZE;
-  ram_end->prev = MEM_SIZE;
+  static int key_created = 0;
+  mem_size_t size, step;
+  unsigned int c, i;
+
+  for(i = 0; i < MEM_NUM_SLABS; i++) {
+    slabs[i].next = slabs[i].prev = NULL;
+    slabs[i].class = SLAB_FREE;
+  }
+
+  num_classes = 0;
+  for(size = MIN_SIZE, step = MIN_SIZE / 4; size <= MAX_SIZE; size += step) {
+    if(size == step * 8) {
+      step *= 2;
+    }
+    c = num_classes++;
+    class_size[c] = size;
+    class_objs[c] = MEM_SLAB_SIZE / size;
+    class_mag[c] = MEM_MAG_BYTES / size;
+    if(class_mag[c] > MEM_MAG_SIZE) {
+      class_mag[c] = MEM_MAG_SIZE;
+    } else if(class_mag[c] == 0) {
+      class_mag[c] = 1;
+    }
+    partial[c] = NULL;
+  }
+  for(i = 0, c = 0; i <= MAX_SIZE / MEM_QUANTUM; i++) {
+    while(class_size[c] < i * MEM_QUANTUM) {
+      c++;
+    }
+    size_class[i] = c;
+  }
+
+  /* the calling thread's magazines; no other may be using the heap */
+  bzero(&mem_cache, sizeof(mem_cache));
+  if(!key_created) {
+    pthread_key_create(&mem_cache_key, mem_cache_release);
+    key_created = 1;
+  }
 
   fflush(stdout);
   mem_sem = sys_sem_new(1);
   assert(mem_sem);
 
-  lfree = (struct mem *)ram;
-
 #if MEM_RECLAIM
   mrlist = NULL;
 #endif /* MEM_RECLAIM */
   
 #ifdef MEM_STATS
-  stats.mem.avail = (uint16_t)MEM_SIZE;
+  stats.mem.avail = MEM_NUM_SLABS * MEM_SLAB_SIZE;
 #endif /* MEM_STATS */
 }
 /*-----------------------------------------------------------------------------------*/
@@ -189,176 +535,126 @@ mem_malloc2(mem_size_t size)
 void *
 mem_malloc(mem_size_t size)
 {
-  mem_size_t ptr, ptr2;
-  struct mem *mem, *mem2;
+  struct mem_cache *mc;
+  struct magazine *mag;
+  uint8_t c;
 
   if(size == 0) {
     return NULL;
   }
-
-  /* Expand the size of the allocated memory region so that we can
-     adjust for alignment. */
-  if((size % MEM_ALIGNMENT) != 0) {
-    size += MEM_ALIGNMENT - ((size + SIZEOF_STRUCT_MEM) % MEM_ALIGNMENT);
+  if(size > MAX_SIZE) {
+    if(size > MEM_NUM_SLABS * MEM_SLAB_SIZE) {
+      return NULL;
+    }
+    return mem_malloc_large(size);
   }
-  
-  if(size > MEM_SIZE) {
+
+  c = size_class[(size + MEM_QUANTUM - 1) / MEM_QUANTUM];
+  mc = mem_cache_get();
+  mag = &mc->mag[c];
+  if(mag->n == 0 && mem_cache_fill(mc, c) == 0) {
+    DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
     return NULL;
   }
-  
-  sys_sem_wait(mem_sem);
-
-  for(ptr = (uint8_t *)lfree - ram; ptr < MEM_SIZE; ptr = ((struct mem *)&ram[ptr])->next) {
-    mem = (struct mem *)&ram[ptr];
-    if(!mem->used &&
-       mem->next - (ptr + SIZEOF_STRUCT_MEM) >= size + SIZEOF_STRUCT_MEM) {
-      ptr2 = ptr + SIZEOF_STRUCT_MEM + size;
-      mem2 = (struct mem *)&ram[ptr2];
-
-      mem2->prev = ptr;      
-      mem2->next = mem->next;
-      mem->next = ptr2;      
-      if(mem2->next != MEM_SIZE) {
-        ((struct mem *)&ram[mem2->next])->prev = ptr2;
-      }
-      
-      mem2->used = 0;      
-      mem->used = 1;
-#ifdef MEM_STATS
-      stats.mem.used += size;
-      /*      if(stats.mem.max < stats.mem.used) {
-        stats.mem.max = stats.mem.used;
-	} */
-      if(stats.mem.max < ptr2) {
-        stats.mem.max = ptr2;
-      }      
-#ifdef MEM_PERF
-      mem_perf_output();
-#endif /* MEM_PERF */  
-#endif /* MEM_STATS */
-
-      if(mem == lfree) {
-	/* Find next free block after mem */
-        while(lfree->used && lfree != ram_end) {
-	  lfree = (struct mem *)&ram[lfree->next];
-        }
-        ASSERT("mem_malloc: !lfree->used", !lfree->used);
-      }
-      sys_sem_signal(mem_sem);
-      ASSERT("mem_malloc: allocated memory not above ram_end.",
-	     (uint32_t)mem + SIZEOF_STRUCT_MEM + size <= (uint32_t)ram_end);
-      ASSERT("mem_malloc: allocated memory properly aligned.",
-	     (unsigned long)((uint8_t *)mem + SIZEOF_STRUCT_MEM) % MEM_ALIGNMENT == 0);
-      return (uint8_t *)mem + SIZEOF_STRUCT_MEM;
-    }    
-  }
-  DEBUGF(MEM_DEBUG, ("mem_malloc: could not allocate %d bytes\n", (int)size));
-#ifdef MEM_STATS
-  ++stats.mem.err;
-#endif /* MEM_STATS */  
-  sys_sem_signal(mem_sem);
-  return NULL;
+  ASSERT("mem_malloc: allocated memory properly aligned.",
+         (unsigned long)mag->obj[mag->n - 1] % MEM_ALIGNMENT == 0);
+  return mag->obj[--mag->n];
 }
 /*-----------------------------------------------------------------------------------*/
 void
 mem_free(void *rmem)
 {
-  struct mem *mem;
+  struct mem_cache *mc;
+  struct magazine *mag;
+  struct slab *s;
 
   if(rmem == NULL) {
     return;
   }
-  
-  sys_sem_wait(mem_sem);
 
-  ASSERT("mem_free: legal memory", (uint8_t *)rmem >= (uint8_t *)ram &&
-	 (uint8_t *)rmem < (uint8_t *)ram_end);
-  
+  ASSERT("mem_free: legal memory", (uint8_t *)rmem >= ram &&
+	 (uint8_t *)rmem < ram + sizeof(ram));
   
-  if((uint8_t *)rmem < (uint8_t *)ram || (uint8_t *)rmem >= (uint8_t *)ram_end) {
+  if((uint8_t *)rmem < ram || (uint8_t *)rmem >= ram + sizeof(ram)) {
     DEBUGF(MEM_DEBUG, ("mem_free: illegal memory\n"));
 #ifdef MEM_STATS
     ++stats.mem.err;
 #endif /* MEM_STATS */
     return;
   }
-  mem = (struct mem *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
 
-  ASSERT("mem_free: mem->used", mem->used);
-  
-  mem->used = 0;
+  /* the class of a slab cannot change while an object is out of it */
+  s = slab_of(rmem);
+  if(s->class == SLAB_LARGE) {
+    sys_arch_sem_wait(mem_sem, 0);
+    mem_free_run(s, 0);
+    sys_sem_signal(mem_sem);
+    return;
+  }
 
-  if(mem < lfree) {
-    lfree = mem;
+  ASSERT("mem_free: rmem is an object", s->class < num_classes &&
+         ((uint8_t *)rmem - slab_ram(s)) % class_size[s->class] == 0);
+
+  mc = mem_cache_get();
+  mag = &mc->mag[s->class];
+  if(mag->n == class_mag[s->class]) {
+    mem_cache_flush(mc, s->class);
   }
-  
-#ifdef MEM_STATS
-  stats.mem.used -= mem->next - ((uint8_t *)mem - ram) - SIZEOF_STRUCT_MEM;
-#ifdef MEM_PERF
-  mem_perf_output();
-#endif /* MEM_PERF */
-  
-#endif /* MEM_STATS */
-  plug_holes(mem);
-  sys_sem_signal(mem_sem);
+  mag->obj[mag->n++] = (struct mem *)rmem;
 }
 /*-----------------------------------------------------------------------------------*/
 void *
 mem_reallocm(void *rmem, mem_size_t newsize)
 {
   void *nmem;
+  mem_size_t size;
+
   nmem = mem_malloc(newsize);
   if(nmem == NULL) {
     return mem_realloc(rmem, newsize);
   }
-  bcopy(rmem, nmem, newsize);
+  size = mem_capacity(rmem);
+  bcopy(rmem, nmem, newsize < size ? newsize : size);
   mem_free(rmem);
   return nmem;
 }
 /*-----------------------------------------------------------------------------------*/
+/* Shrinks rmem in place: an object keeps its class, and a run of slabs
+   frees those it no longer needs.  Growing rmem moves it, and returns
+   NULL, leaving rmem alone, if there is no room. */
 void *
 mem_realloc(void *rmem, mem_size_t newsize)
 {
-  mem_size_t size;
-  mem_size_t ptr, ptr2;
-  struct mem *mem, *mem2;
-  
-  sys_sem_wait(mem_sem);
+  struct slab *s;
+  mem_size_t size, n;
+  void *nmem;
   
-  ASSERT("mem_realloc: legal memory", (uint8_t *)rmem >= (uint8_t *)ram &&
-	 (uint8_t *)rmem < (uint8_t *)ram_end);
+  ASSERT("mem_realloc: legal memory", (uint8_t *)rmem >= ram &&
+	 (uint8_t *)rmem < ram + sizeof(ram));
   
-  if((uint8_t *)rmem < (uint8_t *)ram || (uint8_t *)rmem >= (uint8_t *)ram_end) {
-    DEBUGF(MEM_DEBUG, ("mem_free: illegal memory\n"));
+  if((uint8_t *)rmem < ram || (uint8_t *)rmem >= ram + sizeof(ram)) {
+    DEBUGF(MEM_DEBUG, ("mem_realloc: illegal memory\n"));
     return rmem;
   }
-  mem = (struct mem *)((uint8_t *)rmem - SIZEOF_STRUCT_MEM);
-
-  ptr = (uint8_t *)mem - ram;
 
-  size = mem->next - ptr - SIZEOF_STRUCT_MEM;
-#ifdef MEM_STATS
-  stats.mem.used -= (size - newsize);
-#ifdef MEM_PERF
-  mem_perf_output();
-#endif /* MEM_PERF */ 
-#endif /* MEM_STATS */
-  
-  if(newsize + SIZEOF_STRUCT_MEM + MIN_SIZE < size) {
-    ptr2 = ptr + SIZEOF_STRUCT_MEM + newsize;
-    mem2 = (struct mem *)&ram[ptr2];
-    mem2->used = 0;
-    mem2->next = mem->next;
-    mem2->prev = ptr;
-    mem->next = ptr2;
-    if(mem2->next != MEM_SIZE) {
-      ((struct mem *)&ram[mem2->next])->prev = ptr2;
+  s = slab_of(rmem);
+  size = mem_capacity(rmem);
+  if(newsize <= size) {
+    if(s->class == SLAB_LARGE) {
+      n = (newsize + MEM_SLAB_SIZE - 1) / MEM_SLAB_SIZE;
+      sys_arch_sem_wait(mem_sem, 0);
+      mem_free_run(s, n > 0 ? n : 1);
+      sys_sem_signal(mem_sem);
     }
+    return rmem;
+  }
 
-    plug_holes(mem2);
+  nmem = mem_malloc(newsize);
+  if(nmem != NULL) {
+    bcopy(rmem, nmem, size);
+    mem_free(rmem);
   }
-  sys_sem_signal(mem_sem);  
-  return rmem;
+  return nmem;
 }
 /*-----------------------------------------------------------------------------------*/
 #if MEM_RECLAIM
@@ -33,6 +33,33 @@
  * $Id: memp.c 301 2005-04-06 17:03:23Z casado $
  */
 
+/*-----------------------------------------------------------------------------------*/
+/* memp.c
+ *
+ * Pools of fixed size elements.
+ *
+ * Each thread keeps a LIFO cache of free elements of each pool large
+ * enough to spare some.  memp_malloc() and memp_free() use the calling
+ * thread's cache, and take the pool mutex only to move half a cache's
+ * worth to or from the pool, so the transport thread and the threads
+ * calling the API do not contend for the pool heads.  Both may be called
+ * from any thread; memp_mallocp() and memp_freep() are the same.  A
+ * cache holds no more than 1/MEMP_CACHE_SHARE of its pool.  When a pool
+ * runs dry, every thread empties its cache of that pool back into it the
+ * next time it uses the pool, so elements do not stay stranded in the
+ * caches of threads which no longer need them.  A thread which waits a
+ * long time between calls (one per connection, say) cannot do that, so
+ * once less than half a pool is free, threads take its elements one at a
+ * time and give them straight back: however many threads there are,
+ * little more than half of a pool can be held in caches.
+ *
+ * stats.memp[].used counts the elements in caches as used.  Allocations
+ * served from a thread's cache are added to cachehit whenever the thread
+ * next goes to the pool, and the others to cachemiss.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+
 #include "lwip/lwipopts.h"
 
 #include "lwip/memp.h"
@@ -47,14 +74,43 @@
 #include "lwip/sys.h"
 #include "lwip/stats.h"
 
+#include <pthread.h>
+#include <string.h>
+
+#define MEMP_CACHE_SHARE 16
+
 struct memp {
   struct memp *next;
 };
 
+struct memp_cache {
+  uint16_t n;
+  struct memp *elem[MEMP_CACHE_SIZE];
+};
+
+/* the caches of a thread */
+struct memp_thread {
+  struct memp_cache cache[MEMP_MAX];
+  uint32_t hits[MEMP_MAX];    /* not yet added to the stats */
+  uint32_t drained[MEMP_MAX]; /* memp_drain when the cache was last emptied */
+  int registered;             /* to be emptied when the thread exits */
+};
+
+static __thread struct memp_thread memp_thread;
+static pthread_key_t memp_thread_key;
+
+/* how many free elements of each pool a thread may cache, 0 for none */
+static uint16_t memp_cache_size[MEMP_MAX];
+
+/* bumped when a pool runs dry, to have the threads empty their caches */
+static volatile uint32_t memp_drain[MEMP_MAX];
 
 
 static struct memp *memp_tab[MEMP_MAX];
 
+/* how many elements of each pool are free in it, not counting caches */
+static volatile uint16_t memp_avail[MEMP_MAX];
+
 static const uint16_t memp_sizes[MEMP_MAX] = {
   sizeof(struct pbuf),
   sizeof(struct udp_pcb),
@@ -125,6 +181,7 @@ static uint8_t memp_reclaim(memp_t type);
 #endif /* MEMP_RECLAIM */
 
 /*-----------------------------------------------------------------------------------*/
+/* guards the pools: never held while calling out */
 static sys_sem_t mutex;
 /*-----------------------------------------------------------------------------------*/
 #ifdef LWIP_DEBUG
@@ -150,9 +207,109 @@ memp_sanity(void)
 }
 #endif /* LWIP_DEBUG */
 /*-----------------------------------------------------------------------------------*/
+/* Moves up to n free elements of pool type to elem, and returns how many
+   it moved.  The mutex must be held. */
+static uint16_t
+memp_pool_get(memp_t type, struct memp **elem, uint16_t n)
+{
+  uint16_t i;
+
+  for(i = 0; i < n && memp_tab[type] != NULL; i++) {
+    elem[i] = memp_tab[type];
+    memp_tab[type] = elem[i]->next;
+    elem[i]->next = NULL;
+  }
+  memp_avail[type] -= i;
+#ifdef MEMP_STATS
+  stats.memp[type].used += i;
+  if(stats.memp[type].used > stats.memp[type].max) {
+    stats.memp[type].max = stats.memp[type].used;
+  }
+#endif /* MEMP_STATS */
+  return i;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Returns the n elements in elem to pool type.  The mutex must be
+   held. */
+static void
+memp_pool_put(memp_t type, struct memp **elem, uint16_t n)
+{
+  uint16_t i;
+
+  for(i = 0; i < n; i++) {
+    elem[i]->next = memp_tab[type];
+    memp_tab[type] = elem[i];
+  }
+  memp_avail[type] += n;
+#ifdef MEMP_STATS
+  stats.memp[type].used -= n;
+#endif /* MEMP_STATS */
+  ASSERT("memp sanity", memp_sanity());
+}
+/*-----------------------------------------------------------------------------------*/
+/* Adds the cache hits of mt on pool type to the stats.  The mutex must
+   be held. */
+static void
+memp_thread_hits(struct memp_thread *mt, memp_t type)
+{
+#ifdef MEMP_STATS
+  stats.memp[type].cachehit += mt->hits[type];
+#endif /* MEMP_STATS */
+  mt->hits[type] = 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Empties the cache of mt for pool type if the pool ran dry since it
+   was last emptied. */
+static void
+memp_thread_drain(struct memp_thread *mt, memp_t type)
+{
+  struct memp_cache *mc = &mt->cache[type];
+
+  if(mt->drained[type] == memp_drain[type]) {
+    return;
+  }
+  sys_arch_sem_wait(mutex, 0);
+  mt->drained[type] = memp_drain[type];
+  memp_pool_put(type, mc->elem, mc->n);
+  mc->n = 0;
+  sys_sem_signal(mutex);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Called as a thread exits with the caches it used. */
+static void
+memp_thread_release(void *arg)
+{
+  struct memp_thread *mt = (struct memp_thread *)arg;
+  int i;
+
+  /* anything freed by a later destructor registers the caches again */
+  mt->registered = 0;
+  sys_arch_sem_wait(mutex, 0);
+  for(i = 0; i < MEMP_MAX; ++i) {
+    mt->drained[i] = memp_drain[i];
+    memp_pool_put(i, mt->cache[i].elem, mt->cache[i].n);
+    mt->cache[i].n = 0;
+    memp_thread_hits(mt, i);
+  }
+  sys_sem_signal(mutex);
+}
+/*-----------------------------------------------------------------------------------*/
+static struct memp_thread *
+memp_thread_get(void)
+{
+  struct memp_thread *mt = &memp_thread;
+
+  if(!mt->registered) {
+    pthread_setspecific(memp_thread_key, mt);
+    mt->registered = 1;
+  }
+  return mt;
+}
+/*-----------------------------------------------------------------------------------*/
 void
 memp_init(void)
 {
+    static int key_created = 0;
     struct memp *m, *memp;
     uint16_t i, j;
     uint16_t size;
@@ -161,6 +318,7 @@ memp_init(void)
     for(i = 0; i < MEMP_MAX; ++i) {
         stats.memp[i].used = stats.memp[i].max =
             stats.memp[i].err = stats.memp[i].reclaimed = 0;
+        stats.memp[i].cachehit = stats.memp[i].cachemiss = 0;
         stats.memp[i].avail = memp_num[i];
     }
 #endif /* MEMP_STATS */
@@ -182,6 +340,24 @@ memp_init(void)
         } else {
             memp_tab[i] = NULL;
         }
+
+        memp_drain[i] = 0;
+        memp_avail[i] = memp_num[i];
+
+        /* a cache of one would go to the pool on every other call */
+        memp_cache_size[i] = memp_num[i] / MEMP_CACHE_SHARE;
+        if(memp_cache_size[i] > MEMP_CACHE_SIZE) {
+            memp_cache_size[i] = MEMP_CACHE_SIZE;
+        } else if(memp_cache_size[i] < 2) {
+            memp_cache_size[i] = 0;
+        }
+    }
+
+    /* the calling thread's caches; no other may be using the pools */
+    bzero(&memp_thread, sizeof(memp_thread));
+    if(!key_created) {
+        pthread_key_create(&memp_thread_key, memp_thread_release);
+        key_created = 1;
     }
 
     mutex = sys_sem_new(1);
@@ -192,48 +368,68 @@ memp_init(void)
     }
 #endif /* MEMP_RECLAIM */
 
+}
+/*-----------------------------------------------------------------------------------*/
+/* Says whether less than half of pool type is free, when threads should
+   not keep its elements in their caches.  Read without the mutex, it is
+   only a hint. */
+static int
+memp_low(memp_t type)
+{
+  return memp_avail[type] < memp_num[type] / 2;
 }
 /*-----------------------------------------------------------------------------------*/
 void *
 memp_malloc(memp_t type)
 {
+    struct memp_thread *mt;
+    struct memp_cache *mc;
     struct memp *memp;
 
     ASSERT("memp_malloc: type < MEMP_MAX", type < MEMP_MAX);
 
-    memp = memp_tab[type];
+    mt = memp_thread_get();
+    mc = &mt->cache[type];
+    memp_thread_drain(mt, type);
 
-    if(memp != NULL) 
-    {    
-        memp_tab[type] = memp->next;    
-        memp->next = NULL;
+    if(mc->n > 0) {
+        memp = mc->elem[--mc->n];
+        mt->hits[type]++;
+    } else {
+        memp = NULL;
+        sys_arch_sem_wait(mutex, 0);
+        if(memp_cache_size[type] == 0 || memp_low(type)) {
+            memp_pool_get(type, &memp, 1);
+        } else if((mc->n = memp_pool_get(type, mc->elem, memp_cache_size[type] / 2)) > 0) {
+            memp = mc->elem[--mc->n];
+        }
+        memp_thread_hits(mt, type);
+        if(memp == NULL && memp_cache_size[type] > 0) {
+            mt->drained[type] = ++memp_drain[type];
+        }
 #ifdef MEMP_STATS
-        ++stats.memp[type].used;
-        if(stats.memp[type].used > stats.memp[type].max) {
-            stats.memp[type].max = stats.memp[type].used;
+        ++stats.memp[type].cachemiss;
+        if(memp == NULL) {
+            ++stats.memp[type].err;
         }
 #endif /* MEMP_STATS */
-        ASSERT("memp_malloc: memp properly aligned",
-                ((uint32_t)MEM_ALIGN((uint8_t *)memp + sizeof(struct memp)) % MEM_ALIGNMENT) == 0);
+        sys_sem_signal(mutex);
+    }
 
-        return MEM_ALIGN((uint8_t *)memp + sizeof(struct memp));
-    } else {
+    if(memp == NULL) {
         DEBUGF(MEMP_DEBUG, ("memp_malloc: out of memory in pool %d\n", type));
-#ifdef MEMP_STATS
-        ++stats.memp[type].err;
-#endif /* MEMP_STATS */
         return NULL;
     }
+    ASSERT("memp_malloc: memp properly aligned",
+            ((unsigned long)MEM_ALIGN((uint8_t *)memp + sizeof(struct memp)) % MEM_ALIGNMENT) == 0);
+
+    return MEM_ALIGN((uint8_t *)memp + sizeof(struct memp));
 }
 /*-----------------------------------------------------------------------------------*/
 void *
 memp_mallocp(memp_t type)
 {
-  void *mem;
-  sys_sem_wait(mutex);
-  mem = memp_malloc(type);
-  sys_sem_signal(mutex);
-  return mem;
+  return memp_malloc(type);
 }
 /*-----------------------------------------------------------------------------------*/
 void *
@@ -276,30 +472,42 @@ memp_realloc(memp_t fromtype, memp_t totype, void *mem)
 void
 memp_free(memp_t type, void *mem)
 {
+  struct memp_thread *mt;
+  struct memp_cache *mc;
   struct memp *memp;
+  uint16_t n;
 
   if(mem == NULL) {
     return;
   }
   memp = (struct memp *)((uint8_t *)mem - sizeof(struct memp));
 
-#ifdef MEMP_STATS
-  stats.memp[type].used--; 
-#endif /* MEMP_STATS */
-  
-  memp->next = memp_tab[type]; 
-  memp_tab[type] = memp;
+  if(memp_cache_size[type] == 0 || memp_low(type)) {
+    sys_arch_sem_wait(mutex, 0);
+    memp_pool_put(type, &memp, 1);
+    sys_sem_signal(mutex);
+    return;
+  }
 
-  ASSERT("memp sanity", memp_sanity());
-  return;
+  /* a full cache gives its older half back to the pool */
+  mt = memp_thread_get();
+  mc = &mt->cache[type];
+  memp_thread_drain(mt, type);
+  if(mc->n == memp_cache_size[type]) {
+    n = mc->n / 2;
+    sys_arch_sem_wait(mutex, 0);
+    memp_pool_put(type, mc->elem, n);
+    sys_sem_signal(mutex);
+    mc->n -= n;
+    memmove(mc->elem, mc->elem + n, mc->n * sizeof(mc->elem[0]));
+  }
+  mc->elem[mc->n++] = memp;
 }
 /*-----------------------------------------------------------------------------------*/
 void 
 memp_freep(memp_t type, void *mem)
 {
-  sys_sem_wait(mutex);
   memp_free(type, mem);
-  sys_sem_signal(mutex);
 }
 /*-----------------------------------------------------------------------------------*/
 #if MEMP_RECLAIM
@@ -304,6 +304,39 @@ pbuf_alloc(pbuf_layer l, uint16_t size, pbuf_flag flag)
   return p;
 }
 /*-----------------------------------------------------------------------------------*/
+/* pbuf_alloc_ref():
+ *
+ * Allocates a pbuf for size bytes at payload which stay in the
+ * caller's buffer, so that a packet can be handed over without being
+ * copied. Headers may be prepended to it as far back as base. The
+ * pbuf itself comes from the heap, and when it is freed release(arg)
+ * is called to give the buffer back.
+ */
+/*-----------------------------------------------------------------------------------*/
+struct pbuf *
+pbuf_alloc_ref(void *base, void *payload, uint16_t size,
+	       void (* release)(void *arg), void *arg)
+{
+  struct ref_pbuf *r;
+
+  ASSERT("pbuf_alloc_ref: payload within the buffer",
+	 (uint8_t *)payload >= (uint8_t *)base);
+
+  r = (struct ref_pbuf *)mem_malloc(sizeof(struct ref_pbuf));
+  if(r == NULL) {
+    return NULL;
+  }
+  r->pbuf.next = NULL;
+  r->pbuf.flags = PBUF_FLAG_REF;
+  r->pbuf.ref = 1;
+  r->pbuf.payload = payload;
+  r->pbuf.len = r->pbuf.tot_len = size;
+  r->base = base;
+  r->release = release;
+  r->arg = arg;
+  return &r->pbuf;
+}
+/*-----------------------------------------------------------------------------------*/
 /* pbuf_refresh():
  *
  * Moves free buffers from the pbuf_pool_free_cache to the pbuf_pool
@@ -365,7 +398,8 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
 
   ASSERT("pbuf_realloc: sane p->flags", p->flags == PBUF_FLAG_POOL ||
          p->flags == PBUF_FLAG_ROM ||
-         p->flags == PBUF_FLAG_RAM);
+         p->flags == PBUF_FLAG_RAM ||
+         p->flags == PBUF_FLAG_REF);
 
   
   if(p->tot_len <= size) {
@@ -398,6 +432,7 @@ pbuf_realloc(struct pbuf *p, uint16_t size)
     }
     break;
   case PBUF_FLAG_ROM:    
+  case PBUF_FLAG_REF:
     p->len = size;
     break;
   case PBUF_FLAG_RAM:
@@ -441,16 +476,22 @@ uint8_t
 pbuf_header(struct pbuf *p, int16_t header_size)
 {
   void *payload;
+  uint8_t *start;
 
   payload = p->payload;
   p->payload = (uint8_t *)p->payload - header_size/sizeof(uint8_t);
 
   DEBUGF(PBUF_DEBUG, ("pbuf_header: old %p new %p (%d)\n", payload, p->payload, header_size));
   
-  if((uint8_t *)p->payload < (uint8_t *)p + sizeof(struct pbuf)) {
+  /* The headers of a PBUF_REF pbuf go in the owner's buffer. */
+  if(p->flags == PBUF_FLAG_REF) {
+    start = (uint8_t *)((struct ref_pbuf *)p)->base;
+  } else {
+    start = (uint8_t *)p + sizeof(struct pbuf);
+  }
+  if((uint8_t *)p->payload < start) {
     DEBUGF(PBUF_DEBUG, ("pbuf_header: failed %p %p\n",
-			(uint8_t *)p->payload,
-			(uint8_t *)p + sizeof(struct pbuf)));
+			(uint8_t *)p->payload, start));
     p->payload = payload;
     return -1;
   }
@@ -479,16 +520,16 @@ pbuf_free(struct pbuf *p)
 
   ASSERT("pbuf_free: sane flags", p->flags == PBUF_FLAG_POOL ||
          p->flags == PBUF_FLAG_ROM ||
-         p->flags == PBUF_FLAG_RAM);
+         p->flags == PBUF_FLAG_RAM ||
+         p->flags == PBUF_FLAG_REF);
   
   ASSERT("pbuf_free: p->ref > 0", p->ref > 0);
     
-  /* Decrement reference count. */  
-  p->ref--;
-
   q = NULL;
-  /* If reference count == 0, actually deallocate pbuf. */
-  if(p->ref == 0) {
+  /* Decrement reference count. If reference count == 0, actually
+     deallocate pbuf. The router may drop its reference to a segment
+     from a thread of its own, so this is atomic. */
+  if(__sync_sub_and_fetch(&p->ref, 1) == 0) {
 
     while(p != NULL) {
       /* Check if this is a pbuf from the pool. */
@@ -503,6 +544,10 @@ pbuf_free(struct pbuf *p)
       } else if(p->flags == PBUF_FLAG_ROM) {
 	q = p->next;
 	memp_freep(MEMP_PBUF, p);
+      } else if(p->flags == PBUF_FLAG_REF) {
+	q = p->next;
+	((struct ref_pbuf *)p)->release(((struct ref_pbuf *)p)->arg);
+	mem_free(p);
       } else {
 	q = p->next;
 	mem_free(p);
@@ -547,7 +592,7 @@ pbuf_ref(struct pbuf *p)
   if(p == NULL) {
     return;
   }
-  ++(p->ref);
+  __sync_fetch_and_add(&p->ref, 1);
 }
 /*-----------------------------------------------------------------------------------*/
 /* pbuf_chain():
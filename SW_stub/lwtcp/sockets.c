@@ -39,20 +39,82 @@
 #include "lwip/arch.h"
 #include "lwip/sockets.h"
 
-#define NUM_SOCKETS 10
+#include <errno.h>
+#include <fcntl.h>
+
+/* Every netconn can have a socket. Epoll sets are numbered after the
+   sockets, so that lwip_close() can tell them apart. */
+#define NUM_SOCKETS MEMP_NUM_NETCONN
+#define NUM_EPOLLS  16
 
 /* -- defined in api_lib.c -- */
 void
 netbuf_copy_partial(struct netbuf *buf, void *dataptr, uint16_t len, uint16_t
 		offset);
 
+struct lwip_epoll;
+
 struct lwip_socket {
   struct netconn *conn;
   struct netbuf *lastdata;
   uint16_t lastoffset;
+  /* How many things the netconn's callback has been told are in its
+     recvmbox or acceptmbox, less those taken out; while it is above
+     zero, receiving or accepting does not wait. */
+  int rcvevent;
+  /* Whether there is room to send, and the error the connection
+     failed with (ERR_OK if none). Like rcvevent these follow the
+     netconn's callback, which runs on the transport thread, so that
+     nothing here need look at the pcb, which that thread owns. */
+  int sendevent;
+  err_t err;
+  /* Set once the connection has been found closed, after which
+     receiving does not wait either. */
+  uint8_t eof;
+  int flags;
+  /* The epoll set watching the socket, for what, and the socket's
+     place on the set's list of sockets that may be ready. */
+  struct lwip_epoll *ep;
+  uint32_t events;
+  epoll_data_t data;
+  struct lwip_socket *ready_next, **ready_pprev;
+};
+
+/* An epoll set. Sockets that have become ready for something the set
+   watches them for are put on its ready list, in the order they
+   became ready, and sem is signalled to wake lwip_epoll_wait(). */
+struct lwip_epoll {
+  int used;
+  sys_sem_t sem;
+  struct lwip_socket *ready, **ready_tail;
+};
+
+/* A thread waiting in lwip_poll(), woken whenever any socket may have
+   become ready. */
+struct lwip_poll_waiter {
+  struct lwip_poll_waiter *next;
+  sys_sem_t sem;
 };
 
 static struct lwip_socket sockets[NUM_SOCKETS];
+static struct lwip_epoll epolls[NUM_EPOLLS];
+static struct lwip_poll_waiter *poll_waiters;
+
+/* Guards the sockets, the epoll sets and the poll waiters against
+   the applications and the netconn callbacks, which run on the
+   transport thread. */
+static sys_sem_t socksem;
+
+static void event_callback(struct netconn *conn, enum netconn_evt evt,
+			   uint16_t len);
+static int epoll_close(int epfd);
+
+/*-----------------------------------------------------------------------------------*/
+void
+lwip_socket_init(void)
+{
+  socksem = sys_sem_new(1);
+}
 
 /*-----------------------------------------------------------------------------------*/
 static struct lwip_socket *
@@ -60,37 +122,201 @@ get_socket(int s)
 {
   struct lwip_socket *sock;
   
-  if(s > NUM_SOCKETS) {
-    /* errno = EBADF; */
+  if(s < 0 || s >= NUM_SOCKETS) {
+    errno = EBADF;
     return NULL;
   }
   
   sock = &sockets[s];
 
   if(sock->conn == NULL) {
-    /* errno = EBADF; */
+    errno = EBADF;
     return NULL;
   }
   return sock;
 }
 /*-----------------------------------------------------------------------------------*/
 static int
-alloc_socket(struct netconn *newconn)
+alloc_socket(struct netconn *newconn, int accepted)
 {
   int i;
   
   /* allocate a new socket identifier */
+  sys_arch_sem_wait(socksem, 0);
   for(i = 0; i < NUM_SOCKETS; ++i) {
     if(sockets[i].conn == NULL) {
       sockets[i].conn = newconn;
       sockets[i].lastdata = NULL;
       sockets[i].lastoffset = 0;
+      /* Anything that arrived before the socket existed was counted
+	 in newconn->socket; see event_callback(). */
+      sockets[i].rcvevent = -1 - newconn->socket;
+      /* An accepted connection is established with nothing sent yet;
+	 a new TCP one is writable once it connects. */
+      sockets[i].sendevent = newconn->type != NETCONN_TCP || accepted;
+      sockets[i].err = ERR_OK;
+      sockets[i].eof = 0;
+      sockets[i].flags = 0;
+      sockets[i].ep = NULL;
+      sockets[i].events = 0;
+      sockets[i].ready_pprev = NULL;
+      newconn->socket = i;
+      sys_sem_signal(socksem);
       return i;
     }
   }
+  sys_sem_signal(socksem);
   return -1;
 }
 /*-----------------------------------------------------------------------------------*/
+/* Says whether a socket is ready to be read from, written to, or has
+   failed, as EPOLLIN, EPOLLOUT and EPOLLERR | EPOLLHUP, which are the
+   same as the POLL* flags. Reads only the socket's own state, so it
+   must be called with socksem held. */
+static uint32_t
+sock_events(struct lwip_socket *sock)
+{
+  uint32_t events = 0;
+
+  if(sock->lastdata != NULL || sock->rcvevent > 0 || sock->eof) {
+    events |= EPOLLIN;
+  }
+  if(sock->sendevent) {
+    events |= EPOLLOUT;
+  }
+  if(sock->err != ERR_OK) {
+    events |= EPOLLERR | EPOLLHUP;
+  }
+  return events;
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+ready_add(struct lwip_socket *sock)
+{
+  struct lwip_epoll *ep = sock->ep;
+
+  if(sock->ready_pprev == NULL) {
+    sock->ready_next = NULL;
+    sock->ready_pprev = ep->ready_tail;
+    *ep->ready_tail = sock;
+    ep->ready_tail = &sock->ready_next;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+ready_remove(struct lwip_socket *sock)
+{
+  if(sock->ready_pprev != NULL) {
+    *sock->ready_pprev = sock->ready_next;
+    if(sock->ready_next != NULL) {
+      sock->ready_next->ready_pprev = sock->ready_pprev;
+    } else {
+      sock->ep->ready_tail = sock->ready_pprev;
+    }
+    sock->ready_pprev = NULL;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Puts a socket that is ready for what its epoll set watches it for
+   on the set's ready list, and wakes everyone in lwip_poll() to look
+   again. Called with socksem held. */
+static void
+sock_wakeup(struct lwip_socket *sock)
+{
+  struct lwip_poll_waiter *w;
+
+  if(sock->ep != NULL &&
+     (sock_events(sock) & (sock->events | EPOLLERR | EPOLLHUP)) != 0 &&
+     sock->ready_pprev == NULL) {
+    ready_add(sock);
+    sys_sem_signal(sock->ep->sem);
+  }
+  for(w = poll_waiters; w != NULL; w = w->next) {
+    sys_sem_signal(w->sem);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * event_callback():
+ *
+ * Called by a socket's netconn, on the transport thread, whenever
+ * something is posted to its mailboxes or taken from them, whenever
+ * it has room to send again or runs out of it, and when it fails. A
+ * connection not yet accepted has no socket: what arrives
+ * for it is counted down from -1 in conn->socket, for alloc_socket()
+ * to pick up.
+ */
+static void
+event_callback(struct netconn *conn, enum netconn_evt evt, uint16_t len)
+{
+  struct lwip_socket *sock;
+
+  sys_arch_sem_wait(socksem, 0);
+  if(conn->socket < 0) {
+    if(evt == NETCONN_EVT_RCVPLUS) {
+      conn->socket--;
+    }
+    sys_sem_signal(socksem);
+    return;
+  }
+
+  sock = &sockets[conn->socket];
+  if(sock->conn == conn) {
+    switch(evt) {
+    case NETCONN_EVT_RCVPLUS:
+      sock->rcvevent++;
+      sock_wakeup(sock);
+      break;
+    case NETCONN_EVT_RCVMINUS:
+      sock->rcvevent--;
+      break;
+    case NETCONN_EVT_SENDPLUS:
+      sock->sendevent = 1;
+      sock_wakeup(sock);
+      break;
+    case NETCONN_EVT_SENDMINUS:
+      sock->sendevent = 0;
+      break;
+    case NETCONN_EVT_ERROR:
+      /* Written by the transport thread, which calls us. */
+      sock->err = conn->err;
+      sock_wakeup(sock);
+      break;
+    }
+  }
+  sys_sem_signal(socksem);
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+err_to_errno(err_t err)
+{
+  switch(err) {
+  case ERR_MEM:
+    return ENOMEM;
+  case ERR_BUF:
+    return ENOBUFS;
+  case ERR_ABRT:
+    return ECONNABORTED;
+  case ERR_RST:
+    return ECONNRESET;
+  case ERR_CLSD:
+  case ERR_CONN:
+    return ENOTCONN;
+  case ERR_USE:
+    return EADDRINUSE;
+  case ERR_RTE:
+    return EHOSTUNREACH;
+  default:
+    return EINVAL;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+sock_nonblocking(struct lwip_socket *sock, unsigned int flags)
+{
+  return (flags & MSG_DONTWAIT) || (sock->flags & O_NONBLOCK);
+}
+/*-----------------------------------------------------------------------------------*/
 int
 lwip_accept(int s, struct sockaddr *addr, int *addrlen)
 {
@@ -104,19 +330,31 @@ lwip_accept(int s, struct sockaddr *addr, int *addrlen)
   if(sock == NULL) {
     return -1;
   }
+
+  if(sock_nonblocking(sock, 0) && sock->rcvevent <= 0) {
+    errno = EWOULDBLOCK;
+    return -1;
+  }
   
   newconn = netconn_accept(sock->conn);
+  if(newconn == NULL) {
+    errno = ECONNABORTED;
+    return -1;
+  }
     
   /* get the IP address and port of the remote host */
-  netconn_peer(newconn, &naddr, &port);
+  if(addr != NULL && addrlen != NULL) {
+    netconn_peer(newconn, &naddr, &port);
   
-  ((struct sockaddr_in *)addr)->sin_addr.s_addr = naddr->addr;
-  ((struct sockaddr_in *)addr)->sin_port = port;
+    ((struct sockaddr_in *)addr)->sin_addr.s_addr = naddr->addr;
+    ((struct sockaddr_in *)addr)->sin_port = htons(port);
+    *addrlen = sizeof(struct sockaddr_in);
+  }
 
-  newsock = alloc_socket(newconn);
+  newsock = alloc_socket(newconn, 1);
   if(newsock == -1) {  
     netconn_delete(newconn);
-    /* errno = ENOBUFS; */
+    errno = ENOBUFS;
   }
   return newsock;
 }
@@ -140,7 +378,7 @@ lwip_bind(int s, struct sockaddr *name, int namelen)
   err = netconn_bind(sock->conn, &remote_addr, ntohs(remote_port));
 
   if(err != ERR_OK) {
-    /* errno = ... */
+    errno = err_to_errno(err);
     return -1;
   }
 
@@ -151,21 +389,37 @@ int
 lwip_close(int s)
 {
   struct lwip_socket *sock;
+  struct netconn *conn;
+  struct netbuf *lastdata;
   
   DEBUGF(SOCKETS_DEBUG, ("close: socket %d\n", s));
+  if(s >= NUM_SOCKETS) {
+    return epoll_close(s);
+  }
+
+  /* Let the socket go first, so that the netconn's callback finds
+     it is no longer the netconn's while it is being deleted. */
+  sys_arch_sem_wait(socksem, 0);
   sock = get_socket(s);
   if(sock == NULL) {
+    sys_sem_signal(socksem);
     return -1;
   }
-  
-  
-  netconn_delete(sock->conn);
-  if(sock->lastdata != NULL) {
-    netbuf_delete(sock->lastdata);
+  if(sock->ep != NULL) {
+    ready_remove(sock);
+    sock->ep = NULL;
   }
+  conn = sock->conn;
+  lastdata = sock->lastdata;
   sock->lastdata = NULL;
   sock->lastoffset = 0;
   sock->conn = NULL;
+  sys_sem_signal(socksem);
+  
+  netconn_delete(conn);
+  if(lastdata != NULL) {
+    netbuf_delete(lastdata);
+  }
   return 0;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -188,7 +442,7 @@ lwip_connect(int s, struct sockaddr *name, int namelen)
   err = netconn_connect(sock->conn, &remote_addr, ntohs(remote_port));
 
   if(err != ERR_OK) {
-    /* errno = ... */
+    errno = err_to_errno(err);
     return -1;
   }
 
@@ -209,7 +463,7 @@ lwip_listen(int s, int backlog)
   err = netconn_listen(sock->conn);
 
   if(err != ERR_OK) {
-    /* errno = ... */
+    errno = err_to_errno(err);
     return -1;
   }
 
@@ -237,11 +491,19 @@ lwip_recvfrom(int s, void *mem, int len, unsigned int flags,
     buf = sock->lastdata;
   } else {
     /* No data was left from the previous operation, so we try to get
-       some from the network. */
+       some from the network, unless that would mean waiting. */
+    if(sock_nonblocking(sock, flags) && sock->rcvevent <= 0 &&
+       sock->conn->recvmbox != SYS_MBOX_NULL &&
+       sock->conn->err == ERR_OK) {
+      errno = EWOULDBLOCK;
+      return -1;
+    }
+
     buf = netconn_recv(sock->conn);
     
     if(buf == NULL) {
       /* We should really do some error checking here. */
+      sock->eof = 1;
       return 0;
     }
   }
@@ -310,6 +572,7 @@ lwip_send(int s, void *data, int size, unsigned int flags)
 {
   struct lwip_socket *sock;
   struct netbuf *buf;
+  struct tcp_pcb *pcb;
   err_t err;
 
   DEBUGF(SOCKETS_DEBUG, ("send: socket %d, size %d\n", s, size));
@@ -325,7 +588,7 @@ lwip_send(int s, void *data, int size, unsigned int flags)
     buf = netbuf_new();
 
     if(buf == NULL) {
-      /* errno = ENOBUFS; */
+      errno = ENOBUFS;
       return -1;
     }
     
@@ -340,6 +603,21 @@ lwip_send(int s, void *data, int size, unsigned int flags)
     netbuf_delete(buf);
     break;
   case NETCONN_TCP:
+    /* Without waiting, send only what the send buffer has room for. */
+    if(sock_nonblocking(sock, flags)) {
+      pcb = sock->conn->pcb.tcp;
+      if(pcb == NULL) {
+	errno = ENOTCONN;
+	return -1;
+      }
+      if(tcp_sndbuf(pcb) == 0) {
+	errno = EWOULDBLOCK;
+	return -1;
+      }
+      if(size > tcp_sndbuf(pcb)) {
+	size = tcp_sndbuf(pcb);
+      }
+    }
     err = netconn_write(sock->conn, data, size, NETCONN_COPY);
     break;
   default:
@@ -347,7 +625,7 @@ lwip_send(int s, void *data, int size, unsigned int flags)
     break;
   }
   if(err != ERR_OK) {
-    /* errno = ... */
+    errno = err_to_errno(err);
     return -1;    
   }
     
@@ -392,26 +670,26 @@ lwip_socket(int domain, int type, int protocol)
   /* create a netconn */
   switch(type) {
   case SOCK_DGRAM:
-    conn = netconn_new(NETCONN_UDP);
+    conn = netconn_new_with_callback(NETCONN_UDP, event_callback);
     break;
   case SOCK_STREAM:
-    conn = netconn_new(NETCONN_TCP);
+    conn = netconn_new_with_callback(NETCONN_TCP, event_callback);
     break;
   default:
-    /* errno = ... */
+    errno = EINVAL;
     return -1;
   }
 
   if(conn == NULL) {
     DEBUGF(SOCKETS_DEBUG, ("socket: could not create netconn.\n"));
-    /* errno = ENOBUFS; */
+    errno = ENOBUFS;
     return -1;
   }
 
-  i = alloc_socket(conn);
+  i = alloc_socket(conn, 0);
 
   if(i == -1) {
-    /* errno = ENOBUFS; */
+    errno = ENOBUFS;
     netconn_delete(conn);
   }
   return i;
@@ -420,31 +698,312 @@ lwip_socket(int domain, int type, int protocol)
 int
 lwip_write(int s, void *data, int size)
 {
-  struct lwip_socket *sock;
-  err_t err;
-
   DEBUGF(SOCKETS_DEBUG, ("write: socket %d, size %d\n", s, size));
 
+  return lwip_send(s, data, size, 0);
+}
+/*-----------------------------------------------------------------------------------*/
+int
+lwip_fcntl(int s, int cmd, int val)
+{
+  struct lwip_socket *sock;
+
   sock = get_socket(s);
   if(sock == NULL) {
     return -1;
   }
-    
-  switch(netconn_type(sock->conn)) {
-  case NETCONN_UDP:
-    return lwip_send(s, data, size, 0);
 
-  case NETCONN_TCP:
-    err = netconn_write(sock->conn, data, size, NETCONN_COPY);
-    break;
+  switch(cmd) {
+  case F_GETFL:
+    return sock->flags;
+  case F_SETFL:
+    /* O_NONBLOCK is the only flag a socket has. */
+    sock->flags = val & O_NONBLOCK;
+    return 0;
   default:
-    err = ERR_ARG;
+    errno = EINVAL;
+    return -1;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * sem_wait_timeout():
+ *
+ * Waits on sem for at most *timeout milliseconds, or for ever if
+ * *timeout is negative, and takes what was waited off *timeout.
+ */
+static void
+sem_wait_timeout(sys_sem_t sem, int *timeout)
+{
+  uint16_t wait, waited;
+
+  if(*timeout < 0) {
+    sys_arch_sem_wait(sem, 0);
+    return;
+  }
+  wait = *timeout > 0xffff ? 0xffff : *timeout;
+  waited = sys_arch_sem_wait(sem, wait);
+  if(waited == 0 || waited > wait) {
+    waited = wait;
+  }
+  *timeout -= waited;
+}
+/*-----------------------------------------------------------------------------------*/
+static struct lwip_epoll *
+get_epoll(int epfd)
+{
+  struct lwip_epoll *ep;
+
+  if(epfd < NUM_SOCKETS || epfd >= NUM_SOCKETS + NUM_EPOLLS) {
+    errno = EBADF;
+    return NULL;
+  }
+  ep = &epolls[epfd - NUM_SOCKETS];
+  if(!ep->used) {
+    errno = EBADF;
+    return NULL;
+  }
+  return ep;
+}
+/*-----------------------------------------------------------------------------------*/
+int
+lwip_epoll_create(int size)
+{
+  sys_sem_t sem;
+  int i;
+
+  if(size <= 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  sem = sys_sem_new(0);
+  if(sem == SYS_SEM_NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  sys_arch_sem_wait(socksem, 0);
+  for(i = 0; i < NUM_EPOLLS; ++i) {
+    if(!epolls[i].used) {
+      epolls[i].used = 1;
+      epolls[i].sem = sem;
+      epolls[i].ready = NULL;
+      epolls[i].ready_tail = &epolls[i].ready;
+      sys_sem_signal(socksem);
+      return NUM_SOCKETS + i;
+    }
+  }
+  sys_sem_signal(socksem);
+  sys_sem_free(sem);
+  errno = EMFILE;
+  return -1;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+epoll_close(int epfd)
+{
+  struct lwip_epoll *ep;
+  int i;
+
+  sys_arch_sem_wait(socksem, 0);
+  ep = get_epoll(epfd);
+  if(ep == NULL) {
+    sys_sem_signal(socksem);
+    return -1;
+  }
+  for(i = 0; i < NUM_SOCKETS; ++i) {
+    if(sockets[i].conn != NULL && sockets[i].ep == ep) {
+      ready_remove(&sockets[i]);
+      sockets[i].ep = NULL;
+    }
+  }
+  ep->used = 0;
+  sys_sem_signal(socksem);
+  sys_sem_free(ep->sem);
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * lwip_epoll_ctl():
+ *
+ * Adds a socket to an epoll set, changes what it is watched for, or
+ * removes it, as epoll_ctl() does. A socket can be in only one set.
+ */
+int
+lwip_epoll_ctl(int epfd, int op, int s, struct epoll_event *event)
+{
+  struct lwip_epoll *ep;
+  struct lwip_socket *sock;
+
+  sys_arch_sem_wait(socksem, 0);
+  ep = get_epoll(epfd);
+  sock = ep != NULL ? get_socket(s) : NULL;
+  if(sock == NULL) {
+    sys_sem_signal(socksem);
+    return -1;
+  }
+
+  switch(op) {
+  case EPOLL_CTL_ADD:
+    if(sock->ep != NULL) {
+      sys_sem_signal(socksem);
+      errno = EEXIST;
+      return -1;
+    }
+    sock->ep = ep;
+    break;
+  case EPOLL_CTL_MOD:
+  case EPOLL_CTL_DEL:
+    if(sock->ep != ep) {
+      sys_sem_signal(socksem);
+      errno = ENOENT;
+      return -1;
+    }
+    ready_remove(sock);
+    if(op == EPOLL_CTL_DEL) {
+      sock->ep = NULL;
+      sys_sem_signal(socksem);
+      return 0;
+    }
     break;
+  default:
+    sys_sem_signal(socksem);
+    errno = EINVAL;
+    return -1;
   }
-  if(err != ERR_OK) {
-    /* errno = ... */
+
+  /* A socket that is ready already is reported without waiting for
+     it to become ready again. */
+  sock->events = event->events;
+  sock->data = event->data;
+  sock_wakeup(sock);
+  sys_sem_signal(socksem);
+  return 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * lwip_epoll_wait():
+ *
+ * Waits for up to timeout milliseconds (for ever if it is negative)
+ * for sockets in an epoll set to be ready, as epoll_wait() does, and
+ * reports at most maxevents of them. Sockets are reported in the
+ * order they became ready. One added with EPOLLET is reported once
+ * each time it becomes ready, and then not again until something
+ * more arrives or there is more room to send; any other is reported
+ * for as long as it stays ready.
+ */
+int
+lwip_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		int timeout)
+{
+  struct lwip_epoll *ep;
+  struct lwip_socket *sock, *level, *next;
+  uint32_t revents;
+  sys_sem_t sem;
+  int n;
+
+  if(maxevents <= 0) {
+    errno = EINVAL;
     return -1;
   }
-  return size;
+
+  for(;;) {
+    sys_arch_sem_wait(socksem, 0);
+    ep = get_epoll(epfd);
+    if(ep == NULL) {
+      sys_sem_signal(socksem);
+      return -1;
+    }
+
+    n = 0;
+    level = NULL;
+    while(n < maxevents && ep->ready != NULL) {
+      sock = ep->ready;
+      ready_remove(sock);
+      revents = sock_events(sock) & (sock->events | EPOLLERR | EPOLLHUP);
+      if(revents == 0) {
+	continue;
+      }
+      events[n].events = revents;
+      events[n].data = sock->data;
+      n++;
+      /* Level-triggered sockets go back on the list once this pass
+	 over it is done, to be looked at again next time. */
+      if(!(sock->events & EPOLLET)) {
+	sock->ready_next = level;
+	level = sock;
+      }
+    }
+    for(sock = level; sock != NULL; sock = next) {
+      next = sock->ready_next;
+      ready_add(sock);
+    }
+    sem = ep->sem;
+    sys_sem_signal(socksem);
+
+    if(n > 0 || timeout == 0) {
+      return n;
+    }
+    sem_wait_timeout(sem, &timeout);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * lwip_poll():
+ *
+ * Waits for up to timeout milliseconds (for ever if it is negative)
+ * for any of the sockets in fds to be ready for what is asked of it,
+ * as poll() does.
+ */
+int
+lwip_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+  struct lwip_poll_waiter waiter, **wp;
+  struct lwip_socket *sock;
+  nfds_t i;
+  int n;
+
+  waiter.sem = SYS_SEM_NULL;
+  for(;;) {
+    sys_arch_sem_wait(socksem, 0);
+    n = 0;
+    for(i = 0; i < nfds; ++i) {
+      fds[i].revents = 0;
+      if(fds[i].fd < 0) {
+	continue;
+      }
+      if(fds[i].fd >= NUM_SOCKETS || sockets[fds[i].fd].conn == NULL) {
+	fds[i].revents = POLLNVAL;
+      } else {
+	sock = &sockets[fds[i].fd];
+	fds[i].revents = sock_events(sock) &
+	  (fds[i].events | POLLERR | POLLHUP);
+      }
+      if(fds[i].revents != 0) {
+	n++;
+      }
+    }
+
+    if(n > 0 || timeout == 0) {
+      if(waiter.sem != SYS_SEM_NULL) {
+	for(wp = &poll_waiters; *wp != &waiter; wp = &(*wp)->next);
+	*wp = waiter.next;
+      }
+      sys_sem_signal(socksem);
+      if(waiter.sem != SYS_SEM_NULL) {
+	sys_sem_free(waiter.sem);
+      }
+      return n;
+    }
+
+    /* Hear of every change from now on. */
+    if(waiter.sem == SYS_SEM_NULL) {
+      waiter.sem = sys_sem_new(0);
+      waiter.next = poll_waiters;
+      poll_waiters = &waiter;
+    }
+    sys_sem_signal(socksem);
+    sem_wait_timeout(waiter.sem, &timeout);
+  }
 }
 /*-----------------------------------------------------------------------------------*/
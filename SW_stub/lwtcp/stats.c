@@ -42,6 +42,8 @@
 #include "lwip/stats.h"
 #include "lwip/mem.h"
 
+#include <stdio.h>
+
 
 #ifdef STATS
 struct stats_ stats;
@@ -55,3 +57,30 @@ stats_init(void)
 #endif /* STATS */
 }
 /*-----------------------------------------------------------------------------------*/
+void
+stats_memp_to_string(char *buf, int len)
+{
+#ifdef MEMP_STATS
+  static const char *names[MEMP_MAX] = {
+    "pbuf", "udp_pcb", "tcp_pcb", "tcp_pcb_listen", "tcp_seg",
+    "netbuf", "netconn", "api_msg", "tcpip_msg", "sys_timeout"
+  };
+  struct stats_mem *m;
+  uint32_t allocs;
+  int i, n;
+
+  n = snprintf(buf, len, "%-15s %6s %6s %6s %6s  %s\n",
+               "pool", "avail", "used", "max", "err", "cache hits");
+  for(i = 0; i < MEMP_MAX && n < len; i++) {
+    m = &stats.memp[i];
+    allocs = m->cachehit + m->cachemiss;
+    n += snprintf(buf + n, len - n, "%-15s %6u %6u %6u %6u  %5.1f%%\n",
+                  names[i], (unsigned)m->avail, (unsigned)m->used,
+                  (unsigned)m->max, (unsigned)m->err,
+                  allocs ? m->cachehit * 100.0 / allocs : 0.0);
+  }
+#else
+  snprintf(buf, len, "pool statistics are not compiled in\n");
+#endif /* MEMP_STATS */
+}
+/*-----------------------------------------------------------------------------------*/
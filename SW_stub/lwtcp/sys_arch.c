@@ -39,8 +39,12 @@
 #include <errno.h>
 #include <strings.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <linux/futex.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -48,24 +52,53 @@
 
 #include "lwip/sys.h"
 #include "lwip/opt.h"
+#include "lwip/memp.h"
 #include "lwip/stats.h"
 
 #define UMAX(a, b)      ((a) > (b) ? (a) : (b))
 
+/* Every thread using sys has a struct sys_thread. A thread finds its
+   own through thread_self; the list of them all, threads, is only
+   walked to enumerate them and is guarded by threads_mutex. */
 static struct sys_thread *threads = NULL;
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct sys_thread *thread_self;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
 
-struct sys_mbox_msg {
-  struct sys_mbox_msg *next;
+#if SYS_MBOX_SIZE < 2 || (SYS_MBOX_SIZE & (SYS_MBOX_SIZE - 1)) != 0
+#error "SYS_MBOX_SIZE must be a power of two"
+#endif
+
+/* A mailbox is a ring of SYS_MBOX_SIZE slots which any number of
+   threads post to and one fetches from, without a lock. Each slot has
+   a sequence number saying whose turn it is: a poster claims the slot
+   at tail when its seq equals tail, by moving tail on with a
+   compare-and-swap, and publishes its message by setting seq to
+   tail + 1; the fetcher takes the slot at head once its seq is
+   head + 1 and hands it back to the posters by setting seq to
+   head + SYS_MBOX_SIZE.
+
+   Nobody sleeps unless they have to. A fetcher finding the mailbox
+   empty says so in fetcher_waiting and sleeps on the futex mail,
+   which posters bump and wake only if it is set; posters finding it
+   full likewise count themselves in posters_waiting and sleep on
+   space, which the fetcher bumps and wakes. */
+struct sys_mbox_slot {
+  volatile uint32_t seq;
   void *msg;
 };
 
-#define SYS_MBOX_SIZE 100
-
 struct sys_mbox {
-  uint16_t first, last;
-  void *msgs[SYS_MBOX_SIZE];
-  struct sys_sem *mail;
-  struct sys_sem *mutex;
+  volatile uint32_t tail;       /* next slot to post to */
+  volatile uint32_t mail;
+  volatile uint32_t fetcher_waiting;
+  char pad[64 - 3 * sizeof(uint32_t)]; /* keep the posters' lines apart
+                                          from the fetcher's */
+  uint32_t head;                /* next slot to fetch from */
+  volatile uint32_t space;
+  volatile uint32_t posters_waiting;
+  struct sys_mbox_slot slots[SYS_MBOX_SIZE];
 };
 
 struct sys_sem {
@@ -88,26 +121,70 @@ static void sys_sem_free_(struct sys_sem *sem);
 
 static uint16_t cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, uint16_t timeout);
 
+/*-----------------------------------------------------------------------------------*/
+/* Called as a thread exits with its struct sys_thread, to take it off
+   the list and free any timeouts it left pending. */
+static void
+thread_release(void *arg)
+{
+  struct sys_thread *thread = arg, **tp;
+  struct sys_timeout *t;
+
+  pthread_mutex_lock(&threads_mutex);
+  for(tp = &threads; *tp != thread; tp = &(*tp)->next);
+  *tp = thread->next;
+  pthread_mutex_unlock(&threads_mutex);
+
+  while((t = thread->timeouts.next) != NULL) {
+    thread->timeouts.next = t->next;
+    memp_free(MEMP_SYS_TIMEOUT, t);
+  }
+  thread_self = NULL;
+  free(thread);
+}
+/*-----------------------------------------------------------------------------------*/
+static void
+thread_key_create(void)
+{
+  pthread_key_create(&thread_key, thread_release);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Allocates a struct sys_thread and adds it to the list. */
+static struct sys_thread *
+thread_alloc(void)
+{
+  struct sys_thread *thread;
+
+  thread = malloc(sizeof(struct sys_thread));
+  thread->timeouts.next = NULL;
+  thread->pthread = 0;
+
+  pthread_mutex_lock(&threads_mutex);
+  thread->next = threads;
+  threads = thread;
+  pthread_mutex_unlock(&threads_mutex);
+  return thread;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Makes thread the calling thread's, until it exits. */
+static void
+thread_register(struct sys_thread *thread)
+{
+  pthread_once(&thread_key_once, thread_key_create);
+  thread->pthread = pthread_self();
+  thread_self = thread;
+  pthread_setspecific(thread_key, thread);
+}
 /*-----------------------------------------------------------------------------------*/
 static struct sys_thread *
 current_thread(void)
 {
-  struct sys_thread *st;
-  pthread_t pt;
-  pt = pthread_self();
-  /*  DEBUGF("sys: current_thread: pt %d\n", pt);*/
-  for(st = threads; st != NULL; st = st->next) {
-    /*    DEBUGF("sys: current_thread: st->pthread %d\n", st->pthread);*/
-    if(pthread_equal(st->pthread, pt)) {
-      return st;
-    }
+  if(thread_self == NULL) {
+    /* a thread neither started by sys_thread_new() nor registered
+       with sys_thread_init() yet */
+    sys_thread_init();
   }
-  printf("sys: current_thread: could not find current thread!\n");
-  printf("This is due to a race condition in the LinuxThreads\n");
-  printf("pthreads implementation. Start the program again.\n");
-  
-
-  abort();
+  return thread_self;
 }
 /*-----------------------------------------------------------------------------------*/
 struct thread_start_param {
@@ -120,57 +197,143 @@ static void *
 thread_start(void *arg)
 {
   struct thread_start_param *tp = arg;
-  tp->thread->pthread = pthread_self();
+  thread_register(tp->thread);
   tp->function(tp->arg);
   free(tp);
   return NULL;
 }
 
-/* add the main thread to the threads list .mc */
+/* add the calling thread (e.g. the main thread) to the threads list .mc */
 void sys_thread_init()
 {
-  struct sys_thread *thread;
-
-  thread = malloc(sizeof(struct sys_thread));
-  thread->next = threads;
-  thread->timeouts.next = NULL;
-  thread->pthread = pthread_self();
-  threads = thread;
+  if(thread_self == NULL) {
+    thread_register(thread_alloc());
+  }
 }
 
 void
 sys_thread_new(void (* function)(void *arg), void *arg)
 {
-  struct sys_thread *thread;
   struct thread_start_param *thread_param;
-
-  thread = malloc(sizeof(struct sys_thread));
-  thread->next = threads;
-  thread->timeouts.next = NULL;
-  thread->pthread = 0;
-  threads = thread;
+  pthread_t pthread;
 
   thread_param = malloc(sizeof(struct thread_start_param));
   
   thread_param->function = function;
   thread_param->arg = arg;
-  thread_param->thread = thread;
+  thread_param->thread = thread_alloc();
 
-  if(pthread_create(&(thread->pthread), NULL, thread_start, thread_param) != 0) {
+  if(pthread_create(&pthread, NULL, thread_start, thread_param) != 0) {
     perror("sys_thread_new: pthread_create");
     abort();
   }
 }
 /*-----------------------------------------------------------------------------------*/
+static long
+futex(volatile uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout)
+{
+  return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Milliseconds on a clock that is never set back. */
+static unsigned long
+mono_msecs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Posts msg to mbox, returning 0 if it is full. */
+static int
+mbox_post(struct sys_mbox *mbox, void *msg)
+{
+  struct sys_mbox_slot *slot;
+  uint32_t pos;
+  int32_t dif;
+
+  pos = mbox->tail;
+  for(;;) {
+    slot = &mbox->slots[pos & (SYS_MBOX_SIZE - 1)];
+    dif = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+    if(dif == 0) {
+      if(__sync_bool_compare_and_swap(&mbox->tail, pos, pos + 1)) {
+        break;
+      }
+      pos = mbox->tail;
+    } else if(dif < 0) {
+      /* The fetcher has yet to take what was posted here a lap ago. */
+      return 0;
+    } else {
+      /* Another poster claimed the slot first. */
+      pos = mbox->tail;
+    }
+  }
+  slot->msg = msg;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  /* Either the fetcher sees the message or we see it waiting. */
+  __sync_synchronize();
+  if(mbox->fetcher_waiting) {
+    __sync_fetch_and_add(&mbox->mail, 1);
+    futex(&mbox->mail, FUTEX_WAKE_PRIVATE, 1, NULL);
+  }
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+/* Fetches the oldest message from mbox, returning 0 if it is empty. */
+static int
+mbox_fetch(struct sys_mbox *mbox, void **msg)
+{
+  struct sys_mbox_slot *slot;
+  uint32_t pos;
+
+  pos = mbox->head;
+  slot = &mbox->slots[pos & (SYS_MBOX_SIZE - 1)];
+  if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+    return 0;
+  }
+  if(msg != NULL) {
+    *msg = slot->msg;
+  }
+  __atomic_store_n(&slot->seq, pos + SYS_MBOX_SIZE, __ATOMIC_RELEASE);
+  mbox->head = pos + 1;
+
+  /* Either a poster sees the room or we see it waiting. */
+  __sync_synchronize();
+  if(mbox->posters_waiting) {
+    __sync_fetch_and_add(&mbox->space, 1);
+    futex(&mbox->space, FUTEX_WAKE_PRIVATE, 1, NULL);
+  }
+  return 1;
+}
+/*-----------------------------------------------------------------------------------*/
+static int
+mbox_full(struct sys_mbox *mbox)
+{
+  uint32_t pos;
+
+  pos = mbox->tail;
+  return (int32_t)(mbox->slots[pos & (SYS_MBOX_SIZE - 1)].seq - pos) < 0;
+}
+/*-----------------------------------------------------------------------------------*/
 struct sys_mbox *
 sys_mbox_new()
 {
   struct sys_mbox *mbox;
+  uint32_t i;
 
-  mbox = malloc(sizeof(struct sys_mbox));
-  mbox->first = mbox->last = 0;
-  mbox->mail = sys_sem_new_(0);
-  mbox->mutex = sys_sem_new_(1);
+  mbox = calloc(1, sizeof(struct sys_mbox));
+  if(mbox == NULL) {
+#ifdef SYS_STATS
+    stats.sys.mbox.err++;
+#endif /* SYS_STATS */
+    return SYS_MBOX_NULL;
+  }
+  for(i = 0; i < SYS_MBOX_SIZE; i++) {
+    mbox->slots[i].seq = i;
+  }
   
 #ifdef SYS_STATS
   stats.sys.mbox.used++;
@@ -189,87 +352,93 @@ sys_mbox_free(struct sys_mbox *mbox)
 #ifdef SYS_STATS
     stats.sys.mbox.used--;
 #endif /* SYS_STATS */
-    sys_sem_wait(mbox->mutex);
-    
-    sys_sem_free_(mbox->mail);
-    sys_sem_free_(mbox->mutex);
-    mbox->mail = mbox->mutex = NULL;
     /*  DEBUGF("sys_mbox_free: mbox 0x%lx\n", mbox);*/
     free(mbox);
   }
 }
 /*-----------------------------------------------------------------------------------*/
+/* Posts msg to mbox, waiting for the fetcher to make room if it is
+   full. A thread that the fetcher may itself be waiting on must use
+   sys_mbox_trypost() instead. */
 void
 sys_mbox_post(struct sys_mbox *mbox, void *msg)
 {
-  uint8_t first;
-  
-  sys_sem_wait(mbox->mutex);
-  
-  DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", mbox, msg));
+  uint32_t space;
 
-  mbox->msgs[mbox->last] = msg;
+  DEBUGF(SYS_DEBUG, ("sys_mbox_post: mbox %p msg %p\n", mbox, msg));
 
-  if(mbox->last == mbox->first) {
-    first = 1;
-  } else {
-    first = 0;
-  }
-  
-  mbox->last++;
-  if(mbox->last == SYS_MBOX_SIZE) {
-    mbox->last = 0;
+  while(!mbox_post(mbox, msg)) {
+    space = mbox->space;
+    __sync_fetch_and_add(&mbox->posters_waiting, 1);
+    if(mbox_full(mbox)) {
+      futex(&mbox->space, FUTEX_WAIT_PRIVATE, space, NULL);
+    }
+    __sync_fetch_and_sub(&mbox->posters_waiting, 1);
   }
+}
+/*-----------------------------------------------------------------------------------*/
+/* Posts msg to mbox unless it is full, in which case ERR_MEM is
+   returned and msg is still the caller's. */
+err_t
+sys_mbox_trypost(struct sys_mbox *mbox, void *msg)
+{
+  DEBUGF(SYS_DEBUG, ("sys_mbox_trypost: mbox %p msg %p\n", mbox, msg));
 
-  if(first) {
-    sys_sem_signal(mbox->mail);
+  if(!mbox_post(mbox, msg)) {
+#ifdef SYS_STATS
+    stats.sys.mbox.err++;
+#endif /* SYS_STATS */
+    return ERR_MEM;
   }
-  
-  sys_sem_signal(mbox->mutex);
-
+  return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
+/* Only one thread at a time may fetch from a mailbox. */
 uint16_t
 sys_arch_mbox_fetch(struct sys_mbox *mbox, void **msg, uint16_t timeout)
 {
-  uint16_t time = 1;
-  
-  /* The mutex lock is quick so we don't bother with the timeout
-     stuff here. */
-  sys_arch_sem_wait(mbox->mutex, 0);
-  
-  while(mbox->first == mbox->last) {
-    sys_sem_signal(mbox->mutex);
-    
-    /* We block while waiting for a mail to arrive in the mailbox. We
-       must be prepared to timeout. */
+  unsigned long start, waited;
+  struct timespec ts;
+  uint32_t mail;
+
+  if(mbox_fetch(mbox, msg)) {
+    return 1;
+  }
+
+  /* We block while waiting for a mail to arrive in the mailbox. We
+     must be prepared to timeout. */
+  start = mono_msecs();
+  for(;;) {
+    mail = mbox->mail;
+    mbox->fetcher_waiting = 1;
+    __sync_synchronize();
+    if(mbox_fetch(mbox, msg)) {
+      break;
+    }
     if(timeout != 0) {
-      time = sys_arch_sem_wait(mbox->mail, timeout);
-      
-      /* If time == 0, the sem_wait timed out, and we return 0. */
-      if(time == 0) {
-	return 0;
+      waited = mono_msecs() - start;
+      if(waited >= timeout) {
+        mbox->fetcher_waiting = 0;
+        return 0;
       }
+      ts.tv_sec = (timeout - waited) / 1000;
+      ts.tv_nsec = (timeout - waited) % 1000 * 1000000;
+      futex(&mbox->mail, FUTEX_WAIT_PRIVATE, mail, &ts);
     } else {
-      sys_arch_sem_wait(mbox->mail, 0);
+      futex(&mbox->mail, FUTEX_WAIT_PRIVATE, mail, NULL);
     }
-    
-    sys_arch_sem_wait(mbox->mutex, 0);
   }
-  
+  mbox->fetcher_waiting = 0;
   if(msg != NULL) {
     DEBUGF(SYS_DEBUG, ("sys_mbox_fetch: mbox %p msg %p\n", mbox, *msg));
-    *msg = mbox->msgs[mbox->first];
   }
-  
-  mbox->first++;
-  if(mbox->first == SYS_MBOX_SIZE) {
-    mbox->first = 0;
-  }    
-  
-  sys_sem_signal(mbox->mutex);
-  
-  return time;
+
+  /* Say for how long we waited, which is at least a millisecond. */
+  waited = mono_msecs() - start;
+  if(waited == 0) {
+    return 1;
+  }
+  return waited > 0xffff ? 0xffff : waited;
 }
 /*-----------------------------------------------------------------------------------*/
 struct sys_sem *
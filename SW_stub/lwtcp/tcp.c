@@ -51,11 +51,15 @@
 
 #include "lwip/tcp.h"
 
+#include "lwtcp_sr_integration.h"
+
 /* Incremented every coarse grained timer shot
    (typically every 500 ms, determined by TCP_COARSE_TIMEOUT). */
 uint32_t tcp_ticks;
+/* The shift applied to the RTO on each retransmission timeout: it
+   doubles each time, up to 128 times. */
 const uint8_t tcp_backoff[13] =
-    { 1, 2, 4, 8, 16, 32, 64, 64, 64, 64, 64, 64, 64 };
+    { 1, 2, 3, 4, 5, 6, 7, 7, 7, 7, 7, 7, 7 };
 
 /* The TCP PCB lists. */
 struct tcp_pcb_listen *tcp_listen_pcbs;  /* List of all TCP PCBs in LISTEN state. */
@@ -66,6 +70,14 @@ struct tcp_pcb *tcp_tw_pcbs;      /* List of all TCP PCBs in TIME-WAIT. */
 
 struct tcp_pcb *tcp_tmp_pcb;
 
+/* The PCB hash tables. */
+struct tcp_pcb *tcp_pcb_hash[TCP_PCB_HASH_SIZE];  /* PCBs in tcp_active_pcbs and
+						     tcp_tw_pcbs, by remote
+						     address and ports. */
+struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE]; /* PCBs in
+								 tcp_listen_pcbs,
+								 by local port. */
+
 #define MIN(x,y) (x) < (y)? (x): (y)
 
 #if MEMP_RECLAIM
@@ -77,6 +89,21 @@ static mem_size_t tcp_mem_reclaim(void *arg, mem_size_t size);
 
 static uint8_t tcp_timer;
 
+#if (TCP_TIMER_WHEEL_SIZE & (TCP_TIMER_WHEEL_SIZE - 1)) != 0
+#error "TCP_TIMER_WHEEL_SIZE must be a power of two"
+#endif
+
+/* The timer wheel: an active or TIME-WAIT PCB with a timer running is
+   in the slot for the tick the earliest of them expires on, so that a
+   tick only visits the PCBs with something to do. */
+static struct tcp_pcb *tcp_timer_wheel[TCP_TIMER_WHEEL_SIZE];
+static uint32_t tcp_timer_count;   /* PCBs on the wheel. */
+/* PCBs with a delayed ACK or refused data, for tcp_fasttmr(). */
+static struct tcp_pcb *tcp_fast_pcbs;
+
+/* Tick a is before tick b, allowing for tcp_ticks wrapping. */
+#define TCP_TICK_LT(a,b) ((int32_t)((a) - (b)) < 0)
+
 /*-----------------------------------------------------------------------------------*/
 /*
  * tcp_init():
@@ -87,11 +114,24 @@ static uint8_t tcp_timer;
 void
 tcp_init(void)
 {
+  int i;
+
   /* Clear globals. */
   tcp_listen_pcbs = NULL;
   tcp_active_pcbs = NULL;
   tcp_tw_pcbs = NULL;
   tcp_tmp_pcb = NULL;
+  for(i = 0; i < TCP_PCB_HASH_SIZE; ++i) {
+    tcp_pcb_hash[i] = NULL;
+  }
+  for(i = 0; i < TCP_LISTEN_HASH_SIZE; ++i) {
+    tcp_listen_hash[i] = NULL;
+  }
+  for(i = 0; i < TCP_TIMER_WHEEL_SIZE; ++i) {
+    tcp_timer_wheel[i] = NULL;
+  }
+  tcp_timer_count = 0;
+  tcp_fast_pcbs = NULL;
   
   /* Register memory reclaim function */
 #if MEM_RECLAIM
@@ -113,7 +153,8 @@ tcp_init(void)
 /*
  * tcp_tmr():
  *
- * Called periodically to dispatch TCP timers.
+ * Called every TCP_TMR_INTERVAL, while tcp_timers_pending(), to
+ * dispatch TCP timers.
  *
  */
 /*-----------------------------------------------------------------------------------*/
@@ -323,15 +364,144 @@ void
 tcp_recved(struct tcp_pcb *pcb, uint16_t len)
 {
   pcb->rcv_wnd += len;
-  if(pcb->rcv_wnd > TCP_WND) {
-    pcb->rcv_wnd = TCP_WND;
+  if(pcb->rcv_wnd > pcb->rcv_wnd_max) {
+    pcb->rcv_wnd = pcb->rcv_wnd_max;
   }
   if(!(pcb->flags & TF_ACK_DELAY) ||
      !(pcb->flags & TF_ACK_NOW)) {
     tcp_ack(pcb);
   }
+  tcp_timer_update(pcb);
   DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %d bytes, wnd %u (%u).\n",
-		     len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+		     len, pcb->rcv_wnd, pcb->rcv_wnd_max - pcb->rcv_wnd));
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_setsndbuf():
+ *
+ * Fixes the size of the send buffer, which is otherwise grown from
+ * TCP_SND_BUF towards TCP_SND_BUF_MAX while the windows allow more
+ * data in flight than the buffer holds.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_setsndbuf(struct tcp_pcb *pcb, uint32_t size)
+{
+  uint32_t queued;
+
+  queued = pcb->snd_buf_max - pcb->snd_buf;
+  pcb->snd_buf_max = pcb->snd_buf_lim = size;
+  pcb->snd_buf = size > queued? size - queued: 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_setrcvbuf():
+ *
+ * Fixes the size of the receive window, which is otherwise grown from
+ * TCP_WND towards TCP_WND_MAX while the sender keeps it full and the
+ * application keeps up. Once the SYN is sent, the window can be no
+ * larger than its scale allows.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_setrcvbuf(struct tcp_pcb *pcb, uint32_t size)
+{
+  uint32_t held;
+
+  if(pcb->state != CLOSED && size > ((uint32_t)0xffff << pcb->rcv_scale)) {
+    size = (uint32_t)0xffff << pcb->rcv_scale;
+  }
+  held = pcb->rcv_wnd_max - pcb->rcv_wnd;
+  pcb->rcv_wnd_max = pcb->rcv_wnd_lim = size;
+  pcb->rcv_wnd = size > held? size - held: 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_setsack():
+ *
+ * Turns the offer of selective acknowledgements in the SYN on or off.
+ * They are used only if the peer offers them in turn.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_setsack(struct tcp_pcb *pcb, int on)
+{
+  if(on) {
+    pcb->flags &= ~TF_NOSACK;
+  } else {
+    pcb->flags &= ~TF_SACK;
+    pcb->flags |= TF_NOSACK;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_mss_for():
+ *
+ * Returns the MSS to use with a host: what fits the MTU of the
+ * interface it is routed out of, up to TCP_MSS.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+uint16_t
+tcp_mss_for(struct ip_addr *remote_ip)
+{
+  uint16_t mtu;
+
+  mtu = ip_route_mtu(remote_ip);
+  if(mtu <= IP_HLEN + TCP_HLEN) {
+    return UMIN(TCP_DEFAULT_MSS, TCP_MSS);
+  }
+  return UMIN(mtu - IP_HLEN - TCP_HLEN, TCP_MSS);
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_syn_options():
+ *
+ * Builds the options of a SYN or SYN|ACK in optdata, which must have
+ * room for three words, and returns their length: the MSS, and the
+ * window scale and SACK permitted options unless the SYN being
+ * answered did not offer them. The scale is the least which lets the
+ * receive window grow to its limit.
+ *
+ */
+/*-----------------------------------------------------------------------------------*/
+uint8_t
+tcp_syn_options(struct tcp_pcb *pcb, uint32_t *optdata)
+{
+  uint8_t optlen;
+
+  optdata[0] = HTONL(((uint32_t)2 << 24) | 
+		     ((uint32_t)4 << 16) | 
+		     (((uint32_t)pcb->mss / 256) << 8) |
+		     (pcb->mss & 255));
+  optlen = 4;
+
+  if(pcb->state != SYN_RCVD || (pcb->flags & TF_WND_SCALE)) {
+    pcb->rcv_scale = 0;
+    while(pcb->rcv_scale < TCP_MAX_WND_SCALE &&
+	  (pcb->rcv_wnd_lim >> pcb->rcv_scale) > 0xffff) {
+      ++pcb->rcv_scale;
+    }
+    /* A NOP to align the window scale option. */
+    optdata[optlen / 4] = HTONL(((uint32_t)1 << 24) |
+				((uint32_t)3 << 16) |
+				((uint32_t)3 << 8) |
+				pcb->rcv_scale);
+    optlen += 4;
+  }
+
+  if(pcb->state == SYN_RCVD? (pcb->flags & TF_SACK): !(pcb->flags & TF_NOSACK)) {
+    /* Two NOPs to align the SACK permitted option. */
+    optdata[optlen / 4] = HTONL(((uint32_t)1 << 24) |
+				((uint32_t)1 << 16) |
+				((uint32_t)4 << 8) |
+				2);
+    optlen += 4;
+  }
+  return optlen;
 }
 /*-----------------------------------------------------------------------------------*/
 /*
@@ -382,7 +552,8 @@ err_t
 tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, uint16_t port,
 	    err_t (* connected)(void *arg, struct tcp_pcb *tpcb, err_t err))
 {
-  uint32_t optdata;
+  uint32_t optdata[3];
+  uint8_t optlen;
   err_t ret;
   uint32_t iss;
 
@@ -400,23 +571,20 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, uint16_t port,
   pcb->rcv_nxt = 0;
   pcb->snd_nxt = iss;
   pcb->lastack = iss - 1;
+  pcb->recover = iss;
   pcb->snd_lbb = iss - 1;
-  pcb->rcv_wnd = TCP_WND;
   pcb->snd_wnd = TCP_WND;
-  pcb->mss = TCP_MSS;
+  pcb->mss = tcp_mss_for(ipaddr);
   pcb->cwnd = 1;
   pcb->ssthresh = pcb->mss * 10;
   pcb->state = SYN_SENT;
   pcb->connected = connected;
   TCP_REG(&tcp_active_pcbs, pcb);
   
-  /* Build an MSS option */
-  optdata = HTONL(((uint32_t)2 << 24) | 
-		  ((uint32_t)4 << 16) | 
-		  (((uint32_t)pcb->mss / 256) << 8) |
-		  (pcb->mss & 255));
+  /* Build the MSS, window scale and SACK permitted options */
+  optlen = tcp_syn_options(pcb, optdata);
 
-  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (uint8_t *)&optdata, 4);
+  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (uint8_t *)optdata, optlen);
   if(ret == ERR_OK) { 
     tcp_output(pcb);
   }
@@ -424,175 +592,355 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, uint16_t port,
 } 
 /*-----------------------------------------------------------------------------------*/
 /*
- * tcp_slowtmr():
+ * tcp_wheel_insert():
  *
- * Called every 500 ms and implements the retransmission timer and the timer that
- * removes PCBs that have been in TIME-WAIT for enough time. It also increments
- * various timers such as the inactivity timer in each PCB.
+ * Puts a PCB in the slot of the timer wheel for the given tick.
  */
 /*-----------------------------------------------------------------------------------*/
-void
-tcp_slowtmr(void)
+static void
+tcp_wheel_insert(struct tcp_pcb *pcb, uint32_t tick)
 {
-  static struct tcp_pcb *pcb, *pcb2, *prev;
-  static struct tcp_seg *seg, *useg;
-  static uint32_t eff_wnd;
-  static uint8_t pcb_remove;      /* flag if a PCB should be removed */
+  struct tcp_pcb **slot;
 
-  ++tcp_ticks;
-  
-  /* Steps through all of the active PCBs. */
-  prev = NULL;
-  pcb = tcp_active_pcbs;
-  while(pcb != NULL) {
-    ASSERT("tcp_timer_coarse: active pcb->state != CLOSED", pcb->state != CLOSED);
-    ASSERT("tcp_timer_coarse: active pcb->state != LISTEN", pcb->state != LISTEN);
-    ASSERT("tcp_timer_coarse: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
+  slot = &tcp_timer_wheel[tick & (TCP_TIMER_WHEEL_SIZE - 1)];
+  pcb->wheel_tick = tick;
+  pcb->wheel_next = *slot;
+  if(*slot != NULL) {
+    (*slot)->wheel_pprev = &pcb->wheel_next;
+  }
+  *slot = pcb;
+  pcb->wheel_pprev = slot;
+  ++tcp_timer_count;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_wheel_remove():
+ *
+ * Takes a PCB out of its slot of the timer wheel.
+ */
+/*-----------------------------------------------------------------------------------*/
+static void
+tcp_wheel_remove(struct tcp_pcb *pcb)
+{
+  *pcb->wheel_pprev = pcb->wheel_next;
+  if(pcb->wheel_next != NULL) {
+    pcb->wheel_next->wheel_pprev = pcb->wheel_pprev;
+  }
+  pcb->wheel_next = NULL;
+  pcb->wheel_pprev = NULL;
+  --tcp_timer_count;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_fast_remove():
+ *
+ * Takes a PCB off the list for tcp_fasttmr().
+ */
+/*-----------------------------------------------------------------------------------*/
+static void
+tcp_fast_remove(struct tcp_pcb *pcb)
+{
+  *pcb->fast_pprev = pcb->fast_next;
+  if(pcb->fast_next != NULL) {
+    pcb->fast_next->fast_pprev = pcb->fast_pprev;
+  }
+  pcb->fast_next = NULL;
+  pcb->fast_pprev = NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_timer_due():
+ *
+ * Finds the tick on which the earliest of the PCB's running timers
+ * expires. Returns 0 if none is running.
+ */
+/*-----------------------------------------------------------------------------------*/
+static int
+tcp_timer_due(struct tcp_pcb *pcb, uint32_t *due)
+{
+  uint32_t tick;
+  int running = 0;
 
-    pcb_remove = 0;
+#define TCP_TIMER_AT(t) do { \
+                          tick = (t); \
+                          if(!running || TCP_TICK_LT(tick, *due)) { \
+                            *due = tick; \
+                          } \
+                          running = 1; \
+                        } while(0)
 
-    if(pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) {
-      ++pcb_remove;
-    } else if(pcb->nrtx == TCP_MAXRTX) {
-      ++pcb_remove;
-    } else {
-      ++pcb->rtime;
-      seg = pcb->unacked;
-      if(seg != NULL && pcb->rtime >= pcb->rto) {
-        
-        DEBUGF(TCP_RTO_DEBUG, ("tcp_timer_coarse: rtime %ld pcb->rto %d\n",
-                               tcp_ticks - pcb->rtime, pcb->rto));
-
-	/* Double retransmission time-out unless we are trying to
-           connect to somebody (i.e., we are in SYN_SENT). */
-	if(pcb->state != SYN_SENT) {
-	  pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[pcb->nrtx];
-	}
+  if(pcb->state == TIME_WAIT) {
+    TCP_TIMER_AT(pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+    return running;
+  }
 
-        /* Move all other unacked segments to the unsent queue. */
-        if(seg->next != NULL) {
-          for(useg = seg->next; useg->next != NULL; useg = useg->next);
-          /* useg now points to the last segment on the unacked queue. */
-          useg->next = pcb->unsent;
-          pcb->unsent = seg->next;
-          seg->next = NULL;
-          pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
-        }
-
-	/* Do the actual retransmission. */
-        tcp_rexmit_seg(pcb, seg);
-
-        /* Reduce congestion window and ssthresh. */
-        eff_wnd = MIN(pcb->cwnd, pcb->snd_wnd);
-        pcb->ssthresh = eff_wnd >> 1;
-        if(pcb->ssthresh < pcb->mss) {
-          pcb->ssthresh = pcb->mss * 2;
-        }
-        pcb->cwnd = pcb->mss;
-
-        DEBUGF(TCP_CWND_DEBUG, ("tcp_rexmit_seg: cwnd %u ssthresh %u\n",
-                                pcb->cwnd, pcb->ssthresh));
-      }
+  /* Out of retransmissions: removed on the next tick. */
+  if((pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) ||
+     pcb->nrtx == TCP_MAXRTX) {
+    TCP_TIMER_AT(tcp_ticks);
+  }
+  if(pcb->unacked != NULL) {
+    TCP_TIMER_AT(pcb->rtime + pcb->rto);
+  }
+  if(pcb->state == FIN_WAIT_2) {
+    TCP_TIMER_AT(pcb->tmr + TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+#if TCP_QUEUE_OOSEQ
+  if(pcb->ooseq != NULL) {
+    TCP_TIMER_AT(pcb->tmr + pcb->rto * TCP_OOSEQ_TIMEOUT);
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+  if(pcb->state == SYN_RCVD) {
+    TCP_TIMER_AT(pcb->tmr + TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+  if(pcb->poll != NULL) {
+    TCP_TIMER_AT(pcb->polltmr + pcb->pollinterval);
+  }
+#undef TCP_TIMER_AT
+  return running;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_timer_update():
+ *
+ * Puts the PCB on the timer wheel at the tick its earliest running
+ * timer expires on, or takes it off if none is running, and on the
+ * list for tcp_fasttmr() if it has a delayed ACK or refused data.
+ * Called whenever its timers may have been started or restarted; a
+ * PCB visited early is simply put back for later.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_timer_update(struct tcp_pcb *pcb)
+{
+  uint32_t tick;
+
+  if(pcb->state == CLOSED || pcb->state == LISTEN) {
+    return;
+  }
+
+  if(tcp_timer_due(pcb, &tick)) {
+    if(!TCP_TICK_LT(tcp_ticks, tick)) {
+      tick = tcp_ticks + 1;
     }
-	  
-    /* Check if this PCB has stayed too long in FIN-WAIT-2 */
-    if(pcb->state == FIN_WAIT_2) {
-      if((uint32_t)(tcp_ticks - pcb->tmr) >
-	 TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
+    if(pcb->wheel_pprev == NULL || pcb->wheel_tick != tick) {
+      if(pcb->wheel_pprev != NULL) {
+	tcp_wheel_remove(pcb);
       }
+      tcp_wheel_insert(pcb, tick);
     }
+  } else if(pcb->wheel_pprev != NULL) {
+    tcp_wheel_remove(pcb);
+  }
 
-    /* If this PCB has queued out of sequence data, but has been
-       inactive for too long, will drop the data (it will eventually
-       be retransmitted). */
-#if TCP_QUEUE_OOSEQ    
-    if(pcb->ooseq != NULL &&
-       (uint32_t)tcp_ticks - pcb->tmr >=
-       pcb->rto * TCP_OOSEQ_TIMEOUT) {
-      tcp_segs_free(pcb->ooseq);
-      pcb->ooseq = NULL;
+  if(pcb->state < TIME_WAIT && pcb->fast_pprev == NULL &&
+     ((pcb->flags & (TF_ACK_DELAY | TF_FIN_REFUSED)) ||
+      pcb->refused_data != NULL)) {
+    pcb->fast_next = tcp_fast_pcbs;
+    if(tcp_fast_pcbs != NULL) {
+      tcp_fast_pcbs->fast_pprev = &pcb->fast_next;
     }
-#endif /* TCP_QUEUE_OOSEQ */
+    tcp_fast_pcbs = pcb;
+    pcb->fast_pprev = &tcp_fast_pcbs;
+  }
 
-    /* Check if this PCB has stayed too long in SYN-RCVD */
-    if(pcb->state == SYN_RCVD) {
-      if((uint32_t)(tcp_ticks - pcb->tmr) >
-	 TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-      }
-    }
+  if(tcp_timers_pending()) {
+    tcp_timer_needed();
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_timer_cancel():
+ *
+ * Takes a PCB which is being removed off the timer wheel and the list
+ * for tcp_fasttmr().
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_timer_cancel(struct tcp_pcb *pcb)
+{
+  if(pcb->wheel_pprev != NULL) {
+    tcp_wheel_remove(pcb);
+  }
+  if(pcb->fast_pprev != NULL) {
+    tcp_fast_remove(pcb);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_timers_pending():
+ *
+ * Returns non-zero while any PCB has a timer running, so tcp_tmr()
+ * need only be called while it does.
+ */
+/*-----------------------------------------------------------------------------------*/
+int
+tcp_timers_pending(void)
+{
+  return tcp_timer_count != 0 || tcp_fast_pcbs != NULL;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_active_tmr():
+ *
+ * Runs the retransmission, FIN-WAIT-2, out-of-sequence, SYN-RCVD and
+ * poll timers of an active PCB which is due, removing it if it has
+ * timed out.
+ */
+/*-----------------------------------------------------------------------------------*/
+static void
+tcp_active_tmr(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg, *useg;
+  uint32_t eff_wnd;
+  uint8_t pcb_remove;      /* flag if a PCB should be removed */
+
+  ASSERT("tcp_timer_coarse: active pcb->state != CLOSED", pcb->state != CLOSED);
+  ASSERT("tcp_timer_coarse: active pcb->state != LISTEN", pcb->state != LISTEN);
+  ASSERT("tcp_timer_coarse: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
 
+  pcb_remove = 0;
 
-    /* If the PCB should be removed, do it. */
-    if(pcb_remove) {
-      tcp_pcb_purge(pcb);      
-      /* Remove PCB from tcp_active_pcbs list. */
-      if(prev != NULL) {
-	ASSERT("tcp_timer_coarse: middle tcp != tcp_active_pcbs", pcb != tcp_active_pcbs);
-        prev->next = pcb->next;
-      } else {
-        /* This PCB was the first. */
-        ASSERT("tcp_timer_coarse: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
-        tcp_active_pcbs = pcb->next;
+  if(pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) {
+    ++pcb_remove;
+  } else if(pcb->nrtx == TCP_MAXRTX) {
+    ++pcb_remove;
+  } else {
+    seg = pcb->unacked;
+    if(seg != NULL && (uint32_t)(tcp_ticks - pcb->rtime) >= pcb->rto) {
+      
+      DEBUGF(TCP_RTO_DEBUG, ("tcp_timer_coarse: rtime %ld pcb->rto %d\n",
+			     tcp_ticks - pcb->rtime, pcb->rto));
+
+      /* Double retransmission time-out unless we are trying to
+	 connect to somebody (i.e., we are in SYN_SENT). */
+      if(pcb->state != SYN_SENT) {
+	pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[pcb->nrtx];
       }
 
-      if(pcb->errf != NULL) {
-	pcb->errf(pcb->callback_arg, ERR_ABRT);
+      /* Loss recovery is over. What was SACKed is sent again with
+	 the rest, as the receiver may since have dropped it, and
+	 duplicate ACKs for what was in flight start no new recovery. */
+      pcb->flags &= ~TF_INFR;
+      pcb->dupacks = 0;
+      pcb->recover = pcb->snd_max;
+      for(useg = seg; useg != NULL; useg = useg->next) {
+	useg->flags = 0;
       }
 
-      pcb2 = pcb->next;
-      memp_free(MEMP_TCP_PCB, pcb);
-      pcb = pcb2;
-    } else {
+      /* Move all other unacked segments to the unsent queue. */
+      if(seg->next != NULL) {
+	for(useg = seg->next; useg->next != NULL; useg = useg->next);
+	/* useg now points to the last segment on the unacked queue. */
+	useg->next = pcb->unsent;
+	pcb->unsent = seg->next;
+	seg->next = NULL;
+	pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
+      }
+
+      /* Do the actual retransmission. */
+      tcp_rexmit_seg(pcb, seg);
 
-      /* We check if we should poll the connection. */
-      ++pcb->polltmr;
-      if(pcb->polltmr >= pcb->pollinterval &&
-	 pcb->poll != NULL) {
-	pcb->polltmr = 0;
-	pcb->poll(pcb->callback_arg, pcb);
-	tcp_output(pcb);
+      /* Reduce congestion window and ssthresh. */
+      eff_wnd = MIN(pcb->cwnd, pcb->snd_wnd);
+      pcb->ssthresh = eff_wnd >> 1;
+      if(pcb->ssthresh < pcb->mss) {
+	pcb->ssthresh = pcb->mss * 2;
       }
-      
-      prev = pcb;
-      pcb = pcb->next;
+      pcb->cwnd = pcb->mss;
+
+      DEBUGF(TCP_CWND_DEBUG, ("tcp_rexmit_seg: cwnd %u ssthresh %u\n",
+			      pcb->cwnd, pcb->ssthresh));
     }
   }
-
   
-  /* Steps through all of the TIME-WAIT PCBs. */
-  prev = NULL;    
-  pcb = tcp_tw_pcbs;
-  while(pcb != NULL) {
-    ASSERT("tcp_timer_coarse: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
-    pcb_remove = 0;
-
-    /* Check if this PCB has stayed long enough in TIME-WAIT */
-    if((uint32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+  /* Check if this PCB has stayed too long in FIN-WAIT-2 */
+  if(pcb->state == FIN_WAIT_2) {
+    if((uint32_t)(tcp_ticks - pcb->tmr) >
+       TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
       ++pcb_remove;
     }
-    
+  }
+
+  /* If this PCB has queued out of sequence data, but has been
+     inactive for too long, will drop the data (it will eventually
+     be retransmitted). */
+#if TCP_QUEUE_OOSEQ    
+  if(pcb->ooseq != NULL &&
+     (uint32_t)tcp_ticks - pcb->tmr >=
+     pcb->rto * TCP_OOSEQ_TIMEOUT) {
+    tcp_segs_free(pcb->ooseq);
+    pcb->ooseq = NULL;
+  }
+#endif /* TCP_QUEUE_OOSEQ */
 
+  /* Check if this PCB has stayed too long in SYN-RCVD */
+  if(pcb->state == SYN_RCVD) {
+    if((uint32_t)(tcp_ticks - pcb->tmr) >
+       TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+    }
+  }
 
-    /* If the PCB should be removed, do it. */
-    if(pcb_remove) {
-      tcp_pcb_purge(pcb);      
-      /* Remove PCB from tcp_tw_pcbs list. */
-      if(prev != NULL) {
-	ASSERT("tcp_timer_coarse: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
-        prev->next = pcb->next;
-      } else {
-        /* This PCB was the first. */
-        ASSERT("tcp_timer_coarse: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
-        tcp_tw_pcbs = pcb->next;
-      }
-      pcb2 = pcb->next;
+  /* If the PCB should be removed, do it. */
+  if(pcb_remove) {
+    tcp_pcb_purge(pcb);
+    TCP_RMV(&tcp_active_pcbs, pcb);
+
+    if(pcb->errf != NULL) {
+      pcb->errf(pcb->callback_arg, ERR_ABRT);
+    }
+    memp_free(MEMP_TCP_PCB, pcb);
+    return;
+  }
+
+  /* We check if we should poll the connection. */
+  if(pcb->poll != NULL &&
+     (uint32_t)(tcp_ticks - pcb->polltmr) >= pcb->pollinterval) {
+    pcb->polltmr = tcp_ticks;
+    pcb->poll(pcb->callback_arg, pcb);
+    tcp_output(pcb);
+  }
+
+  tcp_timer_update(pcb);
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_slowtmr():
+ *
+ * Called every 500 ms and implements the retransmission timer and the timer that
+ * removes PCBs that have been in TIME-WAIT for enough time. Only the PCBs in this
+ * tick's slot of the timer wheel are visited.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_slowtmr(void)
+{
+  struct tcp_pcb *pcb, *due;
+
+  ++tcp_ticks;
+
+  /* Take this tick's slot. Its PCBs are due now, or some whole
+     number of turns of the wheel from now. */
+  due = tcp_timer_wheel[tcp_ticks & (TCP_TIMER_WHEEL_SIZE - 1)];
+  tcp_timer_wheel[tcp_ticks & (TCP_TIMER_WHEEL_SIZE - 1)] = NULL;
+  if(due != NULL) {
+    due->wheel_pprev = &due;
+  }
+
+  while((pcb = due) != NULL) {
+    tcp_wheel_remove(pcb);
+    if(pcb->wheel_tick != tcp_ticks) {
+      tcp_wheel_insert(pcb, pcb->wheel_tick);
+    } else if(pcb->state != TIME_WAIT) {
+      tcp_active_tmr(pcb);
+    } else if((uint32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+      /* This PCB has stayed long enough in TIME-WAIT */
+      tcp_pcb_purge(pcb);
+      TCP_RMV(&tcp_tw_pcbs, pcb);
       memp_free(MEMP_TCP_PCB, pcb);
-      pcb = pcb2;
     } else {
-      prev = pcb;
-      pcb = pcb->next;
+      tcp_timer_update(pcb);
     }
   }
 }
@@ -600,24 +948,67 @@ tcp_slowtmr(void)
 /*
  * tcp_fasttmr():
  *
- * Is called every TCP_FINE_TIMEOUT (100 ms) and sends delayed ACKs.
+ * Is called every TCP_FINE_TIMEOUT (100 ms), offers applications data
+ * they refused and sends delayed ACKs, for the PCBs on tcp_fast_pcbs.
  */
 /*-----------------------------------------------------------------------------------*/
 void
 tcp_fasttmr(void)
 {
-  struct tcp_pcb *pcb;
+  struct tcp_pcb *pcb, *due;
 
-  /* send delayed ACKs */  
-  for(pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+  /* Take the list, so a PCB put back on it waits for the next tick. */
+  due = tcp_fast_pcbs;
+  tcp_fast_pcbs = NULL;
+  if(due != NULL) {
+    due->fast_pprev = &due;
+  }
+
+  while((pcb = due) != NULL) {
+    tcp_fast_remove(pcb);
+
+    /* offer the application what it had no room for before */
+    if(pcb->refused_data != NULL || pcb->flags & TF_FIN_REFUSED) {
+      tcp_refused_data(pcb);
+    }
+
+    /* send delayed ACKs */  
     if(pcb->flags & TF_ACK_DELAY) {
       DEBUGF(TCP_DEBUG, ("tcp_timer_fine: delayed ACK\n"));
       tcp_ack_now(pcb);
       pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
     }
+
+    tcp_timer_update(pcb);
   }
 }
 /*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_refused_data():
+ *
+ * Offers the application the data, and then the FIN, that its recv
+ * function had no room for before (returning ERR_MEM). Returns ERR_MEM
+ * if it still has none.
+ */
+/*-----------------------------------------------------------------------------------*/
+err_t
+tcp_refused_data(struct tcp_pcb *pcb)
+{
+  if(pcb->refused_data != NULL) {
+    if(pcb->recv(pcb->callback_arg, pcb, pcb->refused_data, ERR_OK) == ERR_MEM) {
+      return ERR_MEM;
+    }
+    pcb->refused_data = NULL;
+  }
+  if(pcb->flags & TF_FIN_REFUSED) {
+    if(pcb->recv(pcb->callback_arg, pcb, NULL, ERR_OK) == ERR_MEM) {
+      return ERR_MEM;
+    }
+    pcb->flags &= ~TF_FIN_REFUSED;
+  }
+  return ERR_OK;
+}
+/*-----------------------------------------------------------------------------------*/
 /*
  * tcp_segs_free():
  *
@@ -704,24 +1095,27 @@ tcp_new(void)
   pcb = (struct tcp_pcb*)memp_malloc2(MEMP_TCP_PCB);
   if(pcb != NULL) {
     bzero(pcb, sizeof(struct tcp_pcb));
-    pcb->snd_buf = TCP_SND_BUF;
+    pcb->snd_buf = pcb->snd_buf_max = TCP_SND_BUF;
+    pcb->snd_buf_lim = TCP_SND_BUF_MAX;
     pcb->snd_queuelen = 0;
-    pcb->rcv_wnd = TCP_WND;
-    pcb->mss = TCP_MSS;
+    pcb->rcv_wnd = pcb->rcv_wnd_max = TCP_WND;
+    pcb->rcv_wnd_lim = TCP_WND_MAX;
+    pcb->mss = TCP_DEFAULT_MSS;
     pcb->rto = 3000 / TCP_SLOW_INTERVAL;
     pcb->sa = 0;
     pcb->sv = 3000 / TCP_SLOW_INTERVAL;
-    pcb->rtime = 0;
+    pcb->rtime = tcp_ticks;
     pcb->cwnd = 1;
     iss = tcp_next_iss();
     pcb->snd_wl2 = iss;
     pcb->snd_nxt = iss;
     pcb->snd_max = iss;
     pcb->lastack = iss;
+    pcb->recover = iss;
     pcb->snd_lbb = iss;   
     pcb->tmr = tcp_ticks;
 
-    pcb->polltmr = 0;
+    pcb->polltmr = tcp_ticks;
 
     return pcb;
   }
@@ -807,6 +1201,7 @@ tcp_memp_reclaim(void *arg, memp_t type)
     pcb = tcp_tw_pcbs;
     if(pcb != NULL) {
       tcp_tw_pcbs = tcp_tw_pcbs->next;
+      tcp_pcb_hash_remove(&tcp_tw_pcbs, pcb);
       memp_free(MEMP_TCP_PCB, pcb);
       return 1;
     } else {
@@ -874,7 +1269,7 @@ tcp_recv(struct tcp_pcb *pcb,
 /*-----------------------------------------------------------------------------------*/
 void
 tcp_sent(struct tcp_pcb *pcb,
-	 err_t (* sent)(void *arg, struct tcp_pcb *tpcb, uint16_t len))
+	 err_t (* sent)(void *arg, struct tcp_pcb *tpcb, uint32_t len))
 {
   pcb->sent = sent;
 }
@@ -909,6 +1304,7 @@ tcp_poll(struct tcp_pcb *pcb,
 {
   pcb->poll = poll;
   pcb->pollinterval = interval;
+  tcp_timer_update(pcb);
 }
 /*-----------------------------------------------------------------------------------*/
 /*
@@ -951,6 +1347,10 @@ tcp_pcb_purge(struct tcp_pcb *pcb)
       DEBUGF(TCP_DEBUG, ("tcp_pcb_purge: data left on ->ooseq\n"));
     }
 #endif /* TCP_DEBUG */
+    if(pcb->refused_data != NULL) {
+      pbuf_free(pcb->refused_data);
+      pcb->refused_data = NULL;
+    }
     tcp_segs_free(pcb->unsent);
 #if TCP_QUEUE_OOSEQ
     tcp_segs_free(pcb->ooseq);
@@ -985,11 +1385,157 @@ tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
     pcb->flags |= TF_ACK_NOW;
     tcp_output(pcb);
   }  
+  if(pcb->state != LISTEN) {
+    tcp_timer_cancel(pcb);
+  }
   pcb->state = CLOSED;
 
   ASSERT("tcp_pcb_remove: tcp_pcbs_sane()", tcp_pcbs_sane());
 }
 /*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_pcb_hash_index():
+ *
+ * Picks the tcp_pcb_hash[] chain for a connection. The local address
+ * is left out since it may be filled in after the PCB is registered,
+ * and a router has few of them anyway.
+ */
+/*-----------------------------------------------------------------------------------*/
+static uint32_t
+tcp_pcb_hash_index(struct ip_addr *remote_ip, uint16_t remote_port, uint16_t local_port)
+{
+  uint32_t h;
+
+  h = remote_ip->addr ^ (((uint32_t)remote_port << 16) | local_port);
+  h *= 0x9e3779b1;   /* the high bits now depend on all of the input */
+  return (h >> 16) & (TCP_PCB_HASH_SIZE - 1);
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_pcb_hash_add():
+ *
+ * Adds a PCB which has just been registered with a PCB list to the
+ * hash table for that list. Called by TCP_REG.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_pcb_hash_add(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
+{
+  struct tcp_pcb_listen *lpcb;
+  struct tcp_pcb **chain;
+  
+  if(pcblist == (struct tcp_pcb **)&tcp_listen_pcbs) {
+    lpcb = (struct tcp_pcb_listen *)pcb;
+    lpcb->hash_next = tcp_listen_hash[lpcb->local_port & (TCP_LISTEN_HASH_SIZE - 1)];
+    tcp_listen_hash[lpcb->local_port & (TCP_LISTEN_HASH_SIZE - 1)] = lpcb;
+  } else {
+    chain = &tcp_pcb_hash[tcp_pcb_hash_index(&(pcb->remote_ip), pcb->remote_port,
+					     pcb->local_port)];
+    pcb->hash_next = *chain;
+    *chain = pcb;
+    tcp_timer_update(pcb);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_pcb_hash_remove():
+ *
+ * Removes a PCB which has just been taken off a PCB list from the hash
+ * table for that list. Called by TCP_RMV, and wherever a PCB is
+ * unlinked from a list by hand.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_pcb_hash_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
+{
+  struct tcp_pcb_listen **lchain;
+  struct tcp_pcb **chain;
+  
+  if(pcblist == (struct tcp_pcb **)&tcp_listen_pcbs) {
+    for(lchain = &tcp_listen_hash[pcb->local_port & (TCP_LISTEN_HASH_SIZE - 1)];
+	*lchain != NULL; lchain = &(*lchain)->hash_next) {
+      if(*lchain == (struct tcp_pcb_listen *)pcb) {
+	*lchain = (*lchain)->hash_next;
+	break;
+      }
+    }
+    ((struct tcp_pcb_listen *)pcb)->hash_next = NULL;
+  } else {
+    for(chain = &tcp_pcb_hash[tcp_pcb_hash_index(&(pcb->remote_ip), pcb->remote_port,
+						 pcb->local_port)];
+	*chain != NULL; chain = &(*chain)->hash_next) {
+      if(*chain == pcb) {
+	*chain = pcb->hash_next;
+	break;
+      }
+    }
+    pcb->hash_next = NULL;
+    tcp_timer_cancel(pcb);
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_pcb_lookup():
+ *
+ * Finds the active or TIME-WAIT PCB of a connection. As when the lists
+ * were searched in turn, an active PCB is preferred to one in TIME-WAIT
+ * for the same connection.
+ */
+/*-----------------------------------------------------------------------------------*/
+struct tcp_pcb *
+tcp_pcb_lookup(struct ip_addr *remote_ip, uint16_t remote_port,
+	       struct ip_addr *local_ip, uint16_t local_port)
+{
+  struct tcp_pcb *pcb, *tw_pcb;
+
+  tw_pcb = NULL;
+  for(pcb = tcp_pcb_hash[tcp_pcb_hash_index(remote_ip, remote_port, local_port)];
+      pcb != NULL; pcb = pcb->hash_next) {
+    ASSERT("tcp_pcb_lookup: pcb->state != CLOSED", pcb->state != CLOSED);
+    ASSERT("tcp_pcb_lookup: pcb->state != LISTEN", pcb->state != LISTEN);
+    if(pcb->remote_port == remote_port &&
+       pcb->local_port == local_port &&
+       ip_addr_cmp(&(pcb->remote_ip), remote_ip) &&
+       ip_addr_cmp(&(pcb->local_ip), local_ip)) {
+      if(pcb->state != TIME_WAIT) {
+	return pcb;
+      }
+      if(tw_pcb == NULL) {
+	tw_pcb = pcb;
+      }
+    }
+  }
+  return tw_pcb;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_listen_lookup():
+ *
+ * Finds the PCB listening for connections to a local address and port,
+ * preferring one bound to the address to one bound to any address.
+ */
+/*-----------------------------------------------------------------------------------*/
+struct tcp_pcb_listen *
+tcp_listen_lookup(struct ip_addr *local_ip, uint16_t local_port)
+{
+  struct tcp_pcb_listen *lpcb, *any_lpcb;
+
+  any_lpcb = NULL;
+  for(lpcb = tcp_listen_hash[local_port & (TCP_LISTEN_HASH_SIZE - 1)];
+      lpcb != NULL; lpcb = lpcb->hash_next) {
+    ASSERT("tcp_listen_lookup: lpcb->state == LISTEN", lpcb->state == LISTEN);
+    if(lpcb->local_port == local_port) {
+      if(ip_addr_cmp(&(lpcb->local_ip), local_ip)) {
+	return lpcb;
+      }
+      if(any_lpcb == NULL && ip_addr_isany(&(lpcb->local_ip))) {
+	any_lpcb = lpcb;
+      }
+    }
+  }
+  return any_lpcb;
+}
+/*-----------------------------------------------------------------------------------*/
 /*
  * tcp_next_iss():
  *
@@ -64,6 +64,8 @@ static struct tcp_seg inseg;
 static err_t tcp_process(struct tcp_pcb *pcb);
 static void tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
+static void tcp_parsesack(struct tcp_pcb *pcb);
+static void tcp_wnd_scale_off(struct tcp_pcb *pcb);
 
 /*-----------------------------------------------------------------------------------*/
 /* tcp_input:
@@ -79,7 +81,7 @@ void
 tcp_input(struct pbuf *p, struct netif *inp)
 {
   struct tcp_hdr *tcphdr;
-  struct tcp_pcb *pcb, *prev;
+  struct tcp_pcb *pcb;
   struct ip_hdr *iphdr;
   uint8_t offset;
   err_t err;
@@ -136,70 +138,13 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
 
   /* Demultiplex an incoming segment. First, we check if it is destined
-     for an active connection. */  
-  prev = NULL;  
-  for(pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
-    ASSERT("tcp_input: active pcb->state != CLOSED", pcb->state != CLOSED);
-    ASSERT("tcp_input: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
-    ASSERT("tcp_input: active pcb->state != LISTEN", pcb->state != LISTEN);
-    if(pcb->remote_port == tcphdr->src &&
-       pcb->local_port == tcphdr->dest &&
-       ip_addr_cmp(&(pcb->remote_ip), &(iphdr->src)) &&
-       ip_addr_cmp(&(pcb->local_ip), &(iphdr->dest))) {
-      
-      /* Move this PCB to the front of the list so that subsequent
-	 lookups will be faster (we exploit locality in TCP segment
-	 arrivals). */
-      ASSERT("tcp_input: pcb->next != pcb (before cache)", pcb->next != pcb);
-      if(prev != NULL) {
-	prev->next = pcb->next;
-	pcb->next = tcp_active_pcbs;
-	tcp_active_pcbs = pcb; 
-      }
-      ASSERT("tcp_input: pcb->next != pcb (after cache)", pcb->next != pcb);
-      break;
-    }
-    prev = pcb;
-  }
+     for an active connection, or one in TIME-WAIT. */
+  pcb = tcp_pcb_lookup(&(iphdr->src), tcphdr->src, &(iphdr->dest), tcphdr->dest);
 
-  /* If it did not go to an active connection, we check the connections
-     in the TIME-WAIT state. */
+  /* If we did not get a match, we check the PCBs that are LISTENing
+     for incomming connections. */
   if(pcb == NULL) {
-    for(pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb->next) {
-      ASSERT("tcp_input: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
-      if(pcb->remote_port == tcphdr->src &&
-	 pcb->local_port == tcphdr->dest &&
-	 ip_addr_cmp(&(pcb->remote_ip), &(iphdr->src)) &&
-         ip_addr_cmp(&(pcb->local_ip), &(iphdr->dest))) {
-	/* We don't really care enough to move this PCB to the front
-	   of the list since we are not very likely to receive that
-	   many segments for connections in TIME-WAIT. */
-	break;
-      }
-    }  
-  
-  /* Finally, if we still did not get a match, we check all PCBs that
-     are LISTENing for incomming connections. */
-    prev = NULL;  
-    if(pcb == NULL) {
-      for(pcb = (struct tcp_pcb *)tcp_listen_pcbs; pcb != NULL; pcb = pcb->next) {
-	ASSERT("tcp_input: LISTEN pcb->state == LISTEN", pcb->state == LISTEN);
-	if((ip_addr_isany(&(pcb->local_ip)) ||
-               ip_addr_cmp(&(pcb->local_ip), &(iphdr->dest))) &&
-	   pcb->local_port == tcphdr->dest) {	  
-	  /* Move this PCB to the front of the list so that subsequent
-	     lookups will be faster (we exploit locality in TCP segment
-	     arrivals). */
-	  if(prev != NULL) {
-	    prev->next = pcb->next;
-	    pcb->next = (struct tcp_pcb *)tcp_listen_pcbs;
-	    tcp_listen_pcbs = (struct tcp_pcb_listen *)pcb; 
-	  }
-	  break;
-	}
-	prev = pcb;
-      }
-    }
+    pcb = (struct tcp_pcb *)tcp_listen_lookup(&(iphdr->dest), tcphdr->dest);
   }
   
 #if TCP_INPUT_DEBUG
@@ -210,6 +155,19 @@ tcp_input(struct pbuf *p, struct netif *inp)
 
   /*  seg = memp_malloc2(MEMP_TCP_SEG);
       if(seg != NULL && pcb != NULL) {*/
+  if(pcb != NULL && pcb->state != LISTEN &&
+     (pcb->refused_data != NULL || pcb->flags & TF_FIN_REFUSED) &&
+     tcp_refused_data(pcb) != ERR_OK) {
+    /* The application still has no room for what it refused before,
+       so drop the segment; the peer will send it again. */
+    DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: dropping segment, application refused data\n"));
+#ifdef TCP_STATS
+    ++stats.tcp.drop;
+#endif /* TCP_STATS */
+    pbuf_free(p);
+    return;
+  }
+
   if(pcb != NULL) {
       
 #if TCP_INPUT_DEBUG
@@ -224,6 +182,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
     inseg.dataptr = p->payload;
     inseg.p = p;
     inseg.tcphdr = tcphdr;
+    inseg.flags = 0;
     
     /* The len field in the tcp_seg structure is the segment length
        in TCP terms. In TCP, the SYN and FIN segments are treated as
@@ -267,9 +226,22 @@ tcp_input(struct pbuf *p, struct netif *inp)
 	    if(pcb->recv != NULL) {
 	      if(pcb->recv_data != NULL) {
 		err = pcb->recv(pcb->callback_arg, pcb, pcb->recv_data, ERR_OK);
+		if(err == ERR_MEM) {
+		  /* The application has no room for the data: keep it
+		     and offer it again from tcp_refused_data(). It is
+		     ours now, so it is still acknowledged. */
+		  pcb->refused_data = pcb->recv_data;
+		  err = ERR_OK;
+		}
 	      }
 	      if(pcb->flags & TF_GOT_FIN) {
-		err = pcb->recv(pcb->callback_arg, pcb, NULL, ERR_OK);
+		if(pcb->refused_data == NULL) {
+		  err = pcb->recv(pcb->callback_arg, pcb, NULL, ERR_OK);
+		}
+		if(pcb->refused_data != NULL || err == ERR_MEM) {
+		  pcb->flags |= TF_FIN_REFUSED;
+		  err = ERR_OK;
+		}
 	      }
 	    } else {
 	      err = ERR_OK;
@@ -285,6 +257,8 @@ tcp_input(struct pbuf *p, struct netif *inp)
 	    pbuf_free(pcb->recv_data);	  
 	    tcp_output(pcb);
 	  }
+	  /* Its timers may have been started, or a delayed ACK set. */
+	  tcp_timer_update(pcb);
 	}
       }
     }
@@ -334,7 +308,8 @@ tcp_process(struct tcp_pcb *pcb)
   struct tcp_hdr *tcphdr;
   uint32_t seqno, ackno;
   uint8_t flags;
-  uint32_t optdata;
+  uint32_t optdata[3];
+  uint8_t optlen;
   struct tcp_seg *rseg;
   uint8_t acceptable = 0;
   
@@ -417,10 +392,10 @@ tcp_process(struct tcp_pcb *pcb)
       npcb->local_port = pcb->local_port;
       ip_addr_set(&(npcb->remote_ip), &(iphdr->src));
       npcb->remote_port = tcphdr->src;
+      npcb->mss = tcp_mss_for(&(npcb->remote_ip));
       npcb->state = SYN_RCVD;
       npcb->rcv_nxt = seqno + 1;
       npcb->snd_wnd = tcphdr->wnd;
-      npcb->ssthresh = npcb->snd_wnd;
       npcb->snd_wl1 = tcphdr->seqno;
       npcb->accept = pcb->accept;
       npcb->callback_arg = pcb->callback_arg;
@@ -431,14 +406,17 @@ tcp_process(struct tcp_pcb *pcb)
 
       /* Parse any options in the SYN. */
       tcp_parseopt(npcb);
+      if(!(npcb->flags & TF_WND_SCALE)) {
+	tcp_wnd_scale_off(npcb);
+      }
+      /* Slow start runs up to the largest window the peer can offer. */
+      npcb->ssthresh = (uint32_t)0xffff << npcb->snd_scale;
       
-      /* Build an MSS option. */
-      optdata = HTONL(((uint32_t)2 << 24) | 
-		      ((uint32_t)4 << 16) | 
-		      (((uint32_t)npcb->mss / 256) << 8) |
-		      (npcb->mss & 255));
-      /* Send a SYN|ACK together with the MSS option. */
-      tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (uint8_t *)&optdata, 4);
+      /* Build the MSS option, and the window scale and SACK
+	 permitted options if the SYN had them. */
+      optlen = tcp_syn_options(npcb, optdata);
+      /* Send a SYN|ACK together with the options. */
+      tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (uint8_t *)optdata, optlen);
       return tcp_output(npcb);
     }  
     break;
@@ -450,7 +428,10 @@ tcp_process(struct tcp_pcb *pcb)
        ackno == ntohl(pcb->unacked->tcphdr->seqno) + 1) {
       pcb->rcv_nxt = seqno + 1;
       pcb->lastack = ackno;
-      pcb->rcv_wnd = tcphdr->wnd;
+      /* The window in a SYN is never scaled. */
+      pcb->snd_wnd = tcphdr->wnd;
+      pcb->snd_wl1 = seqno;
+      pcb->snd_wl2 = ackno;
       pcb->state = ESTABLISHED;
       pcb->cwnd = pcb->mss;
       --pcb->snd_queuelen;
@@ -459,8 +440,13 @@ tcp_process(struct tcp_pcb *pcb)
       pcb->unacked = rseg->next;
       tcp_seg_free(rseg);
 
-      /* Parse any options in the SYNACK. */
+      /* Parse any options in the SYNACK. Windows are only scaled
+	 if both ends asked to. */
       tcp_parseopt(pcb);
+      if(!(pcb->flags & TF_WND_SCALE)) {
+	tcp_wnd_scale_off(pcb);
+      }
+      pcb->ssthresh = (uint32_t)0xffff << pcb->snd_scale;
 
       /* Call the user specified function to call when sucessfully
 	 connected. */
@@ -594,36 +580,67 @@ tcp_receive(struct tcp_pcb *pcb)
 {
   struct tcp_seg *next, *prev, *cseg;
   struct pbuf *p;
-  uint32_t ackno, seqno;
+  uint32_t ackno, seqno, wnd, inc;
   int32_t off;
   int m;
+#if TCP_QUEUE_OOSEQ
+  int hole;
+#endif /* TCP_QUEUE_OOSEQ */
 
   ackno = inseg.tcphdr->ackno;
   seqno = inseg.tcphdr->seqno;
-      
+  wnd = inseg.tcphdr->wnd;
+  if(!(TCPH_FLAGS(inseg.tcphdr) & TCP_SYN)) {
+    wnd <<= pcb->snd_scale;
+  }
       
   if(TCPH_FLAGS(inseg.tcphdr) & TCP_ACK) {
     /* Update window. */
     if(TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && inseg.tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = inseg.tcphdr->wnd;
+       (pcb->snd_wl2 == ackno && wnd > pcb->snd_wnd)) {
+      pcb->snd_wnd = wnd;
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
       DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %lu\n", pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if(pcb->snd_wnd != inseg.tcphdr->wnd) {
+      if(pcb->snd_wnd != wnd) {
         DEBUGF(TCP_WND_DEBUG, ("tcp_receive: no window update lastack %lu snd_max %lu ackno %lu wl1 %lu seqno %lu wl2 %lu\n",
                                pcb->lastack, pcb->snd_max, ackno, pcb->snd_wl1, seqno, pcb->snd_wl2));
       }
 #endif /* TCP_WND_DEBUG */
     }
-    
+
+    /* Mark what the peer has SACKed on the scoreboard. */
+    if(pcb->flags & TF_SACK) {
+      tcp_parsesack(pcb);
+    }
 
     if(pcb->lastack == ackno) {
       ++pcb->dupacks;
-      if(pcb->dupacks >= 3 && pcb->unacked != NULL) {
+      if(pcb->flags & TF_SACK) {
+	/* Loss recovery with SACK (RFC 6675) begins on the third
+	   duplicate ACK, or as soon as the scoreboard shows the first
+	   unacknowledged segment lost, unless the ACK is for data sent
+	   before the last recovery or timeout. Only the first segment
+	   is retransmitted here; tcp_output() sends the rest of what
+	   is lost, and new data, as the pipe has room for. */
+	if(!(pcb->flags & TF_INFR) && pcb->unacked != NULL &&
+	   TCP_SEQ_GEQ(pcb->lastack, pcb->recover)) {
+	  tcp_sack_pipe(pcb);
+	  if(pcb->dupacks >= 3 || (pcb->unacked->flags & TF_SEG_LOST)) {
+	    DEBUGF(TCP_FR_DEBUG, ("tcp_receive: dupacks %d (%lu), SACK recovery from %lu\n",
+				  pcb->dupacks, pcb->lastack,
+				  ntohl(pcb->unacked->tcphdr->seqno)));
+	    pcb->ssthresh = UMAX((pcb->snd_max - pcb->lastack) / 2, 2 * pcb->mss);
+	    pcb->cwnd = pcb->ssthresh;
+	    pcb->recover = pcb->snd_max;
+	    pcb->flags |= TF_INFR;
+	    tcp_sack_rexmit(pcb, pcb->unacked);
+	  }
+	}
+      } else if(pcb->dupacks >= 3 && pcb->unacked != NULL) {
         if(!(pcb->flags & TF_INFR)) {
           /* This is fast retransmit. Retransmit the first unacked segment. */
           DEBUGF(TCP_FR_DEBUG, ("tcp_receive: dupacks %d (%lu), fast retransmit %lu\n",
@@ -652,8 +669,11 @@ tcp_receive(struct tcp_pcb *pcb)
 
       /* Reset the "IN Fast Retransmit" flag, since we are no longer
          in fast retransmit. Also reset the congestion window to the
-         slow start threshold. */
-      if(pcb->flags & TF_INFR) {
+         slow start threshold. With SACK, recovery goes on through
+         partial ACKs until all that was in flight when it began is
+         acknowledged. */
+      if((pcb->flags & TF_INFR) &&
+	 (!(pcb->flags & TF_SACK) || TCP_SEQ_GEQ(ackno, pcb->recover))) {
 	pcb->flags &= ~TF_INFR;
 	pcb->cwnd = pcb->ssthresh;
       }
@@ -673,8 +693,8 @@ tcp_receive(struct tcp_pcb *pcb)
 
       
       /* Update the congestion control variables (cwnd and
-         ssthresh). */
-      if(pcb->state >= ESTABLISHED) {
+         ssthresh), which stay as they are while recovery lasts. */
+      if(pcb->state >= ESTABLISHED && !(pcb->flags & TF_INFR)) {
         if(pcb->cwnd < pcb->ssthresh) {
 	  if(pcb->cwnd + pcb->mss > pcb->cwnd) {
 	    pcb->cwnd += pcb->mss;
@@ -687,6 +707,17 @@ tcp_receive(struct tcp_pcb *pcb)
           DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %u\n", pcb->cwnd));
         }
       }
+
+      /* Grow the send buffer towards twice what the windows let us
+	 have in flight, so that it does not hold the sender back. */
+      if(pcb->snd_buf_max < pcb->snd_buf_lim) {
+	inc = UMIN(2 * UMIN(pcb->cwnd, pcb->snd_wnd), pcb->snd_buf_lim);
+	if(inc > pcb->snd_buf_max) {
+	  pcb->snd_buf += inc - pcb->snd_buf_max;
+	  pcb->snd_buf_max = inc;
+	  DEBUGF(TCP_WND_DEBUG, ("tcp_receive: send buffer %lu\n", pcb->snd_buf_max));
+	}
+      }
       DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %lu, unacked->seqno %lu:%lu\n",
                                ackno,
                                pcb->unacked != NULL?
@@ -750,7 +781,7 @@ tcp_receive(struct tcp_pcb *pcb)
 	}
 #endif /* LWIP_DEBUG */
       }
-      pcb->polltmr = 0;
+      pcb->polltmr = tcp_ticks;
     }
     /* End of ACK for new data processing. */
     
@@ -865,6 +896,7 @@ tcp_receive(struct tcp_pcb *pcb)
            we have to trim the end of the segment and update rcv_nxt
            and pass the data to the application. */
 #if TCP_QUEUE_OOSEQ
+	hole = (pcb->ooseq != NULL);
 	if(pcb->ooseq != NULL &&
 	   TCP_SEQ_LEQ(pcb->ooseq->tcphdr->seqno, seqno + inseg.len)) {
 	  /* We have to trim the second edge of the incoming
@@ -882,6 +914,18 @@ tcp_receive(struct tcp_pcb *pcb)
 	} else {
 	  pcb->rcv_wnd -= TCP_TCPLEN(&inseg);
 	}
+
+	/* If the sender has used up a whole window we advertised while
+	   the application kept up, the window may be what holds the
+	   sender back: double it. */
+	if(pcb->rcv_wnd_max < pcb->rcv_wnd_lim &&
+	   TCP_SEQ_GEQ(pcb->rcv_nxt + pcb->mss, pcb->rcv_adv) &&
+	   pcb->rcv_wnd_max - pcb->rcv_wnd <= pcb->rcv_wnd_max / 2) {
+	  inc = UMIN(pcb->rcv_wnd_max, pcb->rcv_wnd_lim - pcb->rcv_wnd_max);
+	  pcb->rcv_wnd_max += inc;
+	  pcb->rcv_wnd += inc;
+	  DEBUGF(TCP_WND_DEBUG, ("tcp_receive: receive window %lu\n", pcb->rcv_wnd_max));
+	}
 	
 	/* If there is data in the segment, we make preparations to
 	   pass this up to the application. The ->recv_data variable
@@ -925,7 +969,7 @@ tcp_receive(struct tcp_pcb *pcb)
 	    pbuf_chain(pcb->recv_data, cseg->p);
 	    cseg->p = NULL;
 	  }
-	  if(TCPH_FLAGS(inseg.tcphdr) & TCP_FIN) {
+	  if(TCPH_FLAGS(cseg->tcphdr) & TCP_FIN) {
 	    DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: dequeued FIN."));
 	    pcb->flags |= TF_GOT_FIN;
 	  }	    
@@ -937,11 +981,22 @@ tcp_receive(struct tcp_pcb *pcb)
 #endif /* TCP_QUEUE_OOSEQ */
 
 
-	/* Acknowledge the segment(s). */
+	/* Acknowledge the segment(s), at once if they fill a hole, so
+	   that the sender learns without delay what is still missing
+	   (RFC 5681). */
+#if TCP_QUEUE_OOSEQ
+	if(hole) {
+	  tcp_ack_now(pcb);
+	} else
+#endif /* TCP_QUEUE_OOSEQ */
 	tcp_ack(pcb);
 
       } else {
 	/* We get here if the incoming segment is out-of-sequence. */
+#if TCP_QUEUE_OOSEQ
+	/* Its block is the first the ACK reports. */
+	pcb->rcv_sack = seqno;
+#endif /* TCP_QUEUE_OOSEQ */
 	tcp_ack_now(pcb);
 #if TCP_QUEUE_OOSEQ
 	/* We queue the segment on the ->ooseq queue. */
@@ -1084,7 +1139,7 @@ tcp_parseopt(struct tcp_pcb *pcb)
 
   opts = (uint8_t *)inseg.tcphdr + TCP_HLEN;
   
-  /* Parse the TCP MSS option, if present. */
+  /* Parse the TCP MSS and window scale options, if present. */
   if((TCPH_OFFSET(inseg.tcphdr) & 0xf0) > 0x50) {
     for(c = 0; c < ((TCPH_OFFSET(inseg.tcphdr) >> 4) - 5) << 2 ;) {
       opt = opts[c];
@@ -1098,10 +1153,27 @@ tcp_parseopt(struct tcp_pcb *pcb)
                 opts[c + 1] == 0x04) {
         /* An MSS option with the right option length. */       
         mss = (opts[c + 2] << 8) | opts[c + 3];
-        pcb->mss = mss > TCP_MSS? TCP_MSS: mss;
-        
-        /* And we are done processing options. */
-        break;
+        if(mss > 0 && mss < pcb->mss) {
+          pcb->mss = mss;
+        }
+        c += 4;
+      } else if(opt == 0x03 &&
+                opts[c + 1] == 0x03) {
+        /* A window scale option (RFC 7323), which only counts in a
+           SYN. */
+        if(TCPH_FLAGS(inseg.tcphdr) & TCP_SYN) {
+          pcb->snd_scale = UMIN(opts[c + 2], TCP_MAX_WND_SCALE);
+          pcb->flags |= TF_WND_SCALE;
+        }
+        c += 3;
+      } else if(opt == 0x04 &&
+                opts[c + 1] == 0x02) {
+        /* SACK permitted (RFC 2018), which only counts in a SYN and
+           only if we offer it too. */
+        if((TCPH_FLAGS(inseg.tcphdr) & TCP_SYN) && !(pcb->flags & TF_NOSACK)) {
+          pcb->flags |= TF_SACK;
+        }
+        c += 2;
       } else {
 	if(opts[c + 1] == 0) {
           /* If the length field is zero, the options are malformed
@@ -1116,4 +1188,80 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 /*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_parsesack:
+ *
+ * Marks the segments on ->unacked which the SACK option of the
+ * incoming segment, if it has one, covers whole. Blocks which are not
+ * for data past the last ACK and sent are ignored.
+ */
+/*-----------------------------------------------------------------------------------*/
+
+static void
+tcp_parsesack(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  uint8_t *opts, *block;
+  uint16_t c, optlen, i;
+  uint32_t left, right, seqno;
+
+  opts = (uint8_t *)inseg.tcphdr + TCP_HLEN;
+  optlen = ((TCPH_OFFSET(inseg.tcphdr) >> 4) - 5) << 2;
+  for(c = 0; c < optlen && opts[c] != 0x00;) {
+    if(opts[c] == 0x01) {
+      ++c;
+      continue;
+    }
+    if(c + 1 >= optlen || opts[c + 1] < 2 || c + opts[c + 1] > optlen) {
+      /* Malformed. */
+      break;
+    }
+    if(opts[c] == 0x05) {
+      for(i = 2; i + 8 <= opts[c + 1]; i += 8) {
+	block = opts + c + i;
+	left = ((uint32_t)block[0] << 24) | ((uint32_t)block[1] << 16) |
+	  ((uint32_t)block[2] << 8) | block[3];
+	right = ((uint32_t)block[4] << 24) | ((uint32_t)block[5] << 16) |
+	  ((uint32_t)block[6] << 8) | block[7];
+	if(!TCP_SEQ_LT(inseg.tcphdr->ackno, left) ||
+	   !TCP_SEQ_LT(left, right) ||
+	   TCP_SEQ_GT(right, pcb->snd_max)) {
+	  continue;
+	}
+	for(seg = pcb->unacked; seg != NULL; seg = seg->next) {
+	  seqno = ntohl(seg->tcphdr->seqno);
+	  if(TCP_SEQ_GEQ(seqno, right)) {
+	    break;
+	  }
+	  if(TCP_SEQ_GEQ(seqno, left) &&
+	     TCP_SEQ_LEQ(seqno + TCP_TCPLEN(seg), right)) {
+	    seg->flags |= TF_SEG_SACKED;
+	  }
+	}
+      }
+    }
+    c += opts[c + 1];
+  }
+}
+/*-----------------------------------------------------------------------------------*/
   
+/*
+ * tcp_wnd_scale_off:
+ *
+ * Called when the handshake shows that the peer does not scale
+ * windows. The receive window is then held to what fits in the
+ * header.
+ */
+/*-----------------------------------------------------------------------------------*/
+
+static void
+tcp_wnd_scale_off(struct tcp_pcb *pcb)
+{
+  pcb->snd_scale = pcb->rcv_scale = 0;
+  pcb->rcv_wnd_lim = UMIN(pcb->rcv_wnd_lim, 0xffff);
+  if(pcb->rcv_wnd_max > pcb->rcv_wnd_lim) {
+    pcb->rcv_wnd -= UMIN(pcb->rcv_wnd, pcb->rcv_wnd_max - pcb->rcv_wnd_lim);
+    pcb->rcv_wnd_max = pcb->rcv_wnd_lim;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
@@ -68,6 +68,9 @@
 
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
+static uint16_t tcp_adv_wnd(struct tcp_pcb *pcb, uint32_t wnd, uint8_t flags);
+static uint8_t tcp_sack_options(struct tcp_pcb *pcb, uint32_t *optdata);
+static void tcp_output_rexmit(struct tcp_pcb *pcb, struct tcp_seg *seg);
 
 
 /*-----------------------------------------------------------------------------------*/
@@ -104,7 +107,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, uint16_t len,
 	uint32_t left, seqno;
 	uint16_t seglen;
 	void *ptr;
-	uint8_t queuelen;
+	uint16_t queuelen;
 
 	left = len;
 	ptr = arg;
@@ -154,6 +157,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, uint16_t len,
 		}
 		seg->next = NULL;
 		seg->p = NULL;
+		seg->flags = 0;
 
 
 		if(queue == NULL) {
@@ -330,20 +334,32 @@ tcp_output(struct tcp_pcb *pcb)
   struct pbuf *p;
   struct tcp_hdr *tcphdr;
   struct tcp_seg *seg, *useg;
-  uint32_t wnd;
+  uint32_t wnd, pipe;
+  uint32_t optdata[1 + 2 * TCP_SACK_BLOCKS];
+  uint8_t optlen, recovery;
 #if TCP_CWND_DEBUG
   int i = 0;
 #endif /* TCP_CWND_DEBUG */
   
-  wnd = MIN(pcb->snd_wnd, pcb->cwnd);
+  /* Each of the first two duplicate ACKs lets a new segment out past
+     the congestion window (limited transmit, RFC 3042), so that a
+     small window still brings the third. */
+  wnd = pcb->cwnd;
+  if(pcb->dupacks > 0 && pcb->dupacks < 3 && pcb->unacked != NULL &&
+     !(pcb->flags & TF_INFR)) {
+    wnd += pcb->dupacks * pcb->mss;
+  }
+  wnd = MIN(pcb->snd_wnd, wnd);
 
   seg = pcb->unsent;
 
   if(pcb->flags & TF_ACK_NOW) {
     /* If no segments are enqueued but we should send an ACK, we
-       construct the ACK and send it. */
+       construct the ACK and send it, with SACK blocks for what is
+       queued out of sequence. */
     pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
-    p = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_RAM);
+    optlen = tcp_sack_options(pcb, optdata);
+    p = pbuf_alloc(PBUF_TRANSPORT, optlen, PBUF_RAM);
     if(p == NULL) {
       DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_enqueue: (ACK) could not allocate pbuf\n"));
       return ERR_BUF;
@@ -365,9 +381,10 @@ tcp_output(struct tcp_pcb *pcb)
     tcphdr->seqno = htonl(pcb->snd_nxt);
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_FLAGS_SET(tcphdr, TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_wnd);
+    tcphdr->wnd = tcp_adv_wnd(pcb, pcb->rcv_wnd, TCP_ACK);
     tcphdr->urgp = 0;
-    TCPH_OFFSET_SET(tcphdr, 5 << 4);
+    TCPH_OFFSET_SET(tcphdr, (5 + optlen / 4) << 4);
+    bcopy(optdata, (uint8_t *)tcphdr + TCP_HLEN, optlen);
     
     tcphdr->chksum = 0;
     tcphdr->chksum = inet_chksum_pseudo(p, &(pcb->local_ip), &(pcb->remote_ip),
@@ -397,10 +414,30 @@ tcp_output(struct tcp_pcb *pcb)
                             ntohl(seg->tcphdr->seqno), pcb->lastack));
   }
 #endif /* TCP_CWND_DEBUG */
+
+  /* In loss recovery with SACK (RFC 6675), what may be sent is what
+     the pipe -- the data estimated to be in flight -- leaves room for
+     in the congestion window, rather than what lies within it past
+     the last ACK. The segments presumed lost go first. */
+  recovery = (pcb->flags & (TF_INFR | TF_SACK)) == (TF_INFR | TF_SACK);
+  pipe = 0;
+  if(recovery) {
+    wnd = pcb->snd_wnd;
+    pipe = tcp_sack_pipe(pcb);
+    for(useg = pcb->unacked;
+	useg != NULL && pipe + pcb->mss <= pcb->cwnd;
+	useg = useg->next) {
+      if((useg->flags & (TF_SEG_SACKED | TF_SEG_LOST | TF_SEG_REXMIT)) == TF_SEG_LOST) {
+	tcp_sack_rexmit(pcb, useg);
+	pipe += useg->len;
+      }
+    }
+  }
   
   while(seg != NULL &&
-	ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
-    pcb->rtime = 0;
+	ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd &&
+	(!recovery || pipe + seg->len <= pcb->cwnd)) {
+    pcb->rtime = tcp_ticks;
 #if TCP_CWND_DEBUG
     DEBUGF(TCP_CWND_DEBUG, ("tcp_output: snd_wnd %lu, cwnd %lu, wnd %lu, effwnd %lu, seq %lu, ack %lu, i%d\n",
                             pcb->snd_wnd, pcb->cwnd, wnd,
@@ -419,6 +456,7 @@ tcp_output(struct tcp_pcb *pcb)
     }
     
     tcp_output_segment(seg, pcb);
+    pipe += seg->len;
     pcb->snd_nxt = ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
     if(TCP_SEQ_LT(pcb->snd_max, pcb->snd_nxt)) {
       pcb->snd_max = pcb->snd_nxt;
@@ -438,6 +476,7 @@ tcp_output(struct tcp_pcb *pcb)
     }
     seg = pcb->unsent;
   }  
+  tcp_timer_update(pcb);
   return ERR_OK;
 }
 /*-----------------------------------------------------------------------------------*/
@@ -453,9 +492,9 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 
   /* silly window avoidance */
   if(pcb->rcv_wnd < pcb->mss) {
-    seg->tcphdr->wnd = 0;
+    seg->tcphdr->wnd = tcp_adv_wnd(pcb, 0, TCPH_FLAGS(seg->tcphdr));
   } else {
-    seg->tcphdr->wnd = htons(pcb->rcv_wnd);
+    seg->tcphdr->wnd = tcp_adv_wnd(pcb, pcb->rcv_wnd, TCPH_FLAGS(seg->tcphdr));
   }
 
   /* If we don't have a local IP address, we get one by
@@ -469,7 +508,7 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
     ip_addr_set(&(pcb->local_ip), &(netif.ip_addr));
   }
 
-  pcb->rtime = 0;
+  pcb->rtime = tcp_ticks;
   
   if(pcb->rttest == 0) {
     pcb->rttest = tcp_ticks;
@@ -499,11 +538,28 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 
 }
 /*-----------------------------------------------------------------------------------*/
+/* the window field for a segment advertising wnd: scaled unless the
+   segment is a SYN, and no more than the field holds. Once the sender
+   has used up the window advertised before, the right edge of this one
+   is noted, for tcp_receive() to tell when it is used up in turn. */
+static uint16_t
+tcp_adv_wnd(struct tcp_pcb *pcb, uint32_t wnd, uint8_t flags)
+{
+  uint8_t scale;
+
+  scale = (flags & TCP_SYN)? 0: pcb->rcv_scale;
+  wnd = UMIN(wnd >> scale, 0xffff);
+  if((flags & TCP_SYN) ||
+     TCP_SEQ_GEQ(pcb->rcv_nxt + pcb->mss, pcb->rcv_adv)) {
+    pcb->rcv_adv = pcb->rcv_nxt + (wnd << scale);
+  }
+  return htons(wnd);
+}
+/*-----------------------------------------------------------------------------------*/
 void
 tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg)
 {
   uint32_t wnd;
-  uint16_t len, tot_len;
   
   DEBUGF(TCP_REXMIT_DEBUG, ("tcp_rexmit_seg: skickar %ld:%ld\n",
 			    ntohl(seg->tcphdr->seqno),
@@ -516,38 +572,176 @@ tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg)
     /* Count the number of retranmissions. */
     ++pcb->nrtx;
     
-    seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
-    seg->tcphdr->wnd = htons(pcb->rcv_wnd);
+    tcp_output_rexmit(pcb, seg);
+  } else {
+    DEBUGF(TCP_REXMIT_DEBUG, ("tcp_rexmit_seg: no room in window %lu to send %lu (ack %lu)\n",
+                              wnd, ntohl(seg->tcphdr->seqno), pcb->lastack));
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_sack_rexmit():
+ *
+ * Retransmits a segment in loss recovery with SACK, whatever lies
+ * past the last ACK, as tcp_output() found room for it in the pipe.
+ * It is marked so that it is retransmitted only once in the recovery;
+ * nrtx counts the retransmission timeouts alone.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_sack_rexmit(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  DEBUGF(TCP_FR_DEBUG, ("tcp_sack_rexmit: %lu:%lu\n",
+			ntohl(seg->tcphdr->seqno),
+			ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg)));
+  seg->flags |= TF_SEG_REXMIT;
+  tcp_output_rexmit(pcb, seg);
+}
+/*-----------------------------------------------------------------------------------*/
+/* Sends a segment on ->unacked again. */
+static void
+tcp_output_rexmit(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  uint16_t len, tot_len;
 
-    /* Recalculate checksum. */
-    seg->tcphdr->chksum = 0;
-    seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
-                                             &(pcb->local_ip), &(pcb->remote_ip), IP_PROTO_TCP, seg->p->tot_len);
-    
-    len = seg->p->len;
-    tot_len = seg->p->tot_len;
+  seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
+  seg->tcphdr->wnd = tcp_adv_wnd(pcb, pcb->rcv_wnd, TCPH_FLAGS(seg->tcphdr));
 
-    /*pbuf_header(seg->p, IP_HLEN);*/
+  /* Recalculate checksum. */
+  seg->tcphdr->chksum = 0;
+  seg->tcphdr->chksum = inet_chksum_pseudo(seg->p,
+					   &(pcb->local_ip), &(pcb->remote_ip), IP_PROTO_TCP, seg->p->tot_len);
+    
+  len = seg->p->len;
+  tot_len = seg->p->tot_len;
 
-	sr_lwip_output(seg->p, &(pcb->local_ip), &(pcb->remote_ip) , IP_PROTO_TCP);
+  sr_lwip_output(seg->p, &(pcb->local_ip), &(pcb->remote_ip) , IP_PROTO_TCP);
 
-    seg->p->len = len;
-    seg->p->tot_len = tot_len;
-    seg->p->payload = seg->tcphdr;
+  seg->p->len = len;
+  seg->p->tot_len = tot_len;
+  seg->p->payload = seg->tcphdr;
 
 #ifdef TCP_STATS
-    ++stats.tcp.xmit;
-    ++stats.tcp.rexmit;
+  ++stats.tcp.xmit;
+  ++stats.tcp.rexmit;
 #endif /* TCP_STATS */
 
-    pcb->rtime = 0;
+  pcb->rtime = tcp_ticks;
     
-    /* Don't take any rtt measurements after retransmitting. */    
-    pcb->rttest = 0;
-  } else {
-    DEBUGF(TCP_REXMIT_DEBUG, ("tcp_rexmit_seg: no room in window %lu to send %lu (ack %lu)\n",
-                              wnd, ntohl(seg->tcphdr->seqno), pcb->lastack));
+  /* Don't take any rtt measurements after retransmitting. */    
+  pcb->rttest = 0;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_sack_pipe():
+ *
+ * Goes through the scoreboard on ->unacked, marking the segments
+ * presumed lost, and returns the pipe: the bytes estimated to be in
+ * flight (RFC 6675). A segment is presumed lost once three SACKed
+ * segments, or more than two full-sized segments' worth of SACKed
+ * data, lie above it. Those not SACKed are in flight unless lost, and
+ * again once retransmitted.
+ */
+/*-----------------------------------------------------------------------------------*/
+uint32_t
+tcp_sack_pipe(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg;
+  uint32_t sacked, pipe;
+  uint16_t nsacked;
+
+  sacked = 0;
+  nsacked = 0;
+  for(seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if(seg->flags & TF_SEG_SACKED) {
+      sacked += seg->len;
+      ++nsacked;
+    }
+  }
+
+  pipe = 0;
+  for(seg = pcb->unacked; seg != NULL && nsacked > 0; seg = seg->next) {
+    if(seg->flags & TF_SEG_SACKED) {
+      sacked -= seg->len;
+      --nsacked;
+      continue;
+    }
+    if(nsacked >= 3 || sacked > 2 * (uint32_t)pcb->mss) {
+      seg->flags |= TF_SEG_LOST;
+    } else {
+      seg->flags &= ~TF_SEG_LOST;
+    }
+    if(!(seg->flags & TF_SEG_LOST)) {
+      pipe += seg->len;
+    }
+    if(seg->flags & TF_SEG_REXMIT) {
+      pipe += seg->len;
+    }
   }
+  /* Above the last SACKed segment, nothing is presumed lost. */
+  for(; seg != NULL; seg = seg->next) {
+    seg->flags &= ~TF_SEG_LOST;
+    pipe += (seg->flags & TF_SEG_REXMIT)? 2 * seg->len: seg->len;
+  }
+  return pipe;
+}
+/*-----------------------------------------------------------------------------------*/
+/*
+ * tcp_sack_options():
+ *
+ * Builds the SACK option of an ACK in optdata, which must have room
+ * for 1 + 2 * TCP_SACK_BLOCKS words, and returns its length, 0 if
+ * there is none. Each block is a run of segments queued out of
+ * sequence; the one holding the latest to arrive goes first, then the
+ * others from the lowest up, as many as fit (RFC 2018).
+ */
+/*-----------------------------------------------------------------------------------*/
+static uint8_t
+tcp_sack_options(struct tcp_pcb *pcb, uint32_t *optdata)
+{
+#if TCP_QUEUE_OOSEQ
+  struct tcp_seg *seg;
+  uint32_t left, right;
+  uint8_t n, first;
+
+  if(!(pcb->flags & TF_SACK) || pcb->ooseq == NULL) {
+    return 0;
+  }
+
+  /* Block 0 is kept for the latest, and dropped if it is not found. */
+  n = 1;
+  first = 0;
+  for(seg = pcb->ooseq; seg != NULL; seg = seg->next) {
+    left = seg->tcphdr->seqno;
+    right = left + TCP_TCPLEN(seg);
+    while(seg->next != NULL && seg->next->tcphdr->seqno == right) {
+      seg = seg->next;
+      right += TCP_TCPLEN(seg);
+    }
+    if(TCP_SEQ_LEQ(left, pcb->rcv_sack) && TCP_SEQ_LT(pcb->rcv_sack, right)) {
+      optdata[1] = htonl(left);
+      optdata[2] = htonl(right);
+      first = 1;
+    } else if(n < TCP_SACK_BLOCKS) {
+      optdata[1 + 2 * n] = htonl(left);
+      optdata[2 + 2 * n] = htonl(right);
+      ++n;
+    }
+  }
+  if(!first) {
+    --n;
+    bcopy(&optdata[3], &optdata[1], 2 * n * sizeof(uint32_t));
+  }
+
+  /* Two NOPs to align the blocks. */
+  optdata[0] = htonl(((uint32_t)1 << 24) |
+		     ((uint32_t)1 << 16) |
+		     ((uint32_t)5 << 8) |
+		     (2 + 8 * n));
+  return 4 + 8 * n;
+#else /* TCP_QUEUE_OOSEQ */
+  return 0;
+#endif /* TCP_QUEUE_OOSEQ */
 }
 /*-----------------------------------------------------------------------------------*/
 void
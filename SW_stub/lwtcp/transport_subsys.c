@@ -43,6 +43,7 @@
 #include "lwip/pbuf.h"
 
 #include "lwip/transport_subsys.h"
+#include "lwip/sockets.h"
 
 #include "lwip/tcp.h"
 
@@ -51,13 +52,29 @@
 static void (* transport_init_done)(void *arg) = NULL;
 static void *transport_init_done_arg;
 static sys_mbox_t mbox;
+static int tcp_timer_active;
 
 /*-----------------------------------------------------------------------------------*/
 static void
 transport_tcp_timer(void *arg)
 {
   tcp_tmr();
-  sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)transport_tcp_timer, NULL);
+  /* Stop ticking once no connection has a timer running; TCP calls
+     tcp_timer_needed() when one starts again. */
+  if(tcp_timers_pending()) {
+    sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)transport_tcp_timer, NULL);
+  } else {
+    tcp_timer_active = 0;
+  }
+}
+/*-----------------------------------------------------------------------------------*/
+void
+tcp_timer_needed(void)
+{
+  if(!tcp_timer_active) {
+    tcp_timer_active = 1;
+    sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)transport_tcp_timer, NULL);
+  }
 }
 /*-----------------------------------------------------------------------------------*/
 
@@ -74,8 +91,6 @@ transport_thread(void *arg)
   udp_init();
   tcp_init();
 
-  sys_timeout(TCP_TMR_INTERVAL, (sys_timeout_handler)transport_tcp_timer, NULL);
-
   if(transport_init_done != NULL) {
     transport_init_done(transport_init_done_arg);
   }
@@ -121,7 +136,13 @@ tcp_msg_input(struct pbuf *p, struct netif *inp)
   msg->type = TCP_MSG_INPUT;
   msg->msg.inp.p = p;
   msg->msg.inp.netif = inp;
-  sys_mbox_post(mbox, msg);
+  if(sys_mbox_trypost(mbox, msg) != ERR_OK) {
+    /* The transport thread is behind: drop the segment rather than
+       hold up the router, and leave it to TCP to send it again. */
+    memp_freep(MEMP_TCP_MSG, msg);
+    pbuf_free(p);
+    return ERR_MEM;
+  }
   return ERR_OK;
 }
 
@@ -140,7 +161,13 @@ transport_subsys_input(struct pbuf *p, struct netif *inp)
   msg->type = TCP_MSG_INPUT;
   msg->msg.inp.p = p;
   msg->msg.inp.netif = inp;
-  sys_mbox_post(mbox, msg);
+  if(sys_mbox_trypost(mbox, msg) != ERR_OK) {
+    /* The transport thread is behind: drop the segment rather than
+       hold up the router, and leave it to TCP to send it again. */
+    memp_freep(MEMP_TCP_MSG, msg);
+    pbuf_free(p);
+    return ERR_MEM;
+  }
   return ERR_OK;
 }
 
@@ -157,6 +184,7 @@ transport_apimsg(struct api_msg *apimsg)
   }
   msg->type = TCP_MSG_API;
   msg->msg.apimsg = apimsg;
+  /* the application waits for room if the transport thread is behind */
   sys_mbox_post(mbox, msg);
 }
 /*-----------------------------------------------------------------------------------*/
@@ -165,6 +193,7 @@ transport_subsys_init(void (* initfunc)(void *), void *arg)
 {
   transport_init_done = initfunc;
   transport_init_done_arg = arg;
+  lwip_socket_init();
   mbox = sys_mbox_new();
   sys_thread_new((void *)transport_thread, NULL);
 }
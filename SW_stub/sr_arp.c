@@ -0,0 +1,251 @@
+/* Filename: sr_arp.c */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sr_arp.h"
+
+/** buckets a cache starts with once it has an entry */
+#define ARP_INITIAL_BUCKETS 16
+
+static unsigned arp_hash( arp_t* arp, addr_ip_t ip ) {
+    return hash32( ip ) & (arp->num_buckets - 1);
+}
+
+static void arp_grow( arp_t* arp ) {
+    arp_entry_t** old = arp->bucket;
+    unsigned old_num = arp->num_buckets;
+    arp_entry_t *e, *next;
+    unsigned i, h;
+
+    arp->num_buckets = old_num ? 2 * old_num : ARP_INITIAL_BUCKETS;
+    arp->bucket = calloc_or_die( arp->num_buckets, sizeof(*arp->bucket) );
+    for( i=0; i<old_num; i++ ) {
+        for( e=old[i]; e; e=next ) {
+            next = e->next;
+            h = arp_hash( arp, e->ip );
+            e->next = arp->bucket[h];
+            arp->bucket[h] = e;
+        }
+    }
+    free( old );
+}
+
+/** Returns the entry for ip, expired or not, or NULL if there is none. */
+static arp_entry_t* arp_find( arp_t* arp, addr_ip_t ip ) {
+    arp_entry_t* e;
+
+    if( !arp->num_entries )
+        return NULL;
+
+    for( e=arp->bucket[arp_hash(arp, ip)]; e; e=e->next )
+        if( e->ip == ip )
+            return e;
+
+    return NULL;
+}
+
+/** Returns the entry for ip, adding a dynamic one if there is none. */
+static arp_entry_t* arp_get( arp_t* arp, addr_ip_t ip ) {
+    arp_entry_t* e;
+    unsigned h;
+
+    e = arp_find( arp, ip );
+    if( e )
+        return e;
+
+    if( arp->num_entries >= arp->num_buckets )
+        arp_grow( arp );
+
+    e = malloc_or_die( sizeof(*e) );
+    e->ip = ip;
+    memset( &e->mac, 0, sizeof(e->mac) );
+    e->is_static = FALSE;
+    e->expires_ms = 0;
+    e->request_ms = 0;
+    e->num_requests = 0;
+    h = arp_hash( arp, ip );
+    e->next = arp->bucket[h];
+    arp->bucket[h] = e;
+    arp->num_entries += 1;
+    return e;
+}
+
+/**
+ * Removes the learned entries which are unusable and have not been asked for
+ * within ARP_HOLDDOWN_MS.  The table grows unless that freed half of it, so
+ * sweeps stay rare while it fills.
+ */
+static void arp_sweep( arp_t* arp, uint64_t now_ms ) {
+    arp_entry_t** pe;
+    arp_entry_t* e;
+    unsigned i;
+
+    for( i=0; i<arp->num_buckets; i++ ) {
+        for( pe=&arp->bucket[i]; (e = *pe); ) {
+            if( !e->is_static && now_ms >= e->expires_ms
+                && (!e->num_requests || now_ms >= e->request_ms + ARP_HOLDDOWN_MS) ) {
+                *pe = e->next;
+                arp->num_entries -= 1;
+                free( e );
+            }
+            else
+                pe = &e->next;
+        }
+    }
+
+    if( arp->num_entries >= arp->num_buckets / 2 )
+        arp_grow( arp );
+}
+
+void arp_init( arp_t* arp ) {
+    arp->bucket = NULL;
+    arp->num_buckets = arp->num_entries = 0;
+    arp->version = 0;
+}
+
+void arp_destroy( arp_t* arp ) {
+    arp_purge( arp, TRUE, TRUE );
+    free( arp->bucket );
+    arp_init( arp );
+}
+
+const arp_entry_t* arp_lookup( arp_t* arp, addr_ip_t ip, uint64_t now_ms ) {
+    arp_entry_t* e = arp_find( arp, ip );
+
+    if( e && !e->is_static && now_ms >= e->expires_ms )
+        return NULL;
+
+    return e;
+}
+
+void arp_learn( arp_t* arp, addr_ip_t ip, addr_mac_t mac, uint64_t now_ms ) {
+    arp_learn_until( arp, ip, mac, now_ms + ARP_TIMEOUT_MS );
+}
+
+void arp_learn_until( arp_t* arp, addr_ip_t ip, addr_mac_t mac, uint64_t expires_ms ) {
+    arp_entry_t* e = arp_get( arp, ip );
+
+    if( e->is_static )
+        return;
+
+    if( memcmp( &e->mac, &mac, sizeof(mac) ) != 0 || !e->expires_ms )
+        arp->version += 1;
+    e->mac = mac;
+    e->expires_ms = expires_ms;
+    e->num_requests = 0;
+}
+
+bool arp_want_request( arp_t* arp, addr_ip_t ip, uint64_t now_ms ) {
+    arp_entry_t* e = arp_find( arp, ip );
+
+    if( !e ) {
+        if( arp->num_entries >= arp->num_buckets )
+            arp_sweep( arp, now_ms );
+        e = arp_get( arp, ip );
+    }
+    else if( e->is_static || now_ms + ARP_REFRESH_MS < e->expires_ms )
+        return FALSE;
+
+    if( e->num_requests >= ARP_MAX_REQUESTS ) {
+        if( now_ms < e->request_ms + ARP_HOLDDOWN_MS )
+            return FALSE;
+        e->num_requests = 0;
+    }
+    else if( e->num_requests && now_ms < e->request_ms + ARP_RETRY_MS )
+        return FALSE;
+
+    e->request_ms = now_ms;
+    e->num_requests += 1;
+    return TRUE;
+}
+
+bool arp_refresh_due( const arp_entry_t* e, uint64_t now_ms ) {
+    return !e->is_static && now_ms + ARP_REFRESH_MS >= e->expires_ms
+        && (!e->num_requests || now_ms >= e->request_ms + ARP_RETRY_MS);
+}
+
+void arp_add_static( arp_t* arp, addr_ip_t ip, addr_mac_t mac ) {
+    arp_entry_t* e = arp_get( arp, ip );
+
+    e->mac = mac;
+    e->is_static = TRUE;
+    e->num_requests = 0;
+    arp->version += 1;
+}
+
+bool arp_remove( arp_t* arp, addr_ip_t ip ) {
+    arp_entry_t** pe;
+    arp_entry_t* e;
+
+    if( !arp->num_entries )
+        return FALSE;
+
+    for( pe=&arp->bucket[arp_hash(arp, ip)]; *pe; pe=&(*pe)->next ) {
+        if( (*pe)->ip == ip ) {
+            e = *pe;
+            *pe = e->next;
+            arp->num_entries -= 1;
+            arp->version += 1;
+            free( e );
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+unsigned arp_purge( arp_t* arp, bool purge_static, bool purge_dynamic ) {
+    arp_entry_t** pe;
+    arp_entry_t* e;
+    unsigned i, n = 0;
+
+    for( i=0; i<arp->num_buckets; i++ ) {
+        for( pe=&arp->bucket[i]; (e = *pe); ) {
+            if( e->is_static ? purge_static : purge_dynamic ) {
+                *pe = e->next;
+                free( e );
+                n += 1;
+            }
+            else
+                pe = &e->next;
+        }
+    }
+
+    arp->num_entries -= n;
+    if( n )
+        arp->version += 1;
+    return n;
+}
+
+int arp_to_string( arp_t* arp, uint64_t now_ms, char* buf, int len ) {
+    char str_ip[STRLEN_IP], str_mac[STRLEN_MAC], str_ttl[16];
+    arp_entry_t* e;
+    unsigned i, ret, num;
+
+    num = my_snprintf( buf, len, STR_ARP_FORMAT, "IP", "MAC", "Type", "Expires" );
+    if( !num ) return 0;
+
+    for( i=0; i<arp->num_buckets; i++ ) {
+        for( e=arp->bucket[i]; e; e=e->next ) {
+            ip_to_string( str_ip, e->ip );
+            mac_to_string( str_mac, &e->mac );
+            if( e->is_static )
+                snprintf( str_ttl, sizeof(str_ttl), "never" );
+            else if( !e->expires_ms )
+                snprintf( str_ttl, sizeof(str_ttl), "-" );
+            else if( now_ms >= e->expires_ms )
+                snprintf( str_ttl, sizeof(str_ttl), "expired" );
+            else
+                snprintf( str_ttl, sizeof(str_ttl), "in %.1fs",
+                          (e->expires_ms - now_ms) / 1000.0 );
+            ret = my_snprintf( buf+num, len-num, STR_ARP_FORMAT, str_ip, str_mac,
+                               e->is_static ? "static"
+                               : e->expires_ms ? "dynamic" : "pending", str_ttl );
+            if( !ret ) return 0;
+            num += ret;
+        }
+    }
+
+    return num;
+}
@@ -0,0 +1,134 @@
+/*
+ * Filename: sr_arp.h
+ * Purpose: ARP cache mapping next-hop addresses to MAC addresses.
+ *
+ * Every forwarded packet looks up its next hop, so entries are kept in a hash
+ * table keyed by IP.  Static entries are configured and kept until they are
+ * removed; dynamic ones are learned from ARP traffic and are not used once
+ * ARP_TIMEOUT_MS passes without their being refreshed.  A static entry is
+ * never replaced by a learned one.
+ *
+ * The cache also paces the requests sent for a next hop (see
+ * arp_want_request()): a miss creates a pending entry, and while it is
+ * unanswered one request goes out per ARP_RETRY_MS, up to ARP_MAX_REQUESTS,
+ * after which the next hop is left alone for ARP_HOLDDOWN_MS.  A learned entry
+ * which is still being used asks again ARP_REFRESH_MS before it expires, so
+ * busy next hops do not drop traffic every ARP_TIMEOUT_MS.
+ *
+ * Not thread-safe; the router guards it with its arp_lock.
+ */
+
+#ifndef SR_ARP_H
+#define SR_ARP_H
+
+#include "sr_common.h"
+
+/** how long a learned entry is used without being refreshed */
+#define ARP_TIMEOUT_MS (15 * 1000)
+
+/** how long before a learned entry expires that using it asks for it again */
+#define ARP_REFRESH_MS (3 * 1000)
+
+/** how long an unanswered request is waited for before it is sent again */
+#define ARP_RETRY_MS 1000
+
+/** unanswered requests after which a next hop is given up on for a while */
+#define ARP_MAX_REQUESTS 5
+
+/** how long after its last unanswered request a next hop is not asked for */
+#define ARP_HOLDDOWN_MS (20 * 1000)
+
+/** an IP to MAC mapping */
+typedef struct arp_entry_t {
+    addr_ip_t  ip;
+    addr_mac_t mac;
+    bool       is_static;
+    uint64_t   expires_ms;      /* dynamic entries only; 0 until learned */
+    uint64_t   request_ms;      /* when ip was last asked for */
+    unsigned   num_requests;    /* asked for since it was last learned */
+
+    struct arp_entry_t* next;   /* hash chain */
+} arp_entry_t;
+
+/** the ARP cache */
+typedef struct arp_t {
+    arp_entry_t** bucket;
+    unsigned      num_buckets;  /* a power of 2 */
+    unsigned      num_entries;
+    uint32_t      version;      /* bumped when a mapping is added, changed or removed */
+} arp_t;
+
+/** Initializes an empty cache. */
+void arp_init( arp_t* arp );
+
+/** Frees every entry. */
+void arp_destroy( arp_t* arp );
+
+/**
+ * Returns the entry for ip, or NULL if there is none or it is a learned entry
+ * which expired by now_ms.  The entry is valid until the cache is next changed.
+ */
+const arp_entry_t* arp_lookup( arp_t* arp, addr_ip_t ip, uint64_t now_ms );
+
+/**
+ * Learns that ip is at mac as of now_ms, unless ip has a static entry.  An
+ * expired entry is revived.
+ */
+void arp_learn( arp_t* arp, addr_ip_t ip, addr_mac_t mac, uint64_t now_ms );
+
+/**
+ * Learns that ip is at mac until expires_ms, as arp_learn() does, e.g. for an
+ * entry restored from a snapshot with the time it had left.
+ */
+void arp_learn_until( arp_t* arp, addr_ip_t ip, addr_mac_t mac, uint64_t expires_ms );
+
+/**
+ * Decides whether a packet being sent to ip at now_ms should ask for ip's MAC:
+ * when ip has no usable entry or its entry expires within ARP_REFRESH_MS, and
+ * no request is outstanding and ip is not being held down.  The request is
+ * recorded, so the caller must send it if TRUE is returned.  A miss adds a
+ * pending entry for ip, dropping long idle entries before the table grows.
+ */
+bool arp_want_request( arp_t* arp, addr_ip_t ip, uint64_t now_ms );
+
+/**
+ * Returns TRUE if a packet sent to the usable entry e at now_ms would have
+ * arp_want_request() ask for it again.  This only reads e, so it lets the
+ * caller decide under a read lock whether it needs the write lock.
+ */
+bool arp_refresh_due( const arp_entry_t* e, uint64_t now_ms );
+
+/** Maps ip to mac until it is removed, replacing any entry ip had. */
+void arp_add_static( arp_t* arp, addr_ip_t ip, addr_mac_t mac );
+
+/**
+ * Removes the entry for ip.
+ *
+ * @return FALSE if there was none
+ */
+bool arp_remove( arp_t* arp, addr_ip_t ip );
+
+/**
+ * Removes the static entries if purge_static and the dynamic ones if
+ * purge_dynamic.
+ *
+ * @return number of entries removed
+ */
+unsigned arp_purge( arp_t* arp, bool purge_static, bool purge_dynamic );
+
+/** format of an entry's line (60 bytes): IP, MAC, type, time left */
+#define STR_ARP_FORMAT "  %-15s  %-17s  %-7s  %-12s\n"
+
+/** max length of the string made by arp_to_string() */
+#define STR_ARP_MAX_LEN(arp) (60 * ((arp)->num_entries + 1) + 1)
+
+/**
+ * Fills buf with a line per entry.  Learned entries show how long after now_ms
+ * they expire; next hops which have been asked for but not learned show as
+ * pending.  It takes up to STR_ARP_MAX_LEN(arp) characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int arp_to_string( arp_t* arp, uint64_t now_ms, char* buf, int len );
+
+#endif /* SR_ARP_H */
@@ -0,0 +1,177 @@
+/*
+ * Filename: sr_arp_test.c
+ * Purpose: Checks the ARP cache's request pacing and its sweep of idle entries.
+ *
+ * A next hop which never answers must be asked for once per ARP_RETRY_MS, no
+ * more than ARP_MAX_REQUESTS times, and then not again for ARP_HOLDDOWN_MS.  A
+ * learned entry must be asked for again only in the ARP_REFRESH_MS before it
+ * expires, and learning it must end the requests.  Static entries are never
+ * asked for.  Finally a stream of misses to distinct addresses must keep the
+ * table within a small multiple of the entries asked for in ARP_HOLDDOWN_MS
+ * (the table doubles once half of it is live), and the learned and static
+ * entries must survive the sweeps.
+ *
+ * Usage: test_arp [-n misses]
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "sr_arp.h"
+#include "sr_common.h"
+
+#define CHECK( cond, ... ) \
+    do { \
+        if( !(cond) ) { \
+            printf( "  FAILED: " __VA_ARGS__ ); \
+            printf( "\n" ); \
+            failures += 1; \
+        } \
+    } while( 0 )
+
+static const addr_mac_t mac = { { 0x02, 0, 0, 0, 0, 0x01 } };
+
+/** Counts the requests arp_want_request() allows for ip from start to end. */
+static unsigned count_requests( arp_t* arp, addr_ip_t ip,
+                                uint64_t start_ms, uint64_t end_ms ) {
+    unsigned n = 0;
+    uint64_t t;
+
+    for( t=start_ms; t<end_ms; t+=10 )
+        n += arp_want_request( arp, ip, t );
+
+    return n;
+}
+
+/** Checks the requests for a next hop which never answers. */
+static unsigned pacing() {
+    addr_ip_t ip = htonl( 0x0A000001 ), other = htonl( 0x0A000002 );
+    unsigned failures = 0, last;
+    arp_t arp;
+
+    arp_init( &arp );
+
+    CHECK( arp_want_request( &arp, ip, 1000 ), "first miss asks" );
+    CHECK( !arp_want_request( &arp, ip, 1000 + ARP_RETRY_MS - 1 ),
+           "outstanding request is not repeated" );
+    CHECK( arp_want_request( &arp, other, 1000 ), "other next hops are asked for" );
+    CHECK( !arp_lookup( &arp, ip, 1000 ), "pending entry is not used" );
+
+    /* the first request and the ARP_MAX_REQUESTS - 1 retries */
+    last = 1000 + (ARP_MAX_REQUESTS - 1) * ARP_RETRY_MS;
+    CHECK( count_requests( &arp, ip, 1000 + ARP_RETRY_MS, last + ARP_HOLDDOWN_MS - 1 )
+           == ARP_MAX_REQUESTS - 1, "retries are limited" );
+    CHECK( !arp_want_request( &arp, ip, last + ARP_HOLDDOWN_MS - 1 ),
+           "silent next hop is held down" );
+    CHECK( arp_want_request( &arp, ip, last + ARP_HOLDDOWN_MS ),
+           "held down next hop is asked for again" );
+
+    /* an answer ends the requests */
+    arp_learn( &arp, ip, mac, last + ARP_HOLDDOWN_MS + 10 );
+    CHECK( arp_lookup( &arp, ip, last + ARP_HOLDDOWN_MS + 10 ) != NULL,
+           "learned entry is used" );
+    CHECK( !arp_want_request( &arp, ip, last + ARP_HOLDDOWN_MS + 20 ),
+           "learned entry is not asked for" );
+
+    arp_destroy( &arp );
+    printf( "  pacing: %u failures\n", failures );
+    return failures;
+}
+
+/** Checks that an entry in use is asked for again before it expires. */
+static unsigned refresh() {
+    addr_ip_t ip = htonl( 0x0A000001 ), sta = htonl( 0x0A000003 );
+    const arp_entry_t* e;
+    unsigned failures = 0;
+    uint64_t expires_ms = 5000 + ARP_TIMEOUT_MS, learned_ms;
+    arp_t arp;
+
+    arp_init( &arp );
+    arp_learn( &arp, ip, mac, 5000 );
+    arp_add_static( &arp, sta, mac );
+
+    e = arp_lookup( &arp, ip, expires_ms - ARP_REFRESH_MS - 1 );
+    CHECK( e && !arp_refresh_due( e, expires_ms - ARP_REFRESH_MS - 1 ),
+           "fresh entry is not refreshed" );
+    CHECK( count_requests( &arp, ip, 5000, expires_ms - ARP_REFRESH_MS ) == 0,
+           "fresh entry is not asked for" );
+
+    e = arp_lookup( &arp, ip, expires_ms - ARP_REFRESH_MS );
+    CHECK( e && arp_refresh_due( e, expires_ms - ARP_REFRESH_MS ),
+           "entry about to expire is refreshed" );
+    CHECK( arp_want_request( &arp, ip, expires_ms - ARP_REFRESH_MS ),
+           "entry about to expire is asked for" );
+    e = arp_lookup( &arp, ip, expires_ms - ARP_REFRESH_MS + 10 );
+    CHECK( e && !arp_refresh_due( e, expires_ms - ARP_REFRESH_MS + 10 ),
+           "refresh waits for the outstanding request" );
+    CHECK( arp_lookup( &arp, ip, expires_ms - 1 ) != NULL,
+           "entry is used until it expires" );
+
+    /* the reply renews the entry and ends the requests */
+    learned_ms = expires_ms - ARP_REFRESH_MS + 20;
+    arp_learn( &arp, ip, mac, learned_ms );
+    CHECK( count_requests( &arp, ip, learned_ms,
+                           learned_ms + ARP_TIMEOUT_MS - ARP_REFRESH_MS ) == 0,
+           "renewed entry is not asked for" );
+
+    e = arp_lookup( &arp, sta, 1000000 );
+    CHECK( e && !arp_refresh_due( e, 1000000 ), "static entry is not refreshed" );
+    CHECK( !arp_want_request( &arp, sta, 1000000 ), "static entry is not asked for" );
+
+    arp_destroy( &arp );
+    printf( "  refresh: %u failures\n", failures );
+    return failures;
+}
+
+/** Checks that misses to ever new next hops do not grow the table forever. */
+static unsigned sweep( unsigned misses ) {
+    addr_ip_t learned = htonl( 0x0A000001 ), sta = htonl( 0x0A000003 );
+    unsigned failures = 0, i, live, max_entries = 0;
+    uint64_t now_ms = 0;
+    arp_t arp;
+
+    arp_init( &arp );
+    arp_add_static( &arp, sta, mac );
+
+    /* one miss every 10ms, so a next hop is held for ARP_HOLDDOWN_MS / 10 */
+    for( i=0; i<misses; i++ ) {
+        now_ms = 10 * (uint64_t)i;
+        if( i % (ARP_TIMEOUT_MS / 20) == 0 )
+            arp_learn( &arp, learned, mac, now_ms );
+        arp_want_request( &arp, htonl( 0x0B000000 + i ), now_ms );
+        if( arp.num_entries > max_entries )
+            max_entries = arp.num_entries;
+    }
+
+    live = ARP_HOLDDOWN_MS / 10 + 2;
+    printf( "  sweep: %u misses, at most %u entries (%u asked for within the"
+            " hold down), %u buckets\n", misses, max_entries, live, arp.num_buckets );
+    CHECK( max_entries <= 4 * live, "idle entries are swept" );
+    CHECK( arp_lookup( &arp, learned, now_ms ) != NULL, "learned entry survives" );
+    CHECK( arp_lookup( &arp, sta, now_ms ) != NULL, "static entry survives" );
+
+    arp_destroy( &arp );
+    return failures;
+}
+
+int main( int argc, char** argv ) {
+    unsigned misses = 100000, failures = 0;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:" )) != EOF ) {
+        switch( c ) {
+        case 'n': misses = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n misses]\n", argv[0] );
+            return 1;
+        }
+    }
+
+    failures += pacing();
+    failures += refresh();
+    failures += sweep( misses );
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
@@ -13,12 +13,23 @@
  *  - sys_thread_init(..) in sr_lwip_transport_startup(..) MUST be called from
  *    the main thread before other threads have been started.
  *
- *  - lwip requires that only one instance of the IP stack exist, therefore
- *    at the moment we don't support multiple instances of sr.  However
- *    support for this (given a cooperative tcp stack) would be simple,
- *    simple allow sr_init_low_level_subystem(..) to create new sr_instances
- *    each time they are called and return an identifier.  This identifier
- *    must be passed into sr_global_instance(..) to return the correct
+ *  - sr_init_low_level_subystem(..) may be called several times to host
+ *    several virtual routers in one process.  Each call creates a new
+ *    sr_instance with its own router state and network thread; the
+ *    instances are kept in a registry and sr_get_global_instance(..)
+ *    returns the instance the calling thread serves (or the first one for
+ *    threads which serve none, like a CLI session until its "router"
+ *    command picks one with sr_get_instance(..)).  lwip requires that only
+ *    one instance of the IP stack exist, so it is started by the first call
+ *    and shared, along with its buffer pools, by every instance.
+ *
+ *  - since the IP stack is shared, its connections belong to no instance.
+ *    A segment it sends leaves through the instance which owns the
+ *    segment's source address (sr_get_instance_via_ip(..)), and it only
+ *    takes segments to an address from the instance which owns it, so a
+ *    connection stays with the router it was made through as long as the
+ *    routers' interface addresses are distinct.  A connection opened without
+ *    binding it to an address gets its source address from the first
  *    instance.
  *
  *  - lwip needs to keep track of all the threads so we use its
@@ -68,6 +79,15 @@ extern char* optarg;
 
 /** current state of the router */
 router_status_t sr_status;
+
+/** every instance in the process, newest first */
+static struct sr_instance* sr_instances = 0;
+static unsigned sr_num_instances = 0;
+static pthread_mutex_t sr_instances_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** the instance each thread serves */
+static pthread_key_t sr_key_instance;
+static pthread_once_t sr_key_once = PTHREAD_ONCE_INIT;
 router_status_t sr_get_status() { return sr_status; }
 void sr_set_status( router_status_t status ) { sr_status = status; }
 
@@ -126,7 +146,8 @@ static char* gen_logfile( unsigned topo, char* host ) {
  * seperate thread.
  *
  * Caveats :
- *  - this method can only be called once!
+ *  - each call creates a new router instance; the first must be made from
+ *    the main thread before any other threads have been started.
  *
  *---------------------------------------------------------------------------*/
 
@@ -143,29 +164,29 @@ int sr_init_low_level_subystem(int argc, char **argv)
 
     char  *client = 0;
     char  *logfile = 0;
+    char  *snapshot = 0;
     int free_logfile = 0;
 
-    /* -- singleton instance of router, passed to sr_get_global_instance
-          to become globally accessible                                  -- */
-    static struct sr_instance* sr = 0;
+    /* -- instance of router, registered by sr_init_instance(..) -- */
+    struct sr_instance* sr;
 
-    int c;
+    /* -- lwip is shared by every instance, so it is only started once -- */
+    static int lwip_started = 0;
 
-    if ( sr )
-    {
-        fprintf(stderr,  "Warning: because of limitations in lwip, ");
-        fprintf(stderr,  " sr supports 1 router instance per process. \n ");
-        return 1;
-    }
+    int c;
 
     sr = (struct sr_instance*) malloc(sizeof(struct sr_instance));
+    assert( sr && "malloc failed" );
+
+    /* -- each instance parses its own arguments from the start -- */
+    optind = 1;
 
     #ifdef MININET_MODE
         char* router_name = NULL;
         int itable_not_specified = 1;
     #endif /* MININET_MODE */
 
-    while ((c = getopt(argc, argv, "hns:v:p:c:t:r:l:i:z:")) != EOF)
+    while ((c = getopt(argc, argv, "hns:v:p:c:t:r:l:i:z:g:")) != EOF)
     {
         switch (c)
         {
@@ -209,6 +230,9 @@ int sr_init_low_level_subystem(int argc, char **argv)
                 Debug("\nOSPF disabled!\n\n");
                 ospf = 0;
                 break;
+            case 'g':
+                snapshot = optarg;
+                break;
           #ifdef MININET_MODE
             case 'z':
 	      router_name = optarg;
@@ -245,12 +269,14 @@ int sr_init_low_level_subystem(int argc, char **argv)
     Debug("\n\n");
 
     /* -- required by lwip, must be called from the main thread -- */
-    sys_thread_init();
+    if ( ! lwip_started )
+    { sys_thread_init(); }
 
     /* -- zero out sr instance and set default configurations -- */
     debug_println("*****SR_INIT_INSTANCE");
     sr_init_instance(sr);
     sr->interface_subsystem->use_ospf = ospf;
+    sr->interface_subsystem->snapshot_path = snapshot;
 
     strncpy(sr->rtable, rtable, SR_NAMELEN);
 
@@ -288,7 +314,11 @@ int sr_init_low_level_subystem(int argc, char **argv)
         perror("gethostname(..)");
         return 1;
     }
-    sr_lwip_transport_startup();
+    if ( ! lwip_started )
+    {
+        sr_lwip_transport_startup();
+        lwip_started = 1;
+    }
 
 
 #if !defined _CPUMODE_ && !defined MININET_MODE
@@ -307,7 +337,7 @@ int sr_init_low_level_subystem(int argc, char **argv)
     /* -- start low-level network thread -- */
     Debug( "Starting the low-level network thread\n" );
     sr_set_status( STATUS_RUNNING );
-    sys_thread_new(sr_low_level_network_subsystem, NULL);
+    sys_thread_new(sr_low_level_network_subsystem, sr);
 
     return 0;
 }/* -- main -- */
@@ -339,26 +369,112 @@ router_t* sr_get_subsystem(struct sr_instance* sr)
     return sr->interface_subsystem;
 } /* -- sr_get_subsystem -- */
 
+static void sr_key_create(void)
+{
+    pthread_key_create(&sr_key_instance, NULL);
+}
+
 /*-----------------------------------------------------------------------------
  * Method: sr_get_global_instance(..)
  * Scope: Global
  *
  * Provide the world with access to sr_instance(..)
  *
+ * If sr is non-NULL, the calling thread serves sr from now on.  Returns the
+ * instance the calling thread serves, or the first instance created if it
+ * serves none.
+ *
  *---------------------------------------------------------------------------*/
 
 struct sr_instance* sr_get_global_instance(struct sr_instance* sr)
 {
-    static struct sr_instance* sr_global_instance = 0;
+    struct sr_instance* first;
+
+    pthread_once(&sr_key_once, sr_key_create);
 
     if ( sr )
-    { sr_global_instance = sr; }
+    { pthread_setspecific(sr_key_instance, sr); }
+    else
+    { sr = pthread_getspecific(sr_key_instance); }
+
+    if ( ! sr )
+    {
+        pthread_mutex_lock(&sr_instances_lock);
+        for ( first = sr_instances; first && first->next; first = first->next );
+        sr = first;
+        pthread_mutex_unlock(&sr_instances_lock);
+    }
+
+    return sr;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_get_instance(..)
+ * Scope: Global
+ *
+ * Returns the instance of the router named name, or NULL if there is none.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_instance* sr_get_instance(const char* name)
+{
+    struct sr_instance* sr;
+
+    pthread_mutex_lock(&sr_instances_lock);
+    for ( sr = sr_instances; sr; sr = sr->next )
+    {
+#ifdef MININET_MODE
+        if ( strcmp(sr->router_name, name) == 0 )
+#else
+        if ( strcmp(sr->vhost, name) == 0 )
+#endif
+        { break; }
+    }
+    pthread_mutex_unlock(&sr_instances_lock);
+
+    return sr;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_get_instance_via_ip(..)
+ * Scope: Global
+ *
+ * Returns the instance of the router with an interface whose address is ip
+ * (nbo), or NULL if there is none.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_instance* sr_get_instance_via_ip(uint32_t ip)
+{
+    struct sr_instance* sr;
+    router_t* router;
+    unsigned i;
+
+    pthread_mutex_lock(&sr_instances_lock);
+    for ( sr = sr_instances; sr; sr = sr->next )
+    {
+        router = sr->interface_subsystem;
+        if ( ! router )
+        { continue; }
+
+        pthread_mutex_lock(&router->intf_lock);
+        for ( i = 0; i < router->num_interfaces; i++ )
+        {
+            if ( router->interface[i].ip == ip )
+            { break; }
+        }
+        pthread_mutex_unlock(&router->intf_lock);
 
-    return sr_global_instance;
+        if ( i < router->num_interfaces )
+        { break; }
+    }
+    pthread_mutex_unlock(&sr_instances_lock);
+
+    return sr;
 }
 
 static void sr_low_level_network_subsystem(void *arg) {
-    struct sr_instance* sr = sr_get_global_instance(NULL);
+    struct sr_instance* sr = sr_get_global_instance((struct sr_instance*)arg);
 
     debug_pthread_init( "Network", "Low-Level Network Subsystem Thread" );
 
@@ -378,9 +494,12 @@ static void sr_low_level_network_subsystem(void *arg) {
     /* read packets until we can read no more or status changes from RUNNING */
     while( SR_LOW_LEVEL_READ_METHOD==1 && sr_get_status()==STATUS_RUNNING );
 
-    /* cleanup */
+    /* cleanup; the process terminates with its last instance */
     sr_destroy_instance(sr);
-    sr_set_status( STATUS_TERMINATED );
+    pthread_mutex_lock(&sr_instances_lock);
+    if ( sr_num_instances == 0 )
+    { sr_set_status( STATUS_TERMINATED ); }
+    pthread_mutex_unlock(&sr_instances_lock);
 }
 
 /*-----------------------------------------------------------------------------
@@ -436,8 +555,12 @@ void sr_init_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    /* -- set argument as global singleton -- */
-    sr_get_global_instance(sr);
+    /* -- register the instance; its network thread will serve it -- */
+    pthread_mutex_lock(&sr_instances_lock);
+    sr->next = sr_instances;
+    sr_instances = sr;
+    sr_num_instances += 1;
+    pthread_mutex_unlock(&sr_instances_lock);
 
     sr->sockfd   = -1;
     sr->user[0]  = 0;
@@ -460,7 +583,15 @@ void sr_init_instance(struct sr_instance* sr)
  *----------------------------------------------------------------------------*/
 
 static void sr_destroy_instance(struct sr_instance* sr) {
+    struct sr_instance** psr;
+
     assert(sr);
+    pthread_mutex_lock(&sr_instances_lock);
+    for ( psr = &sr_instances; *psr != sr; psr = &(*psr)->next );
+    *psr = sr->next;
+    sr_num_instances -= 1;
+    pthread_mutex_unlock(&sr_instances_lock);
+
     sr_integ_destroy(sr);
     free( sr );
 }
@@ -474,11 +605,12 @@ static void usage(char* argv0)
 {
   #ifdef MININET_MODE
     printf("SR -- user space Simple Routing program\n");
-    printf("Format: %s [-h] -z router_name [-n]\n",argv0);
+    printf("Format: %s [-h] -z router_name [-n] [-g snapshot_file]\n",argv0);
     printf("             [-r rtable_file] [-l log_file] [-i interface_file]\n");
+    printf("             [-- <options of the next router hosted by this process> ...]\n");
   #else  /* NETFPGA or MANUAL modes */
     printf("Simple Router Client\n");
-    printf("Format: %s [-h] [-v host] [-s server] [-p port] [-n] \n",argv0);
+    printf("Format: %s [-h] [-v host] [-s server] [-p port] [-n] [-g snapshot_file]\n",argv0);
     printf("             [-t topo id] [-r rtable_file] [-l log_file] [-i interface_file]\n");
   #endif /* MININET_MODE */
 } /* -- usage -- */
@@ -14,7 +14,8 @@
  *
  * Low level network code should use the functios:
  *
- * sr_get_global_instance(..) - to gain a pointer to the global sr context
+ * sr_get_global_instance(..) - to gain a pointer to the sr context the
+ *                              calling thread serves
  *
  *  and
  *
@@ -94,16 +95,19 @@ struct sr_instance
   char* router_name;   /* router name, needed for interface initialisation */
   #endif /* MININET_MODE */
 
+  struct sr_instance* next; /* next instance in the process */
 };
 
 /* ----------------------------------------------------------------------------
  * See method definitions in sr_base.c for detailed explanation of the
- * following two methods.
+ * following methods.
  * -------------------------------------------------------------------------*/
 
 router_t* sr_get_subsystem(struct sr_instance* sr);
 void  sr_set_subsystem(struct sr_instance* sr, router_t* core);
 struct sr_instance* sr_get_global_instance(struct sr_instance* sr);
+struct sr_instance* sr_get_instance(const char* name);
+struct sr_instance* sr_get_instance_via_ip(uint32_t ip /* nbo */);
 
 
 /* ----------------------------------------------------------------------------
@@ -130,12 +134,15 @@ int sr_integ_output(struct sr_instance* sr /* borrowed */,
                     const char* iface /* borrowed */);
 
 uint32_t sr_findsrcip(uint32_t dest /* nbo */);
-uint32_t sr_integ_ip_output(uint8_t* payload /* given */,
+struct pbuf;
+uint32_t sr_integ_ip_output(struct pbuf* p /* given */,
                             uint8_t  proto,
                             uint32_t src, /* nbo */
-                            uint32_t dest, /* nbo */
-                            int len);
+                            uint32_t dest /* nbo */);
+void sr_transport_input(struct sr_instance* sr /* borrowed */,
+                        uint8_t* buf /* given */, uint8_t* packet /* in buf */);
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
+uint16_t sr_integ_findmtu(uint32_t dest /* nbo */);
 
 
 #endif  /* -- SR_BASE_INTERNAL_H -- */
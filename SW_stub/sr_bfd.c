@@ -0,0 +1,305 @@
+/* Filename: sr_bfd.c */
+
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sr_bfd.h"
+
+/** sessions the table starts with once it has one */
+#define BFD_INITIAL_SESSIONS 8
+
+/** discriminators keep the slot of their session in their low bits */
+#define BFD_SLOT_BITS 16
+#define BFD_SLOT_MASK ((1 << BFD_SLOT_BITS) - 1)
+
+/** control packet flags */
+#define BFD_FLAG_AUTH       0x04
+#define BFD_FLAG_MULTIPOINT 0x01
+
+#define bfd_of_tx(t)     ((bfd_session_t*)((byte*)(t) - offsetof(bfd_session_t, tx)))
+#define bfd_of_detect(t) ((bfd_session_t*)((byte*)(t) - offsetof(bfd_session_t, detect)))
+
+static unsigned bfd_max( unsigned a, unsigned b ) {
+    return a > b ? a : b;
+}
+
+/** Returns the next number of the transmit jitter (xorshift32). */
+static uint32_t bfd_rand( bfd_t* b ) {
+    b->rand ^= b->rand << 13;
+    b->rand ^= b->rand >> 17;
+    b->rand ^= b->rand << 5;
+    return b->rand;
+}
+
+/** Returns the interval after which s should send its next packet. */
+static unsigned bfd_tx_interval( bfd_t* b, bfd_session_t* s ) {
+    unsigned ms;
+
+    if( s->state == BFD_DOWN )
+        ms = BFD_SLOW_TX_MS;
+    else
+        ms = bfd_max( b->tx_ms, s->remote_min_rx_ms );
+
+    /* 0 to 25% early so that the neighbors do not fall into step, and at least
+       10% early with a multiplier of 1 so that a packet is never late */
+    if( b->detect_mult == 1 )
+        return ms - ms / 10 - bfd_rand( b ) % (ms * 15 / 100 + 1);
+    return ms - bfd_rand( b ) % (ms / 4 + 1);
+}
+
+/** Returns the time without a packet from its neighbor which takes s Down. */
+static unsigned bfd_detect_time( bfd_t* b, bfd_session_t* s ) {
+    return s->remote_mult * bfd_max( b->tx_ms, s->remote_min_tx_ms );
+}
+
+/** Sends s's control packet and schedules the next. */
+static void bfd_send( bfd_t* b, bfd_session_t* s, uint64_t now_ms ) {
+    bfd_pkt_t pkt;
+
+    pkt.vers_diag = (BFD_VERSION << 5) | s->diag;
+    pkt.state_flags = s->state << 6;
+    pkt.detect_mult = b->detect_mult;
+    pkt.len = sizeof(pkt);
+    pkt.my_disc = htonl( s->local_disc );
+    pkt.your_disc = htonl( s->remote_disc );
+    pkt.min_tx_us = htonl( b->tx_ms * 1000 );
+    pkt.min_rx_us = htonl( b->tx_ms * 1000 );
+    pkt.min_echo_rx_us = 0;
+
+    s->pkts_out += 1;
+    b->pkts_out += 1;
+    b->send( b->cb_arg, s->iface, s->ip, (byte*)&pkt, sizeof(pkt) );
+    tw_schedule( &b->tx_wheel, &s->tx, now_ms + bfd_tx_interval( b, s ) );
+}
+
+/**
+ * Moves s to state, sending a packet which says so, and queues a report if it
+ * went Up or Down from Up.
+ *
+ * @return TRUE if a report was queued
+ */
+static bool bfd_set_state( bfd_t* b, bfd_session_t* s, bfd_state_t state,
+                           bfd_diag_t diag, uint64_t now_ms ) {
+    bool report = (state == BFD_UP || s->state == BFD_UP);
+
+    s->state = state;
+    if( state == BFD_DOWN ) {
+        s->diag = diag;
+        tw_cancel( &b->detect_wheel, &s->detect );
+    }
+    else if( state == BFD_UP ) {
+        s->diag = BFD_DIAG_NONE;
+        s->up_ms = now_ms;
+    }
+    bfd_send( b, s, now_ms );
+
+    if( !report || s->notify )
+        return report;
+    s->notify = TRUE;
+    s->next_notify = b->notify;
+    b->notify = s;
+    return TRUE;
+}
+
+/** Called by the transmit wheel when s is due to send. */
+static void bfd_tx_expired( void* arg, tw_timer_t* t, uint64_t now_ms ) {
+    bfd_send( (bfd_t*)arg, bfd_of_tx( t ), now_ms );
+}
+
+/** Called by the detection wheel when s has heard nothing for too long. */
+static void bfd_detect_expired( void* arg, tw_timer_t* t, uint64_t now_ms ) {
+    bfd_session_t* s = bfd_of_detect( t );
+
+    /* whatever the neighbor says next is from a new session */
+    s->remote_disc = 0;
+    bfd_set_state( (bfd_t*)arg, s, BFD_DOWN, BFD_DIAG_TIME_EXPIRED, now_ms );
+}
+
+void bfd_init( bfd_t* b, unsigned tx_ms, unsigned detect_mult, uint32_t seed,
+               bfd_send_cb send, bfd_state_cb changed, void* cb_arg,
+               uint64_t now_ms ) {
+    tw_init( &b->tx_wheel, BFD_TICK_MS, now_ms );
+    tw_init( &b->detect_wheel, BFD_TICK_MS, now_ms );
+    b->session = NULL;
+    b->max_sessions = b->num_sessions = 0;
+    b->generation = 1;
+    b->notify = NULL;
+    b->tx_ms = tx_ms ? tx_ms : BFD_TX_MS;
+    b->detect_mult = detect_mult ? detect_mult : BFD_DETECT_MULT;
+    b->rand = seed ? seed : 1;
+    b->send = send;
+    b->changed = changed;
+    b->cb_arg = cb_arg;
+    b->pkts_in = b->pkts_out = b->bad_pkts = 0;
+}
+
+void bfd_destroy( bfd_t* b ) {
+    unsigned i;
+
+    for( i=0; i<b->max_sessions; i++ )
+        if( b->session[i] )
+            bfd_remove_session( b, b->session[i] );
+    free( b->session );
+    b->session = NULL;
+    b->max_sessions = 0;
+}
+
+bfd_session_t* bfd_add_session( bfd_t* b, unsigned iface, uint32_t nbr_id,
+                                addr_ip_t ip, uint64_t now_ms ) {
+    bfd_session_t* s;
+    unsigned slot;
+
+    if( b->num_sessions == b->max_sessions ) {
+        true_or_die( b->max_sessions <= BFD_SLOT_MASK, "Error: too many BFD sessions" );
+        b->max_sessions = b->max_sessions ? 2 * b->max_sessions : BFD_INITIAL_SESSIONS;
+        b->session = realloc_or_die( b->session, b->max_sessions * sizeof(*b->session) );
+        memset( b->session + b->num_sessions, 0,
+                (b->max_sessions - b->num_sessions) * sizeof(*b->session) );
+    }
+    for( slot=0; b->session[slot]; slot++ )
+        ;
+
+    /* a new generation for each session, so packets for a session which has
+       gone do not match the one which reuses its slot */
+    if( !(b->generation & ((1 << (32 - BFD_SLOT_BITS)) - 1)) )
+        b->generation += 1;
+    s = calloc_or_die( 1, sizeof(*s) );
+    s->local_disc = (b->generation++ << BFD_SLOT_BITS) | slot;
+    s->nbr_id = nbr_id;
+    s->ip = ip;
+    s->iface = iface;
+    s->state = BFD_DOWN;
+    s->remote_state = BFD_DOWN;
+    s->diag = BFD_DIAG_NONE;
+    tw_timer_init( &s->tx );
+    tw_timer_init( &s->detect );
+    b->session[slot] = s;
+    b->num_sessions += 1;
+
+    bfd_send( b, s, now_ms );
+    return s;
+}
+
+bfd_session_t* bfd_find( bfd_t* b, unsigned iface, uint32_t nbr_id ) {
+    unsigned i;
+
+    for( i=0; i<b->max_sessions; i++ )
+        if( b->session[i] && b->session[i]->iface == iface
+            && b->session[i]->nbr_id == nbr_id )
+            return b->session[i];
+
+    return NULL;
+}
+
+void bfd_remove_session( bfd_t* b, bfd_session_t* s ) {
+    bfd_session_t** p;
+
+    if( s->notify )
+        for( p=&b->notify; *p; p=&(*p)->next_notify )
+            if( *p == s ) {
+                *p = s->next_notify;
+                break;
+            }
+
+    tw_cancel( &b->tx_wheel, &s->tx );
+    tw_cancel( &b->detect_wheel, &s->detect );
+    b->session[s->local_disc & BFD_SLOT_MASK] = NULL;
+    b->num_sessions -= 1;
+    free( s );
+}
+
+/** Returns the session a packet which has no discriminator for us came to. */
+static bfd_session_t* bfd_find_by_ip( bfd_t* b, unsigned iface, addr_ip_t ip ) {
+    unsigned i;
+
+    for( i=0; i<b->max_sessions; i++ )
+        if( b->session[i] && b->session[i]->iface == iface && b->session[i]->ip == ip )
+            return b->session[i];
+
+    return NULL;
+}
+
+bool bfd_input( bfd_t* b, unsigned iface, addr_ip_t src, const byte* pkt,
+                unsigned len, uint64_t now_ms ) {
+    const bfd_pkt_t* p = (const bfd_pkt_t*)pkt;
+    bfd_state_t remote_state;
+    bfd_session_t* s = NULL;
+    uint32_t your_disc;
+    unsigned slot;
+    bool report = FALSE;
+
+    /* the checks of RFC 5880 6.8.6 which apply without authentication */
+    if( len < sizeof(*p) || p->len < sizeof(*p) || p->len > len
+        || (p->vers_diag >> 5) != BFD_VERSION || !p->detect_mult
+        || (p->state_flags & (BFD_FLAG_AUTH | BFD_FLAG_MULTIPOINT)) || !p->my_disc ) {
+        b->bad_pkts += 1;
+        return FALSE;
+    }
+
+    remote_state = p->state_flags >> 6;
+    your_disc = ntohl( p->your_disc );
+    if( your_disc ) {
+        slot = your_disc & BFD_SLOT_MASK;
+        if( slot < b->max_sessions && (s = b->session[slot])
+            && (s->local_disc != your_disc || s->iface != iface) )
+            s = NULL;
+    }
+    else if( remote_state == BFD_DOWN || remote_state == BFD_ADMIN_DOWN )
+        s = bfd_find_by_ip( b, iface, src );
+    if( !s ) {
+        b->bad_pkts += 1;
+        return FALSE;
+    }
+
+    s->pkts_in += 1;
+    b->pkts_in += 1;
+    s->remote_disc = ntohl( p->my_disc );
+    s->remote_state = remote_state;
+    s->remote_mult = p->detect_mult;
+    s->remote_min_tx_ms = (ntohl( p->min_tx_us ) + 999) / 1000;
+    s->remote_min_rx_ms = (ntohl( p->min_rx_us ) + 999) / 1000;
+
+    if( remote_state == BFD_ADMIN_DOWN ) {
+        if( s->state != BFD_DOWN )
+            report = bfd_set_state( b, s, BFD_DOWN, BFD_DIAG_NBR_DOWN, now_ms );
+    }
+    else if( s->state == BFD_DOWN ) {
+        if( remote_state == BFD_DOWN )
+            report = bfd_set_state( b, s, BFD_INIT, BFD_DIAG_NONE, now_ms );
+        else if( remote_state == BFD_INIT )
+            report = bfd_set_state( b, s, BFD_UP, BFD_DIAG_NONE, now_ms );
+    }
+    else if( s->state == BFD_INIT ) {
+        if( remote_state == BFD_INIT || remote_state == BFD_UP )
+            report = bfd_set_state( b, s, BFD_UP, BFD_DIAG_NONE, now_ms );
+    }
+    else if( remote_state == BFD_DOWN )
+        report = bfd_set_state( b, s, BFD_DOWN, BFD_DIAG_NBR_DOWN, now_ms );
+
+    if( s->state == BFD_INIT || s->state == BFD_UP )
+        tw_schedule( &b->detect_wheel, &s->detect, now_ms + bfd_detect_time( b, s ) );
+
+    return report;
+}
+
+int64_t bfd_timer( bfd_t* b, uint64_t now_ms ) {
+    int64_t tx, detect;
+    bfd_session_t* s;
+
+    tw_advance( &b->detect_wheel, now_ms, bfd_detect_expired, b );
+    tw_advance( &b->tx_wheel, now_ms, bfd_tx_expired, b );
+
+    /* the owner may remove sessions, this one or those still on the list */
+    while( (s = b->notify) ) {
+        b->notify = s->next_notify;
+        s->notify = FALSE;
+        b->changed( b->cb_arg, s, now_ms );
+    }
+
+    tx = tw_timeout( &b->tx_wheel, now_ms );
+    detect = tw_timeout( &b->detect_wheel, now_ms );
+    if( tx < 0 || (detect >= 0 && detect < tx) )
+        return detect;
+    return tx;
+}
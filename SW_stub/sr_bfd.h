@@ -0,0 +1,180 @@
+/*
+ * Filename: sr_bfd.h
+ * Purpose: Fast liveness detection between neighboring routers, after BFD.
+ *
+ * PWOSPF only notices that a neighbor has gone when its hellos stop for the
+ * dead interval, which is measured in tens of seconds; until then routes
+ * through it blackhole traffic.  Here each neighbor has a session of small
+ * control packets, exchanged every few milliseconds in both directions, in the
+ * format and with the three-way handshake and state machine of Bidirectional
+ * Forwarding Detection (RFC 5880, single hop as in RFC 5881).  When no packet
+ * is heard from an Up session's neighbor within its detection time (its
+ * detect multiplier times the slower of the two ends' intervals), or it says
+ * the session is Down, the session goes Down and its owner tears the
+ * adjacency down.  Demand mode, echo, authentication and the poll sequence
+ * are not implemented: the intervals of a session never change once it is Up.
+ *
+ * Received packets are matched to their session through its discriminator in
+ * O(1), so they can be handled as they arrive.  Transmit and detection timers
+ * are on timer wheels.  A session sends slowly while Down, and at once
+ * whenever its state changes, so the handshake takes three packet latencies.
+ * State changes are not reported from bfd_input() but queued for the next
+ * bfd_timer(), so the receive path never calls back into its owner.
+ *
+ * All times are explicit, in milliseconds, so a simulation can drive sessions
+ * with virtual time.  Not thread-safe; the router serializes access with its
+ * bfd_lock.
+ */
+
+#ifndef SR_BFD_H
+#define SR_BFD_H
+
+#include "sr_common.h"
+#include "sr_timer_wheel.h"
+
+/** UDP destination port of single hop control packets */
+#define BFD_PORT 3784
+
+#define BFD_VERSION 1
+
+/** defaults: sessions which detect a failure in 30ms */
+#define BFD_TX_MS          10
+#define BFD_DETECT_MULT    3
+
+/** transmit interval of a session which is Down */
+#define BFD_SLOW_TX_MS     1000
+
+/** granularity of the timers */
+#define BFD_TICK_MS        1
+
+/** session states, as sent in control packets */
+typedef enum bfd_state_t {
+    BFD_ADMIN_DOWN = 0,
+    BFD_DOWN       = 1,
+    BFD_INIT       = 2,
+    BFD_UP         = 3
+} bfd_state_t;
+
+/** why a session last went Down */
+typedef enum bfd_diag_t {
+    BFD_DIAG_NONE          = 0,
+    BFD_DIAG_TIME_EXPIRED  = 1,     /* control detection time expired */
+    BFD_DIAG_NBR_DOWN      = 3      /* neighbor signaled session down */
+} bfd_diag_t;
+
+/** control packet (all fields in network byte order) */
+typedef struct bfd_pkt_t {
+    byte     vers_diag;         /* version << 5 | diagnostic */
+    byte     state_flags;       /* state << 6 | P F C A D M */
+    byte     detect_mult;
+    byte     len;               /* of the packet */
+    uint32_t my_disc;
+    uint32_t your_disc;         /* 0 until the neighbor's is known */
+    uint32_t min_tx_us;         /* desired min TX interval */
+    uint32_t min_rx_us;         /* required min RX interval */
+    uint32_t min_echo_rx_us;    /* 0: no echo */
+} __attribute__ ((packed)) bfd_pkt_t;
+
+/** a session with one neighbor */
+typedef struct bfd_session_t {
+    uint32_t    local_disc;     /* host byte order, like remote_disc */
+    uint32_t    remote_disc;    /* 0 until a packet is heard */
+    uint32_t    nbr_id;         /* router ID of the neighbor */
+    addr_ip_t   ip;             /* its address on the link */
+    unsigned    iface;
+    bfd_state_t state;
+    bfd_state_t remote_state;
+    bfd_diag_t  diag;
+    unsigned    remote_mult;
+    unsigned    remote_min_tx_ms;
+    unsigned    remote_min_rx_ms;
+    tw_timer_t  tx;             /* next control packet */
+    tw_timer_t  detect;         /* scheduled while Init or Up */
+    bool        notify;         /* a state change is waiting to be reported */
+    struct bfd_session_t* next_notify;
+
+    /* statistics */
+    uint64_t    pkts_in, pkts_out;
+    uint64_t    up_ms;          /* when it last went Up */
+} bfd_session_t;
+
+/** sends the control packet pkt to ip through interface iface */
+typedef void (*bfd_send_cb)( void* arg, unsigned iface, addr_ip_t ip,
+                             const byte* pkt, unsigned len );
+
+/**
+ * reports that s went Up or Down at now_ms; it may remove any session,
+ * including s
+ */
+typedef void (*bfd_state_cb)( void* arg, bfd_session_t* s, uint64_t now_ms );
+
+/** the sessions of a router */
+typedef struct bfd_t {
+    timer_wheel_t   tx_wheel;
+    timer_wheel_t   detect_wheel;
+    bfd_session_t** session;    /* indexed by discriminator & 0xFFFF */
+    unsigned        max_sessions, num_sessions;
+    uint32_t        generation; /* high bits of the next discriminator */
+    bfd_session_t*  notify;     /* sessions whose change is to be reported */
+
+    unsigned        tx_ms;      /* desired min TX and required min RX interval */
+    unsigned        detect_mult;
+    uint32_t        rand;       /* state of the transmit jitter */
+
+    bfd_send_cb     send;
+    bfd_state_cb    changed;
+    void*           cb_arg;
+
+    /* statistics */
+    uint64_t        pkts_in, pkts_out;
+    uint64_t        bad_pkts;   /* dropped as invalid or for no session */
+} bfd_t;
+
+/**
+ * Initializes b with no sessions at now_ms.  Sessions ask for control packets
+ * every tx_ms and are declared Down after detect_mult are missed (zero selects
+ * BFD_TX_MS or BFD_DETECT_MULT).  seed seeds the transmit jitter.
+ */
+void bfd_init( bfd_t* b, unsigned tx_ms, unsigned detect_mult, uint32_t seed,
+               bfd_send_cb send, bfd_state_cb changed, void* cb_arg,
+               uint64_t now_ms );
+
+/** Frees every session. */
+void bfd_destroy( bfd_t* b );
+
+/**
+ * Starts a session, Down, with neighbor nbr_id at ip on interface iface, and
+ * sends its first control packet at once.
+ */
+bfd_session_t* bfd_add_session( bfd_t* b, unsigned iface, uint32_t nbr_id,
+                                addr_ip_t ip, uint64_t now_ms );
+
+/**
+ * Returns the session with neighbor nbr_id on interface iface, or NULL.  Takes
+ * time linear in the number of sessions.
+ */
+bfd_session_t* bfd_find( bfd_t* b, unsigned iface, uint32_t nbr_id );
+
+/** Ends session s without telling the neighbor (it finds out in time). */
+void bfd_remove_session( bfd_t* b, bfd_session_t* s );
+
+/**
+ * Handles the control packet pkt (the UDP payload, len bytes) received from
+ * src on interface iface at now_ms.  If the session's state changes, a packet
+ * saying so is sent straight away.
+ *
+ * @return TRUE if the session went Up or Down, which bfd_timer() will report
+ */
+bool bfd_input( bfd_t* b, unsigned iface, addr_ip_t src, const byte* pkt,
+                unsigned len, uint64_t now_ms );
+
+/**
+ * Sends the control packets which are due, takes Down the sessions whose
+ * detection time expired, and reports each session which went Up or Down since
+ * the last call (in the state it is in now).
+ *
+ * @return ms until there is more to do, or -1 if there are no sessions
+ */
+int64_t bfd_timer( bfd_t* b, uint64_t now_ms );
+
+#endif /* SR_BFD_H */
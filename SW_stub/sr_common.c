@@ -80,6 +80,14 @@ addr_mac_t make_mac_addr(byte byte5, byte byte4, byte byte3, byte byte2, byte by
 
 }
 
+uint32_t hash32( uint32_t x ) {
+    x ^= x >> 16;
+    x *= 0x85ebca6b;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35;
+    return x ^ (x >> 16);
+}
+
 #ifdef _CPUMODE_
 inline uint16_t mac_hi( addr_mac_t* mac ) {
   return (mac->octet[0]<<8) + mac->octet[1];
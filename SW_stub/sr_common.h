@@ -19,6 +19,18 @@
 /** length in bytes of an Ethernet (MAC) address */
 #define ETH_ADDR_LEN 6
 
+/** length in bytes of an Ethernet header (no VLAN tag) */
+#define ETH_HDR_LEN 14
+
+/** length in bytes of an IPv4 header without options */
+#define IP_HDR_LEN 20
+
+/** max length in bytes of a frame from the hardware (VLAN tagged, no FCS) */
+#define ETH_MAX_LEN 1518
+
+/** largest IP packet an Ethernet frame carries */
+#define ETH_MTU 1500
+
 /* 4 octets of 3 chars each, 3 periods, 1 nul => 16 chars */
 #define STRLEN_IP  16
 
@@ -105,6 +117,14 @@ addr_ip_t make_ip_addr( const char* str );
 /** Uses the specified bytes to create a MAC address */
 addr_mac_t make_mac_addr(byte byte5, byte byte4, byte byte3, byte byte2, byte byte1, byte byte0);
 
+/**
+ * Mixes every bit of x into the low bits (the MurmurHash3 finalizer).  Tables
+ * keyed by addresses or router IDs use it to pick a bucket: those are in
+ * network byte order, so their low bits alone would be the first octet, which
+ * most keys share.
+ */
+uint32_t hash32( uint32_t x );
+
 #ifdef _CPUMODE_
 /** Returns the upper 16 bits of the MAC address */
 inline uint16_t mac_hi( addr_mac_t* mac );
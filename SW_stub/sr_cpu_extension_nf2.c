@@ -1,6 +1,7 @@
 /* Filename: sr_cpu_extension_nf.c */
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <linux/if_ether.h>
 #include <linux/if_packet.h>
 #include <net/if.h>
@@ -13,8 +14,7 @@
 #include "sr_common.h"
 #include "sr_cpu_extension_nf2.h"
 #include "sr_dumper.h"
-
-#define DECAP_NEXT_INTF 1 /* nf2c1 because it has the rate limiter */
+#include "sr_router.h"
 
 #ifdef _CPUMODE_
 int sr_cpu_init_intf_socket( int interface_index ) {
@@ -55,26 +55,30 @@ int sr_cpu_init_intf_socket( int interface_index ) {
 
     return s;
 }
-static uint64_t count=0;
 int sr_cpu_input( struct sr_instance* sr ) {
-    byte buf[ETH_MAX_LEN];
+    byte* buf;
     ssize_t len;
     router_t* router;
     interface_t* intf;
     fd_set rdset, errset;
     int ret, max_fd;
-    unsigned i;
+    unsigned i, n;
+    bool decapped;
     struct timeval timeout;
 
+    router = sr->interface_subsystem;
+
     /* loop until something interesting happens */
     do {
+        /* don't sit on decapsulated frames while waiting for more input */
+        decap_flush( &router->decap );
+
         /* clear the sets */
         FD_ZERO( &rdset );
         FD_ZERO( &errset );
 
         /* set the bits on interfaces' fd's that we care about */
         max_fd = -1;
-        router = sr->interface_subsystem;
         for( i=0; i<router->num_interfaces; i++ ) {
             if( router->interface[i].enabled ) {
                 FD_SET( router->interface[i].hw_fd, &rdset );
@@ -100,41 +104,42 @@ int sr_cpu_input( struct sr_instance* sr ) {
         for( i=0; i<router->num_interfaces; i++ ) {
             intf = &router->interface[i];
             if( intf->enabled ) {
-                /* check for available bytes in the input buffer */
-                if( FD_ISSET( intf->hw_fd, &rdset ) ) {
-                    len = real_read_once( intf->hw_fd, buf, ETH_MAX_LEN );
-                    if( len == 0 )
+                /* drain the input buffer (a batch at most, so one busy port
+                   can't starve the others): tunnelled frames are handled
+                   here, anything else goes to the router */
+                for( n=0; n<DECAP_MAX_BATCH && FD_ISSET( intf->hw_fd, &rdset ); n++ ) {
+                    buf = decap_rx_buffer( &router->decap );
+                    len = recv( intf->hw_fd, buf, ETH_MAX_LEN, MSG_DONTWAIT );
+                    if( len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+                        break;
+                    else if( len < 0 && errno == EINTR )
+                        continue;
+                    else if( len == 0 ) {
                         debug_println( "Warning: HW socket closed to %s",
                                        intf->name );
-                    else if( len < 0 )
+                        break;
+                    }
+                    else if( len < 0 ) {
                         debug_println( "Warning: error when reading on HW socket to %s",
                                        intf->name );
-                    else {
-                        /* check packet for decap first */
-                        if( len >= 34 ) {
-                            if( buf[23] == 0x04 || buf[23] == 0xF4 ) {
-                                debug_println( "*** DECAPSULATING PACKET ***" );
-
-                                /* write a new Ethernet header */
-                                byte* new_buf = buf + 20;
-                                memset( new_buf, 0xFF, ETH_ADDR_LEN );
-                                memcpy( new_buf+6, &router->interface[DECAP_NEXT_INTF].mac, ETH_ADDR_LEN );
-                                *((uint16_t*)(new_buf+12)) = htons( ETHERTYPE_IP );
-
-                                /* send it back out nf2c{DECAP_NEXT_INTF} */
-                                sr_cpu_output( new_buf, len-20, &router->interface[DECAP_NEXT_INTF] );
-count+=len;fprintf(stderr,"%llu\n",count-20);
-                                continue;
-                            }
-                        }
-                        /* send the packet to our processing pipeline */
-                        sr_integ_input( sr, buf, len, intf );
-
-                        /* log the received packet */
-                        sr_log_packet( sr, buf, len );
-
-                        return 1;
+                        break;
                     }
+
+                    pthread_rwlock_rdlock( &router->decap_lock );
+                    decapped = decap_input( &router->decap, i, len );
+                    pthread_rwlock_unlock( &router->decap_lock );
+                    if( decapped )
+                        continue;
+
+                    decap_flush( &router->decap );
+
+                    /* send the packet to our processing pipeline */
+                    sr_integ_input( sr, buf, len, intf );
+
+                    /* log the received packet */
+                    sr_log_packet( sr, buf, len );
+
+                    return 1;
                 }
 
                 /* check for an error on the socket */
@@ -0,0 +1,200 @@
+/* Filename: sr_decap.c */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "sr_decap.h"
+
+#if defined MININET_MODE || defined _CPUMODE_
+
+/** length of the outer headers the hardware strips (Ethernet + option-less IP) */
+#define DECAP_OUTER_LEN (ETHER_HDR_LEN + 20)
+
+void decap_init( decap_t* decap, unsigned batch_size ) {
+    memset( decap, 0, sizeof(*decap) );
+
+    if( batch_size < 1 )
+        batch_size = 1;
+    else if( batch_size > DECAP_MAX_BATCH )
+        batch_size = DECAP_MAX_BATCH;
+    decap->batch_size = batch_size;
+}
+
+int decap_add_tunnel( decap_t* decap, byte proto, addr_ip_t remote,
+                      uint32_t in_ports, decap_inner_t inner,
+                      interface_t* out_intf ) {
+    decap_tunnel_t* t;
+
+    if( decap->num_tunnels == DECAP_MAX_TUNNELS )
+        return -1;
+
+    t = &decap->tunnel[decap->num_tunnels];
+    memset( t, 0, sizeof(*t) );
+    t->proto = proto;
+    t->remote = remote;
+    t->in_ports = in_ports;
+    t->inner = inner;
+    t->out_intf = out_intf;
+
+    return decap->num_tunnels++;
+}
+
+int decap_remove_tunnel( decap_t* decap, byte proto, addr_ip_t remote ) {
+    unsigned i;
+
+    for( i=0; i<decap->num_tunnels; i++ )
+        if( decap->tunnel[i].proto == proto && decap->tunnel[i].remote == remote )
+            break;
+    if( i == decap->num_tunnels )
+        return -1;
+
+    /* keep the table in order: the first matching tunnel wins */
+    memmove( &decap->tunnel[i], &decap->tunnel[i+1],
+             (decap->num_tunnels - i - 1) * sizeof(decap->tunnel[0]) );
+    decap->num_tunnels -= 1;
+    return 0;
+}
+
+byte* decap_rx_buffer( decap_t* decap ) {
+    return decap->slot[decap->num_pending].buf;
+}
+
+bool decap_input( decap_t* decap, unsigned in_port, unsigned len ) {
+    decap_slot_t* s = &decap->slot[decap->num_pending];
+    struct ether_header* eth = (struct ether_header*)s->buf;
+    struct ip* ip = (struct ip*)(s->buf + ETHER_HDR_LEN);
+    decap_tunnel_t* t;
+    unsigned i;
+
+    /* like the hardware, only option-less outer IPv4 headers are stripped */
+    if( len < DECAP_OUTER_LEN
+        || eth->ether_type != htons( ETHERTYPE_IP )
+        || ip->ip_v != 4 || ip->ip_hl != 5 )
+        return FALSE;
+
+    for( i=0; i<decap->num_tunnels; i++ ) {
+        t = &decap->tunnel[i];
+        if( t->proto == ip->ip_p
+            && (t->in_ports & (1U << in_port))
+            && (t->remote == 0 || t->remote == ip->ip_src.s_addr) )
+            break;
+    }
+    if( i == decap->num_tunnels )
+        return FALSE;
+
+    if( t->inner == DECAP_INNER_ETH ) {
+        if( len < DECAP_OUTER_LEN + ETHER_HDR_LEN )
+            return FALSE;
+        s->off = DECAP_OUTER_LEN;
+    }
+    else {
+        /* build the new Ethernet header over the end of the outer IP header */
+        s->off = DECAP_OUTER_LEN - ETHER_HDR_LEN;
+        eth = (struct ether_header*)(s->buf + s->off);
+        memset( eth->ether_dhost, 0xFF, ETH_ADDR_LEN );
+        memcpy( eth->ether_shost, &t->out_intf->mac, ETH_ADDR_LEN );
+        eth->ether_type = htons( ETHERTYPE_IP );
+    }
+    s->len = len - s->off;
+    s->intf = t->out_intf;
+
+    t->packets += 1;
+    t->bytes += s->len;
+
+    decap->num_pending += 1;
+    if( decap->num_pending == decap->batch_size )
+        decap_flush( decap );
+
+    return TRUE;
+}
+
+/** Sends the n frames in slot which are all bound for the same interface. */
+static void decap_send_run( decap_t* decap, decap_slot_t* slot, unsigned n ) {
+    struct mmsghdr msg[DECAP_MAX_BATCH];
+    struct iovec iov[DECAP_MAX_BATCH];
+    interface_t* intf = slot[0].intf;
+    unsigned i, sent;
+    int ret;
+
+    memset( msg, 0, n * sizeof(*msg) );
+    for( i=0; i<n; i++ ) {
+        iov[i].iov_base = slot[i].buf + slot[i].off;
+        iov[i].iov_len = slot[i].len;
+        msg[i].msg_hdr.msg_iov = &iov[i];
+        msg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    pthread_mutex_lock( &intf->hw_lock );
+    sent = 0;
+    while( sent < n ) {
+        ret = sendmmsg( intf->hw_fd, msg + sent, n - sent, 0 );
+        if( ret < 0 ) {
+            if( errno == EINTR )
+                continue;
+
+            /* skip the frame which could not be sent */
+            decap->tx_errors += 1;
+            sent += 1;
+            continue;
+        }
+        decap->tx_batches += 1;
+        decap->tx_packets += ret;
+        sent += ret;
+    }
+    pthread_mutex_unlock( &intf->hw_lock );
+}
+
+void decap_flush( decap_t* decap ) {
+    unsigned i, j;
+
+    for( i=0; i<decap->num_pending; i=j ) {
+        for( j=i+1; j<decap->num_pending && decap->slot[j].intf == decap->slot[i].intf; j++ );
+        decap_send_run( decap, &decap->slot[i], j - i );
+    }
+    decap->num_pending = 0;
+}
+
+int decap_to_string( decap_t* decap, char* buf, int len ) {
+    char str_ip[STRLEN_IP];
+    decap_tunnel_t* t;
+    unsigned i, n, ret;
+    struct in_addr ip;
+
+    ret = my_snprintf( buf, len, "%-5s %-15s %-8s %-5s %-10s %12s %14s\n",
+                       "Proto", "Remote", "InPorts", "Inner", "OutIntf",
+                       "Packets", "Bytes" );
+    if( !ret ) return 0;
+    n = ret;
+
+    for( i=0; i<decap->num_tunnels; i++ ) {
+        t = &decap->tunnel[i];
+        if( t->remote ) {
+            ip.s_addr = t->remote;
+            inet_ntop( AF_INET, &ip, str_ip, STRLEN_IP );
+        }
+        else
+            strcpy( str_ip, "any" );
+
+        ret = my_snprintf( buf+n, len-n, "%-5u %-15s 0x%-6X %-5s %-10s %12llu %14llu\n",
+                           t->proto, str_ip, t->in_ports,
+                           t->inner == DECAP_INNER_ETH ? "eth" : "ip",
+                           t->out_intf->name,
+                           (unsigned long long)t->packets,
+                           (unsigned long long)t->bytes );
+        if( !ret ) return 0;
+        n += ret;
+    }
+
+    ret = my_snprintf( buf+n, len-n, "TX: %llu frames in %llu batches, %llu errors\n",
+                       (unsigned long long)decap->tx_packets,
+                       (unsigned long long)decap->tx_batches,
+                       (unsigned long long)decap->tx_errors );
+    if( !ret ) return 0;
+    return n + ret;
+}
+
+#endif /* MININET_MODE || _CPUMODE_ */
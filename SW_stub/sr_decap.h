@@ -0,0 +1,131 @@
+/*
+ * Filename: sr_decap.h
+ * Purpose: Tunnel termination stage for frames received from the hardware.
+ *
+ * Mirrors the nf10_decap pcore: a frame arriving on one of a tunnel's ingress
+ * ports whose outer IPv4 protocol matches the tunnel has its outer Ethernet and
+ * IP headers stripped and is sent straight back out, without entering the
+ * router's processing pipeline.  Two payload types are supported:
+ *
+ *   DECAP_INNER_ETH  the payload is a complete Ethernet frame (what the
+ *                    nf10_encap pcore produces; the outer 34 bytes are removed)
+ *   DECAP_INNER_IP   the payload is an IP packet (IP-in-IP); a new Ethernet
+ *                    header from the egress interface is written over the tail
+ *                    of the outer IP header
+ *
+ * Frames are received directly into the stage's buffers, so a decapsulated
+ * frame is never copied.  They are queued and sent in batches (one sendmmsg per
+ * egress interface) when the batch fills or decap_flush() is called.
+ *
+ * Not thread-safe; the router guards the tunnel table with its decap_lock
+ * (tunnels are configured from the CLI with "ip decap").
+ */
+
+#ifndef SR_DECAP_H
+#define SR_DECAP_H
+
+#include "sr_common.h"
+#include "sr_interface.h"
+
+#if defined MININET_MODE || defined _CPUMODE_
+
+/** max number of tunnels which may be terminated */
+#define DECAP_MAX_TUNNELS 8
+
+/** max number of decapsulated frames queued before they are sent */
+#define DECAP_MAX_BATCH 32
+
+/** the type of the encapsulated payload */
+typedef enum decap_inner_t {
+    DECAP_INNER_ETH,
+    DECAP_INNER_IP
+} decap_inner_t;
+
+/** a tunnel which this router terminates */
+typedef struct decap_tunnel_t {
+    byte          proto;     /* outer IP protocol which identifies the tunnel */
+    addr_ip_t     remote;    /* nbo; outer source IP, or 0 to accept any */
+    uint32_t      in_ports;  /* bit i set => accept on interface i */
+    decap_inner_t inner;
+    interface_t*  out_intf;  /* where decapsulated frames are sent */
+
+    uint64_t packets;        /* frames decapsulated */
+    uint64_t bytes;          /* bytes sent after decapsulation */
+} decap_tunnel_t;
+
+/** a receive buffer; once it holds a decapsulated frame it is queued for TX */
+typedef struct decap_slot_t {
+    byte buf[ETH_MAX_LEN];
+    unsigned off;            /* where the decapsulated frame starts in buf */
+    unsigned len;
+    interface_t* intf;
+} decap_slot_t;
+
+/** the decapsulation stage */
+typedef struct decap_t {
+    decap_tunnel_t tunnel[DECAP_MAX_TUNNELS];
+    unsigned num_tunnels;
+
+    decap_slot_t slot[DECAP_MAX_BATCH + 1]; /* pending frames + the RX buffer */
+    unsigned num_pending;
+    unsigned batch_size;
+
+    uint64_t tx_batches;     /* sendmmsg calls made */
+    uint64_t tx_packets;     /* frames sent */
+    uint64_t tx_errors;      /* frames which could not be sent */
+} decap_t;
+
+/**
+ * Initializes an empty stage.  Frames are sent once batch_size of them are
+ * queued (1 sends each frame as soon as it is decapsulated).
+ */
+void decap_init( decap_t* decap, unsigned batch_size );
+
+/**
+ * Adds a tunnel to terminate.
+ *
+ * @return the tunnel's index, or -1 if the table is full
+ */
+int decap_add_tunnel( decap_t* decap, byte proto, addr_ip_t remote,
+                      uint32_t in_ports, decap_inner_t inner,
+                      interface_t* out_intf );
+
+/**
+ * Stops terminating the tunnel with outer protocol proto from remote (0 for
+ * the tunnel which accepts any source).
+ *
+ * @return 0 on success, or -1 if there is no such tunnel
+ */
+int decap_remove_tunnel( decap_t* decap, byte proto, addr_ip_t remote );
+
+/**
+ * Returns the buffer (ETH_MAX_LEN bytes) the next frame should be received
+ * into.  The buffer remains valid until the next decap_input() which returns
+ * TRUE.
+ */
+byte* decap_rx_buffer( decap_t* decap );
+
+/**
+ * Checks whether the frame of length len in the RX buffer, which arrived on
+ * interface in_port, terminates a tunnel.  If so it is decapsulated and queued
+ * for transmission (the stage keeps the buffer) and TRUE is returned.
+ * Otherwise FALSE is returned and the frame is left untouched in the buffer.
+ */
+bool decap_input( decap_t* decap, unsigned in_port, unsigned len );
+
+/** Sends every queued frame. */
+void decap_flush( decap_t* decap );
+
+#define STR_DECAP_MAX_LEN (100*(DECAP_MAX_TUNNELS+3))
+
+/**
+ * Fills buf with the tunnel table and counters.  It takes up to
+ * STR_DECAP_MAX_LEN characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int decap_to_string( decap_t* decap, char* buf, int len );
+
+#endif /* MININET_MODE || _CPUMODE_ */
+
+#endif /* SR_DECAP_H */
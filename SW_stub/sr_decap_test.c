@@ -0,0 +1,237 @@
+/*
+ * Filename: sr_decap_test.c
+ * Purpose: Checks and benchmarks the CPU path decapsulation stage.
+ *
+ * Tunnelled frames (both the Ethernet-in-IP format produced by the nf10_encap
+ * pcore and IP-in-IP) are pushed through decap_input() at each of several batch
+ * sizes.  The egress interface's hw_fd is one end of a datagram socketpair and
+ * a receiver thread on the other end checks every decapsulated frame.  The
+ * cost per frame and the number of send calls are reported so the software
+ * path can be compared with the rate the nf10_decap pcore sustains for the same
+ * traffic (see "show hw stats").  Removing a tunnel is checked first.
+ *
+ * Usage: test_decap [-n frames] [-s frame_size]
+ */
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "sr_decap.h"
+
+#define TUNNEL_PROTO 0xB2  /* nf10_encap/nf10_decap default protocol */
+#define OUTER_LEN    34
+
+/** what the receiver expects the decapsulated frames to look like */
+typedef struct receiver_t {
+    int fd;
+    const byte* expect;
+    unsigned expect_len;
+    unsigned long received;
+    unsigned long bad;
+} receiver_t;
+
+static void* receiver_main( void* vr ) {
+    receiver_t* r = (receiver_t*)vr;
+    byte buf[ETH_MAX_LEN];
+    ssize_t len;
+
+    while( (len = recv( r->fd, buf, ETH_MAX_LEN, 0 )) > 0 ) {
+        if( len == 1 )
+            break; /* end marker */
+
+        if( (unsigned)len != r->expect_len || memcmp( buf, r->expect, len ) != 0 )
+            r->bad += 1;
+        r->received += 1;
+    }
+
+    return NULL;
+}
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Builds an outer Ethernet + IPv4 header carrying a payload_len payload. */
+static void make_outer( byte* frame, byte proto, unsigned payload_len ) {
+    struct ether_header* eth = (struct ether_header*)frame;
+    struct ip* ip = (struct ip*)(frame + ETHER_HDR_LEN);
+
+    memset( eth->ether_dhost, 0x02, ETH_ADDR_LEN );
+    memset( eth->ether_shost, 0x04, ETH_ADDR_LEN );
+    eth->ether_type = htons( ETHERTYPE_IP );
+
+    memset( ip, 0, sizeof(*ip) );
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons( 20 + payload_len );
+    ip->ip_ttl = 64;
+    ip->ip_p = proto;
+    ip->ip_src.s_addr = htonl( 0x0a000002 );
+    ip->ip_dst.s_addr = htonl( 0x0a000001 );
+}
+
+/**
+ * Runs num_frames copies of frame through a decap stage with the given batch
+ * size and checks that each comes out as expect.
+ *
+ * @return number of frames which were not decapsulated correctly
+ */
+static unsigned long run( interface_t* in, interface_t* out, int peer_fd,
+                          decap_inner_t inner, unsigned batch_size,
+                          const byte* frame, unsigned len,
+                          const byte* expect, unsigned expect_len,
+                          unsigned long num_frames ) {
+    static decap_t decap;
+    receiver_t r;
+    pthread_t tid;
+    unsigned long i, not_decapped = 0;
+    uint64_t start, elapsed;
+
+    decap_init( &decap, batch_size );
+    decap_add_tunnel( &decap, inner == DECAP_INNER_ETH ? TUNNEL_PROTO : IPPROTO_IPIP,
+                      0, 1U << 0, inner, out );
+
+    /* a frame on a port the tunnel is not bound to is left alone */
+    memcpy( decap_rx_buffer( &decap ), frame, len );
+    if( decap_input( &decap, 1, len ) )
+        not_decapped += 1;
+
+    memset( &r, 0, sizeof(r) );
+    r.fd = peer_fd;
+    r.expect = expect;
+    r.expect_len = expect_len;
+    true_or_die( pthread_create( &tid, NULL, receiver_main, &r ) == 0,
+                 "Error: pthread_create failed" );
+
+    start = now_nsec();
+    for( i=0; i<num_frames; i++ ) {
+        /* stands in for the recv() sr_cpu_input does into this buffer */
+        memcpy( decap_rx_buffer( &decap ), frame, len );
+        if( !decap_input( &decap, 0, len ) )
+            not_decapped += 1;
+    }
+    decap_flush( &decap );
+    elapsed = now_nsec() - start;
+
+    send( out->hw_fd, "", 1, 0 );
+    pthread_join( tid, NULL );
+
+    printf( "  %-3s batch %2u: %7.1f ns/frame %7.3f Mframes/s %8llu sends  %lu received %lu bad\n",
+            inner == DECAP_INNER_ETH ? "eth" : "ip", batch_size,
+            (double)elapsed / num_frames, num_frames * 1000.0 / elapsed,
+            (unsigned long long)decap.tx_batches, r.received, r.bad );
+
+    return not_decapped + r.bad + (num_frames - r.received) + decap.tx_errors;
+}
+
+/**
+ * Checks that removing a tunnel stops it (and only it) from terminating frames.
+ *
+ * @return number of failed checks
+ */
+static unsigned long check_remove( interface_t* out ) {
+    static decap_t decap;
+    byte frame[ETH_MAX_LEN];
+    unsigned long failures = 0;
+    unsigned len = 128;
+
+    decap_init( &decap, DECAP_MAX_BATCH );
+    decap_add_tunnel( &decap, IPPROTO_IPIP, 0, ~0U, DECAP_INNER_IP, out );
+    decap_add_tunnel( &decap, TUNNEL_PROTO, 0, ~0U, DECAP_INNER_ETH, out );
+
+    failures += decap_remove_tunnel( &decap, IPPROTO_IPIP, htonl( 0x0A000001 ) ) != -1;
+    failures += decap_remove_tunnel( &decap, IPPROTO_IPIP, 0 ) != 0;
+    failures += decap_remove_tunnel( &decap, IPPROTO_IPIP, 0 ) != -1;
+    failures += decap.num_tunnels != 1;
+
+    make_outer( frame, IPPROTO_IPIP, len - OUTER_LEN );
+    memcpy( decap_rx_buffer( &decap ), frame, len );
+    failures += decap_input( &decap, 0, len );
+
+    make_outer( frame, TUNNEL_PROTO, len - OUTER_LEN );
+    memcpy( decap_rx_buffer( &decap ), frame, len );
+    failures += !decap_input( &decap, 0, len );
+
+    /* drop the queued frame rather than sending it to the receiver */
+    decap.num_pending = 0;
+
+    printf( "  remove: %lu failures\n", failures );
+    return failures;
+}
+
+int main( int argc, char** argv ) {
+    static const unsigned batch_sizes[] = { 1, 4, 16, DECAP_MAX_BATCH };
+    byte frame[ETH_MAX_LEN], expect[ETH_MAX_LEN];
+    unsigned long num_frames = 200000, failures = 0;
+    unsigned frame_size = 512, i;
+    interface_t intf[2];
+    int fds[2], sndbuf, c;
+
+    while( (c = getopt( argc, argv, "n:s:" )) != EOF ) {
+        switch( c ) {
+        case 'n': num_frames = strtoul( optarg, NULL, 0 ); break;
+        case 's': frame_size = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n frames] [-s frame_size]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( frame_size >= OUTER_LEN + 2*ETHER_HDR_LEN && frame_size <= ETH_MAX_LEN,
+                 "Error: frame size must be between %u and %u",
+                 OUTER_LEN + 2*ETHER_HDR_LEN, ETH_MAX_LEN );
+
+    true_or_die( socketpair( AF_UNIX, SOCK_DGRAM, 0, fds ) == 0,
+                 "Error: socketpair failed" );
+    sndbuf = 4 * 1024 * 1024;
+    setsockopt( fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf) );
+
+    memset( intf, 0, sizeof(intf) );
+    for( i=0; i<2; i++ ) {
+        snprintf( intf[i].name, SR_NAMELEN, "eth%u", i );
+        memset( intf[i].mac.octet, 0x10 + i, ETH_ADDR_LEN );
+        intf[i].enabled = TRUE;
+        intf[i].hw_id = i;
+        intf[i].hw_fd = -1;
+        pthread_mutex_init( &intf[i].hw_lock, NULL );
+    }
+    intf[1].hw_fd = fds[0];
+
+    printf( "%lu frames of %u bytes per run\n", num_frames, frame_size );
+
+    failures += check_remove( &intf[1] );
+
+    /* Ethernet-in-IP: everything after the outer 34 bytes is passed on as is */
+    make_outer( frame, TUNNEL_PROTO, frame_size - OUTER_LEN );
+    for( i=OUTER_LEN; i<frame_size; i++ )
+        frame[i] = i;
+    memcpy( expect, frame + OUTER_LEN, frame_size - OUTER_LEN );
+    for( i=0; i<sizeof(batch_sizes)/sizeof(batch_sizes[0]); i++ )
+        failures += run( &intf[0], &intf[1], fds[1], DECAP_INNER_ETH, batch_sizes[i],
+                         frame, frame_size, expect, frame_size - OUTER_LEN,
+                         num_frames );
+
+    /* IP-in-IP: the inner IP packet gets a new Ethernet header */
+    make_outer( frame, IPPROTO_IPIP, frame_size - OUTER_LEN );
+    memset( expect, 0xFF, ETH_ADDR_LEN );
+    memcpy( expect + ETH_ADDR_LEN, intf[1].mac.octet, ETH_ADDR_LEN );
+    *((uint16_t*)(expect + 2*ETH_ADDR_LEN)) = htons( ETHERTYPE_IP );
+    memcpy( expect + ETHER_HDR_LEN, frame + OUTER_LEN, frame_size - OUTER_LEN );
+    for( i=0; i<sizeof(batch_sizes)/sizeof(batch_sizes[0]); i++ )
+        failures += run( &intf[0], &intf[1], fds[1], DECAP_INNER_IP, batch_sizes[i],
+                         frame, frame_size, expect, frame_size - OUTER_LEN + ETHER_HDR_LEN,
+                         num_frames );
+
+    printf( "%s (%lu failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
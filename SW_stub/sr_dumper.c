@@ -101,3 +101,63 @@ sr_dump_close(FILE *fp)
   fclose(fp);
 }
 
+/*
+ * Open a dump file written by sr_dump_open() (or tcpdump) for reading.
+ */
+FILE *
+sr_dump_read_open(const char *fname)
+{
+        struct pcap_file_header hdr;
+        FILE *fp;
+
+        if (fname[0] == '-' && fname[1] == '\0')
+                fp = stdin;
+        else {
+                fp = fopen(fname, "r");
+                if (fp == NULL) {
+                        fprintf(stderr, "sr_dump_read_open: can't open %s\n",
+                            fname);
+                        return (NULL);
+                }
+        }
+
+        if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+            hdr.magic != TCPDUMP_MAGIC ||
+            hdr.linktype != LINKTYPE_ETHERNET) {
+                fprintf(stderr, "sr_dump_read_open: %s is not an Ethernet "
+                    "capture\n", fname);
+                if (fp != stdin)
+                        fclose(fp);
+                return (NULL);
+        }
+
+        return fp;
+}
+
+/*
+ * Read the next packet from the dump file; excess bytes are skipped.
+ */
+int
+sr_dump_read(FILE *fp, struct pcap_pkthdr *h, unsigned char *sp,
+             unsigned maxlen)
+{
+        struct pcap_sf_pkthdr sf_hdr;
+        unsigned size;
+
+        if (fread(&sf_hdr, sizeof(sf_hdr), 1, fp) != 1)
+                return (-1);
+
+        h->ts.tv_sec  = sf_hdr.ts.tv_sec;
+        h->ts.tv_usec = sf_hdr.ts.tv_usec;
+        h->caplen     = sf_hdr.caplen;
+        h->len        = sf_hdr.len;
+
+        size = min(sf_hdr.caplen, maxlen);
+        if (fread(sp, 1, size, fp) != size)
+                return (-1);
+        if (size < sf_hdr.caplen &&
+            fseek(fp, sf_hdr.caplen - size, SEEK_CUR) != 0)
+                return (-1);
+
+        return (size);
+}
@@ -83,3 +83,19 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+/**
+ * Open a dump file for reading and check its file header.  Only Ethernet
+ * captures written in the host's byte order (as sr_dump_open writes them) are
+ * accepted.
+ */
+FILE* sr_dump_read_open(const char *fname);
+
+/**
+ * Read the next packet from a dump file opened with sr_dump_read_open.  At
+ * most maxlen bytes of the packet are placed in sp.
+ *
+ * @return number of bytes placed in sp, or -1 at the end of the file
+ */
+int sr_dump_read(FILE *fp, struct pcap_pkthdr *h, unsigned char *sp,
+                 unsigned maxlen);
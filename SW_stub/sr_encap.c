@@ -0,0 +1,126 @@
+/* Filename: sr_encap.c */
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <string.h>
+#include "sr_encap.h"
+
+void encap_init( encap_t* encap ) {
+    memset( encap, 0, sizeof(*encap) );
+}
+
+int encap_set_tunnel( encap_t* encap, unsigned port,
+                      addr_mac_t src_mac, addr_mac_t dst_mac,
+                      addr_ip_t src_ip, addr_ip_t dst_ip,
+                      byte proto, byte ttl, byte tos ) {
+    encap_tunnel_t* t;
+    struct ether_header* eth;
+    struct ip* ip;
+    uint16_t* w;
+    unsigned i;
+
+    if( port >= ENCAP_MAX_TUNNELS )
+        return -1;
+
+    t = &encap->tunnel[port];
+    memset( t, 0, sizeof(*t) );
+
+    eth = (struct ether_header*)t->hdr;
+    memcpy( eth->ether_dhost, &dst_mac, ETH_ADDR_LEN );
+    memcpy( eth->ether_shost, &src_mac, ETH_ADDR_LEN );
+    eth->ether_type = htons( ETHERTYPE_IP );
+
+    /* same fields as the hardware: no ID, no fragmentation flags */
+    ip = (struct ip*)(t->hdr + ETHER_HDR_LEN);
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_tos = tos;
+    ip->ip_ttl = ttl;
+    ip->ip_p = proto;
+    ip->ip_src.s_addr = src_ip;
+    ip->ip_dst.s_addr = dst_ip;
+
+    /* the length and checksum are the only per-frame fields, so sum the rest
+       now and only add the length in when a frame is sent */
+    w = (uint16_t*)ip;
+    for( i=0; i<sizeof(*ip)/2; i++ )
+        t->csum_base += w[i];
+
+    t->enabled = TRUE;
+    return 0;
+}
+
+void encap_clear_tunnel( encap_t* encap, unsigned port ) {
+    if( port < ENCAP_MAX_TUNNELS )
+        encap->tunnel[port].enabled = FALSE;
+}
+
+bool encap_output( encap_t* encap, unsigned port, byte** frame, unsigned* len ) {
+    encap_tunnel_t* t;
+    struct ip* ip;
+    uint32_t sum;
+    uint16_t tot_len;
+    byte* outer;
+
+    if( port >= ENCAP_MAX_TUNNELS || !encap->tunnel[port].enabled )
+        return FALSE;
+    t = &encap->tunnel[port];
+
+    outer = *frame - ENCAP_HDR_LEN;
+    memcpy( outer, t->hdr, ENCAP_HDR_LEN );
+
+    tot_len = htons( *len + ENCAP_HDR_LEN - ETHER_HDR_LEN );
+    ip = (struct ip*)(outer + ETHER_HDR_LEN);
+    ip->ip_len = tot_len;
+
+    sum = t->csum_base + tot_len;
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += sum >> 16;
+    ip->ip_sum = ~sum;
+
+    *frame = outer;
+    *len += ENCAP_HDR_LEN;
+
+    __sync_fetch_and_add( &t->packets, 1 );
+    __sync_fetch_and_add( &t->bytes, *len );
+    return TRUE;
+}
+
+unsigned encap_mtu( const encap_t* encap, unsigned port ) {
+    if( port < ENCAP_MAX_TUNNELS && encap->tunnel[port].enabled )
+        return ETH_MTU - ENCAP_HDR_LEN;
+    return ETH_MTU;
+}
+
+int encap_to_string( encap_t* encap, char* buf, int len ) {
+    char str_src[STRLEN_IP], str_dst[STRLEN_IP];
+    encap_tunnel_t* t;
+    unsigned i, n, ret;
+    struct ip* ip;
+
+    ret = my_snprintf( buf, len, "%-4s %-15s %-15s %-5s %12s %14s\n",
+                       "Port", "Source", "Destination", "Proto",
+                       "Packets", "Bytes" );
+    if( !ret ) return 0;
+    n = ret;
+
+    for( i=0; i<ENCAP_MAX_TUNNELS; i++ ) {
+        t = &encap->tunnel[i];
+        if( !t->enabled )
+            continue;
+
+        ip = (struct ip*)(t->hdr + ETHER_HDR_LEN);
+        inet_ntop( AF_INET, &ip->ip_src, str_src, STRLEN_IP );
+        inet_ntop( AF_INET, &ip->ip_dst, str_dst, STRLEN_IP );
+        ret = my_snprintf( buf+n, len-n, "%-4u %-15s %-15s %-5u %12llu %14llu\n",
+                           i, str_src, str_dst, ip->ip_p,
+                           (unsigned long long)t->packets,
+                           (unsigned long long)t->bytes );
+        if( !ret ) return 0;
+        n += ret;
+    }
+
+    return n;
+}
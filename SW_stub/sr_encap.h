@@ -0,0 +1,90 @@
+/*
+ * Filename: sr_encap.h
+ * Purpose: Tunnel encapsulation stage for frames the router sends.
+ *
+ * Mirrors the nf10_encap pcore: each output port may have a tunnel, and every
+ * frame sent out that port is carried as the payload of an outer Ethernet +
+ * IPv4 header (the whole original frame, Ethernet header included, follows the
+ * outer header).  The outer header of each tunnel is built once when the tunnel
+ * is configured, so encapsulating a frame is a 34-byte prepend plus a total
+ * length and incremental checksum fixup.  Frames passed in must have
+ * ENCAP_HDR_LEN bytes of headroom in front of them (see PACKET_HEADROOM).
+ *
+ * Not thread-safe; the router guards it with its encap_lock (tunnels are
+ * configured from the CLI with "ip tunnel").
+ */
+
+#ifndef SR_ENCAP_H
+#define SR_ENCAP_H
+
+#include "sr_common.h"
+
+/** bytes prepended to an encapsulated frame (outer Ethernet + IP header) */
+#define ENCAP_HDR_LEN 34
+
+/** one tunnel per output port, as in the hardware */
+#define ENCAP_MAX_TUNNELS 4
+
+/** defaults the nf10_encap pcore comes out of reset with */
+#define ENCAP_DEFAULT_PROTO 0xB2
+#define ENCAP_DEFAULT_TTL   0xFF
+
+/** a tunnel's prebuilt outer header */
+typedef struct encap_tunnel_t {
+    bool     enabled;
+    byte     hdr[ENCAP_HDR_LEN]; /* outer header with total length 0 */
+    uint32_t csum_base;          /* unfolded sum of the outer IP header */
+
+    uint64_t packets;            /* frames encapsulated */
+    uint64_t bytes;              /* bytes sent, outer header included */
+} encap_tunnel_t;
+
+/** the encapsulation stage, indexed by output port (interface index) */
+typedef struct encap_t {
+    encap_tunnel_t tunnel[ENCAP_MAX_TUNNELS];
+} encap_t;
+
+/** Initializes the stage with no tunnels. */
+void encap_init( encap_t* encap );
+
+/**
+ * Configures a tunnel for frames sent out port and builds its outer header,
+ * replacing any tunnel port had.
+ *
+ * @return 0 on success, or -1 if port is out of range
+ */
+int encap_set_tunnel( encap_t* encap, unsigned port,
+                      addr_mac_t src_mac, addr_mac_t dst_mac,
+                      addr_ip_t src_ip, addr_ip_t dst_ip, /* nbo */
+                      byte proto, byte ttl, byte tos );
+
+/** Stops encapsulating frames sent out port. */
+void encap_clear_tunnel( encap_t* encap, unsigned port );
+
+/**
+ * Encapsulates the frame of length *len at *frame if port has a tunnel.  The
+ * outer header is written into the ENCAP_HDR_LEN bytes before *frame, and
+ * *frame and *len are updated to describe the encapsulated frame.
+ *
+ * @return TRUE if the frame was encapsulated
+ */
+bool encap_output( encap_t* encap, unsigned port, byte** frame, unsigned* len );
+
+/**
+ * Returns the largest IP packet which fits in a frame sent out port: ETH_MTU,
+ * less ENCAP_HDR_LEN if port has a tunnel (the outer IP packet carries the
+ * inner Ethernet header too).
+ */
+unsigned encap_mtu( const encap_t* encap, unsigned port );
+
+#define STR_ENCAP_MAX_LEN (100*(ENCAP_MAX_TUNNELS+1))
+
+/**
+ * Fills buf with the tunnel table and counters.  It takes up to
+ * STR_ENCAP_MAX_LEN characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int encap_to_string( encap_t* encap, char* buf, int len );
+
+#endif /* SR_ENCAP_H */
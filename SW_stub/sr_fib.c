@@ -0,0 +1,345 @@
+/* Filename: sr_fib.c */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sr_fib.h"
+
+/** slots a prefix length's table starts with */
+#define FIB_INITIAL_SIZE 16
+
+/** Returns the mask of prefix length n, in network byte order. */
+static addr_ip_t fib_mask( unsigned n ) {
+    return n ? htonl( 0xFFFFFFFF << (32 - n) ) : 0;
+}
+
+static int hop_cmp( const void* va, const void* vb ) {
+    const fib_hop_t* a = (const fib_hop_t*)va;
+    const fib_hop_t* b = (const fib_hop_t*)vb;
+
+    if( a->intf != b->intf )
+        return a->intf < b->intf ? -1 : 1;
+    if( a->gw != b->gw )
+        return ntohl( a->gw ) < ntohl( b->gw ) ? -1 : 1;
+    return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/* next-hop groups                                                          */
+/*--------------------------------------------------------------------------*/
+
+/** Returns a reference to the group of the given next hops, creating it if needed. */
+static fib_group_t* group_get( fib_t* fib, const fib_hop_t* hops, unsigned num_hops ) {
+    fib_hop_t sorted[FIB_MAX_PATHS];
+    fib_group_t* g;
+    unsigned i, n;
+
+    if( num_hops > FIB_MAX_PATHS )
+        num_hops = FIB_MAX_PATHS;
+
+    /* zeroed so that groups compare with memcmp(); duplicates dropped */
+    memset( sorted, 0, sizeof(sorted) );
+    memcpy( sorted, hops, num_hops * sizeof(*hops) );
+    qsort( sorted, num_hops, sizeof(*sorted), hop_cmp );
+    for( i=n=0; i<num_hops; i++ )
+        if( n == 0 || hop_cmp( &sorted[n-1], &sorted[i] ) != 0 )
+            sorted[n++] = sorted[i];
+    memset( sorted + n, 0, (FIB_MAX_PATHS - n) * sizeof(*sorted) );
+
+    for( g=fib->groups; g; g=g->next ) {
+        if( g->num_hops == n && memcmp( g->hop, sorted, sizeof(sorted) ) == 0 ) {
+            g->refcnt += 1;
+            return g;
+        }
+    }
+
+    g = malloc_or_die( sizeof(*g) );
+    g->refcnt = 1;
+    g->num_hops = n;
+    memcpy( g->hop, sorted, sizeof(sorted) );
+    g->next = fib->groups;
+    fib->groups = g;
+    fib->num_groups += 1;
+    return g;
+}
+
+static void group_put( fib_t* fib, fib_group_t* g ) {
+    fib_group_t** pg;
+
+    if( --g->refcnt )
+        return;
+
+    for( pg=&fib->groups; *pg!=g; pg=&(*pg)->next );
+    *pg = g->next;
+    fib->num_groups -= 1;
+    free( g );
+}
+
+/*--------------------------------------------------------------------------*/
+/* per prefix length tables                                                 */
+/*--------------------------------------------------------------------------*/
+
+/** Returns the slot holding subnet in t, or the empty slot where it would go. */
+static fib_entry_t* table_find( fib_table_t* t, addr_ip_t subnet ) {
+    unsigned mask = t->size - 1;
+    unsigned h = hash32( subnet ) & mask;
+
+    while( t->entry[h].group && t->entry[h].subnet != subnet )
+        h = (h + 1) & mask;
+    return &t->entry[h];
+}
+
+static void table_grow( fib_table_t* t ) {
+    fib_entry_t* old = t->entry;
+    unsigned i, old_size = t->size;
+
+    t->size = old_size ? 2 * old_size : FIB_INITIAL_SIZE;
+    t->entry = calloc_or_die( t->size, sizeof(*t->entry) );
+    for( i=0; i<old_size; i++ )
+        if( old[i].group )
+            *table_find( t, old[i].subnet ) = old[i];
+    free( old );
+}
+
+/** Empties slot e of t, moving up the entries after it (no tombstones). */
+static void table_erase( fib_table_t* t, fib_entry_t* e ) {
+    unsigned mask = t->size - 1;
+    unsigned i = e - t->entry, j = i, h;
+
+    t->entry[i].group = NULL;
+    t->num_entries -= 1;
+    for( ;; ) {
+        j = (j + 1) & mask;
+        if( !t->entry[j].group )
+            return;
+
+        /* the entry at j may fill the hole at i unless its home slot lies
+           cyclically in (i, j] */
+        h = hash32( t->entry[j].subnet ) & mask;
+        if( (j > i && (h <= i || h > j)) || (j < i && (h <= i && h > j)) ) {
+            t->entry[i] = t->entry[j];
+            t->entry[j].group = NULL;
+            i = j;
+        }
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/* public interface                                                         */
+/*--------------------------------------------------------------------------*/
+
+void fib_init( fib_t* fib, uint32_t seed ) {
+    memset( fib, 0, sizeof(*fib) );
+    fib->seed = seed;
+}
+
+void fib_destroy( fib_t* fib ) {
+    fib_group_t* g;
+    unsigned i;
+
+    for( i=0; i<=32; i++ )
+        free( fib->table[i].entry );
+    while( (g = fib->groups) ) {
+        fib->groups = g->next;
+        free( g );
+    }
+    memset( fib, 0, sizeof(*fib) );
+}
+
+void fib_set( fib_t* fib, addr_ip_t subnet, addr_ip_t mask,
+              const fib_hop_t* hops, unsigned num_hops ) {
+    unsigned n = __builtin_popcount( mask );
+    fib_table_t* t = &fib->table[n];
+    fib_group_t* g;
+    fib_entry_t* e;
+
+    /* take the new reference first in case the group stays the same */
+    g = group_get( fib, hops, num_hops );
+    subnet &= mask;
+
+    if( 2 * (t->num_entries + 1) > t->size )
+        table_grow( t );
+    e = table_find( t, subnet );
+    if( e->group ) {
+        group_put( fib, e->group );
+        if( e->stale )
+            fib->num_stale -= 1;
+    }
+    else {
+        e->subnet = subnet;
+        t->num_entries += 1;
+        fib->num_routes += 1;
+        fib->lengths |= (uint64_t)1 << n;
+    }
+    e->group = g;
+    e->stale = FALSE;
+}
+
+bool fib_remove( fib_t* fib, addr_ip_t subnet, addr_ip_t mask ) {
+    unsigned n = __builtin_popcount( mask );
+    fib_table_t* t = &fib->table[n];
+    fib_entry_t* e;
+
+    if( !t->num_entries )
+        return FALSE;
+
+    e = table_find( t, subnet & mask );
+    if( !e->group )
+        return FALSE;
+
+    if( e->stale )
+        fib->num_stale -= 1;
+    group_put( fib, e->group );
+    table_erase( t, e );
+    fib->num_routes -= 1;
+    if( !t->num_entries )
+        fib->lengths &= ~((uint64_t)1 << n);
+    return TRUE;
+}
+
+void fib_mark_stale( fib_t* fib ) {
+    fib_table_t* t;
+    unsigned i, j;
+
+    for( i=0; i<=32; i++ ) {
+        t = &fib->table[i];
+        for( j=0; j<t->size; j++ )
+            if( t->entry[j].group )
+                t->entry[j].stale = TRUE;
+    }
+    fib->num_stale = fib->num_routes;
+}
+
+unsigned fib_sweep_stale( fib_t* fib ) {
+    fib_table_t* t;
+    unsigned i, j, n = 0;
+
+    /* erasing moves a later entry into slot j, so it is looked at again; one
+       wrapping round the end of a table may be moved behind the scan, which
+       another pass picks up */
+    while( fib->num_stale ) {
+        for( i=0; i<=32; i++ ) {
+            t = &fib->table[i];
+            j = 0;
+            while( j < t->size ) {
+                if( t->entry[j].group && t->entry[j].stale ) {
+                    fib_remove( fib, t->entry[j].subnet, fib_mask( i ) );
+                    n += 1;
+                }
+                else
+                    j += 1;
+            }
+        }
+    }
+
+    return n;
+}
+
+const fib_group_t* fib_lookup( fib_t* fib, addr_ip_t dst ) {
+    uint64_t lengths = fib->lengths;
+    fib_entry_t* e;
+    unsigned n;
+
+    /* longest first */
+    while( lengths ) {
+        n = 63 - __builtin_clzll( lengths );
+        lengths &= ~((uint64_t)1 << n);
+
+        e = table_find( &fib->table[n], dst & fib_mask( n ) );
+        if( e->group )
+            return e->group;
+    }
+
+    return NULL;
+}
+
+/** Mixes x into the hash h (the MurmurHash3 block step). */
+static uint32_t hash_mix( uint32_t h, uint32_t x ) {
+    x *= 0xcc9e2d51;
+    x = (x << 15) | (x >> 17);
+    x *= 0x1b873593;
+    h ^= x;
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xe6546b64;
+}
+
+uint32_t fib_flow_hash( fib_t* fib, const byte* ip, unsigned len ) {
+    const struct ip* iph = (const struct ip*)ip;
+    unsigned hlen;
+    uint32_t h;
+
+    h = hash_mix( fib->seed, iph->ip_src.s_addr );
+    h = hash_mix( h, iph->ip_dst.s_addr );
+    h = hash_mix( h, iph->ip_p );
+
+    /* the ports are only in the first fragment, so a fragmented flow is
+       hashed on its addresses alone to keep its fragments together */
+    hlen = iph->ip_hl * 4;
+    if( (iph->ip_p == IPPROTO_TCP || iph->ip_p == IPPROTO_UDP)
+        && !(ntohs( iph->ip_off ) & (IP_MF | IP_OFFMASK))
+        && len >= hlen + 4 ) {
+        h = hash_mix( h, *(const uint32_t*)(ip + hlen) );
+    }
+
+    /* finalize so every input bit affects the high bits fib_select() uses */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    return h ^ (h >> 16);
+}
+
+const fib_hop_t* fib_select( const fib_group_t* g, uint32_t hash ) {
+    /* hash-threshold: member i gets the i-th of num_hops equal ranges */
+    return &g->hop[((uint64_t)hash * g->num_hops) >> 32];
+}
+
+const fib_hop_t* fib_route( fib_t* fib, const byte* ip, unsigned len ) {
+    const fib_group_t* g;
+
+    g = fib_lookup( fib, ((const struct ip*)ip)->ip_dst.s_addr );
+    if( !g || !g->num_hops )
+        return NULL;
+    if( g->num_hops == 1 )
+        return &g->hop[0];
+    return fib_select( g, fib_flow_hash( fib, ip, len ) );
+}
+
+int fib_to_string( fib_t* fib, char* buf, int len ) {
+    char str_subnet[STRLEN_SUBNET], str_gw[STRLEN_IP];
+    fib_table_t* t;
+    fib_group_t* g;
+    unsigned i, j, k, n, ret;
+
+    ret = my_snprintf( buf, len, "%-18s %-15s %5s\n", "Prefix", "Next Hop", "Intf" );
+    if( !ret ) return 0;
+    n = ret;
+
+    for( i=33; i-->0; ) {
+        t = &fib->table[i];
+        for( j=0; j<t->size; j++ ) {
+            g = t->entry[j].group;
+            if( !g )
+                continue;
+
+            subnet_to_string( str_subnet, t->entry[j].subnet, fib_mask( i ) );
+            for( k=0; k<g->num_hops; k++ ) {
+                if( g->hop[k].gw )
+                    ip_to_string( str_gw, g->hop[k].gw );
+                else
+                    strcpy( str_gw, "direct" );
+                ret = my_snprintf( buf+n, len-n, "%-18s %-15s %5u\n",
+                                   k ? "" : str_subnet, str_gw, g->hop[k].intf );
+                if( !ret ) return 0;
+                n += ret;
+            }
+        }
+    }
+
+    ret = my_snprintf( buf+n, len-n, "%u routes (%u stale) over %u next-hop groups\n",
+                       fib->num_routes, fib->num_stale, fib->num_groups );
+    if( !ret ) return 0;
+    return n + ret;
+}
@@ -0,0 +1,136 @@
+/*
+ * Filename: sr_fib.h
+ * Purpose: Forwarding table with equal-cost multipath next-hop groups.
+ *
+ * A routing table with one next hop per prefix leaves every equal-cost path
+ * but one idle.  Instead each prefix points to a next-hop group: the set of
+ * equal-cost next hops, shared by every prefix routed over the same set (so a
+ * topology change rewrites a handful of groups' members rather than each
+ * prefix).  A packet's member is picked by hashing its flow (addresses,
+ * protocol, and ports unless it is a fragment), so every packet of a flow takes
+ * the same path and is never reordered, while different flows spread over all
+ * of them.  The member is chosen by hash-threshold (RFC 2992): the hash space is
+ * split into one contiguous range per member, so adding or removing a member
+ * only moves the flows in the ranges which shift rather than nearly all of
+ * them as hash modulo N would.  The hash is seeded per router so that routers in
+ * a row do not all make the same choice (which would leave the second stage's
+ * paths unused).
+ *
+ * Longest prefix match is done with a hash table per prefix length, probed
+ * from the longest length in use down.
+ *
+ * Not thread-safe; the router guards it with its fib_lock.
+ */
+
+#ifndef SR_FIB_H
+#define SR_FIB_H
+
+#include "sr_common.h"
+
+/** max next hops in a group */
+#define FIB_MAX_PATHS 8
+
+/** a next hop */
+typedef struct fib_hop_t {
+    addr_ip_t gw;           /* 0 if the destination is on the link */
+    unsigned  intf;         /* index of the outgoing interface */
+} fib_hop_t;
+
+/** a set of equal-cost next hops shared by every prefix routed over it */
+typedef struct fib_group_t {
+    unsigned  refcnt;       /* prefixes using the group */
+    unsigned  num_hops;
+    fib_hop_t hop[FIB_MAX_PATHS];   /* sorted, so that equal sets compare equal */
+    struct fib_group_t* next;
+} fib_group_t;
+
+/** a prefix of the length of the table it is in */
+typedef struct fib_entry_t {
+    addr_ip_t    subnet;
+    fib_group_t* group;     /* NULL if the slot is empty */
+    bool         stale;     /* restored from a snapshot and not set since */
+} fib_entry_t;
+
+/** the prefixes of one length */
+typedef struct fib_table_t {
+    fib_entry_t* entry;     /* open addressing */
+    unsigned     num_entries, size;
+} fib_table_t;
+
+/** the forwarding table */
+typedef struct fib_t {
+    fib_table_t  table[33];     /* indexed by prefix length */
+    uint64_t     lengths;       /* bit n set if table[n] is not empty */
+    fib_group_t* groups;
+    unsigned     num_groups;
+    unsigned     num_routes;
+    unsigned     num_stale;     /* routes which are stale */
+    uint32_t     seed;          /* of the flow hash */
+} fib_t;
+
+/** Initializes an empty table whose flow hash is seeded with seed. */
+void fib_init( fib_t* fib, uint32_t seed );
+
+/** Frees everything fib holds. */
+void fib_destroy( fib_t* fib );
+
+/**
+ * Routes the prefix subnet/mask over the num_hops next hops in hops (at most
+ * FIB_MAX_PATHS are used; the order does not matter), replacing its route if
+ * it had one.  mask must be contiguous.  The route is not stale.
+ */
+void fib_set( fib_t* fib, addr_ip_t subnet, addr_ip_t mask,
+              const fib_hop_t* hops, unsigned num_hops );
+
+/**
+ * Removes the route to subnet/mask.
+ *
+ * @return FALSE if there was none
+ */
+bool fib_remove( fib_t* fib, addr_ip_t subnet, addr_ip_t mask );
+
+/**
+ * Marks every route stale.  Stale routes are still used for forwarding until
+ * they are either set again or swept.
+ */
+void fib_mark_stale( fib_t* fib );
+
+/**
+ * Removes every route which is still stale.
+ *
+ * @return number of routes removed
+ */
+unsigned fib_sweep_stale( fib_t* fib );
+
+/**
+ * Returns the next-hop group of the longest prefix matching dst, or NULL if
+ * no prefix does.  The group is valid until the table is next changed.
+ */
+const fib_group_t* fib_lookup( fib_t* fib, addr_ip_t dst );
+
+/**
+ * Returns the hash of the flow the IP packet ip (len bytes from the IP header)
+ * belongs to.
+ */
+uint32_t fib_flow_hash( fib_t* fib, const byte* ip, unsigned len );
+
+/** Returns the member of group g flows with hash hash are sent to. */
+const fib_hop_t* fib_select( const fib_group_t* g, uint32_t hash );
+
+/**
+ * Returns the next hop for the IP packet ip (len bytes from the IP header), or
+ * NULL if there is no route to its destination.
+ */
+const fib_hop_t* fib_route( fib_t* fib, const byte* ip, unsigned len );
+
+/** max length of the string made by fib_to_string() */
+#define STR_FIB_MAX_LEN(fib) (80 * ((fib)->num_routes * FIB_MAX_PATHS + 2))
+
+/**
+ * Fills buf with the routes.  It takes up to STR_FIB_MAX_LEN(fib) characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int fib_to_string( fib_t* fib, char* buf, int len );
+
+#endif /* SR_FIB_H */
@@ -0,0 +1,343 @@
+/*
+ * Filename: sr_fib_test.c
+ * Purpose: Checks the ECMP forwarding table and SPF's equal-cost first hops.
+ *
+ * Longest prefix match is checked against a linear search over random
+ * prefixes of every length, before and after removing half of them, and the
+ * lookup rate is reported.
+ *
+ * Then r0 of the thames topology (see sr_topologies/thames.py) computes its
+ * routes: r6, opposite r0 on the ring, is five hops away both ways round, so
+ * its subnet must get both of r0's neighbors as next hops.  Random TCP flows to
+ * it are hashed over the two, which must each carry about half of them, with
+ * every fragment of a flow sent the same way.  The flows moved when a member
+ * leaves a group are counted for hash-threshold selection and for hash modulo
+ * N, and the choices of two routers with different hash seeds are compared.
+ * Finally one side of the ring fails and every flow must move to the other.
+ *
+ * Usage: test_fib [-f flows] [-s seed]
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "sr_fib.h"
+#include "sr_pwospf_spf.h"
+
+/** a route the linear search is checked against */
+typedef struct ref_route_t {
+    addr_ip_t subnet, mask;
+    unsigned len;
+    fib_hop_t hop;
+    bool present;
+} ref_route_t;
+
+/** a packet of a flow: IP header and the TCP ports */
+typedef struct flow_pkt_t {
+    struct ip ip;
+    uint16_t sport, dport;
+} __attribute__ ((packed)) flow_pkt_t;
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rand32() {
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+/** Returns the first hop of the longest matching reference route, or NULL. */
+static const fib_hop_t* ref_lookup( ref_route_t* r, unsigned n, addr_ip_t dst ) {
+    const ref_route_t* best = NULL;
+    unsigned i;
+
+    for( i=0; i<n; i++ )
+        if( r[i].present && (dst & r[i].mask) == r[i].subnet
+            && (!best || r[i].len > best->len) )
+            best = &r[i];
+
+    return best ? &best->hop : NULL;
+}
+
+/** Returns the number of lookups on which fib and the reference disagree. */
+static unsigned lpm_compare( fib_t* fib, ref_route_t* r, unsigned n, unsigned lookups ) {
+    const fib_group_t* g;
+    const fib_hop_t* h;
+    unsigned i, bad = 0;
+    addr_ip_t dst;
+
+    for( i=0; i<lookups; i++ ) {
+        /* half the lookups fall inside a route's prefix */
+        dst = rand32();
+        if( i & 1 )
+            dst = r[rand() % n].subnet | (dst & ~r[rand() % n].mask);
+
+        g = fib_lookup( fib, dst );
+        h = ref_lookup( r, n, dst );
+        if( !g != !h || (g && (g->num_hops != 1 || g->hop[0].intf != h->intf
+                               || g->hop[0].gw != h->gw)) )
+            bad += 1;
+    }
+
+    return bad;
+}
+
+static unsigned lpm( unsigned num_routes ) {
+    ref_route_t* r;
+    fib_t fib;
+    unsigned i, j, len, bad, found = 0;
+    uint64_t start, lookups = 1000000;
+
+    r = malloc_or_die( num_routes * sizeof(*r) );
+    fib_init( &fib, 1 );
+    for( i=0; i<num_routes; i++ ) {
+        /* mostly /8 to /32, with a few short prefixes and a default route */
+        len = i == 0 ? 0 : (rand() % 10 == 0 ? rand() % 33 : 8 + rand() % 25);
+        r[i].len = len;
+        r[i].mask = len ? htonl( 0xFFFFFFFF << (32 - len) ) : 0;
+        r[i].subnet = rand32() & r[i].mask;
+        r[i].hop.gw = htonl( 0x0a000000 + rand() % 8 );
+        r[i].hop.intf = rand() % 4;
+        r[i].present = TRUE;
+
+        /* a duplicate prefix replaces the earlier route */
+        for( j=0; j<i; j++ )
+            if( r[j].present && r[j].mask == r[i].mask && r[j].subnet == r[i].subnet )
+                r[j].present = FALSE;
+        fib_set( &fib, r[i].subnet, r[i].mask, &r[i].hop, 1 );
+    }
+
+    bad = lpm_compare( &fib, r, num_routes, 20000 );
+    printf( "lpm: %u routes in %u next-hop groups, %u mismatches\n",
+            fib.num_routes, fib.num_groups, bad );
+    bad += fib.num_groups > 32; /* one group per distinct next hop */
+
+    for( i=0; i<num_routes; i+=2 ) {
+        if( r[i].present ) {
+            bad += !fib_remove( &fib, r[i].subnet, r[i].mask );
+            r[i].present = FALSE;
+        }
+    }
+    i = lpm_compare( &fib, r, num_routes, 20000 );
+    printf( "lpm: %u routes left after removing half, %u mismatches\n",
+            fib.num_routes, i );
+    bad += i;
+
+    start = now_nsec();
+    for( i=0; i<lookups; i++ )
+        found += fib_lookup( &fib, rand32() ) != NULL;
+    printf( "lpm: %.1f ns per lookup (including rand()), %u of %llu matched\n",
+            (now_nsec() - start) / (double)lookups, found, (unsigned long long)lookups );
+
+    fib_destroy( &fib );
+    free( r );
+    return bad;
+}
+
+/** thames router IDs are the IP of eth0 */
+static const uint32_t thames_rid[] = {
+    0x0a000101, 0x0a000202, 0x0a000302, 0x0a000402, 0x0a000502,
+    0x0a000602, 0x0a000702, 0x0a000802, 0x0a000902, 0x0a000a02
+};
+#define THAMES_ROUTERS (sizeof(thames_rid)/sizeof(thames_rid[0]))
+
+/** thames router to router links: 10.0.subnet.0/24 joins a and b */
+static const struct { unsigned subnet, a, b; } thames_link[] = {
+    { 2, 0, 1 }, { 3, 0, 2 }, { 4, 1, 3 }, { 5, 3, 4 }, { 6, 4, 5 },
+    { 7, 5, 6 }, { 8, 6, 7 }, { 9, 7, 8 }, { 10, 8, 9 }, { 11, 9, 2 }
+};
+#define THAMES_LINKS (sizeof(thames_link)/sizeof(thames_link[0]))
+
+/** r0's forwarding table, fed by its SPF */
+typedef struct thames_t {
+    spf_t spf;
+    fib_t fib;
+} thames_t;
+
+/** Installs a route from SPF with each first hop's router ID as gateway. */
+static void thames_route( void* arg, addr_ip_t subnet, addr_ip_t mask,
+                          const spf_route_t* route ) {
+    thames_t* t = (thames_t*)arg;
+    fib_hop_t hops[SPF_MAX_ECMP];
+    unsigned i;
+
+    if( !route ) {
+        fib_remove( &t->fib, subnet, mask );
+        return;
+    }
+
+    for( i=0; i<route->num_hops; i++ ) {
+        hops[i].gw = route->first_hop[i];
+        hops[i].intf = route->first_hop[i] == htonl( thames_rid[1] ) ? 0 : 1;
+    }
+    if( route->num_hops == 0 ) {
+        hops[0].gw = 0;
+        hops[0].intf = 2;
+    }
+    fib_set( &t->fib, subnet, mask, hops, route->num_hops ? route->num_hops : 1 );
+}
+
+/** Gives thames router r its links to SPF, leaving out link down if not -1. */
+static void thames_links( spf_t* spf, unsigned r, int down ) {
+    lsdb_link_t links[4];
+    unsigned i, n = 0;
+
+    /* the stub subnet of r's host: 10.0.1.0 for r0, else 10.0.(11+r).0 */
+    links[n].subnet = htonl( 0x0a000000 | ((r ? 11 + r : 1) << 8) );
+    links[n].mask = htonl( 0xFFFFFF00 );
+    links[n].router_id = 0;
+    n += 1;
+    for( i=0; i<THAMES_LINKS; i++ ) {
+        if( (int)i == down || (thames_link[i].a != r && thames_link[i].b != r) )
+            continue;
+        links[n].subnet = htonl( 0x0a000000 | (thames_link[i].subnet << 8) );
+        links[n].mask = htonl( 0xFFFFFF00 );
+        links[n].router_id = htonl( thames_rid[thames_link[i].a == r ? thames_link[i].b
+                                                                       : thames_link[i].a] );
+        n += 1;
+    }
+
+    spf_set_links( spf, htonl( thames_rid[r] ), links, n );
+}
+
+/** Makes the packet of a random TCP flow to r6's host. */
+static void flow_make( flow_pkt_t* p ) {
+    memset( p, 0, sizeof(*p) );
+    p->ip.ip_v = 4;
+    p->ip.ip_hl = 5;
+    p->ip.ip_len = htons( sizeof(*p) );
+    p->ip.ip_ttl = 64;
+    p->ip.ip_p = IPPROTO_TCP;
+    p->ip.ip_src.s_addr = htonl( 0x0a000100 + 1 + rand() % 254 );
+    p->ip.ip_dst.s_addr = htonl( 0x0a001100 + 1 + rand() % 254 );
+    p->sport = htons( 1024 + rand() % 60000 );
+    p->dport = htons( rand() % 2 ? 80 : 1024 + rand() % 60000 );
+}
+
+/** Returns the index of the member hop of g. */
+static unsigned member( const fib_group_t* g, const fib_hop_t* hop ) {
+    return hop - g->hop;
+}
+
+static unsigned ecmp( unsigned flows ) {
+    thames_t t;
+    fib_t other;
+    fib_group_t g4, g3;
+    const fib_group_t* g;
+    const fib_hop_t* h;
+    flow_pkt_t p, frag;
+    unsigned i, bad = 0, count[2] = { 0, 0 }, split = 0, agree = 0;
+    unsigned moved_threshold = 0, moved_modulo = 0;
+    uint32_t hash;
+
+    fib_init( &t.fib, htonl( thames_rid[0] ) );
+    spf_init( &t.spf, htonl( thames_rid[0] ), thames_route, &t );
+    for( i=0; i<THAMES_ROUTERS; i++ )
+        thames_links( &t.spf, i, -1 );
+    spf_run( &t.spf );
+    bad += !spf_check( &t.spf );
+
+    /* r6 is five hops away through both r1 and r2 */
+    g = fib_lookup( &t.fib, htonl( 0x0a001101 ) );
+    if( !g || g->num_hops != 2 ) {
+        printf( "ecmp: r6's subnet does not have two next hops\n" );
+        fib_destroy( &t.fib );
+        spf_destroy( &t.spf );
+        return bad + 1;
+    }
+    g = fib_lookup( &t.fib, htonl( 0x0a001001 ) );
+    bad += !g || g->num_hops != 1;  /* r5 is closer through r1 */
+
+    fib_init( &other, htonl( thames_rid[1] ) );
+    for( i=0; i<flows; i++ ) {
+        flow_make( &p );
+        h = fib_route( &t.fib, (byte*)&p, sizeof(p) );
+        g = fib_lookup( &t.fib, p.ip.ip_dst.s_addr );
+        count[member( g, h )] += 1;
+
+        /* the first and a later fragment of the flow take the same path */
+        frag = p;
+        frag.ip.ip_off = htons( IP_MF );
+        h = fib_route( &t.fib, (byte*)&frag, sizeof(frag) );
+        frag.ip.ip_off = htons( 185 );
+        frag.sport = frag.dport = 0;
+        split += h != fib_route( &t.fib, (byte*)&frag, sizeof(frag) );
+
+        /* a router with another seed makes its own choice */
+        hash = fib_flow_hash( &t.fib, (byte*)&p, sizeof(p) );
+        agree += (member( g, fib_select( g, hash ) )
+                  == member( g, fib_select( g, fib_flow_hash( &other, (byte*)&p,
+                                                              sizeof(p) ) ) ));
+
+        /* flows moved when the last of four members leaves */
+        g4.num_hops = 4;
+        g3.num_hops = 3;
+        moved_threshold += (member( &g4, fib_select( &g4, hash ) )
+                            != member( &g3, fib_select( &g3, hash ) ));
+        moved_modulo += hash % 4 != hash % 3;
+    }
+    fib_destroy( &other );
+
+    printf( "ecmp: %u flows to r6 split %u/%u over r1/r2, %u fragmented flows split\n",
+            flows, count[0], count[1], split );
+    printf( "ecmp: %.1f%% of flows choose the same member with another hash seed\n",
+            100.0 * agree / flows );
+    printf( "ecmp: a member leaving a group of 4 moves %.1f%% of flows "
+            "(%.1f%% with hash modulo N)\n",
+            100.0 * moved_threshold / flows, 100.0 * moved_modulo / flows );
+    bad += count[0] < flows * 45 / 100 || count[1] < flows * 45 / 100;
+    bad += split != 0;
+    bad += agree < flows * 40 / 100 || agree > flows * 60 / 100;
+    bad += moved_threshold >= moved_modulo;
+
+    /* fail r4-r5: r6 is only reachable through r2 */
+    thames_links( &t.spf, 4, 4 );
+    thames_links( &t.spf, 5, 4 );
+    spf_run( &t.spf );
+    bad += !spf_check( &t.spf );
+    g = fib_lookup( &t.fib, htonl( 0x0a001101 ) );
+    if( !g || g->num_hops != 1 || g->hop[0].gw != htonl( thames_rid[2] ) )
+        bad += 1;
+    for( i=0; i<flows / 10; i++ ) {
+        flow_make( &p );
+        h = fib_route( &t.fib, (byte*)&p, sizeof(p) );
+        bad += !h || h->gw != htonl( thames_rid[2] );
+    }
+    printf( "ecmp: after r4-r5 fails, %u routes over %u next-hop groups\n",
+            t.fib.num_routes, t.fib.num_groups );
+
+    fib_destroy( &t.fib );
+    spf_destroy( &t.spf );
+    return bad;
+}
+
+int main( int argc, char** argv ) {
+    unsigned flows = 100000, seed = 1, failures = 0;
+    int c;
+
+    while( (c = getopt( argc, argv, "f:s:" )) != EOF ) {
+        switch( c ) {
+        case 'f': flows = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-f flows] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( flows >= 100, "Error: need at least 100 flows" );
+    srand( seed );
+
+    failures += lpm( 5000 );
+    failures += ecmp( flows );
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
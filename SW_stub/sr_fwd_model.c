@@ -0,0 +1,266 @@
+/* Filename: sr_fwd_model.c */
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <string.h>
+#include "common/nf10util.h"
+#include "sr_fwd_model.h"
+
+#define FWD_ETH_HDR_LEN 14
+#define FWD_IP_HDR_LEN  20
+
+#ifdef _CPUMODE_
+/** register holding the hardware counter for each fwd_reason_t */
+static const uint32_t fwd_counter_reg[FWD_NUM_REASONS] = {
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_SENT_FROM_CPU,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_DROPPED_WRONG_DST_MAC,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_SENT_CPU_NON_IP,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_SENT_CPU_OPTION_VER,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_DROPPED_CHECKSUM,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_SENT_CPU_DEST_IP_HIT,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_SENT_TO_CPU_BAD_TTL,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_SENT_CPU_LPM_MISS,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_SENT_CPU_ARP_MISS,
+    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_FORWARDED
+};
+#endif
+
+static const char* fwd_reason_name[FWD_NUM_REASONS] = {
+    "PKT_SENT_FROM_CPU",
+    "PKT_DROPPED_WRONG_DST_MAC",
+    "PKT_SENT_CPU_NON_IP",
+    "PKT_SENT_CPU_OPTION_VER",
+    "PKT_DROPPED_CHECKSUM",
+    "PKT_SENT_CPU_DEST_IP_HIT",
+    "PKT_SENT_TO_CPU_BAD_TTL",
+    "PKT_SENT_CPU_LPM_MISS",
+    "PKT_SENT_CPU_ARP_MISS",
+    "PKT_FORWARDED"
+};
+
+void fwd_model_init( fwd_model_t* model ) {
+    unsigned i;
+
+    memset( model, 0, sizeof(*model) );
+    for( i=0; i<FWD_MODEL_LPM_DEPTH; i++ )
+        model->lpm[i].mask = 0xFFFFFFFF;
+}
+
+void fwd_model_reset_counters( fwd_model_t* model ) {
+    memset( model->counter, 0, sizeof(model->counter) );
+}
+
+void fwd_model_set_lpm( fwd_model_t* model, unsigned index,
+                        addr_ip_t ip, addr_ip_t mask,
+                        addr_ip_t next_hop, uint32_t oq ) {
+    true_or_die( index < FWD_MODEL_LPM_DEPTH, "Error: bad LPM index %u", index );
+    model->lpm[index].ip = ip;
+    model->lpm[index].mask = mask;
+    model->lpm[index].next_hop = next_hop;
+    model->lpm[index].oq = oq;
+}
+
+void fwd_model_set_arp( fwd_model_t* model, unsigned index,
+                        addr_ip_t ip, addr_mac_t mac ) {
+    true_or_die( index < FWD_MODEL_ARP_DEPTH, "Error: bad ARP index %u", index );
+    model->arp[index].ip = ip;
+    model->arp[index].mac = mac;
+}
+
+void fwd_model_set_filter( fwd_model_t* model, unsigned index, addr_ip_t ip ) {
+    true_or_die( index < FWD_MODEL_FILTER_DEPTH,
+                 "Error: bad filter index %u", index );
+    model->filter[index] = ip;
+}
+
+#ifdef _CPUMODE_
+int fwd_model_load_from_hw( fwd_model_t* model, int regs_fd ) {
+    uint32_t hi, lo, ip, mask, next_hop, oq;
+    unsigned i;
+    int err = 0;
+
+    fwd_model_init( model );
+
+    /* the MAC registers are laid out LOW, HIGH for each port in turn */
+    for( i=0; i<FWD_MODEL_NUM_PORTS; i++ ) {
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_MAC_0_HIGH + 8*i, &hi );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_MAC_0_LOW + 8*i, &lo );
+        mac_set_hi( &model->mac[i], hi );
+        mac_set_lo( &model->mac[i], lo );
+    }
+
+    for( i=0; i<FWD_MODEL_FILTER_DEPTH; i++ ) {
+        err |= writeReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_FILTER_RD_ADDR, i );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_FILTER_IP, &ip );
+        model->filter[i] = htonl( ip );
+    }
+
+    for( i=0; i<FWD_MODEL_LPM_DEPTH; i++ ) {
+        err |= writeReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_LPM_RD_ADDR, i );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_LPM_IP, &ip );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_LPM_IP_MASK, &mask );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_LPM_NEXT_HOP_IP, &next_hop );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_LPM_OQ, &oq );
+        fwd_model_set_lpm( model, i, htonl(ip), htonl(mask), htonl(next_hop), oq );
+    }
+
+    for( i=0; i<FWD_MODEL_ARP_DEPTH; i++ ) {
+        err |= writeReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_ARP_RD_ADDR, i );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_ARP_IP, &ip );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_ARP_MAC_HIGH, &hi );
+        err |= readReg( regs_fd, XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR1_ARP_MAC_LOW, &lo );
+        model->arp[i].ip = htonl( ip );
+        mac_set_hi( &model->arp[i].mac, hi );
+        mac_set_lo( &model->arp[i].mac, lo );
+    }
+
+    for( i=0; i<FWD_NUM_REASONS; i++ )
+        err |= readReg( regs_fd, fwd_counter_reg[i], &model->counter[i] );
+
+    return err;
+}
+#endif
+
+/** Returns the ones-complement sum of the IP header (0xFFFF if it is valid). */
+static uint16_t fwd_ip_sum( const byte* hdr ) {
+    uint32_t sum = 0;
+    unsigned i;
+
+    for( i=0; i<FWD_IP_HDR_LEN; i+=2 )
+        sum += (hdr[i] << 8) | hdr[i+1];
+
+    while( sum >> 16 )
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return sum;
+}
+
+static bool fwd_is_filtered( fwd_model_t* model, addr_ip_t dst ) {
+    unsigned i;
+    for( i=0; i<FWD_MODEL_FILTER_DEPTH; i++ )
+        if( model->filter[i] != 0 && model->filter[i] == dst )
+            return TRUE;
+
+    return FALSE;
+}
+
+/** the hardware LPM is a TCAM: the lowest-indexed matching row wins */
+static fwd_lpm_entry_t* fwd_lpm_lookup( fwd_model_t* model, addr_ip_t dst ) {
+    unsigned i;
+    for( i=0; i<FWD_MODEL_LPM_DEPTH; i++ )
+        if( ((dst ^ model->lpm[i].ip) & model->lpm[i].mask) == 0 )
+            return &model->lpm[i];
+
+    return NULL;
+}
+
+static fwd_arp_entry_t* fwd_arp_lookup( fwd_model_t* model, addr_ip_t ip ) {
+    unsigned i;
+    for( i=0; i<FWD_MODEL_ARP_DEPTH; i++ )
+        if( model->arp[i].ip != 0 && model->arp[i].ip == ip )
+            return &model->arp[i];
+
+    return NULL;
+}
+
+static void fwd_decide( fwd_result_t* result, fwd_verdict_t verdict,
+                        fwd_reason_t reason, uint32_t oq ) {
+    result->verdict = verdict;
+    result->reason = reason;
+    result->oq = oq;
+}
+
+void fwd_model_process( fwd_model_t* model,
+                        byte* frame, unsigned len,
+                        unsigned src_port, bool from_cpu,
+                        fwd_result_t* result ) {
+    static const addr_mac_t broadcast = { { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } };
+    struct ether_header* eth;
+    struct ip* iph;
+    fwd_lpm_entry_t* route;
+    fwd_arp_entry_t* arp;
+    addr_ip_t next_hop;
+    uint16_t sum;
+    int out_port;
+
+    true_or_die( src_port < FWD_MODEL_NUM_PORTS,
+                 "Error: bad source port %u", src_port );
+
+    eth = (struct ether_header*)frame;
+    iph = (struct ip*)(frame + FWD_ETH_HDR_LEN);
+
+    if( from_cpu )
+        fwd_decide( result, FWD_VERDICT_FORWARD, FWD_REASON_FROM_CPU,
+                    FWD_OQ_MAC(src_port) );
+    else if( len < FWD_ETH_HDR_LEN ||
+             (memcmp( eth->ether_dhost, &model->mac[src_port], ETH_ADDR_LEN ) != 0 &&
+              memcmp( eth->ether_dhost, &broadcast, ETH_ADDR_LEN ) != 0) )
+        fwd_decide( result, FWD_VERDICT_DROP, FWD_REASON_WRONG_DST_MAC, 0 );
+    else if( ntohs(eth->ether_type) != ETHERTYPE_IP )
+        fwd_decide( result, FWD_VERDICT_TO_CPU, FWD_REASON_NON_IP,
+                    FWD_OQ_CPU(src_port) );
+    else if( len < FWD_ETH_HDR_LEN + FWD_IP_HDR_LEN ||
+             iph->ip_v != 4 || iph->ip_hl != 5 )
+        fwd_decide( result, FWD_VERDICT_TO_CPU, FWD_REASON_OPTION_VER,
+                    FWD_OQ_CPU(src_port) );
+    else if( fwd_ip_sum( (byte*)iph ) != 0xFFFF )
+        fwd_decide( result, FWD_VERDICT_DROP, FWD_REASON_BAD_CHECKSUM, 0 );
+    else if( fwd_is_filtered( model, iph->ip_dst.s_addr ) )
+        fwd_decide( result, FWD_VERDICT_TO_CPU, FWD_REASON_DEST_IP_HIT,
+                    FWD_OQ_CPU(src_port) );
+    else if( iph->ip_ttl <= 1 )
+        fwd_decide( result, FWD_VERDICT_TO_CPU, FWD_REASON_BAD_TTL,
+                    FWD_OQ_CPU(src_port) );
+    else if( !(route = fwd_lpm_lookup( model, iph->ip_dst.s_addr )) )
+        fwd_decide( result, FWD_VERDICT_TO_CPU, FWD_REASON_LPM_MISS,
+                    FWD_OQ_CPU(src_port) );
+    else {
+        next_hop = route->next_hop ? route->next_hop : iph->ip_dst.s_addr;
+        arp = fwd_arp_lookup( model, next_hop );
+        out_port = fwd_oq_to_port( route->oq );
+        if( !arp || out_port < 0 )
+            fwd_decide( result, FWD_VERDICT_TO_CPU, FWD_REASON_ARP_MISS,
+                        FWD_OQ_CPU(src_port) );
+        else {
+            fwd_decide( result, FWD_VERDICT_FORWARD, FWD_REASON_FORWARDED,
+                        route->oq );
+
+            /* rewrite the frame as the hardware would put it on the wire */
+            memcpy( eth->ether_dhost, &arp->mac, ETH_ADDR_LEN );
+            memcpy( eth->ether_shost, &model->mac[out_port], ETH_ADDR_LEN );
+            iph->ip_ttl -= 1;
+            iph->ip_sum = 0;
+            sum = ~fwd_ip_sum( (byte*)iph );
+            iph->ip_sum = htons( sum );
+        }
+    }
+
+    model->counter[result->reason] += 1;
+}
+
+int fwd_oq_to_port( uint32_t oq ) {
+    unsigned i;
+    for( i=0; i<FWD_MODEL_NUM_PORTS; i++ )
+        if( oq & FWD_OQ_MAC(i) )
+            return i;
+
+    return -1;
+}
+
+const char* fwd_verdict_to_string( fwd_verdict_t verdict ) {
+    switch( verdict ) {
+    case FWD_VERDICT_FORWARD: return "forward";
+    case FWD_VERDICT_TO_CPU:  return "to-cpu";
+    case FWD_VERDICT_DROP:    return "drop";
+    default:                  return "?";
+    }
+}
+
+const char* fwd_reason_to_string( fwd_reason_t reason ) {
+    if( reason < FWD_NUM_REASONS )
+        return fwd_reason_name[reason];
+    else
+        return "?";
+}
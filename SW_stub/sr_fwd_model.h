@@ -0,0 +1,140 @@
+/*
+ * Filename: sr_fwd_model.h
+ * Purpose: Software model of the hardware output-port-lookup pipeline.
+ *
+ * The model holds the same tables the nf10_router_output_port_lookup pcore
+ * exposes through its registers (router MACs, destination IP filter, LPM and
+ * ARP tables) and replays the decisions the hardware makes for each frame,
+ * including the counter it increments.  It is used to differentially test the
+ * CPU-path router against what the hardware would have done with a packet.
+ */
+
+#ifndef SR_FWD_MODEL_H
+#define SR_FWD_MODEL_H
+
+#include "reg_defines.h"
+#include "sr_common.h"
+
+/** number of MAC (and CPU) ports the output-port-lookup block serves */
+#define FWD_MODEL_NUM_PORTS 4
+
+/** table depths, as synthesized into the hardware */
+#define FWD_MODEL_LPM_DEPTH    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_ROUTE_TABLE_DEPTH
+#define FWD_MODEL_ARP_DEPTH    XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_ARP_TABLE_DEPTH
+#define FWD_MODEL_FILTER_DEPTH XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_DST_IP_FILTER_TABLE_DEPTH
+
+/**
+ * One-hot output queue encoding used in TUSER and the LPM OQ register: MAC
+ * port i is bit 2i and the CPU queue associated with port i is bit 2i+1.
+ */
+#define FWD_OQ_MAC(port) (1U << (2*(port)))
+#define FWD_OQ_CPU(port) (1U << (2*(port)+1))
+
+/** what the pipeline did with a frame */
+typedef enum fwd_verdict_t {
+    FWD_VERDICT_FORWARD, /* sent out a MAC port */
+    FWD_VERDICT_TO_CPU,  /* sent up to software */
+    FWD_VERDICT_DROP     /* dropped */
+} fwd_verdict_t;
+
+/**
+ * Why the pipeline made its decision.  Each reason corresponds to exactly one
+ * hardware counter; the order below is the order the checks are applied in.
+ */
+typedef enum fwd_reason_t {
+    FWD_REASON_FROM_CPU,       /* PKT_SENT_FROM_CPU */
+    FWD_REASON_WRONG_DST_MAC,  /* PKT_DROPPED_WRONG_DST_MAC */
+    FWD_REASON_NON_IP,         /* PKT_SENT_CPU_NON_IP */
+    FWD_REASON_OPTION_VER,     /* PKT_SENT_CPU_OPTION_VER */
+    FWD_REASON_BAD_CHECKSUM,   /* PKT_DROPPED_CHECKSUM */
+    FWD_REASON_DEST_IP_HIT,    /* PKT_SENT_CPU_DEST_IP_HIT */
+    FWD_REASON_BAD_TTL,        /* PKT_SENT_TO_CPU_BAD_TTL */
+    FWD_REASON_LPM_MISS,       /* PKT_SENT_CPU_LPM_MISS */
+    FWD_REASON_ARP_MISS,       /* PKT_SENT_CPU_ARP_MISS */
+    FWD_REASON_FORWARDED,      /* PKT_FORWARDED */
+    FWD_NUM_REASONS
+} fwd_reason_t;
+
+/** an LPM table row; an invalid row is ip=0, mask=255.255.255.255 */
+typedef struct fwd_lpm_entry_t {
+    addr_ip_t ip;       /* nbo */
+    addr_ip_t mask;     /* nbo */
+    addr_ip_t next_hop; /* nbo; 0 => the destination is directly connected */
+    uint32_t  oq;       /* one-hot output queue */
+} fwd_lpm_entry_t;
+
+/** an ARP table row; an invalid row has ip=0 */
+typedef struct fwd_arp_entry_t {
+    addr_ip_t  ip;      /* nbo */
+    addr_mac_t mac;
+} fwd_arp_entry_t;
+
+/** the register state of the output-port-lookup block */
+typedef struct fwd_model_t {
+    addr_mac_t      mac[FWD_MODEL_NUM_PORTS];
+    addr_ip_t       filter[FWD_MODEL_FILTER_DEPTH]; /* nbo; 0 => invalid */
+    fwd_lpm_entry_t lpm[FWD_MODEL_LPM_DEPTH];
+    fwd_arp_entry_t arp[FWD_MODEL_ARP_DEPTH];
+
+    uint32_t counter[FWD_NUM_REASONS];
+} fwd_model_t;
+
+/** the outcome of running one frame through the model */
+typedef struct fwd_result_t {
+    fwd_verdict_t verdict;
+    fwd_reason_t  reason;
+    uint32_t      oq;     /* one-hot output queue (0 if dropped) */
+} fwd_result_t;
+
+/** Initializes the model with every table row invalid and counters zeroed. */
+void fwd_model_init( fwd_model_t* model );
+
+/** Zeroes the counters (equivalent to pulsing BAR0_RESET_CNTRS). */
+void fwd_model_reset_counters( fwd_model_t* model );
+
+/** Writes an LPM row, as add_LPM_table_entry() does in RouterLib.py. */
+void fwd_model_set_lpm( fwd_model_t* model, unsigned index,
+                        addr_ip_t ip, addr_ip_t mask,
+                        addr_ip_t next_hop, uint32_t oq );
+
+/** Writes an ARP row. */
+void fwd_model_set_arp( fwd_model_t* model, unsigned index,
+                        addr_ip_t ip, addr_mac_t mac );
+
+/** Writes a destination IP filter row. */
+void fwd_model_set_filter( fwd_model_t* model, unsigned index, addr_ip_t ip );
+
+#ifdef _CPUMODE_
+/**
+ * Loads the router MACs and every table row from the hardware registers using
+ * the RD_ADDR indirection the pcore provides.  The counters are loaded too.
+ *
+ * @return 0 on success, or non-zero if a register access failed
+ */
+int fwd_model_load_from_hw( fwd_model_t* model, int regs_fd );
+#endif
+
+/**
+ * Runs frame through the model exactly as the hardware would.  If the verdict
+ * is FWD_VERDICT_FORWARD, frame is rewritten in place (MACs, TTL and checksum)
+ * to match what the hardware puts on the wire.  The counter for the reason is
+ * incremented.
+ *
+ * @param src_port  port index (0..FWD_MODEL_NUM_PORTS-1) the frame came from
+ * @param from_cpu  whether the frame came from the CPU queue of src_port
+ */
+void fwd_model_process( fwd_model_t* model,
+                        byte* frame, unsigned len,
+                        unsigned src_port, bool from_cpu,
+                        fwd_result_t* result );
+
+/** Returns the port index of the first MAC port set in oq, or -1 if none. */
+int fwd_oq_to_port( uint32_t oq );
+
+/** Returns a short name for the verdict. */
+const char* fwd_verdict_to_string( fwd_verdict_t verdict );
+
+/** Returns the name of the hardware counter associated with reason. */
+const char* fwd_reason_to_string( fwd_reason_t reason );
+
+#endif /* SR_FWD_MODEL_H */
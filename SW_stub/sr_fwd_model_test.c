@@ -0,0 +1,490 @@
+/*
+ * Filename: sr_fwd_model_test.c
+ * Purpose: Differential test of the CPU-path router against the hardware
+ *          forwarding model.
+ *
+ * Each packet in a pcap is run through fwd_model_process() and through
+ * router_handle_packet().  This file stands in for sr_integration.c so that the
+ * frames the router sends are captured instead of written to the hardware.  A
+ * divergence is reported whenever:
+ *
+ *   - the model forwards a frame and the router does not forward the identical
+ *     frame out of the same port,
+ *   - the model drops a frame and the router sends anything at all, or
+ *   - the model sends a frame to the CPU and the router forwards it, unless it
+ *     was sent up because it has IP options, which the router forwards.
+ *
+ * The cost per packet of both the model and the router is reported at the end.
+ *
+ * Usage: test_fwd_model -i itable [-r rtable] [-a arptable] [-p port] [-v] pcap
+ *
+ *   itable    interfaces, one per line: name ip mask mac (as for sr -i).  The
+ *             n-th interface is hardware port n and its IP is put in the
+ *             destination IP filter.
+ *   rtable    routes, one per line: prefix next_hop mask interface (as written
+ *             by rtable.py).  Routes are written into the LPM table longest
+ *             prefix first, as the router must do for the hardware TCAM.
+ *   arptable  ARP entries, one per line: ip mac
+ *   port      port index the packets arrive on (default: 0)
+ *
+ * The router is given the same routes and ARP entries as the model.  A small
+ * capture covering each of the model's decisions is in testdata/fwd_model:
+ *
+ *   ./test_fwd_model -i testdata/fwd_model/itable -r testdata/fwd_model/rtable \
+ *                    -a testdata/fwd_model/arptable testdata/fwd_model/basic.pcap
+ */
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "sr_base_internal.h"
+#include "sr_common.h"
+#include "sr_dumper.h"
+#include "sr_fwd_model.h"
+#include "sr_integration.h"
+#include "sr_router.h"
+
+#define FRAME_MAX_LEN    2048
+#define MAX_CAPTURES     16
+
+/** a frame the router sent while handling the current packet */
+typedef struct capture_t {
+    byte frame[FRAME_MAX_LEN];
+    unsigned len;
+    interface_t* intf;
+} capture_t;
+
+static struct sr_instance the_sr;
+static capture_t captures[MAX_CAPTURES];
+static unsigned num_captures;
+static unsigned num_dropped_captures;
+
+/*----------------------------------------------------------------------------
+ * Integration layer stand-ins (see sr_integration.c)
+ *---------------------------------------------------------------------------*/
+
+struct sr_instance* get_sr() {
+    return &the_sr;
+}
+
+router_t* get_router() {
+    return the_sr.interface_subsystem;
+}
+
+void sr_integ_init( struct sr_instance* sr ) { }
+void sr_integ_hw_setup( struct sr_instance* sr ) { }
+void sr_integ_destroy( struct sr_instance* sr ) { }
+
+void sr_integ_input( struct sr_instance* sr,
+                     const uint8_t* packet /* borrowed */,
+                     unsigned int len,
+#if defined _CPUMODE_ || defined MININET_MODE
+                     interface_t* intf )
+#else
+                     const char* interface )
+#endif
+{
+    die( "Error: the differential test does not read from the network" );
+}
+
+int sr_integ_low_level_output( struct sr_instance* sr /* borrowed */,
+                               uint8_t* buf /* borrowed */,
+                               unsigned int len,
+                               interface_t* intf ) {
+    capture_t* c;
+
+    if( num_captures == MAX_CAPTURES || len > FRAME_MAX_LEN ) {
+        num_dropped_captures += 1;
+        return 0;
+    }
+
+    c = &captures[num_captures++];
+    memcpy( c->frame, buf, len );
+    c->len = len;
+    c->intf = intf;
+    return 0;
+}
+
+uint32_t sr_integ_findsrcip( uint32_t dest /* nbo */ ) {
+    return 0;
+}
+
+uint16_t sr_integ_findmtu( uint32_t dest /* nbo */ ) {
+    return 0;
+}
+
+uint32_t sr_integ_ip_output( struct pbuf* p /* given */,
+                             uint8_t  proto,
+                             uint32_t src, /* nbo */
+                             uint32_t dest /* nbo */ ) {
+    pbuf_free( p );
+    return 1;
+}
+
+/*----------------------------------------------------------------------------
+ * Table loading
+ *---------------------------------------------------------------------------*/
+
+static addr_mac_t parse_mac( const char* str, const char* filename ) {
+    unsigned o[6];
+    addr_mac_t mac;
+    unsigned i;
+
+    if( sscanf( str, "%X:%X:%X:%X:%X:%X", &o[0], &o[1], &o[2], &o[3], &o[4], &o[5] ) != 6 )
+        die( "Error: bad MAC %s in %s", str, filename );
+
+    for( i=0; i<ETH_ADDR_LEN; i++ )
+        mac.octet[i] = o[i];
+    return mac;
+}
+
+/**
+ * Adds the interfaces in filename to the router without opening any sockets
+ * and mirrors their MACs and IPs into the model's MAC and filter tables.
+ */
+static void load_intfs( router_t* router, fwd_model_t* model,
+                        const char* filename ) {
+    char line[512], str_name[SR_NAMELEN], str_ip[32], str_mask[32], str_mac[32];
+    interface_t* intf;
+    FILE* fp;
+
+    fp = fopen( filename, "r" );
+    if( !fp )
+        die( "Error: could not open interface file %s", filename );
+
+    while( fgets( line, 512, fp ) ) {
+        if( sscanf( line, "%31s %31s %31s %31s", str_name, str_ip, str_mask, str_mac ) != 4 )
+            continue;
+
+        true_or_die( router->num_interfaces < FWD_MODEL_NUM_PORTS,
+                     "Error: too many interfaces in %s", filename );
+        intf = &router->interface[router->num_interfaces];
+        strcpy( intf->name, str_name );
+        intf->ip = make_ip_addr( str_ip );
+        intf->subnet_mask = make_ip_addr( str_mask );
+        intf->mac = parse_mac( str_mac, filename );
+        intf->enabled = TRUE;
+        nbr_table_init( &intf->neighbors );
+#if defined MININET_MODE || defined _CPUMODE_
+        intf->hw_id = router->num_interfaces;
+        intf->hw_fd = -1;
+        pthread_mutex_init( &intf->hw_lock, NULL );
+#endif
+
+        model->mac[router->num_interfaces] = intf->mac;
+        fwd_model_set_filter( model, router->num_interfaces, intf->ip );
+        router->num_interfaces += 1;
+    }
+
+    fclose( fp );
+}
+
+static unsigned intf_index( router_t* router, const char* name ) {
+    unsigned i;
+    for( i=0; i<router->num_interfaces; i++ )
+        if( strcmp( router->interface[i].name, name ) == 0 )
+            return i;
+
+    die( "Error: unknown interface %s", name );
+    return 0;
+}
+
+static unsigned prefix_len( addr_ip_t mask ) {
+    uint32_t m = ntohl( mask );
+    unsigned n = 0;
+    while( m & 0x80000000 ) {
+        n += 1;
+        m <<= 1;
+    }
+    return n;
+}
+
+/**
+ * Writes the routes in filename into the LPM table, longest prefix first, and
+ * into the router's FIB.
+ */
+static void load_routes( router_t* router, fwd_model_t* model,
+                         const char* filename ) {
+    char line[512], str_prefix[32], str_next_hop[32], str_mask[32], str_intf[SR_NAMELEN];
+    fwd_lpm_entry_t routes[FWD_MODEL_LPM_DEPTH], tmp;
+    fib_hop_t hop;
+    unsigned num_routes, i, j;
+    FILE* fp;
+
+    fp = fopen( filename, "r" );
+    if( !fp )
+        die( "Error: could not open routing table %s", filename );
+
+    num_routes = 0;
+    while( fgets( line, 512, fp ) ) {
+        if( sscanf( line, "%31s %31s %31s %31s", str_prefix, str_next_hop, str_mask, str_intf ) != 4 )
+            continue;
+
+        true_or_die( num_routes < FWD_MODEL_LPM_DEPTH,
+                     "Error: too many routes in %s", filename );
+        routes[num_routes].mask = make_ip_addr( str_mask );
+        routes[num_routes].ip = make_ip_addr( str_prefix ) & routes[num_routes].mask;
+        routes[num_routes].next_hop = make_ip_addr( str_next_hop );
+        routes[num_routes].oq = FWD_OQ_MAC( intf_index( router, str_intf ) );
+        num_routes += 1;
+    }
+    fclose( fp );
+
+    pthread_rwlock_wrlock( &router->fib_lock );
+    for( i=0; i<num_routes; i++ ) {
+        hop.gw = routes[i].next_hop;
+        hop.intf = fwd_oq_to_port( routes[i].oq );
+        fib_set( &router->fib, routes[i].ip, routes[i].mask, &hop, 1 );
+    }
+    pthread_rwlock_unlock( &router->fib_lock );
+
+    /* stable insertion sort: longer prefixes must occupy lower TCAM rows */
+    for( i=1; i<num_routes; i++ ) {
+        tmp = routes[i];
+        for( j=i; j>0 && prefix_len(routes[j-1].mask) < prefix_len(tmp.mask); j-- )
+            routes[j] = routes[j-1];
+        routes[j] = tmp;
+    }
+
+    for( i=0; i<num_routes; i++ )
+        fwd_model_set_lpm( model, i, routes[i].ip, routes[i].mask,
+                           routes[i].next_hop, routes[i].oq );
+}
+
+/** Writes the entries in filename into the ARP table and the router's cache. */
+static void load_arp( router_t* router, fwd_model_t* model,
+                      const char* filename ) {
+    char line[512], str_ip[32], str_mac[32];
+    addr_mac_t mac;
+    addr_ip_t ip;
+    unsigned n;
+    FILE* fp;
+
+    fp = fopen( filename, "r" );
+    if( !fp )
+        die( "Error: could not open ARP table %s", filename );
+
+    n = 0;
+    while( fgets( line, 512, fp ) ) {
+        if( sscanf( line, "%31s %31s", str_ip, str_mac ) != 2 )
+            continue;
+
+        ip = make_ip_addr( str_ip );
+        mac = parse_mac( str_mac, filename );
+        fwd_model_set_arp( model, n++, ip, mac );
+
+        pthread_rwlock_wrlock( &router->arp_lock );
+        arp_add_static( &router->arp, ip, mac );
+        pthread_rwlock_unlock( &router->arp_lock );
+    }
+    fclose( fp );
+}
+
+/*----------------------------------------------------------------------------
+ * Comparison
+ *---------------------------------------------------------------------------*/
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Returns TRUE if frame is long enough to hold an IPv4 header and has one. */
+static bool is_ip_frame( const byte* frame, unsigned len ) {
+    return len >= ETH_HDR_LEN + sizeof(struct ip)
+        && ((const struct ether_header*)frame)->ether_type == htons( ETHERTYPE_IP );
+}
+
+/**
+ * Returns the captured frame which is a forwarded copy of the IPv4 packet in
+ * frame (same addresses and ID, TTL one lower), or NULL if there is none.
+ */
+static capture_t* find_forwarded( const byte* frame, unsigned len ) {
+    const struct ip* in;
+    const struct ip* out;
+    unsigned i;
+
+    if( !is_ip_frame( frame, len ) )
+        return NULL;
+    in = (const struct ip*)(frame + ETH_HDR_LEN);
+
+    for( i=0; i<num_captures; i++ ) {
+        if( !is_ip_frame( captures[i].frame, captures[i].len ) )
+            continue;
+        out = (const struct ip*)(captures[i].frame + ETH_HDR_LEN);
+        if( out->ip_src.s_addr == in->ip_src.s_addr &&
+            out->ip_dst.s_addr == in->ip_dst.s_addr &&
+            out->ip_id == in->ip_id &&
+            out->ip_p == in->ip_p &&
+            out->ip_ttl + 1 == in->ip_ttl )
+            return &captures[i];
+    }
+
+    return NULL;
+}
+
+static void usage( const char* argv0 ) {
+    fprintf( stderr, "Usage: %s -i itable [-r rtable] [-a arptable] [-p port] [-v] pcap\n",
+             argv0 );
+    exit( 1 );
+}
+
+int main( int argc, char** argv ) {
+    const char *itable = NULL, *rtable = NULL, *arptable = NULL;
+    static byte frame[FRAME_MAX_LEN], model_frame[FRAME_MAX_LEN];
+    unsigned src_port = 0, num_pkts = 0, num_diverged = 0, i;
+    unsigned sw_forwarded = 0;
+    uint64_t model_nsec = 0, router_nsec = 0, t;
+    struct pcap_pkthdr hdr;
+    fwd_model_t model;
+    fwd_result_t res;
+    packet_info_t* pi;
+    capture_t* fwd;
+    router_t* router;
+    bool verbose = FALSE, diverged;
+    int len, port, c;
+    FILE* fp;
+
+    while( (c = getopt( argc, argv, "i:r:a:p:v" )) != EOF ) {
+        switch( c ) {
+        case 'i': itable = optarg; break;
+        case 'r': rtable = optarg; break;
+        case 'a': arptable = optarg; break;
+        case 'p': src_port = atoi( optarg ); break;
+        case 'v': verbose = TRUE; break;
+        default:  usage( argv[0] );
+        }
+    }
+    if( optind != argc - 1 )
+        usage( argv[0] );
+
+    debug_pthread_init_init();
+    debug_pthread_init( "Main", "Differential Test Thread" );
+    sys_thread_init();
+
+    router = malloc_or_die( sizeof(*router) );
+    router->sr = &the_sr;
+    router_init( router );
+
+    /* only the packets under test may be sent */
+    pthread_mutex_lock( &router->ospf_lock );
+    router->use_ospf = FALSE;
+    pthread_mutex_unlock( &router->ospf_lock );
+    memset( &the_sr, 0, sizeof(the_sr) );
+    the_sr.interface_subsystem = router;
+    the_sr.hw_init = 1;
+
+    fwd_model_init( &model );
+#ifdef _CPUMODE_
+    if( !itable ) {
+        true_or_die( fwd_model_load_from_hw( &model, router->netfpga_regs ) == 0,
+                     "Error: failed to read the forwarding tables from the hardware" );
+        fwd_model_reset_counters( &model );
+    }
+#endif
+    if( itable )
+        load_intfs( router, &model, itable );
+    if( rtable )
+        load_routes( router, &model, rtable );
+    if( arptable )
+        load_arp( router, &model, arptable );
+
+    true_or_die( router->num_interfaces > 0, "Error: no interfaces (use -i)" );
+    true_or_die( src_port < router->num_interfaces,
+                 "Error: no interface for port %u", src_port );
+
+    fp = sr_dump_read_open( argv[optind] );
+    if( !fp )
+        return 1;
+
+    while( (len = sr_dump_read( fp, &hdr, frame, FRAME_MAX_LEN )) >= 0 ) {
+        num_pkts += 1;
+
+        /* what would the hardware do? */
+        memcpy( model_frame, frame, len );
+        t = now_nsec();
+        fwd_model_process( &model, model_frame, len, src_port, FALSE, &res );
+        model_nsec += now_nsec() - t;
+
+        /* what does the software router do? (it frees pi and its buffer) */
+        num_captures = 0;
+        pi = malloc_or_die( sizeof(*pi) );
+        pi->router = router;
+        pi->len = len;
+        pi->interface = &router->interface[src_port];
+        pi->buf = malloc_or_die( PACKET_HEADROOM + len );
+        pi->packet = pi->buf + PACKET_HEADROOM;
+        memcpy( pi->packet, frame, len );
+
+        t = now_nsec();
+        router_handle_packet( pi );
+        router_nsec += now_nsec() - t;
+
+        fwd = find_forwarded( frame, len );
+        if( fwd )
+            sw_forwarded += 1;
+
+        switch( res.verdict ) {
+        case FWD_VERDICT_FORWARD:
+            port = fwd_oq_to_port( res.oq );
+            diverged = !fwd
+                || fwd->intf != &router->interface[port]
+                || fwd->len != len
+                || memcmp( fwd->frame, model_frame, len ) != 0;
+            break;
+
+        case FWD_VERDICT_DROP:
+            diverged = ( num_captures > 0 );
+            break;
+
+        case FWD_VERDICT_TO_CPU:
+        default:
+            diverged = ( fwd != NULL && res.reason != FWD_REASON_OPTION_VER );
+            break;
+        }
+
+        if( diverged || verbose ) {
+            printf( "%s packet %u (%u bytes): hw=%s (%s)",
+                    diverged ? "DIVERGED" : "ok      ", num_pkts, len,
+                    fwd_verdict_to_string( res.verdict ),
+                    fwd_reason_to_string( res.reason ) );
+            if( res.verdict == FWD_VERDICT_FORWARD )
+                printf( " via %s", router->interface[fwd_oq_to_port( res.oq )].name );
+            if( fwd )
+                printf( "; sw=forward via %s\n", fwd->intf->name );
+            else
+                printf( "; sw=no forward (%u frames sent)\n", num_captures );
+        }
+        if( diverged )
+            num_diverged += 1;
+    }
+    sr_dump_close( fp );
+
+    printf( "\n%u packets, %u diverged, %u forwarded by software\n",
+            num_pkts, num_diverged, sw_forwarded );
+    if( num_dropped_captures )
+        printf( "(%u router output frames were not captured)\n",
+                num_dropped_captures );
+
+    printf( "\nModel counters:\n" );
+    for( i=0; i<FWD_NUM_REASONS; i++ )
+        printf( "  %-26s %u\n", fwd_reason_to_string( i ), model.counter[i] );
+
+    if( num_pkts ) {
+        printf( "\nCost per packet:\n" );
+        printf( "  model                      %.1f ns\n", (double)model_nsec / num_pkts );
+        printf( "  router_handle_packet       %.1f ns\n", (double)router_nsec / num_pkts );
+    }
+
+    router_destroy( router );
+    return num_diverged ? 2 : 0;
+}
@@ -0,0 +1,177 @@
+/* Filename: sr_hw_stats.c */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "common/nf10util.h"
+#include "reg_defines.h"
+#include "sr_hw_stats.h"
+
+/** first register of the consecutive counter block */
+#define HW_STATS_FIRST_REG XPAR_NF10_ROUTER_OUTPUT_PORT_LOOKUP_0_BAR0_PKT_DROPPED_WRONG_DST_MAC
+
+static const char* hw_counter_name[HW_NUM_COUNTERS] = {
+    "PKT_DROPPED_WRONG_DST_MAC",
+    "PKT_SENT_CPU_LPM_MISS",
+    "PKT_SENT_CPU_ARP_MISS",
+    "PKT_SENT_CPU_NON_IP",
+    "PKT_DROPPED_CHECKSUM",
+    "PKT_FORWARDED",
+    "PKT_SENT_CPU_DEST_IP_HIT",
+    "PKT_SENT_TO_CPU_BAD_TTL",
+    "PKT_SENT_CPU_OPTION_VER",
+    "PKT_SENT_FROM_CPU",
+};
+
+/** Entry point for the poller thread. */
+static void* hw_stats_thread_main( void* vstats );
+
+void hw_stats_init( hw_stats_t* stats, int regs_fd, unsigned interval_ms ) {
+    memset( stats, 0, sizeof(*stats) );
+    stats->regs_fd = regs_fd;
+    stats->interval_ms = interval_ms ? interval_ms : HW_STATS_DEFAULT_INTERVAL_MS;
+
+    pthread_mutex_init( &stats->lock, NULL );
+    pthread_cond_init( &stats->cond_done, NULL );
+    stats->done = FALSE;
+
+    /* joinable, so that destroy can wait for it to stop using the lock */
+    true_or_die( pthread_create( &stats->thread, NULL,
+                                 hw_stats_thread_main, stats ) == 0,
+                 "Error: unable to start the HW stats poller thread" );
+}
+
+void hw_stats_destroy( hw_stats_t* stats ) {
+    pthread_mutex_lock( &stats->lock );
+    stats->done = TRUE;
+    pthread_cond_signal( &stats->cond_done );
+    pthread_mutex_unlock( &stats->lock );
+
+    /* the poller wakes immediately, but may be mid-read */
+    pthread_join( stats->thread, NULL );
+
+    pthread_mutex_destroy( &stats->lock );
+    pthread_cond_destroy( &stats->cond_done );
+}
+
+/**
+ * Samples the counters once and publishes the result.  Only the poller thread
+ * calls this, so there is a single writer.
+ */
+static void hw_stats_sample( hw_stats_t* stats ) {
+    uint32_t raw[HW_NUM_COUNTERS];
+    hw_stats_snapshot_t next;
+    double elapsed;
+    unsigned i;
+
+    if( readRegs( stats->regs_fd, HW_STATS_FIRST_REG, HW_NUM_COUNTERS, raw ) ) {
+        stats->read_errors += 1;
+        return;
+    }
+
+    next = stats->snap;
+    gettimeofday( &next.time, NULL );
+
+    if( next.num_samples == 0 ) {
+        for( i=0; i<HW_NUM_COUNTERS; i++ ) {
+            next.total[i] = raw[i];
+            next.rate[i] = 0;
+        }
+    }
+    else {
+        elapsed = (next.time.tv_sec - stats->snap.time.tv_sec)
+                + (next.time.tv_usec - stats->snap.time.tv_usec) / 1000000.0;
+
+        for( i=0; i<HW_NUM_COUNTERS; i++ ) {
+            /* unsigned subtraction handles the 32-bit counter wrapping */
+            uint32_t delta = raw[i] - stats->last_raw[i];
+            next.total[i] += delta;
+            next.rate[i] = elapsed > 0 ? delta / elapsed : 0;
+        }
+    }
+    next.num_samples += 1;
+    memcpy( stats->last_raw, raw, sizeof(raw) );
+
+    /* publish: readers retry if they see an odd or changed sequence number */
+    stats->seq += 1;
+    __sync_synchronize();
+    stats->snap = next;
+    __sync_synchronize();
+    stats->seq += 1;
+}
+
+static void* hw_stats_thread_main( void* vstats ) {
+    hw_stats_t* stats = (hw_stats_t*)vstats;
+    struct timespec wake;
+
+    debug_pthread_init( "HW Stats", "HW Stats Poller Thread" );
+
+    pthread_mutex_lock( &stats->lock );
+    while( !stats->done ) {
+        pthread_mutex_unlock( &stats->lock );
+        hw_stats_sample( stats );
+        pthread_mutex_lock( &stats->lock );
+
+        clock_gettime( CLOCK_REALTIME, &wake );
+        wake.tv_sec  += stats->interval_ms / 1000;
+        wake.tv_nsec += (stats->interval_ms % 1000) * 1000000;
+        if( wake.tv_nsec >= 1000000000 ) {
+            wake.tv_sec  += 1;
+            wake.tv_nsec -= 1000000000;
+        }
+
+        while( !stats->done &&
+               pthread_cond_timedwait( &stats->cond_done, &stats->lock, &wake ) != ETIMEDOUT );
+    }
+    pthread_mutex_unlock( &stats->lock );
+    debug_println( "HW Stats Poller Thread shutting down" );
+
+    return NULL;
+}
+
+void hw_stats_read( hw_stats_t* stats, hw_stats_snapshot_t* snap ) {
+    unsigned seq;
+
+    do {
+        while( (seq = stats->seq) & 1 )
+            sched_yield();
+        __sync_synchronize();
+        *snap = stats->snap;
+        __sync_synchronize();
+    } while( seq != stats->seq );
+}
+
+const char* hw_counter_to_string( hw_counter_t c ) {
+    if( c >= HW_NUM_COUNTERS )
+        return "unknown";
+    return hw_counter_name[c];
+}
+
+int hw_stats_to_string( hw_stats_t* stats, char* buf, int len ) {
+    hw_stats_snapshot_t snap;
+    unsigned i, n, ret;
+
+    hw_stats_read( stats, &snap );
+    if( snap.num_samples == 0 )
+        return my_snprintf( buf, len, "HW counters have not been sampled yet\n" );
+
+    ret = my_snprintf( buf, len, "%-26s %20s %14s\n",
+                       "Counter", "Total", "Rate (pkt/s)" );
+    if( !ret ) return 0;
+    n = ret;
+
+    for( i=0; i<HW_NUM_COUNTERS; i++ ) {
+        ret = my_snprintf( buf+n, len-n, "%-26s %20llu %14.1f\n",
+                           hw_counter_name[i],
+                           (unsigned long long)snap.total[i], snap.rate[i] );
+        if( !ret ) return 0;
+        n += ret;
+    }
+
+    ret = my_snprintf( buf+n, len-n, "(sampled every %ums, %u samples, %u read errors)\n",
+                       stats->interval_ms, snap.num_samples, stats->read_errors );
+    if( !ret ) return 0;
+    return n + ret;
+}
@@ -0,0 +1,95 @@
+/*
+ * Filename: sr_hw_stats.h
+ * Purpose: Background sampling of the output-port-lookup counters.
+ *
+ * A poller thread reads every counter with a single batched register read at a
+ * fixed interval, extends them to 64 bits, computes per-second rates and
+ * publishes the result under a sequence lock.  Readers (the CLI, exporters)
+ * copy the latest snapshot without taking a lock or touching the card, so
+ * looking at the statistics does not perturb them.
+ */
+
+#ifndef SR_HW_STATS_H
+#define SR_HW_STATS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "sr_common.h"
+
+/** default sampling interval */
+#define HW_STATS_DEFAULT_INTERVAL_MS 1000
+
+/**
+ * The counters, in the order they appear in BAR0 (PKT_DROPPED_WRONG_DST_MAC
+ * through PKT_SENT_FROM_CPU are consecutive registers).
+ */
+typedef enum hw_counter_t {
+    HW_CNT_WRONG_DST_MAC,
+    HW_CNT_LPM_MISS,
+    HW_CNT_ARP_MISS,
+    HW_CNT_NON_IP,
+    HW_CNT_BAD_CHECKSUM,
+    HW_CNT_FORWARDED,
+    HW_CNT_DEST_IP_HIT,
+    HW_CNT_BAD_TTL,
+    HW_CNT_OPTION_VER,
+    HW_CNT_FROM_CPU,
+    HW_NUM_COUNTERS
+} hw_counter_t;
+
+/** one published sample */
+typedef struct hw_stats_snapshot_t {
+    struct timeval time;                /* when the sample was taken */
+    unsigned num_samples;               /* 0 => nothing sampled yet */
+    uint64_t total[HW_NUM_COUNTERS];    /* since the poller started */
+    double   rate[HW_NUM_COUNTERS];     /* per second over the last interval */
+} hw_stats_snapshot_t;
+
+/** the counter service */
+typedef struct hw_stats_t {
+    /* published state: seq is odd while the poller is updating snap */
+    volatile unsigned seq;
+    hw_stats_snapshot_t snap;
+
+    /* poller state */
+    int regs_fd;
+    unsigned interval_ms;
+    uint32_t last_raw[HW_NUM_COUNTERS];
+    unsigned read_errors;
+
+    pthread_t       thread;    /* the poller, joined by hw_stats_destroy() */
+    pthread_mutex_t lock;      /* protects done */
+    pthread_cond_t  cond_done;
+    bool done;
+} hw_stats_t;
+
+/**
+ * Initializes stats and starts the poller thread, which samples the counters
+ * through regs_fd every interval_ms milliseconds.
+ */
+void hw_stats_init( hw_stats_t* stats, int regs_fd, unsigned interval_ms );
+
+/** Stops the poller thread and releases the resources held by stats. */
+void hw_stats_destroy( hw_stats_t* stats );
+
+/**
+ * Copies the most recently published sample into snap.  Never blocks the
+ * poller and never touches the hardware; safe to call from any thread.
+ */
+void hw_stats_read( hw_stats_t* stats, hw_stats_snapshot_t* snap );
+
+/** Returns the name of the hardware register backing counter c. */
+const char* hw_counter_to_string( hw_counter_t c );
+
+#define STR_HW_STATS_MAX_LEN (80*(HW_NUM_COUNTERS+3))
+
+/**
+ * Fills buf with a table of the latest sample.  It takes up to
+ * STR_HW_STATS_MAX_LEN characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int hw_stats_to_string( hw_stats_t* stats, char* buf, int len );
+
+#endif /* SR_HW_STATS_H */
@@ -9,6 +9,8 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
 #include "sr_base_internal.h"
 
 #ifdef _CPUMODE_
@@ -22,6 +24,16 @@
 #include "sr_thread.h"
 #include "sr_work_queue.h"
 #include "sr_dumper.h"
+#include "lwip/opt.h"
+#include "lwip/pbuf.h"
+
+#if PBUF_IP_HLEN + PBUF_LINK_HLEN < ROUTER_SEND_HEADROOM
+#error "lwtcp's PBUF_LINK_HLEN leaves no room for the Ethernet and tunnel headers"
+#endif
+
+#ifdef _CPUMODE_
+#define DECAP_NEXT_INTF 1 /* nf2c1 because it has the rate limiter */
+#endif
 
 /**
  * First method called during router initialization.
@@ -31,11 +43,12 @@ void sr_integ_init(struct sr_instance* sr) {
     debug_println( "Initializing the router subsystem" );
 
     router_t* subsystem = malloc_or_die( sizeof(router_t) );
+    subsystem->sr = sr;
     router_init( subsystem );
 #ifdef MININET_MODE
     subsystem->name = sr->router_name;      // router name (e.g. r0), needed for
 #endif                                      // interface initialisation
-    sr_set_subsystem( sr_get_global_instance(0), subsystem );
+    sr_set_subsystem( sr, subsystem );
 }
 
 /**
@@ -44,7 +57,25 @@ void sr_integ_init(struct sr_instance* sr) {
  * protocol) which require interface information during initialization.
  */
 void sr_integ_hw_setup( struct sr_instance* sr ) {
+    router_t* router = sr->interface_subsystem;
+
     debug_println( "Performing post-hw setup initialization" );
+
+    /* pick up where a previous run of this router left off */
+    router_restore( router, router_now_ms() );
+
+#ifdef _CPUMODE_
+    /* terminate IP-in-IP tunnels arriving on any port and send them on (more
+       may be configured with "ip decap add") */
+    if( router->num_interfaces > DECAP_NEXT_INTF ) {
+        pthread_rwlock_wrlock( &router->decap_lock );
+        decap_add_tunnel( &router->decap, IPPROTO_IPIP, 0, ~0U, DECAP_INNER_IP,
+                          &router->interface[DECAP_NEXT_INTF] );
+        decap_add_tunnel( &router->decap, 0xF4, 0, ~0U, DECAP_INNER_IP,
+                          &router->interface[DECAP_NEXT_INTF] );
+        pthread_rwlock_unlock( &router->decap_lock );
+    }
+#endif
 }
 
 /**
@@ -76,8 +107,9 @@ void sr_integ_input(struct sr_instance* sr,
     pi->len = len;
     pi->interface = intf;
 
-    /* copy the (Ethernet) packet itself */
-    pi->packet = malloc_or_die( len ); /* freed by router_pthread_main */
+    /* copy the (Ethernet) packet itself, leaving room to encapsulate it */
+    pi->buf = malloc_or_die( PACKET_HEADROOM + len ); /* freed by router_pthread_main */
+    pi->packet = pi->buf + PACKET_HEADROOM;
     memcpy( pi->packet, packet, len );
 
 #ifdef _THREAD_PER_PACKET_
@@ -86,7 +118,7 @@ void sr_integ_input(struct sr_instance* sr,
     make_thread( router_pthread_main, pi );
 #else
     /* put the packet on the work queue */
-    wq_enqueue( &pi->router->work_queue, WORK_NEW_PACKET, pi );
+    wq_enqueue( pi->router->work_queue, WORK_NEW_PACKET, pi );
 #endif
 }
 
@@ -129,31 +161,79 @@ int sr_integ_low_level_output(struct sr_instance* sr /* borrowed */,
 /** For memory deallocation pruposes on shutdown. */
 void sr_integ_destroy(struct sr_instance* sr) {
     debug_println("Cleaning up the router for shutdown");
+
+    /* other instances may keep running, so release this one's router */
+    router_destroy( sr->interface_subsystem );
+    free( sr->interface_subsystem );
+    sr_set_subsystem( sr, NULL );
 }
 
 /**
  * Called by the transport layer for outgoing packets generated by the
- * router.  Expects source address in network byte order.
+ * router.  Returns the address of the interface dest is reached through, in
+ * network byte order, on the router the calling thread serves (the first one
+ * for lwtcp's own thread).
  *
  * @return 0 on failure to find a route to dest.
  */
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */) {
-	return 0;
+    router_t* router = get_router();
+    interface_t* intf;
+    unsigned i;
+
+    for( i=0; i<router->num_interfaces; i++ ) {
+        intf = &router->interface[i];
+        if( ((intf->ip ^ dest) & intf->subnet_mask) == 0 )
+            return intf->ip;
+    }
+
+    intf = router_lookup_interface_via_ip( router, dest );
+    return intf ? intf->ip : 0;
+}
+
+/**
+ * Called by the transport layer to size the segments it sends to dest.  Which of
+ * the route's equal-cost next hops a connection's flow hashes to is not known
+ * here, so this is the smallest MTU among them; a tunnelled interface carries
+ * ENCAP_HDR_LEN fewer bytes than ETH_MTU.
+ *
+ * @return the MTU of the path to dest, or 0 if there is no route.
+ */
+uint16_t sr_integ_findmtu(uint32_t dest /* nbo */) {
+    return router_route_mtu( get_router(), dest );
 }
 
 /**
  * Called by the transport layer for outgoing packets that need IP
- * encapsulation.
+ * encapsulation.  p's payload is preceded by room for the IP header and
+ * PBUF_LINK_HLEN bytes more, so the IP, Ethernet and any tunnel headers are
+ * added in place, in front of the payload, rather than by copying it.
+ *
+ * The packet is sent by the router which owns src, since lwtcp is shared by
+ * every router in the process (see sr_base.c).
  *
- * @return 0 on success or waiting for MAC and then will try to send it,
- *         and 1 on failure.
+ * p may be lwtcp's own retransmission copy of the segment (see
+ * sr_lwip_output()), which lwtcp rewrites in place when it resends it, so the
+ * packet is transmitted before this returns and p is freed straight away; it
+ * must never be queued.  A packet to a next hop whose MAC is not known is
+ * dropped once an ARP request is sent, and TCP sends it again.
+ *
+ * @return 0 on success, and 1 if no router owns src, there is no route to
+ *         dest or its next hop's MAC is not known.
  */
-uint32_t sr_integ_ip_output(uint8_t* payload /* given */,
+uint32_t sr_integ_ip_output(struct pbuf* p /* given */,
                             uint8_t  proto,
                             uint32_t src, /* nbo */
-                            uint32_t dest, /* nbo */
-                            int len) {
-    bool ret=1;
-
-    return( ret ? 0 : 1 );
+                            uint32_t dest /* nbo */) {
+    struct sr_instance* sr = sr_get_instance_via_ip( src );
+    int ret = -1;
+
+    if( sr && p->next == NULL && pbuf_header( p, ROUTER_SEND_HEADROOM ) == 0 ) {
+        pbuf_header( p, -ROUTER_SEND_HEADROOM );
+        ret = router_send_ip( sr->interface_subsystem, p->payload, p->len, proto,
+                              IPDEFTTL, src, dest, NULL );
+    }
+
+    pbuf_free( p );
+    return( ret == 0 ? 0 : 1 );
 }
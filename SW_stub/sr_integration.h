@@ -8,10 +8,13 @@
 
 #include "sr_interface.h"
 
-/** returns a pointer to the global sr (only valid after it is initialized) */
+/**
+ * returns a pointer to the sr the calling thread serves, or the first one if
+ * it serves none (only valid after it is initialized)
+ */
 struct sr_instance* get_sr();
 
-/** returns a pointer to the global router subsystem */
+/** returns a pointer to the router subsystem of get_sr() */
 router_t* get_router();
 
 int sr_integ_low_level_output( struct sr_instance* sr /* borrowed */,
@@ -22,4 +25,8 @@ int sr_integ_low_level_output( struct sr_instance* sr /* borrowed */,
 /** returns the ip of the interface this will be sent via */
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
 
+/** returns the MTU of the path to dest (less the outer header on tunnelled
+ *  interfaces), or 0 if there is no route */
+uint16_t sr_integ_findmtu(uint32_t dest /* nbo */);
+
 #endif /* INTEGRATION_H */
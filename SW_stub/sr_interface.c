@@ -81,17 +81,23 @@ int intf_to_string( interface_t* intf, char* buf, int len ) {
     return my_snprintf( buf, len, STR_INTF_FORMAT, name, mac, ip, status );
 }
 
-/* 82 bytes */
-#define STR_NEIGHBOR_FORMAT "  %-15s  %-15s  %-18s  %-24s\n"
-
 int intf_neighbor_header_to_string( char* buf, int len ) {
-    return my_snprintf( buf, len, STR_NEIGHBOR_FORMAT,
+    return my_snprintf( buf, len, STR_NBR_FORMAT,
                         "Neighbor IP", "Neighbor Rtr ID", "Subnet",
                         "Last Hello Time" );
 }
 
-int intf_neighbor_to_string( interface_t* intf, char* buf, int len ) {
-        return 0;
+int intf_neighbor_to_string( interface_t* intf, uint64_t now_ms,
+                             char* buf, int len ) {
+    int n, ret;
+
+    n = intf_to_string( intf, buf, len );
+    if( !n ) return 0;
+
+    ret = nbr_table_to_string( &intf->neighbors, intf->ip & intf->subnet_mask,
+                               intf->subnet_mask, now_ms, buf+n, len-n );
+    if( !ret && intf->neighbors.num_neighbors ) return 0;
+    return n + ret;
 }
 
 #ifdef _CPUMODE_
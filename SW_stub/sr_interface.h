@@ -8,10 +8,10 @@
 
 #include <pthread.h>
 #include "sr_common.h"
+#include "sr_pwospf_nbr.h"
 #define SR_NAMELEN 32
 
 /* forward declaration */
-struct neighbor_t;
 struct router_t;
 
 /** holds info about a router's interface */
@@ -40,7 +40,7 @@ typedef struct {
     pthread_mutex_t hw_lock; /* lock to prevent issues w/ multiple writers */
 #endif /* MININET_MODE || _CPU_MODE_ */
 
-    struct neighbor_t* neighbor_list_head; /* neighboring nodes */
+    nbr_table_t neighbors; /* PWOSPF neighbors, by router ID */
 } interface_t;
 
 /**
@@ -79,12 +79,18 @@ int intf_header_to_string( char* buf, int len );
  */
 int intf_to_string( interface_t* intf, char* buf, int len );
 
-#define STR_MAX_NEIGHBORS     32
-#define STR_INTF_NEIGHBOR_MAX_LEN  (82*(STR_MAX_NEIGHBORS+1))
+#define STR_INTF_NEIGHBOR_HDR_MAX_LEN 83
+#define STR_INTF_NEIGHBOR_MAX_LEN(intf) \
+    (STR_INTF_MAX_LEN + STR_NBR_TABLE_MAX_LEN(&(intf)->neighbors))
 int intf_neighbor_header_to_string( char* buf, int len );
 
-/** intf_to_string along with the neighors */
-int intf_neighbor_to_string( interface_t* intf, char* buf, int len );
+/**
+ * intf_to_string along with the neighbors, showing how long before now_ms each
+ * was last heard from.  It takes up to STR_INTF_NEIGHBOR_MAX_LEN(intf)
+ * characters.
+ */
+int intf_neighbor_to_string( interface_t* intf, uint64_t now_ms,
+                             char* buf, int len );
 
 #ifdef _CPUMODE_
 #define STR_INTF_HW_MAX_LEN 1024 /* actual max is 775; this provides some slop */
@@ -10,6 +10,8 @@
  *---------------------------------------------------------------------------*/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #ifdef _SOLARIS_
@@ -30,24 +32,45 @@
 #include "sr_base_internal.h"
 
 
-void sr_transport_input(uint8_t* packet /* borrowed */)
-{
-    struct pbuf* pb;
-    struct netif inp;
+/*-----------------------------------------------------------------------------
+ * Method: sr_transport_input(..)
+ * Scope:  Global
+ *
+ * Called by the router sr to pass a received IP packet (at packet, in buf) to
+ * lwip.  The packet is not copied: lwip is handed a pbuf which refers to it
+ * in place, and buf is freed once lwip frees that pbuf.
+ *
+ * lwip is shared by every router in the process and replies leave through
+ * the router which owns their source address, so a packet is only taken from
+ * the router which owns its destination address.
+ *
+ *---------------------------------------------------------------------------*/
 
+void sr_transport_input(struct sr_instance* sr /* borrowed */,
+                        uint8_t* buf /* given */, uint8_t* packet /* in buf */)
+{
     /* -- this is sort of a hack for now, in the future we should
      *    initialize netif's with the hw information and pass handles
-     *    to them around with the packets
+     *    to them around with the packets.  It is static since the
+     *    transport thread reads it after this returns.
      *                                                            -- */
-    memset(&inp, sizeof(struct netif), 0);
+    static struct netif inp;
 
+    struct pbuf* pb;
     struct ip* header = (struct ip*)packet;
 
-    pb = pbuf_alloc(PBUF_RAW, ntohs(header->ip_len), PBUF_RAM);
-
-    pb->len = pb->tot_len = ntohs(header->ip_len);
+    if(sr_get_instance_via_ip(header->ip_dst.s_addr) != sr)
+    {
+        free(buf);
+        return;
+    }
 
-    memcpy(pb->payload,packet,pb->tot_len);
+    pb = pbuf_alloc_ref(buf, packet, ntohs(header->ip_len), free, buf);
+    if(pb == NULL)
+    {
+        free(buf);
+        return;
+    }
 
     tcp_msg_input(pb, &inp);
 } /* -- sr_transport_input -- */
@@ -67,6 +90,34 @@ uint32_t /*nbo*/ ip_route(struct ip_addr *dest)
     return  sr_integ_findsrcip(dest->addr);
 } /* -- ip_route -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: ip_route_mtu(..)
+ * Scope:  Global
+ *
+ * Called by lwip to size its segments to the MTU of the interface dest is
+ * routed out of.  Returns 0 if that is not known.
+ *
+ *---------------------------------------------------------------------------*/
+
+uint16_t ip_route_mtu(struct ip_addr *dest)
+{
+    return  sr_integ_findmtu(dest->addr);
+} /* -- ip_route_mtu -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_lwip_output_release(..)
+ * Scope:  Local
+ *
+ * Called when the router frees a pbuf lent to it by sr_lwip_output(..) to
+ * drop the reference it held to the segment.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_lwip_output_release(void* segment)
+{
+    pbuf_free((struct pbuf*)segment);
+} /* -- sr_lwip_output_release -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_lwip_output(..)
  * Scope: Global
@@ -81,34 +132,55 @@ uint32_t /*nbo*/ ip_route(struct ip_addr *dest)
  *
  *  sr_integ_ip_output(..)
  *
+ * lwip allocates its segments with PBUF_IP_HLEN + PBUF_LINK_HLEN bytes in
+ * front, so the router is lent the segment itself to prepend its headers to.
+ * It gets a pbuf of its own referring to the segment, since lwip keeps the
+ * segment for retransmission and moves its payload pointer.  Only a segment
+ * chained from several pbufs (data written without copying) is copied.
+ *
+ * Lending the segment relies on the router transmitting it before
+ * sr_integ_ip_output(..) returns: a retransmission rewrites the segment's
+ * headers in place, so a router which queued the pbuf (say, until an ARP
+ * reply came) would have to copy it first.
+ *
  *---------------------------------------------------------------------------*/
 
 err_t sr_lwip_output(struct pbuf *p, struct ip_addr *src, struct ip_addr *dst, uint8_t proto )
 {
     struct pbuf *q;
-    uint8_t* payload;
-    int offset = 0;
-
-    /* initiate transfer(); */
-
+    uint16_t offset = 0;
+    int headroom = PBUF_IP_HLEN + PBUF_LINK_HLEN;
 
-    payload = (uint8_t*)malloc(p->tot_len);
-
-    memcpy(payload + offset, p->payload, p->len);
-    offset += p->len;
-
-    for(q = p->next; q != NULL; q = q->next)
+    if(p->next == NULL && pbuf_header(p, headroom) == 0)
+    {
+        pbuf_header(p, -headroom);
+        pbuf_ref(p);
+        q = pbuf_alloc_ref((uint8_t*)p->payload - headroom, p->payload, p->len,
+                           sr_lwip_output_release, p);
+        if(q == NULL)
+        {
+            pbuf_free(p);
+            return ERR_MEM;
+        }
+    }
+    else
     {
-        memcpy(payload + offset, q->payload, q->len);
-        offset += q->len;
+        q = pbuf_alloc(PBUF_IP, p->tot_len, PBUF_RAM);
+        if(q == NULL)
+        { return ERR_MEM; }
+
+        for(; p != NULL; p = p->next)
+        {
+            memcpy((uint8_t*)q->payload + offset, p->payload, p->len);
+            offset += p->len;
+        }
     }
 
     sr_integ_ip_output(
-            payload, /*disown*/
+            q, /*disown*/
             proto,
             src->addr,
-            dst->addr,
-            p->tot_len);
+            dst->addr);
 
     return 0;
 } /* -- sr_lwip_output -- */
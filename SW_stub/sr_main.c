@@ -27,6 +27,7 @@
  *---------------------------------------------------------------------------*/
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include "cli/cli_main.h"
 #include "sr_base.h"
@@ -45,11 +46,21 @@ int original_main(int argc, char** argv)
 #endif
 {
 
+    int i, start;
+
     debug_pthread_init_init();
     debug_pthread_init( "Main", "Main Thread" );
 
-    /* start the low-level network subsystem */
-    sr_init_low_level_subystem(argc, argv);
+    /* start a low-level network subsystem for each router; the arguments of
+       several routers hosted by this process are separated by "--" */
+    for( start=i=1; i<=argc; i++ ) {
+        if( i == argc || strcmp( argv[i], "--" ) == 0 ) {
+            argv[start-1] = argv[0];
+            if( sr_init_low_level_subystem( i - start + 1, argv + start - 1 ) )
+                return 1;
+            start = i + 1;
+        }
+    }
 
     /* start the command-line interface (blocks until it terminates) */
     if( cli_main( CLI_PORT ) == CLI_ERROR )
@@ -0,0 +1,377 @@
+/*
+ * Filename: sr_mbox_bench.c
+ * Purpose: Measures how many messages a second lwtcp's mailboxes carry from
+ *          1, 2, 4 and 8 posting threads to the one thread fetching them.
+ *
+ * Each poster sends its numbered messages with sys_mbox_post() as fast as it
+ * can, and the fetcher takes them with sys_arch_mbox_fetch(); the rate is
+ * reported against a copy of the mailbox lwtcp used to have, a 100-slot array
+ * behind two semaphores built from mutexes and condition variables.  Every
+ * message sent must arrive exactly once and in the order its poster sent it.
+ * The old mailbox overwrote messages when full rather than make posters wait,
+ * so how many it lost is reported too.
+ *
+ * Then a full mailbox must turn away sys_mbox_trypost() and hold up a
+ * sys_mbox_post() until a message is fetched, and a fetch from an empty one
+ * must time out after as long as it was asked to wait, or return as soon as
+ * something is posted.
+ *
+ * Usage: mbox_bench [-n msgs_per_poster]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "lwip/opt.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+
+/** most threads posting at once */
+#define MAX_POSTERS 8
+
+/** how many messages the old mailbox held */
+#define OLD_MBOX_SIZE 100
+
+/** a message says which poster sent it and its number, from 1 */
+#define MSG( poster, seq ) ((void*)(((uintptr_t)(poster) << 24) | (seq)))
+#define MSG_POSTER( msg )  ((unsigned)((uintptr_t)(msg) >> 24))
+#define MSG_SEQ( msg )     ((uint32_t)(uintptr_t)(msg) & 0xffffff)
+
+/** a semaphore as lwtcp's old mailbox built it */
+typedef struct old_sem_t {
+    unsigned c;
+    pthread_cond_t cond;
+    pthread_mutex_t mutex;
+} old_sem_t;
+
+/** lwtcp's old mailbox */
+typedef struct old_mbox_t {
+    uint16_t first, last;
+    void* msgs[OLD_MBOX_SIZE];
+    old_sem_t mail;
+    old_sem_t mutex;
+} old_mbox_t;
+
+/** a mailbox under test, one kind or the other */
+typedef struct mbox_t {
+    sys_mbox_t  mbox;
+    old_mbox_t* old;
+} mbox_t;
+
+/** a thread posting */
+typedef struct poster_t {
+    pthread_t thread;
+    unsigned  id;
+    unsigned  msgs;
+    mbox_t*   mbox;
+} poster_t;
+
+static pthread_barrier_t barrier;
+static volatile unsigned posters_done;
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void old_sem_init( old_sem_t* sem, unsigned count ) {
+    sem->c = count;
+    pthread_cond_init( &sem->cond, NULL );
+    pthread_mutex_init( &sem->mutex, NULL );
+}
+
+static void old_sem_destroy( old_sem_t* sem ) {
+    pthread_cond_destroy( &sem->cond );
+    pthread_mutex_destroy( &sem->mutex );
+}
+
+/** Waits for sem as sys_arch_sem_wait() did; 0 if timeout ms pass first. */
+static unsigned old_sem_wait( old_sem_t* sem, unsigned timeout ) {
+    struct timeval tv;
+    struct timespec ts;
+
+    pthread_mutex_lock( &sem->mutex );
+    while( sem->c == 0 ) {
+        if( timeout > 0 ) {
+            gettimeofday( &tv, NULL );
+            ts.tv_sec = tv.tv_sec + timeout / 1000;
+            ts.tv_nsec = tv.tv_usec * 1000 + timeout % 1000 * 1000000;
+            if( ts.tv_nsec >= 1000000000 ) {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000;
+            }
+            if( pthread_cond_timedwait( &sem->cond, &sem->mutex, &ts ) != 0 ) {
+                pthread_mutex_unlock( &sem->mutex );
+                return 0;
+            }
+        }
+        else
+            pthread_cond_wait( &sem->cond, &sem->mutex );
+    }
+    sem->c -= 1;
+    pthread_mutex_unlock( &sem->mutex );
+    return 1;
+}
+
+static void old_sem_signal( old_sem_t* sem ) {
+    pthread_mutex_lock( &sem->mutex );
+    sem->c = 1;
+    pthread_cond_signal( &sem->cond );
+    pthread_mutex_unlock( &sem->mutex );
+}
+
+/** Posts msg as sys_mbox_post() did, overwriting if the mailbox is full. */
+static void old_mbox_post( old_mbox_t* mbox, void* msg ) {
+    int first;
+
+    old_sem_wait( &mbox->mutex, 0 );
+    mbox->msgs[mbox->last] = msg;
+    first = (mbox->last == mbox->first);
+    mbox->last = (mbox->last + 1) % OLD_MBOX_SIZE;
+    if( first )
+        old_sem_signal( &mbox->mail );
+    old_sem_signal( &mbox->mutex );
+}
+
+/** Fetches a message as sys_arch_mbox_fetch() did; 0 on timeout. */
+static unsigned old_mbox_fetch( old_mbox_t* mbox, void** msg, unsigned timeout ) {
+    old_sem_wait( &mbox->mutex, 0 );
+    while( mbox->first == mbox->last ) {
+        old_sem_signal( &mbox->mutex );
+        if( old_sem_wait( &mbox->mail, timeout ) == 0 )
+            return 0;
+        old_sem_wait( &mbox->mutex, 0 );
+    }
+    *msg = mbox->msgs[mbox->first];
+    mbox->first = (mbox->first + 1) % OLD_MBOX_SIZE;
+    old_sem_signal( &mbox->mutex );
+    return 1;
+}
+
+static void* poster_main( void* arg ) {
+    poster_t* p = arg;
+    uint32_t seq;
+
+    pthread_barrier_wait( &barrier );
+    for( seq=1; seq<=p->msgs; seq++ ) {
+        if( p->mbox->old )
+            old_mbox_post( p->mbox->old, MSG( p->id, seq ) );
+        else
+            sys_mbox_post( p->mbox->mbox, MSG( p->id, seq ) );
+    }
+    __sync_fetch_and_add( &posters_done, 1 );
+    return NULL;
+}
+
+/**
+ * Sends msgs messages from each of n posters through mbox and fetches them
+ * all, returning the messages per second.  Messages missing or out of order
+ * are counted in *lost and *misordered.
+ */
+static double run( mbox_t* mbox, unsigned n, unsigned msgs,
+                   uint64_t* lost, uint64_t* misordered ) {
+    static poster_t posters[MAX_POSTERS];
+    uint32_t last[MAX_POSTERS];
+    uint64_t t0, elapsed, got = 0;
+    unsigned i, from;
+    void* msg;
+
+    posters_done = 0;
+    memset( last, 0, sizeof(last) );
+    pthread_barrier_init( &barrier, NULL, n + 1 );
+    for( i=0; i<n; i++ ) {
+        posters[i].id = i;
+        posters[i].msgs = msgs;
+        posters[i].mbox = mbox;
+        true_or_die( pthread_create( &posters[i].thread, NULL, poster_main, &posters[i] ) == 0,
+                     "Error: pthread_create failed" );
+    }
+    pthread_barrier_wait( &barrier );
+
+    t0 = now_nsec();
+    while( got < (uint64_t)n * msgs ) {
+        if( mbox->old ) {
+            /* messages may have been overwritten, so stop once the posters
+               are done and nothing more arrives */
+            if( old_mbox_fetch( mbox->old, &msg, 10 ) == 0 ) {
+                if( posters_done == n )
+                    break;
+                continue;
+            }
+        }
+        else if( sys_arch_mbox_fetch( mbox->mbox, &msg, 10000 ) == 0 )
+            break;  /* lost messages, which it never should */
+        got += 1;
+
+        from = MSG_POSTER( msg );
+        if( from >= n || MSG_SEQ( msg ) <= last[from] ) {
+            *misordered += 1;
+            continue;
+        }
+        last[from] = MSG_SEQ( msg );
+    }
+    elapsed = now_nsec() - t0;
+
+    for( i=0; i<n; i++ )
+        pthread_join( posters[i].thread, NULL );
+    pthread_barrier_destroy( &barrier );
+
+    *lost += (uint64_t)n * msgs - got;
+    return got * 1e9 / elapsed;
+}
+
+/** posts one message to a full mailbox, which must wait for room */
+static void* full_poster_main( void* arg ) {
+    sys_mbox_post( arg, MSG( 1, 1 ) );
+    __sync_fetch_and_add( &posters_done, 1 );
+    return NULL;
+}
+
+/** posts to an empty mailbox a while after it is fetched from */
+static void* late_poster_main( void* arg ) {
+    usleep( 50000 );
+    sys_mbox_post( arg, MSG( 2, 1 ) );
+    return NULL;
+}
+
+/** Checks a full mailbox makes posters wait and an empty one fetchers. */
+static unsigned check_waits() {
+    sys_mbox_t mbox;
+    pthread_t thread;
+    unsigned failures = 0, i;
+    uint64_t t0, waited_ms;
+    uint16_t time;
+    void* msg;
+
+    mbox = sys_mbox_new();
+    true_or_die( mbox != SYS_MBOX_NULL, "Error: sys_mbox_new failed" );
+    for( i=0; i<SYS_MBOX_SIZE; i++ )
+        if( sys_mbox_trypost( mbox, MSG( 0, i + 1 ) ) != ERR_OK ) {
+            fprintf( stderr, "mailbox full after %u of %u messages\n", i, SYS_MBOX_SIZE );
+            failures += 1;
+            break;
+        }
+    if( sys_mbox_trypost( mbox, MSG( 0, 0 ) ) != ERR_MEM ) {
+        fprintf( stderr, "a full mailbox took another message\n" );
+        failures += 1;
+    }
+
+    /* a poster must wait for room, and get it once a message is fetched */
+    posters_done = 0;
+    true_or_die( pthread_create( &thread, NULL, full_poster_main, mbox ) == 0,
+                 "Error: pthread_create failed" );
+    usleep( 50000 );
+    if( posters_done != 0 ) {
+        fprintf( stderr, "sys_mbox_post did not wait for room in a full mailbox\n" );
+        failures += 1;
+    }
+    for( i=0; i<=SYS_MBOX_SIZE; i++ ) {
+        if( sys_arch_mbox_fetch( mbox, &msg, 1000 ) == 0 ) {
+            fprintf( stderr, "message %u never arrived\n", i );
+            failures += 1;
+            break;
+        }
+        if( msg != (i < SYS_MBOX_SIZE ? MSG( 0, i + 1 ) : MSG( 1, 1 )) ) {
+            fprintf( stderr, "message %u was not the one posted\n", i );
+            failures += 1;
+        }
+    }
+    pthread_join( thread, NULL );
+
+    /* a fetch from an empty mailbox must time out ... */
+    t0 = now_nsec();
+    time = sys_arch_mbox_fetch( mbox, &msg, 100 );
+    waited_ms = (now_nsec() - t0) / 1000000;
+    if( time != 0 || waited_ms < 100 || waited_ms > 1000 ) {
+        fprintf( stderr, "a 100 ms fetch from an empty mailbox returned %u after %llu ms\n",
+                 time, (unsigned long long)waited_ms );
+        failures += 1;
+    }
+
+    /* ... unless something is posted first */
+    true_or_die( pthread_create( &thread, NULL, late_poster_main, mbox ) == 0,
+                 "Error: pthread_create failed" );
+    t0 = now_nsec();
+    time = sys_arch_mbox_fetch( mbox, &msg, 1000 );
+    waited_ms = (now_nsec() - t0) / 1000000;
+    if( time == 0 || msg != MSG( 2, 1 ) || waited_ms > 900 ) {
+        fprintf( stderr, "a fetch returned %u after %llu ms, not when posted to\n",
+                 time, (unsigned long long)waited_ms );
+        failures += 1;
+    }
+    pthread_join( thread, NULL );
+
+    sys_mbox_free( mbox );
+    printf( "%u-message mailbox: full refuses and waits, empty times out\n", SYS_MBOX_SIZE );
+    return failures;
+}
+
+int main( int argc, char** argv ) {
+    static const unsigned POSTERS[] = { 1, 2, 4, MAX_POSTERS };
+    unsigned msgs = 200000;
+    unsigned failures = 0, i, n;
+    uint64_t lost, misordered, old_lost, old_misordered;
+    double rate, old_rate;
+    old_mbox_t old;
+    mbox_t mbox;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:" )) != EOF ) {
+        switch( c ) {
+        case 'n': msgs = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n msgs_per_poster]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( msgs >= 1 && msgs < 0xffffff,
+                 "Error: need 1 to 16777214 messages per poster" );
+
+    stats_init();
+    sys_init();
+
+    printf( "%u messages per poster\n", msgs );
+    for( i=0; i<sizeof(POSTERS)/sizeof(POSTERS[0]); i++ ) {
+        n = POSTERS[i];
+
+        lost = misordered = 0;
+        mbox.old = NULL;
+        mbox.mbox = sys_mbox_new();
+        true_or_die( mbox.mbox != SYS_MBOX_NULL, "Error: sys_mbox_new failed" );
+        rate = run( &mbox, n, msgs, &lost, &misordered );
+        sys_mbox_free( mbox.mbox );
+        if( lost || misordered ) {
+            fprintf( stderr, "%u posters: %llu messages lost, %llu out of order\n", n,
+                     (unsigned long long)lost, (unsigned long long)misordered );
+            failures += 1;
+        }
+
+        old_lost = old_misordered = 0;
+        memset( &old, 0, sizeof(old) );
+        old_sem_init( &old.mail, 0 );
+        old_sem_init( &old.mutex, 1 );
+        mbox.old = &old;
+        old_rate = run( &mbox, n, msgs, &old_lost, &old_misordered );
+        old_sem_destroy( &old.mail );
+        old_sem_destroy( &old.mutex );
+
+        printf( "%u poster%s: %6.2f M msgs/s lock-free, %6.2f M msgs/s with semaphores"
+                " (%llu lost)\n", n, n == 1 ? " " : "s", rate / 1e6, old_rate / 1e6,
+                (unsigned long long)(old_lost + old_misordered) );
+    }
+
+    failures += check_waits();
+    if( stats.sys.mbox.used != 0 ) {
+        fprintf( stderr, "%u mailboxes still in use\n", (unsigned)stats.sys.mbox.used );
+        failures += 1;
+    }
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,466 @@
+/*
+ * Filename: sr_mem_bench.c
+ * Purpose: Measures lwtcp's heap (mem_malloc and friends) and pools (memp)
+ *          under many connections.
+ *
+ * Each thread runs its share of the connections.  A connection queues buffers
+ * of the sizes lwtcp allocates pbufs in -- bare acks, segments of up to an MSS
+ * with their headers, now and then a larger send -- and frees them oldest
+ * first, trimming a few in place with mem_realloc() as pbuf_realloc() does.
+ * Each buffer is marked at both ends, and the marks must be intact when it is
+ * freed.  Throughput, in allocations and frees per second, is reported for 1,
+ * 2, 4, ... threads.
+ *
+ * Fragmentation is measured by running the connections and then allocating
+ * buffers like theirs until the heap is exhausted, and again after closing
+ * every other connection with buffers of another size: the share of the heap
+ * which could be filled each time is reported.
+ *
+ * The pools are measured with each thread taking bursts of pbufs, or a netbuf
+ * or two, and giving them back, as the transport thread and API callers do.
+ * The share of allocations served by the threads' caches is reported with the
+ * throughput.
+ *
+ * The heap's edge cases are checked as well, and once every thread is gone the
+ * heap and the pools must account for no memory in use.
+ *
+ * Usage: mem_bench [-c connections] [-t max_threads] [-n ops_per_thread] [-s seed]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+
+/** buffers a connection holds at most */
+#define QUEUE_LEN  8
+
+/** pbuf header, link, IP and TCP headers in front of a segment's data */
+#define HDR_LEN    80
+#define MSS        1460
+
+/** size of the buffers which fill the heap after half the connections close */
+#define FILL_LEN   3000
+
+/** failed allocations in a row after which the heap is taken to be full */
+#define MAX_MISSES 100
+
+/** most pbufs a thread holds at once (it holds at most two netbufs) */
+#define MAX_BURST  8
+
+/** a buffer in a connection's queue */
+typedef struct buf_t {
+    byte*      p;
+    mem_size_t len;
+} buf_t;
+
+typedef struct conn_t {
+    buf_t    q[QUEUE_LEN];
+    unsigned head, n;
+} conn_t;
+
+/** a thread and the connections it runs */
+typedef struct worker_t {
+    pthread_t thread;
+    conn_t*   conns;
+    unsigned  num_conns;
+    unsigned  ops;
+    uint32_t  rand;
+    uint64_t  allocs, frees, alloc_fails;
+    double    filled[2];    /* share of the heap filled, in fragment_thread() */
+    unsigned  failures;
+} worker_t;
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** xorshift: rand() takes a lock, which would swamp what is measured */
+static uint32_t next_rand( uint32_t* r ) {
+    *r ^= *r << 13;
+    *r ^= *r >> 17;
+    *r ^= *r << 5;
+    return *r;
+}
+
+/** Returns the size of a buffer lwtcp might allocate. */
+static mem_size_t buf_len( uint32_t* r ) {
+    unsigned x = next_rand( r ) % 1000;
+
+    if( x < 400 )
+        return HDR_LEN;
+    else if( x < 900 )
+        return HDR_LEN + 1 + next_rand( r ) % MSS;
+    else if( x < 998 )
+        return HDR_LEN + MSS + next_rand( r ) % 8192;
+    else
+        return 16384 + next_rand( r ) % 49152;
+}
+
+static uint32_t buf_tag( const buf_t* b ) {
+    return (uint32_t)(unsigned long)b->p ^ b->len;
+}
+
+static void buf_mark( buf_t* b ) {
+    uint32_t tag = buf_tag( b );
+    memcpy( b->p, &tag, sizeof(tag) );
+    memcpy( b->p + b->len - sizeof(tag), &tag, sizeof(tag) );
+}
+
+static bool buf_intact( const buf_t* b ) {
+    uint32_t tag = buf_tag( b ), head, tail;
+    memcpy( &head, b->p, sizeof(head) );
+    memcpy( &tail, b->p + b->len - sizeof(tail), sizeof(tail) );
+    return head == tag && tail == tag;
+}
+
+/**
+ * Queues a new buffer on c.  One segment in ten is trimmed by up to a quarter,
+ * as tcp_input() trims one which overlaps the receive window.
+ */
+static void conn_push( worker_t* w, conn_t* c ) {
+    buf_t b;
+    void* p;
+
+    b.len = buf_len( &w->rand );
+    if( !(b.p = mem_malloc( b.len )) ) {
+        w->alloc_fails += 1;
+        return;
+    }
+    w->allocs += 1;
+
+    if( b.len > HDR_LEN && next_rand( &w->rand ) % 10 == 0 ) {
+        b.len -= next_rand( &w->rand ) % ((b.len - HDR_LEN) / 4 + 1);
+        p = mem_realloc( b.p, b.len );
+        if( p != b.p )
+            w->failures += 1;
+    }
+
+    buf_mark( &b );
+    c->q[(c->head + c->n) % QUEUE_LEN] = b;
+    c->n += 1;
+}
+
+/** Frees the oldest buffer of c. */
+static void conn_pop( worker_t* w, conn_t* c ) {
+    buf_t* b = &c->q[c->head];
+
+    if( !buf_intact( b ) )
+        w->failures += 1;
+    mem_free( b->p );
+    w->frees += 1;
+    c->head = (c->head + 1) % QUEUE_LEN;
+    c->n -= 1;
+}
+
+static void conn_close( worker_t* w, conn_t* c ) {
+    while( c->n )
+        conn_pop( w, c );
+}
+
+/** Runs w's connections for w->ops operations. */
+static void churn( worker_t* w ) {
+    conn_t* c;
+    unsigned i;
+
+    for( i=0; i<w->ops; i++ ) {
+        c = &w->conns[next_rand( &w->rand ) % w->num_conns];
+        if( c->n == 0 || (c->n < QUEUE_LEN && next_rand( &w->rand ) % 100 < 52) )
+            conn_push( w, c );
+        else
+            conn_pop( w, c );
+    }
+}
+
+static void* churn_thread( void* arg ) {
+    worker_t* w = (worker_t*)arg;
+    unsigned i;
+
+    churn( w );
+    for( i=0; i<w->num_conns; i++ )
+        conn_close( w, &w->conns[i] );
+    return NULL;
+}
+
+/**
+ * Allocates buffers of FILL_LEN bytes, or of the connections' sizes if mixed,
+ * until MAX_MISSES in a row fail, then frees them.  Returns the bytes filled.
+ */
+static uint64_t fill_heap( worker_t* w, bool mixed ) {
+    void** fill;
+    uint64_t bytes = 0;
+    unsigned i, n, misses;
+    mem_size_t len;
+
+    fill = malloc_or_die( (MEM_SIZE / HDR_LEN + 1) * sizeof(*fill) );
+    for( n=0, misses=0; misses<MAX_MISSES; ) {
+        len = mixed ? buf_len( &w->rand ) : FILL_LEN;
+        if( (fill[n] = mem_malloc( len )) ) {
+            bytes += len;
+            n += 1;
+            misses = 0;
+        }
+        else
+            misses += 1;
+    }
+    for( i=0; i<n; i++ )
+        mem_free( fill[i] );
+    free( fill );
+
+    return bytes;
+}
+
+/**
+ * Runs every connection and fills the rest of the heap with buffers like
+ * theirs.  Then closes the odd connections and fills the heap with buffers of
+ * FILL_LEN.  Leaves the share of the heap filled each time in w->filled.
+ */
+static void* fragment_thread( void* arg ) {
+    worker_t* w = (worker_t*)arg;
+    uint64_t live = 0;
+    unsigned i, j;
+
+    churn( w );
+    for( i=0; i<w->num_conns; i++ )
+        for( j=0; j<w->conns[i].n; j++ )
+            live += w->conns[i].q[(w->conns[i].head + j) % QUEUE_LEN].len;
+    w->filled[0] = (live + fill_heap( w, TRUE )) / (double)MEM_SIZE;
+
+    for( i=1; i<w->num_conns; i+=2 ) {
+        for( j=0; j<w->conns[i].n; j++ )
+            live -= w->conns[i].q[(w->conns[i].head + j) % QUEUE_LEN].len;
+        conn_close( w, &w->conns[i] );
+    }
+    w->filled[1] = (live + fill_heap( w, FALSE )) / (double)MEM_SIZE;
+
+    for( i=0; i<w->num_conns; i+=2 )
+        conn_close( w, &w->conns[i] );
+    return NULL;
+}
+
+/** Checks the edge cases of the heap's API. */
+static void* check_thread( void* arg ) {
+    worker_t* w = (worker_t*)arg;
+    byte *p, *q;
+    void** all;
+    unsigned i, n;
+
+    if( mem_malloc( 0 ) || mem_malloc( MEM_SIZE + 1 ) )
+        w->failures += 1;
+
+    /* shrinking keeps the buffer where it is, growing keeps its contents */
+    p = mem_malloc( 1000 );
+    for( i=0; i<1000; i++ )
+        p[i] = i;
+    if( mem_realloc( p, 100 ) != p )
+        w->failures += 1;
+    q = mem_realloc( p, 5000 );
+    for( i=0; q && i<100; i++ )
+        if( q[i] != (byte)i )
+            w->failures += 1;
+    if( !q )
+        w->failures += 1;
+    mem_free( q );
+
+    /* and the same for a run of whole slabs */
+    p = mem_malloc( 200000 );
+    if( !p || mem_realloc( p, 70000 ) != p )
+        w->failures += 1;
+    memset( p, 0xAB, 70000 );
+    q = mem_reallocm( p, 40000 );
+    if( !q || q[39999] != 0xAB )
+        w->failures += 1;
+    mem_free( q );
+
+    /* nearly all the heap can be had in small pieces, and then all at once */
+    all = malloc_or_die( (MEM_SIZE / 1000 + 1) * sizeof(*all) );
+    for( n=0; n<=MEM_SIZE / 1000 && (all[n] = mem_malloc( 1000 )); n++ );
+    if( n < MEM_SIZE / 1024 * 9 / 10 )
+        w->failures += 1;
+    for( i=0; i<n; i++ )
+        mem_free( all[i] );
+    free( all );
+    if( !(p = mem_malloc( MEM_SIZE / 2 )) )
+        w->failures += 1;
+    mem_free( p );
+
+    return NULL;
+}
+
+/**
+ * Takes bursts of pbufs or netbufs from the pools, marks each with w, and
+ * gives them back checking that no other thread was handed the same one.
+ */
+static void* pool_thread( void* arg ) {
+    worker_t* w = (worker_t*)arg;
+    void* elem[MAX_BURST];
+    memp_t type;
+    unsigned i, j, n;
+
+    for( i=0; i<w->ops; i+=2*n ) {
+        if( next_rand( &w->rand ) % 4 ) {
+            type = MEMP_PBUF;
+            n = 1 + next_rand( &w->rand ) % MAX_BURST;
+        }
+        else {
+            type = MEMP_NETBUF;
+            n = 1 + next_rand( &w->rand ) % 2;
+        }
+        for( j=0; j<n; j++ ) {
+            if( !(elem[j] = memp_malloc( type )) ) {
+                w->alloc_fails += 1;
+                break;
+            }
+            *(worker_t**)elem[j] = w;
+        }
+        n = j;
+        w->allocs += n;
+        while( j-- ) {
+            if( *(worker_t**)elem[j] != w )
+                w->failures += 1;
+            memp_free( type, elem[j] );
+        }
+        w->frees += n;
+        if( n == 0 )
+            n = 1;
+    }
+    return NULL;
+}
+
+/** Runs fn on each of the n workers in w, each in its own thread. */
+static void run_workers( worker_t* w, unsigned n, void* (*fn)( void* ) ) {
+    unsigned i;
+
+    for( i=0; i<n; i++ )
+        true_or_die( pthread_create( &w[i].thread, NULL, fn, &w[i] ) == 0,
+                     "Error: pthread_create failed" );
+    for( i=0; i<n; i++ )
+        pthread_join( w[i].thread, NULL );
+}
+
+/** Gives the n workers in w equal shares of the connections in conns. */
+static void workers_init( worker_t* w, unsigned n, conn_t* conns,
+                          unsigned num_conns, unsigned ops, unsigned seed ) {
+    unsigned i;
+
+    memset( conns, 0, num_conns * sizeof(*conns) );
+    memset( w, 0, n * sizeof(*w) );
+    for( i=0; i<n; i++ ) {
+        w[i].conns = conns + i * (num_conns / n);
+        w[i].num_conns = num_conns / n;
+        w[i].ops = ops;
+        w[i].rand = seed * 2654435761u + i + 1;
+    }
+}
+
+int main( int argc, char** argv ) {
+    unsigned num_conns = 256, max_threads = 8, ops = 2000000, seed = 1;
+    unsigned failures = 0, t, i;
+    uint64_t t0, elapsed, done, fails, hits, allocs;
+    worker_t* w;
+    conn_t* conns;
+    int c;
+
+    while( (c = getopt( argc, argv, "c:t:n:s:" )) != EOF ) {
+        switch( c ) {
+        case 'c': num_conns = atoi( optarg ); break;
+        case 't': max_threads = atoi( optarg ); break;
+        case 'n': ops = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-c connections] [-t max_threads] "
+                     "[-n ops_per_thread] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( max_threads >= 1 && num_conns >= 2 * max_threads,
+                 "Error: need at least two connections per thread" );
+
+    stats_init();
+    sys_init();
+    mem_init();
+    memp_init();
+
+    w = calloc_or_die( max_threads, sizeof(*w) );
+    conns = calloc_or_die( num_conns, sizeof(*conns) );
+
+    printf( "%u connections, %u operations per thread\n", num_conns, ops );
+    for( t=1; t<=max_threads; t*=2 ) {
+        workers_init( w, t, conns, num_conns, ops, seed );
+        t0 = now_nsec();
+        run_workers( w, t, churn_thread );
+        elapsed = now_nsec() - t0;
+
+        done = fails = 0;
+        for( i=0; i<t; i++ ) {
+            done += w[i].allocs + w[i].frees;
+            fails += w[i].alloc_fails;
+            failures += w[i].failures;
+        }
+        printf( "%2u threads: %7.2f Mops/s (%llu allocations failed)\n", t,
+                done * 1000.0 / elapsed, (unsigned long long)fails );
+    }
+
+    workers_init( w, 1, conns, num_conns, ops, seed );
+    run_workers( w, 1, fragment_thread );
+    failures += w[0].failures;
+    printf( "heap filled to %.1f%% by the connections' buffers,\n"
+            "           %.1f%% by %u byte buffers after half the connections closed\n",
+            w[0].filled[0] * 100, w[0].filled[1] * 100, FILL_LEN );
+
+    printf( "pools:\n" );
+    for( t=1; t<=max_threads; t*=2 ) {
+        workers_init( w, t, conns, num_conns, ops, seed );
+        hits = stats.memp[MEMP_PBUF].cachehit + stats.memp[MEMP_NETBUF].cachehit;
+        allocs = hits + stats.memp[MEMP_PBUF].cachemiss + stats.memp[MEMP_NETBUF].cachemiss;
+        t0 = now_nsec();
+        run_workers( w, t, pool_thread );
+        elapsed = now_nsec() - t0;
+
+        done = fails = 0;
+        for( i=0; i<t; i++ ) {
+            done += w[i].allocs + w[i].frees;
+            fails += w[i].alloc_fails;
+            failures += w[i].failures;
+        }
+        hits = stats.memp[MEMP_PBUF].cachehit + stats.memp[MEMP_NETBUF].cachehit - hits;
+        allocs = stats.memp[MEMP_PBUF].cachehit + stats.memp[MEMP_NETBUF].cachehit
+            + stats.memp[MEMP_PBUF].cachemiss + stats.memp[MEMP_NETBUF].cachemiss - allocs;
+        printf( "%2u threads: %7.2f Mops/s (%.1f%% from the threads' caches, "
+                "%llu allocations failed)\n", t, done * 1000.0 / elapsed,
+                allocs ? hits * 100.0 / allocs : 0.0, (unsigned long long)fails );
+    }
+
+    workers_init( w, 1, conns, num_conns, ops, seed );
+    run_workers( w, 1, check_thread );
+    failures += w[0].failures;
+
+#ifdef MEM_STATS
+    if( stats.mem.used != 0 ) {
+        printf( "%u bytes of the heap still in use\n", (unsigned)stats.mem.used );
+        failures += 1;
+    }
+#endif
+#ifdef MEMP_STATS
+    for( i=0; i<MEMP_MAX; i++ ) {
+        if( stats.memp[i].used != 0 ) {
+            printf( "%u elements of pool %u still in use\n", (unsigned)stats.memp[i].used, i );
+            failures += 1;
+        }
+    }
+#endif
+
+    free( conns );
+    free( w );
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
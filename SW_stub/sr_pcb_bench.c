@@ -0,0 +1,283 @@
+/*
+ * Filename: sr_pcb_bench.c
+ * Purpose: Measures how long lwtcp takes to find the PCB an incoming segment
+ *          belongs to, with 10, 1000 and 10000 connections open.
+ *
+ * The connections are to the router's address from hosts all over, on a
+ * handful of service ports, and one in ten of them is in TIME-WAIT.  Segments
+ * arrive for connections picked at random, and one in ten is a SYN for one of
+ * the listeners instead.  Each is demultiplexed as tcp_input() does, with the
+ * PCB hash tables, and as it used to be, by walking the active, TIME-WAIT and
+ * listen lists in turn (moving a match to the front of its list); the cost of
+ * a lookup is reported for both.  Every lookup must find the right PCB.
+ *
+ * Afterwards the PCBs are unregistered and the hash tables must be empty.
+ *
+ * Usage: pcb_bench [-n lookups] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "lwip/tcp.h"
+#include "lwtcp_sr_integration.h"
+
+/** the router's address, which every connection is to */
+#define LOCAL_IP      0x0a000101
+
+/** ports the router listens on */
+static const uint16_t SERVICE_PORTS[] = { 22, 23, 80, 179, 443, 2601, 2604, 8080 };
+#define NUM_SERVICES  (sizeof(SERVICE_PORTS) / sizeof(SERVICE_PORTS[0]))
+
+/** most nodes the linear lookups may visit in total, so they finish */
+#define LINEAR_BUDGET 200000000ULL
+
+/** a segment to be demultiplexed and the PCB it should be matched to */
+typedef struct seg_t {
+    struct ip_addr src, dest;
+    uint16_t       sport, dport;
+    struct tcp_pcb* pcb;
+} seg_t;
+
+static struct tcp_pcb_listen listeners[NUM_SERVICES];
+
+/* No segment is ever sent, so lwtcp's hooks into the router are stubs. */
+uint32_t ip_route( struct ip_addr* dest ) {
+    return 0;
+}
+
+uint16_t ip_route_mtu( struct ip_addr* dest ) {
+    return 0;
+}
+
+err_t sr_lwip_output( struct pbuf* p, struct ip_addr* src, struct ip_addr* dst,
+                      uint8_t proto ) {
+    return ERR_RTE;
+}
+
+void tcp_timer_needed( void ) {
+}
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** xorshift */
+static uint32_t next_rand( uint32_t* r ) {
+    *r ^= *r << 13;
+    *r ^= *r >> 17;
+    *r ^= *r << 5;
+    return *r;
+}
+
+/** Finds a segment's PCB as tcp_input() does. */
+static struct tcp_pcb* hash_lookup( seg_t* s ) {
+    struct tcp_pcb* pcb;
+
+    pcb = tcp_pcb_lookup( &s->src, s->sport, &s->dest, s->dport );
+    if( pcb == NULL )
+        pcb = (struct tcp_pcb*)tcp_listen_lookup( &s->dest, s->dport );
+    return pcb;
+}
+
+/** Finds a segment's PCB as tcp_input() used to, by walking the lists. */
+static struct tcp_pcb* linear_lookup( seg_t* s ) {
+    struct tcp_pcb *pcb, *prev;
+
+    prev = NULL;
+    for( pcb=tcp_active_pcbs; pcb!=NULL; pcb=pcb->next ) {
+        if( pcb->remote_port == s->sport && pcb->local_port == s->dport &&
+            ip_addr_cmp( &pcb->remote_ip, &s->src ) &&
+            ip_addr_cmp( &pcb->local_ip, &s->dest ) ) {
+            if( prev != NULL ) {
+                prev->next = pcb->next;
+                pcb->next = tcp_active_pcbs;
+                tcp_active_pcbs = pcb;
+            }
+            return pcb;
+        }
+        prev = pcb;
+    }
+
+    for( pcb=tcp_tw_pcbs; pcb!=NULL; pcb=pcb->next )
+        if( pcb->remote_port == s->sport && pcb->local_port == s->dport &&
+            ip_addr_cmp( &pcb->remote_ip, &s->src ) &&
+            ip_addr_cmp( &pcb->local_ip, &s->dest ) )
+            return pcb;
+
+    prev = NULL;
+    for( pcb=(struct tcp_pcb*)tcp_listen_pcbs; pcb!=NULL; pcb=pcb->next ) {
+        if( (ip_addr_isany( &pcb->local_ip ) ||
+             ip_addr_cmp( &pcb->local_ip, &s->dest )) &&
+            pcb->local_port == s->dport ) {
+            if( prev != NULL ) {
+                prev->next = pcb->next;
+                pcb->next = (struct tcp_pcb*)tcp_listen_pcbs;
+                tcp_listen_pcbs = (struct tcp_pcb_listen*)pcb;
+            }
+            return pcb;
+        }
+        prev = pcb;
+    }
+    return NULL;
+}
+
+/** Opens num_pcbs connections to random hosts and returns their PCBs. */
+static struct tcp_pcb* pcbs_open( unsigned num_pcbs, uint32_t* r ) {
+    struct tcp_pcb* pcbs;
+    unsigned i;
+
+    pcbs = calloc_or_die( num_pcbs, sizeof(*pcbs) );
+    for( i=0; i<num_pcbs; i++ ) {
+        /* each connection is from its own host, so the 4-tuples differ */
+        pcbs[i].remote_ip.addr = htonl( 0x0b000000 + i + 1 );
+        pcbs[i].remote_port = 1024 + next_rand( r ) % 60000;
+        pcbs[i].local_ip.addr = htonl( LOCAL_IP );
+        pcbs[i].local_port = SERVICE_PORTS[next_rand( r ) % NUM_SERVICES];
+        if( next_rand( r ) % 10 == 0 ) {
+            pcbs[i].state = TIME_WAIT;
+            TCP_REG( &tcp_tw_pcbs, (&pcbs[i]) );
+        }
+        else {
+            pcbs[i].state = ESTABLISHED;
+            TCP_REG( &tcp_active_pcbs, (&pcbs[i]) );
+        }
+    }
+    return pcbs;
+}
+
+/** Closes the connections opened by pcbs_open(). */
+static void pcbs_close( struct tcp_pcb* pcbs, unsigned num_pcbs ) {
+    unsigned i;
+
+    for( i=0; i<num_pcbs; i++ ) {
+        if( pcbs[i].state == TIME_WAIT )
+            TCP_RMV( &tcp_tw_pcbs, (&pcbs[i]) );
+        else
+            TCP_RMV( &tcp_active_pcbs, (&pcbs[i]) );
+    }
+    free( pcbs );
+}
+
+/** Makes n segments, mostly for the connections and some SYNs. */
+static void segs_make( seg_t* segs, unsigned n, struct tcp_pcb* pcbs,
+                       unsigned num_pcbs, uint32_t* r ) {
+    struct tcp_pcb* pcb;
+    unsigned i, j;
+
+    for( i=0; i<n; i++ ) {
+        if( next_rand( r ) % 10 == 0 ) {
+            /* a SYN from a host with no connection yet */
+            j = next_rand( r ) % NUM_SERVICES;
+            segs[i].src.addr = htonl( 0x0c000000 + next_rand( r ) % 0x1000000 );
+            segs[i].sport = 1024 + next_rand( r ) % 60000;
+            segs[i].dest.addr = htonl( LOCAL_IP );
+            segs[i].dport = SERVICE_PORTS[j];
+            segs[i].pcb = (struct tcp_pcb*)&listeners[j];
+        }
+        else {
+            pcb = &pcbs[next_rand( r ) % num_pcbs];
+            segs[i].src = pcb->remote_ip;
+            segs[i].sport = pcb->remote_port;
+            segs[i].dest = pcb->local_ip;
+            segs[i].dport = pcb->local_port;
+            segs[i].pcb = pcb;
+        }
+    }
+}
+
+/**
+ * Demultiplexes segs[0..n) with lookup and returns the mean cost of a lookup
+ * in nanoseconds.  Any segment matched to the wrong PCB is counted in
+ * *failures.
+ */
+static double segs_lookup( seg_t* segs, unsigned n,
+                           struct tcp_pcb* (*lookup)( seg_t* ),
+                           unsigned* failures ) {
+    uint64_t t0, elapsed;
+    unsigned i, wrong = 0;
+
+    t0 = now_nsec();
+    for( i=0; i<n; i++ )
+        if( lookup( &segs[i] ) != segs[i].pcb )
+            wrong += 1;
+    elapsed = now_nsec() - t0;
+
+    *failures += wrong;
+    return (double)elapsed / n;
+}
+
+int main( int argc, char** argv ) {
+    static const unsigned SIZES[] = { 10, 1000, 10000 };
+    unsigned lookups = 1000000, seed = 1, num_linear;
+    unsigned failures = 0, i, j;
+    double hash_ns, linear_ns;
+    struct tcp_pcb* pcbs;
+    seg_t* segs;
+    uint32_t r;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:s:" )) != EOF ) {
+        switch( c ) {
+        case 'n': lookups = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n lookups] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( lookups >= 1, "Error: need at least one lookup" );
+    r = seed ? seed : 1;
+
+    /* the service ports' listeners; the last ones take any address */
+    for( i=0; i<NUM_SERVICES; i++ ) {
+        listeners[i].state = LISTEN;
+        listeners[i].local_port = SERVICE_PORTS[i];
+        listeners[i].local_ip.addr = (i < NUM_SERVICES / 2) ? htonl( LOCAL_IP ) : 0;
+        TCP_REG( (struct tcp_pcb**)&tcp_listen_pcbs, ((struct tcp_pcb*)&listeners[i]) );
+    }
+
+    segs = malloc_or_die( lookups * sizeof(*segs) );
+    printf( "%u lookups, %u buckets\n", lookups, TCP_PCB_HASH_SIZE );
+    for( i=0; i<sizeof(SIZES)/sizeof(SIZES[0]); i++ ) {
+        pcbs = pcbs_open( SIZES[i], &r );
+        segs_make( segs, lookups, pcbs, SIZES[i], &r );
+
+        /* hash first, so the linear lookups' reordering doesn't help it */
+        hash_ns = segs_lookup( segs, lookups, hash_lookup, &failures );
+        num_linear = lookups;
+        if( (uint64_t)num_linear * SIZES[i] > LINEAR_BUDGET )
+            num_linear = LINEAR_BUDGET / SIZES[i];
+        linear_ns = segs_lookup( segs, num_linear, linear_lookup, &failures );
+
+        printf( "%5u PCBs: %7.1f ns/segment hashed, %9.1f ns/segment walking the lists\n",
+                SIZES[i], hash_ns, linear_ns );
+        pcbs_close( pcbs, SIZES[i] );
+    }
+    free( segs );
+
+    for( i=0; i<NUM_SERVICES; i++ )
+        TCP_RMV( (struct tcp_pcb**)&tcp_listen_pcbs, ((struct tcp_pcb*)&listeners[i]) );
+    if( tcp_active_pcbs || tcp_tw_pcbs || tcp_listen_pcbs ) {
+        fprintf( stderr, "PCB lists not empty after closing every PCB\n" );
+        failures += 1;
+    }
+    for( j=0; j<TCP_PCB_HASH_SIZE; j++ )
+        if( tcp_pcb_hash[j] ) {
+            fprintf( stderr, "hash chain %u not empty after closing every PCB\n", j );
+            failures += 1;
+        }
+    for( j=0; j<TCP_LISTEN_HASH_SIZE; j++ )
+        if( tcp_listen_hash[j] ) {
+            fprintf( stderr, "listen hash chain %u not empty after closing every PCB\n", j );
+            failures += 1;
+        }
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,664 @@
+/*
+ * Filename: sr_poll_bench.c
+ * Purpose: Compares serving 1000 lwtcp connections with a thread each to
+ *          serving them all from one thread with lwip_epoll_wait().
+ *
+ * The whole stack runs as it does on the router -- the transport thread, the
+ * netconn API and the sockets over it -- but packets sent are looped back to
+ * the transport thread rather than put on the wire.  A client thread connects
+ * every session to an echo server and then runs rounds of requests: it sends a
+ * request on every session, and waits with lwip_epoll_wait() until every
+ * session has its echo back.  The server is run two ways: with an acceptor
+ * thread starting a thread per connection, each blocking in lwip_recv(), and
+ * as one thread accepting, receiving and sending on non-blocking sockets as
+ * edge-triggered epoll events tell it to.  The requests a second and the
+ * context switches per request (all threads', from getrusage()) are reported
+ * for each.
+ *
+ * Every echo must come back intact.  Before either run the semantics are
+ * checked on one connection: a non-blocking socket with nothing to read or
+ * accept must say EWOULDBLOCK, an edge-triggered socket must be reported once
+ * per arrival however much is left unread, a level-triggered one and
+ * lwip_poll() for as long as it is readable, a thread waiting in lwip_poll()
+ * must be woken by data arriving, and a closed socket must leave its epoll
+ * set.  Once every connection is closed the stack must be back to the
+ * mailboxes and semaphores it started with.
+ *
+ * Usage: poll_bench [-n sessions] [-r rounds]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <net/ethernet.h>
+#include "sr_common.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "lwip/pbuf.h"
+#include "lwip/sockets.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+#include "lwip/tcp.h"
+#include "lwtcp_sr_integration.h"
+
+#define LOCAL_IP     0x0a000001
+#define FIRST_PORT   7000
+
+/** the most sessions, which with both ends in one stack is half the sockets */
+#define MAX_SESSIONS (MEMP_NUM_NETCONN / 2 - 8)
+
+#define MSG_LEN      64
+#define MAX_EVENTS   256
+
+/** stack of a thread serving one connection */
+#define WORKER_STACK (64 * 1024)
+
+/** a wait this long for something to happen means the bench has stalled */
+#define STALL_MSEC   10000
+
+/** a packet looped back to the transport thread */
+typedef struct pkt_t {
+    struct pkt_t* next;
+    byte*         buf;          /* the frame, as the router receives it */
+    uint16_t      len;          /* of the IP packet after the link header */
+} pkt_t;
+
+/** one end of a session, as the client sees it */
+typedef struct session_t {
+    int      fd;
+    unsigned id;
+    uint16_t got;               /* bytes of this round's echo so far */
+    byte     buf[MSG_LEN];
+} session_t;
+
+/** a connection served by the event loop */
+typedef struct econn_t {
+    int      fd;
+    bool     want_out;          /* waiting for room to send the rest */
+    uint16_t off, len;          /* of what is still to be echoed */
+    byte     buf[2048];
+} econn_t;
+
+/** an echo server */
+typedef struct server_t {
+    int        lfd;
+    unsigned   n;
+    unsigned   failures;
+    /* thread per connection */
+    pthread_t* workers;
+    unsigned   nworkers;
+    /* event loop */
+    econn_t*   conns;
+    unsigned   accepted, closed;
+} server_t;
+
+static struct netif netif;
+
+/* packets waiting to be looped back; touched only by the transport thread */
+static pkt_t* loop_head;
+static pkt_t** loop_tail = &loop_head;
+static bool loop_scheduled;
+
+/* -- the stack's hooks into the router, here a loopback -- */
+
+uint32_t ip_route( struct ip_addr* dest ) {
+    return htonl( LOCAL_IP );
+}
+
+uint16_t ip_route_mtu( struct ip_addr* dest ) {
+    return 1500;
+}
+
+/**
+ * Hands the packets waiting on the loopback to TCP in the frames they were
+ * sent in, as sr_transport_input() does.  Runs on the transport thread.
+ */
+static void loop_deliver( void* arg ) {
+    pkt_t *pkt, *next;
+    struct pbuf* p;
+
+    pkt = loop_head;
+    loop_head = NULL;
+    loop_tail = &loop_head;
+    loop_scheduled = FALSE;
+    for( ; pkt!=NULL; pkt=next ) {
+        next = pkt->next;
+        p = pbuf_alloc_ref( pkt->buf, pkt->buf + ETHER_HDR_LEN, pkt->len, free, pkt->buf );
+        true_or_die( p != NULL, "Error: out of memory for a looped back packet" );
+        tcp_input( p, &netif );
+        free( pkt );
+    }
+}
+
+/**
+ * Puts an IP packet around a segment and loops it back, to be delivered once
+ * the transport thread is done with what it is doing now.
+ */
+err_t sr_lwip_output( struct pbuf* p, struct ip_addr* src, struct ip_addr* dst,
+                      uint8_t proto ) {
+    struct ip_hdr* iphdr;
+    struct pbuf* r;
+    pkt_t* pkt;
+    uint16_t len, off;
+
+    len = IP_HLEN + p->tot_len;
+    pkt = malloc_or_die( sizeof(*pkt) );
+    pkt->buf = malloc_or_die( ETHER_HDR_LEN + len );
+    pkt->len = len;
+    iphdr = (struct ip_hdr*)(pkt->buf + ETHER_HDR_LEN);
+    memset( iphdr, 0, IP_HLEN );
+    IPH_VHLTOS_SET( iphdr, 4, IP_HLEN / 4, 0 );
+    IPH_LEN_SET( iphdr, htons( len ) );
+    IPH_TTL_SET( iphdr, 64 );
+    IPH_PROTO_SET( iphdr, proto );
+    iphdr->src = *src;
+    iphdr->dest = *dst;
+    off = IP_HLEN;
+    for( r=p; r!=NULL; r=r->next ) {
+        memcpy( (byte*)iphdr + off, r->payload, r->len );
+        off += r->len;
+    }
+
+    pkt->next = NULL;
+    *loop_tail = pkt;
+    loop_tail = &pkt->next;
+    if( !loop_scheduled ) {
+        loop_scheduled = TRUE;
+        sys_timeout( 0, loop_deliver, NULL );
+    }
+    return ERR_OK;
+}
+
+/* -- helpers -- */
+
+static uint64_t now_usec() {
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/** context switches so far, voluntary or not, of every thread */
+static uint64_t ctx_switches() {
+    struct rusage ru;
+    getrusage( RUSAGE_SELF, &ru );
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void server_addr( struct sockaddr_in* sin, uint16_t port ) {
+    memset( sin, 0, sizeof(*sin) );
+    sin->sin_family = AF_INET;
+    sin->sin_addr.s_addr = htonl( LOCAL_IP );
+    sin->sin_port = htons( port );
+}
+
+/** Returns a socket listening on port. */
+static int listen_on( uint16_t port ) {
+    struct sockaddr_in sin;
+    int fd;
+
+    fd = lwip_socket( AF_INET, SOCK_STREAM, 0 );
+    true_or_die( fd >= 0, "Error: no socket to listen on" );
+    server_addr( &sin, port );
+    true_or_die( lwip_bind( fd, (struct sockaddr*)&sin, sizeof(sin) ) == 0,
+                 "Error: could not bind the server" );
+    true_or_die( lwip_listen( fd, MAX_SESSIONS ) == 0, "Error: could not listen" );
+    return fd;
+}
+
+/** Returns a socket connected to port, or -1. */
+static int connect_to( uint16_t port ) {
+    struct sockaddr_in sin;
+    int fd;
+
+    fd = lwip_socket( AF_INET, SOCK_STREAM, 0 );
+    if( fd < 0 )
+        return -1;
+    server_addr( &sin, port );
+    if( lwip_connect( fd, (struct sockaddr*)&sin, sizeof(sin) ) != 0 ) {
+        lwip_close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+/** Adds or changes fd in the epoll set epfd, for events, with data ptr. */
+static int watch( int epfd, int op, int fd, uint32_t events, void* ptr ) {
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = ptr;
+    return lwip_epoll_ctl( epfd, op, fd, &ev );
+}
+
+/* -- a server with a thread per connection -- */
+
+static void* worker_main( void* arg ) {
+    int fd = (intptr_t)arg;
+    byte buf[2048];
+    int n;
+
+    while( (n = lwip_recv( fd, buf, sizeof(buf), 0 )) > 0 )
+        if( lwip_send( fd, buf, n, 0 ) != n )
+            break;
+    lwip_close( fd );
+    return NULL;
+}
+
+static void* acceptor_main( void* arg ) {
+    server_t* srv = arg;
+    pthread_attr_t attr;
+    int fd;
+
+    pthread_attr_init( &attr );
+    pthread_attr_setstacksize( &attr, WORKER_STACK );
+    while( srv->nworkers < srv->n ) {
+        fd = lwip_accept( srv->lfd, NULL, NULL );
+        if( fd < 0 ) {
+            fprintf( stderr, "accept failed (errno %d)\n", errno );
+            srv->failures += 1;
+            break;
+        }
+        true_or_die( pthread_create( &srv->workers[srv->nworkers], &attr, worker_main,
+                                     (void*)(intptr_t)fd ) == 0,
+                     "Error: pthread_create failed" );
+        srv->nworkers += 1;
+    }
+    pthread_attr_destroy( &attr );
+    return NULL;
+}
+
+/* -- a server with one thread and an epoll set -- */
+
+/**
+ * Echoes what arrives on c until it would have to wait.  Returns FALSE once
+ * the connection is closed or has failed.
+ */
+static bool echo_io( int epfd, econn_t* c ) {
+    int n;
+
+    for( ;; ) {
+        while( c->off < c->len ) {
+            n = lwip_send( c->fd, c->buf + c->off, c->len - c->off, 0 );
+            if( n < 0 ) {
+                if( errno != EWOULDBLOCK )
+                    return FALSE;
+                if( !c->want_out ) {
+                    c->want_out = TRUE;
+                    watch( epfd, EPOLL_CTL_MOD, c->fd, EPOLLIN | EPOLLOUT | EPOLLET, c );
+                }
+                return TRUE;
+            }
+            c->off += n;
+        }
+        if( c->want_out ) {
+            c->want_out = FALSE;
+            watch( epfd, EPOLL_CTL_MOD, c->fd, EPOLLIN | EPOLLET, c );
+        }
+
+        n = lwip_recv( c->fd, c->buf, sizeof(c->buf), 0 );
+        if( n > 0 ) {
+            c->off = 0;
+            c->len = n;
+        }
+        else
+            return n < 0 && errno == EWOULDBLOCK;
+    }
+}
+
+static void* event_loop_main( void* arg ) {
+    struct epoll_event evs[MAX_EVENTS];
+    server_t* srv = arg;
+    econn_t* c;
+    int epfd, fd, n, i;
+
+    epfd = lwip_epoll_create( srv->n + 1 );
+    true_or_die( epfd >= 0, "Error: no epoll set for the server" );
+    lwip_fcntl( srv->lfd, F_SETFL, O_NONBLOCK );
+    true_or_die( watch( epfd, EPOLL_CTL_ADD, srv->lfd, EPOLLIN | EPOLLET, NULL ) == 0,
+                 "Error: could not watch the listening socket" );
+
+    while( srv->closed < srv->n ) {
+        n = lwip_epoll_wait( epfd, evs, MAX_EVENTS, STALL_MSEC );
+        if( n <= 0 ) {
+            fprintf( stderr, "server stalled with %u of %u connections closed\n",
+                     srv->closed, srv->n );
+            srv->failures += 1;
+            break;
+        }
+        for( i=0; i<n; i++ ) {
+            c = evs[i].data.ptr;
+            if( c != NULL ) {
+                if( !echo_io( epfd, c ) ) {
+                    lwip_close( c->fd );
+                    c->fd = -1;
+                    srv->closed += 1;
+                }
+                continue;
+            }
+
+            /* the listening socket: take every connection waiting */
+            while( (fd = lwip_accept( srv->lfd, NULL, NULL )) >= 0 ) {
+                if( srv->accepted == srv->n ) {
+                    fprintf( stderr, "server accepted more connections than were made\n" );
+                    srv->failures += 1;
+                    lwip_close( fd );
+                    continue;
+                }
+                c = &srv->conns[srv->accepted++];
+                c->fd = fd;
+                lwip_fcntl( fd, F_SETFL, O_NONBLOCK );
+                if( watch( epfd, EPOLL_CTL_ADD, fd, EPOLLIN | EPOLLET, c ) != 0 ) {
+                    fprintf( stderr, "could not watch a connection (errno %d)\n", errno );
+                    srv->failures += 1;
+                }
+            }
+            if( errno != EWOULDBLOCK ) {
+                fprintf( stderr, "accept failed (errno %d)\n", errno );
+                srv->failures += 1;
+            }
+        }
+    }
+
+    lwip_close( epfd );
+    return NULL;
+}
+
+/* -- the client -- */
+
+/** the byte at offset off of session id's request in round r */
+static byte pattern( unsigned id, unsigned r, unsigned off ) {
+    return (byte)(id * 7 + r * 13 + off);
+}
+
+/**
+ * Runs rounds of requests over sessions from one thread with an epoll set,
+ * and returns the number of checks which failed.
+ */
+static unsigned client_rounds( session_t* sessions, unsigned n, unsigned rounds ) {
+    struct epoll_event evs[MAX_EVENTS];
+    byte msg[MSG_LEN];
+    session_t* s;
+    unsigned failures = 0, pending, r, i, j;
+    int epfd, k, got;
+
+    epfd = lwip_epoll_create( n );
+    true_or_die( epfd >= 0, "Error: no epoll set for the client" );
+    for( i=0; i<n; i++ )
+        if( watch( epfd, EPOLL_CTL_ADD, sessions[i].fd, EPOLLIN | EPOLLET, &sessions[i] ) != 0 ) {
+            fprintf( stderr, "could not watch session %u (errno %d)\n", i, errno );
+            failures += 1;
+        }
+
+    for( r=0; r<rounds && failures==0; r++ ) {
+        for( i=0; i<n; i++ ) {
+            for( j=0; j<MSG_LEN; j++ )
+                msg[j] = pattern( i, r, j );
+            if( lwip_send( sessions[i].fd, msg, MSG_LEN, 0 ) != MSG_LEN ) {
+                fprintf( stderr, "session %u could not send (errno %d)\n", i, errno );
+                failures += 1;
+            }
+        }
+
+        pending = n;
+        while( pending > 0 && failures == 0 ) {
+            k = lwip_epoll_wait( epfd, evs, MAX_EVENTS, STALL_MSEC );
+            if( k <= 0 ) {
+                fprintf( stderr, "round %u stalled with %u echoes outstanding\n", r, pending );
+                failures += 1;
+                break;
+            }
+            while( k-- > 0 ) {
+                s = evs[k].data.ptr;
+                while( s->got < MSG_LEN ) {
+                    got = lwip_recv( s->fd, s->buf + s->got, MSG_LEN - s->got, MSG_DONTWAIT );
+                    if( got <= 0 )
+                        break;
+                    s->got += got;
+                }
+                if( s->got < MSG_LEN ) {
+                    if( got == 0 || errno != EWOULDBLOCK ) {
+                        fprintf( stderr, "session %u lost its connection\n", s->id );
+                        failures += 1;
+                    }
+                    continue;
+                }
+                for( j=0; j<MSG_LEN; j++ )
+                    if( s->buf[j] != pattern( s->id, r, j ) ) {
+                        fprintf( stderr, "session %u got a corrupt echo\n", s->id );
+                        failures += 1;
+                        break;
+                    }
+                s->got = 0;
+                pending -= 1;
+            }
+        }
+    }
+
+    /* every echo has been read, so edge-triggered sockets have nothing to say */
+    if( failures == 0 && lwip_epoll_wait( epfd, evs, MAX_EVENTS, 0 ) != 0 ) {
+        fprintf( stderr, "a drained edge-triggered socket was reported\n" );
+        failures += 1;
+    }
+    lwip_close( epfd );
+    return failures;
+}
+
+/**
+ * Serves n sessions for rounds of requests with a thread per connection or
+ * with an event loop, and returns the number of checks which failed.
+ */
+static unsigned run( bool event_loop, unsigned n, unsigned rounds ) {
+    static uint16_t port = FIRST_PORT;
+    session_t* sessions;
+    server_t srv;
+    pthread_t server;
+    uint64_t t0, t1, cs0, cs1;
+    unsigned failures = 0, i;
+
+    memset( &srv, 0, sizeof(srv) );
+    srv.n = n;
+    srv.lfd = listen_on( ++port );
+    if( event_loop )
+        srv.conns = calloc( n, sizeof(econn_t) );
+    else
+        srv.workers = calloc( n, sizeof(pthread_t) );
+    sessions = calloc( n, sizeof(session_t) );
+    true_or_die( srv.conns || srv.workers, "Error: out of memory for the server" );
+    true_or_die( sessions != NULL, "Error: out of memory for the sessions" );
+    true_or_die( pthread_create( &server, NULL, event_loop ? event_loop_main : acceptor_main,
+                                 &srv ) == 0, "Error: pthread_create failed" );
+
+    for( i=0; i<n; i++ ) {
+        sessions[i].id = i;
+        sessions[i].fd = connect_to( port );
+        if( sessions[i].fd < 0 ) {
+            fprintf( stderr, "session %u could not connect (errno %d)\n", i, errno );
+            failures += 1;
+            n = i;
+            break;
+        }
+    }
+
+    cs0 = ctx_switches();
+    t0 = now_usec();
+    if( failures == 0 )
+        failures += client_rounds( sessions, n, rounds );
+    t1 = now_usec();
+    cs1 = ctx_switches();
+
+    for( i=0; i<n; i++ )
+        lwip_close( sessions[i].fd );
+    if( !event_loop )
+        pthread_join( server, NULL );
+    for( i=0; i<srv.nworkers; i++ )
+        pthread_join( srv.workers[i], NULL );
+    if( event_loop )
+        pthread_join( server, NULL );
+    lwip_close( srv.lfd );
+    failures += srv.failures;
+
+    printf( "  %-24s %5u sessions %9.0f requests/s %7.2f context switches/request\n",
+            event_loop ? "event loop (1 thread)" : "thread per connection", n,
+            (double)n * rounds * 1e6 / (t1 > t0 ? t1 - t0 : 1),
+            (double)(cs1 - cs0) / ((double)n * rounds) );
+
+    free( sessions );
+    free( srv.conns );
+    free( srv.workers );
+    return failures;
+}
+
+/* -- the semantics -- */
+
+static void* send_later( void* arg ) {
+    usleep( 50000 );
+    lwip_send( (intptr_t)arg, "wake", 4, 0 );
+    return NULL;
+}
+
+#define CHECK( cond, what ) do { if( !(cond) ) { \
+            fprintf( stderr, "check failed: %s\n", what ); failures += 1; } } while( 0 )
+
+/** Checks readiness on one connection, and returns the number of checks which failed. */
+static unsigned check_semantics() {
+    struct epoll_event ev[4];
+    struct pollfd pfd;
+    pthread_t thread;
+    uint64_t t0;
+    unsigned failures = 0;
+    int lfd, c, s, epfd;
+    byte buf[16];
+
+    lfd = listen_on( FIRST_PORT );
+    c = connect_to( FIRST_PORT );
+    true_or_die( c >= 0, "Error: could not connect" );
+    s = lwip_accept( lfd, NULL, NULL );
+    true_or_die( s >= 0, "Error: could not accept" );
+
+    lwip_fcntl( lfd, F_SETFL, O_NONBLOCK );
+    CHECK( lwip_fcntl( lfd, F_GETFL, 0 ) & O_NONBLOCK, "the socket is non-blocking" );
+    CHECK( lwip_accept( lfd, NULL, NULL ) == -1 && errno == EWOULDBLOCK,
+           "accept with nothing to accept says EWOULDBLOCK" );
+    CHECK( lwip_recv( s, buf, sizeof(buf), MSG_DONTWAIT ) == -1 && errno == EWOULDBLOCK,
+           "recv with nothing to read says EWOULDBLOCK" );
+    CHECK( lwip_recv( -1, buf, sizeof(buf), 0 ) == -1 && errno == EBADF,
+           "recv on a bad socket says EBADF" );
+
+    epfd = lwip_epoll_create( 1 );
+    CHECK( watch( epfd, EPOLL_CTL_ADD, s, EPOLLIN | EPOLLET, &s ) == 0, "the socket is watched" );
+    CHECK( watch( epfd, EPOLL_CTL_ADD, s, EPOLLIN, &s ) == -1 && errno == EEXIST,
+           "a socket is watched only once" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 0, "a socket with nothing to read is not reported" );
+
+    lwip_send( c, "0123456789", 10, 0 );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, STALL_MSEC ) == 1 && ev[0].events == EPOLLIN &&
+           ev[0].data.ptr == &s, "data arriving is reported" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 0, "edge-triggered data is reported once" );
+    CHECK( lwip_recv( s, buf, 4, 0 ) == 4, "part of the data is read" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 0,
+           "edge-triggered data left unread is not reported again" );
+    pfd.fd = s;
+    pfd.events = POLLIN;
+    CHECK( lwip_poll( &pfd, 1, 0 ) == 1 && pfd.revents == POLLIN, "poll sees data left unread" );
+    CHECK( lwip_poll( &pfd, 1, 0 ) == 1 && pfd.revents == POLLIN, "poll sees it again" );
+
+    CHECK( watch( epfd, EPOLL_CTL_MOD, s, EPOLLIN, &s ) == 0, "the socket becomes level-triggered" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 1, "level-triggered data left unread is reported" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 1, "and reported again" );
+    CHECK( lwip_recv( s, buf, sizeof(buf), 0 ) == 6 && memcmp( buf, "456789", 6 ) == 0,
+           "the rest of the data is read" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 0, "a drained socket is not reported" );
+    CHECK( lwip_poll( &pfd, 1, 0 ) == 0, "poll sees a drained socket is not ready" );
+
+    CHECK( watch( epfd, EPOLL_CTL_MOD, s, EPOLLOUT | EPOLLET, &s ) == 0, "the socket is watched for sending" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 1 && ev[0].events == EPOLLOUT,
+           "a socket with room to send is reported" );
+
+    /* a thread waiting in poll is woken by data arriving */
+    true_or_die( pthread_create( &thread, NULL, send_later, (void*)(intptr_t)c ) == 0,
+                 "Error: pthread_create failed" );
+    t0 = now_usec();
+    CHECK( lwip_poll( &pfd, 1, STALL_MSEC ) == 1 && pfd.revents == POLLIN,
+           "poll is woken by data arriving" );
+    CHECK( now_usec() - t0 < STALL_MSEC * 1000ULL / 2, "poll is woken promptly" );
+    pthread_join( thread, NULL );
+    CHECK( lwip_recv( s, buf, sizeof(buf), 0 ) == 4, "the data that woke poll is read" );
+
+    /* the peer closing is reported, and reading then returns 0 */
+    CHECK( watch( epfd, EPOLL_CTL_MOD, s, EPOLLIN | EPOLLET, &s ) == 0, "the socket is watched again" );
+    lwip_close( c );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, STALL_MSEC ) == 1 && (ev[0].events & EPOLLIN),
+           "the peer closing is reported" );
+    CHECK( lwip_recv( s, buf, sizeof(buf), 0 ) == 0, "reading after the peer closed returns 0" );
+    CHECK( lwip_poll( &pfd, 1, 0 ) == 1, "a closed connection stays readable" );
+
+    lwip_close( s );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == 0, "a closed socket leaves its epoll set" );
+    CHECK( watch( epfd, EPOLL_CTL_DEL, s, 0, NULL ) == -1 && errno == EBADF,
+           "a closed socket cannot be removed" );
+    CHECK( lwip_close( epfd ) == 0, "the epoll set is closed" );
+    CHECK( lwip_epoll_wait( epfd, ev, 4, 0 ) == -1 && errno == EBADF,
+           "a closed epoll set cannot be waited on" );
+    lwip_close( lfd );
+    return failures;
+}
+
+/* -- the benchmark -- */
+
+static void init_done( void* arg ) {
+    sys_sem_signal( arg );
+}
+
+int main( int argc, char** argv ) {
+    unsigned sessions = 1000, rounds = 20;
+    unsigned failures = 0, mboxes, sems;
+    sys_sem_t sem;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:r:" )) != EOF ) {
+        switch( c ) {
+        case 'n': sessions = atoi( optarg ); break;
+        case 'r': rounds = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n sessions] [-r rounds]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( sessions >= 1 && sessions <= MAX_SESSIONS,
+                 "Error: the number of sessions is out of range" );
+    true_or_die( rounds >= 1, "Error: need at least one round" );
+
+    stats_init();
+    sys_init();
+    mem_init();
+    memp_init();
+    pbuf_init();
+
+    sem = sys_sem_new( 0 );
+    transport_subsys_init( init_done, sem );
+    sys_arch_sem_wait( sem, 0 );
+    sys_sem_free( sem );
+    mboxes = stats.sys.mbox.used;
+    sems = stats.sys.sem.used;
+
+    failures += check_semantics();
+
+    printf( "%u sessions, %u rounds of %u byte requests\n", sessions, rounds, MSG_LEN );
+    failures += run( FALSE, sessions, rounds );
+    failures += run( TRUE, sessions, rounds );
+
+    if( stats.sys.mbox.used != mboxes || stats.sys.sem.used != sems ) {
+        fprintf( stderr, "%d mailboxes and %d semaphores left behind\n",
+                 (int)(stats.sys.mbox.used - mboxes), (int)(stats.sys.sem.used - sems) );
+        failures += 1;
+    }
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Filename: sr_pwospf.h
+ * Purpose: PWOSPF protocol constants and packet formats.
+ *
+ * PWOSPF is the simplified OSPFv2 used between the routers: every router
+ * periodically floods a link state update (LSU) listing the subnets on each of
+ * its interfaces and the router ID of the neighbor on each (0 if none), and
+ * discovers its neighbors with hello packets.  All multi-byte fields are in
+ * network byte order.
+ */
+
+#ifndef SR_PWOSPF_H
+#define SR_PWOSPF_H
+
+#include "sr_common.h"
+
+/** IP protocol number of PWOSPF (same as OSPF) */
+#define IPPROTO_PWOSPF 89
+
+/** destination address of hellos (224.0.0.5) */
+#define PWOSPF_ALL_SPF_ROUTERS 0xE0000005
+
+#define PWOSPF_VERSION 2
+
+/** default intervals, in seconds */
+#define PWOSPF_HELLO_INT     10
+#define PWOSPF_NEIGHBOR_TIMEOUT (3 * PWOSPF_HELLO_INT)
+#define PWOSPF_LSU_INT       30
+#define PWOSPF_LSU_TIMEOUT   (3 * PWOSPF_LSU_INT)
+
+/** initial TTL of an LSU; decremented at each hop it is flooded over */
+#define PWOSPF_LSU_TTL 64
+
+typedef enum pwospf_type_t {
+    PWOSPF_TYPE_HELLO      = 1,
+    PWOSPF_TYPE_LSU        = 4,
+    PWOSPF_TYPE_LSACK      = 5,  /* acknowledges LSUs (as in OSPF) */
+    PWOSPF_TYPE_LSU_BUNDLE = 6   /* several LSUs in one packet */
+} pwospf_type_t;
+
+/** header common to all PWOSPF packets */
+typedef struct pwospf_hdr_t {
+    byte     version;
+    byte     type;
+    uint16_t len;          /* of the whole PWOSPF packet, header included */
+    uint32_t router_id;
+    uint32_t area_id;
+    uint16_t checksum;     /* over the packet, excluding the auth field */
+    uint16_t autype;
+    byte     auth[8];
+} __attribute__ ((packed)) pwospf_hdr_t;
+
+/** follows the header in a hello */
+typedef struct pwospf_hello_t {
+    addr_ip_t mask;
+    uint16_t  hello_int;
+    uint16_t  padding;
+} __attribute__ ((packed)) pwospf_hello_t;
+
+/** follows the header in an LSU; num_adv pwospf_lsa_t follow it */
+typedef struct pwospf_lsu_t {
+    uint16_t seq;
+    uint16_t ttl;
+    uint32_t num_adv;
+} __attribute__ ((packed)) pwospf_lsu_t;
+
+/** one advertised link: a subnet and the router on the other end of it */
+typedef struct pwospf_lsa_t {
+    addr_ip_t subnet;
+    addr_ip_t mask;
+    uint32_t  router_id;   /* 0 if there is no router on the subnet */
+} __attribute__ ((packed)) pwospf_lsa_t;
+
+/**
+ * follows the header in an LSU bundle; num_lsu complete LSU packets (each with
+ * its own header, whose router_id is the LSU's originator) follow it
+ */
+typedef struct pwospf_bundle_t {
+    uint32_t num_lsu;
+} __attribute__ ((packed)) pwospf_bundle_t;
+
+/** follows the header in an LSACK; num_ack pwospf_ack_entry_t follow it */
+typedef struct pwospf_ack_t {
+    uint32_t num_ack;
+} __attribute__ ((packed)) pwospf_ack_t;
+
+/** acknowledges the LSU router_id originated with sequence number seq */
+typedef struct pwospf_ack_entry_t {
+    uint32_t router_id;
+    uint16_t seq;
+    uint16_t padding;
+} __attribute__ ((packed)) pwospf_ack_entry_t;
+
+#endif /* SR_PWOSPF_H */
@@ -0,0 +1,653 @@
+/* Filename: sr_pwospf_flood.c */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sr_pwospf.h"
+#include "sr_pwospf_flood.h"
+
+/** bytes of the IP header in front of every PWOSPF packet */
+#define FLOOD_IP_HDR_LEN 20
+
+/** Returns TRUE if sequence number a is newer than b (with wrap around). */
+static bool seq_is_newer( uint16_t a, uint16_t b ) {
+    return (int16_t)(a - b) > 0;
+}
+
+/** Returns the slot of originator router_id, or FLOOD_NO_ORIG if it has none. */
+#define FLOOD_NO_ORIG 0xFFFFFFFF
+static unsigned orig_find( flood_t* f, uint32_t router_id ) {
+    unsigned mask = f->orig_hash_size - 1;
+    unsigned h;
+
+    if( !f->orig_hash_size )
+        return FLOOD_NO_ORIG;
+
+    for( h=hash32( router_id ) & mask; f->orig_hash[h]; h=(h + 1) & mask )
+        if( f->orig[f->orig_hash[h] - 1] == router_id )
+            return f->orig_hash[h] - 1;
+
+    return FLOOD_NO_ORIG;
+}
+
+static void orig_hash_insert( flood_t* f, unsigned o ) {
+    unsigned mask = f->orig_hash_size - 1;
+    unsigned h;
+
+    for( h=hash32( f->orig[o] ) & mask; f->orig_hash[h]; h=(h + 1) & mask );
+    f->orig_hash[h] = o + 1;
+}
+
+/**
+ * Returns the slot of originator router_id, giving it one if needed.  Slots
+ * are never taken back: there is one per router in the network.
+ */
+static unsigned orig_get( flood_t* f, uint32_t router_id ) {
+    unsigned o = orig_find( f, router_id );
+
+    if( o != FLOOD_NO_ORIG )
+        return o;
+
+    if( 2 * (f->num_origs + 1) > f->orig_hash_size ) {
+        free( f->orig_hash );
+        f->orig_hash_size = f->orig_hash_size ? 2 * f->orig_hash_size : 16;
+        f->orig_hash = calloc_or_die( f->orig_hash_size, sizeof(*f->orig_hash) );
+        for( o=0; o<f->num_origs; o++ )
+            orig_hash_insert( f, o );
+    }
+    if( f->num_origs == f->max_origs ) {
+        f->max_origs = f->max_origs ? 2 * f->max_origs : 16;
+        f->orig = realloc_or_die( f->orig, f->max_origs * sizeof(*f->orig) );
+    }
+
+    o = f->num_origs++;
+    f->orig[o] = router_id;
+    orig_hash_insert( f, o );
+    return o;
+}
+
+/** Makes room in n's position arrays for every originator slot. */
+static void nbr_grow_at( flood_t* f, flood_nbr_t* n ) {
+    unsigned max = f->max_origs;
+
+    if( n->max_at >= max )
+        return;
+
+    n->pending_at = realloc_or_die( n->pending_at, max * sizeof(unsigned) );
+    n->rxmt_at = realloc_or_die( n->rxmt_at, max * sizeof(unsigned) );
+    n->ack_at = realloc_or_die( n->ack_at, max * sizeof(unsigned) );
+    memset( n->pending_at + n->max_at, 0, (max - n->max_at) * sizeof(unsigned) );
+    memset( n->rxmt_at + n->max_at, 0, (max - n->max_at) * sizeof(unsigned) );
+    memset( n->ack_at + n->max_at, 0, (max - n->max_at) * sizeof(unsigned) );
+    n->max_at = max;
+}
+
+/** Returns a copy of an LSU packet with one reference. */
+static flood_lsu_t* lsu_new( flood_t* f, const byte* pkt, unsigned len ) {
+    const pwospf_hdr_t* hdr = (const pwospf_hdr_t*)pkt;
+    const pwospf_lsu_t* lsu = (const pwospf_lsu_t*)(hdr + 1);
+    flood_lsu_t* l;
+
+    l = malloc_or_die( sizeof(*l) - 1 + len );
+    l->refcnt = 1;
+    l->router_id = hdr->router_id;
+    l->orig = orig_get( f, hdr->router_id );
+    l->seq = ntohs( lsu->seq );
+    l->len = len;
+    memcpy( l->pkt, pkt, len );
+    return l;
+}
+
+static void lsu_unref( flood_lsu_t* l ) {
+    if( --l->refcnt == 0 )
+        free( l );
+}
+
+static flood_nbr_t* nbr_find( flood_t* f, uint32_t router_id ) {
+    unsigned i;
+
+    for( i=0; i<f->num_nbrs; i++ )
+        if( f->nbr[i].router_id == router_id )
+            return &f->nbr[i];
+
+    return NULL;
+}
+
+/** Drops the i'th entry of n's retransmit list, moving the last one into it. */
+static void nbr_rxmt_remove( flood_nbr_t* n, unsigned i ) {
+    n->rxmt_at[n->rxmt[i].lsu->orig] = 0;
+    lsu_unref( n->rxmt[i].lsu );
+    n->rxmt[i] = n->rxmt[--n->num_rxmt];
+    if( i < n->num_rxmt )
+        n->rxmt_at[n->rxmt[i].lsu->orig] = i + 1;
+}
+
+/** Drops the i'th entry of n's queue, moving the last one into it. */
+static void nbr_pending_remove( flood_nbr_t* n, unsigned i ) {
+    n->pending_at[n->pending[i]->orig] = 0;
+    lsu_unref( n->pending[i] );
+    n->pending[i] = n->pending[--n->num_pending];
+    if( i < n->num_pending )
+        n->pending_at[n->pending[i]->orig] = i + 1;
+}
+
+/** Queues lsu for n unless n has or is already getting it (or a newer one). */
+static void nbr_enqueue( flood_t* f, flood_nbr_t* n, flood_lsu_t* l ) {
+    unsigned i;
+
+    nbr_grow_at( f, n );
+
+    if( (i = n->rxmt_at[l->orig]) ) {
+        if( !seq_is_newer( l->seq, n->rxmt[i-1].lsu->seq ) )
+            return;
+
+        /* no point retransmitting the old one */
+        nbr_rxmt_remove( n, i - 1 );
+        f->superseded += 1;
+    }
+
+    if( (i = n->pending_at[l->orig]) ) {
+        if( !seq_is_newer( l->seq, n->pending[i-1]->seq ) )
+            return;
+
+        lsu_unref( n->pending[i-1] );
+        l->refcnt += 1;
+        n->pending[i-1] = l;
+        f->superseded += 1;
+        return;
+    }
+
+    if( n->num_pending == n->max_pending ) {
+        n->max_pending = n->max_pending ? 2 * n->max_pending : 8;
+        n->pending = realloc_or_die( n->pending, n->max_pending * sizeof(*n->pending) );
+    }
+    l->refcnt += 1;
+    n->pending[n->num_pending++] = l;
+    n->pending_at[l->orig] = n->num_pending;
+}
+
+/**
+ * Notes that n has the LSU router_id originated with sequence number seq, so
+ * neither it nor anything older need be sent or retransmitted to n.
+ */
+static void nbr_has( flood_t* f, flood_nbr_t* n, uint32_t router_id, uint16_t seq ) {
+    unsigned o = orig_find( f, router_id );
+    unsigned i;
+
+    if( o == FLOOD_NO_ORIG || o >= n->max_at )
+        return; /* nothing of router_id's was ever queued for n */
+
+    if( (i = n->rxmt_at[o]) && !seq_is_newer( n->rxmt[i-1].lsu->seq, seq ) )
+        nbr_rxmt_remove( n, i - 1 );
+
+    if( (i = n->pending_at[o]) && !seq_is_newer( n->pending[i-1]->seq, seq ) ) {
+        nbr_pending_remove( n, i - 1 );
+        f->suppressed += 1;
+    }
+}
+
+static void nbr_queue_ack( flood_t* f, flood_nbr_t* n, uint32_t router_id, uint16_t seq ) {
+    unsigned o = orig_get( f, router_id );
+    unsigned i;
+
+    nbr_grow_at( f, n );
+    if( (i = n->ack_at[o]) && n->ack[i-1].seq == seq )
+        return;
+
+    if( n->num_ack == n->max_ack ) {
+        n->max_ack = n->max_ack ? 2 * n->max_ack : 8;
+        n->ack = realloc_or_die( n->ack, n->max_ack * sizeof(*n->ack) );
+    }
+    n->ack[n->num_ack].router_id = router_id;
+    n->ack[n->num_ack].orig = o;
+    n->ack[n->num_ack].seq = seq;
+    n->num_ack += 1;
+    n->ack_at[o] = n->num_ack;
+}
+
+static void nbr_free( flood_nbr_t* n ) {
+    unsigned i;
+
+    for( i=0; i<n->num_pending; i++ )
+        lsu_unref( n->pending[i] );
+    for( i=0; i<n->num_rxmt; i++ )
+        lsu_unref( n->rxmt[i].lsu );
+    free( n->pending );
+    free( n->rxmt );
+    free( n->ack );
+    free( n->pending_at );
+    free( n->rxmt_at );
+    free( n->ack_at );
+}
+
+/** Queues l for every neighbor other than except (and l's originator). */
+static void flood_forward( flood_t* f, flood_lsu_t* l, flood_nbr_t* except ) {
+    unsigned i;
+
+    for( i=0; i<f->num_nbrs; i++ )
+        if( &f->nbr[i] != except && f->nbr[i].router_id != l->router_id )
+            nbr_enqueue( f, &f->nbr[i], l );
+}
+
+void flood_init( flood_t* f, uint32_t router_id, uint32_t pace_ms, uint32_t rxmt_ms,
+                 lsdb_t* lsdb, flood_send_cb send, flood_install_cb install,
+                 flood_reoriginate_cb reoriginate, void* cb_arg ) {
+    unsigned i;
+
+    memset( f, 0, sizeof(*f) );
+    f->router_id = router_id;
+    f->pace_ms = pace_ms;
+    f->rxmt_ms = rxmt_ms ? rxmt_ms : FLOOD_RXMT_MS;
+    f->bundle = pace_ms != 0;
+    f->lsdb = lsdb;
+    f->send = send;
+    f->install = install;
+    f->reoriginate = reoriginate;
+    f->cb_arg = cb_arg;
+
+    for( i=0; i<FLOOD_MAX_IFACES; i++ )
+        f->iface[i].mtu = FLOOD_DEFAULT_MTU;
+    f->buf = malloc_or_die( FLOOD_DEFAULT_MTU );
+}
+
+void flood_destroy( flood_t* f ) {
+    unsigned i;
+
+    for( i=0; i<f->num_nbrs; i++ )
+        nbr_free( &f->nbr[i] );
+    free( f->nbr );
+    free( f->buf );
+    free( f->orig );
+    free( f->orig_hash );
+    f->nbr = NULL;
+    f->buf = NULL;
+    f->orig = NULL;
+    f->orig_hash = NULL;
+    f->num_nbrs = f->max_nbrs = 0;
+    f->num_origs = f->max_origs = f->orig_hash_size = 0;
+}
+
+void flood_set_mtu( flood_t* f, unsigned iface, unsigned mtu ) {
+    unsigned i, max = 0;
+
+    true_or_die( iface < FLOOD_MAX_IFACES, "Error: interface %u out of range", iface );
+    f->iface[iface].mtu = mtu;
+
+    for( i=0; i<FLOOD_MAX_IFACES; i++ )
+        if( f->iface[i].mtu > max )
+            max = f->iface[i].mtu;
+    f->buf = realloc_or_die( f->buf, max );
+}
+
+void flood_add_neighbor( flood_t* f, unsigned iface, uint32_t router_id ) {
+    flood_nbr_t* n;
+
+    true_or_die( iface < FLOOD_MAX_IFACES, "Error: interface %u out of range", iface );
+    if( nbr_find( f, router_id ) )
+        return;
+
+    if( f->num_nbrs == f->max_nbrs ) {
+        f->max_nbrs = f->max_nbrs ? 2 * f->max_nbrs : 4;
+        f->nbr = realloc_or_die( f->nbr, f->max_nbrs * sizeof(*f->nbr) );
+    }
+    n = &f->nbr[f->num_nbrs++];
+    memset( n, 0, sizeof(*n) );
+    n->router_id = router_id;
+    n->iface = iface;
+}
+
+void flood_remove_neighbor( flood_t* f, uint32_t router_id ) {
+    flood_nbr_t* n = nbr_find( f, router_id );
+
+    if( !n )
+        return;
+
+    nbr_free( n );
+    *n = f->nbr[--f->num_nbrs];
+}
+
+void flood_originate( flood_t* f, const byte* pkt, unsigned len ) {
+    flood_lsu_t* l = lsu_new( f, pkt, len );
+
+    flood_forward( f, l, NULL );
+    lsu_unref( l );
+}
+
+void flood_to_neighbor( flood_t* f, uint32_t nbr_id, const byte* pkt, unsigned len ) {
+    flood_nbr_t* n = nbr_find( f, nbr_id );
+    flood_lsu_t* l;
+
+    if( !n )
+        return;
+
+    l = lsu_new( f, pkt, len );
+    nbr_enqueue( f, n, l );
+    lsu_unref( l );
+}
+
+void flood_originate_links( flood_t* f, uint16_t seq, const lsdb_link_t* links,
+                            unsigned num_links, uint64_t now_ms ) {
+    byte* pkt = malloc_or_die( LSDB_LSU_LEN(num_links) );
+    unsigned len;
+
+    len = lsdb_lsu_make( pkt, f->router_id, seq, links, num_links );
+    f->install( f->cb_arg, pkt, len, now_ms );
+    flood_originate( f, pkt, len );
+    free( pkt );
+}
+
+/** Queues the LSU database entry e was built from for n. */
+static void nbr_enqueue_entry( flood_t* f, flood_nbr_t* n, const lsdb_entry_t* e ) {
+    byte* pkt = malloc_or_die( LSDB_LSU_LEN(e->num_links) );
+    flood_lsu_t* l;
+    unsigned len;
+
+    len = lsdb_lsu_make( pkt, e->router_id, e->seq, e->links, e->num_links );
+    l = lsu_new( f, pkt, len );
+    nbr_enqueue( f, n, l );
+    lsu_unref( l );
+    free( pkt );
+}
+
+void flood_sync( flood_t* f, uint32_t nbr_id ) {
+    flood_nbr_t* n = nbr_find( f, nbr_id );
+    lsdb_entry_t* e;
+    unsigned i;
+
+    if( !n )
+        return;
+
+    for( i=0; i<f->lsdb->num_buckets; i++ )
+        for( e=f->lsdb->bucket[i]; e; e=e->next )
+            nbr_enqueue_entry( f, n, e );
+}
+
+/**
+ * Handles a copy of this router's own LSU, with sequence number seq, received
+ * from n.  If n holds one at least as new as the installed one (one with the
+ * same sequence number must also advertise the same links), the router must
+ * originate past it; if n is behind, it is sent the installed one.
+ */
+static void flood_self_input( flood_t* f, flood_nbr_t* n, const byte* pkt,
+                              unsigned len, uint16_t seq, uint64_t now_ms ) {
+    lsdb_entry_t* e = lsdb_find( f->lsdb, f->router_id );
+
+    nbr_queue_ack( f, n, f->router_id, seq );
+    nbr_has( f, n, f->router_id, seq );
+    if( !e || seq_is_newer( seq, e->seq )
+        || (seq == e->seq && !lsdb_lsu_matches( f->lsdb, pkt, len )) )
+        f->reoriginate( f->cb_arg, seq, now_ms );
+    else if( seq != e->seq )
+        nbr_enqueue_entry( f, n, e );
+}
+
+/** Handles one LSU packet received from n. */
+static void flood_lsu_input( flood_t* f, flood_nbr_t* n, const byte* pkt, unsigned len,
+                             uint64_t now_ms ) {
+    const pwospf_hdr_t* hdr = (const pwospf_hdr_t*)pkt;
+    const pwospf_lsu_t* lsu = (const pwospf_lsu_t*)(hdr + 1);
+    pwospf_lsu_t* fwd_lsu;
+    flood_lsu_t* l;
+    uint16_t seq;
+
+    if( len < sizeof(*hdr) + sizeof(*lsu) )
+        return;
+    seq = ntohs( lsu->seq );
+
+    if( hdr->router_id == f->router_id ) {
+        flood_self_input( f, n, pkt, len, seq, now_ms );
+        return;
+    }
+
+    switch( f->install( f->cb_arg, pkt, len, now_ms ) ) {
+    case LSDB_CHANGED:
+    case LSDB_REFRESHED:
+        nbr_queue_ack( f, n, hdr->router_id, seq );
+        nbr_has( f, n, hdr->router_id, seq );
+        if( ntohs( lsu->ttl ) <= 1 )
+            break;
+
+        l = lsu_new( f, pkt, len );
+        fwd_lsu = (pwospf_lsu_t*)(l->pkt + sizeof(*hdr));
+        fwd_lsu->ttl = htons( ntohs( lsu->ttl ) - 1 );
+        flood_forward( f, l, n );
+        lsu_unref( l );
+        break;
+
+    case LSDB_DUPLICATE:
+        /* n has it too: an implicit ack, and the reason n may be retransmitting */
+        nbr_queue_ack( f, n, hdr->router_id, seq );
+        nbr_has( f, n, hdr->router_id, seq );
+        break;
+
+    case LSDB_STALE:
+        /* n is behind: it may have missed the newer one while it was away */
+        nbr_queue_ack( f, n, hdr->router_id, seq );
+        nbr_enqueue_entry( f, n, lsdb_find( f->lsdb, hdr->router_id ) );
+        break;
+
+    case LSDB_INVALID:
+        break;
+    }
+}
+
+void flood_input( flood_t* f, uint32_t nbr_id, const byte* pkt, unsigned len,
+                  uint64_t now_ms ) {
+    const pwospf_hdr_t* hdr = (const pwospf_hdr_t*)pkt;
+    const pwospf_hdr_t* inner;
+    const pwospf_ack_entry_t* ack;
+    flood_nbr_t* n = nbr_find( f, nbr_id );
+    unsigned num, off, inner_len, i;
+
+    if( !n || len < sizeof(*hdr) + sizeof(uint32_t) || hdr->version != PWOSPF_VERSION )
+        return;
+
+    switch( hdr->type ) {
+    case PWOSPF_TYPE_LSU:
+        flood_lsu_input( f, n, pkt, len, now_ms );
+        break;
+
+    case PWOSPF_TYPE_LSU_BUNDLE:
+        num = ntohl( ((const pwospf_bundle_t*)(hdr + 1))->num_lsu );
+        off = sizeof(*hdr) + sizeof(pwospf_bundle_t);
+        for( i=0; i<num && off + sizeof(*inner) <= len; i++ ) {
+            inner = (const pwospf_hdr_t*)(pkt + off);
+            inner_len = ntohs( inner->len );
+            if( inner_len < sizeof(*inner) || off + inner_len > len )
+                break;
+            flood_lsu_input( f, n, pkt + off, inner_len, now_ms );
+            off += inner_len;
+        }
+        break;
+
+    case PWOSPF_TYPE_LSACK:
+        num = ntohl( ((const pwospf_ack_t*)(hdr + 1))->num_ack );
+        ack = (const pwospf_ack_entry_t*)(pkt + sizeof(*hdr) + sizeof(pwospf_ack_t));
+        if( num > (len - sizeof(*hdr) - sizeof(pwospf_ack_t)) / sizeof(*ack) )
+            return;
+        for( i=0; i<num; i++ )
+            nbr_has( f, n, ack[i].router_id, ntohs( ack[i].seq ) );
+        break;
+    }
+}
+
+/** Fills in the header of the packet of type and len in f->buf and sends it. */
+static void flood_send_buf( flood_t* f, flood_nbr_t* n, byte type, unsigned len ) {
+    pwospf_hdr_t* hdr = (pwospf_hdr_t*)f->buf;
+
+    memset( hdr, 0, sizeof(*hdr) );
+    hdr->version = PWOSPF_VERSION;
+    hdr->type = type;
+    hdr->len = htons( len );
+    hdr->router_id = f->router_id;
+
+    f->send( f->cb_arg, n->iface, n->router_id, f->buf, len );
+    f->bytes_sent += len;
+}
+
+/** Sends everything queued for n, in as few packets as its MTU allows. */
+static void nbr_flush( flood_t* f, flood_nbr_t* n, uint64_t now_ms ) {
+    unsigned max = f->iface[n->iface].mtu - FLOOD_IP_HDR_LEN;
+    const unsigned bundle_hdr = sizeof(pwospf_hdr_t) + sizeof(pwospf_bundle_t);
+    const unsigned ack_hdr = sizeof(pwospf_hdr_t) + sizeof(pwospf_ack_t);
+    pwospf_ack_entry_t* ack;
+    flood_lsu_t* l;
+    unsigned i, j, off, count;
+
+    if( n->num_rxmt + n->num_pending > n->max_rxmt ) {
+        n->max_rxmt = n->num_rxmt + n->num_pending;
+        n->rxmt = realloc_or_die( n->rxmt, n->max_rxmt * sizeof(*n->rxmt) );
+    }
+
+    for( i=0; i<n->num_pending; ) {
+        off = bundle_hdr;
+        count = 0;
+        while( i + count < n->num_pending && f->bundle
+               && off + n->pending[i + count]->len <= max ) {
+            off += n->pending[i + count]->len;
+            count += 1;
+        }
+
+        if( count <= 1 ) {
+            /* on its own, as a plain LSU */
+            l = n->pending[i];
+            f->send( f->cb_arg, n->iface, n->router_id, l->pkt, l->len );
+            f->bytes_sent += l->len;
+            count = 1;
+        }
+        else {
+            off = bundle_hdr;
+            for( j=i; j<i+count; j++ ) {
+                memcpy( f->buf + off, n->pending[j]->pkt, n->pending[j]->len );
+                off += n->pending[j]->len;
+            }
+            ((pwospf_bundle_t*)(f->buf + sizeof(pwospf_hdr_t)))->num_lsu = htonl( count );
+            flood_send_buf( f, n, PWOSPF_TYPE_LSU_BUNDLE, off );
+        }
+        f->lsu_pkts += 1;
+        f->lsus_sent += count;
+
+        /* the reference moves to the retransmit list */
+        for( j=i; j<i+count; j++ ) {
+            n->pending_at[n->pending[j]->orig] = 0;
+            n->rxmt[n->num_rxmt].lsu = n->pending[j];
+            n->rxmt[n->num_rxmt].sent_ms = now_ms;
+            n->num_rxmt += 1;
+            n->rxmt_at[n->pending[j]->orig] = n->num_rxmt;
+        }
+        if( now_ms + f->rxmt_ms < n->rxmt_due_ms )
+            n->rxmt_due_ms = now_ms + f->rxmt_ms;
+        i += count;
+    }
+    n->num_pending = 0;
+
+    for( i=0; i<n->num_ack; ) {
+        count = f->bundle ? (max - ack_hdr) / sizeof(*ack) : 1;
+        if( count > n->num_ack - i )
+            count = n->num_ack - i;
+
+        ((pwospf_ack_t*)(f->buf + sizeof(pwospf_hdr_t)))->num_ack = htonl( count );
+        ack = (pwospf_ack_entry_t*)(f->buf + ack_hdr);
+        for( j=0; j<count; j++ ) {
+            ack[j].router_id = n->ack[i + j].router_id;
+            ack[j].seq = htons( n->ack[i + j].seq );
+            ack[j].padding = 0;
+            n->ack_at[n->ack[i + j].orig] = 0;
+        }
+        flood_send_buf( f, n, PWOSPF_TYPE_LSACK, ack_hdr + count * sizeof(*ack) );
+        f->ack_pkts += 1;
+        f->acks_sent += count;
+        i += count;
+    }
+    n->num_ack = 0;
+}
+
+int64_t flood_timer( flood_t* f, uint64_t now_ms ) {
+    bool ready[FLOOD_MAX_IFACES];
+    flood_iface_t* fi;
+    flood_nbr_t* n;
+    flood_lsu_t* l;
+    int64_t next = -1, t;
+    unsigned i, j;
+
+    /* requeue what has gone unacknowledged for too long; rxmt_due_ms only
+       moves later when the list is scanned, so most calls skip the scan */
+    for( i=0; i<f->num_nbrs; i++ ) {
+        n = &f->nbr[i];
+        if( !n->num_rxmt || now_ms < n->rxmt_due_ms )
+            continue;
+
+        n->rxmt_due_ms = 0xFFFFFFFFFFFFFFFFULL;
+        for( j=0; j<n->num_rxmt; ) {
+            if( n->rxmt[j].sent_ms + f->rxmt_ms > now_ms ) {
+                if( n->rxmt[j].sent_ms + f->rxmt_ms < n->rxmt_due_ms )
+                    n->rxmt_due_ms = n->rxmt[j].sent_ms + f->rxmt_ms;
+                j++;
+                continue;
+            }
+            l = n->rxmt[j].lsu;
+            l->refcnt += 1;
+            nbr_rxmt_remove( n, j );
+            nbr_enqueue( f, n, l );
+            lsu_unref( l );
+            f->retransmits += 1;
+        }
+    }
+
+    /* flush each interface whose pacing interval is up */
+    for( i=0; i<FLOOD_MAX_IFACES; i++ )
+        ready[i] = now_ms >= f->iface[i].next_tx_ms;
+    for( i=0; i<f->num_nbrs; i++ ) {
+        n = &f->nbr[i];
+        if( !n->num_pending && !n->num_ack )
+            continue;
+
+        fi = &f->iface[n->iface];
+        if( ready[n->iface] ) {
+            nbr_flush( f, n, now_ms );
+            fi->next_tx_ms = now_ms + f->pace_ms;
+        }
+        else {
+            t = fi->next_tx_ms - now_ms;
+            if( next < 0 || t < next )
+                next = t;
+        }
+    }
+
+    for( i=0; i<f->num_nbrs; i++ ) {
+        n = &f->nbr[i];
+        if( n->num_rxmt ) {
+            t = n->rxmt_due_ms > now_ms ? (int64_t)(n->rxmt_due_ms - now_ms) : 0;
+            if( next < 0 || t < next )
+                next = t;
+        }
+    }
+
+    return next;
+}
+
+bool flood_idle( flood_t* f ) {
+    unsigned i;
+
+    for( i=0; i<f->num_nbrs; i++ )
+        if( f->nbr[i].num_pending || f->nbr[i].num_rxmt || f->nbr[i].num_ack )
+            return FALSE;
+
+    return TRUE;
+}
+
+int flood_to_string( flood_t* f, char* buf, int len ) {
+    return my_snprintf( buf, len,
+                        "Flooding: pace %ums, retransmit %ums, %s\n"
+                        "Sent: %llu LSU packets (%llu LSUs), %llu ack packets (%llu acks), %llu bytes\n"
+                        "Retransmitted: %llu  Superseded: %llu  Suppressed: %llu\n",
+                        f->pace_ms, f->rxmt_ms, f->bundle ? "bundled" : "unbundled",
+                        (unsigned long long)f->lsu_pkts,
+                        (unsigned long long)f->lsus_sent,
+                        (unsigned long long)f->ack_pkts,
+                        (unsigned long long)f->acks_sent,
+                        (unsigned long long)f->bytes_sent,
+                        (unsigned long long)f->retransmits,
+                        (unsigned long long)f->superseded,
+                        (unsigned long long)f->suppressed );
+}
@@ -0,0 +1,237 @@
+/*
+ * Filename: sr_pwospf_flood.h
+ * Purpose: Paced, batched LSU flooding with per-neighbor retransmission.
+ *
+ * Forwarding every LSU to every neighbor the moment it arrives multiplies the
+ * control traffic during convergence: each change is flooded as a separate
+ * packet over every link, and copies of LSUs a neighbor already has, or which
+ * a newer LSU has replaced, are sent anyway.  Instead each neighbor has a queue
+ * of LSUs waiting to be sent to it, which holds at most one LSU per originator
+ * (a newer LSU replaces a queued older one), and a list of the LSUs sent to it
+ * which it has not yet acknowledged.  Each interface is paced: its queues are
+ * flushed at most once every pace_ms, and everything waiting is sent in as few
+ * LSU bundles as the interface MTU allows.  Acknowledgements are likewise
+ * delayed and sent together.  An LSU which is not acknowledged within rxmt_ms
+ * is queued again.  Receiving a copy of an LSU from a neighbor acknowledges it
+ * implicitly, and it is not sent back.  A neighbor which sends an LSU older
+ * than the one in the database is sent the database's copy in return.
+ *
+ * Copies of this router's own LSU are never installed as another router's.
+ * If a neighbor holds one at least as new as the last this router originated,
+ * as its neighbors do when it restarts without its old sequence number, the
+ * router is told to originate again past it, as OSPF does.
+ *
+ * Each originator seen is given a small slot number, and every neighbor keeps
+ * the position of each originator's LSU in its queue, retransmit list and acks
+ * by slot, so queuing, superseding and acknowledging an LSU take constant time
+ * however long the queues grow while a large network converges.
+ *
+ * With pacing and bundling off, every LSU and every ack goes out in a packet of
+ * its own, as plain PWOSPF LSUs; a bundle holding a single LSU is always sent
+ * that way.
+ *
+ * All times are explicit, in milliseconds, so a simulation can drive flooding
+ * with virtual time.  Not thread-safe; the router serializes access with its
+ * ospf_lock.
+ */
+
+#ifndef SR_PWOSPF_FLOOD_H
+#define SR_PWOSPF_FLOOD_H
+
+#include "sr_common.h"
+#include "sr_pwospf_lsdb.h"
+
+/** defaults */
+#define FLOOD_DEFAULT_MTU 1500
+#define FLOOD_PACE_MS     10
+#define FLOOD_RXMT_MS     1000
+
+/** max number of interfaces */
+#define FLOOD_MAX_IFACES  32
+
+/** an LSU being flooded, shared by every queue it is on */
+typedef struct flood_lsu_t {
+    unsigned refcnt;
+    uint32_t router_id;     /* originator */
+    unsigned orig;          /* its slot */
+    uint16_t seq;
+    unsigned len;
+    byte     pkt[1];        /* the complete LSU packet; len bytes */
+} flood_lsu_t;
+
+/** an LSU sent to a neighbor and not yet acknowledged */
+typedef struct flood_rxmt_t {
+    flood_lsu_t* lsu;
+    uint64_t     sent_ms;
+} flood_rxmt_t;
+
+/** an acknowledgement waiting to be sent */
+typedef struct flood_ack_t {
+    uint32_t router_id;
+    unsigned orig;          /* slot of router_id */
+    uint16_t seq;
+} flood_ack_t;
+
+/** a neighbor LSUs are flooded to */
+typedef struct flood_nbr_t {
+    uint32_t      router_id;
+    unsigned      iface;
+    flood_lsu_t** pending;      /* waiting to be sent, one per originator */
+    unsigned      num_pending, max_pending;
+    flood_rxmt_t* rxmt;         /* sent, not yet acknowledged */
+    unsigned      num_rxmt, max_rxmt;
+    flood_ack_t*  ack;          /* acknowledgements waiting to be sent */
+    unsigned      num_ack, max_ack;
+    uint64_t      rxmt_due_ms;  /* no retransmission is due before this */
+
+    /* by originator slot: 1 + the index of its entry in pending, rxmt and ack,
+       or 0 if it has none */
+    unsigned*     pending_at;
+    unsigned*     rxmt_at;
+    unsigned*     ack_at;
+    unsigned      max_at;
+} flood_nbr_t;
+
+/** an interface neighbors are reached through */
+typedef struct flood_iface_t {
+    unsigned mtu;               /* of the IP packet */
+    uint64_t next_tx_ms;        /* earliest the queues may be flushed again */
+} flood_iface_t;
+
+/** sends the PWOSPF packet pkt to neighbor nbr_id through interface iface */
+typedef void (*flood_send_cb)( void* arg, unsigned iface, uint32_t nbr_id,
+                               const byte* pkt, unsigned len );
+
+/**
+ * installs an LSU packet received at now_ms (e.g. with lsdb_lsu_input()); the
+ * result decides whether it is flooded further
+ */
+typedef lsdb_result_t (*flood_install_cb)( void* arg, const byte* pkt, unsigned len,
+                                           uint64_t now_ms );
+
+/**
+ * a neighbor holds a copy of this router's own LSU with sequence number seq,
+ * not older than the last it originated: it must originate its LSU again with
+ * a greater sequence number
+ */
+typedef void (*flood_reoriginate_cb)( void* arg, uint16_t seq, uint64_t now_ms );
+
+/** the flooding state of a router */
+typedef struct flood_t {
+    uint32_t      router_id;
+    flood_iface_t iface[FLOOD_MAX_IFACES];
+    flood_nbr_t*  nbr;
+    unsigned      num_nbrs, max_nbrs;
+
+    /* originator slots: orig[i] is the router ID in slot i, and orig_hash maps
+       a router ID to 1 + its slot (open addressing, at most half full) */
+    uint32_t*     orig;
+    unsigned      num_origs, max_origs;
+    unsigned*     orig_hash;
+    unsigned      orig_hash_size;
+
+    uint32_t      pace_ms;
+    uint32_t      rxmt_ms;
+    bool          bundle;       /* FALSE: one LSU or ack per packet */
+
+    lsdb_t*              lsdb;  /* what install installs into */
+    flood_send_cb        send;
+    flood_install_cb     install;
+    flood_reoriginate_cb reoriginate;
+    void*                cb_arg;
+    byte*            buf;       /* packet being built */
+
+    /* statistics */
+    uint64_t lsu_pkts;          /* packets carrying LSUs sent */
+    uint64_t ack_pkts;          /* ack packets sent */
+    uint64_t lsus_sent;         /* LSUs sent, counting each in a bundle */
+    uint64_t acks_sent;
+    uint64_t retransmits;       /* LSUs queued again for lack of an ack */
+    uint64_t superseded;        /* queued LSUs replaced by a newer one */
+    uint64_t suppressed;        /* LSUs not sent since the neighbor had them */
+    uint64_t bytes_sent;
+} flood_t;
+
+/**
+ * Initializes flooding for router router_id.  install is called with each LSU
+ * received from another router, to install it in lsdb, and send with each
+ * packet to transmit; reoriginate is called when the router's own LSU must be
+ * originated again.  Zero pace_ms turns both pacing and bundling off; zero
+ * rxmt_ms selects FLOOD_RXMT_MS.
+ */
+void flood_init( flood_t* f, uint32_t router_id, uint32_t pace_ms, uint32_t rxmt_ms,
+                 lsdb_t* lsdb, flood_send_cb send, flood_install_cb install,
+                 flood_reoriginate_cb reoriginate, void* cb_arg );
+
+/** Frees everything f holds. */
+void flood_destroy( flood_t* f );
+
+/** Sets the MTU of interface iface (FLOOD_DEFAULT_MTU until set). */
+void flood_set_mtu( flood_t* f, unsigned iface, unsigned mtu );
+
+/** Adds neighbor router_id, reached through interface iface. */
+void flood_add_neighbor( flood_t* f, unsigned iface, uint32_t router_id );
+
+/** Removes neighbor router_id, dropping everything queued for it. */
+void flood_remove_neighbor( flood_t* f, uint32_t router_id );
+
+/**
+ * Floods an LSU this router originated (pkt is the complete LSU packet, which
+ * is copied) to every neighbor.
+ */
+void flood_originate( flood_t* f, const byte* pkt, unsigned len );
+
+/**
+ * Queues an LSU (the complete packet, which is copied) for neighbor nbr_id
+ * alone, e.g. to send it the whole database when the adjacency comes up.
+ */
+void flood_to_neighbor( flood_t* f, uint32_t nbr_id, const byte* pkt, unsigned len );
+
+/**
+ * Originates this router's LSU with sequence number seq listing links: it is
+ * passed to the install callback as a received one would be, and flooded to
+ * every neighbor.
+ */
+void flood_originate_links( flood_t* f, uint16_t seq, const lsdb_link_t* links,
+                            unsigned num_links, uint64_t now_ms );
+
+/**
+ * Queues every LSU in the database for new neighbor nbr_id, so that it learns
+ * the whole database when the adjacency comes up.
+ */
+void flood_sync( flood_t* f, uint32_t nbr_id );
+
+/**
+ * Handles a PWOSPF LSU, LSU bundle or LSACK packet received from neighbor
+ * nbr_id.  Each LSU from another router is passed to the install callback and,
+ * if it was newer than what was installed, queued for the other neighbors; if
+ * it was older, the installed one is queued for nbr_id.  A copy of the
+ * router's own LSU may call the reoriginate callback.
+ */
+void flood_input( flood_t* f, uint32_t nbr_id, const byte* pkt, unsigned len,
+                  uint64_t now_ms );
+
+/**
+ * Sends whatever is due by now_ms: the queues of interfaces whose pacing
+ * interval has passed, and retransmissions.
+ *
+ * @return ms until there will be something to do, or -1 if there is nothing
+ *         queued at all
+ */
+int64_t flood_timer( flood_t* f, uint64_t now_ms );
+
+/** Returns TRUE if nothing is queued or awaiting acknowledgement. */
+bool flood_idle( flood_t* f );
+
+/** max length of the string made by flood_to_string() */
+#define STR_FLOOD_MAX_LEN 256
+
+/**
+ * Fills buf with the flooding statistics.  It takes up to STR_FLOOD_MAX_LEN
+ * characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int flood_to_string( flood_t* f, char* buf, int len );
+
+#endif /* SR_PWOSPF_FLOOD_H */
@@ -0,0 +1,544 @@
+/*
+ * Filename: sr_pwospf_flood_test.c
+ * Purpose: Simulates PWOSPF flooding and counts control packets per change.
+ *
+ * Every router of a topology runs its own LSDB and flooding state; packets
+ * between neighbors take 1ms of virtual time and a fraction of them is lost.
+ * After the initial flood, links are flapped (one at a time, and in bursts of
+ * several at once) and the simulation runs until every queue has drained; each
+ * router's LSDB must then hold the latest LSU of every router it can reach.  When a link comes
+ * back up each end sends the other its whole database, since a burst may have
+ * partitioned the network.  Then a router is restarted with an empty database
+ * and its sequence numbers starting over, and must originate past the LSU its
+ * neighbors kept from before.  The LSU and ack packets sent per topology change
+ * are reported for immediate, unbundled flooding and for paced, bundled
+ * flooding.  The topologies are thames (see sr_topologies/thames.py) and larger
+ * rings of routers with random chords.
+ *
+ * Usage: test_flood [-c changes] [-l loss_percent] [-s seed]
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "sr_pwospf.h"
+#include "sr_pwospf_flood.h"
+#include "sr_pwospf_lsdb.h"
+
+/** give up on a change if flooding has not finished after this long */
+#define SIM_TIMEOUT_MS 120000
+
+/** thames router to router links (10.0.subnet.0/24 joins a and b) */
+static const unsigned thames_link[][3] = {
+    { 2, 0, 1 }, { 3, 0, 2 }, { 4, 1, 3 }, { 5, 3, 4 }, { 6, 4, 5 },
+    { 7, 5, 6 }, { 8, 6, 7 }, { 9, 7, 8 }, { 10, 8, 9 }, { 11, 9, 2 }
+};
+#define THAMES_ROUTERS 10
+#define THAMES_LINKS (sizeof(thames_link)/sizeof(thames_link[0]))
+
+struct sim_t;
+
+typedef struct sim_link_t {
+    unsigned a, b;          /* routers */
+    unsigned a_if, b_if;    /* their interfaces */
+    uint32_t subnet;        /* nbo */
+    bool up;
+} sim_link_t;
+
+typedef struct sim_router_t {
+    struct sim_t* sim;
+    uint32_t rid;
+    uint16_t seq;
+    lsdb_t lsdb;
+    flood_t flood;
+    unsigned link[FLOOD_MAX_IFACES];    /* by interface */
+    unsigned num_ifaces;
+} sim_router_t;
+
+typedef struct sim_pkt_t {
+    unsigned dst;
+    uint32_t src_rid;
+    unsigned len;
+    byte* pkt;
+} sim_pkt_t;
+
+typedef struct sim_t {
+    sim_router_t* router;
+    unsigned num_routers;
+    sim_link_t* link;
+    unsigned num_links;
+    sim_pkt_t* next;        /* in flight, delivered at the next ms */
+    unsigned num_next, max_next;
+    uint64_t now_ms;
+    uint32_t pace_ms;
+    unsigned loss_pct;
+    unsigned long lost;
+} sim_t;
+
+static void sim_send( void* arg, unsigned iface, uint32_t nbr_id,
+                      const byte* pkt, unsigned len ) {
+    sim_router_t* r = (sim_router_t*)arg;
+    sim_t* sim = r->sim;
+    sim_link_t* l = &sim->link[r->link[iface]];
+    sim_pkt_t* p;
+
+    if( !l->up )
+        return;
+    if( (unsigned)(rand() % 100) < sim->loss_pct ) {
+        sim->lost += 1;
+        return;
+    }
+
+    if( sim->num_next == sim->max_next ) {
+        sim->max_next = sim->max_next ? 2 * sim->max_next : 64;
+        sim->next = realloc_or_die( sim->next, sim->max_next * sizeof(*sim->next) );
+    }
+    p = &sim->next[sim->num_next++];
+    p->dst = &sim->router[l->a] == r ? l->b : l->a;
+    p->src_rid = r->rid;
+    p->len = len;
+    p->pkt = malloc_or_die( len );
+    memcpy( p->pkt, pkt, len );
+}
+
+static lsdb_result_t sim_install( void* arg, const byte* pkt, unsigned len,
+                                  uint64_t now_ms ) {
+    sim_router_t* r = (sim_router_t*)arg;
+    return lsdb_lsu_input( &r->lsdb, pkt, len, now_ms, NULL, NULL );
+}
+
+/** max length of an LSU in the simulation */
+#define SIM_MAX_LSU_LEN (sizeof(pwospf_hdr_t) + sizeof(pwospf_lsu_t) \
+                         + (FLOOD_MAX_IFACES + 1) * sizeof(pwospf_lsa_t))
+
+/** Builds an LSU packet in pkt. @return its length */
+static unsigned sim_lsu( byte* pkt, uint32_t rid, uint16_t seq,
+                         const lsdb_link_t* links, unsigned num_links ) {
+    pwospf_hdr_t* hdr = (pwospf_hdr_t*)pkt;
+    pwospf_lsu_t* lsu = (pwospf_lsu_t*)(hdr + 1);
+    pwospf_lsa_t* lsa = (pwospf_lsa_t*)(lsu + 1);
+    unsigned i, len;
+
+    memset( hdr, 0, sizeof(*hdr) );
+    hdr->version = PWOSPF_VERSION;
+    hdr->type = PWOSPF_TYPE_LSU;
+    hdr->router_id = rid;
+    for( i=0; i<num_links; i++ ) {
+        lsa[i].subnet = links[i].subnet;
+        lsa[i].mask = links[i].mask;
+        lsa[i].router_id = links[i].router_id;
+    }
+
+    lsu->seq = htons( seq );
+    lsu->ttl = htons( PWOSPF_LSU_TTL );
+    lsu->num_adv = htonl( num_links );
+    len = sizeof(*hdr) + sizeof(*lsu) + num_links * sizeof(*lsa);
+    hdr->len = htons( len );
+    return len;
+}
+
+/** Router r originates, installs and floods an LSU for its current links. */
+static void sim_originate( sim_t* sim, unsigned r ) {
+    lsdb_link_t links[FLOOD_MAX_IFACES + 1];
+    byte pkt[SIM_MAX_LSU_LEN];
+    sim_router_t* sr = &sim->router[r];
+    sim_link_t* l;
+    lsdb_result_t ret;
+    unsigned i, len;
+
+    /* a stub subnet for the router's hosts */
+    links[0].subnet = htonl( 0xac000000 | (r << 8) );
+    links[0].mask = htonl( 0xFFFFFF00 );
+    links[0].router_id = 0;
+    for( i=0; i<sr->num_ifaces; i++ ) {
+        l = &sim->link[sr->link[i]];
+        links[i+1].subnet = l->subnet;
+        links[i+1].mask = htonl( 0xFFFFFF00 );
+        links[i+1].router_id = !l->up ? 0 : sim->router[l->a == r ? l->b : l->a].rid;
+    }
+
+    sr->seq += 1;
+    len = sim_lsu( pkt, sr->rid, sr->seq, links, sr->num_ifaces + 1 );
+    ret = lsdb_lsu_input( &sr->lsdb, pkt, len, sim->now_ms, NULL, NULL );
+    true_or_die( ret == LSDB_CHANGED || ret == LSDB_REFRESHED,
+                 "Error: own LSU was not installed" );
+    flood_originate( &sr->flood, pkt, len );
+}
+
+/** the reoriginate callback: r originates past the LSU a neighbor holds */
+static void sim_reoriginate( void* arg, uint16_t seq, uint64_t now_ms ) {
+    sim_router_t* r = (sim_router_t*)arg;
+
+    r->seq = seq;
+    sim_originate( r->sim, r - r->sim->router );
+}
+
+/** Queues every LSU in from's database for its neighbor to. */
+static void sim_sync( sim_router_t* from, sim_router_t* to ) {
+    byte pkt[SIM_MAX_LSU_LEN];
+    lsdb_entry_t* e;
+    unsigned i, len;
+
+    for( i=0; i<from->lsdb.num_buckets; i++ ) {
+        for( e=from->lsdb.bucket[i]; e; e=e->next ) {
+            len = sim_lsu( pkt, e->router_id, e->seq, e->links, e->num_links );
+            flood_to_neighbor( &from->flood, to->rid, pkt, len );
+        }
+    }
+}
+
+static void sim_link_set( sim_t* sim, unsigned i, bool up ) {
+    sim_link_t* l = &sim->link[i];
+    sim_router_t* a = &sim->router[l->a];
+    sim_router_t* b = &sim->router[l->b];
+
+    l->up = up;
+    if( up ) {
+        flood_add_neighbor( &a->flood, l->a_if, b->rid );
+        flood_add_neighbor( &b->flood, l->b_if, a->rid );
+        sim_sync( a, b );
+        sim_sync( b, a );
+    }
+    else {
+        flood_remove_neighbor( &a->flood, b->rid );
+        flood_remove_neighbor( &b->flood, a->rid );
+    }
+}
+
+static void sim_add_link( sim_t* sim, unsigned a, unsigned b, uint32_t subnet ) {
+    sim_link_t* l = &sim->link[sim->num_links];
+
+    true_or_die( sim->router[a].num_ifaces < FLOOD_MAX_IFACES
+                 && sim->router[b].num_ifaces < FLOOD_MAX_IFACES,
+                 "Error: too many links on one router" );
+    l->a = a;
+    l->b = b;
+    l->a_if = sim->router[a].num_ifaces++;
+    l->b_if = sim->router[b].num_ifaces++;
+    l->subnet = subnet;
+    sim->router[a].link[l->a_if] = sim->num_links;
+    sim->router[b].link[l->b_if] = sim->num_links;
+    sim->num_links += 1;
+    sim_link_set( sim, sim->num_links - 1, TRUE );
+}
+
+static bool sim_has_link( sim_t* sim, unsigned a, unsigned b ) {
+    unsigned i;
+
+    for( i=0; i<sim->num_links; i++ )
+        if( (sim->link[i].a == a && sim->link[i].b == b)
+            || (sim->link[i].a == b && sim->link[i].b == a) )
+            return TRUE;
+
+    return FALSE;
+}
+
+/**
+ * Builds thames if n is 0, otherwise a ring of n routers with n/2 random
+ * chords.  pace_ms is passed to flood_init().
+ */
+static void sim_init( sim_t* sim, unsigned n, uint32_t pace_ms, unsigned loss_pct ) {
+    unsigned i, a, b, num_links;
+
+    memset( sim, 0, sizeof(*sim) );
+    sim->num_routers = n ? n : THAMES_ROUTERS;
+    num_links = n ? n + n / 2 : THAMES_LINKS;
+    sim->router = calloc_or_die( sim->num_routers, sizeof(*sim->router) );
+    sim->link = calloc_or_die( num_links, sizeof(*sim->link) );
+    sim->pace_ms = pace_ms;
+    sim->loss_pct = loss_pct;
+
+    for( i=0; i<sim->num_routers; i++ ) {
+        sim->router[i].sim = sim;
+        sim->router[i].rid = htonl( 0x0a000000 | ((i + 1) << 8) | 1 );
+        lsdb_init( &sim->router[i].lsdb );
+        flood_init( &sim->router[i].flood, sim->router[i].rid, pace_ms, FLOOD_RXMT_MS,
+                    &sim->router[i].lsdb, sim_send, sim_install, sim_reoriginate,
+                    &sim->router[i] );
+    }
+
+    if( !n ) {
+        for( i=0; i<THAMES_LINKS; i++ )
+            sim_add_link( sim, thames_link[i][1], thames_link[i][2],
+                          htonl( 0x0a000000 | (thames_link[i][0] << 8) ) );
+        return;
+    }
+
+    for( i=0; i<n; i++ )
+        sim_add_link( sim, i, (i + 1) % n, htonl( 0x0b000000 | (i << 8) ) );
+    while( sim->num_links < num_links ) {
+        a = rand() % n;
+        b = rand() % n;
+        if( a != b && !sim_has_link( sim, a, b ) )
+            sim_add_link( sim, a, b, htonl( 0x0b000000 | (sim->num_links << 8) ) );
+    }
+}
+
+static void sim_destroy( sim_t* sim ) {
+    unsigned i;
+
+    for( i=0; i<sim->num_routers; i++ ) {
+        flood_destroy( &sim->router[i].flood );
+        lsdb_destroy( &sim->router[i].lsdb );
+    }
+    for( i=0; i<sim->num_next; i++ )
+        free( sim->next[i].pkt );
+    free( sim->next );
+    free( sim->router );
+    free( sim->link );
+}
+
+/** Advances one ms: delivers what is in flight, then runs every timer. */
+static void sim_step( sim_t* sim ) {
+    sim_pkt_t* cur = sim->next;
+    unsigned num_cur = sim->num_next, i;
+
+    sim->now_ms += 1;
+    sim->next = NULL;
+    sim->num_next = sim->max_next = 0;
+
+    for( i=0; i<num_cur; i++ ) {
+        flood_input( &sim->router[cur[i].dst].flood, cur[i].src_rid,
+                     cur[i].pkt, cur[i].len, sim->now_ms );
+        free( cur[i].pkt );
+    }
+    free( cur );
+
+    for( i=0; i<sim->num_routers; i++ )
+        flood_timer( &sim->router[i].flood, sim->now_ms );
+}
+
+static bool sim_quiet( sim_t* sim ) {
+    unsigned i;
+
+    if( sim->num_next )
+        return FALSE;
+    for( i=0; i<sim->num_routers; i++ )
+        if( !flood_idle( &sim->router[i].flood ) )
+            return FALSE;
+
+    return TRUE;
+}
+
+/**
+ * Returns the number of (router, originator) pairs, connected by links which
+ * are up, where the router does not have the originator's latest LSU.
+ */
+static unsigned sim_unconverged( sim_t* sim ) {
+    unsigned* part = malloc_or_die( sim->num_routers * sizeof(*part) );
+    lsdb_entry_t* e;
+    unsigned i, j, bad = 0;
+    bool changed;
+
+    /* label each router with the lowest index it is connected to */
+    for( i=0; i<sim->num_routers; i++ )
+        part[i] = i;
+    do {
+        changed = FALSE;
+        for( i=0; i<sim->num_links; i++ ) {
+            if( !sim->link[i].up || part[sim->link[i].a] == part[sim->link[i].b] )
+                continue;
+            if( part[sim->link[i].a] < part[sim->link[i].b] )
+                part[sim->link[i].b] = part[sim->link[i].a];
+            else
+                part[sim->link[i].a] = part[sim->link[i].b];
+            changed = TRUE;
+        }
+    } while( changed );
+
+    for( i=0; i<sim->num_routers; i++ ) {
+        for( j=0; j<sim->num_routers; j++ ) {
+            if( part[i] != part[j] )
+                continue;
+            e = lsdb_find( &sim->router[i].lsdb, sim->router[j].rid );
+            if( !e || e->seq != sim->router[j].seq )
+                bad += 1;
+        }
+    }
+
+    free( part );
+    return bad;
+}
+
+/** Runs until flooding finishes. @return ms it took, or 0 on timeout */
+static uint64_t sim_run( sim_t* sim ) {
+    uint64_t start = sim->now_ms;
+
+    do {
+        sim_step( sim );
+    } while( !sim_quiet( sim ) && sim->now_ms - start < SIM_TIMEOUT_MS );
+
+    return sim_quiet( sim ) ? sim->now_ms - start : 0;
+}
+
+/** totals over every router */
+typedef struct sim_count_t {
+    uint64_t lsu_pkts, ack_pkts, retransmits, ms;
+} sim_count_t;
+
+static void sim_count( sim_t* sim, sim_count_t* c ) {
+    unsigned i;
+
+    c->lsu_pkts = c->ack_pkts = c->retransmits = 0;
+    for( i=0; i<sim->num_routers; i++ ) {
+        c->lsu_pkts += sim->router[i].flood.lsu_pkts;
+        c->ack_pkts += sim->router[i].flood.ack_pkts;
+        c->retransmits += sim->router[i].flood.retransmits;
+    }
+}
+
+/**
+ * Flaps burst links at once, num_changes / burst times (each flap is two
+ * changes: down and up), and counts the packets sent.
+ *
+ * @return number of failures
+ */
+static unsigned sim_changes( sim_t* sim, unsigned num_changes, unsigned burst,
+                             sim_count_t* total ) {
+    unsigned flap[64], i, j, k, failures = 0;
+    sim_count_t before, after;
+    uint64_t ms;
+
+    memset( total, 0, sizeof(*total) );
+    for( i=0; i<num_changes / (2 * burst); i++ ) {
+        for( j=0; j<burst; j++ ) {
+            do {
+                flap[j] = rand() % sim->num_links;
+                for( k=0; k<j && flap[k] != flap[j]; k++ );
+            } while( k < j );
+        }
+
+        for( k=0; k<2; k++ ) {
+            sim_count( sim, &before );
+            for( j=0; j<burst; j++ ) {
+                sim_link_set( sim, flap[j], k == 1 );
+                sim_originate( sim, sim->link[flap[j]].a );
+                sim_originate( sim, sim->link[flap[j]].b );
+            }
+            ms = sim_run( sim );
+            sim_count( sim, &after );
+
+            if( !ms || sim_unconverged( sim ) )
+                failures += 1;
+            total->lsu_pkts += after.lsu_pkts - before.lsu_pkts;
+            total->ack_pkts += after.ack_pkts - before.ack_pkts;
+            total->retransmits += after.retransmits - before.retransmits;
+            total->ms += ms;
+        }
+    }
+
+    return failures;
+}
+
+/**
+ * Restarts router r without its state: its links go down (and its neighbors
+ * originate without it), it comes back with an empty database and sequence
+ * numbers starting over, and its links come back up.
+ *
+ * @return number of failures
+ */
+static unsigned sim_restart( sim_t* sim, unsigned r ) {
+    sim_router_t* sr = &sim->router[r];
+    bool was_up[FLOOD_MAX_IFACES];
+    sim_link_t* l;
+    unsigned i, failures = 0;
+
+    for( i=0; i<sr->num_ifaces; i++ ) {
+        l = &sim->link[sr->link[i]];
+        was_up[i] = l->up;
+        if( !l->up )
+            continue;
+        sim_link_set( sim, sr->link[i], FALSE );
+        sim_originate( sim, l->a == r ? l->b : l->a );
+    }
+    if( !sim_run( sim ) || sim_unconverged( sim ) )
+        failures += 1;
+
+    flood_destroy( &sr->flood );
+    lsdb_destroy( &sr->lsdb );
+    lsdb_init( &sr->lsdb );
+    flood_init( &sr->flood, sr->rid, sim->pace_ms, FLOOD_RXMT_MS,
+                &sr->lsdb, sim_send, sim_install, sim_reoriginate, sr );
+    sr->seq = 0;
+
+    for( i=0; i<sr->num_ifaces; i++ ) {
+        if( !was_up[i] )
+            continue;
+        l = &sim->link[sr->link[i]];
+        sim_link_set( sim, sr->link[i], TRUE );
+        sim_originate( sim, l->a == r ? l->b : l->a );
+    }
+    sim_originate( sim, r );
+    if( !sim_run( sim ) || sim_unconverged( sim ) )
+        failures += 1;
+
+    return failures;
+}
+
+/** @return number of failures */
+static unsigned run( unsigned n, unsigned num_changes, unsigned loss_pct, unsigned seed ) {
+    static const uint32_t pace[2] = { 0, FLOOD_PACE_MS };
+    static const unsigned bursts[2] = { 1, 4 };
+    sim_count_t c;
+    unsigned m, b, i, failures = 0, changes;
+    char name[32];
+    sim_t sim;
+
+    if( n )
+        snprintf( name, sizeof(name), "ring+chords %u", n );
+    else
+        strcpy( name, "thames" );
+
+    for( b=0; b<2; b++ ) {
+        for( m=0; m<2; m++ ) {
+            srand( seed );  /* same topology and changes for both modes */
+            sim_init( &sim, n, pace[m], loss_pct );
+
+            for( i=0; i<sim.num_routers; i++ )
+                sim_originate( &sim, i );
+            if( !sim_run( &sim ) || sim_unconverged( &sim ) )
+                failures += 1;
+
+            failures += sim_changes( &sim, num_changes, bursts[b], &c );
+            failures += sim_restart( &sim, rand() % sim.num_routers );
+            changes = (num_changes / (2 * bursts[b])) * 2;
+            printf( "  %-16s burst %u %-9s: %7.1f LSU pkts %7.1f ack pkts %7.1f total"
+                    " %5.1f rxmt per change, %6.1f ms to converge\n",
+                    name, bursts[b], pace[m] ? "paced" : "immediate",
+                    (double)c.lsu_pkts / changes, (double)c.ack_pkts / changes,
+                    (double)(c.lsu_pkts + c.ack_pkts) / changes,
+                    (double)c.retransmits / changes, (double)c.ms / changes );
+            sim_destroy( &sim );
+        }
+    }
+
+    return failures;
+}
+
+int main( int argc, char** argv ) {
+    static const unsigned sizes[] = { 0, 50, 200 };
+    unsigned num_changes = 40, loss_pct = 1, seed = 1, failures = 0, i;
+    int c;
+
+    while( (c = getopt( argc, argv, "c:l:s:" )) != EOF ) {
+        switch( c ) {
+        case 'c': num_changes = atoi( optarg ); break;
+        case 'l': loss_pct = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-c changes] [-l loss_percent] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( num_changes >= 8, "Error: need at least 8 changes" );
+
+    printf( "%u topology changes per run, %u%% packet loss\n", num_changes, loss_pct );
+    for( i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++ )
+        failures += run( sizes[i], num_changes, loss_pct, seed );
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
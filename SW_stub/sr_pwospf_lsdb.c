@@ -0,0 +1,359 @@
+/* Filename: sr_pwospf_lsdb.c */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sr_pwospf.h"
+#include "sr_pwospf_lsdb.h"
+
+/** buckets a new database starts with */
+#define LSDB_INITIAL_BUCKETS 16
+
+/** LSUs with up to this many advertisements are decoded on the stack */
+#define LSDB_STACK_LINKS 64
+
+static unsigned lsdb_hash( lsdb_t* lsdb, uint32_t router_id ) {
+    return hash32( router_id ) & (lsdb->num_buckets - 1);
+}
+
+/** Returns TRUE if sequence number a is newer than b (with wrap around). */
+static bool seq_is_newer( uint16_t a, uint16_t b ) {
+    return (int16_t)(a - b) > 0;
+}
+
+static int link_cmp( const void* va, const void* vb ) {
+    const lsdb_link_t* a = (const lsdb_link_t*)va;
+    const lsdb_link_t* b = (const lsdb_link_t*)vb;
+
+    if( a->router_id != b->router_id )
+        return a->router_id < b->router_id ? -1 : 1;
+    if( a->subnet != b->subnet )
+        return a->subnet < b->subnet ? -1 : 1;
+    if( a->mask != b->mask )
+        return a->mask < b->mask ? -1 : 1;
+    return 0;
+}
+
+static void lsdb_grow( lsdb_t* lsdb ) {
+    lsdb_entry_t** old = lsdb->bucket;
+    unsigned old_num = lsdb->num_buckets;
+    lsdb_entry_t *e, *next;
+    unsigned i, h;
+
+    lsdb->num_buckets *= 2;
+    lsdb->bucket = calloc_or_die( lsdb->num_buckets, sizeof(*lsdb->bucket) );
+    for( i=0; i<old_num; i++ ) {
+        for( e=old[i]; e; e=next ) {
+            next = e->next;
+            h = lsdb_hash( lsdb, e->router_id );
+            e->next = lsdb->bucket[h];
+            lsdb->bucket[h] = e;
+        }
+    }
+    free( old );
+}
+
+void lsdb_init( lsdb_t* lsdb ) {
+    memset( lsdb, 0, sizeof(*lsdb) );
+    lsdb->num_buckets = LSDB_INITIAL_BUCKETS;
+    lsdb->bucket = calloc_or_die( lsdb->num_buckets, sizeof(*lsdb->bucket) );
+}
+
+void lsdb_destroy( lsdb_t* lsdb ) {
+    lsdb_entry_t *e, *next;
+    unsigned i;
+
+    for( i=0; i<lsdb->num_buckets; i++ ) {
+        for( e=lsdb->bucket[i]; e; e=next ) {
+            next = e->next;
+            free( e->links );
+            free( e );
+        }
+    }
+    free( lsdb->bucket );
+    lsdb->bucket = NULL;
+    lsdb->num_buckets = lsdb->num_entries = lsdb->num_links = 0;
+}
+
+lsdb_entry_t* lsdb_find( lsdb_t* lsdb, uint32_t router_id ) {
+    lsdb_entry_t* e;
+
+    for( e=lsdb->bucket[lsdb_hash(lsdb, router_id)]; e; e=e->next )
+        if( e->router_id == router_id )
+            return e;
+
+    return NULL;
+}
+
+/**
+ * Returns LSDB_CHANGED if seq is newer than e's (or e is NULL), otherwise
+ * counts and returns why it is suppressed.
+ */
+static lsdb_result_t lsdb_check_seq( lsdb_t* lsdb, lsdb_entry_t* e, uint16_t seq ) {
+    if( !e || seq_is_newer( seq, e->seq ) )
+        return LSDB_CHANGED;
+
+    if( seq == e->seq ) {
+        lsdb->lsu_duplicate += 1;
+        return LSDB_DUPLICATE;
+    }
+    lsdb->lsu_stale += 1;
+    return LSDB_STALE;
+}
+
+bool lsdb_is_newer( lsdb_t* lsdb, uint32_t router_id, uint16_t seq ) {
+    return lsdb_check_seq( lsdb, lsdb_find( lsdb, router_id ), seq ) == LSDB_CHANGED;
+}
+
+lsdb_result_t lsdb_update( lsdb_t* lsdb, uint32_t router_id, uint16_t seq,
+                           const lsdb_link_t* links, unsigned num_links,
+                           uint64_t now_ms, lsdb_change_cb cb, void* cb_arg ) {
+    lsdb_entry_t* e = lsdb_find( lsdb, router_id );
+    lsdb_result_t ret;
+    lsdb_link_t* sorted;
+    unsigned h;
+
+    ret = lsdb_check_seq( lsdb, e, seq );
+    if( ret != LSDB_CHANGED )
+        return ret;
+
+    sorted = malloc_or_die( (num_links ? num_links : 1) * sizeof(*sorted) );
+    memcpy( sorted, links, num_links * sizeof(*sorted) );
+    qsort( sorted, num_links, sizeof(*sorted), link_cmp );
+
+    if( e ) {
+        e->seq = seq;
+        e->last_update_ms = now_ms;
+
+        if( e->num_links == num_links
+            && memcmp( e->links, sorted, num_links * sizeof(*sorted) ) == 0 ) {
+            free( sorted );
+            lsdb->lsu_refreshed += 1;
+            return LSDB_REFRESHED;
+        }
+
+        if( cb )
+            cb( cb_arg, e );
+        free( e->links );
+        lsdb->num_links -= e->num_links;
+    }
+    else {
+        if( lsdb->num_entries >= lsdb->num_buckets )
+            lsdb_grow( lsdb );
+
+        e = malloc_or_die( sizeof(*e) );
+        e->router_id = router_id;
+        e->seq = seq;
+        e->last_update_ms = now_ms;
+        h = lsdb_hash( lsdb, router_id );
+        e->next = lsdb->bucket[h];
+        lsdb->bucket[h] = e;
+        lsdb->num_entries += 1;
+    }
+
+    e->links = sorted;
+    e->num_links = num_links;
+    lsdb->num_links += num_links;
+    lsdb->version += 1;
+    lsdb->lsu_changed += 1;
+    return LSDB_CHANGED;
+}
+
+lsdb_result_t lsdb_lsu_input( lsdb_t* lsdb, const byte* pkt, unsigned len,
+                              uint64_t now_ms, lsdb_change_cb cb, void* cb_arg ) {
+    const pwospf_hdr_t* hdr = (const pwospf_hdr_t*)pkt;
+    const pwospf_lsu_t* lsu = (const pwospf_lsu_t*)(pkt + sizeof(*hdr));
+    const pwospf_lsa_t* lsa = (const pwospf_lsa_t*)(lsu + 1);
+    lsdb_link_t stack_links[LSDB_STACK_LINKS];
+    lsdb_link_t* links;
+    lsdb_result_t ret;
+    uint32_t num_adv;
+    unsigned i;
+
+    if( len < sizeof(*hdr) + sizeof(*lsu)
+        || hdr->version != PWOSPF_VERSION || hdr->type != PWOSPF_TYPE_LSU ) {
+        lsdb->lsu_invalid += 1;
+        return LSDB_INVALID;
+    }
+
+    /* the cheap check: most LSUs seen while flooding are copies */
+    ret = lsdb_check_seq( lsdb, lsdb_find( lsdb, hdr->router_id ), ntohs(lsu->seq) );
+    if( ret != LSDB_CHANGED )
+        return ret;
+
+    num_adv = ntohl( lsu->num_adv );
+    if( num_adv > (len - sizeof(*hdr) - sizeof(*lsu)) / sizeof(*lsa) ) {
+        lsdb->lsu_invalid += 1;
+        return LSDB_INVALID;
+    }
+
+    links = num_adv <= LSDB_STACK_LINKS ? stack_links
+                                        : malloc_or_die( num_adv * sizeof(*links) );
+    for( i=0; i<num_adv; i++ ) {
+        links[i].subnet = lsa[i].subnet;
+        links[i].mask = lsa[i].mask;
+        links[i].router_id = lsa[i].router_id;
+    }
+
+    ret = lsdb_update( lsdb, hdr->router_id, ntohs(lsu->seq), links, num_adv,
+                       now_ms, cb, cb_arg );
+    if( links != stack_links )
+        free( links );
+    return ret;
+}
+
+bool lsdb_lsu_matches( lsdb_t* lsdb, const byte* pkt, unsigned len ) {
+    const pwospf_hdr_t* hdr = (const pwospf_hdr_t*)pkt;
+    const pwospf_lsu_t* lsu = (const pwospf_lsu_t*)(pkt + sizeof(*hdr));
+    const pwospf_lsa_t* lsa = (const pwospf_lsa_t*)(lsu + 1);
+    lsdb_entry_t* e;
+    lsdb_link_t link;
+    unsigned i;
+
+    if( len < sizeof(*hdr) + sizeof(*lsu)
+        || !(e = lsdb_find( lsdb, hdr->router_id ))
+        || ntohl( lsu->num_adv ) != e->num_links
+        || e->num_links > (len - sizeof(*hdr) - sizeof(*lsu)) / sizeof(*lsa) )
+        return FALSE;
+
+    /* the entry's links are sorted */
+    for( i=0; i<e->num_links; i++ ) {
+        link.subnet = lsa[i].subnet;
+        link.mask = lsa[i].mask;
+        link.router_id = lsa[i].router_id;
+        if( !bsearch( &link, e->links, e->num_links, sizeof(link), link_cmp ) )
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+unsigned lsdb_lsu_make( byte* pkt, uint32_t router_id, uint16_t seq,
+                        const lsdb_link_t* links, unsigned num_links ) {
+    pwospf_hdr_t* hdr = (pwospf_hdr_t*)pkt;
+    pwospf_lsu_t* lsu = (pwospf_lsu_t*)(hdr + 1);
+    pwospf_lsa_t* lsa = (pwospf_lsa_t*)(lsu + 1);
+    unsigned i;
+
+    memset( hdr, 0, sizeof(*hdr) );
+    hdr->version = PWOSPF_VERSION;
+    hdr->type = PWOSPF_TYPE_LSU;
+    hdr->len = htons( LSDB_LSU_LEN(num_links) );
+    hdr->router_id = router_id;
+    lsu->seq = htons( seq );
+    lsu->ttl = htons( PWOSPF_LSU_TTL );
+    lsu->num_adv = htonl( num_links );
+    for( i=0; i<num_links; i++ ) {
+        lsa[i].subnet = links[i].subnet;
+        lsa[i].mask = links[i].mask;
+        lsa[i].router_id = links[i].router_id;
+    }
+
+    return LSDB_LSU_LEN(num_links);
+}
+
+/** Unlinks and frees *pe, which is in bucket chain position pe. */
+static void lsdb_unlink( lsdb_t* lsdb, lsdb_entry_t** pe,
+                         lsdb_change_cb cb, void* cb_arg ) {
+    lsdb_entry_t* e = *pe;
+
+    if( cb )
+        cb( cb_arg, e );
+
+    *pe = e->next;
+    lsdb->num_entries -= 1;
+    lsdb->num_links -= e->num_links;
+    lsdb->version += 1;
+    free( e->links );
+    free( e );
+}
+
+bool lsdb_remove( lsdb_t* lsdb, uint32_t router_id,
+                  lsdb_change_cb cb, void* cb_arg ) {
+    lsdb_entry_t** pe;
+
+    for( pe=&lsdb->bucket[lsdb_hash(lsdb, router_id)]; *pe; pe=&(*pe)->next ) {
+        if( (*pe)->router_id == router_id ) {
+            lsdb_unlink( lsdb, pe, cb, cb_arg );
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+unsigned lsdb_expire( lsdb_t* lsdb, uint64_t now_ms, uint64_t timeout_ms,
+                      uint32_t keep_id, lsdb_change_cb cb, void* cb_arg ) {
+    lsdb_entry_t** pe;
+    unsigned i, n = 0;
+
+    for( i=0; i<lsdb->num_buckets; i++ ) {
+        pe = &lsdb->bucket[i];
+        while( *pe ) {
+            if( (*pe)->router_id != keep_id
+                && (*pe)->last_update_ms + timeout_ms < now_ms ) {
+                lsdb_unlink( lsdb, pe, cb, cb_arg );
+                n += 1;
+            }
+            else
+                pe = &(*pe)->next;
+        }
+    }
+
+    lsdb->expired += n;
+    return n;
+}
+
+int lsdb_to_string( lsdb_t* lsdb, char* buf, int len ) {
+    char str_rid[STRLEN_IP], str_subnet[STRLEN_SUBNET], str_nbr[STRLEN_IP];
+    lsdb_entry_t* e;
+    unsigned i, j, n, ret;
+
+    ret = my_snprintf( buf, len, "%-15s %5s  %-18s %-15s\n",
+                       "Router ID", "Seq", "Subnet", "Neighbor" );
+    if( !ret ) return 0;
+    n = ret;
+
+    for( i=0; i<lsdb->num_buckets; i++ ) {
+        for( e=lsdb->bucket[i]; e; e=e->next ) {
+            ip_to_string( str_rid, e->router_id );
+            if( e->num_links == 0 ) {
+                ret = my_snprintf( buf+n, len-n, "%-15s %5u  (no links)\n",
+                                   str_rid, e->seq );
+                if( !ret ) return 0;
+                n += ret;
+            }
+
+            for( j=0; j<e->num_links; j++ ) {
+                subnet_to_string( str_subnet, e->links[j].subnet, e->links[j].mask );
+                if( e->links[j].router_id )
+                    ip_to_string( str_nbr, e->links[j].router_id );
+                else
+                    strcpy( str_nbr, "-" );
+
+                if( j == 0 )
+                    ret = my_snprintf( buf+n, len-n, "%-15s %5u  %-18s %-15s\n",
+                                       str_rid, e->seq, str_subnet, str_nbr );
+                else
+                    ret = my_snprintf( buf+n, len-n, "%-15s %5s  %-18s %-15s\n",
+                                       "", "", str_subnet, str_nbr );
+                if( !ret ) return 0;
+                n += ret;
+            }
+        }
+    }
+
+    ret = my_snprintf( buf+n, len-n,
+                       "LSUs accepted: %llu (%llu changed topology, %llu refreshed)\n"
+                       "LSUs suppressed: %llu (%llu duplicate, %llu stale, %llu invalid)  Expired: %llu\n",
+                       (unsigned long long)(lsdb->lsu_changed + lsdb->lsu_refreshed),
+                       (unsigned long long)lsdb->lsu_changed,
+                       (unsigned long long)lsdb->lsu_refreshed,
+                       (unsigned long long)(lsdb->lsu_duplicate + lsdb->lsu_stale + lsdb->lsu_invalid),
+                       (unsigned long long)lsdb->lsu_duplicate,
+                       (unsigned long long)lsdb->lsu_stale,
+                       (unsigned long long)lsdb->lsu_invalid,
+                       (unsigned long long)lsdb->expired );
+    if( !ret ) return 0;
+    return n + ret;
+}
@@ -0,0 +1,151 @@
+/*
+ * Filename: sr_pwospf_lsdb.h
+ * Purpose: PWOSPF link state database.
+ *
+ * Holds the most recent LSU from every router, in a hash table keyed by router
+ * ID.  During flooding every router receives each LSU once per neighbor, and a
+ * flapping link makes every router re-originate, so most LSUs received are
+ * copies of ones already installed.  Each entry keeps the sequence number of
+ * the LSU it was built from, and an LSU whose sequence number is not newer is
+ * rejected with a single hash lookup, before its advertisements are even read.
+ * A newer LSU which advertises the same links as before only refreshes the
+ * entry; only a real change bumps the database version, which is what SPF
+ * keys off.
+ *
+ * Not thread-safe; the router serializes access with its ospf_lock.
+ */
+
+#ifndef SR_PWOSPF_LSDB_H
+#define SR_PWOSPF_LSDB_H
+
+#include "sr_common.h"
+#include "sr_pwospf.h"
+
+/** a link of a router, as advertised in its LSU */
+typedef struct lsdb_link_t {
+    addr_ip_t subnet;       /* nbo */
+    addr_ip_t mask;         /* nbo */
+    uint32_t  router_id;    /* neighbor on the subnet, or 0 if none */
+} lsdb_link_t;
+
+/** the link state of one router */
+typedef struct lsdb_entry_t {
+    uint32_t     router_id;
+    uint16_t     seq;       /* of the LSU the links came from */
+    uint64_t     last_update_ms;
+    lsdb_link_t* links;     /* sorted, so equal sets compare equal */
+    unsigned     num_links;
+
+    struct lsdb_entry_t* next; /* hash chain */
+} lsdb_entry_t;
+
+/** what an LSU did to the database */
+typedef enum lsdb_result_t {
+    LSDB_DUPLICATE,         /* same sequence number as installed: ignored */
+    LSDB_STALE,             /* older sequence number than installed: ignored */
+    LSDB_INVALID,           /* malformed LSU: ignored */
+    LSDB_REFRESHED,         /* newer, but the links are unchanged */
+    LSDB_CHANGED            /* new router, or its links changed */
+} lsdb_result_t;
+
+/** called with an entry just before it is removed or its links replaced */
+typedef void (*lsdb_change_cb)( void* arg, const lsdb_entry_t* old_entry );
+
+/** the database */
+typedef struct lsdb_t {
+    lsdb_entry_t** bucket;
+    unsigned num_buckets;   /* a power of 2 */
+    unsigned num_entries;
+    unsigned num_links;     /* summed over all entries */
+
+    uint32_t version;       /* bumped whenever the topology changes */
+
+    uint64_t lsu_changed;   /* LSUs which changed the topology */
+    uint64_t lsu_refreshed; /* newer LSUs with unchanged links */
+    uint64_t lsu_duplicate; /* suppressed: sequence number already installed */
+    uint64_t lsu_stale;     /* suppressed: older sequence number */
+    uint64_t lsu_invalid;   /* suppressed: malformed */
+    uint64_t expired;       /* entries removed for not being refreshed */
+} lsdb_t;
+
+/** Initializes an empty database. */
+void lsdb_init( lsdb_t* lsdb );
+
+/** Frees every entry. */
+void lsdb_destroy( lsdb_t* lsdb );
+
+/** Returns the entry for router_id, or NULL if there is none. */
+lsdb_entry_t* lsdb_find( lsdb_t* lsdb, uint32_t router_id );
+
+/**
+ * Returns TRUE if seq is newer than the sequence number installed for
+ * router_id (or there is no entry for it).  Otherwise the LSU is a duplicate or
+ * stale copy, which is counted as suppressed, and FALSE is returned.  O(1).
+ */
+bool lsdb_is_newer( lsdb_t* lsdb, uint32_t router_id, uint16_t seq );
+
+/**
+ * Installs the links (nbo fields, in any order) router_id advertised in the LSU
+ * with sequence number seq, received at now_ms.  links is not kept.  If cb is
+ * non-NULL it is called with the old entry before its links are replaced.
+ */
+lsdb_result_t lsdb_update( lsdb_t* lsdb, uint32_t router_id, uint16_t seq,
+                           const lsdb_link_t* links, unsigned num_links,
+                           uint64_t now_ms, lsdb_change_cb cb, void* cb_arg );
+
+/**
+ * Handles a received LSU packet: pkt points to the PWOSPF header and len is the
+ * length of the PWOSPF packet.  Duplicate and stale LSUs are rejected from the
+ * header alone.
+ */
+lsdb_result_t lsdb_lsu_input( lsdb_t* lsdb, const byte* pkt, unsigned len,
+                              uint64_t now_ms, lsdb_change_cb cb, void* cb_arg );
+
+/**
+ * Returns TRUE if the LSU packet pkt (as for lsdb_lsu_input()) advertises the
+ * links installed for its originator, whatever its sequence number.
+ */
+bool lsdb_lsu_matches( lsdb_t* lsdb, const byte* pkt, unsigned len );
+
+/** length of an LSU packet with num_links advertisements */
+#define LSDB_LSU_LEN(num_links) (sizeof(pwospf_hdr_t) + sizeof(pwospf_lsu_t) \
+                                 + (num_links) * sizeof(pwospf_lsa_t))
+
+/**
+ * Builds in pkt, which must hold LSDB_LSU_LEN(num_links) bytes, the LSU
+ * router_id originates with sequence number seq advertising links.
+ *
+ * @return the length of the packet
+ */
+unsigned lsdb_lsu_make( byte* pkt, uint32_t router_id, uint16_t seq,
+                        const lsdb_link_t* links, unsigned num_links );
+
+/**
+ * Removes the entry for router_id, if any, calling cb with it first.
+ *
+ * @return TRUE if there was an entry
+ */
+bool lsdb_remove( lsdb_t* lsdb, uint32_t router_id,
+                  lsdb_change_cb cb, void* cb_arg );
+
+/**
+ * Removes every entry, other than the one for keep_id, which has not been
+ * updated within timeout_ms of now_ms, calling cb with each first.
+ *
+ * @return number of entries removed
+ */
+unsigned lsdb_expire( lsdb_t* lsdb, uint64_t now_ms, uint64_t timeout_ms,
+                      uint32_t keep_id, lsdb_change_cb cb, void* cb_arg );
+
+/** max length of the string made by lsdb_to_string() */
+#define STR_LSDB_MAX_LEN(lsdb) (80 * ((lsdb)->num_entries + (lsdb)->num_links + 4))
+
+/**
+ * Fills buf with the database contents and LSU counters.  It takes up to
+ * STR_LSDB_MAX_LEN(lsdb) characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int lsdb_to_string( lsdb_t* lsdb, char* buf, int len );
+
+#endif /* SR_PWOSPF_LSDB_H */
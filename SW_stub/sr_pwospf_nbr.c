@@ -0,0 +1,157 @@
+/* Filename: sr_pwospf_nbr.c */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sr_pwospf_nbr.h"
+
+/** buckets a table starts with once it has a neighbor */
+#define NBR_INITIAL_BUCKETS 4
+
+static unsigned nbr_hash( nbr_table_t* t, uint32_t router_id ) {
+    return hash32( router_id ) & (t->num_buckets - 1);
+}
+
+static void nbr_grow( nbr_table_t* t ) {
+    neighbor_t** old = t->bucket;
+    unsigned old_num = t->num_buckets;
+    neighbor_t *n, *next;
+    unsigned i, h;
+
+    t->num_buckets = old_num ? 2 * old_num : NBR_INITIAL_BUCKETS;
+    t->bucket = calloc_or_die( t->num_buckets, sizeof(*t->bucket) );
+    for( i=0; i<old_num; i++ ) {
+        for( n=old[i]; n; n=next ) {
+            next = n->next;
+            h = nbr_hash( t, n->router_id );
+            n->next = t->bucket[h];
+            t->bucket[h] = n;
+        }
+    }
+    free( old );
+}
+
+void nbr_table_init( nbr_table_t* t ) {
+    /* most links are point-to-point, so buckets wait for the first neighbor */
+    t->bucket = NULL;
+    t->num_buckets = t->num_neighbors = 0;
+}
+
+void nbr_table_destroy( nbr_table_t* t, timer_wheel_t* w ) {
+    neighbor_t *n, *next;
+    unsigned i;
+
+    for( i=0; i<t->num_buckets; i++ ) {
+        for( n=t->bucket[i]; n; n=next ) {
+            next = n->next;
+            tw_cancel( w, &n->dead );
+            free( n );
+        }
+    }
+    free( t->bucket );
+    nbr_table_init( t );
+}
+
+neighbor_t* nbr_find( nbr_table_t* t, uint32_t router_id ) {
+    neighbor_t* n;
+
+    if( !t->num_neighbors )
+        return NULL;
+
+    for( n=t->bucket[nbr_hash(t, router_id)]; n; n=n->next )
+        if( n->router_id == router_id )
+            return n;
+
+    return NULL;
+}
+
+neighbor_t* nbr_find_ip( nbr_table_t* t, addr_ip_t ip ) {
+    neighbor_t* n;
+    unsigned i;
+
+    for( i=0; i<t->num_buckets; i++ )
+        for( n=t->bucket[i]; n; n=n->next )
+            if( n->ip == ip )
+                return n;
+
+    return NULL;
+}
+
+neighbor_t* nbr_hello( nbr_table_t* t, timer_wheel_t* w, unsigned iface,
+                       uint32_t router_id, addr_ip_t ip, uint64_t now_ms,
+                       unsigned dead_ms, bool* is_new ) {
+    neighbor_t* n;
+    unsigned h;
+
+    n = nbr_find( t, router_id );
+    *is_new = (n == NULL);
+    if( !n ) {
+        if( t->num_neighbors >= t->num_buckets )
+            nbr_grow( t );
+
+        n = malloc_or_die( sizeof(*n) );
+        n->router_id = router_id;
+        n->iface = iface;
+        tw_timer_init( &n->dead );
+        h = nbr_hash( t, router_id );
+        n->next = t->bucket[h];
+        t->bucket[h] = n;
+        t->num_neighbors += 1;
+    }
+
+    n->ip = ip;
+    n->last_hello_ms = now_ms;
+    tw_schedule( w, &n->dead, now_ms + dead_ms );
+    return n;
+}
+
+bool nbr_remove( nbr_table_t* t, timer_wheel_t* w, uint32_t router_id ) {
+    neighbor_t** pn;
+    neighbor_t* n;
+
+    if( !t->num_neighbors )
+        return FALSE;
+
+    for( pn=&t->bucket[nbr_hash(t, router_id)]; *pn; pn=&(*pn)->next ) {
+        if( (*pn)->router_id == router_id ) {
+            n = *pn;
+            *pn = n->next;
+            t->num_neighbors -= 1;
+            tw_cancel( w, &n->dead );
+            free( n );
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+neighbor_t* nbr_of_timer( tw_timer_t* dead ) {
+    return (neighbor_t*)((char*)dead - offsetof(neighbor_t, dead));
+}
+
+int nbr_table_to_string( nbr_table_t* t, addr_ip_t subnet, addr_ip_t mask,
+                         uint64_t now_ms, char* buf, int len ) {
+    char str_ip[STRLEN_IP], str_rid[STRLEN_IP], str_subnet[STRLEN_SUBNET];
+    char str_age[32];
+    neighbor_t* n;
+    unsigned i, ret, num = 0;
+
+    subnet_to_string( str_subnet, subnet, mask );
+    for( i=0; i<t->num_buckets; i++ ) {
+        for( n=t->bucket[i]; n; n=n->next ) {
+            ip_to_string( str_ip, n->ip );
+            ip_to_string( str_rid, n->router_id );
+            snprintf( str_age, sizeof(str_age), "%.1fs ago",
+                      (now_ms - n->last_hello_ms) / 1000.0 );
+            ret = my_snprintf( buf+num, len-num, STR_NBR_FORMAT,
+                               str_ip, str_rid, str_subnet, str_age );
+            if( !ret ) return 0;
+            num += ret;
+        }
+    }
+
+    if( num == 0 && len > 0 )
+        buf[0] = '\0';
+    return num;
+}
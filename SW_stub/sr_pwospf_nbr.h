@@ -0,0 +1,95 @@
+/*
+ * Filename: sr_pwospf_nbr.h
+ * Purpose: PWOSPF neighbors learned from hellos.
+ *
+ * Every hello refreshes its sender, so the neighbors of an interface are kept
+ * in a hash table keyed by router ID, and a hello is a single lookup whether it
+ * comes from a known neighbor or a new one.  Each neighbor's dead interval is a
+ * timer on the router's timer wheel which every hello pushes back: a neighbor
+ * is noticed dead when its timer expires rather than by scanning every
+ * neighbor on every tick, so neither hellos nor expiry cost more as neighbors
+ * are added.
+ *
+ * Not thread-safe; the router serializes access with its ospf_lock.
+ */
+
+#ifndef SR_PWOSPF_NBR_H
+#define SR_PWOSPF_NBR_H
+
+#include "sr_common.h"
+#include "sr_timer_wheel.h"
+
+/** tick of the timer wheel dead intervals are timed on */
+#define NBR_TICK_MS 100
+
+/** a PWOSPF neighbor reached through an interface */
+typedef struct neighbor_t {
+    uint32_t   router_id;
+    addr_ip_t  ip;              /* its address on the link */
+    unsigned   iface;           /* index of the interface it is reached through */
+    uint64_t   last_hello_ms;
+    tw_timer_t dead;            /* expires when the dead interval passes */
+
+    struct neighbor_t* next;    /* hash chain */
+} neighbor_t;
+
+/** the neighbors on one interface */
+typedef struct nbr_table_t {
+    neighbor_t** bucket;
+    unsigned     num_buckets;   /* a power of 2 */
+    unsigned     num_neighbors;
+} nbr_table_t;
+
+/** Initializes an empty table. */
+void nbr_table_init( nbr_table_t* t );
+
+/** Frees every neighbor, cancelling their timers on w. */
+void nbr_table_destroy( nbr_table_t* t, timer_wheel_t* w );
+
+/** Returns neighbor router_id, or NULL if there is none. */
+neighbor_t* nbr_find( nbr_table_t* t, uint32_t router_id );
+
+/**
+ * Returns the neighbor whose address on the link is ip, or NULL if there is
+ * none.  The table is scanned: a link seldom has more than a few neighbors.
+ */
+neighbor_t* nbr_find_ip( nbr_table_t* t, addr_ip_t ip );
+
+/**
+ * Handles a hello received at now_ms from router_id, whose address on the link
+ * is ip, through interface iface: the neighbor is added if it is new (and
+ * *is_new set) and its dead timer on w restarted to expire dead_ms from now.
+ *
+ * @return the neighbor
+ */
+neighbor_t* nbr_hello( nbr_table_t* t, timer_wheel_t* w, unsigned iface,
+                       uint32_t router_id, addr_ip_t ip, uint64_t now_ms,
+                       unsigned dead_ms, bool* is_new );
+
+/**
+ * Removes neighbor router_id, cancelling its timer on w.
+ *
+ * @return FALSE if there was no such neighbor
+ */
+bool nbr_remove( nbr_table_t* t, timer_wheel_t* w, uint32_t router_id );
+
+/** Returns the neighbor whose dead timer is dead. */
+neighbor_t* nbr_of_timer( tw_timer_t* dead );
+
+/** format of a neighbor's line (82 bytes): address, router ID, subnet, age */
+#define STR_NBR_FORMAT "  %-15s  %-15s  %-18s  %-24s\n"
+
+/** max length of the string made by nbr_table_to_string() */
+#define STR_NBR_TABLE_MAX_LEN(t) (82 * ((t)->num_neighbors + 1))
+
+/**
+ * Fills buf with a line per neighbor: its address, router ID, the subnet of
+ * the interface (subnet/mask) and how long before now_ms it was last heard
+ * from.  It takes up to STR_NBR_TABLE_MAX_LEN(t) characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int nbr_table_to_string( nbr_table_t* t, addr_ip_t subnet, addr_ip_t mask,
+                         uint64_t now_ms, char* buf, int len );
+
+#endif /* SR_PWOSPF_NBR_H */
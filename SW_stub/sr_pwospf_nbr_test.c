@@ -0,0 +1,289 @@
+/*
+ * Filename: sr_pwospf_nbr_test.c
+ * Purpose: Checks the timer wheel and the neighbor table built on it.
+ *
+ * Random timers are scheduled, rescheduled and cancelled while the wheel is
+ * advanced in random steps, some longer than a turn of the wheel, and checked
+ * against their deadlines: every timer still scheduled must fire exactly once,
+ * never before it expires and by the first advance a tick or more past its
+ * expiry, and the wheel's timeout must never be later than that.
+ *
+ * Then an interface learns a crowd of neighbors from their hellos.  The
+ * neighbors which keep sending hellos must survive, and those which go quiet
+ * must be dropped one dead interval (to within a tick) after their last hello.
+ * The time spent on dead neighbor detection is compared with scanning every
+ * neighbor on each tick.
+ *
+ * Usage: test_nbr [-n neighbors] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "sr_pwospf_nbr.h"
+#include "sr_timer_wheel.h"
+
+/** tick of the wheels under test */
+#define TICK_MS 100
+
+/** hello interval and dead interval of the neighbors */
+#define HELLO_MS 10000
+#define DEAD_MS  (3 * HELLO_MS)
+
+/** a timer and what the test expects of it */
+typedef struct ref_timer_t {
+    tw_timer_t t;
+    uint64_t expires_ms;    /* 0 if it should not be scheduled */
+    unsigned fired;
+} ref_timer_t;
+
+/** a checked wheel */
+typedef struct check_t {
+    ref_timer_t* timer;
+    unsigned failures;
+} check_t;
+
+/** a neighbor's expected state */
+typedef struct ref_nbr_t {
+    bool     quiet;         /* stops sending hellos after DEAD_MS */
+    uint64_t last_hello_ms;
+    uint64_t dead_ms;       /* when it was dropped, or 0 */
+} ref_nbr_t;
+
+/** what the dead neighbor callback needs */
+typedef struct nbr_check_t {
+    nbr_table_t* table;
+    timer_wheel_t* wheel;
+    ref_nbr_t* ref;
+    unsigned failures;
+} nbr_check_t;
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void timer_expired( void* arg, tw_timer_t* t, uint64_t now_ms ) {
+    check_t* c = (check_t*)arg;
+    ref_timer_t* r = (ref_timer_t*)t;
+
+    r->fired += 1;
+    if( tw_is_scheduled( t ) || r->fired > 1 || !r->expires_ms
+        || now_ms < r->expires_ms ) {
+        printf( "  timer %u due at %llu fired at %llu (fired %u times)\n",
+                (unsigned)(r - c->timer), (unsigned long long)r->expires_ms,
+                (unsigned long long)now_ms, r->fired );
+        c->failures += 1;
+    }
+    r->expires_ms = 0;
+}
+
+/** Randomly schedules and cancels n timers while advancing the wheel. */
+static unsigned wheel( unsigned n ) {
+    timer_wheel_t w;
+    check_t c;
+    uint64_t now_ms = 123456, next;
+    int64_t timeout;
+    unsigned i, step, num = 0;
+
+    tw_init( &w, TICK_MS, now_ms );
+    c.timer = calloc_or_die( n, sizeof(*c.timer) );
+    c.failures = 0;
+    for( i=0; i<n; i++ )
+        tw_timer_init( &c.timer[i].t );
+
+    for( step=0; step<20000; step++ ) {
+        /* change a few timers */
+        for( i=0; i<8; i++ ) {
+            ref_timer_t* r = &c.timer[rand() % n];
+            r->fired = 0;
+            if( rand() % 4 == 0 ) {
+                tw_cancel( &w, &r->t );
+                r->expires_ms = 0;
+            }
+            else {
+                /* mostly within a turn of the wheel, some well beyond */
+                r->expires_ms = now_ms + (rand() % 8 ? rand() % (TW_SLOTS * TICK_MS)
+                                                     : rand() % (10 * TW_SLOTS * TICK_MS));
+                if( rand() % 16 == 0 )
+                    r->expires_ms = now_ms; /* due already */
+                tw_schedule( &w, &r->t, r->expires_ms );
+            }
+        }
+
+        /* the timeout may be early but never late */
+        next = 0;
+        for( i=0; i<n; i++ )
+            if( c.timer[i].expires_ms && (!next || c.timer[i].expires_ms < next) )
+                next = c.timer[i].expires_ms;
+        timeout = tw_timeout( &w, now_ms );
+        if( (next && (timeout < 0 || now_ms + timeout > next + TICK_MS))
+            || (!next && timeout >= 0) ) {
+            printf( "  timeout %lld with the next timer due in %lld\n", (long long)timeout,
+                    next ? (long long)(next - now_ms) : -1LL );
+            c.failures += 1;
+        }
+
+        /* advance by up to a few ticks, now and then by several turns */
+        now_ms += rand() % 64 ? rand() % (4 * TICK_MS) : rand() % (3 * TW_SLOTS * TICK_MS);
+        tw_advance( &w, now_ms, timer_expired, &c );
+
+        for( i=0; i<n; i++ ) {
+            if( c.timer[i].expires_ms && c.timer[i].expires_ms + TICK_MS <= now_ms ) {
+                printf( "  timer %u due at %llu has not fired at %llu\n", i,
+                        (unsigned long long)c.timer[i].expires_ms,
+                        (unsigned long long)now_ms );
+                c.failures += 1;
+                c.timer[i].expires_ms = 0;
+            }
+        }
+    }
+
+    for( i=0; i<n; i++ )
+        num += (c.timer[i].expires_ms != 0);
+    if( num != w.num_timers ) {
+        printf( "  wheel has %u timers, expected %u\n", w.num_timers, num );
+        c.failures += 1;
+    }
+
+    printf( "Timer wheel: %u timers, %u steps: %s\n", n, step,
+            c.failures ? "FAILED" : "ok" );
+    free( c.timer );
+    return c.failures;
+}
+
+static void nbr_dead( void* arg, tw_timer_t* dead, uint64_t now_ms ) {
+    nbr_check_t* c = (nbr_check_t*)arg;
+    neighbor_t* nbr = nbr_of_timer( dead );
+    ref_nbr_t* r = &c->ref[nbr->router_id - 1];
+
+    if( !r->quiet || now_ms < r->last_hello_ms + DEAD_MS
+        || now_ms >= r->last_hello_ms + DEAD_MS + TICK_MS ) {
+        printf( "  neighbor %u (%s) dropped %llums after its last hello\n",
+                nbr->router_id, r->quiet ? "quiet" : "talking",
+                (unsigned long long)(now_ms - r->last_hello_ms) );
+        c->failures += 1;
+    }
+    r->dead_ms = now_ms;
+    nbr_remove( c->table, c->wheel, nbr->router_id );
+}
+
+/**
+ * Neighbors 1..n send hellos, staggered, every HELLO_MS; a random quarter of
+ * them stop after DEAD_MS.  Returns the number of failures.
+ */
+static unsigned neighbors( unsigned n ) {
+    nbr_table_t table;
+    timer_wheel_t w;
+    nbr_check_t c;
+    uint64_t now_ms, end_ms, t0, wheel_ns = 0, scan_ns = 0;
+    neighbor_t* nbr;
+    bool is_new;
+    unsigned i, num_dead = 0, scan_dead = 0, num_quiet = 0;
+
+    nbr_table_init( &table );
+    tw_init( &w, TICK_MS, 0 );
+    c.table = &table;
+    c.wheel = &w;
+    c.ref = calloc_or_die( n, sizeof(*c.ref) );
+    c.failures = 0;
+    for( i=0; i<n; i++ ) {
+        c.ref[i].quiet = (rand() % 4 == 0);
+        num_quiet += c.ref[i].quiet;
+    }
+
+    end_ms = 10 * DEAD_MS;
+    for( now_ms=0; now_ms<=end_ms; now_ms+=TICK_MS ) {
+        /* neighbor i sends its hellos on ticks congruent to i */
+        for( i=0; i<n; i++ ) {
+            ref_nbr_t* r = &c.ref[i];
+            if( (now_ms / TICK_MS) % (HELLO_MS / TICK_MS) != i % (HELLO_MS / TICK_MS) )
+                continue;
+            if( r->quiet && now_ms >= DEAD_MS )
+                continue;
+
+            nbr_hello( &table, &w, 0, i + 1, i + 1, now_ms, DEAD_MS, &is_new );
+            if( is_new != (r->last_hello_ms == 0 && now_ms < HELLO_MS) ) {
+                printf( "  neighbor %u new on hello at %llu\n", i + 1,
+                        (unsigned long long)now_ms );
+                c.failures += 1;
+            }
+            r->last_hello_ms = now_ms;
+        }
+
+        /* dead neighbor detection: the wheel */
+        t0 = now_nsec();
+        tw_advance( &w, now_ms, nbr_dead, &c );
+        wheel_ns += now_nsec() - t0;
+
+        /* and for comparison, what a scan of every neighbor costs */
+        t0 = now_nsec();
+        for( i=0; i<table.num_buckets; i++ )
+            for( nbr=table.bucket[i]; nbr; nbr=nbr->next )
+                if( nbr->last_hello_ms + DEAD_MS + TICK_MS <= now_ms )
+                    scan_dead += 1;
+        scan_ns += now_nsec() - t0;
+    }
+
+    for( i=0; i<n; i++ ) {
+        if( c.ref[i].quiet )
+            num_dead += (c.ref[i].dead_ms != 0);
+        nbr = nbr_find( &table, i + 1 );
+        if( nbr_find_ip( &table, i + 1 ) != nbr ) {
+            printf( "  neighbor %u not found by its address\n", i + 1 );
+            c.failures += 1;
+        }
+        if( c.ref[i].quiet != (nbr == NULL) ) {
+            printf( "  neighbor %u (%s) %s\n", i + 1,
+                    c.ref[i].quiet ? "quiet" : "talking",
+                    c.ref[i].quiet ? "was not dropped" : "was dropped" );
+            c.failures += 1;
+        }
+    }
+    if( num_dead != num_quiet || table.num_neighbors != n - num_quiet || scan_dead ) {
+        printf( "  %u of %u quiet neighbors dropped, %u left, %u missed\n",
+                num_dead, num_quiet, table.num_neighbors, scan_dead );
+        c.failures += 1;
+    }
+
+    printf( "Neighbors: %u (%u went quiet) over %llu ticks: %s\n", n, num_quiet,
+            (unsigned long long)(end_ms / TICK_MS + 1), c.failures ? "FAILED" : "ok" );
+    printf( "  dead neighbor detection per tick: %8.2fus timer wheel, %8.2fus scan\n",
+            wheel_ns / 1000.0 / (end_ms / TICK_MS + 1),
+            scan_ns / 1000.0 / (end_ms / TICK_MS + 1) );
+
+    nbr_table_destroy( &table, &w );
+    if( w.num_timers ) {
+        printf( "  %u timers left after the table was destroyed\n", w.num_timers );
+        c.failures += 1;
+    }
+    free( c.ref );
+    return c.failures;
+}
+
+int main( int argc, char** argv ) {
+    unsigned n = 10000, seed = 1, failures = 0;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:s:" )) != EOF ) {
+        switch( c ) {
+        case 'n': n = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n neighbors] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( n >= 4, "Error: need at least 4 neighbors" );
+    srand( seed );
+
+    failures += wheel( 1000 );
+    failures += neighbors( n );
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,903 @@
+/*
+ * Filename: sr_pwospf_sim.c
+ * Purpose: Discrete-event simulator of PWOSPF convergence.
+ *
+ * Runs a whole topology of routers in one process on virtual time, so that
+ * protocol changes can be measured on large networks without Mininet or root.
+ * Every router installs every LSU, so the work grows with the square of the
+ * network: a 500-router ring boots in about 4 s of wall clock time, and a
+ * 1000-router one in about as long as the 16 s of virtual time it simulates.
+ *
+ * Each router is an instance of the router's own protocol code (neighbor
+ * tables and their dead timers, LSDB, flooding, SPF hold-down, incremental SPF
+ * and BFD), fed through the same entry points the router uses.  Only what the
+ * router does with its interfaces is done here: a hello is sent every hello
+ * interval on each interface, and a router's LSU lists its stub subnet and its
+ * neighbors.  A neighbor is learned from its first hello (after which the two
+ * exchange databases and re-originate their LSUs) and declared dead when none
+ * is heard for three hello intervals.  Packets take latency_ms over a link and
+ * are lost if the link goes down meanwhile.
+ *
+ * Everything happens in an event queue ordered by virtual time: packet
+ * arrivals, hellos, LSU refreshes, and each router's protocol timer, which is
+ * scheduled whenever the neighbor, flooding, SPF or BFD state asks to be
+ * woken.
+ *
+ * The routers boot together with random hello phases, and then links fail and
+ * recover one at a time.  After each, the simulation runs until every router's
+ * route to every router's stub subnet matches the shortest path over the links
+ * which are up; the time from the change to the last route change, the virtual
+ * and wall clock time taken, and the packets sent are reported.  Link failures
+ * are noticed when the neighbor's hellos stop unless carrier detection (-c) is
+ * on, or BFD sessions (-b) run between the neighbors.  With BFD the longest
+ * failover (convergence after a link failure) must stay within
+ * SIM_BFD_FAILOVER_MS.  That bound holds only because each change follows
+ * SIM_SETTLE_MS of quiet, in which the SPF hold-down falls back to its initial
+ * delay; in a network whose links flap, SPF is held down for up to
+ * SPF_THROTTLE_MAX_MS (5 s) however fast BFD notices.  Topologies are thames
+ * and humber (see sr_topologies/) and a ring of n routers with n/2 random
+ * chords.
+ *
+ * Usage: pwospf_sim [-t thames|humber|ring] [-n routers] [-f failures]
+ *                   [-l latency_ms] [-H hello_s] [-p pace_ms] [-b bfd_ms]
+ *                   [-c] [-r] [-s seed]
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_bfd.h"
+#include "sr_common.h"
+#include "sr_pwospf.h"
+#include "sr_pwospf_flood.h"
+#include "sr_pwospf_lsdb.h"
+#include "sr_pwospf_nbr.h"
+#include "sr_pwospf_spf.h"
+#include "sr_pwospf_throttle.h"
+#include "sr_timer_wheel.h"
+
+/** no time: an event which is not scheduled */
+#define SIM_NEVER 0xFFFFFFFFFFFFFFFFULL
+
+/** how often convergence is checked, in virtual ms */
+#define SIM_CHECK_MS 100
+
+/**
+ * quiet time before each change, long enough for the SPF hold-down to drop
+ * back to its initial delay as it would between rare real failures
+ */
+#define SIM_SETTLE_MS (2 * SPF_THROTTLE_MAX_MS)
+
+/** give up on a change if routes have not converged after this long */
+#define SIM_TIMEOUT_MS 600000
+
+/**
+ * longest a link failure may take to converge with BFD: detection, the SPF
+ * hold-down, and flooding the LSUs across the network.  Only after
+ * SIM_SETTLE_MS of quiet: with the hold-down backed off by recent changes, a
+ * failover waits up to SPF_THROTTLE_MAX_MS for SPF.
+ */
+#define SIM_BFD_FAILOVER_MS 150
+
+/** thames router to router links (10.0.subnet.0/24 joins a and b) */
+static const unsigned thames_link[][3] = {
+    { 2, 0, 1 }, { 3, 0, 2 }, { 4, 1, 3 }, { 5, 3, 4 }, { 6, 4, 5 },
+    { 7, 5, 6 }, { 8, 6, 7 }, { 9, 7, 8 }, { 10, 8, 9 }, { 11, 9, 2 }
+};
+#define THAMES_ROUTERS 10
+#define THAMES_LINKS (sizeof(thames_link)/sizeof(thames_link[0]))
+
+/** humber router to router links, with the loop completed */
+static const unsigned humber_link[][3] = {
+    { 2, 0, 1 }, { 3, 0, 2 }, { 6, 1, 2 }
+};
+#define HUMBER_ROUTERS 3
+#define HUMBER_LINKS (sizeof(humber_link)/sizeof(humber_link[0]))
+
+struct sim_t;
+
+typedef enum sim_event_type_t {
+    SIM_EV_PACKET,          /* a packet arrives */
+    SIM_EV_BFD,             /* a BFD control packet arrives */
+    SIM_EV_TIMER,           /* a router's protocol timer */
+    SIM_EV_HELLO,           /* a router sends hellos */
+    SIM_EV_REFRESH          /* a router refreshes its LSU */
+} sim_event_type_t;
+
+typedef struct sim_event_t {
+    uint64_t at_ms;
+    uint64_t seq;           /* events at the same time run in order */
+    sim_event_type_t type;
+    unsigned router;
+    unsigned iface;         /* packets: the interface it arrives on */
+    uint32_t src_rid;
+    unsigned len;
+    byte*    pkt;
+} sim_event_t;
+
+typedef struct sim_link_t {
+    unsigned a, b;          /* routers */
+    unsigned a_if, b_if;    /* their interfaces */
+    uint32_t subnet;        /* nbo */
+    bool up;
+} sim_link_t;
+
+typedef struct sim_iface_t {
+    unsigned    link;
+    nbr_table_t neighbors;  /* the router at the other end, once heard */
+} sim_iface_t;
+
+typedef struct sim_router_t {
+    struct sim_t*  sim;
+    unsigned       index;
+    uint32_t       rid;
+    uint16_t       seq;
+    lsdb_t         lsdb;
+    spf_t          spf;
+    spf_throttle_t throttle;
+    flood_t        flood;
+    bfd_t          bfd;
+    timer_wheel_t  nbr_wheel;   /* neighbors' dead intervals */
+    sim_iface_t    iface[FLOOD_MAX_IFACES];
+    unsigned       num_ifaces;
+    uint64_t       timer_ms;    /* when the scheduled timer event fires */
+    uint32_t*      dist;        /* route distance to each router's stub subnet */
+    uint64_t       hellos;
+} sim_router_t;
+
+typedef struct sim_t {
+    sim_router_t* router;
+    unsigned      num_routers;
+    sim_link_t*   link;
+    unsigned      num_links, max_links;
+
+    sim_event_t*  heap;
+    unsigned      num_heap, max_heap;
+    uint64_t      next_seq;
+    uint64_t      now_ms;
+    uint64_t      last_change_ms;   /* of any route at any router */
+
+    /* parameters */
+    unsigned      latency_ms;
+    unsigned      hello_ms;
+    unsigned      refresh_ms;       /* 0: LSUs are not refreshed */
+    bool          carrier;          /* link failures are noticed at once */
+    unsigned      bfd_ms;           /* BFD transmit interval, or 0 if off */
+
+    /* statistics */
+    uint64_t      events;
+    uint64_t      lost;             /* packets sent over a link which went down */
+    uint64_t      max_failover_ms;  /* slowest convergence after a link failure */
+
+    /* scratch space for the reference shortest paths */
+    uint32_t*     truth;
+    unsigned*     queue;
+} sim_t;
+
+/** totals over every router */
+typedef struct sim_count_t {
+    uint64_t hellos, bfd_pkts, lsu_pkts, ack_pkts, bytes, events;
+} sim_count_t;
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------*/
+/* event queue                                                              */
+/*--------------------------------------------------------------------------*/
+
+static bool ev_before( const sim_event_t* a, const sim_event_t* b ) {
+    return a->at_ms < b->at_ms || (a->at_ms == b->at_ms && a->seq < b->seq);
+}
+
+static void sim_schedule( sim_t* sim, sim_event_t* e ) {
+    sim_event_t tmp;
+    unsigned i, parent;
+
+    if( sim->num_heap == sim->max_heap ) {
+        sim->max_heap = sim->max_heap ? 2 * sim->max_heap : 1024;
+        sim->heap = realloc_or_die( sim->heap, sim->max_heap * sizeof(*sim->heap) );
+    }
+
+    e->seq = sim->next_seq++;
+    sim->heap[sim->num_heap++] = *e;
+    for( i=sim->num_heap-1; i>0; i=parent ) {
+        parent = (i - 1) / 2;
+        if( !ev_before( &sim->heap[i], &sim->heap[parent] ) )
+            break;
+        tmp = sim->heap[parent];
+        sim->heap[parent] = sim->heap[i];
+        sim->heap[i] = tmp;
+    }
+}
+
+static sim_event_t sim_next_event( sim_t* sim ) {
+    sim_event_t top = sim->heap[0], tmp;
+    unsigned i, c;
+
+    sim->heap[0] = sim->heap[--sim->num_heap];
+    for( i=0; (c = 2*i + 1) < sim->num_heap; i=c ) {
+        if( c + 1 < sim->num_heap && ev_before( &sim->heap[c+1], &sim->heap[c] ) )
+            c += 1;
+        if( !ev_before( &sim->heap[c], &sim->heap[i] ) )
+            break;
+        tmp = sim->heap[c];
+        sim->heap[c] = sim->heap[i];
+        sim->heap[i] = tmp;
+    }
+
+    return top;
+}
+
+static void sim_schedule_router( sim_t* sim, sim_event_type_t type, unsigned r,
+                                 uint64_t at_ms ) {
+    sim_event_t e;
+
+    memset( &e, 0, sizeof(e) );
+    e.at_ms = at_ms;
+    e.type = type;
+    e.router = r;
+    sim_schedule( sim, &e );
+}
+
+/*--------------------------------------------------------------------------*/
+/* protocol glue                                                            */
+/*--------------------------------------------------------------------------*/
+
+/**
+ * Sends a packet (a PWOSPF packet, or a BFD one if type is SIM_EV_BFD) from
+ * interface iface of r to the router at the other end.
+ */
+static void sim_transmit( sim_router_t* r, unsigned iface, sim_event_type_t type,
+                          const byte* pkt, unsigned len ) {
+    sim_t* sim = r->sim;
+    sim_link_t* l = &sim->link[r->iface[iface].link];
+    sim_event_t e;
+
+    if( !l->up ) {
+        sim->lost += 1;
+        return;
+    }
+
+    memset( &e, 0, sizeof(e) );
+    e.at_ms = sim->now_ms + sim->latency_ms;
+    e.type = type;
+    e.router = l->a == r->index ? l->b : l->a;
+    e.iface = l->a == r->index ? l->b_if : l->a_if;
+    e.src_rid = r->rid;
+    e.len = len;
+    e.pkt = malloc_or_die( len );
+    memcpy( e.pkt, pkt, len );
+    sim_schedule( sim, &e );
+}
+
+static void sim_flood_send( void* arg, unsigned iface, uint32_t nbr_id,
+                            const byte* pkt, unsigned len ) {
+    sim_transmit( (sim_router_t*)arg, iface, SIM_EV_PACKET, pkt, len );
+}
+
+static void sim_bfd_send( void* arg, unsigned iface, addr_ip_t ip,
+                          const byte* pkt, unsigned len ) {
+    sim_transmit( (sim_router_t*)arg, iface, SIM_EV_BFD, pkt, len );
+}
+
+/** Passes r's LSDB entry for rid to SPF and schedules a run. */
+static void sim_topology_changed( sim_router_t* r, uint32_t rid ) {
+    lsdb_entry_t* e = lsdb_find( &r->lsdb, rid );
+
+    spf_set_links( &r->spf, e->router_id, e->links, e->num_links );
+    spf_throttle_change( &r->throttle, r->sim->now_ms );
+}
+
+/** the install callback, as the router's */
+static lsdb_result_t sim_install( void* arg, const byte* pkt, unsigned len,
+                                  uint64_t now_ms ) {
+    sim_router_t* r = (sim_router_t*)arg;
+    lsdb_result_t ret;
+
+    ret = lsdb_lsu_input( &r->lsdb, pkt, len, now_ms, NULL, NULL );
+    if( ret == LSDB_CHANGED )
+        sim_topology_changed( r, ((const pwospf_hdr_t*)pkt)->router_id );
+
+    return ret;
+}
+
+/** Records the route to a router's stub subnet (172.x.y.0/24 for router x*256+y). */
+static void sim_route( void* arg, addr_ip_t subnet, addr_ip_t mask,
+                       const spf_route_t* route ) {
+    sim_router_t* r = (sim_router_t*)arg;
+    uint32_t s = ntohl( subnet );
+
+    r->sim->last_change_ms = r->sim->now_ms;
+    if( (s >> 24) == 0xac )
+        r->dist[(s >> 8) & 0xFFFF] = route ? route->dist : SPF_INFINITY;
+}
+
+/**
+ * Router r originates, installs and floods an LSU listing its stub subnet and
+ * the subnet of each interface once per neighbor on it (or once with none).
+ */
+static void sim_originate( sim_router_t* r ) {
+    lsdb_link_t links[FLOOD_MAX_IFACES + 1];
+    nbr_table_t* t;
+    neighbor_t* nbr;
+    unsigned i, j, num_links = 1;
+
+    links[0].subnet = htonl( 0xac000000 | (r->index << 8) );
+    links[0].mask = htonl( 0xFFFFFF00 );
+    links[0].router_id = 0;
+    for( i=0; i<r->num_ifaces; i++ ) {
+        t = &r->iface[i].neighbors;
+        if( !t->num_neighbors ) {
+            links[num_links].subnet = r->sim->link[r->iface[i].link].subnet;
+            links[num_links].mask = htonl( 0xFFFFFF00 );
+            links[num_links++].router_id = 0;
+        }
+        for( j=0; j<t->num_buckets; j++ ) {
+            for( nbr=t->bucket[j]; nbr; nbr=nbr->next ) {
+                links[num_links].subnet = r->sim->link[r->iface[i].link].subnet;
+                links[num_links].mask = htonl( 0xFFFFFF00 );
+                links[num_links++].router_id = nbr->router_id;
+            }
+        }
+    }
+
+    r->seq += 1;
+    flood_originate_links( &r->flood, r->seq, links, num_links, r->sim->now_ms );
+}
+
+/** the reoriginate callback, as the router's */
+static void sim_reoriginate( void* arg, uint16_t seq, uint64_t now_ms ) {
+    sim_router_t* r = (sim_router_t*)arg;
+
+    r->seq = seq;
+    sim_originate( r );
+}
+
+/** Removes neighbor nbr_id of interface iface of r, as the router does. */
+static void sim_neighbor_down( sim_router_t* r, unsigned iface, uint32_t nbr_id ) {
+    bfd_session_t* s;
+
+    if( r->sim->bfd_ms && (s = bfd_find( &r->bfd, iface, nbr_id )) )
+        bfd_remove_session( &r->bfd, s );
+    nbr_remove( &r->iface[iface].neighbors, &r->nbr_wheel, nbr_id );
+    flood_remove_neighbor( &r->flood, nbr_id );
+    sim_originate( r );
+}
+
+/** Called by r's neighbor wheel when a neighbor's dead interval expires. */
+static void sim_neighbor_dead( void* arg, tw_timer_t* dead, uint64_t now_ms ) {
+    neighbor_t* nbr = nbr_of_timer( dead );
+
+    sim_neighbor_down( (sim_router_t*)arg, nbr->iface, nbr->router_id );
+}
+
+/**
+ * Runs r's protocol timer as the router's PWOSPF thread does, and schedules
+ * the next one if it is sooner than the one already scheduled.
+ */
+static void sim_kick( sim_router_t* r ) {
+    sim_t* sim = r->sim;
+    int64_t spf_timeout, flood_timeout, nbr_timeout, bfd_timeout = -1, timeout;
+
+    /* first, so that a neighbor they take down is flooded and scheduled for SPF */
+    tw_advance( &r->nbr_wheel, sim->now_ms, sim_neighbor_dead, r );
+    if( sim->bfd_ms )
+        bfd_timeout = bfd_timer( &r->bfd, sim->now_ms );
+
+    if( spf_throttle_due( &r->throttle, sim->now_ms ) ) {
+        spf_run( &r->spf );
+        spf_throttle_ran( &r->throttle, sim->now_ms );
+    }
+    spf_timeout = spf_throttle_timeout( &r->throttle, sim->now_ms );
+    flood_timeout = flood_timer( &r->flood, sim->now_ms );
+    nbr_timeout = tw_timeout( &r->nbr_wheel, sim->now_ms );
+
+    timeout = spf_timeout;
+    if( timeout < 0 || (flood_timeout >= 0 && flood_timeout < timeout) )
+        timeout = flood_timeout;
+    if( timeout < 0 || (bfd_timeout >= 0 && bfd_timeout < timeout) )
+        timeout = bfd_timeout;
+    if( timeout < 0 || (nbr_timeout >= 0 && nbr_timeout < timeout) )
+        timeout = nbr_timeout;
+    if( timeout < 0 )
+        return;
+    if( timeout == 0 )
+        timeout = 1;
+
+    if( sim->now_ms + timeout < r->timer_ms ) {
+        r->timer_ms = sim->now_ms + timeout;
+        sim_schedule_router( sim, SIM_EV_TIMER, r->index, r->timer_ms );
+    }
+}
+
+static void sim_hello_send( sim_router_t* r, unsigned iface ) {
+    byte pkt[sizeof(pwospf_hdr_t) + sizeof(pwospf_hello_t)];
+    pwospf_hdr_t* hdr = (pwospf_hdr_t*)pkt;
+    pwospf_hello_t* hello = (pwospf_hello_t*)(hdr + 1);
+
+    memset( pkt, 0, sizeof(pkt) );
+    hdr->version = PWOSPF_VERSION;
+    hdr->type = PWOSPF_TYPE_HELLO;
+    hdr->len = htons( sizeof(pkt) );
+    hdr->router_id = r->rid;
+    hello->mask = htonl( 0xFFFFFF00 );
+    hello->hello_int = htons( r->sim->hello_ms / 1000 );
+
+    r->hellos += 1;
+    sim_transmit( r, iface, SIM_EV_PACKET, pkt, sizeof(pkt) );
+}
+
+/** Sends r's hellos. */
+static void sim_hello( sim_router_t* r ) {
+    unsigned i;
+
+    for( i=0; i<r->num_ifaces; i++ )
+        sim_hello_send( r, i );
+}
+
+/** Handles a hello from nbr_id on interface iface of r, as the router does. */
+static void sim_hello_input( sim_router_t* r, unsigned iface, uint32_t nbr_id ) {
+    bool is_new;
+
+    /* the simulation has no addresses: a neighbor's router ID stands in */
+    nbr_hello( &r->iface[iface].neighbors, &r->nbr_wheel, iface, nbr_id, nbr_id,
+               r->sim->now_ms, 3 * r->sim->hello_ms, &is_new );
+    if( !is_new )
+        return;
+
+    flood_add_neighbor( &r->flood, iface, nbr_id );
+    if( r->sim->bfd_ms )
+        bfd_add_session( &r->bfd, iface, nbr_id, nbr_id, r->sim->now_ms );
+    flood_sync( &r->flood, nbr_id );
+    sim_originate( r );
+}
+
+/** Removes every neighbor of interface iface of r, as when carrier is lost. */
+static void sim_carrier_lost( sim_router_t* r, unsigned iface ) {
+    nbr_table_t* t = &r->iface[iface].neighbors;
+    unsigned i;
+
+    for( i=0; i<t->num_buckets; i++ )
+        while( t->bucket[i] )
+            sim_neighbor_down( r, iface, t->bucket[i]->router_id );
+}
+
+/** BFD's state change callback: a session going Down tears down its neighbor. */
+static void sim_bfd_changed( void* arg, bfd_session_t* s, uint64_t now_ms ) {
+    sim_router_t* r = (sim_router_t*)arg;
+
+    if( s->state != BFD_UP && nbr_find( &r->iface[s->iface].neighbors, s->nbr_id ) )
+        sim_neighbor_down( r, s->iface, s->nbr_id );
+}
+
+/** Handles one event. */
+static void sim_event( sim_t* sim, sim_event_t* e ) {
+    sim_router_t* r = &sim->router[e->router];
+    sim_link_t* l;
+
+    sim->now_ms = e->at_ms;
+    sim->events += 1;
+
+    switch( e->type ) {
+    case SIM_EV_PACKET:
+        l = &sim->link[r->iface[e->iface].link];
+        if( !l->up )
+            sim->lost += 1;
+        else if( ((pwospf_hdr_t*)e->pkt)->type == PWOSPF_TYPE_HELLO )
+            sim_hello_input( r, e->iface, e->src_rid );
+        else
+            flood_input( &r->flood, e->src_rid, e->pkt, e->len, sim->now_ms );
+        free( e->pkt );
+        break;
+
+    case SIM_EV_BFD:
+        l = &sim->link[r->iface[e->iface].link];
+        if( !l->up )
+            sim->lost += 1;
+        else
+            bfd_input( &r->bfd, e->iface, e->src_rid, e->pkt, e->len, sim->now_ms );
+        free( e->pkt );
+        break;
+
+    case SIM_EV_TIMER:
+        if( e->at_ms != r->timer_ms )
+            return; /* superseded by an earlier one */
+        r->timer_ms = SIM_NEVER;
+        break;
+
+    case SIM_EV_HELLO:
+        sim_hello( r );
+        sim_schedule_router( sim, SIM_EV_HELLO, r->index, sim->now_ms + sim->hello_ms );
+        break;
+
+    case SIM_EV_REFRESH:
+        sim_originate( r );
+        sim_schedule_router( sim, SIM_EV_REFRESH, r->index, sim->now_ms + sim->refresh_ms );
+        break;
+    }
+
+    sim_kick( r );
+}
+
+/*--------------------------------------------------------------------------*/
+/* topology                                                                 */
+/*--------------------------------------------------------------------------*/
+
+static void sim_add_link( sim_t* sim, unsigned a, unsigned b, uint32_t subnet ) {
+    sim_link_t* l;
+
+    true_or_die( sim->router[a].num_ifaces < FLOOD_MAX_IFACES
+                 && sim->router[b].num_ifaces < FLOOD_MAX_IFACES,
+                 "Error: too many links on one router" );
+    if( sim->num_links == sim->max_links ) {
+        sim->max_links = sim->max_links ? 2 * sim->max_links : 16;
+        sim->link = realloc_or_die( sim->link, sim->max_links * sizeof(*sim->link) );
+    }
+
+    l = &sim->link[sim->num_links];
+    l->a = a;
+    l->b = b;
+    l->a_if = sim->router[a].num_ifaces++;
+    l->b_if = sim->router[b].num_ifaces++;
+    l->subnet = subnet;
+    l->up = TRUE;
+    sim->router[a].iface[l->a_if].link = sim->num_links;
+    sim->router[b].iface[l->b_if].link = sim->num_links;
+    sim->num_links += 1;
+}
+
+static bool sim_has_link( sim_t* sim, unsigned a, unsigned b ) {
+    unsigned i;
+
+    for( i=0; i<sim->num_links; i++ )
+        if( (sim->link[i].a == a && sim->link[i].b == b)
+            || (sim->link[i].a == b && sim->link[i].b == a) )
+            return TRUE;
+
+    return FALSE;
+}
+
+/** Takes link i down or brings it back up. */
+static void sim_link_set( sim_t* sim, unsigned i, bool up ) {
+    sim_link_t* l = &sim->link[i];
+    sim_router_t* a = &sim->router[l->a];
+    sim_router_t* b = &sim->router[l->b];
+
+    l->up = up;
+    if( up ) {
+        /* hello as soon as the interface comes up */
+        sim_hello_send( a, l->a_if );
+        sim_hello_send( b, l->b_if );
+    }
+    else if( sim->carrier ) {
+        sim_carrier_lost( a, l->a_if );
+        sim_carrier_lost( b, l->b_if );
+    }
+    sim_kick( a );
+    sim_kick( b );
+}
+
+/** Creates the routers of a topology; every router boots at time 0. */
+static void sim_init( sim_t* sim, const char* topo, unsigned n, unsigned latency_ms,
+                      unsigned hello_ms, unsigned pace_ms, unsigned bfd_ms,
+                      bool carrier, bool refresh ) {
+    sim_router_t* r;
+    unsigned i, a, b;
+
+    memset( sim, 0, sizeof(*sim) );
+    if( strcmp( topo, "thames" ) == 0 )
+        n = THAMES_ROUTERS;
+    else if( strcmp( topo, "humber" ) == 0 )
+        n = HUMBER_ROUTERS;
+    true_or_die( n >= 3 && n <= 0x10000, "Error: need 3 to 65536 routers" );
+
+    sim->num_routers = n;
+    sim->router = calloc_or_die( n, sizeof(*sim->router) );
+    sim->latency_ms = latency_ms;
+    sim->hello_ms = hello_ms;
+    sim->refresh_ms = refresh ? PWOSPF_LSU_INT * 1000 : 0;
+    sim->carrier = carrier;
+    sim->bfd_ms = bfd_ms;
+    sim->truth = malloc_or_die( n * sizeof(*sim->truth) );
+    sim->queue = malloc_or_die( n * sizeof(*sim->queue) );
+
+    if( strcmp( topo, "thames" ) == 0 ) {
+        for( i=0; i<THAMES_LINKS; i++ )
+            sim_add_link( sim, thames_link[i][1], thames_link[i][2],
+                          htonl( 0x0a000000 | (thames_link[i][0] << 8) ) );
+    }
+    else if( strcmp( topo, "humber" ) == 0 ) {
+        for( i=0; i<HUMBER_LINKS; i++ )
+            sim_add_link( sim, humber_link[i][1], humber_link[i][2],
+                          htonl( 0x0a000000 | (humber_link[i][0] << 8) ) );
+    }
+    else {
+        for( i=0; i<n; i++ )
+            sim_add_link( sim, i, (i + 1) % n, htonl( 0x0b000000 | (i << 8) ) );
+        while( sim->num_links < n + n / 2 ) {
+            a = rand() % n;
+            b = rand() % n;
+            if( a != b && !sim_has_link( sim, a, b ) )
+                sim_add_link( sim, a, b, htonl( 0x0b000000 | (sim->num_links << 8) ) );
+        }
+    }
+
+    for( i=0; i<n; i++ ) {
+        r = &sim->router[i];
+        r->sim = sim;
+        r->index = i;
+        r->rid = htonl( 0x01000000 + i + 1 );
+        r->timer_ms = SIM_NEVER;
+        r->dist = malloc_or_die( n * sizeof(*r->dist) );
+        memset( r->dist, 0xFF, n * sizeof(*r->dist) );
+        tw_init( &r->nbr_wheel, NBR_TICK_MS, 0 );
+        for( a=0; a<r->num_ifaces; a++ )
+            nbr_table_init( &r->iface[a].neighbors );
+        lsdb_init( &r->lsdb );
+        spf_init( &r->spf, r->rid, sim_route, r );
+        spf_throttle_init( &r->throttle, SPF_THROTTLE_INITIAL_MS,
+                           SPF_THROTTLE_INCR_MS, SPF_THROTTLE_MAX_MS );
+        flood_init( &r->flood, r->rid, pace_ms, FLOOD_RXMT_MS, &r->lsdb,
+                    sim_flood_send, sim_install, sim_reoriginate, r );
+        if( bfd_ms )
+            bfd_init( &r->bfd, bfd_ms, BFD_DETECT_MULT, r->rid,
+                      sim_bfd_send, sim_bfd_changed, r, 0 );
+
+        sim_originate( r );
+        sim_kick( r );
+        sim_schedule_router( sim, SIM_EV_HELLO, i, rand() % hello_ms );
+        if( refresh )
+            sim_schedule_router( sim, SIM_EV_REFRESH, i, rand() % sim->refresh_ms );
+    }
+}
+
+static void sim_destroy( sim_t* sim ) {
+    sim_router_t* r;
+    unsigned i, j;
+
+    for( i=0; i<sim->num_routers; i++ ) {
+        r = &sim->router[i];
+        for( j=0; j<r->num_ifaces; j++ )
+            nbr_table_destroy( &r->iface[j].neighbors, &r->nbr_wheel );
+        if( sim->bfd_ms )
+            bfd_destroy( &sim->router[i].bfd );
+        flood_destroy( &sim->router[i].flood );
+        spf_destroy( &sim->router[i].spf );
+        lsdb_destroy( &sim->router[i].lsdb );
+        free( sim->router[i].dist );
+    }
+    for( i=0; i<sim->num_heap; i++ )
+        if( sim->heap[i].type == SIM_EV_PACKET || sim->heap[i].type == SIM_EV_BFD )
+            free( sim->heap[i].pkt );
+    free( sim->heap );
+    free( sim->router );
+    free( sim->link );
+    free( sim->truth );
+    free( sim->queue );
+}
+
+/*--------------------------------------------------------------------------*/
+/* convergence                                                              */
+/*--------------------------------------------------------------------------*/
+
+/** Returns TRUE if nothing is left to flood and no SPF run is pending. */
+static bool sim_quiet( sim_t* sim ) {
+    unsigned i;
+
+    for( i=0; i<sim->num_routers; i++ )
+        if( sim->router[i].throttle.pending || !flood_idle( &sim->router[i].flood ) )
+            return FALSE;
+
+    return TRUE;
+}
+
+/**
+ * Returns TRUE if every router's distance to every router matches a breadth
+ * first search over the links which are up.
+ */
+static bool sim_converged( sim_t* sim ) {
+    sim_router_t* r;
+    sim_link_t* l;
+    unsigned i, j, k, head, tail, v, w;
+
+    for( i=0; i<sim->num_routers; i++ ) {
+        memset( sim->truth, 0xFF, sim->num_routers * sizeof(*sim->truth) );
+        sim->truth[i] = 0;
+        sim->queue[0] = i;
+        for( head=0, tail=1; head<tail; head++ ) {
+            v = sim->queue[head];
+            r = &sim->router[v];
+            for( k=0; k<r->num_ifaces; k++ ) {
+                l = &sim->link[r->iface[k].link];
+                w = l->a == v ? l->b : l->a;
+                if( l->up && sim->truth[w] == SPF_INFINITY ) {
+                    sim->truth[w] = sim->truth[v] + 1;
+                    sim->queue[tail++] = w;
+                }
+            }
+        }
+
+        for( j=0; j<sim->num_routers; j++ )
+            if( sim->router[i].dist[j] != sim->truth[j] )
+                return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Runs until the routes converge, checking every SIM_CHECK_MS.
+ *
+ * @return FALSE on timeout
+ */
+static bool sim_run( sim_t* sim ) {
+    uint64_t start = sim->now_ms, check = sim->now_ms;
+    sim_event_t e;
+
+    for( ;; ) {
+        check += SIM_CHECK_MS;
+        while( sim->num_heap && sim->heap[0].at_ms <= check ) {
+            e = sim_next_event( sim );
+            sim_event( sim, &e );
+        }
+        sim->now_ms = check;
+
+        if( sim_quiet( sim ) && sim_converged( sim ) )
+            return TRUE;
+        if( check - start > SIM_TIMEOUT_MS )
+            return FALSE;
+    }
+}
+
+/** Runs the routers for ms of virtual time. */
+static void sim_idle( sim_t* sim, uint64_t ms ) {
+    uint64_t end = sim->now_ms + ms;
+    sim_event_t e;
+
+    while( sim->num_heap && sim->heap[0].at_ms <= end ) {
+        e = sim_next_event( sim );
+        sim_event( sim, &e );
+    }
+    sim->now_ms = end;
+}
+
+static void sim_count( sim_t* sim, sim_count_t* c ) {
+    unsigned i;
+
+    memset( c, 0, sizeof(*c) );
+    for( i=0; i<sim->num_routers; i++ ) {
+        c->hellos += sim->router[i].hellos;
+        if( sim->bfd_ms )
+            c->bfd_pkts += sim->router[i].bfd.pkts_out;
+        c->lsu_pkts += sim->router[i].flood.lsu_pkts;
+        c->ack_pkts += sim->router[i].flood.ack_pkts;
+        c->bytes += sim->router[i].flood.bytes_sent;
+    }
+    c->events = sim->events;
+}
+
+/**
+ * Applies a change (link i going up or down after SIM_SETTLE_MS of quiet, or
+ * the boot if i is -1), runs until the routes converge and prints what it took.
+ *
+ * @return FALSE if the routes did not converge
+ */
+static bool sim_change( sim_t* sim, const char* what, int i, bool up ) {
+    sim_count_t before, after;
+    uint64_t start_ms, start_ns, wall_ns;
+    bool ok;
+
+    if( i >= 0 )
+        sim_idle( sim, SIM_SETTLE_MS );
+    start_ms = sim->now_ms;
+    start_ns = now_nsec();
+    sim_count( sim, &before );
+    sim->last_change_ms = start_ms;
+    if( i >= 0 )
+        sim_link_set( sim, i, up );
+    ok = sim_run( sim );
+    wall_ns = now_nsec() - start_ns;
+    sim_count( sim, &after );
+    if( i >= 0 && !up && sim->last_change_ms - start_ms > sim->max_failover_ms )
+        sim->max_failover_ms = sim->last_change_ms - start_ms;
+
+    printf( "  %-14s %s in %7.3f s virtual (%6.3f s simulated in %6.3f s):"
+            " %7llu hellos %7llu BFD pkts %7llu LSU pkts %7llu acks %9llu LSU/ack bytes"
+            " %9llu events\n",
+            what, ok ? "converged" : "TIMED OUT",
+            (sim->last_change_ms - start_ms) / 1000.0,
+            (sim->now_ms - start_ms) / 1000.0, wall_ns / 1e9,
+            (unsigned long long)(after.hellos - before.hellos),
+            (unsigned long long)(after.bfd_pkts - before.bfd_pkts),
+            (unsigned long long)(after.lsu_pkts - before.lsu_pkts),
+            (unsigned long long)(after.ack_pkts - before.ack_pkts),
+            (unsigned long long)(after.bytes - before.bytes),
+            (unsigned long long)(after.events - before.events) );
+    return ok;
+}
+
+/** @return number of failures */
+static unsigned run( const char* topo, unsigned n, unsigned num_failures,
+                     unsigned latency_ms, unsigned hello_ms, unsigned pace_ms,
+                     unsigned bfd_ms, bool carrier, bool refresh ) {
+    unsigned i, k, failures = 0;
+    char what[32];
+    sim_t sim;
+
+    sim_init( &sim, topo, n, latency_ms, hello_ms, pace_ms, bfd_ms, carrier, refresh );
+    printf( "%s: %u routers, %u links\n", topo, sim.num_routers, sim.num_links );
+
+    failures += !sim_change( &sim, "boot", -1, TRUE );
+    for( i=0; i<num_failures; i++ ) {
+        k = rand() % sim.num_links;
+        snprintf( what, sizeof(what), "link %u down", k );
+        failures += !sim_change( &sim, what, k, FALSE );
+        snprintf( what, sizeof(what), "link %u up", k );
+        failures += !sim_change( &sim, what, k, TRUE );
+    }
+    if( sim.lost )
+        printf( "  %llu packets lost on failed links\n", (unsigned long long)sim.lost );
+    if( num_failures ) {
+        printf( "  longest failover %.3f s\n", sim.max_failover_ms / 1000.0 );
+        if( bfd_ms && sim.max_failover_ms > SIM_BFD_FAILOVER_MS ) {
+            printf( "  failover took longer than %u ms with BFD\n", SIM_BFD_FAILOVER_MS );
+            failures += 1;
+        }
+    }
+
+    sim_destroy( &sim );
+    return failures;
+}
+
+int main( int argc, char** argv ) {
+    static const char* topos[] = { "humber", "thames", "ring" };
+    const char* topo = NULL;
+    unsigned n = 1000, num_failures = 3, latency_ms = 1, hello_s = PWOSPF_HELLO_INT;
+    unsigned pace_ms = FLOOD_PACE_MS, bfd_ms = 0, seed = 1, failures = 0, i;
+    bool carrier = FALSE, refresh = FALSE;
+    int c;
+
+    while( (c = getopt( argc, argv, "t:n:f:l:H:p:b:crs:" )) != EOF ) {
+        switch( c ) {
+        case 't': topo = optarg; break;
+        case 'n': n = atoi( optarg ); break;
+        case 'f': num_failures = atoi( optarg ); break;
+        case 'l': latency_ms = atoi( optarg ); break;
+        case 'H': hello_s = atoi( optarg ); break;
+        case 'p': pace_ms = atoi( optarg ); break;
+        case 'b': bfd_ms = atoi( optarg ); break;
+        case 'c': carrier = TRUE; break;
+        case 'r': refresh = TRUE; break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-t thames|humber|ring] [-n routers] [-f failures]\n"
+                     "          [-l latency_ms] [-H hello_s] [-p pace_ms] [-b bfd_ms]\n"
+                     "          [-c] [-r] [-s seed]\n",
+                     argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( hello_s > 0, "Error: the hello interval must be positive" );
+    true_or_die( !topo || strcmp( topo, "thames" ) == 0 || strcmp( topo, "humber" ) == 0
+                 || strcmp( topo, "ring" ) == 0, "Error: unknown topology" );
+    srand( seed );
+
+    printf( "%u ms links, %u s hellos, %s, LSUs %srefreshed, %s flooding\n",
+            latency_ms, hello_s, carrier ? "carrier detection"
+            : bfd_ms ? "failures found by BFD" : "failures found by hellos",
+            refresh ? "" : "not ", pace_ms ? "paced" : "immediate" );
+    for( i=0; i<sizeof(topos)/sizeof(topos[0]); i++ )
+        if( !topo || strcmp( topo, topos[i] ) == 0 )
+            failures += run( topos[i], n, num_failures, latency_ms, hello_s * 1000,
+                             pace_ms, bfd_ms, carrier, refresh );
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,848 @@
+/* Filename: sr_pwospf_spf.c */
+
+#include <stdlib.h>
+#include <string.h>
+#include "sr_pwospf_spf.h"
+
+/**
+ * Returns the array a, reallocated if needed so that it has room for element
+ * num (doubling its capacity *max).
+ */
+static void* spf_grow( void* a, unsigned num, unsigned* max, unsigned size ) {
+    if( num < *max )
+        return a;
+
+    *max = *max ? 2 * *max : 8;
+    return realloc_or_die( a, *max * size );
+}
+
+/** appends val to the growable array arr of num elements and max capacity */
+#define SPF_PUSH( arr, num, max, val ) do {                       \
+        (arr) = spf_grow( (arr), (num), &(max), sizeof(*(arr)) );  \
+        (arr)[(num)++] = (val);                                    \
+    } while( 0 )
+
+static int link_cmp( const void* va, const void* vb ) {
+    const lsdb_link_t* a = (const lsdb_link_t*)va;
+    const lsdb_link_t* b = (const lsdb_link_t*)vb;
+
+    if( a->router_id != b->router_id )
+        return a->router_id < b->router_id ? -1 : 1;
+    if( a->subnet != b->subnet )
+        return a->subnet < b->subnet ? -1 : 1;
+    if( a->mask != b->mask )
+        return a->mask < b->mask ? -1 : 1;
+    return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/* node and prefix tables                                                   */
+/*--------------------------------------------------------------------------*/
+
+unsigned spf_lookup( spf_t* spf, uint32_t rid ) {
+    unsigned mask = spf->node_hash_size - 1;
+    unsigned h = hash32( rid ) & mask;
+
+    while( spf->node_hash[h] ) {
+        if( spf->node[spf->node_hash[h] - 1].rid == rid )
+            return spf->node_hash[h] - 1;
+        h = (h + 1) & mask;
+    }
+
+    return SPF_NONE;
+}
+
+static void node_hash_insert( spf_t* spf, unsigned v ) {
+    unsigned mask = spf->node_hash_size - 1;
+    unsigned h = hash32( spf->node[v].rid ) & mask;
+
+    while( spf->node_hash[h] )
+        h = (h + 1) & mask;
+    spf->node_hash[h] = v + 1;
+}
+
+/** Returns the index of router rid's node, creating it if needed. */
+static unsigned node_get( spf_t* spf, uint32_t rid ) {
+    spf_node_t* n;
+    unsigned v;
+
+    v = spf_lookup( spf, rid );
+    if( v != SPF_NONE )
+        return v;
+
+    /* keep the table at most half full */
+    if( 2 * (spf->num_nodes + 1) > spf->node_hash_size ) {
+        free( spf->node_hash );
+        spf->node_hash_size *= 2;
+        spf->node_hash = calloc_or_die( spf->node_hash_size, sizeof(unsigned) );
+        for( v=0; v<spf->num_nodes; v++ )
+            node_hash_insert( spf, v );
+    }
+
+    v = spf->num_nodes;
+    spf->node = spf_grow( spf->node, v, &spf->max_nodes, sizeof(*spf->node) );
+    spf->num_nodes += 1;
+
+    n = &spf->node[v];
+    memset( n, 0, sizeof(*n) );
+    n->rid = rid;
+    n->dist = SPF_INFINITY;
+    n->slot = SPF_NONE;
+    n->parent = n->first_child = n->next_sibling = n->prev_sibling = SPF_NONE;
+    node_hash_insert( spf, v );
+
+    return v;
+}
+
+static unsigned prefix_hash( addr_ip_t subnet, addr_ip_t mask ) {
+    return hash32( subnet ^ hash32( mask ) );
+}
+
+static void prefix_hash_insert( spf_t* spf, unsigned p ) {
+    unsigned mask = spf->prefix_hash_size - 1;
+    unsigned h = prefix_hash( spf->prefix[p].subnet, spf->prefix[p].mask ) & mask;
+
+    while( spf->prefix_hash[h] )
+        h = (h + 1) & mask;
+    spf->prefix_hash[h] = p + 1;
+}
+
+/** Returns the index of the prefix, creating it if needed. */
+static unsigned prefix_get( spf_t* spf, addr_ip_t subnet, addr_ip_t mask ) {
+    unsigned hmask = spf->prefix_hash_size - 1;
+    unsigned h = prefix_hash( subnet, mask ) & hmask;
+    spf_prefix_t* p;
+    unsigned i;
+
+    while( spf->prefix_hash[h] ) {
+        p = &spf->prefix[spf->prefix_hash[h] - 1];
+        if( p->subnet == subnet && p->mask == mask )
+            return spf->prefix_hash[h] - 1;
+        h = (h + 1) & hmask;
+    }
+
+    if( 2 * (spf->num_prefixes + 1) > spf->prefix_hash_size ) {
+        free( spf->prefix_hash );
+        spf->prefix_hash_size *= 2;
+        spf->prefix_hash = calloc_or_die( spf->prefix_hash_size, sizeof(unsigned) );
+        for( i=0; i<spf->num_prefixes; i++ )
+            prefix_hash_insert( spf, i );
+    }
+
+    i = spf->num_prefixes;
+    spf->prefix = spf_grow( spf->prefix, i, &spf->max_prefixes, sizeof(*spf->prefix) );
+    spf->num_prefixes += 1;
+
+    p = &spf->prefix[i];
+    memset( p, 0, sizeof(*p) );
+    p->subnet = subnet;
+    p->mask = mask;
+    prefix_hash_insert( spf, i );
+
+    return i;
+}
+
+static void node_mark_dirty( spf_t* spf, unsigned v ) {
+    if( !spf->node[v].dirty ) {
+        spf->node[v].dirty = TRUE;
+        SPF_PUSH( spf->dirty_node, spf->num_dirty_node, spf->max_dirty_node, v );
+    }
+}
+
+static void prefix_mark_dirty( spf_t* spf, unsigned p ) {
+    if( !spf->prefix[p].dirty ) {
+        spf->prefix[p].dirty = TRUE;
+        SPF_PUSH( spf->dirty_prefix, spf->num_dirty_prefix, spf->max_dirty_prefix, p );
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/* shortest path tree and adjacency                                         */
+/*--------------------------------------------------------------------------*/
+
+static void tree_unlink( spf_t* spf, unsigned v ) {
+    spf_node_t* n = &spf->node[v];
+
+    if( n->parent == SPF_NONE )
+        return;
+
+    if( n->prev_sibling != SPF_NONE )
+        spf->node[n->prev_sibling].next_sibling = n->next_sibling;
+    else
+        spf->node[n->parent].first_child = n->next_sibling;
+    if( n->next_sibling != SPF_NONE )
+        spf->node[n->next_sibling].prev_sibling = n->prev_sibling;
+
+    n->parent = n->prev_sibling = n->next_sibling = SPF_NONE;
+}
+
+static void tree_link( spf_t* spf, unsigned v, unsigned parent ) {
+    spf_node_t* n = &spf->node[v];
+    spf_node_t* p = &spf->node[parent];
+
+    tree_unlink( spf, v );
+    n->parent = parent;
+    n->next_sibling = p->first_child;
+    if( p->first_child != SPF_NONE )
+        spf->node[p->first_child].prev_sibling = v;
+    p->first_child = v;
+}
+
+static void adj_remove( spf_node_t* n, unsigned w ) {
+    unsigned i;
+
+    for( i=0; i<n->num_adj; i++ ) {
+        if( n->adj[i] == w ) {
+            n->adj[i] = n->adj[--n->num_adj];
+            return;
+        }
+    }
+}
+
+/** Returns TRUE if n advertises a link to router rid. */
+static bool advertises( spf_node_t* n, uint32_t rid ) {
+    int lo = 0, hi = (int)n->num_links - 1, mid;
+
+    while( lo <= hi ) {
+        mid = (lo + hi) / 2;
+        if( n->links[mid].router_id == rid )
+            return TRUE;
+        else if( n->links[mid].router_id < rid )
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return FALSE;
+}
+
+/** bit of slot s in spf_node_t.hops */
+#define SLOT_BIT( s ) ((s) == SPF_NONE ? 0 : (uint64_t)1 << (s))
+
+/** Gives the root's neighbor v a slot, if one is free. */
+static void slot_assign( spf_t* spf, unsigned v ) {
+    unsigned s;
+
+    if( spf->node[v].slot != SPF_NONE )
+        return;
+
+    for( s=0; s<SPF_MAX_SLOTS; s++ ) {
+        if( spf->slot_node[s] == SPF_NONE ) {
+            spf->slot_node[s] = v;
+            spf->node[v].slot = s;
+            return;
+        }
+    }
+}
+
+static void slot_release( spf_t* spf, unsigned v ) {
+    if( spf->node[v].slot != SPF_NONE ) {
+        spf->slot_node[spf->node[v].slot] = SPF_NONE;
+        spf->node[v].slot = SPF_NONE;
+    }
+}
+
+static void edge_remove( spf_t* spf, unsigned u, unsigned w ) {
+    adj_remove( &spf->node[u], w );
+    adj_remove( &spf->node[w], u );
+
+    if( u == spf->root )
+        slot_release( spf, w );
+    if( w == spf->root )
+        slot_release( spf, u );
+    SPF_PUSH( spf->del, spf->num_del, spf->max_del, u );
+    SPF_PUSH( spf->del, spf->num_del, spf->max_del, w );
+
+    if( spf->node[w].parent == u )
+        SPF_PUSH( spf->cut, spf->num_cut, spf->max_cut, w );
+    if( spf->node[u].parent == w )
+        SPF_PUSH( spf->cut, spf->num_cut, spf->max_cut, u );
+}
+
+static void edge_add( spf_t* spf, unsigned u, unsigned w ) {
+    spf_node_t* n;
+
+    n = &spf->node[u];
+    SPF_PUSH( n->adj, n->num_adj, n->max_adj, w );
+    n = &spf->node[w];
+    SPF_PUSH( n->adj, n->num_adj, n->max_adj, u );
+
+    if( u == spf->root )
+        slot_assign( spf, w );
+    if( w == spf->root )
+        slot_assign( spf, u );
+    SPF_PUSH( spf->ins, spf->num_ins, spf->max_ins, u );
+    SPF_PUSH( spf->ins, spf->num_ins, spf->max_ins, w );
+}
+
+/**
+ * Returns the slots of the first hops of v's shortest paths: the union of
+ * those of its neighbors one hop closer to the root.
+ */
+static uint64_t node_hops( spf_t* spf, unsigned v ) {
+    spf_node_t* n = &spf->node[v];
+    spf_node_t* p;
+    uint64_t hops = 0;
+    unsigned j;
+
+    if( v == spf->root || n->dist == SPF_INFINITY )
+        return 0;
+
+    for( j=0; j<n->num_adj; j++ ) {
+        p = &spf->node[n->adj[j]];
+        if( p->dist == SPF_INFINITY || p->dist + 1 != n->dist )
+            continue;
+        hops |= n->adj[j] == spf->root ? SLOT_BIT( n->slot ) : p->hops;
+    }
+
+    return hops;
+}
+
+/*--------------------------------------------------------------------------*/
+/* priority queue                                                           */
+/*--------------------------------------------------------------------------*/
+
+static void heap_push( spf_t* spf, uint32_t dist, unsigned v ) {
+    spf_heap_entry_t e, tmp;
+    unsigned i, parent;
+
+    e.dist = dist;
+    e.node = v;
+    SPF_PUSH( spf->heap, spf->num_heap, spf->max_heap, e );
+
+    for( i=spf->num_heap-1; i>0; i=parent ) {
+        parent = (i - 1) / 2;
+        if( spf->heap[parent].dist <= spf->heap[i].dist )
+            break;
+        tmp = spf->heap[parent];
+        spf->heap[parent] = spf->heap[i];
+        spf->heap[i] = tmp;
+    }
+}
+
+static spf_heap_entry_t heap_pop( spf_t* spf ) {
+    spf_heap_entry_t top = spf->heap[0], tmp;
+    unsigned i, c;
+
+    spf->heap[0] = spf->heap[--spf->num_heap];
+    for( i=0; (c = 2*i + 1) < spf->num_heap; i=c ) {
+        if( c + 1 < spf->num_heap && spf->heap[c+1].dist < spf->heap[c].dist )
+            c += 1;
+        if( spf->heap[i].dist <= spf->heap[c].dist )
+            break;
+        tmp = spf->heap[c];
+        spf->heap[c] = spf->heap[i];
+        spf->heap[i] = tmp;
+    }
+
+    return top;
+}
+
+/** Makes u w's parent and queues w if that brings w closer to the root. */
+static void relax( spf_t* spf, unsigned u, unsigned w ) {
+    uint32_t d = spf->node[u].dist;
+
+    if( d != SPF_INFINITY && d + 1 < spf->node[w].dist ) {
+        spf->node[w].dist = d + 1;
+        tree_link( spf, w, u );
+        heap_push( spf, d + 1, w );
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/* routes                                                                   */
+/*--------------------------------------------------------------------------*/
+
+/**
+ * Fills r with the best route to pf: the closest advertiser (ties go to the
+ * lowest router ID) and the first hops of the shortest paths to every
+ * advertiser that close.
+ *
+ * @return FALSE if no advertiser is reachable
+ */
+static bool route_make( spf_t* spf, spf_prefix_t* pf, spf_route_t* r ) {
+    spf_node_t *n, *b = NULL;
+    uint64_t hops = 0;
+    uint32_t rid;
+    unsigned i, j;
+
+    for( i=0; i<pf->num_adv; i++ ) {
+        n = &spf->node[pf->adv[i]];
+        if( n->dist == SPF_INFINITY )
+            continue;
+        if( !b || n->dist < b->dist ) {
+            b = n;
+            hops = n->hops;
+        }
+        else if( n->dist == b->dist ) {
+            if( n->rid < b->rid )
+                b = n;
+            hops |= n->hops;
+        }
+    }
+    if( !b )
+        return FALSE;
+
+    /* zeroed so that routes compare with memcmp() */
+    memset( r, 0, sizeof(*r) );
+    r->via = b->rid;
+    r->dist = b->dist;
+
+    /* the lowest SPF_MAX_ECMP first hops' router IDs, in ascending order */
+    for( ; hops; hops &= hops - 1 ) {
+        rid = spf->node[spf->slot_node[__builtin_ctzll( hops )]].rid;
+        for( j=r->num_hops; j>0 && r->first_hop[j-1] > rid; j-- )
+            if( j < SPF_MAX_ECMP )
+                r->first_hop[j] = r->first_hop[j-1];
+        if( j < SPF_MAX_ECMP ) {
+            r->first_hop[j] = rid;
+            if( r->num_hops < SPF_MAX_ECMP )
+                r->num_hops += 1;
+        }
+    }
+
+    return TRUE;
+}
+
+/** Picks the best route for prefix p and reports it if it changed. */
+static unsigned prefix_evaluate( spf_t* spf, unsigned p ) {
+    spf_prefix_t* pf = &spf->prefix[p];
+    spf_route_t r;
+
+    pf->dirty = FALSE;
+
+    if( !route_make( spf, pf, &r ) ) {
+        if( !pf->has_route )
+            return 0;
+        pf->has_route = FALSE;
+        if( spf->cb )
+            spf->cb( spf->cb_arg, pf->subnet, pf->mask, NULL );
+        return 1;
+    }
+
+    if( pf->has_route && memcmp( &pf->route, &r, sizeof(r) ) == 0 )
+        return 0;
+
+    pf->route = r;
+    pf->has_route = TRUE;
+    if( spf->cb )
+        spf->cb( spf->cb_arg, pf->subnet, pf->mask, &pf->route );
+    return 1;
+}
+
+/** Re-evaluates the prefixes of every dirty node and every dirty prefix. */
+static unsigned spf_update_routes( spf_t* spf ) {
+    spf_node_t* n;
+    unsigned i, j, changed = 0;
+
+    for( i=0; i<spf->num_dirty_node; i++ ) {
+        n = &spf->node[spf->dirty_node[i]];
+        n->dirty = FALSE;
+        for( j=0; j<n->num_links; j++ )
+            prefix_mark_dirty( spf, n->link_prefix[j] );
+    }
+    spf->num_dirty_node = 0;
+
+    for( i=0; i<spf->num_dirty_prefix; i++ )
+        changed += prefix_evaluate( spf, spf->dirty_prefix[i] );
+    spf->num_dirty_prefix = 0;
+
+    spf->routes_changed += changed;
+    return changed;
+}
+
+/*--------------------------------------------------------------------------*/
+/* public interface                                                         */
+/*--------------------------------------------------------------------------*/
+
+void spf_init( spf_t* spf, uint32_t root_rid, spf_route_cb cb, void* cb_arg ) {
+    memset( spf, 0, sizeof(*spf) );
+    spf->cb = cb;
+    spf->cb_arg = cb_arg;
+    memset( spf->slot_node, 0xFF, sizeof(spf->slot_node) );
+
+    spf->node_hash_size = 16;
+    spf->node_hash = calloc_or_die( spf->node_hash_size, sizeof(unsigned) );
+    spf->prefix_hash_size = 16;
+    spf->prefix_hash = calloc_or_die( spf->prefix_hash_size, sizeof(unsigned) );
+
+    spf->root = node_get( spf, root_rid );
+    spf->node[spf->root].dist = 0;
+}
+
+void spf_set_root( spf_t* spf, uint32_t rid ) {
+    spf_node_t* n;
+    unsigned i;
+
+    for( i=0; i<SPF_MAX_SLOTS; i++ )
+        if( spf->slot_node[i] != SPF_NONE )
+            slot_release( spf, spf->slot_node[i] );
+
+    spf->root = node_get( spf, rid );
+    n = &spf->node[spf->root];
+    for( i=0; i<n->num_adj; i++ )
+        slot_assign( spf, n->adj[i] );
+
+    spf_full( spf );
+}
+
+void spf_destroy( spf_t* spf ) {
+    unsigned i;
+
+    for( i=0; i<spf->num_nodes; i++ ) {
+        free( spf->node[i].links );
+        free( spf->node[i].link_prefix );
+        free( spf->node[i].adj );
+    }
+    for( i=0; i<spf->num_prefixes; i++ )
+        free( spf->prefix[i].adv );
+
+    free( spf->node );
+    free( spf->node_hash );
+    free( spf->prefix );
+    free( spf->prefix_hash );
+    free( spf->cut );
+    free( spf->ins );
+    free( spf->del );
+    free( spf->dirty_node );
+    free( spf->dirty_prefix );
+    free( spf->work );
+    free( spf->order );
+    free( spf->heap );
+    memset( spf, 0, sizeof(*spf) );
+}
+
+void spf_set_links( spf_t* spf, uint32_t rid,
+                    const lsdb_link_t* links, unsigned num_links ) {
+    const lsdb_link_t* ol;
+    const unsigned* op;
+    lsdb_link_t* nl;
+    unsigned* np;
+    spf_node_t* n;
+    spf_prefix_t* pf;
+    unsigned u, w, i, j, k, on;
+    uint32_t a;
+    bool gone;
+
+    nl = malloc_or_die( (num_links ? num_links : 1) * sizeof(*nl) );
+    memcpy( nl, links, num_links * sizeof(*nl) );
+    qsort( nl, num_links, sizeof(*nl), link_cmp );
+    np = malloc_or_die( (num_links ? num_links : 1) * sizeof(*np) );
+
+    /* create every node and prefix first since doing so may move the arrays;
+       a link the node already advertised keeps its prefix, so a new LSU
+       which changes one link costs one lookup rather than one per link */
+    u = node_get( spf, rid );
+    ol = spf->node[u].links;
+    op = spf->node[u].link_prefix;
+    on = spf->node[u].num_links;
+    for( i=j=0; j<num_links; j++ ) {
+        while( i < on && link_cmp( &ol[i], &nl[j] ) < 0 )
+            i++;
+        if( i < on && link_cmp( &ol[i], &nl[j] ) == 0 ) {
+            np[j] = op[i];
+            continue;
+        }
+        if( nl[j].router_id )
+            node_get( spf, nl[j].router_id );
+        np[j] = prefix_get( spf, nl[j].subnet & nl[j].mask, nl[j].mask );
+    }
+    n = &spf->node[u];
+
+    /* merge the old and new neighbor lists: a link to a neighbor which only
+       one of them has goes away or appears, if the neighbor links back */
+    i = j = 0;
+    while( i < n->num_links || j < num_links ) {
+        if( j == num_links
+            || (i < n->num_links && n->links[i].router_id < nl[j].router_id) ) {
+            a = n->links[i].router_id;
+            gone = TRUE;
+        }
+        else if( i == n->num_links || nl[j].router_id < n->links[i].router_id ) {
+            a = nl[j].router_id;
+            gone = FALSE;
+        }
+        else {
+            a = nl[j].router_id;
+            while( i < n->num_links && n->links[i].router_id == a ) i++;
+            while( j < num_links && nl[j].router_id == a ) j++;
+            continue;
+        }
+
+        if( gone )
+            while( i < n->num_links && n->links[i].router_id == a ) i++;
+        else
+            while( j < num_links && nl[j].router_id == a ) j++;
+
+        if( a == 0 || a == rid )
+            continue;
+        w = spf_lookup( spf, a );
+        if( !advertises( &spf->node[w], rid ) )
+            continue;
+
+        if( gone )
+            edge_remove( spf, u, w );
+        else
+            edge_add( spf, u, w );
+    }
+
+    /* move the node's prefixes */
+    n = &spf->node[u];
+    for( i=0; i<n->num_links; i++ ) {
+        pf = &spf->prefix[n->link_prefix[i]];
+        for( k=0; k<pf->num_adv; k++ ) {
+            if( pf->adv[k] == u ) {
+                pf->adv[k] = pf->adv[--pf->num_adv];
+                break;
+            }
+        }
+        prefix_mark_dirty( spf, n->link_prefix[i] );
+    }
+    for( i=0; i<num_links; i++ ) {
+        pf = &spf->prefix[np[i]];
+        for( k=0; k<pf->num_adv && pf->adv[k] != u; k++ );
+        if( k == pf->num_adv )
+            SPF_PUSH( pf->adv, pf->num_adv, pf->max_adv, u );
+        prefix_mark_dirty( spf, np[i] );
+    }
+
+    free( n->links );
+    free( n->link_prefix );
+    n->links = nl;
+    n->link_prefix = np;
+    n->num_links = num_links;
+}
+
+void spf_remove_router( spf_t* spf, uint32_t rid ) {
+    if( spf_lookup( spf, rid ) != SPF_NONE )
+        spf_set_links( spf, rid, NULL, 0 );
+}
+
+/** Queues v to have its first hops recomputed. */
+static void hops_queue( spf_t* spf, unsigned v ) {
+    if( !spf->node[v].queued ) {
+        spf->node[v].queued = TRUE;
+        heap_push( spf, spf->node[v].dist, v );
+    }
+}
+
+/** Queues v and each of its neighbors. */
+static void hops_queue_around( spf_t* spf, unsigned v ) {
+    unsigned j;
+
+    hops_queue( spf, v );
+    for( j=0; j<spf->node[v].num_adj; j++ )
+        hops_queue( spf, spf->node[v].adj[j] );
+}
+
+unsigned spf_run( spf_t* spf ) {
+    spf_heap_entry_t e;
+    spf_node_t* n;
+    unsigned i, j, k, v, w, num_aff;
+    uint32_t best;
+    uint64_t hops;
+
+    if( !spf->num_cut && !spf->num_ins && !spf->num_del && !spf->num_dirty_node && !spf->num_dirty_prefix )
+        return 0;
+
+    spf->runs += 1;
+    spf->epoch += 1;
+
+    /* 1) every node below a deleted tree edge loses its path to the root */
+    spf->num_work = 0;
+    for( i=0; i<spf->num_cut; i++ ) {
+        v = spf->cut[i];
+        if( spf->node[v].mark == spf->epoch )
+            continue;
+        spf->node[v].mark = spf->epoch;
+        k = spf->num_work;
+        SPF_PUSH( spf->work, spf->num_work, spf->max_work, v );
+        for( ; k<spf->num_work; k++ ) {
+            for( w=spf->node[spf->work[k]].first_child; w!=SPF_NONE; w=spf->node[w].next_sibling ) {
+                if( spf->node[w].mark != spf->epoch ) {
+                    spf->node[w].mark = spf->epoch;
+                    SPF_PUSH( spf->work, spf->num_work, spf->max_work, w );
+                }
+            }
+        }
+    }
+    num_aff = spf->num_work;
+    for( i=0; i<num_aff; i++ ) {
+        n = &spf->node[spf->work[i]];
+        tree_unlink( spf, spf->work[i] );
+        n->dist = SPF_INFINITY;
+        node_mark_dirty( spf, spf->work[i] );
+    }
+
+    /* 2) seed the affected nodes from their neighbors outside the affected
+          set, and the endpoints of new edges from each other */
+    spf->num_heap = 0;
+    for( i=0; i<num_aff; i++ ) {
+        v = spf->work[i];
+        n = &spf->node[v];
+        best = SPF_INFINITY;
+        k = SPF_NONE;
+        for( j=0; j<n->num_adj; j++ ) {
+            w = n->adj[j];
+            if( spf->node[w].mark != spf->epoch && spf->node[w].dist < best ) {
+                best = spf->node[w].dist;
+                k = w;
+            }
+        }
+        if( k != SPF_NONE && best != SPF_INFINITY ) {
+            n->dist = best + 1;
+            tree_link( spf, v, k );
+            heap_push( spf, n->dist, v );
+        }
+    }
+    for( i=0; i+1<spf->num_ins; i+=2 ) {
+        relax( spf, spf->ins[i], spf->ins[i+1] );
+        relax( spf, spf->ins[i+1], spf->ins[i] );
+    }
+
+    /* 3) Dijkstra over just the nodes whose distance can change */
+    spf->num_order = 0;
+    while( spf->num_heap ) {
+        e = heap_pop( spf );
+        if( e.dist != spf->node[e.node].dist )
+            continue; /* superseded */
+
+        SPF_PUSH( spf->order, spf->num_order, spf->max_order, e.node );
+        node_mark_dirty( spf, e.node );
+        n = &spf->node[e.node];
+        for( j=0; j<n->num_adj; j++ ) {
+            relax( spf, e.node, n->adj[j] );
+            n = &spf->node[e.node];
+        }
+    }
+    spf->nodes_touched += spf->num_order;
+
+    /* 4) first hops, closest nodes first so that a node's neighbors one hop
+          closer are always done; starts from the nodes whose distance or
+          edges changed and spreads only while the hops keep changing */
+    for( i=0; i<num_aff; i++ )
+        hops_queue_around( spf, spf->work[i] );
+    for( i=0; i<spf->num_order; i++ )
+        hops_queue_around( spf, spf->order[i] );
+    for( i=0; i<spf->num_ins; i++ )
+        hops_queue( spf, spf->ins[i] );
+    for( i=0; i<spf->num_del; i++ )
+        hops_queue( spf, spf->del[i] );
+    while( spf->num_heap ) {
+        v = heap_pop( spf ).node;
+        n = &spf->node[v];
+        n->queued = FALSE;
+        hops = node_hops( spf, v );
+        if( hops == n->hops )
+            continue;
+
+        n->hops = hops;
+        node_mark_dirty( spf, v );
+        for( j=0; j<n->num_adj; j++ ) {
+            w = n->adj[j];
+            if( spf->node[w].dist != SPF_INFINITY && spf->node[w].dist == n->dist + 1 )
+                hops_queue( spf, w );
+        }
+    }
+
+    spf->num_cut = 0;
+    spf->num_ins = 0;
+    spf->num_del = 0;
+    return spf_update_routes( spf );
+}
+
+unsigned spf_full( spf_t* spf ) {
+    spf_node_t* n;
+    unsigned i, j, v, w;
+
+    spf->full_runs += 1;
+
+    for( i=0; i<spf->num_nodes; i++ ) {
+        n = &spf->node[i];
+        n->dist = SPF_INFINITY;
+        n->hops = 0;
+        n->parent = n->first_child = n->next_sibling = n->prev_sibling = SPF_NONE;
+    }
+
+    /* breadth first, since every link costs the same */
+    spf->node[spf->root].dist = 0;
+    spf->num_work = 0;
+    SPF_PUSH( spf->work, spf->num_work, spf->max_work, spf->root );
+    for( i=0; i<spf->num_work; i++ ) {
+        v = spf->work[i];
+        for( j=0; j<spf->node[v].num_adj; j++ ) {
+            w = spf->node[v].adj[j];
+            if( spf->node[w].dist != SPF_INFINITY )
+                continue;
+
+            spf->node[w].dist = spf->node[v].dist + 1;
+            tree_link( spf, w, v );
+            SPF_PUSH( spf->work, spf->num_work, spf->max_work, w );
+        }
+    }
+    spf->nodes_touched += spf->num_work;
+
+    /* in order of distance, so a node's neighbors one hop closer are done */
+    for( i=0; i<spf->num_work; i++ )
+        spf->node[spf->work[i]].hops = node_hops( spf, spf->work[i] );
+
+    spf->num_cut = 0;
+    spf->num_ins = 0;
+    spf->num_del = 0;
+    for( i=0; i<spf->num_dirty_node; i++ )
+        spf->node[spf->dirty_node[i]].dirty = FALSE;
+    spf->num_dirty_node = 0;
+    for( i=0; i<spf->num_prefixes; i++ )
+        prefix_mark_dirty( spf, i );
+
+    return spf_update_routes( spf );
+}
+
+bool spf_check( spf_t* spf ) {
+    spf_prefix_t* pf;
+    spf_node_t *n, *p;
+    spf_route_t r;
+    unsigned i, j;
+
+    for( i=0; i<spf->num_nodes; i++ ) {
+        n = &spf->node[i];
+        if( n->hops != node_hops( spf, i ) )
+            return FALSE;
+        if( n->slot != SPF_NONE && spf->slot_node[n->slot] != i )
+            return FALSE;
+
+        /* no neighbor offers a shorter path */
+        for( j=0; j<n->num_adj; j++ ) {
+            p = &spf->node[n->adj[j]];
+            if( p->dist != SPF_INFINITY && p->dist + 1 < n->dist )
+                return FALSE;
+        }
+
+        if( i == spf->root || n->dist == SPF_INFINITY ) {
+            if( n->parent != SPF_NONE )
+                return FALSE;
+            continue;
+        }
+
+        /* the parent is a neighbor one hop closer */
+        if( n->parent == SPF_NONE )
+            return FALSE;
+        p = &spf->node[n->parent];
+        for( j=0; j<n->num_adj && n->adj[j] != n->parent; j++ );
+        if( j == n->num_adj || p->dist + 1 != n->dist )
+            return FALSE;
+    }
+
+    for( i=0; i<spf->num_prefixes; i++ ) {
+        pf = &spf->prefix[i];
+        if( !route_make( spf, pf, &r ) ) {
+            if( pf->has_route )
+                return FALSE;
+            continue;
+        }
+        if( !pf->has_route || memcmp( &pf->route, &r, sizeof(r) ) != 0 )
+            return FALSE;
+    }
+
+    return TRUE;
+}
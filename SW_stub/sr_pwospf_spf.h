@@ -0,0 +1,189 @@
+/*
+ * Filename: sr_pwospf_spf.h
+ * Purpose: Incremental shortest path first computation for PWOSPF.
+ *
+ * The topology is kept as a graph of routers joined by two-way links (a link
+ * is only used if both ends advertise each other, as PWOSPF requires) with a
+ * shortest path tree rooted at this router.  Every link costs one hop.
+ *
+ * Changes to routers' links are recorded as edge insertions and deletions and
+ * applied by spf_run(), which only recomputes the part of the tree they
+ * affect: a deleted tree edge detaches the subtree below it, which is then
+ * rebuilt from its boundary with the rest of the tree, and an inserted edge
+ * only propagates outward from the nodes it brings closer.  Only the prefixes
+ * advertised by routers whose distance or first hops changed are re-evaluated,
+ * and only prefixes whose route actually changed are passed to the route
+ * callback.  spf_full() recomputes everything from scratch and is kept as the
+ * reference implementation.
+ *
+ * Every equal-cost path is kept, not just the one along the tree: each router
+ * has the set of the root's neighbors its shortest paths start at (a bitmap of
+ * slots, one per neighbor of the root), which is the union of the sets of its
+ * neighbors one hop closer.  A route lists the first hops of every shortest
+ * path to each closest advertiser of the prefix, so the FIB can spread flows
+ * over them.  Only the first SPF_MAX_SLOTS neighbors of the root get a slot.
+ *
+ * Not thread-safe; the router serializes access with its ospf_lock.
+ */
+
+#ifndef SR_PWOSPF_SPF_H
+#define SR_PWOSPF_SPF_H
+
+#include "sr_common.h"
+#include "sr_pwospf_lsdb.h"
+
+/** distance of an unreachable router */
+#define SPF_INFINITY 0xFFFFFFFF
+
+/** an invalid node index */
+#define SPF_NONE 0xFFFFFFFF
+
+/** max neighbors of the root paths can start at (bits in spf_node_t.hops) */
+#define SPF_MAX_SLOTS 64
+
+/** max first hops of a route */
+#define SPF_MAX_ECMP 8
+
+/** the route chosen for a prefix */
+typedef struct spf_route_t {
+    uint32_t via;           /* closest router advertising the prefix (the root if
+                               direct); ties go to the lowest router ID */
+    uint32_t dist;          /* hops from the root to via */
+    unsigned num_hops;      /* 0 if direct */
+    uint32_t first_hop[SPF_MAX_ECMP]; /* root's neighbors the equal-cost paths
+                                         start at, ascending; unused ones are 0 */
+} spf_route_t;
+
+/** called for each prefix whose route changed; route is NULL if withdrawn */
+typedef void (*spf_route_cb)( void* arg, addr_ip_t subnet, addr_ip_t mask,
+                              const spf_route_t* route );
+
+/** a router in the topology */
+typedef struct spf_node_t {
+    uint32_t     rid;
+    lsdb_link_t* links;         /* as advertised, sorted by neighbor */
+    unsigned*    link_prefix;   /* prefix index of each link */
+    unsigned     num_links;
+    unsigned*    adj;           /* nodes with a two-way link to this one */
+    unsigned     num_adj, max_adj;
+
+    /* shortest path tree */
+    uint32_t dist;
+    uint64_t hops;              /* slots of the first hops of all shortest paths */
+    unsigned slot;              /* if a neighbor of the root, else SPF_NONE */
+    unsigned parent, first_child, next_sibling, prev_sibling;
+
+    uint32_t mark;              /* == spf_t.epoch if in the affected set */
+    bool     queued;            /* waiting for its hops to be recomputed */
+    bool     dirty;             /* prefixes need re-evaluating */
+} spf_node_t;
+
+/** a prefix and the routers advertising it */
+typedef struct spf_prefix_t {
+    addr_ip_t   subnet, mask;
+    unsigned*   adv;
+    unsigned    num_adv, max_adv;
+    bool        dirty;
+    bool        has_route;
+    spf_route_t route;
+} spf_prefix_t;
+
+/** a (distance, node) pair in the SPF priority queue */
+typedef struct spf_heap_entry_t {
+    uint32_t dist;
+    unsigned node;
+} spf_heap_entry_t;
+
+/** the SPF state */
+typedef struct spf_t {
+    spf_node_t*   node;
+    unsigned      num_nodes, max_nodes;
+    unsigned*     node_hash;        /* open addressing: node index + 1 */
+    unsigned      node_hash_size;
+    spf_prefix_t* prefix;
+    unsigned      num_prefixes, max_prefixes;
+    unsigned*     prefix_hash;      /* open addressing: prefix index + 1 */
+    unsigned      prefix_hash_size;
+    unsigned      root;
+    unsigned      slot_node[SPF_MAX_SLOTS]; /* neighbor of the root in each slot */
+
+    spf_route_cb  cb;
+    void*         cb_arg;
+
+    /* changes pending for the next run */
+    unsigned* cut;                  /* nodes whose tree edge was deleted */
+    unsigned  num_cut, max_cut;
+    unsigned* ins;                  /* pairs of nodes joined by a new edge */
+    unsigned  num_ins, max_ins;
+    unsigned* del;                  /* pairs of nodes whose edge was deleted */
+    unsigned  num_del, max_del;
+    unsigned* dirty_node;
+    unsigned  num_dirty_node, max_dirty_node;
+    unsigned* dirty_prefix;
+    unsigned  num_dirty_prefix, max_dirty_prefix;
+
+    /* scratch space */
+    uint32_t          epoch;
+    unsigned*         work;
+    unsigned          num_work, max_work;
+    unsigned*         order;
+    unsigned          num_order, max_order;
+    spf_heap_entry_t* heap;
+    unsigned          num_heap, max_heap;
+
+    /* statistics */
+    uint64_t runs;                  /* incremental runs */
+    uint64_t full_runs;
+    uint64_t nodes_touched;         /* nodes whose tree position was recomputed */
+    uint64_t routes_changed;        /* route callbacks made */
+} spf_t;
+
+/**
+ * Initializes the topology with only the root router.  cb (optional) is called
+ * by spf_run() and spf_full() for each route which changes.
+ */
+void spf_init( spf_t* spf, uint32_t root_rid, spf_route_cb cb, void* cb_arg );
+
+/**
+ * Makes router rid the root of the tree (e.g. once the router ID is known) and
+ * recomputes everything.
+ */
+void spf_set_root( spf_t* spf, uint32_t rid );
+
+/** Frees everything spf holds. */
+void spf_destroy( spf_t* spf );
+
+/**
+ * Replaces the links advertised by router rid (e.g. with an LSDB entry's).
+ * Takes effect at the next spf_run() or spf_full().
+ */
+void spf_set_links( spf_t* spf, uint32_t rid,
+                    const lsdb_link_t* links, unsigned num_links );
+
+/** Removes everything router rid advertised (e.g. its LSDB entry expired). */
+void spf_remove_router( spf_t* spf, uint32_t rid );
+
+/**
+ * Applies the pending changes incrementally.
+ *
+ * @return number of routes which changed
+ */
+unsigned spf_run( spf_t* spf );
+
+/**
+ * Recomputes the whole tree and every route from scratch.
+ *
+ * @return number of routes which changed
+ */
+unsigned spf_full( spf_t* spf );
+
+/** Returns the index of router rid's node, or SPF_NONE if it is unknown. */
+unsigned spf_lookup( spf_t* spf, uint32_t rid );
+
+/**
+ * Checks that the tree is a valid shortest path tree and that every router's
+ * first hops and every route agree with it.  Used by the tests.
+ */
+bool spf_check( spf_t* spf );
+
+#endif /* SR_PWOSPF_SPF_H */
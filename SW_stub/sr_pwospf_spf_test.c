@@ -0,0 +1,453 @@
+/*
+ * Filename: sr_pwospf_spf_test.c
+ * Purpose: Checks and benchmarks incremental SPF against full recomputation.
+ *
+ * Builds synthetic topologies (a ring of routers plus random chords, each
+ * router also advertising a stub subnet) of 10, 100 and 1000 routers, installs
+ * every router's links through the LSDB, and then flaps random links.  After
+ * each change the affected routers re-originate, one SPF instance converges
+ * with spf_run() and a second with spf_full(); the two must agree on every
+ * distance and route, and the incremental tree must pass spf_check().  The
+ * average convergence time, nodes recomputed and routes changed per flap are
+ * reported for both.
+ *
+ * Then an LSU storm is replayed against router r0 of the thames topology (see
+ * sr_topologies/thames.py): two of its links flap repeatedly, every change is
+ * flooded to r0 as an LSU from each end of the link, and each LSU reaches r0
+ * once per neighbor after a random delay.  One copy of r0 runs SPF for every
+ * LSU which changes its LSDB; another schedules runs with the SPF hold-down
+ * timer.  Both must end up with the same routes; the SPF runs per LSU received
+ * are reported for each.
+ *
+ * Usage: test_spf [-f flaps] [-s seed]
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "sr_pwospf.h"
+#include "sr_pwospf_lsdb.h"
+#include "sr_pwospf_spf.h"
+#include "sr_pwospf_throttle.h"
+
+/** a link between two synthetic routers */
+typedef struct edge_t {
+    unsigned a, b;
+    bool up;
+} edge_t;
+
+/** a synthetic topology */
+typedef struct topo_t {
+    unsigned num_routers;
+    edge_t* edge;
+    unsigned num_edges;
+    uint16_t* seq;
+    lsdb_t lsdb;
+} topo_t;
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rid_of( unsigned i ) {
+    return htonl( 0x01000000 + i + 1 );
+}
+
+static void count_route( void* arg, addr_ip_t subnet, addr_ip_t mask,
+                         const spf_route_t* route ) {
+    *(unsigned long*)arg += 1;
+}
+
+static bool has_edge( topo_t* t, unsigned a, unsigned b ) {
+    unsigned i;
+
+    for( i=0; i<t->num_edges; i++ )
+        if( (t->edge[i].a == a && t->edge[i].b == b)
+            || (t->edge[i].a == b && t->edge[i].b == a) )
+            return TRUE;
+
+    return FALSE;
+}
+
+static void topo_init( topo_t* t, unsigned n ) {
+    unsigned i, a, b, num_chords = n / 2;
+
+    t->num_routers = n;
+    t->edge = malloc_or_die( (n + num_chords) * sizeof(*t->edge) );
+    t->num_edges = 0;
+    t->seq = calloc_or_die( n, sizeof(*t->seq) );
+    lsdb_init( &t->lsdb );
+
+    for( i=0; i<n; i++ ) {
+        t->edge[t->num_edges].a = i;
+        t->edge[t->num_edges].b = (i + 1) % n;
+        t->edge[t->num_edges].up = TRUE;
+        t->num_edges += 1;
+    }
+    for( i=0; i<num_chords; i++ ) {
+        do {
+            a = rand() % n;
+            b = rand() % n;
+        } while( a == b || has_edge( t, a, b ) );
+        t->edge[t->num_edges].a = a;
+        t->edge[t->num_edges].b = b;
+        t->edge[t->num_edges].up = TRUE;
+        t->num_edges += 1;
+    }
+}
+
+static void topo_destroy( topo_t* t ) {
+    lsdb_destroy( &t->lsdb );
+    free( t->edge );
+    free( t->seq );
+}
+
+/**
+ * Has router r originate an LSU for its current links, installs it in the
+ * LSDB, and passes the resulting entry to each SPF instance.
+ */
+static void originate( topo_t* t, unsigned r, spf_t** spf, unsigned num_spf ) {
+    lsdb_link_t links[64];
+    lsdb_entry_t* e;
+    unsigned i, n = 0;
+
+    for( i=0; i<t->num_edges && n < 63; i++ ) {
+        if( !t->edge[i].up || (t->edge[i].a != r && t->edge[i].b != r) )
+            continue;
+        links[n].subnet = htonl( 0x0a000000 | (i << 8) );
+        links[n].mask = htonl( 0xFFFFFF00 );
+        links[n].router_id = rid_of( t->edge[i].a == r ? t->edge[i].b : t->edge[i].a );
+        n += 1;
+    }
+    links[n].subnet = htonl( 0xac000000 | (r << 8) );
+    links[n].mask = htonl( 0xFFFFFF00 );
+    links[n].router_id = 0;
+    n += 1;
+
+    t->seq[r] += 1;
+    true_or_die( lsdb_update( &t->lsdb, rid_of(r), t->seq[r], links, n, 0, NULL, NULL )
+                 == LSDB_CHANGED, "Error: LSU was not installed" );
+    e = lsdb_find( &t->lsdb, rid_of(r) );
+    for( i=0; i<num_spf; i++ )
+        spf_set_links( spf[i], e->router_id, e->links, e->num_links );
+}
+
+/**
+ * Returns the number of distances and routes (including their first hops) on
+ * which inc and full differ.
+ */
+static unsigned compare( spf_t* inc, spf_t* full ) {
+    spf_prefix_t *p, *q;
+    unsigned i, v, bad = 0;
+
+    for( i=0; i<full->num_nodes; i++ ) {
+        v = spf_lookup( inc, full->node[i].rid );
+        if( v == SPF_NONE || inc->node[v].dist != full->node[i].dist )
+            bad += 1;
+    }
+
+    /* both instances were given the same links in the same order */
+    for( i=0; i<full->num_prefixes; i++ ) {
+        p = &inc->prefix[i];
+        q = &full->prefix[i];
+        if( p->subnet != q->subnet || p->has_route != q->has_route )
+            bad += 1;
+        else if( q->has_route && memcmp( &p->route, &q->route, sizeof(p->route) ) != 0 )
+            bad += 1;
+    }
+
+    return bad + !spf_check( inc );
+}
+
+/** Applies one change to edge e in both instances and times convergence. */
+static unsigned step( topo_t* t, unsigned e, spf_t* inc, spf_t* full,
+                      uint64_t* inc_ns, uint64_t* full_ns ) {
+    spf_t* both[2];
+    uint64_t start;
+
+    both[0] = inc;
+    both[1] = full;
+    t->edge[e].up = !t->edge[e].up;
+    originate( t, t->edge[e].a, both, 2 );
+    originate( t, t->edge[e].b, both, 2 );
+
+    start = now_nsec();
+    spf_run( inc );
+    *inc_ns += now_nsec() - start;
+
+    start = now_nsec();
+    spf_full( full );
+    *full_ns += now_nsec() - start;
+
+    return compare( inc, full );
+}
+
+/** @return number of mismatches found */
+static unsigned run( unsigned n, unsigned flaps ) {
+    unsigned long inc_routes = 0, full_routes = 0;
+    uint64_t inc_ns = 0, full_ns = 0, inc_touched, full_touched;
+    spf_t inc, full;
+    spf_t* both[2];
+    unsigned i, e, bad;
+    topo_t t;
+
+    topo_init( &t, n );
+    spf_init( &inc, rid_of(0), count_route, &inc_routes );
+    spf_init( &full, rid_of(0), count_route, &full_routes );
+    both[0] = &inc;
+    both[1] = &full;
+
+    for( i=0; i<n; i++ )
+        originate( &t, i, both, 2 );
+    spf_run( &inc );
+    spf_full( &full );
+    bad = compare( &inc, &full );
+
+    inc_routes = full_routes = 0;
+    inc_touched = inc.nodes_touched;
+    full_touched = full.nodes_touched;
+    for( i=0; i<flaps; i++ ) {
+        e = rand() % t.num_edges;
+        bad += step( &t, e, &inc, &full, &inc_ns, &full_ns );  /* down */
+        bad += step( &t, e, &inc, &full, &inc_ns, &full_ns );  /* up */
+    }
+    inc_touched = inc.nodes_touched - inc_touched;
+    full_touched = full.nodes_touched - full_touched;
+
+    /* a router going away entirely */
+    spf_remove_router( &inc, rid_of(n / 2) );
+    spf_remove_router( &full, rid_of(n / 2) );
+    spf_run( &inc );
+    spf_full( &full );
+    bad += compare( &inc, &full );
+
+    printf( "  %4u routers %4u links: incremental %8.2f us %7.1f nodes %6.1f routes"
+            "  full %8.2f us %7.1f nodes %6.1f routes  %u mismatches\n",
+            n, t.num_edges,
+            inc_ns / 1000.0 / (2 * flaps), (double)inc_touched / (2 * flaps),
+            (double)inc_routes / (2 * flaps),
+            full_ns / 1000.0 / (2 * flaps), (double)full_touched / (2 * flaps),
+            (double)full_routes / (2 * flaps), bad );
+
+    spf_destroy( &inc );
+    spf_destroy( &full );
+    topo_destroy( &t );
+    return bad;
+}
+
+/** thames router IDs are the IP of eth0 */
+static const uint32_t thames_rid[] = {
+    0x0a000101, 0x0a000202, 0x0a000302, 0x0a000402, 0x0a000502,
+    0x0a000602, 0x0a000702, 0x0a000802, 0x0a000902, 0x0a000a02
+};
+#define THAMES_ROUTERS (sizeof(thames_rid)/sizeof(thames_rid[0]))
+
+/** thames router to router links: 10.0.subnet.0/24 joins a and b */
+static const struct { unsigned subnet, a, b; } thames_link[] = {
+    { 2, 0, 1 }, { 3, 0, 2 }, { 4, 1, 3 }, { 5, 3, 4 }, { 6, 4, 5 },
+    { 7, 5, 6 }, { 8, 6, 7 }, { 9, 7, 8 }, { 10, 8, 9 }, { 11, 9, 2 }
+};
+#define THAMES_LINKS (sizeof(thames_link)/sizeof(thames_link[0]))
+
+/** an LSU on its way to r0 */
+typedef struct lsu_event_t {
+    uint64_t arrival_ms;
+    unsigned len;
+    byte pkt[sizeof(pwospf_hdr_t) + sizeof(pwospf_lsu_t) + 4 * sizeof(pwospf_lsa_t)];
+} lsu_event_t;
+
+/** a copy of r0 receiving the storm */
+typedef struct observer_t {
+    lsdb_t lsdb;
+    spf_t spf;
+    unsigned long lsus;
+    unsigned long changes;
+} observer_t;
+
+static int event_cmp( const void* va, const void* vb ) {
+    const lsu_event_t* a = (const lsu_event_t*)va;
+    const lsu_event_t* b = (const lsu_event_t*)vb;
+
+    if( a->arrival_ms != b->arrival_ms )
+        return a->arrival_ms < b->arrival_ms ? -1 : 1;
+    return a < b ? -1 : 1;
+}
+
+/** Builds the LSU thames router r originates given which links are up. */
+static unsigned thames_lsu( byte* pkt, unsigned r, uint16_t seq, const bool* up ) {
+    pwospf_hdr_t* hdr = (pwospf_hdr_t*)pkt;
+    pwospf_lsu_t* lsu = (pwospf_lsu_t*)(hdr + 1);
+    pwospf_lsa_t* lsa = (pwospf_lsa_t*)(lsu + 1);
+    unsigned i, n = 0;
+
+    memset( hdr, 0, sizeof(*hdr) );
+    hdr->version = PWOSPF_VERSION;
+    hdr->type = PWOSPF_TYPE_LSU;
+    hdr->router_id = htonl( thames_rid[r] );
+
+    /* the stub subnet of r's host: 10.0.1.0 for r0, else 10.0.(11+r).0 */
+    lsa[n].subnet = htonl( 0x0a000000 | ((r ? 11 + r : 1) << 8) );
+    lsa[n].mask = htonl( 0xFFFFFF00 );
+    lsa[n].router_id = 0;
+    n += 1;
+    for( i=0; i<THAMES_LINKS; i++ ) {
+        if( thames_link[i].a != r && thames_link[i].b != r )
+            continue;
+        lsa[n].subnet = htonl( 0x0a000000 | (thames_link[i].subnet << 8) );
+        lsa[n].mask = htonl( 0xFFFFFF00 );
+        lsa[n].router_id = !up[i] ? 0 : htonl( thames_rid[thames_link[i].a == r
+                                                          ? thames_link[i].b
+                                                          : thames_link[i].a] );
+        n += 1;
+    }
+
+    lsu->seq = htons( seq );
+    lsu->ttl = htons( PWOSPF_LSU_TTL );
+    lsu->num_adv = htonl( n );
+    hdr->len = htons( sizeof(*hdr) + sizeof(*lsu) + n * sizeof(*lsa) );
+    return ntohs( hdr->len );
+}
+
+/**
+ * Delivers an LSU to o.  If it changes the LSDB, the new links are given to
+ * SPF.
+ *
+ * @return TRUE if the topology changed
+ */
+static bool observer_input( observer_t* o, const lsu_event_t* ev, uint64_t now_ms ) {
+    lsdb_entry_t* e;
+
+    o->lsus += 1;
+    if( lsdb_lsu_input( &o->lsdb, ev->pkt, ev->len, now_ms, NULL, NULL ) != LSDB_CHANGED )
+        return FALSE;
+
+    e = lsdb_find( &o->lsdb, ((const pwospf_hdr_t*)ev->pkt)->router_id );
+    spf_set_links( &o->spf, e->router_id, e->links, e->num_links );
+    o->changes += 1;
+    return TRUE;
+}
+
+/** @return number of mismatches found */
+static unsigned storm( unsigned flaps ) {
+    static const unsigned flapping[2] = { 4, 7 };   /* r4-r5 and r7-r8 */
+    static const unsigned period_ms[2] = { 40, 70 };
+    bool up[THAMES_LINKS];
+    uint16_t seq[THAMES_ROUTERS];
+    lsu_event_t* ev;
+    unsigned num_ev = 0, max_ev, i, j, k, r, bad;
+    unsigned long eager_runs = 0;
+    observer_t eager, held;
+    spf_throttle_t throttle;
+    uint64_t t, end_ms, last_run_ms = 0;
+
+    for( i=0; i<THAMES_LINKS; i++ )
+        up[i] = TRUE;
+    for( i=0; i<THAMES_ROUTERS; i++ )
+        seq[i] = 0;
+    max_ev = 2 * THAMES_ROUTERS + 2 * 2 * 2 * flaps;
+    ev = malloc_or_die( max_ev * sizeof(*ev) );
+
+    /* every router's initial LSU reaches r0 over both of its ring directions */
+    for( r=0; r<THAMES_ROUTERS; r++ ) {
+        for( k=0; k<2; k++ ) {
+            ev[num_ev].len = thames_lsu( ev[num_ev].pkt, r, seq[r], up );
+            ev[num_ev].arrival_ms = 1 + rand() % 20;
+            num_ev += 1;
+        }
+        seq[r] += 1;
+    }
+
+    /* each flap makes both ends re-originate */
+    for( i=0; i<flaps; i++ ) {
+        for( j=0; j<2; j++ ) {
+            t = 1000 + i * period_ms[j];
+            up[flapping[j]] = !up[flapping[j]];
+            for( r=0; r<THAMES_ROUTERS; r++ ) {
+                if( r != thames_link[flapping[j]].a && r != thames_link[flapping[j]].b )
+                    continue;
+                for( k=0; k<2; k++ ) {
+                    ev[num_ev].len = thames_lsu( ev[num_ev].pkt, r, seq[r], up );
+                    ev[num_ev].arrival_ms = t + 1 + rand() % 20;
+                    num_ev += 1;
+                }
+                seq[r] += 1;
+            }
+        }
+    }
+    qsort( ev, num_ev, sizeof(*ev), event_cmp );
+
+    lsdb_init( &eager.lsdb );
+    lsdb_init( &held.lsdb );
+    spf_init( &eager.spf, htonl( thames_rid[0] ), NULL, NULL );
+    spf_init( &held.spf, htonl( thames_rid[0] ), NULL, NULL );
+    eager.lsus = eager.changes = held.lsus = held.changes = 0;
+    spf_throttle_init( &throttle, SPF_THROTTLE_INITIAL_MS,
+                       SPF_THROTTLE_INCR_MS, SPF_THROTTLE_MAX_MS );
+
+    /* virtual time, a millisecond at a time */
+    end_ms = ev[num_ev - 1].arrival_ms + 2 * SPF_THROTTLE_MAX_MS;
+    for( t=0, i=0; t<=end_ms; t++ ) {
+        for( ; i<num_ev && ev[i].arrival_ms == t; i++ ) {
+            if( observer_input( &eager, &ev[i], t ) ) {
+                spf_run( &eager.spf );
+                eager_runs += 1;
+            }
+            if( observer_input( &held, &ev[i], t ) )
+                spf_throttle_change( &throttle, t );
+        }
+
+        if( spf_throttle_due( &throttle, t ) ) {
+            spf_run( &held.spf );
+            spf_throttle_ran( &throttle, t );
+            last_run_ms = t;
+        }
+    }
+
+    bad = compare( &held.spf, &eager.spf ) + throttle.pending;
+    printf( "  storm: %lu LSUs, %lu changed the LSDB; SPF eager: %lu runs"
+            " (%.3f per LSU); held down: %llu runs (%.3f per LSU, up to %u changes"
+            " per run); converged %llu ms after the last LSU  %u mismatches\n",
+            held.lsus, held.changes, eager_runs, (double)eager_runs / eager.lsus,
+            (unsigned long long)throttle.runs, (double)throttle.runs / held.lsus,
+            throttle.max_batch,
+            (unsigned long long)(last_run_ms - ev[num_ev - 1].arrival_ms), bad );
+
+    spf_destroy( &eager.spf );
+    spf_destroy( &held.spf );
+    lsdb_destroy( &eager.lsdb );
+    lsdb_destroy( &held.lsdb );
+    free( ev );
+    return bad;
+}
+
+int main( int argc, char** argv ) {
+    static const unsigned sizes[] = { 10, 100, 1000 };
+    unsigned flaps = 200, seed = 1, failures = 0, i;
+    int c;
+
+    while( (c = getopt( argc, argv, "f:s:" )) != EOF ) {
+        switch( c ) {
+        case 'f': flaps = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-f flaps] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( flaps > 0, "Error: need at least one flap" );
+    srand( seed );
+
+    printf( "%u link flaps (down and up) per topology, times are per change\n", flaps );
+    for( i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++ )
+        failures += run( sizes[i], flaps );
+    failures += storm( flaps );
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
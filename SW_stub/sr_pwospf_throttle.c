@@ -0,0 +1,79 @@
+/* Filename: sr_pwospf_throttle.c */
+
+#include <string.h>
+#include "sr_pwospf_throttle.h"
+
+void spf_throttle_init( spf_throttle_t* t, uint32_t initial_ms,
+                        uint32_t incr_ms, uint32_t max_ms ) {
+    memset( t, 0, sizeof(*t) );
+    t->initial_ms = initial_ms ? initial_ms : SPF_THROTTLE_INITIAL_MS;
+    t->incr_ms = incr_ms ? incr_ms : SPF_THROTTLE_INCR_MS;
+    t->max_ms = max_ms ? max_ms : SPF_THROTTLE_MAX_MS;
+    if( t->max_ms < t->incr_ms )
+        t->max_ms = t->incr_ms;
+    t->hold_ms = t->incr_ms;
+}
+
+void spf_throttle_change( spf_throttle_t* t, uint64_t now_ms ) {
+    bool quiet = t->changes == 0 || now_ms - t->last_change_ms >= 2ULL * t->max_ms;
+
+    if( !t->pending ) {
+        if( quiet ) {
+            t->hold_ms = t->incr_ms;
+            t->due_ms = now_ms + t->initial_ms;
+        }
+        else {
+            /* held down since the last run; each run doubles the hold */
+            t->due_ms = t->last_run_ms + t->hold_ms;
+            if( t->due_ms < now_ms )
+                t->due_ms = now_ms;
+            t->hold_ms = t->hold_ms * 2 < t->max_ms ? t->hold_ms * 2 : t->max_ms;
+        }
+
+        t->pending = TRUE;
+        t->first_change_ms = now_ms;
+        t->batch = 0;
+    }
+
+    t->batch += 1;
+    t->changes += 1;
+    t->last_change_ms = now_ms;
+}
+
+bool spf_throttle_due( spf_throttle_t* t, uint64_t now_ms ) {
+    return t->pending && now_ms >= t->due_ms;
+}
+
+void spf_throttle_ran( spf_throttle_t* t, uint64_t now_ms ) {
+    if( !t->pending )
+        return;
+
+    t->runs += 1;
+    if( t->batch > t->max_batch )
+        t->max_batch = t->batch;
+    if( now_ms - t->first_change_ms > t->max_delay_ms )
+        t->max_delay_ms = now_ms - t->first_change_ms;
+
+    t->pending = FALSE;
+    t->last_run_ms = now_ms;
+}
+
+int64_t spf_throttle_timeout( spf_throttle_t* t, uint64_t now_ms ) {
+    if( !t->pending )
+        return -1;
+
+    return t->due_ms > now_ms ? (int64_t)(t->due_ms - now_ms) : 0;
+}
+
+int spf_throttle_to_string( spf_throttle_t* t, char* buf, int len ) {
+    return my_snprintf( buf, len,
+                        "SPF throttle: initial %ums, hold %ums, max %ums (current hold %ums%s)\n"
+                        "SPF runs: %llu for %llu changes (%.2f runs per change, up to %u per run, max delay %llums)\n",
+                        t->initial_ms, t->incr_ms, t->max_ms, t->hold_ms,
+                        t->pending ? ", run pending" : "",
+                        (unsigned long long)t->runs,
+                        (unsigned long long)t->changes,
+                        t->changes ? (double)t->runs / t->changes : 0.0,
+                        t->max_batch,
+                        (unsigned long long)t->max_delay_ms );
+}
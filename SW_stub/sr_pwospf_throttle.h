@@ -0,0 +1,83 @@
+/*
+ * Filename: sr_pwospf_throttle.h
+ * Purpose: SPF hold-down timer which coalesces bursts of LSDB changes.
+ *
+ * A single link flap makes both ends re-originate, and each of their LSUs
+ * reaches every router shortly after the other; a flapping link keeps doing so.
+ * Rather than running SPF (and pushing the results to the FIB) for each LSU,
+ * a change only schedules a run.  The first change after a quiet period runs
+ * SPF after initial_ms; further runs are held down for incr_ms, doubling each
+ * time up to max_ms.  Every change which arrives while a run is pending is
+ * folded into it.  Once no change has been seen for 2 * max_ms the hold time
+ * drops back to its initial value.
+ *
+ * All times are explicit, in milliseconds, so a simulation can drive the timer
+ * with virtual time.  Not thread-safe; the router serializes access with its
+ * ospf_lock.
+ */
+
+#ifndef SR_PWOSPF_THROTTLE_H
+#define SR_PWOSPF_THROTTLE_H
+
+#include "sr_common.h"
+
+/** default timer parameters */
+#define SPF_THROTTLE_INITIAL_MS 50
+#define SPF_THROTTLE_INCR_MS    200
+#define SPF_THROTTLE_MAX_MS     5000
+
+/** the SPF hold-down timer */
+typedef struct spf_throttle_t {
+    uint32_t initial_ms;    /* delay of the first run after a quiet period */
+    uint32_t incr_ms;       /* hold time after that first run */
+    uint32_t max_ms;        /* limit the hold time doubles up to */
+
+    uint32_t hold_ms;       /* minimum time from the last run to the next */
+    bool     pending;       /* a run is scheduled */
+    uint64_t due_ms;        /* when the pending run is due */
+    uint64_t first_change_ms; /* first change folded into the pending run */
+    uint64_t last_run_ms;
+    uint64_t last_change_ms;
+    unsigned batch;         /* changes folded into the pending run */
+
+    /* statistics */
+    uint64_t changes;       /* changes reported */
+    uint64_t runs;          /* runs those were coalesced into */
+    unsigned max_batch;     /* most changes handled by one run */
+    uint64_t max_delay_ms;  /* longest a change waited for its run */
+} spf_throttle_t;
+
+/**
+ * Initializes the timer.  Zero parameters select the SPF_THROTTLE_*_MS
+ * defaults.
+ */
+void spf_throttle_init( spf_throttle_t* t, uint32_t initial_ms,
+                        uint32_t incr_ms, uint32_t max_ms );
+
+/** Notes a topology change at now_ms, scheduling a run if none is pending. */
+void spf_throttle_change( spf_throttle_t* t, uint64_t now_ms );
+
+/** Returns TRUE if a run is pending and due at now_ms. */
+bool spf_throttle_due( spf_throttle_t* t, uint64_t now_ms );
+
+/** Notes that the pending run was made at now_ms. */
+void spf_throttle_ran( spf_throttle_t* t, uint64_t now_ms );
+
+/**
+ * Returns the number of milliseconds from now_ms until the pending run is due
+ * (0 if overdue), or -1 if no run is pending.
+ */
+int64_t spf_throttle_timeout( spf_throttle_t* t, uint64_t now_ms );
+
+/** max length of the string made by spf_throttle_to_string() */
+#define STR_SPF_THROTTLE_MAX_LEN 256
+
+/**
+ * Fills buf with the timer parameters and statistics.  It takes up to
+ * STR_SPF_THROTTLE_MAX_LEN characters.
+ *
+ * @return number of bytes written, or 0 if there was not enough space in buf
+ */
+int spf_throttle_to_string( spf_throttle_t* t, char* buf, int len );
+
+#endif /* SR_PWOSPF_THROTTLE_H */
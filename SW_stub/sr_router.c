@@ -1,6 +1,7 @@
 /* Filename: sr_router.c */
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,10 +9,396 @@
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <net/ethernet.h>
+#include <netinet/if_ether.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
 #include "common/nf10util.h"
 #include "sr_cpu_extension_nf2.h"
+#include "sr_pwospf.h"
 #include "sr_router.h"
+#include "sr_base_internal.h"
+#include "sr_integration.h"
 
+/**
+ * UDP source port of BFD control packets, from the range RFC 5881 requires;
+ * sessions are told apart by their discriminators, so one port serves them all
+ */
+#define ROUTER_BFD_SRC_PORT 49152
+
+/** how often the snapshot is saved if the topology changed */
+#define ROUTER_SNAPSHOT_MS 1000
+
+/** how often the LSDB is checked for entries which were not refreshed */
+#define ROUTER_EXPIRE_MS 1000
+
+/**
+ * how long routes restored from a snapshot are kept without SPF: long enough
+ * for every live neighbor to have sent a hello and its LSUs
+ */
+#define ROUTER_GRACE_MS (PWOSPF_NEIGHBOR_TIMEOUT * 1000)
+
+static const addr_mac_t router_broadcast_mac = {
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }
+};
+
+#ifndef _THREAD_PER_PACKET_
+/** the work queue shared by every router in the process */
+static work_queue_t router_work_queue;
+static unsigned router_work_queue_users = 0;
+static pthread_mutex_t router_work_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/** Returns the ones-complement sum of the len bytes at buf. */
+static uint16_t router_sum( const byte* buf, unsigned len ) {
+    uint32_t sum = 0;
+    unsigned i;
+
+    for( i=0; i+1<len; i+=2 )
+        sum += (buf[i] << 8) | buf[i+1];
+    if( len & 1 )
+        sum += buf[len-1] << 8;
+
+    while( sum >> 16 )
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return sum;
+}
+
+/**
+ * Returns the ones-complement sum of the UDP datagram udp sent from src to dst
+ * and its pseudo header (0xFFFF if its checksum is right).
+ */
+static uint16_t router_udp_sum( const struct udphdr* udp, addr_ip_t src,
+                                addr_ip_t dst ) {
+    struct {
+        addr_ip_t src, dst;
+        byte zero, proto;
+        uint16_t len;
+    } __attribute__ ((packed)) pseudo = { src, dst, 0, IPPROTO_UDP, udp->len };
+    uint32_t sum;
+
+    sum = router_sum( (const byte*)&pseudo, sizeof(pseudo) )
+        + router_sum( (const byte*)udp, ntohs( udp->len ) );
+    return (sum & 0xFFFF) + (sum >> 16);
+}
+
+/** Fills in the checksum of the IP header iph. */
+static void router_ip_checksum( struct ip* iph ) {
+    iph->ip_sum = 0;
+    iph->ip_sum = htons( ~router_sum( (byte*)iph, iph->ip_hl * 4 ) );
+}
+
+/**
+ * Called by SPF for each prefix whose route changed.  Each first hop is mapped
+ * to the neighbor's address on every interface it is reached through, so
+ * parallel links to one neighbor are used as well.
+ */
+static void router_route_changed( void* arg, addr_ip_t subnet, addr_ip_t mask,
+                                  const spf_route_t* route ) {
+    router_t* router = (router_t*)arg;
+    char str_subnet[STRLEN_SUBNET];
+    fib_hop_t hops[FIB_MAX_PATHS];
+    neighbor_t* nbr;
+    unsigned i, j, num_hops = 0;
+
+    subnet_to_string( str_subnet, subnet, mask );
+    if( route && route->num_hops == 0 ) {
+        /* directly connected */
+        for( i=0; i<router->num_interfaces && num_hops<FIB_MAX_PATHS; i++ ) {
+            if( (router->interface[i].ip & mask) == subnet ) {
+                hops[num_hops].gw = 0;
+                hops[num_hops++].intf = i;
+            }
+        }
+    }
+    else if( route ) {
+        for( j=0; j<route->num_hops; j++ ) {
+            for( i=0; i<router->num_interfaces && num_hops<FIB_MAX_PATHS; i++ ) {
+                nbr = nbr_find( &router->interface[i].neighbors, route->first_hop[j] );
+                if( nbr ) {
+                    hops[num_hops].gw = nbr->ip;
+                    hops[num_hops++].intf = i;
+                }
+            }
+        }
+    }
+
+    pthread_rwlock_wrlock( &router->fib_lock );
+    if( num_hops )
+        fib_set( &router->fib, subnet, mask, hops, num_hops );
+    else
+        fib_remove( &router->fib, subnet, mask );
+    pthread_rwlock_unlock( &router->fib_lock );
+
+    if( !route )
+        debug_println( "SPF: route to %s withdrawn", str_subnet );
+    else
+        debug_println( "SPF: route to %s over %u next hops (%u hops away)",
+                       str_subnet, num_hops, route->dist );
+}
+
+/**
+ * Sends a PWOSPF packet from the flooding queues to the neighbor's address on
+ * the link.  Called by flooding, with ospf_lock held.
+ */
+static void router_flood_send( void* arg, unsigned iface, uint32_t nbr_id,
+                               const byte* pkt, unsigned len ) {
+    router_t* router = (router_t*)arg;
+    interface_t* intf = &router->interface[iface];
+    neighbor_t* nbr;
+    byte* buf;
+
+    nbr = nbr_find( &intf->neighbors, nbr_id );
+    if( !nbr )
+        return;
+
+    buf = malloc_or_die( ROUTER_SEND_HEADROOM + len );
+    memcpy( buf + ROUTER_SEND_HEADROOM, pkt, len );
+    router_send_ip( router, buf + ROUTER_SEND_HEADROOM, len, IPPROTO_PWOSPF, 1,
+                    intf->ip, nbr->ip, intf );
+    free( buf );
+}
+
+/** Sends a hello out each enabled interface.  The caller must hold ospf_lock. */
+static void router_send_hellos( router_t* router ) {
+    byte buf[ROUTER_SEND_HEADROOM + sizeof(pwospf_hdr_t) + sizeof(pwospf_hello_t)];
+    pwospf_hdr_t* hdr = (pwospf_hdr_t*)(buf + ROUTER_SEND_HEADROOM);
+    pwospf_hello_t* hello = (pwospf_hello_t*)(hdr + 1);
+    interface_t* intf;
+    unsigned i;
+
+    memset( hdr, 0, sizeof(*hdr) + sizeof(*hello) );
+    hdr->version = PWOSPF_VERSION;
+    hdr->type = PWOSPF_TYPE_HELLO;
+    hdr->len = htons( sizeof(*hdr) + sizeof(*hello) );
+    hdr->router_id = router->router_id;
+    hello->hello_int = htons( PWOSPF_HELLO_INT );
+
+    for( i=0; i<router->num_interfaces; i++ ) {
+        intf = &router->interface[i];
+        if( !intf->enabled )
+            continue;
+
+        hello->mask = intf->subnet_mask;
+        router_send_ip( router, (byte*)hdr, sizeof(*hdr) + sizeof(*hello),
+                        IPPROTO_PWOSPF, 1, intf->ip,
+                        htonl( PWOSPF_ALL_SPF_ROUTERS ), intf );
+    }
+}
+
+/** Installs a received LSU and schedules SPF if it changed the topology. */
+static lsdb_result_t router_install_lsu( void* arg, const byte* pkt, unsigned len,
+                                         uint64_t now_ms ) {
+    router_t* router = (router_t*)arg;
+    lsdb_entry_t* e;
+    lsdb_result_t ret;
+
+    ret = lsdb_lsu_input( &router->lsdb, pkt, len, now_ms, NULL, NULL );
+    if( ret == LSDB_CHANGED ) {
+        e = lsdb_find( &router->lsdb, ((const pwospf_hdr_t*)pkt)->router_id );
+        spf_set_links( &router->spf, e->router_id, e->links, e->num_links );
+        spf_throttle_change( &router->spf_throttle, now_ms );
+    }
+
+    return ret;
+}
+
+/**
+ * Originates, installs and floods this router's LSU, advertising the subnet of
+ * each interface once per neighbor on it (or once with no neighbor).
+ */
+static void router_originate( router_t* router, uint64_t now_ms ) {
+    lsdb_link_t* links;
+    interface_t* intf;
+    neighbor_t* nbr;
+    unsigned i, j, num_links = 0;
+
+    for( i=0; i<router->num_interfaces; i++ )
+        num_links += router->interface[i].neighbors.num_neighbors + 1;
+    links = malloc_or_die( num_links * sizeof(*links) );
+
+    for( num_links=i=0; i<router->num_interfaces; i++ ) {
+        intf = &router->interface[i];
+        if( !intf->neighbors.num_neighbors ) {
+            links[num_links].subnet = intf->ip & intf->subnet_mask;
+            links[num_links].mask = intf->subnet_mask;
+            links[num_links++].router_id = 0;
+        }
+        for( j=0; j<intf->neighbors.num_buckets; j++ ) {
+            for( nbr=intf->neighbors.bucket[j]; nbr; nbr=nbr->next ) {
+                links[num_links].subnet = intf->ip & intf->subnet_mask;
+                links[num_links].mask = intf->subnet_mask;
+                links[num_links++].router_id = nbr->router_id;
+            }
+        }
+    }
+
+    router->lsu_seq += 1;
+    router->lsu_refresh_ms = now_ms + PWOSPF_LSU_INT * 1000;
+    flood_originate_links( &router->flood, router->lsu_seq, links, num_links, now_ms );
+    free( links );
+}
+
+/** Called as an LSDB entry which was not refreshed is removed. */
+static void router_lsdb_expired( void* arg, const lsdb_entry_t* e ) {
+    router_t* router = (router_t*)arg;
+    char str_rid[STRLEN_IP];
+
+    ip_to_string( str_rid, e->router_id );
+    debug_println( "PWOSPF: the LSU of %s expired", str_rid );
+    spf_remove_router( &router->spf, e->router_id );
+}
+
+/**
+ * Called by flooding when a neighbor holds this router's LSU with sequence
+ * number seq, at least as new as the last it originated: after a restart
+ * without a snapshot, the neighbors keep the LSU from before it.  The LSU is
+ * originated again past seq straight away.
+ */
+static void router_reoriginate( void* arg, uint16_t seq, uint64_t now_ms ) {
+    router_t* router = (router_t*)arg;
+
+    debug_println( "PWOSPF: a neighbor holds LSU %u of this router; originating past it",
+                   seq );
+    router->lsu_seq = seq;
+    router->lsu_due = FALSE;
+    router_originate( router, now_ms );
+}
+
+/**
+ * Removes neighbor router_id from intf and from flooding, and schedules an LSU
+ * without it, but leaves its BFD session.  The caller must hold ospf_lock.
+ */
+static void router_drop_neighbor( router_t* router, interface_t* intf,
+                                  uint32_t router_id ) {
+    unsigned i;
+
+    if( !nbr_remove( &intf->neighbors, &router->nbr_wheel, router_id ) )
+        return;
+
+    /* flooding is per neighbor, which may still be reached over another link */
+    for( i=0; i<router->num_interfaces; i++ )
+        if( nbr_find( &router->interface[i].neighbors, router_id ) )
+            break;
+    if( i == router->num_interfaces )
+        flood_remove_neighbor( &router->flood, router_id );
+
+    router->lsu_due = TRUE;
+}
+
+/** router_remove_neighbor() for callers which hold ospf_lock (not bfd_lock). */
+static void router_remove_neighbor_locked( router_t* router, interface_t* intf,
+                                           uint32_t router_id ) {
+    bfd_session_t* s;
+
+    pthread_mutex_lock( &router->bfd_lock );
+    s = bfd_find( &router->bfd, intf - router->interface, router_id );
+    if( s )
+        bfd_remove_session( &router->bfd, s );
+    pthread_mutex_unlock( &router->bfd_lock );
+
+    router_drop_neighbor( router, intf, router_id );
+}
+
+/**
+ * Sends a BFD control packet to ip on the link of interface iface, over UDP to
+ * BFD_PORT with TTL 255 (RFC 5881).  Called by BFD, with bfd_lock held.
+ */
+static void router_bfd_send( void* arg, unsigned iface, addr_ip_t ip,
+                             const byte* pkt, unsigned len ) {
+    router_t* router = (router_t*)arg;
+    interface_t* intf = &router->interface[iface];
+    byte buf[ROUTER_SEND_HEADROOM + sizeof(struct udphdr) + sizeof(bfd_pkt_t)];
+    struct udphdr* udp = (struct udphdr*)(buf + ROUTER_SEND_HEADROOM);
+
+    if( len > sizeof(bfd_pkt_t) )
+        return;
+
+    udp->source = htons( ROUTER_BFD_SRC_PORT );
+    udp->dest = htons( BFD_PORT );
+    udp->len = htons( sizeof(*udp) + len );
+    memcpy( udp + 1, pkt, len );
+    udp->check = 0;
+    udp->check = htons( ~router_udp_sum( udp, intf->ip, ip ) );
+    if( !udp->check )
+        udp->check = 0xFFFF; /* zero means no checksum */
+    router_send_ip( router, (byte*)udp, sizeof(*udp) + len, IPPROTO_UDP, 255,
+                    intf->ip, ip, intf );
+}
+
+/**
+ * Called by BFD, with ospf_lock and bfd_lock held, when a session goes Up or
+ * Down.  A neighbor whose session went Down is removed at once.
+ */
+static void router_bfd_changed( void* arg, bfd_session_t* s, uint64_t now_ms ) {
+    router_t* router = (router_t*)arg;
+    char str_rid[STRLEN_IP];
+    uint32_t router_id = s->nbr_id;
+    unsigned iface = s->iface;
+
+    ip_to_string( str_rid, router_id );
+    if( s->state == BFD_UP ) {
+        debug_println( "BFD: session with neighbor %s on interface %u is up",
+                       str_rid, iface );
+        return;
+    }
+
+    debug_println( "BFD: session with neighbor %s on interface %u is down (%s)",
+                   str_rid, iface, s->diag == BFD_DIAG_NBR_DOWN
+                   ? "neighbor signaled down" : "detection time expired" );
+    bfd_remove_session( &router->bfd, s );
+    router_drop_neighbor( router, &router->interface[iface], router_id );
+}
+
+/** Called by the neighbor wheel when a neighbor's dead interval expires. */
+static void router_neighbor_dead( void* arg, tw_timer_t* dead, uint64_t now_ms ) {
+    router_t* router = (router_t*)arg;
+    neighbor_t* nbr = nbr_of_timer( dead );
+    char str_rid[STRLEN_IP];
+
+    ip_to_string( str_rid, nbr->router_id );
+    debug_println( "PWOSPF: neighbor %s on interface %u is dead",
+                   str_rid, nbr->iface );
+    router_remove_neighbor_locked( router, &router->interface[nbr->iface],
+                                   nbr->router_id );
+}
+
+uint64_t router_now_ms() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Entry point for the thread which runs the PWOSPF timers. */
+static void* router_ospf_thread_main( void* vrouter ) {
+    router_t* router = (router_t*)vrouter;
+    struct timespec wake;
+    int64_t timeout;
+
+    debug_pthread_init( "PWOSPF", "PWOSPF Timer Thread" );
+
+    pthread_mutex_lock( &router->ospf_lock );
+    while( !router->ospf_done ) {
+        timeout = router_ospf_timer( router, router_now_ms() );
+        if( timeout < 0 || timeout > 1000 )
+            timeout = 1000;
+
+        clock_gettime( CLOCK_REALTIME, &wake );
+        wake.tv_sec  += timeout / 1000;
+        wake.tv_nsec += (timeout % 1000) * 1000000;
+        if( wake.tv_nsec >= 1000000000 ) {
+            wake.tv_sec  += 1;
+            wake.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait( &router->ospf_cond, &router->ospf_lock, &wake );
+    }
+    pthread_mutex_unlock( &router->ospf_lock );
+
+    debug_println( "PWOSPF Timer Thread shutting down" );
+    return NULL;
+}
 
 void router_init( router_t* router ) {
 #ifdef _CPUMODE_
@@ -27,37 +414,382 @@ void router_init( router_t* router ) {
         pause.tv_nsec = 5000 * 1000; /* 5ms */
         nanosleep( &pause, NULL );
     }
+    hw_stats_init( &router->hw_stats, router->netfpga_regs,
+                   HW_STATS_DEFAULT_INTERVAL_MS );
+    decap_init( &router->decap, DECAP_MAX_BATCH );
+    pthread_rwlock_init( &router->decap_lock, NULL );
 #endif
 
     router->num_interfaces = 0;
 
     router->use_ospf = TRUE;
+    router->router_id = 0; /* set when the first interface is added */
+    lsdb_init( &router->lsdb );
+    tw_init( &router->nbr_wheel, NBR_TICK_MS, router_now_ms() );
+    bfd_init( &router->bfd, BFD_TX_MS, BFD_DETECT_MULT, router->router_id,
+              router_bfd_send, router_bfd_changed, router, router_now_ms() );
+    pthread_mutex_init( &router->bfd_lock, NULL );
+    router->lsu_seq = 0;
+    router->lsu_due = FALSE;
+    router->lsu_refresh_ms = 0;
+    router->expire_due_ms = 0;
+    router->hello_due_ms = 0;
+    router->snapshot_path = NULL;
+    router->snapshot_due_ms = 0;
+    router->snapshot_version = 0;
+    router->snapshot_arp_version = 0;
+    router->grace_until_ms = 0;
+    fib_init( &router->fib, router->router_id );
+    pthread_rwlock_init( &router->fib_lock, NULL );
+    arp_init( &router->arp );
+    pthread_rwlock_init( &router->arp_lock, NULL );
+    spf_init( &router->spf, router->router_id, router_route_changed, router );
+    spf_throttle_init( &router->spf_throttle, SPF_THROTTLE_INITIAL_MS,
+                       SPF_THROTTLE_INCR_MS, SPF_THROTTLE_MAX_MS );
+    flood_init( &router->flood, router->router_id, FLOOD_PACE_MS, FLOOD_RXMT_MS,
+                &router->lsdb, router_flood_send, router_install_lsu,
+                router_reoriginate, router );
+    pthread_mutex_init( &router->ospf_lock, NULL );
+    pthread_cond_init( &router->ospf_cond, NULL );
+    router->ospf_done = FALSE;
+    true_or_die( pthread_create( &router->ospf_thread, NULL,
+                                 router_ospf_thread_main, router ) == 0,
+                 "Error: unable to start the PWOSPF timer thread" );
+
+    encap_init( &router->encap );
+    pthread_rwlock_init( &router->encap_lock, NULL );
 
     pthread_mutex_init( &router->intf_lock, NULL );
 
 #ifndef _THREAD_PER_PACKET_
-    debug_println( "Initializing the router work queue with %u worker threads",
-                   NUM_WORKER_THREADS );
-    wq_init( &router->work_queue, NUM_WORKER_THREADS, &router_handle_work );
+    /* packets carry their router, so one pool of workers serves them all */
+    pthread_mutex_lock( &router_work_queue_lock );
+    if( router_work_queue_users++ == 0 ) {
+        debug_println( "Initializing the router work queue with %u worker threads",
+                       NUM_WORKER_THREADS );
+        wq_init( &router_work_queue, NUM_WORKER_THREADS, &router_handle_work );
+    }
+    pthread_mutex_unlock( &router_work_queue_lock );
+    router->work_queue = &router_work_queue;
 #else
     debug_println( "Router initialized (will use one thread per packet)" );
 #endif
 }
 
+/**
+ * Saves the snapshot if the topology or the ARP cache's mappings changed since
+ * it was last saved.
+ */
+static void router_snapshot( router_t* router, uint64_t now_ms ) {
+    nbr_table_t* nbrs[ROUTER_MAX_INTERFACES];
+    uint32_t arp_version;
+    unsigned i;
+    int ret;
+
+    router->snapshot_due_ms = now_ms + ROUTER_SNAPSHOT_MS;
+    pthread_rwlock_rdlock( &router->arp_lock );
+    arp_version = router->arp.version;
+    if( router->lsdb.version == router->snapshot_version
+        && arp_version == router->snapshot_arp_version ) {
+        pthread_rwlock_unlock( &router->arp_lock );
+        return;
+    }
+
+    for( i=0; i<router->num_interfaces; i++ )
+        nbrs[i] = &router->interface[i].neighbors;
+
+    /* the FIB is only written with ospf_lock held, as it is here, so it needs
+       no read lock */
+    ret = snapshot_save( router->snapshot_path, router->router_id, &router->fib,
+                         &router->lsdb, nbrs, router->num_interfaces,
+                         &router->arp, now_ms );
+    pthread_rwlock_unlock( &router->arp_lock );
+    if( ret != 0 )
+        debug_println( "Warning: unable to save the snapshot to %s: %s",
+                       router->snapshot_path, strerror( errno ) );
+    else {
+        router->snapshot_version = router->lsdb.version;
+        router->snapshot_arp_version = arp_version;
+    }
+}
+
 void router_destroy( router_t* router ) {
+    unsigned i;
+
     pthread_mutex_destroy( &router->intf_lock );
+    pthread_mutex_lock( &router->ospf_lock );
+    router->ospf_done = TRUE;
+    pthread_cond_signal( &router->ospf_cond );
+    pthread_mutex_unlock( &router->ospf_lock );
+    pthread_join( router->ospf_thread, NULL );
+    if( router->snapshot_path && router->num_interfaces )
+        router_snapshot( router, router_now_ms() );
+    pthread_cond_destroy( &router->ospf_cond );
+    pthread_mutex_destroy( &router->ospf_lock );
+    bfd_destroy( &router->bfd );
+    pthread_mutex_destroy( &router->bfd_lock );
+    flood_destroy( &router->flood );
+    spf_destroy( &router->spf );
+    lsdb_destroy( &router->lsdb );
+    fib_destroy( &router->fib );
+    pthread_rwlock_destroy( &router->fib_lock );
+    arp_destroy( &router->arp );
+    pthread_rwlock_destroy( &router->arp_lock );
+    pthread_rwlock_destroy( &router->encap_lock );
+    for( i=0; i<router->num_interfaces; i++ )
+        nbr_table_destroy( &router->interface[i].neighbors, &router->nbr_wheel );
 
 #ifdef _CPUMODE_
+    hw_stats_destroy( &router->hw_stats );
+    pthread_rwlock_destroy( &router->decap_lock );
     closeDescriptor( &router->nf );
 #endif
 
 #ifndef _THREAD_PER_PACKET_
-    wq_destroy( &router->work_queue );
+    pthread_mutex_lock( &router_work_queue_lock );
+    if( --router_work_queue_users == 0 )
+        wq_destroy( router->work_queue );
+    pthread_mutex_unlock( &router_work_queue_lock );
 #endif
 }
 
+/**
+ * Handles the PWOSPF packet pkt (len bytes) received on intf from src.  Hellos
+ * must agree with intf on the subnet mask and hello interval.
+ */
+static void router_handle_pwospf( router_t* router, interface_t* intf,
+                                  addr_ip_t src, const byte* pkt, unsigned len ) {
+    const pwospf_hdr_t* hdr = (const pwospf_hdr_t*)pkt;
+    const pwospf_hello_t* hello = (const pwospf_hello_t*)(hdr + 1);
+    uint64_t now_ms = router_now_ms();
+    neighbor_t* nbr;
+    uint32_t nbr_id;
+
+    if( !router->use_ospf || len < sizeof(*hdr)
+        || hdr->version != PWOSPF_VERSION || ntohs( hdr->len ) > len )
+        return;
+    len = ntohs( hdr->len );
+
+    if( hdr->type == PWOSPF_TYPE_HELLO ) {
+        if( len >= sizeof(*hdr) + sizeof(*hello)
+            && hdr->router_id != router->router_id
+            && hello->mask == intf->subnet_mask
+            && ntohs( hello->hello_int ) == PWOSPF_HELLO_INT )
+            router_handle_hello( router, intf, hdr->router_id, src, now_ms );
+        return;
+    }
+
+    /* a plain LSU carries its originator's ID rather than the sender's, so the
+       sender is known by its address */
+    pthread_mutex_lock( &router->ospf_lock );
+    nbr = nbr_find_ip( &intf->neighbors, src );
+    nbr_id = nbr ? nbr->router_id : 0;
+    pthread_mutex_unlock( &router->ospf_lock );
+
+    if( nbr_id )
+        router_handle_lsu( router, nbr_id, pkt, len, now_ms );
+}
+
+/**
+ * Sends an ARP request for ip out intf, to dst (the MAC ip is thought to be
+ * at, to refresh an entry as RFC 1122 suggests) or broadcast if dst is NULL.
+ */
+static void router_arp_request( router_t* router, interface_t* intf,
+                                addr_ip_t ip, const addr_mac_t* dst ) {
+    byte buf[PACKET_HEADROOM + ETH_HDR_LEN + sizeof(struct ether_arp)];
+    struct ether_header* eth = (struct ether_header*)(buf + PACKET_HEADROOM);
+    struct ether_arp* arp = (struct ether_arp*)(buf + PACKET_HEADROOM + ETH_HDR_LEN);
+
+    memcpy( eth->ether_dhost, dst ? dst : &router_broadcast_mac, ETH_ADDR_LEN );
+    memcpy( eth->ether_shost, &intf->mac, ETH_ADDR_LEN );
+    eth->ether_type = htons( ETHERTYPE_ARP );
+    arp->arp_hrd = htons( ARPHRD_ETHER );
+    arp->arp_pro = htons( ETHERTYPE_IP );
+    arp->arp_hln = ETH_ADDR_LEN;
+    arp->arp_pln = IP_ADDR_LEN;
+    arp->arp_op = htons( ARPOP_REQUEST );
+    memcpy( arp->arp_sha, &intf->mac, ETH_ADDR_LEN );
+    memcpy( arp->arp_spa, &intf->ip, IP_ADDR_LEN );
+    memset( arp->arp_tha, 0, ETH_ADDR_LEN );
+    memcpy( arp->arp_tpa, &ip, IP_ADDR_LEN );
+
+    router_output_frame( router, (byte*)eth, ETH_HDR_LEN + sizeof(*arp), intf );
+}
+
+/**
+ * Learns the sender of an ARP packet addressed to the interface it arrived on,
+ * as it is about to talk to the router (RFC 826), and answers it if it is a
+ * request.  The reply is written over the request.
+ */
+static void router_handle_arp( packet_info_t* pi ) {
+    router_t* router = pi->router;
+    interface_t* intf = pi->interface;
+    struct ether_header* eth = (struct ether_header*)pi->packet;
+    struct ether_arp* arp = (struct ether_arp*)(pi->packet + ETH_HDR_LEN);
+    addr_ip_t spa, tpa;
+    addr_mac_t sha;
+
+    if( pi->len < ETH_HDR_LEN + sizeof(*arp)
+        || ntohs( arp->arp_hrd ) != ARPHRD_ETHER
+        || ntohs( arp->arp_pro ) != ETHERTYPE_IP
+        || arp->arp_hln != ETH_ADDR_LEN || arp->arp_pln != IP_ADDR_LEN )
+        return;
+
+    memcpy( &spa, arp->arp_spa, IP_ADDR_LEN );
+    memcpy( &tpa, arp->arp_tpa, IP_ADDR_LEN );
+    memcpy( &sha, arp->arp_sha, ETH_ADDR_LEN );
+    if( tpa != intf->ip || spa == 0 )
+        return;
+
+    pthread_rwlock_wrlock( &router->arp_lock );
+    arp_learn( &router->arp, spa, sha, router_now_ms() );
+    pthread_rwlock_unlock( &router->arp_lock );
+
+    if( ntohs( arp->arp_op ) != ARPOP_REQUEST )
+        return;
+
+    arp->arp_op = htons( ARPOP_REPLY );
+    memcpy( arp->arp_tha, &sha, ETH_ADDR_LEN );
+    memcpy( arp->arp_tpa, &spa, IP_ADDR_LEN );
+    memcpy( arp->arp_sha, &intf->mac, ETH_ADDR_LEN );
+    memcpy( arp->arp_spa, &intf->ip, IP_ADDR_LEN );
+    memcpy( eth->ether_dhost, &sha, ETH_ADDR_LEN );
+    memcpy( eth->ether_shost, &intf->mac, ETH_ADDR_LEN );
+    router_output_frame( router, pi->packet, pi->len, intf );
+}
+
+/** Returns TRUE if packets to dst are for the router itself. */
+static bool router_is_local( router_t* router, addr_ip_t dst ) {
+    unsigned i;
+
+    if( dst == htonl( PWOSPF_ALL_SPF_ROUTERS ) )
+        return TRUE;
+
+    for( i=0; i<router->num_interfaces; i++ )
+        if( router->interface[i].ip == dst )
+            return TRUE;
+
+    return FALSE;
+}
+
+/**
+ * Hands BFD control packets in the UDP datagram in iph to BFD.  Single hop BFD
+ * packets must arrive with TTL 255, so they cannot have come from further than
+ * the link (RFC 5881).  Other datagrams are dropped.
+ */
+static void router_handle_udp( packet_info_t* pi, struct ip* iph ) {
+    unsigned hdr_len = iph->ip_hl * 4;
+    struct udphdr* udp = (struct udphdr*)((byte*)iph + hdr_len);
+    unsigned len = ntohs( iph->ip_len ) - hdr_len;
+
+    if( len < sizeof(*udp) || ntohs( udp->len ) < sizeof(*udp)
+        || ntohs( udp->len ) > len || udp->dest != htons( BFD_PORT )
+        || iph->ip_ttl != 255 )
+        return;
+
+    if( udp->check && router_udp_sum( udp, iph->ip_src.s_addr,
+                                      iph->ip_dst.s_addr ) != 0xFFFF )
+        return;
+
+    router_handle_bfd( pi->router, pi->interface, iph->ip_src.s_addr,
+                       (byte*)(udp + 1), ntohs( udp->len ) - sizeof(*udp),
+                       router_now_ms() );
+}
+
+/**
+ * Delivers the IP packet iph in pi to the router.  pi->buf is set to NULL if
+ * it was handed on.
+ */
+static void router_deliver_local( packet_info_t* pi, struct ip* iph ) {
+    unsigned hdr_len = iph->ip_hl * 4;
+
+    switch( iph->ip_p ) {
+    case IPPROTO_PWOSPF:
+        router_handle_pwospf( pi->router, pi->interface, iph->ip_src.s_addr,
+                              (byte*)iph + hdr_len, ntohs( iph->ip_len ) - hdr_len );
+        break;
+
+    case IPPROTO_UDP:
+        router_handle_udp( pi, iph );
+        break;
+
+    case IPPROTO_TCP:
+        /* lwip frees the buffer once it is done with the segment */
+        sr_transport_input( pi->router->sr, pi->buf, (byte*)iph );
+        pi->buf = NULL;
+        break;
+
+    default:
+        break; /* ICMP is not answered */
+    }
+}
+
+/**
+ * Forwards the IP packet iph (len bytes with any Ethernet padding, which is
+ * sent on as the hardware does).  Packets whose TTL runs out or which have no
+ * route are dropped without an ICMP error.
+ */
+static void router_forward( router_t* router, struct ip* iph, unsigned len ) {
+    fib_hop_t hop;
+
+    if( iph->ip_ttl <= 1 )
+        return;
+    if( !router_route_packet( router, (byte*)iph, len, &hop ) )
+        return;
+
+    iph->ip_ttl -= 1;
+    router_ip_checksum( iph );
+    router_output_ip( router, (byte*)iph, len,
+                      hop.gw ? hop.gw : iph->ip_dst.s_addr,
+                      &router->interface[hop.intf] );
+}
+
+/** Checks the IP packet in pi and delivers or forwards it. */
+static void router_handle_ip( packet_info_t* pi ) {
+    struct ip* iph = (struct ip*)(pi->packet + ETH_HDR_LEN);
+    unsigned len = pi->len - ETH_HDR_LEN;
+    unsigned hdr_len;
+
+    if( len < sizeof(*iph) || iph->ip_v != 4 )
+        return;
+
+    hdr_len = iph->ip_hl * 4;
+    if( hdr_len < sizeof(*iph) || ntohs( iph->ip_len ) < hdr_len
+        || ntohs( iph->ip_len ) > len )
+        return;
+
+    if( router_sum( (byte*)iph, hdr_len ) != 0xFFFF )
+        return;
+
+    if( router_is_local( pi->router, iph->ip_dst.s_addr ) )
+        router_deliver_local( pi, iph );
+    else
+        router_forward( pi->router, iph, len );
+}
+
 void router_handle_packet( packet_info_t* pi ) {
-	printf("NEW FRAME RECEIVED!!!\n");
+    struct ether_header* eth = (struct ether_header*)pi->packet;
+
+    /* the hardware drops frames which are not for the port */
+    if( pi->len >= ETH_HDR_LEN
+        && (memcmp( eth->ether_dhost, &pi->interface->mac, ETH_ADDR_LEN ) == 0
+            || memcmp( eth->ether_dhost, &router_broadcast_mac, ETH_ADDR_LEN ) == 0) ) {
+        switch( ntohs( eth->ether_type ) ) {
+        case ETHERTYPE_ARP:
+            router_handle_arp( pi );
+            break;
+
+        case ETHERTYPE_IP:
+            router_handle_ip( pi );
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    free( pi->buf );
+    free( pi );
 }
 
 
@@ -87,13 +819,348 @@ void router_handle_work( work_t* work ) {
 #endif
 
 
+int router_output_frame( router_t* router, byte* frame,
+                         unsigned len, interface_t* intf ) {
+    /* the tunnel is chosen by output port, as in the hardware */
+    pthread_rwlock_rdlock( &router->encap_lock );
+    encap_output( &router->encap, intf - router->interface, &frame, &len );
+    pthread_rwlock_unlock( &router->encap_lock );
+    return sr_integ_low_level_output( router->sr, frame, len, intf );
+}
+
+int router_output_ip( router_t* router, byte* ip, unsigned len,
+                      addr_ip_t next_hop, interface_t* intf ) {
+    struct ether_header* eth = (struct ether_header*)(ip - ETH_HDR_LEN);
+    const arp_entry_t* e;
+    bool found, refresh = FALSE, ask;
+    uint64_t now_ms;
+
+    if( next_hop == 0xFFFFFFFF || IN_MULTICAST( ntohl( next_hop ) ) )
+        memcpy( eth->ether_dhost, &router_broadcast_mac, ETH_ADDR_LEN );
+    else {
+        now_ms = router_now_ms();
+        pthread_rwlock_rdlock( &router->arp_lock );
+        e = arp_lookup( &router->arp, next_hop, now_ms );
+        found = (e != NULL);
+        if( found ) {
+            memcpy( eth->ether_dhost, &e->mac, ETH_ADDR_LEN );
+            refresh = arp_refresh_due( e, now_ms );
+        }
+        pthread_rwlock_unlock( &router->arp_lock );
+
+        /* one request per next hop at a time, and none once it has stopped
+           answering; an entry in use is asked for again before it expires */
+        if( !found || refresh ) {
+            pthread_rwlock_wrlock( &router->arp_lock );
+            ask = arp_want_request( &router->arp, next_hop, now_ms );
+            pthread_rwlock_unlock( &router->arp_lock );
+
+            if( ask )
+                router_arp_request( router, intf, next_hop,
+                                    found ? (addr_mac_t*)eth->ether_dhost : NULL );
+            if( !found )
+                return -1;
+        }
+    }
+
+    memcpy( eth->ether_shost, &intf->mac, ETH_ADDR_LEN );
+    eth->ether_type = htons( ETHERTYPE_IP );
+    return router_output_frame( router, (byte*)eth, ETH_HDR_LEN + len, intf );
+}
+
+int router_send_ip( router_t* router, byte* payload, unsigned len,
+                    byte proto, byte ttl, addr_ip_t src, addr_ip_t dst,
+                    interface_t* intf ) {
+    struct ip* iph = (struct ip*)(payload - IP_HDR_LEN);
+    fib_hop_t hop;
+
+    iph->ip_v = 4;
+    iph->ip_hl = IP_HDR_LEN / 4;
+    iph->ip_tos = 0;
+    iph->ip_len = htons( IP_HDR_LEN + len );
+    iph->ip_id = 0; /* never fragmented (RFC 6864) */
+    iph->ip_off = htons( IP_DF );
+    iph->ip_ttl = ttl;
+    iph->ip_p = proto;
+    iph->ip_src.s_addr = src;
+    iph->ip_dst.s_addr = dst;
+    router_ip_checksum( iph );
+
+    if( intf )
+        return router_output_ip( router, (byte*)iph, IP_HDR_LEN + len, dst, intf );
+
+    if( !router_route_packet( router, (byte*)iph, IP_HDR_LEN + len, &hop ) )
+        return -1;
+    return router_output_ip( router, (byte*)iph, IP_HDR_LEN + len,
+                             hop.gw ? hop.gw : dst, &router->interface[hop.intf] );
+}
+
+void router_handle_lsu( router_t* router, uint32_t nbr_id, const byte* pkt,
+                        unsigned len, uint64_t now_ms ) {
+    pthread_mutex_lock( &router->ospf_lock );
+    flood_input( &router->flood, nbr_id, pkt, len, now_ms );
+    pthread_cond_signal( &router->ospf_cond ); /* there may be more to send */
+    pthread_mutex_unlock( &router->ospf_lock );
+}
+
+/** Returns the sooner of timeouts a and b, where -1 is never. */
+static int64_t router_min_timeout( int64_t a, int64_t b ) {
+    if( a < 0 || (b >= 0 && b < a) )
+        return b;
+    return a;
+}
+
+bool router_restore( router_t* router, uint64_t now_ms ) {
+    const snapshot_route_t* r;
+    const snapshot_lsdb_t* l;
+    const snapshot_nbr_t* n;
+    const snapshot_arp_t* a;
+    const lsdb_link_t* k;
+    lsdb_entry_t* e;
+    snapshot_t snap;
+    uint64_t age_ms;
+    bool is_new;
+    unsigned i;
+
+    if( !router->snapshot_path || !snapshot_open( &snap, router->snapshot_path ) )
+        return FALSE;
+    if( snap.hdr->router_id != router->router_id ) {
+        debug_println( "Ignoring the snapshot in %s: it is of another router",
+                       router->snapshot_path );
+        snapshot_close( &snap );
+        return FALSE;
+    }
+
+    pthread_mutex_lock( &router->ospf_lock );
+
+    /* forward over the old routes until SPF has been run on fresh state */
+    pthread_rwlock_wrlock( &router->fib_lock );
+    for( i=0; i<snap.hdr->num_routes; i++ ) {
+        r = &snap.route[i];
+        fib_set( &router->fib, r->subnet, r->mask, r->hop, r->num_hops );
+    }
+    fib_mark_stale( &router->fib );
+    pthread_rwlock_unlock( &router->fib_lock );
+
+    /* the database ages out like one learned from LSUs if it is not refreshed
+       (see router_ospf_timer()) */
+    for( k=snap.link, i=0; i<snap.hdr->num_lsdb; k+=l->num_links, i++ ) {
+        l = &snap.lsdb[i];
+        lsdb_update( &router->lsdb, l->router_id, l->seq, k, l->num_links,
+                     now_ms, NULL, NULL );
+        e = lsdb_find( &router->lsdb, l->router_id );
+        spf_set_links( &router->spf, e->router_id, e->links, e->num_links );
+    }
+
+    /* carry on from the last LSU this router originated, which its neighbors
+       still hold and would take a smaller sequence number to be stale */
+    if( (e = lsdb_find( &router->lsdb, router->router_id )) )
+        router->lsu_seq = e->seq;
+
+    /* neighbors are dropped unless they say hello within a dead interval */
+    for( i=0; i<snap.hdr->num_nbrs; i++ ) {
+        n = &snap.nbr[i];
+        if( n->iface >= router->num_interfaces )
+            continue;
+        nbr_hello( &router->interface[n->iface].neighbors, &router->nbr_wheel,
+                   n->iface, n->router_id, n->ip, now_ms,
+                   PWOSPF_NEIGHBOR_TIMEOUT * 1000, &is_new );
+        if( is_new ) {
+            flood_add_neighbor( &router->flood, n->iface, n->router_id );
+            pthread_mutex_lock( &router->bfd_lock );
+            bfd_add_session( &router->bfd, n->iface, n->router_id, n->ip, now_ms );
+            pthread_mutex_unlock( &router->bfd_lock );
+        }
+    }
+
+    /* the next hops' MACs, so the restored routes need not wait for ARP;
+       learned ones keep what they had left of their lifetime */
+    age_ms = snapshot_age_ms( &snap );
+    pthread_rwlock_wrlock( &router->arp_lock );
+    for( i=0; i<snap.hdr->num_arp; i++ ) {
+        a = &snap.arp[i];
+        if( a->is_static )
+            arp_add_static( &router->arp, a->ip, a->mac );
+        else if( a->ttl_ms > age_ms )
+            arp_learn_until( &router->arp, a->ip, a->mac, now_ms + a->ttl_ms - age_ms );
+    }
+    router->snapshot_arp_version = router->arp.version;
+    pthread_rwlock_unlock( &router->arp_lock );
+
+    debug_println( "Restored %u routes, %u LSDB entries, %u neighbors and %u ARP "
+                   "entries from %s", snap.hdr->num_routes, snap.hdr->num_lsdb,
+                   snap.hdr->num_nbrs, snap.hdr->num_arp, router->snapshot_path );
+    snapshot_close( &snap );
+
+    router->grace_until_ms = now_ms + ROUTER_GRACE_MS;
+    router->snapshot_version = router->lsdb.version;
+    pthread_cond_signal( &router->ospf_cond );
+    pthread_mutex_unlock( &router->ospf_lock );
+    return TRUE;
+}
+
+int64_t router_ospf_timer( router_t* router, uint64_t now_ms ) {
+    int64_t timeout, bfd_timeout;
+    unsigned n;
+
+    /* a dead neighbor is withdrawn from the LSU right away, and the LSU
+       schedules SPF through the hold-down timer like any other change */
+    tw_advance( &router->nbr_wheel, now_ms, router_neighbor_dead, router );
+    if( router->use_ospf && now_ms >= router->hello_due_ms ) {
+        router->hello_due_ms = now_ms + PWOSPF_HELLO_INT * 1000;
+        router_send_hellos( router );
+    }
+    pthread_mutex_lock( &router->bfd_lock );
+    bfd_timeout = bfd_timer( &router->bfd, now_ms );
+    pthread_mutex_unlock( &router->bfd_lock );
+    if( router->lsu_due
+        || (router->num_interfaces && now_ms >= router->lsu_refresh_ms) ) {
+        router->lsu_due = FALSE;
+        router_originate( router, now_ms );
+    }
+    if( now_ms >= router->expire_due_ms ) {
+        router->expire_due_ms = now_ms + ROUTER_EXPIRE_MS;
+        if( lsdb_expire( &router->lsdb, now_ms, PWOSPF_LSU_TIMEOUT * 1000,
+                         router->router_id, router_lsdb_expired, router ) )
+            spf_throttle_change( &router->spf_throttle, now_ms );
+    }
+
+    if( router->grace_until_ms && now_ms >= router->grace_until_ms ) {
+        /* the restart is over: replace the restored routes */
+        router->grace_until_ms = 0;
+        spf_run( &router->spf );
+        spf_throttle_ran( &router->spf_throttle, now_ms );
+        pthread_rwlock_wrlock( &router->fib_lock );
+        n = fib_sweep_stale( &router->fib );
+        pthread_rwlock_unlock( &router->fib_lock );
+        debug_println( "Graceful restart done: %u stale routes removed", n );
+    }
+    else if( !router->grace_until_ms
+             && spf_throttle_due( &router->spf_throttle, now_ms ) ) {
+        spf_run( &router->spf );
+        spf_throttle_ran( &router->spf_throttle, now_ms );
+    }
+
+    if( router->snapshot_path && now_ms >= router->snapshot_due_ms )
+        router_snapshot( router, now_ms );
+
+    if( router->grace_until_ms )
+        timeout = router->grace_until_ms - now_ms;
+    else
+        timeout = spf_throttle_timeout( &router->spf_throttle, now_ms );
+    timeout = router_min_timeout( timeout, flood_timer( &router->flood, now_ms ) );
+    if( router->snapshot_path )
+        timeout = router_min_timeout( timeout, router->snapshot_due_ms - now_ms );
+    timeout = router_min_timeout( timeout, bfd_timeout );
+    timeout = router_min_timeout( timeout, router->expire_due_ms - now_ms );
+    if( router->num_interfaces )
+        timeout = router_min_timeout( timeout, router->lsu_refresh_ms - now_ms );
+    if( router->use_ospf )
+        timeout = router_min_timeout( timeout, router->hello_due_ms - now_ms );
+    return router_min_timeout( timeout, tw_timeout( &router->nbr_wheel, now_ms ) );
+}
+
 interface_t* router_lookup_interface_via_ip( router_t* router, addr_ip_t ip ) {
-    return 0;
+    const fib_group_t* g;
+    interface_t* intf = NULL;
+
+    pthread_rwlock_rdlock( &router->fib_lock );
+    g = fib_lookup( &router->fib, ip );
+    if( g && g->num_hops )
+        intf = &router->interface[g->hop[0].intf];
+    pthread_rwlock_unlock( &router->fib_lock );
+
+    return intf;
+}
+
+unsigned router_route_mtu( router_t* router, addr_ip_t ip ) {
+    const fib_group_t* g;
+    unsigned intf[FIB_MAX_PATHS];
+    unsigned num_hops = 0, mtu = 0, m, i;
+
+    pthread_rwlock_rdlock( &router->fib_lock );
+    g = fib_lookup( &router->fib, ip );
+    if( g ) {
+        num_hops = g->num_hops;
+        for( i=0; i<num_hops; i++ )
+            intf[i] = g->hop[i].intf;
+    }
+    pthread_rwlock_unlock( &router->fib_lock );
+
+    pthread_rwlock_rdlock( &router->encap_lock );
+    for( i=0; i<num_hops; i++ ) {
+        m = encap_mtu( &router->encap, intf[i] );
+        if( !mtu || m < mtu )
+            mtu = m;
+    }
+    pthread_rwlock_unlock( &router->encap_lock );
+
+    return mtu;
+}
+
+bool router_route_packet( router_t* router, const byte* ip, unsigned len,
+                          fib_hop_t* hop ) {
+    const fib_hop_t* h;
+
+    pthread_rwlock_rdlock( &router->fib_lock );
+    h = fib_route( &router->fib, ip, len );
+    if( h )
+        *hop = *h;
+    pthread_rwlock_unlock( &router->fib_lock );
+
+    return h != NULL;
+}
+
+void router_handle_hello( router_t* router, interface_t* intf,
+                          uint32_t router_id, addr_ip_t ip, uint64_t now_ms ) {
+    unsigned iface = intf - router->interface;
+    bool is_new;
+
+    pthread_mutex_lock( &router->ospf_lock );
+    nbr_hello( &intf->neighbors, &router->nbr_wheel, iface, router_id, ip,
+               now_ms, PWOSPF_NEIGHBOR_TIMEOUT * 1000, &is_new );
+    if( is_new ) {
+        flood_add_neighbor( &router->flood, iface, router_id );
+        pthread_mutex_lock( &router->bfd_lock );
+        bfd_add_session( &router->bfd, iface, router_id, ip, now_ms );
+        pthread_mutex_unlock( &router->bfd_lock );
+        flood_sync( &router->flood, router_id );
+        router->lsu_due = TRUE;
+        pthread_cond_signal( &router->ospf_cond ); /* originate now */
+    }
+    pthread_mutex_unlock( &router->ospf_lock );
+}
+
+void router_handle_bfd( router_t* router, interface_t* intf, addr_ip_t src,
+                        const byte* pkt, unsigned len, uint64_t now_ms ) {
+    bool changed;
+
+    pthread_mutex_lock( &router->bfd_lock );
+    changed = bfd_input( &router->bfd, intf - router->interface, src, pkt, len, now_ms );
+    pthread_mutex_unlock( &router->bfd_lock );
+
+    if( changed ) {
+        pthread_mutex_lock( &router->ospf_lock );
+        pthread_cond_signal( &router->ospf_cond ); /* report it now */
+        pthread_mutex_unlock( &router->ospf_lock );
+    }
+}
+
+void router_remove_neighbor( router_t* router, interface_t* intf,
+                             uint32_t router_id ) {
+    pthread_mutex_lock( &router->ospf_lock );
+    router_remove_neighbor_locked( router, intf, router_id );
+    pthread_cond_signal( &router->ospf_cond ); /* originate now */
+    pthread_mutex_unlock( &router->ospf_lock );
 }
 
 interface_t* router_lookup_interface_via_name( router_t* router,
                                                const char* name ) {
     unsigned i;
+    for( i=0; i<router->num_interfaces; i++ )
+        if( strcmp( router->interface[i].name, name ) == 0 )
+            return &router->interface[i];
+
     return NULL;
 }
 
@@ -111,7 +1178,7 @@ void router_add_interface( router_t* router,
     intf->subnet_mask = mask;
     intf->mac = mac;
     intf->enabled = TRUE;
-    intf->neighbor_list_head = NULL;
+    nbr_table_init( &intf->neighbors );
 
 #ifdef MININET_MODE
     // open a socket to talk to the hw on this interface
@@ -132,8 +1199,24 @@ void router_add_interface( router_t* router,
     pthread_mutex_init( &intf->hw_lock, NULL );
 #endif
 
+    pthread_mutex_lock( &router->ospf_lock );
+
+    /* like OSPF, the router is identified by its first interface's IP */
+    if( router->num_interfaces == 0 ) {
+        router->router_id = ip;
+        router->flood.router_id = ip;
+        router->fib.seed = ip;
+        router->bfd.rand = ip;
+        spf_set_root( &router->spf, ip );
+    }
+
     router->num_interfaces += 1;
 
+    /* say hello on the new interface straight away */
+    router->hello_due_ms = 0;
+    pthread_cond_signal( &router->ospf_cond );
+    pthread_mutex_unlock( &router->ospf_lock );
+
 }
 
 
@@ -15,6 +15,7 @@
 
 /* forward declarations */
 struct router_t;
+struct sr_instance;
 
 #include <netinet/in.h>
 #include <pthread.h>
@@ -22,13 +23,34 @@ struct router_t;
 #include "common/nf10util.h"
 #include "common/nf_util.h"
 #include "reg_defines.h"
+#include "sr_arp.h"
+#include "sr_bfd.h"
 #include "sr_common.h"
+#include "sr_decap.h"
+#include "sr_encap.h"
+#include "sr_fib.h"
+#include "sr_hw_stats.h"
 #include "sr_interface.h"
+#include "sr_pwospf_flood.h"
+#include "sr_pwospf_lsdb.h"
+#include "sr_pwospf_spf.h"
+#include "sr_pwospf_throttle.h"
+#include "sr_snapshot.h"
+#include "sr_timer_wheel.h"
 #include "sr_work_queue.h"
 
 /** max number of interfaces the router max have */
 #define ROUTER_MAX_INTERFACES 4
 
+/**
+ * bytes reserved in front of each received packet so that it can be
+ * encapsulated in place when it is forwarded
+ */
+#define PACKET_HEADROOM ENCAP_HDR_LEN
+
+/** bytes which must precede the payload of a packet the router originates */
+#define ROUTER_SEND_HEADROOM (PACKET_HEADROOM + ETH_HDR_LEN + IP_HDR_LEN)
+
 /** router data structure */
 typedef struct router_t {
 
@@ -37,18 +59,56 @@ typedef struct router_t {
     pthread_mutex_t intf_lock;
 
     bool use_ospf;
+    uint32_t router_id;         /* IP of the first interface added */
+    lsdb_t lsdb;                /* PWOSPF link state database */
+    spf_t spf;                  /* shortest paths computed from the LSDB */
+    spf_throttle_t spf_throttle; /* coalesces LSDB changes into SPF runs */
+    flood_t flood;              /* LSU flooding to the neighbors */
+    pthread_mutex_t ospf_lock;  /* protects the PWOSPF state */
+    pthread_cond_t ospf_cond;   /* wakes the PWOSPF timer thread */
+    pthread_t ospf_thread;
+    bool ospf_done;             /* tells the PWOSPF timer thread to exit */
+
+    timer_wheel_t nbr_wheel;    /* neighbors' dead intervals */
+    bfd_t bfd;                  /* fast liveness sessions with the neighbors */
+    pthread_mutex_t bfd_lock;   /* protects bfd; taken after ospf_lock */
+    uint16_t lsu_seq;           /* of the last LSU this router originated */
+    bool lsu_due;               /* its neighbors changed since */
+    uint64_t lsu_refresh_ms;    /* when it is originated again regardless */
+    uint64_t expire_due_ms;     /* when the LSDB is next checked for expiry */
+    uint64_t hello_due_ms;      /* when hellos are next sent */
+
+    fib_t fib;                  /* ECMP forwarding table, fed by SPF */
+    pthread_rwlock_t fib_lock;  /* written by SPF, read by the packet handlers */
+
+    arp_t arp;                  /* MACs of the next hops */
+    pthread_rwlock_t arp_lock;  /* written as ARP packets arrive */
+
+    const char* snapshot_path;  /* state is saved to for restarts, or NULL */
+    uint64_t snapshot_due_ms;   /* when it is next saved, if it changed */
+    uint32_t snapshot_version;  /* of the LSDB when it was last saved */
+    uint32_t snapshot_arp_version; /* of the ARP cache then */
+    uint64_t grace_until_ms;    /* restored routes are kept until then, or 0 */
+
+    encap_t encap;              /* tunnels frames are encapsulated in on output */
+    pthread_rwlock_t encap_lock; /* written as tunnels are configured */
 
 #ifdef _CPUMODE_
     struct nf_device nf;
     int	netfpga_regs;
+    hw_stats_t hw_stats;  /* periodic snapshot of the hardware counters */
+    decap_t decap;        /* tunnels terminated on the CPU path */
+    pthread_rwlock_t decap_lock; /* written as tunnels are configured */
 #endif
 
 #ifdef MININET_MODE
     char* name;      // name of router (e.g. r0)
 #endif               // needed for iface initialisation
 
+    struct sr_instance* sr;     /* the instance this router belongs to */
+
 #ifndef _THREAD_PER_PACKET_
-    work_queue_t work_queue;
+    work_queue_t* work_queue;   /* shared by every router in the process */
 
 #   ifndef NUM_WORKER_THREADS
 #    define NUM_WORKER_THREADS 2 /* in addition to the main thread, ARP queue
@@ -60,22 +120,27 @@ typedef struct router_t {
 /** a packet along with the router and the interface it arrived on */
 typedef struct packet_info_t {
     router_t* router;
+    byte* buf;       /* the allocation; PACKET_HEADROOM bytes precede packet */
     byte* packet;
     unsigned len;
     interface_t* interface;
 } packet_info_t;
 
-/** Initializes the router_t data structure. */
+/**
+ * Initializes the router_t data structure.  Every router in the process shares
+ * one pool of worker threads, started with the first router.
+ */
 void router_init( router_t* router );
 
 /** Destroys the router_t data structure. */
 void router_destroy( router_t* router );
 
 /**
- * Main entry function for a thread which is to handle the packet_info_t
- * specified by vpacket.  The thread will process the packet and then free the
- * buffers associated with the packet, including vpacket itself, before
- * terminating.
+ * Handles the frame pi->packet received on pi->interface: ARP requests for the
+ * interface's address are answered, IP packets addressed to the router are
+ * delivered locally, and other IP packets are forwarded as the hardware
+ * forwards them.  The buffers associated with the packet, including pi itself,
+ * are freed before it returns.
  */
 void router_handle_packet( packet_info_t* pi );
 
@@ -102,6 +167,25 @@ void router_handle_work( work_t* work /* borrowed */ );
  */
 interface_t* router_lookup_interface_via_ip( router_t* router, addr_ip_t ip );
 
+/**
+ * Determines the largest IP packet which can be sent to ip without being
+ * fragmented, whichever of the route's equal-cost next hops its flow takes.
+ * Interfaces with a tunnel lose ENCAP_HDR_LEN to the outer header.
+ *
+ * @return the MTU, or 0 if a route does not exist
+ */
+unsigned router_route_mtu( router_t* router, addr_ip_t ip );
+
+/**
+ * Picks the next hop for the IP packet ip (len bytes from the IP header).
+ * When the route has several equal-cost next hops, the packet's flow decides
+ * which one, so a flow always takes the same path.
+ *
+ * @return FALSE if a route does not exist
+ */
+bool router_route_packet( router_t* router, const byte* ip /* borrowed */,
+                          unsigned len, fib_hop_t* hop );
+
 /**
  * Returns a pointer to the interface described by the specified name.
  *
@@ -111,6 +195,108 @@ interface_t* router_lookup_interface_via_name( router_t* router,
                                                const char* name );
 
 
+/**
+ * Sends a frame out intf, encapsulating it first if a tunnel is configured on
+ * intf.  frame must be preceded by PACKET_HEADROOM bytes the router may write
+ * to, as packet_info_t packets are.
+ *
+ * @return 0 on success, otherwise -1
+ */
+int router_output_frame( router_t* router, byte* frame /* borrowed */,
+                         unsigned len, interface_t* intf );
+
+/**
+ * Sends the IP packet at ip (len bytes, header complete) out intf to next_hop,
+ * which must be on intf's link: the Ethernet header is written in front of it,
+ * to next_hop's MAC from the ARP cache, or to the broadcast MAC if next_hop is
+ * a broadcast or multicast address.  ip must be preceded by PACKET_HEADROOM +
+ * ETH_HDR_LEN bytes the router may write to.  Nothing is queued: if next_hop's
+ * MAC is not known the packet is dropped, and an ARP request for it is sent
+ * unless one is outstanding or next_hop has stopped answering (see
+ * arp_want_request()).  A packet sent shortly before next_hop's entry expires
+ * asks for it again, so a next hop in use stays resolved.
+ *
+ * @return 0 on success, otherwise -1
+ */
+int router_output_ip( router_t* router, byte* ip /* borrowed */, unsigned len,
+                      addr_ip_t next_hop, interface_t* intf );
+
+/**
+ * Sends a packet the router originates: an IP header of protocol proto from
+ * src to dst with TTL ttl is written in front of payload (len bytes), which
+ * must be preceded by ROUTER_SEND_HEADROOM bytes the router may write to.  If
+ * intf is NULL the packet is routed through the FIB; otherwise dst must be on
+ * intf's link (or a broadcast or multicast address) and it is sent out intf.
+ * As with router_output_ip(), the packet is sent before this returns or not at
+ * all.
+ *
+ * @return 0 on success, otherwise -1
+ */
+int router_send_ip( router_t* router, byte* payload /* borrowed */, unsigned len,
+                    byte proto, byte ttl, addr_ip_t src, addr_ip_t dst,
+                    interface_t* intf );
+
+/**
+ * Handles a PWOSPF LSU, LSU bundle or LSACK from neighbor nbr_id: pkt points
+ * to the PWOSPF header and len is the length of the PWOSPF packet.  New LSUs
+ * are queued for flooding to the other neighbors.  If one changes the
+ * topology, an incremental SPF run is scheduled; changes arriving before it is
+ * made are folded into it.
+ */
+void router_handle_lsu( router_t* router, uint32_t nbr_id, const byte* pkt /* borrowed */,
+                        unsigned len, uint64_t now_ms );
+
+/**
+ * Drops the neighbors whose dead interval expired by now_ms or whose BFD
+ * session went Down, sends the hellos and BFD packets which are due (hellos
+ * only if use_ospf is set), originates an LSU if the neighbors changed or
+ * PWOSPF_LSU_INT passed since the last, removes the LSDB entries of other
+ * routers which were not refreshed within PWOSPF_LSU_TIMEOUT (scheduling SPF),
+ * makes the scheduled SPF run if its hold-down timer (and any restart grace
+ * period) expired, sends the flooding which is due, and saves the snapshot if
+ * it is due.  The caller must hold ospf_lock.
+ *
+ * @return ms until there is more to do, or -1 if nothing is pending
+ */
+int64_t router_ospf_timer( router_t* router, uint64_t now_ms );
+
+/**
+ * Restores the FIB, LSDB, neighbors and ARP cache from the router's snapshot,
+ * if it has one which was saved with the same router ID.  The routes are used
+ * straight away, to the restored next hops' MACs, but marked stale: SPF is
+ * held off for a grace period in which the neighbors resend their hellos and
+ * LSUs, and routes it does not set again then are removed.  Must be called
+ * once the interfaces have been added.
+ *
+ * @return TRUE if the snapshot was restored
+ */
+bool router_restore( router_t* router, uint64_t now_ms );
+
+/** Returns the time in ms of the monotonic clock the PWOSPF timers use. */
+uint64_t router_now_ms();
+
+/**
+ * Handles a hello received on intf at now_ms from router_id, whose address on
+ * the link is ip.  A new neighbor is added to intf and to the routers LSUs are
+ * flooded to, a BFD session is started with it, and an LSU is scheduled;
+ * either way the neighbor's dead interval restarts.
+ */
+void router_handle_hello( router_t* router, interface_t* intf,
+                          uint32_t router_id, addr_ip_t ip, uint64_t now_ms );
+
+/**
+ * Handles the BFD control packet pkt (the UDP payload, len bytes) received on
+ * intf at now_ms from src.  Only takes the BFD lock, so it may be called as
+ * packets arrive; if the packet takes a session Down, the PWOSPF timer thread
+ * is woken to remove the neighbor.
+ */
+void router_handle_bfd( router_t* router, interface_t* intf, addr_ip_t src,
+                        const byte* pkt /* borrowed */, unsigned len, uint64_t now_ms );
+
+/** Removes neighbor router_id from intf and schedules an LSU. */
+void router_remove_neighbor( router_t* router, interface_t* intf,
+                             uint32_t router_id );
+
 /**
  * Adds an interface to the router.  Not thread-safe.  Should only be used
  * during the initialization phase.  The interface will be enabled by default.
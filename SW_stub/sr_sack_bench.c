@@ -0,0 +1,501 @@
+/*
+ * Filename: sr_sack_bench.c
+ * Purpose: Measures the goodput of a bulk transfer between two lwtcp
+ *          connections over a lossy virtual link, with and without SACK.
+ *
+ * As in tcp_bench, the client and server are both ends of one lwtcp stack,
+ * joined by a link with a rate, a one-way delay and an MTU which delivers
+ * packets on a virtual clock that also drives the TCP timers.  Here the link
+ * drops each packet, either way, with a given probability, drawn from a
+ * generator seeded alike for every run.  Each loss rate is run with both ends
+ * agreeing to selective acknowledgements (RFC 2018), when loss recovery is
+ * driven by the SACK scoreboard, and with the client not offering them, when
+ * each loss costs a fast retransmit of its own or a retransmission timeout.
+ * The goodput (in virtual time) and the segments retransmitted are reported
+ * for each.
+ *
+ * Every byte must arrive intact, SACK must be agreed to exactly when it is
+ * offered, nothing may be retransmitted on a lossless link, three segments
+ * dropped from one window must be repaired by three retransmissions and no
+ * timeout, and SACK must be no slower than going without at any loss rate.
+ * Once every connection is gone the stack must hold no more memory than it
+ * started with.
+ *
+ * Usage: sack_bench [-b bytes_per_transfer] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <net/ethernet.h>
+#include "sr_common.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "lwip/pbuf.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+#include "lwip/tcp.h"
+#include "lwtcp_sr_integration.h"
+
+#define CLIENT_IP   0x0a000001
+#define SERVER_IP   0x0a000002
+#define SERVER_PORT 23
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC   1000000ULL
+
+/** the link: a management link of modest rate */
+#define LINK_RATE   10000000ULL
+#define LINK_DELAY  (20 * NSEC_PER_MSEC)
+#define LINK_MTU    1500
+
+/** a transfer which makes no progress for this long has stalled */
+#define STALL_NSEC (600 * NSEC_PER_SEC)
+
+/** the most packets from the client the link can be told to drop */
+#define MAX_DROPS   8
+
+/** a packet crossing the link */
+typedef struct pkt_t {
+    struct pkt_t* next;
+    uint64_t      arrive;       /* virtual time it reaches the far end */
+    byte*         buf;          /* the frame, as the router receives it */
+    uint16_t      len;          /* of the IP packet after the link header */
+} pkt_t;
+
+/** a full duplex point-to-point link between the client and server */
+typedef struct link_t {
+    uint64_t    idle_at[2];     /* when each end's transmitter is next idle */
+    pkt_t*      head;           /* packets in flight, by arrival time */
+    uint32_t    loss;           /* packets dropped per million, each way */
+    uint32_t    rand;           /* state of the generator deciding drops */
+    unsigned    sent[2];        /* packets sent by each end */
+    unsigned    dropped;        /* packets lost, either way */
+    unsigned    drop[MAX_DROPS];/* numbers of packets from the client to lose */
+    unsigned    ndrops;
+} link_t;
+
+/** the state of one bulk transfer */
+typedef struct flow_t {
+    struct tcp_pcb* client;
+    struct tcp_pcb* server;
+    bool            connected;
+    bool            sack;       /* whether both ends agreed to SACK */
+    uint32_t        total, sent, received;
+    uint64_t        start, done;
+    unsigned        corrupt;
+} flow_t;
+
+/** what a transfer came to */
+typedef struct result_t {
+    double      mbps;
+    unsigned    rexmit;
+} result_t;
+
+static link_t vlink;
+static uint64_t now;
+static struct netif netif;
+
+/* -- the stack's hooks into the router, here the virtual link -- */
+
+uint32_t ip_route( struct ip_addr* dest ) {
+    return htonl( ntohl( dest->addr ) == SERVER_IP ? CLIENT_IP : SERVER_IP );
+}
+
+uint16_t ip_route_mtu( struct ip_addr* dest ) {
+    return LINK_MTU;
+}
+
+/** The bench calls tcp_tmr() itself, every TCP_TMR_INTERVAL of link time. */
+void tcp_timer_needed( void ) {
+}
+
+/** Returns the next number from the link's generator (xorshift). */
+static uint32_t link_rand() {
+    vlink.rand ^= vlink.rand << 13;
+    vlink.rand ^= vlink.rand >> 17;
+    vlink.rand ^= vlink.rand << 5;
+    return vlink.rand;
+}
+
+/** Decides whether the link loses the next packet sent by end. */
+static bool link_drops( unsigned end ) {
+    unsigned i;
+
+    vlink.sent[end] += 1;
+    if( end == 0 )
+        for( i=0; i<vlink.ndrops; i++ )
+            if( vlink.drop[i] == vlink.sent[end] )
+                return TRUE;
+    return vlink.loss && link_rand() % 1000000 < vlink.loss;
+}
+
+/**
+ * Puts an IP packet around a segment and sends it across the link, which
+ * may lose it once it is serialized.
+ */
+err_t sr_lwip_output( struct pbuf* p, struct ip_addr* src, struct ip_addr* dst,
+                      uint8_t proto ) {
+    struct ip_hdr* iphdr;
+    struct pbuf* r;
+    pkt_t *pkt, **pp;
+    uint16_t len, off;
+    unsigned end;
+
+    len = IP_HLEN + p->tot_len;
+
+    /* serialized after whatever this end is still sending */
+    end = (ntohl( src->addr ) == SERVER_IP);
+    if( vlink.idle_at[end] < now )
+        vlink.idle_at[end] = now;
+    vlink.idle_at[end] += len * 8ULL * NSEC_PER_SEC / LINK_RATE;
+    if( link_drops( end ) ) {
+        vlink.dropped += 1;
+        return ERR_OK;
+    }
+
+    pkt = malloc_or_die( sizeof(*pkt) );
+    pkt->buf = malloc_or_die( ETHER_HDR_LEN + len );
+    pkt->len = len;
+    iphdr = (struct ip_hdr*)(pkt->buf + ETHER_HDR_LEN);
+    memset( iphdr, 0, IP_HLEN );
+    IPH_VHLTOS_SET( iphdr, 4, IP_HLEN / 4, 0 );
+    IPH_LEN_SET( iphdr, htons( len ) );
+    IPH_TTL_SET( iphdr, 64 );
+    IPH_PROTO_SET( iphdr, proto );
+    iphdr->src = *src;
+    iphdr->dest = *dst;
+    off = IP_HLEN;
+    for( r=p; r!=NULL; r=r->next ) {
+        memcpy( (byte*)iphdr + off, r->payload, r->len );
+        off += r->len;
+    }
+
+    pkt->arrive = vlink.idle_at[end] + LINK_DELAY;
+    for( pp=&vlink.head; *pp!=NULL && (*pp)->arrive <= pkt->arrive; pp=&(*pp)->next );
+    pkt->next = *pp;
+    *pp = pkt;
+    return ERR_OK;
+}
+
+/**
+ * Delivers the next packet across the link, handing it to lwtcp in the
+ * frame it arrived in as sr_transport_input() does.
+ */
+static void link_deliver() {
+    pkt_t* pkt = vlink.head;
+    struct pbuf* p;
+
+    vlink.head = pkt->next;
+    now = pkt->arrive;
+    p = pbuf_alloc_ref( pkt->buf, pkt->buf + ETHER_HDR_LEN, pkt->len, free, pkt->buf );
+    true_or_die( p != NULL, "Error: out of memory for a packet on the link" );
+    tcp_input( p, &netif );
+    free( pkt );
+}
+
+/* -- the applications at either end -- */
+
+/** the byte at offset off of a transfer */
+static byte pattern( uint32_t off ) {
+    return (byte)(off ^ (off >> 8) ^ (off >> 16));
+}
+
+/** Writes as much of the transfer as the client's send buffer takes. */
+static void client_pump( flow_t* f ) {
+    static byte buf[0xffff];
+    uint32_t n, i;
+
+    if( !f->connected || f->client == NULL )
+        return;
+
+    while( f->sent < f->total && tcp_sndbuf( f->client ) > 0 ) {
+        n = f->total - f->sent;
+        if( n > tcp_sndbuf( f->client ) )
+            n = tcp_sndbuf( f->client );
+        if( n > sizeof(buf) )
+            n = sizeof(buf);
+        for( i=0; i<n; i++ )
+            buf[i] = pattern( f->sent + i );
+        if( tcp_write( f->client, buf, n, 1 ) != ERR_OK )
+            break;
+        f->sent += n;
+    }
+    tcp_output( f->client );
+}
+
+static err_t client_connected( void* arg, struct tcp_pcb* pcb, err_t err ) {
+    flow_t* f = arg;
+
+    f->connected = (err == ERR_OK);
+    return ERR_OK;
+}
+
+static void client_err( void* arg, err_t err ) {
+    ((flow_t*)arg)->client = NULL;
+}
+
+static err_t server_recv( void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err ) {
+    flow_t* f = arg;
+    struct pbuf* q;
+    uint16_t i;
+
+    if( p == NULL )
+        return ERR_OK;
+
+    for( q=p; q!=NULL; q=q->next ) {
+        for( i=0; i<q->len; i++ )
+            if( ((byte*)q->payload)[i] != pattern( f->received + i ) )
+                f->corrupt += 1;
+        f->received += q->len;
+    }
+    tcp_recved( pcb, p->tot_len );
+    pbuf_free( p );
+
+    if( f->received >= f->total && f->done == 0 )
+        f->done = now;
+    return ERR_OK;
+}
+
+static void server_err( void* arg, err_t err ) {
+    ((flow_t*)arg)->server = NULL;
+}
+
+static err_t server_accept( void* arg, struct tcp_pcb* pcb, err_t err ) {
+    flow_t* f = arg;
+
+    f->server = pcb;
+    tcp_arg( pcb, f );
+    tcp_recv( pcb, server_recv );
+    tcp_err( pcb, server_err );
+    return ERR_OK;
+}
+
+/* -- the benchmark -- */
+
+/**
+ * Runs a transfer of total bytes over the link as it is set up, with SACK
+ * offered by the client or not, puts what it came to in *res, and returns
+ * the number of checks which failed.
+ */
+static unsigned run( struct tcp_pcb* listener, bool sack, uint32_t total,
+                     result_t* res ) {
+    static uint16_t port = 4096;
+    struct ip_addr client_ip, server_ip;
+    uint32_t rexmit, last_received;
+    uint64_t next_tick, last_progress;
+    unsigned failures = 0;
+    flow_t f;
+
+    memset( &f, 0, sizeof(f) );
+    memset( res, 0, sizeof(*res) );
+    f.total = total;
+    vlink.sent[0] = vlink.sent[1] = 0;
+    vlink.dropped = 0;
+    rexmit = stats.tcp.rexmit;
+    tcp_arg( listener, &f );
+
+    client_ip.addr = htonl( CLIENT_IP );
+    server_ip.addr = htonl( SERVER_IP );
+    f.client = tcp_new();
+    true_or_die( f.client != NULL, "Error: no PCB for the client" );
+    tcp_arg( f.client, &f );
+    tcp_err( f.client, client_err );
+    tcp_setsack( f.client, sack );
+    true_or_die( tcp_bind( f.client, &client_ip, ++port ) == ERR_OK,
+                 "Error: could not bind the client" );
+    f.start = now;
+    tcp_connect( f.client, &server_ip, SERVER_PORT, client_connected );
+
+    /* run the link and the timers until the last byte is in */
+    next_tick = now + TCP_TMR_INTERVAL * NSEC_PER_MSEC;
+    last_received = 0;
+    last_progress = now;
+    while( f.done == 0 && f.client != NULL ) {
+        if( vlink.head != NULL && vlink.head->arrive <= next_tick )
+            link_deliver();
+        else {
+            now = next_tick;
+            next_tick += TCP_TMR_INTERVAL * NSEC_PER_MSEC;
+            tcp_tmr();
+        }
+        client_pump( &f );
+
+        if( f.received != last_received ) {
+            last_received = f.received;
+            last_progress = now;
+        }
+        else if( now - last_progress > STALL_NSEC )
+            break;
+    }
+    res->rexmit = (uint16_t)(stats.tcp.rexmit - rexmit);
+
+    if( f.done == 0 ) {
+        fprintf( stderr, "    stalled after %u of %u bytes\n", f.received, f.total );
+        failures += 1;
+    }
+    else if( f.client == NULL || f.server == NULL ) {
+        fprintf( stderr, "    connection lost\n" );
+        failures += 1;
+    }
+    else {
+        res->mbps = f.total * 8.0 * NSEC_PER_SEC / (f.done - f.start) / 1e6;
+        if( !(f.client->flags & TF_SACK) != !sack || !(f.server->flags & TF_SACK) != !sack ) {
+            fprintf( stderr, "    SACK %s when it was %s\n",
+                     (f.client->flags & TF_SACK) ? "agreed to" : "not agreed to",
+                     sack ? "offered" : "not offered" );
+            failures += 1;
+        }
+    }
+    if( f.corrupt ) {
+        fprintf( stderr, "    %u bytes arrived corrupt\n", f.corrupt );
+        failures += 1;
+    }
+
+    /* tear both ends down and let the resets cross the link */
+    vlink.loss = 0;
+    vlink.ndrops = 0;
+    if( f.server != NULL )
+        tcp_abort( f.server );
+    if( f.client != NULL )
+        tcp_abort( f.client );
+    while( vlink.head != NULL )
+        link_deliver();
+    return failures;
+}
+
+/** loss rates run, in packets per million */
+static const uint32_t LOSSES[] = { 1000, 5000, 10000, 20000, 50000 };
+#define NUM_LOSSES (sizeof(LOSSES) / sizeof(LOSSES[0]))
+
+/** arguments and results of the thread which runs the transfers */
+typedef struct bench_t {
+    uint32_t total;
+    uint32_t seed;
+    result_t res[NUM_LOSSES][2];
+    unsigned failures;
+} bench_t;
+
+/**
+ * Runs every transfer.  This is done on a thread of its own so that when it
+ * exits, the stack's per-thread caches go back to the pools and the heap
+ * before they are checked.
+ */
+static void* bench_thread( void* arg ) {
+    bench_t* b = arg;
+    struct tcp_pcb* listener;
+    struct ip_addr server_ip;
+    result_t res;
+    unsigned i, s;
+
+    sys_thread_init();
+    server_ip.addr = htonl( SERVER_IP );
+    listener = tcp_new();
+    true_or_die( listener != NULL && tcp_bind( listener, &server_ip, SERVER_PORT ) == ERR_OK,
+                 "Error: could not bind the server" );
+    listener = tcp_listen( listener );
+    tcp_accept( listener, server_accept );
+
+    /* a lossless link needs nothing sent twice */
+    for( s=0; s<2; s++ ) {
+        b->failures += run( listener, !s, b->total, &res );
+        printf( "  no loss %-14s %7.2f Mb/s  %5u retransmitted\n",
+                s ? "without SACK:" : "with SACK:", res.mbps, res.rexmit );
+        if( res.rexmit != 0 ) {
+            fprintf( stderr, "    segments retransmitted on a lossless link\n" );
+            b->failures += 1;
+        }
+    }
+
+    /* three losses in one window, once the window has opened, are each
+       retransmitted once from the scoreboard, before any timeout */
+    for( s=0; s<2; s++ ) {
+        vlink.drop[0] = 200;
+        vlink.drop[1] = 203;
+        vlink.drop[2] = 206;
+        vlink.ndrops = 3;
+        b->failures += run( listener, !s, b->total, &res );
+        printf( "  3 in a window %-8s %7.2f Mb/s  %5u retransmitted\n",
+                s ? "without:" : "with:", res.mbps, res.rexmit );
+        if( !s && res.rexmit != 3 ) {
+            fprintf( stderr, "    %u segments retransmitted for 3 lost\n", res.rexmit );
+            b->failures += 1;
+        }
+    }
+
+    for( i=0; i<NUM_LOSSES; i++ )
+        for( s=0; s<2; s++ ) {
+            vlink.loss = LOSSES[i];
+            vlink.rand = b->seed + i;
+            b->failures += run( listener, !s, b->total, &b->res[i][s] );
+            printf( "  %4.1f%% loss %-11s %7.2f Mb/s  %5u retransmitted  %4u packets lost\n",
+                    LOSSES[i] / 10000.0, s ? "without:" : "with SACK:",
+                    b->res[i][s].mbps, b->res[i][s].rexmit, vlink.dropped );
+        }
+
+    tcp_close( listener );
+    return NULL;
+}
+
+int main( int argc, char** argv ) {
+    pthread_t thread;
+    uint32_t heap;
+    bench_t b;
+    unsigned i;
+    int c;
+
+    memset( &b, 0, sizeof(b) );
+    b.total = 1 << 20;
+    b.seed = 1;
+    while( (c = getopt( argc, argv, "b:s:" )) != EOF ) {
+        switch( c ) {
+        case 'b': b.total = atoi( optarg ); break;
+        case 's': b.seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-b bytes_per_transfer] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( b.total >= 1, "Error: need at least one byte per transfer" );
+    true_or_die( b.seed != 0, "Error: the seed may not be 0" );
+
+    stats_init();
+    sys_init();
+    mem_init();
+    memp_init();
+    pbuf_init();
+    tcp_init();
+    netif.netmask.addr = htonl( 0xffffff00 );
+    heap = stats.mem.used;
+
+    printf( "%u bytes per transfer, %u Mb/s link, %u ms RTT\n", b.total,
+            (unsigned)(LINK_RATE / 1000000), (unsigned)(2 * LINK_DELAY / NSEC_PER_MSEC) );
+    true_or_die( pthread_create( &thread, NULL, bench_thread, &b ) == 0,
+                 "Error: pthread_create failed" );
+    pthread_join( thread, NULL );
+
+    /* SACK must pay for itself at every loss rate */
+    for( i=0; i<NUM_LOSSES; i++ )
+        if( b.res[i][0].mbps < b.res[i][1].mbps ) {
+            fprintf( stderr, "SACK is slower than going without at %.1f%% loss\n",
+                     LOSSES[i] / 10000.0 );
+            b.failures += 1;
+        }
+
+    if( stats.mem.used != heap ) {
+        fprintf( stderr, "%u more bytes of the heap in use than before\n",
+                 (unsigned)(stats.mem.used - heap) );
+        b.failures += 1;
+    }
+    for( i=0; i<MEMP_MAX; i++ )
+        if( stats.memp[i].used != 0 ) {
+            fprintf( stderr, "%u elements of pool %u still in use\n",
+                     (unsigned)stats.memp[i].used, i );
+            b.failures += 1;
+        }
+
+    printf( "%s (%u failures)\n", b.failures ? "FAILED" : "PASSED", b.failures );
+    return b.failures ? 1 : 0;
+}
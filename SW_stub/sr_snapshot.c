@@ -0,0 +1,242 @@
+/* Filename: sr_snapshot.c */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sr_snapshot.h"
+
+/**
+ * Returns the Fletcher-style checksum of the len bytes (a multiple of 4) at
+ * buf: quick enough to run over a large table on every save and load.
+ */
+static uint32_t snapshot_checksum( const void* buf, unsigned len ) {
+    const uint32_t* w = (const uint32_t*)buf;
+    uint64_t a = 1, b = 0;
+    unsigned i;
+
+    for( i=0; i<len/4; i++ ) {
+        a += w[i];
+        b += a;
+    }
+    a = (a & 0xFFFFFFFF) + (a >> 32);
+    b = (b & 0xFFFFFFFF) + (b >> 32);
+    return (uint32_t)(a ^ (b << 16) ^ (b >> 16));
+}
+
+/** Sets the record pointers of snap from its header. */
+static void snapshot_layout( snapshot_t* snap ) {
+    const byte* p = (const byte*)snap->map + sizeof(snapshot_hdr_t);
+
+    snap->hdr = (const snapshot_hdr_t*)snap->map;
+    snap->route = (const snapshot_route_t*)p;
+    p += snap->hdr->num_routes * sizeof(*snap->route);
+    snap->lsdb = (const snapshot_lsdb_t*)p;
+    p += snap->hdr->num_lsdb * sizeof(*snap->lsdb);
+    snap->link = (const lsdb_link_t*)p;
+    p += snap->hdr->num_links * sizeof(*snap->link);
+    snap->nbr = (const snapshot_nbr_t*)p;
+    p += snap->hdr->num_nbrs * sizeof(*snap->nbr);
+    snap->arp = (const snapshot_arp_t*)p;
+}
+
+/** Returns the length of a snapshot with the counts in hdr. */
+static uint64_t snapshot_length( const snapshot_hdr_t* hdr ) {
+    return sizeof(*hdr)
+        + (uint64_t)hdr->num_routes * sizeof(snapshot_route_t)
+        + (uint64_t)hdr->num_lsdb * sizeof(snapshot_lsdb_t)
+        + (uint64_t)hdr->num_links * sizeof(lsdb_link_t)
+        + (uint64_t)hdr->num_nbrs * sizeof(snapshot_nbr_t)
+        + (uint64_t)hdr->num_arp * sizeof(snapshot_arp_t);
+}
+
+int snapshot_save( const char* path, uint32_t router_id, fib_t* fib,
+                   lsdb_t* lsdb, nbr_table_t* const* nbrs, unsigned num_ifaces,
+                   arp_t* arp, uint64_t now_ms ) {
+    snapshot_hdr_t hdr;
+    snapshot_t snap;
+    snapshot_hdr_t* h;
+    snapshot_route_t* r;
+    snapshot_lsdb_t* l;
+    lsdb_link_t* k;
+    snapshot_nbr_t* n;
+    snapshot_arp_t* a;
+    arp_entry_t* ae;
+    lsdb_entry_t* e;
+    neighbor_t* nbr;
+    fib_table_t* t;
+    fib_group_t* g;
+    char* tmp;
+    unsigned i, j;
+    int fd, err;
+
+    memset( &hdr, 0, sizeof(hdr) );
+    hdr.magic = SNAPSHOT_MAGIC;
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.router_id = router_id;
+    hdr.num_routes = fib->num_routes;
+    hdr.num_lsdb = lsdb->num_entries;
+    hdr.num_links = lsdb->num_links;
+    for( i=0; i<num_ifaces; i++ )
+        hdr.num_nbrs += nbrs[i]->num_neighbors;
+    for( i=0; i<arp->num_buckets; i++ )
+        for( ae=arp->bucket[i]; ae; ae=ae->next )
+            if( ae->is_static || now_ms < ae->expires_ms )
+                hdr.num_arp += 1;
+    hdr.saved_s = time( NULL );
+    hdr.length = snapshot_length( &hdr );
+
+    /* written beside the snapshot and renamed over it once complete */
+    tmp = malloc_or_die( strlen(path) + 5 );
+    sprintf( tmp, "%s.tmp", path );
+    fd = open( tmp, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 ) {
+        free( tmp );
+        return -1;
+    }
+    if( ftruncate( fd, hdr.length ) != 0 )
+        goto fail;
+    snap.map = mmap( NULL, hdr.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( snap.map == MAP_FAILED )
+        goto fail;
+    snap.len = hdr.length;
+
+    h = (snapshot_hdr_t*)snap.map;
+    *h = hdr;
+    snapshot_layout( &snap );
+
+    r = (snapshot_route_t*)snap.route;
+    for( i=0; i<=32; i++ ) {
+        t = &fib->table[i];
+        for( j=0; j<t->size; j++ ) {
+            if( !(g = t->entry[j].group) )
+                continue;
+            r->subnet = t->entry[j].subnet;
+            r->mask = i ? htonl( 0xFFFFFFFF << (32 - i) ) : 0;
+            r->num_hops = g->num_hops;
+            memcpy( r->hop, g->hop, sizeof(r->hop) );
+            r += 1;
+        }
+    }
+
+    l = (snapshot_lsdb_t*)snap.lsdb;
+    k = (lsdb_link_t*)snap.link;
+    for( i=0; i<lsdb->num_buckets; i++ ) {
+        for( e=lsdb->bucket[i]; e; e=e->next ) {
+            l->router_id = e->router_id;
+            l->seq = e->seq;
+            l->num_links = e->num_links;
+            memcpy( k, e->links, e->num_links * sizeof(*k) );
+            k += e->num_links;
+            l += 1;
+        }
+    }
+
+    n = (snapshot_nbr_t*)snap.nbr;
+    for( i=0; i<num_ifaces; i++ ) {
+        for( j=0; j<nbrs[i]->num_buckets; j++ ) {
+            for( nbr=nbrs[i]->bucket[j]; nbr; nbr=nbr->next ) {
+                n->router_id = nbr->router_id;
+                n->ip = nbr->ip;
+                n->iface = i;
+                n += 1;
+            }
+        }
+    }
+
+    a = (snapshot_arp_t*)snap.arp;
+    for( i=0; i<arp->num_buckets; i++ ) {
+        for( ae=arp->bucket[i]; ae; ae=ae->next ) {
+            if( !ae->is_static && now_ms >= ae->expires_ms )
+                continue;
+            a->ip = ae->ip;
+            a->mac = ae->mac;
+            a->is_static = ae->is_static;
+            a->ttl_ms = ae->is_static ? 0 : ae->expires_ms - now_ms;
+            a += 1;
+        }
+    }
+
+    h->checksum = snapshot_checksum( snap.map, snap.len );
+    munmap( snap.map, snap.len );
+    if( close( fd ) != 0 || rename( tmp, path ) != 0 ) {
+        err = errno;
+        unlink( tmp );
+        free( tmp );
+        errno = err;
+        return -1;
+    }
+    free( tmp );
+    return 0;
+
+ fail:
+    err = errno;
+    close( fd );
+    unlink( tmp );
+    free( tmp );
+    errno = err;
+    return -1;
+}
+
+bool snapshot_open( snapshot_t* snap, const char* path ) {
+    snapshot_hdr_t* hdr;
+    struct stat st;
+    uint32_t sum;
+    int fd;
+
+    memset( snap, 0, sizeof(*snap) );
+    fd = open( path, O_RDONLY );
+    if( fd < 0 )
+        return FALSE;
+    if( fstat( fd, &st ) != 0 || st.st_size < (off_t)sizeof(*hdr) ) {
+        close( fd );
+        return FALSE;
+    }
+
+    /* a private mapping so that the checksum field may be zeroed to check it */
+    snap->map = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( snap->map == MAP_FAILED ) {
+        snap->map = NULL;
+        return FALSE;
+    }
+    snap->len = st.st_size;
+
+    hdr = (snapshot_hdr_t*)snap->map;
+    if( hdr->magic != SNAPSHOT_MAGIC || hdr->version != SNAPSHOT_VERSION
+        || hdr->length != snap->len || snapshot_length( hdr ) != snap->len ) {
+        snapshot_close( snap );
+        return FALSE;
+    }
+
+    sum = hdr->checksum;
+    hdr->checksum = 0;
+    if( snapshot_checksum( snap->map, snap->len ) != sum ) {
+        snapshot_close( snap );
+        return FALSE;
+    }
+    hdr->checksum = sum;
+
+    snapshot_layout( snap );
+    return TRUE;
+}
+
+uint64_t snapshot_age_ms( const snapshot_t* snap ) {
+    time_t now = time( NULL );
+
+    if( now <= (time_t)snap->hdr->saved_s )
+        return 0;
+    return (uint64_t)(now - snap->hdr->saved_s) * 1000;
+}
+
+void snapshot_close( snapshot_t* snap ) {
+    if( snap->map )
+        munmap( snap->map, snap->len );
+    memset( snap, 0, sizeof(*snap) );
+}
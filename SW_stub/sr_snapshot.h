@@ -0,0 +1,120 @@
+/*
+ * Filename: sr_snapshot.h
+ * Purpose: Snapshot of the router's forwarding and PWOSPF state for restarts.
+ *
+ * A restarted router has to relearn its neighbors from hellos and its link
+ * state database from their LSUs before SPF can fill the forwarding table, and
+ * until then it drops everything it should forward.  The router therefore
+ * writes its FIB, LSDB, neighbors and ARP cache to a snapshot file every so
+ * often, and a new process maps the file and reloads it on startup: packets are
+ * forwarded over the old routes, to the next hops' known MACs, straight away
+ * while the protocol catches up, with the restored routes marked stale until
+ * SPF sets them again (see fib_mark_stale()).  Learned ARP entries keep the
+ * time they had left, less the time the router was down.
+ *
+ * The file is a header followed by fixed-size records, written into a mapping
+ * of a temporary file which is then renamed over the snapshot, so a reader
+ * never sees a partly written one.  A checksum over the whole file guards
+ * against one left truncated or corrupt by a crash.  The records are in host
+ * byte order (as the addresses in them are in network byte order): a snapshot
+ * is only read back on the machine which wrote it.
+ */
+
+#ifndef SR_SNAPSHOT_H
+#define SR_SNAPSHOT_H
+
+#include "sr_arp.h"
+#include "sr_common.h"
+#include "sr_fib.h"
+#include "sr_pwospf_lsdb.h"
+#include "sr_pwospf_nbr.h"
+
+#define SNAPSHOT_MAGIC   0x50414e53 /* "SNAP" */
+#define SNAPSHOT_VERSION 2
+
+/** start of the file; the records follow in the order of the counts */
+typedef struct snapshot_hdr_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t length;        /* of the whole file */
+    uint32_t checksum;      /* of the whole file, with this field 0 */
+    uint32_t router_id;
+    uint32_t num_routes;
+    uint32_t num_lsdb;
+    uint32_t num_links;     /* summed over the LSDB entries */
+    uint32_t num_nbrs;
+    uint32_t num_arp;
+    uint32_t saved_s;       /* wall clock time (time()) it was saved at */
+} snapshot_hdr_t;
+
+/** a route */
+typedef struct snapshot_route_t {
+    addr_ip_t subnet;
+    addr_ip_t mask;
+    uint32_t  num_hops;
+    fib_hop_t hop[FIB_MAX_PATHS];
+} snapshot_route_t;
+
+/** an LSDB entry; its links follow the previous entry's in the link records */
+typedef struct snapshot_lsdb_t {
+    uint32_t router_id;
+    uint32_t seq;
+    uint32_t num_links;
+} snapshot_lsdb_t;
+
+/** a neighbor */
+typedef struct snapshot_nbr_t {
+    uint32_t  router_id;
+    addr_ip_t ip;
+    uint32_t  iface;
+} snapshot_nbr_t;
+
+/** an ARP cache entry */
+typedef struct snapshot_arp_t {
+    addr_ip_t  ip;
+    addr_mac_t mac;
+    uint16_t   is_static;
+    uint32_t   ttl_ms;      /* learned entries: time it had left when saved */
+} snapshot_arp_t;
+
+/** a snapshot mapped for reading */
+typedef struct snapshot_t {
+    void*                   map;
+    unsigned                len;
+    const snapshot_hdr_t*   hdr;
+    const snapshot_route_t* route;
+    const snapshot_lsdb_t*  lsdb;
+    const lsdb_link_t*      link;
+    const snapshot_nbr_t*   nbr;
+    const snapshot_arp_t*   arp;
+} snapshot_t;
+
+/**
+ * Writes the routes in fib, the entries of lsdb, the neighbors in the
+ * num_ifaces tables nbrs points to (nbrs[i] for interface i), and the entries
+ * of arp which have not expired by now_ms to path, replacing it atomically.
+ *
+ * @return 0 on success, or -1 on failure (with errno set)
+ */
+int snapshot_save( const char* path, uint32_t router_id, fib_t* fib,
+                   lsdb_t* lsdb, nbr_table_t* const* nbrs, unsigned num_ifaces,
+                   arp_t* arp, uint64_t now_ms );
+
+/**
+ * Maps the snapshot in path and checks it is complete and intact.
+ *
+ * @return TRUE on success, or FALSE if there is no such file or it is not a
+ *         valid snapshot
+ */
+bool snapshot_open( snapshot_t* snap, const char* path );
+
+/**
+ * Returns the ms of wall clock time since snap was saved, to take off its
+ * learned ARP entries' time left (0 if the clock was set back).
+ */
+uint64_t snapshot_age_ms( const snapshot_t* snap );
+
+/** Unmaps a snapshot opened with snapshot_open(). */
+void snapshot_close( snapshot_t* snap );
+
+#endif /* SR_SNAPSHOT_H */
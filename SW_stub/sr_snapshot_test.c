@@ -0,0 +1,408 @@
+/*
+ * Filename: sr_snapshot_test.c
+ * Purpose: Checks the restart snapshot and the FIB's stale route sweep.
+ *
+ * A router's FIB of random routes, an LSDB, the neighbors on a few interfaces
+ * and an ARP cache are saved and loaded back into empty tables, which must then
+ * hold exactly what was saved: static ARP entries as they were, learned ones
+ * with the time they had left, and no learned ones which had expired.
+ * Snapshots with a flipped bit, cut short, or missing altogether must be
+ * refused.
+ *
+ * Then the restored routes are marked stale as on a restart, SPF's replacement
+ * sets a random part of them again, and the sweep must remove precisely the
+ * rest while lookups keep working throughout.  The time to save and to restore
+ * the table is reported.
+ *
+ * Usage: test_snapshot [-n routes] [-s seed] [-f file]
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_arp.h"
+#include "sr_common.h"
+#include "sr_fib.h"
+#include "sr_pwospf_lsdb.h"
+#include "sr_pwospf_nbr.h"
+#include "sr_snapshot.h"
+#include "sr_timer_wheel.h"
+
+/** interfaces with neighbors on them */
+#define NUM_IFACES 4
+
+/** routers in the LSDB and the most links each advertises */
+#define NUM_ROUTERS   64
+#define MAX_LINKS     6
+
+/** ARP entries, and the times they are saved and restored at */
+#define NUM_ARP       48
+#define SAVE_MS       100000
+#define RESTORE_MS    500
+
+/** a route which was saved */
+typedef struct ref_route_t {
+    addr_ip_t subnet, mask;
+    unsigned  num_hops;
+    fib_hop_t hop[FIB_MAX_PATHS];
+    bool      set_again;    /* by SPF after the restart */
+} ref_route_t;
+
+/** the state a router saves */
+typedef struct state_t {
+    fib_t         fib;
+    lsdb_t        lsdb;
+    timer_wheel_t wheel;
+    nbr_table_t   nbrs[NUM_IFACES];
+    nbr_table_t*  nbr_ptr[NUM_IFACES];
+    arp_t         arp;
+} state_t;
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t rand32() {
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static void state_init( state_t* s ) {
+    unsigned i;
+
+    fib_init( &s->fib, 1 );
+    lsdb_init( &s->lsdb );
+    tw_init( &s->wheel, 100, 0 );
+    for( i=0; i<NUM_IFACES; i++ ) {
+        nbr_table_init( &s->nbrs[i] );
+        s->nbr_ptr[i] = &s->nbrs[i];
+    }
+    arp_init( &s->arp );
+}
+
+static void state_destroy( state_t* s ) {
+    unsigned i;
+
+    for( i=0; i<NUM_IFACES; i++ )
+        nbr_table_destroy( &s->nbrs[i], &s->wheel );
+    arp_destroy( &s->arp );
+    lsdb_destroy( &s->lsdb );
+    fib_destroy( &s->fib );
+}
+
+/** Loads snap into s as the router does on a restart. */
+static void state_restore( state_t* s, const snapshot_t* snap ) {
+    const snapshot_lsdb_t* l;
+    const snapshot_arp_t* a;
+    const lsdb_link_t* k;
+    uint64_t age_ms = snapshot_age_ms( snap );
+    bool is_new;
+    unsigned i;
+
+    for( i=0; i<snap->hdr->num_routes; i++ )
+        fib_set( &s->fib, snap->route[i].subnet, snap->route[i].mask,
+                 snap->route[i].hop, snap->route[i].num_hops );
+    fib_mark_stale( &s->fib );
+
+    for( k=snap->link, i=0; i<snap->hdr->num_lsdb; k+=l->num_links, i++ ) {
+        l = &snap->lsdb[i];
+        lsdb_update( &s->lsdb, l->router_id, l->seq, k, l->num_links, 0, NULL, NULL );
+    }
+
+    for( i=0; i<snap->hdr->num_nbrs; i++ )
+        nbr_hello( &s->nbrs[snap->nbr[i].iface], &s->wheel, snap->nbr[i].iface,
+                   snap->nbr[i].router_id, snap->nbr[i].ip, 0, 30000, &is_new );
+
+    for( i=0; i<snap->hdr->num_arp; i++ ) {
+        a = &snap->arp[i];
+        if( a->is_static )
+            arp_add_static( &s->arp, a->ip, a->mac );
+        else if( a->ttl_ms > age_ms )
+            arp_learn_until( &s->arp, a->ip, a->mac, RESTORE_MS + a->ttl_ms - age_ms );
+    }
+}
+
+/**
+ * Returns the number of saved ARP entries (saved at SAVE_MS) which were not
+ * restored (at RESTORE_MS) as they should have been.
+ */
+static unsigned arp_compare( arp_t* saved, arp_t* loaded ) {
+    const arp_entry_t* l;
+    arp_entry_t* e;
+    unsigned i, bad = 0, num = 0;
+    uint64_t left;
+
+    for( i=0; i<saved->num_buckets; i++ ) {
+        for( e=saved->bucket[i]; e; e=e->next ) {
+            l = arp_lookup( loaded, e->ip, RESTORE_MS );
+            if( !e->is_static && e->expires_ms <= SAVE_MS ) {
+                bad += l != NULL;
+                continue;
+            }
+            num += 1;
+            if( !l || l->is_static != e->is_static
+                || memcmp( &l->mac, &e->mac, sizeof(e->mac) ) ) {
+                bad += 1;
+                continue;
+            }
+
+            /* less up to a second or two of wall clock time since the save */
+            left = e->expires_ms - SAVE_MS;
+            if( !e->is_static && (l->expires_ms > RESTORE_MS + left
+                                  || l->expires_ms + 2000 < RESTORE_MS + left) )
+                bad += 1;
+        }
+    }
+
+    return bad + (num != loaded->num_entries);
+}
+
+/** Returns the number of saved routes whose lookup in fib differs. */
+static unsigned routes_compare( fib_t* fib, ref_route_t* r, unsigned n, bool all ) {
+    const fib_group_t* g;
+    unsigned i, bad = 0;
+
+    for( i=0; i<n; i++ ) {
+        if( !all && !r[i].set_again )
+            continue;
+        g = fib_lookup( fib, r[i].subnet );
+        if( !g || g->num_hops != r[i].num_hops
+            || memcmp( g->hop, r[i].hop, r[i].num_hops * sizeof(fib_hop_t) ) )
+            bad += 1;
+    }
+
+    return bad;
+}
+
+/** Returns the number of differences between the LSDBs and neighbors. */
+static unsigned state_compare( state_t* a, state_t* b ) {
+    lsdb_entry_t *ea, *eb;
+    neighbor_t *na, *nb;
+    unsigned i, j, bad = 0;
+
+    if( a->lsdb.num_entries != b->lsdb.num_entries || a->lsdb.num_links != b->lsdb.num_links )
+        bad += 1;
+    for( i=0; i<a->lsdb.num_buckets; i++ ) {
+        for( ea=a->lsdb.bucket[i]; ea; ea=ea->next ) {
+            eb = lsdb_find( &b->lsdb, ea->router_id );
+            if( !eb || eb->seq != ea->seq || eb->num_links != ea->num_links
+                || memcmp( eb->links, ea->links, ea->num_links * sizeof(lsdb_link_t) ) )
+                bad += 1;
+        }
+    }
+
+    for( i=0; i<NUM_IFACES; i++ ) {
+        if( a->nbrs[i].num_neighbors != b->nbrs[i].num_neighbors )
+            bad += 1;
+        for( j=0; j<a->nbrs[i].num_buckets; j++ ) {
+            for( na=a->nbrs[i].bucket[j]; na; na=na->next ) {
+                nb = nbr_find( &b->nbrs[i], na->router_id );
+                if( !nb || nb->ip != na->ip || nb->iface != i )
+                    bad += 1;
+            }
+        }
+    }
+
+    return bad;
+}
+
+/** Returns TRUE if path is refused after its byte at offset is changed. */
+static bool corrupt_refused( const char* path, long offset ) {
+    snapshot_t snap;
+    FILE* f;
+    int c;
+
+    f = fopen( path, "r+b" );
+    fseek( f, offset, SEEK_SET );
+    c = fgetc( f );
+    fseek( f, offset, SEEK_SET );
+    fputc( c ^ 0x10, f );
+    fclose( f );
+
+    if( snapshot_open( &snap, path ) ) {
+        snapshot_close( &snap );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+int main( int argc, char** argv ) {
+    const char* path = "/tmp/test_snapshot.snap";
+    unsigned n = 100000, seed = 1, failures = 0;
+    state_t saved, loaded;
+    snapshot_t snap;
+    ref_route_t* r;
+    lsdb_link_t links[MAX_LINKS];
+    addr_mac_t mac;
+    uint64_t t0, save_ns, load_ns;
+    unsigned i, j, len, num_links, num_set = 0, swept;
+    bool is_new;
+    long size;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:s:f:" )) != EOF ) {
+        switch( c ) {
+        case 'n': n = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        case 'f': path = optarg; break;
+        default:
+            fprintf( stderr, "Usage: %s [-n routes] [-s seed] [-f file]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( n >= 1 && n <= (1 << 17), "Error: routes must be 1 to 131072" );
+    srand( seed );
+    state_init( &saved );
+
+    /* prefixes of 17 to 32 bits whose first 17 bits are the route's index,
+       so that no two are the same */
+    r = calloc_or_die( n, sizeof(*r) );
+    for( i=0; i<n; i++ ) {
+        len = 17 + rand() % 16;
+        r[i].mask = htonl( 0xFFFFFFFF << (32 - len) );
+        r[i].subnet = htonl( (i << 15) | (rand32() & 0x7FFF) ) & r[i].mask;
+        r[i].num_hops = 1 + rand() % 3;
+        for( j=0; j<r[i].num_hops; j++ ) {
+            r[i].hop[j].gw = htonl( 0x0A000001 + j );
+            r[i].hop[j].intf = j;
+        }
+        fib_set( &saved.fib, r[i].subnet, r[i].mask, r[i].hop, r[i].num_hops );
+    }
+
+    /* routers 1..NUM_ROUTERS with a few links each */
+    for( i=1; i<=NUM_ROUTERS; i++ ) {
+        num_links = 1 + rand() % MAX_LINKS;
+        for( j=0; j<num_links; j++ ) {
+            links[j].subnet = htonl( 0xC0A80000 | (i << 8) | (j << 2) );
+            links[j].mask = htonl( 0xFFFFFFFC );
+            links[j].router_id = rand() % 2 ? 1 + rand() % NUM_ROUTERS : 0;
+        }
+        lsdb_update( &saved.lsdb, i, rand() % 65536, links, num_links, 0, NULL, NULL );
+    }
+
+    /* a few neighbors on every interface */
+    for( i=0; i<NUM_IFACES; i++ )
+        for( j=0; j<=i; j++ )
+            nbr_hello( &saved.nbrs[i], &saved.wheel, i, 1 + i * NUM_IFACES + j,
+                       htonl( 0x0A010000 | (i << 8) | j ), 0, 30000, &is_new );
+
+    /* static and learned ARP entries, some of which have expired */
+    for( i=0; i<NUM_ARP; i++ ) {
+        mac = make_mac_addr( 0x02, 0, 0, 0, i >> 8, i );
+        if( i % 4 == 0 )
+            arp_add_static( &saved.arp, htonl( 0x0A020000 + i ), mac );
+        else
+            arp_learn( &saved.arp, htonl( 0x0A020000 + i ), mac,
+                       SAVE_MS - rand() % (ARP_TIMEOUT_MS * 5 / 4) );
+    }
+
+    /* save it and load it into a fresh router */
+    t0 = now_nsec();
+    if( snapshot_save( path, 0x01020304, &saved.fib, &saved.lsdb, saved.nbr_ptr,
+                       NUM_IFACES, &saved.arp, SAVE_MS ) != 0 ) {
+        perror( path );
+        return 1;
+    }
+    save_ns = now_nsec() - t0;
+
+    state_init( &loaded );
+    t0 = now_nsec();
+    if( !snapshot_open( &snap, path ) ) {
+        printf( "  the snapshot just saved was refused\n" );
+        return 1;
+    }
+    state_restore( &loaded, &snap );
+    load_ns = now_nsec() - t0;
+    size = snap.len;
+
+    if( snap.hdr->router_id != 0x01020304 || snap.hdr->num_routes != n
+        || loaded.fib.num_routes != n || loaded.fib.num_stale != n ) {
+        printf( "  restored %u of %u routes (%u stale) of router %08x\n",
+                loaded.fib.num_routes, n, loaded.fib.num_stale, snap.hdr->router_id );
+        failures += 1;
+    }
+    if( (j = routes_compare( &loaded.fib, r, n, TRUE )) ) {
+        printf( "  %u restored routes differ\n", j );
+        failures += 1;
+    }
+    if( (j = state_compare( &saved, &loaded )) ) {
+        printf( "  %u restored LSDB entries or neighbors differ\n", j );
+        failures += 1;
+    }
+    if( (j = arp_compare( &saved.arp, &loaded.arp )) ) {
+        printf( "  %u ARP entries were not restored as saved\n", j );
+        failures += 1;
+    }
+    snapshot_close( &snap );
+    printf( "Round trip: %u routes, %u LSDB entries, %u neighbors, %u ARP entries: %s\n",
+            n, loaded.lsdb.num_entries, saved.nbrs[0].num_neighbors
+            + saved.nbrs[1].num_neighbors + saved.nbrs[2].num_neighbors
+            + saved.nbrs[3].num_neighbors, loaded.arp.num_entries,
+            failures ? "FAILED" : "ok" );
+    printf( "  %ld bytes: save %.2fms, restore %.2fms\n", size,
+            save_ns / 1000000.0, load_ns / 1000000.0 );
+
+    /* SPF on the refreshed topology sets some of the routes again: the rest
+       must be forwarded over until the sweep, and then be gone */
+    j = failures;
+    for( i=0; i<n; i++ ) {
+        if( rand() % 3 ) {
+            r[i].set_again = TRUE;
+            num_set += 1;
+            fib_set( &loaded.fib, r[i].subnet, r[i].mask, r[i].hop, r[i].num_hops );
+        }
+    }
+    if( loaded.fib.num_stale != n - num_set || routes_compare( &loaded.fib, r, n, TRUE ) ) {
+        printf( "  %u stale routes before the sweep, expected %u\n",
+                loaded.fib.num_stale, n - num_set );
+        failures += 1;
+    }
+    swept = fib_sweep_stale( &loaded.fib );
+    if( swept != n - num_set || loaded.fib.num_routes != num_set
+        || loaded.fib.num_stale || routes_compare( &loaded.fib, r, n, FALSE ) ) {
+        printf( "  swept %u routes leaving %u, expected %u leaving %u\n",
+                swept, loaded.fib.num_routes, n - num_set, num_set );
+        failures += 1;
+    }
+    for( i=0; i<n; i++ ) {
+        if( !r[i].set_again && fib_lookup( &loaded.fib, r[i].subnet ) ) {
+            printf( "  swept route %u still matches\n", i );
+            failures += 1;
+            break;
+        }
+    }
+    printf( "Stale sweep: %u of %u routes set again: %s\n", num_set, n,
+            failures > j ? "FAILED" : "ok" );
+
+    /* damaged snapshots */
+    j = failures;
+    if( !corrupt_refused( path, size / 2 ) || !corrupt_refused( path, size - 1 ) ) {
+        printf( "  a corrupt snapshot was accepted\n" );
+        failures += 1;
+    }
+    snapshot_save( path, 0x01020304, &saved.fib, &saved.lsdb, saved.nbr_ptr, NUM_IFACES,
+                   &saved.arp, SAVE_MS );
+    true_or_die( truncate( path, size - sizeof(snapshot_arp_t) ) == 0, "Error: truncate failed" );
+    if( snapshot_open( &snap, path ) ) {
+        printf( "  a truncated snapshot was accepted\n" );
+        snapshot_close( &snap );
+        failures += 1;
+    }
+    unlink( path );
+    if( snapshot_open( &snap, path ) ) {
+        printf( "  a missing snapshot was opened\n" );
+        failures += 1;
+    }
+    printf( "Damaged snapshots: %s\n", failures > j ? "FAILED" : "ok" );
+
+    state_destroy( &loaded );
+    state_destroy( &saved );
+    free( r );
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
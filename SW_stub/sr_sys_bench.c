@@ -0,0 +1,256 @@
+/*
+ * Filename: sr_sys_bench.c
+ * Purpose: Measures how long lwtcp's sys layer takes to find the calling
+ *          thread's timeouts, with 1, 4, 16 and 64 threads using it.
+ *
+ * Each thread looks up its timeouts with sys_arch_timeouts(), which reads
+ * thread-local storage, and as it used to, by walking a list of every thread
+ * comparing pthread_self(); the cost of a lookup, in the thread's own CPU
+ * time, is reported for both.  Then each thread runs a timeout-heavy
+ * workload: it schedules timeouts with sys_timeout() and expires the earliest
+ * as sys_mbox_fetch() does whenever it has a few pending, and the cost of
+ * scheduling and expiring one is reported.
+ *
+ * No thread is registered with sys_thread_init(); the sys layer must register
+ * each the first time it asks for its timeouts and give each its own.  Every
+ * timeout expired must call its handler once, and half the threads exit with
+ * timeouts still pending: once every thread is gone, the timeout pool must
+ * have them all back.
+ *
+ * Usage: sys_bench [-n ops_per_thread] [-s seed]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+
+/** most threads run at once */
+#define MAX_THREADS 64
+
+/** timeouts a thread has pending before it expires the earliest */
+#define PENDING     2
+
+/** a thread as the sys layer used to find it, on a list of them all */
+typedef struct old_thread_t {
+    struct old_thread_t* next;
+    pthread_t pthread;
+} old_thread_t;
+
+/** a thread and what it measured */
+typedef struct worker_t {
+    pthread_t thread;
+    unsigned  id;
+    unsigned  ops;
+    uint32_t  rand;
+    struct sys_timeouts* timeouts;  /* its own, as sys_arch_timeouts() gave */
+    old_thread_t old;
+    double    tls_ns, list_ns, timeout_ns;
+    uint64_t  scheduled, fired, left;
+    unsigned  failures;
+} worker_t;
+
+static old_thread_t* old_threads;
+static pthread_mutex_t old_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t barrier;
+
+/** the calling thread's CPU time */
+static uint64_t cpu_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** xorshift */
+static uint32_t next_rand( uint32_t* r ) {
+    *r ^= *r << 13;
+    *r ^= *r >> 17;
+    *r ^= *r << 5;
+    return *r;
+}
+
+/** Finds the calling thread as current_thread() used to. */
+static old_thread_t* old_current_thread() {
+    old_thread_t* t;
+    pthread_t self = pthread_self();
+
+    for( t=old_threads; t!=NULL; t=t->next )
+        if( pthread_equal( t->pthread, self ) )
+            return t;
+    return NULL;
+}
+
+static void timeout_handler( void* arg ) {
+    ((worker_t*)arg)->fired += 1;
+}
+
+/** Expires the calling thread's earliest timeout as sys_mbox_fetch() does. */
+static void timeout_expire() {
+    struct sys_timeouts* timeouts;
+    struct sys_timeout* t;
+    sys_timeout_handler h;
+    void* arg;
+
+    timeouts = sys_arch_timeouts();
+    t = timeouts->next;
+    timeouts->next = t->next;
+    h = t->h;
+    arg = t->arg;
+    memp_free( MEMP_SYS_TIMEOUT, t );
+    h( arg );
+}
+
+static void* worker_main( void* arg ) {
+    worker_t* w = arg;
+    struct sys_timeouts* timeouts;
+    old_thread_t* t;
+    uint64_t t0;
+    unsigned i, pending;
+    uintptr_t sum = 0;
+
+    /* registered with the sys layer when it first asks for its timeouts,
+       and on the old list as sys_thread_new() used to */
+    w->timeouts = sys_arch_timeouts();
+    w->old.pthread = pthread_self();
+    pthread_mutex_lock( &old_threads_lock );
+    w->old.next = old_threads;
+    old_threads = &w->old;
+    pthread_mutex_unlock( &old_threads_lock );
+    pthread_barrier_wait( &barrier );
+
+    t0 = cpu_nsec();
+    for( i=0; i<w->ops; i++ ) {
+        timeouts = sys_arch_timeouts();
+        sum += (uintptr_t)timeouts;
+        if( timeouts != w->timeouts )
+            w->failures += 1;
+    }
+    w->tls_ns = (double)(cpu_nsec() - t0) / w->ops;
+
+    t0 = cpu_nsec();
+    for( i=0; i<w->ops; i++ ) {
+        t = old_current_thread();
+        sum += (uintptr_t)t;
+        if( t != &w->old )
+            w->failures += 1;
+    }
+    w->list_ns = (double)(cpu_nsec() - t0) / w->ops;
+
+    /* every thread is still on the old list until all are done with it */
+    pthread_barrier_wait( &barrier );
+
+    t0 = cpu_nsec();
+    pending = 0;
+    for( i=0; i<w->ops; i++ ) {
+        sys_timeout( 1 + next_rand( &w->rand ) % 1000, timeout_handler, w );
+        w->scheduled += 1;
+        if( ++pending > PENDING ) {
+            timeout_expire();
+            pending -= 1;
+        }
+    }
+    w->timeout_ns = (double)(cpu_nsec() - t0) / w->ops;
+
+    /* odd threads exit with timeouts pending, for the sys layer to free */
+    if( w->id % 2 == 0 )
+        while( pending-- > 0 )
+            timeout_expire();
+    else
+        w->left = pending;
+
+    if( sum == 0 )
+        w->failures += 1;
+    return NULL;
+}
+
+int main( int argc, char** argv ) {
+    static const unsigned THREADS[] = { 1, 4, 16, MAX_THREADS };
+    static worker_t w[MAX_THREADS];
+    unsigned ops = 200000, seed = 1;
+    unsigned failures = 0, i, j, k, n;
+    double tls_ns, list_ns, timeout_ns;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:s:" )) != EOF ) {
+        switch( c ) {
+        case 'n': ops = atoi( optarg ); break;
+        case 's': seed = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n ops_per_thread] [-s seed]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( ops >= 1, "Error: need at least one operation per thread" );
+
+    stats_init();
+    sys_init();
+    mem_init();
+    memp_init();
+
+    printf( "%u operations per thread\n", ops );
+    for( i=0; i<sizeof(THREADS)/sizeof(THREADS[0]); i++ ) {
+        n = THREADS[i];
+        memset( w, 0, sizeof(w) );
+        old_threads = NULL;
+        pthread_barrier_init( &barrier, NULL, n );
+        for( j=0; j<n; j++ ) {
+            w[j].id = j;
+            w[j].ops = ops;
+            w[j].rand = (seed + j) * 2654435761U;
+            if( w[j].rand == 0 )
+                w[j].rand = 1;
+            true_or_die( pthread_create( &w[j].thread, NULL, worker_main, &w[j] ) == 0,
+                         "Error: pthread_create failed" );
+        }
+        for( j=0; j<n; j++ )
+            pthread_join( w[j].thread, NULL );
+        pthread_barrier_destroy( &barrier );
+
+        tls_ns = list_ns = timeout_ns = 0;
+        for( j=0; j<n; j++ ) {
+            tls_ns += w[j].tls_ns / n;
+            list_ns += w[j].list_ns / n;
+            timeout_ns += w[j].timeout_ns / n;
+            failures += w[j].failures;
+            if( w[j].timeouts == NULL ) {
+                fprintf( stderr, "thread %u had no timeouts\n", j );
+                failures += 1;
+            }
+            for( k=0; k<j; k++ )
+                if( w[k].timeouts == w[j].timeouts ) {
+                    fprintf( stderr, "threads %u and %u shared their timeouts\n", k, j );
+                    failures += 1;
+                }
+            if( w[j].fired + w[j].left != w[j].scheduled ) {
+                fprintf( stderr, "thread %u scheduled %llu timeouts but %llu fired\n", j,
+                         (unsigned long long)w[j].scheduled,
+                         (unsigned long long)w[j].fired );
+                failures += 1;
+            }
+        }
+        printf( "%2u threads: %5.1f ns/lookup from thread-local storage, "
+                "%6.1f ns/lookup walking the threads, %6.1f ns/timeout\n",
+                n, tls_ns, list_ns, timeout_ns );
+    }
+
+    if( stats.memp[MEMP_SYS_TIMEOUT].used != 0 ) {
+        fprintf( stderr, "%u timeouts still in use after every thread exited\n",
+                 (unsigned)stats.memp[MEMP_SYS_TIMEOUT].used );
+        failures += 1;
+    }
+    if( stats.memp[MEMP_SYS_TIMEOUT].err != 0 ) {
+        fprintf( stderr, "the timeout pool ran out %u times\n",
+                 (unsigned)stats.memp[MEMP_SYS_TIMEOUT].err );
+        failures += 1;
+    }
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}
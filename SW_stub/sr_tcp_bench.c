@@ -0,0 +1,478 @@
+/*
+ * Filename: sr_tcp_bench.c
+ * Purpose: Measures the throughput of a bulk transfer between two lwtcp
+ *          connections over a virtual link.
+ *
+ * The client and server are both ends of one lwtcp stack.  The link between
+ * them has a rate, a one-way delay and an MTU, and delivers every packet --
+ * in order, after it has been serialized and has crossed the link -- on a
+ * virtual clock, which also drives the TCP timers.  The client writes as
+ * fast as its send buffer allows and the server reads everything as soon as
+ * it arrives, so the throughput reported (in virtual time) is what the
+ * windows and segment size allow on that link.
+ *
+ * Each link is run with the stack's old fixed settings -- a 128 byte MSS, a
+ * 256 byte send buffer and a 1 KB window -- and with the MSS derived from an
+ * Ethernet and a jumbo MTU and the buffers left to tune themselves.  Packets
+ * cross between lwtcp and the link as they do between lwtcp and the router:
+ * received frames are wrapped in pbufs in place, and every segment sent must
+ * be one the router can be lent without copying.  Every byte must arrive
+ * intact, no segment may exceed the MTU, nothing may need retransmitting,
+ * windows must be scaled where the peer agreed to it, the tuned connections
+ * must beat the old ones, and once every connection is gone the stack must
+ * hold no more memory than it started with.
+ *
+ * Usage: tcp_bench [-b bytes_per_transfer]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <net/ethernet.h>
+#include "sr_common.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "lwip/pbuf.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+#include "lwip/tcp.h"
+#include "lwtcp_sr_integration.h"
+
+#define CLIENT_IP   0x0a000001
+#define SERVER_IP   0x0a000002
+#define SERVER_PORT 179
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC   1000000ULL
+
+/** a transfer which makes no progress for this long has stalled */
+#define STALL_NSEC (600 * NSEC_PER_SEC)
+
+/** a packet crossing the link */
+typedef struct pkt_t {
+    struct pkt_t* next;
+    uint64_t      arrive;       /* virtual time it reaches the far end */
+    byte*         buf;          /* the frame, as the router receives it */
+    uint16_t      len;          /* of the IP packet after the link header */
+} pkt_t;
+
+/** a full duplex point-to-point link between the client and server */
+typedef struct link_t {
+    uint64_t    rate;           /* bits per second each way */
+    uint64_t    delay;          /* one-way propagation delay, ns */
+    uint16_t    mtu;
+    uint64_t    idle_at[2];     /* when each end's transmitter is next idle */
+    pkt_t*      head;           /* packets in flight, by arrival time */
+    unsigned    oversized;      /* packets sent larger than the MTU */
+    unsigned    copied;         /* segments the router could not be lent */
+} link_t;
+
+/** how the connections are set up */
+typedef struct config_t {
+    const char* name;
+    uint16_t    mtu;
+    uint32_t    snd_buf, rcv_wnd;  /* fixed sizes, or 0 to auto-tune */
+} config_t;
+
+/** the state of one bulk transfer */
+typedef struct flow_t {
+    const config_t* config;
+    struct tcp_pcb* client;
+    struct tcp_pcb* server;
+    bool            connected;
+    uint32_t        total, sent, received;
+    uint64_t        start, done;
+    unsigned        corrupt;
+} flow_t;
+
+static link_t vlink;
+static uint64_t now;
+static struct netif netif;
+
+/* -- the stack's hooks into the router, here the virtual link -- */
+
+uint32_t ip_route( struct ip_addr* dest ) {
+    return htonl( ntohl( dest->addr ) == SERVER_IP ? CLIENT_IP : SERVER_IP );
+}
+
+uint16_t ip_route_mtu( struct ip_addr* dest ) {
+    return vlink.mtu;
+}
+
+/** The bench calls tcp_tmr() itself, every TCP_TMR_INTERVAL of link time. */
+void tcp_timer_needed( void ) {
+}
+
+/** Puts an IP packet around a segment and sends it across the link. */
+err_t sr_lwip_output( struct pbuf* p, struct ip_addr* src, struct ip_addr* dst,
+                      uint8_t proto ) {
+    struct ip_hdr* iphdr;
+    struct pbuf* r;
+    pkt_t *pkt, **pp;
+    uint16_t len, off;
+    unsigned end;
+
+    len = IP_HLEN + p->tot_len;
+    if( len > vlink.mtu )
+        vlink.oversized += 1;
+
+    /* the router is lent the segment if it is whole with room for headers */
+    if( p->next != NULL || pbuf_header( p, PBUF_IP_HLEN + PBUF_LINK_HLEN ) != 0 )
+        vlink.copied += 1;
+    else
+        pbuf_header( p, -(PBUF_IP_HLEN + PBUF_LINK_HLEN) );
+
+    pkt = malloc_or_die( sizeof(*pkt) );
+    pkt->buf = malloc_or_die( ETHER_HDR_LEN + len );
+    pkt->len = len;
+    iphdr = (struct ip_hdr*)(pkt->buf + ETHER_HDR_LEN);
+    memset( iphdr, 0, IP_HLEN );
+    IPH_VHLTOS_SET( iphdr, 4, IP_HLEN / 4, 0 );
+    IPH_LEN_SET( iphdr, htons( len ) );
+    IPH_TTL_SET( iphdr, 64 );
+    IPH_PROTO_SET( iphdr, proto );
+    iphdr->src = *src;
+    iphdr->dest = *dst;
+    off = IP_HLEN;
+    for( r=p; r!=NULL; r=r->next ) {
+        memcpy( (byte*)iphdr + off, r->payload, r->len );
+        off += r->len;
+    }
+
+    /* serialized after whatever this end is still sending */
+    end = (ntohl( src->addr ) == SERVER_IP);
+    if( vlink.idle_at[end] < now )
+        vlink.idle_at[end] = now;
+    vlink.idle_at[end] += len * 8ULL * NSEC_PER_SEC / vlink.rate;
+
+    pkt->arrive = vlink.idle_at[end] + vlink.delay;
+    for( pp=&vlink.head; *pp!=NULL && (*pp)->arrive <= pkt->arrive; pp=&(*pp)->next );
+    pkt->next = *pp;
+    *pp = pkt;
+    return ERR_OK;
+}
+
+/**
+ * Delivers the next packet across the link, handing it to lwtcp in the
+ * frame it arrived in as sr_transport_input() does.
+ */
+static void link_deliver() {
+    pkt_t* pkt = vlink.head;
+    struct pbuf* p;
+
+    vlink.head = pkt->next;
+    now = pkt->arrive;
+    p = pbuf_alloc_ref( pkt->buf, pkt->buf + ETHER_HDR_LEN, pkt->len, free, pkt->buf );
+    true_or_die( p != NULL, "Error: out of memory for a packet on the link" );
+    tcp_input( p, &netif );
+    free( pkt );
+}
+
+/* -- the applications at either end -- */
+
+/** the byte at offset off of a transfer */
+static byte pattern( uint32_t off ) {
+    return (byte)(off ^ (off >> 8) ^ (off >> 16));
+}
+
+/** Writes as much of the transfer as the client's send buffer takes. */
+static void client_pump( flow_t* f ) {
+    static byte buf[0xffff];
+    uint32_t n, i;
+
+    if( !f->connected || f->client == NULL )
+        return;
+
+    while( f->sent < f->total && tcp_sndbuf( f->client ) > 0 ) {
+        n = f->total - f->sent;
+        if( n > tcp_sndbuf( f->client ) )
+            n = tcp_sndbuf( f->client );
+        if( n > sizeof(buf) )
+            n = sizeof(buf);
+        for( i=0; i<n; i++ )
+            buf[i] = pattern( f->sent + i );
+        if( tcp_write( f->client, buf, n, 1 ) != ERR_OK )
+            break;
+        f->sent += n;
+    }
+    tcp_output( f->client );
+}
+
+static err_t client_connected( void* arg, struct tcp_pcb* pcb, err_t err ) {
+    flow_t* f = arg;
+
+    f->connected = (err == ERR_OK);
+    return ERR_OK;
+}
+
+static void client_err( void* arg, err_t err ) {
+    ((flow_t*)arg)->client = NULL;
+}
+
+static err_t server_recv( void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err ) {
+    flow_t* f = arg;
+    struct pbuf* q;
+    uint16_t i;
+
+    if( p == NULL )
+        return ERR_OK;
+
+    for( q=p; q!=NULL; q=q->next ) {
+        for( i=0; i<q->len; i++ )
+            if( ((byte*)q->payload)[i] != pattern( f->received + i ) )
+                f->corrupt += 1;
+        f->received += q->len;
+    }
+    tcp_recved( pcb, p->tot_len );
+    pbuf_free( p );
+
+    if( f->received >= f->total && f->done == 0 )
+        f->done = now;
+    return ERR_OK;
+}
+
+static void server_err( void* arg, err_t err ) {
+    ((flow_t*)arg)->server = NULL;
+}
+
+static err_t server_accept( void* arg, struct tcp_pcb* pcb, err_t err ) {
+    flow_t* f = arg;
+
+    f->server = pcb;
+    tcp_arg( pcb, f );
+    tcp_recv( pcb, server_recv );
+    tcp_err( pcb, server_err );
+    if( f->config->snd_buf )
+        tcp_setsndbuf( pcb, f->config->snd_buf );
+    if( f->config->rcv_wnd )
+        tcp_setrcvbuf( pcb, f->config->rcv_wnd );
+    return ERR_OK;
+}
+
+/* -- the benchmark -- */
+
+/**
+ * Runs a transfer of total bytes with config over the link, puts its
+ * throughput in *mbps, and returns the number of checks which failed.
+ */
+static unsigned run( struct tcp_pcb* listener, const config_t* config,
+                     uint32_t total, double* mbps ) {
+    static uint16_t port = 4096;
+    struct ip_addr client_ip, server_ip;
+    uint32_t rexmit, last_received;
+    uint64_t next_tick, last_progress;
+    unsigned failures = 0;
+    flow_t f;
+
+    memset( &f, 0, sizeof(f) );
+    *mbps = 0;
+    f.config = config;
+    f.total = total;
+    vlink.mtu = config->mtu;
+    vlink.oversized = 0;
+    vlink.copied = 0;
+    rexmit = stats.tcp.rexmit;
+    tcp_arg( listener, &f );
+
+    client_ip.addr = htonl( CLIENT_IP );
+    server_ip.addr = htonl( SERVER_IP );
+    f.client = tcp_new();
+    true_or_die( f.client != NULL, "Error: no PCB for the client" );
+    tcp_arg( f.client, &f );
+    tcp_err( f.client, client_err );
+    if( config->snd_buf )
+        tcp_setsndbuf( f.client, config->snd_buf );
+    if( config->rcv_wnd )
+        tcp_setrcvbuf( f.client, config->rcv_wnd );
+    true_or_die( tcp_bind( f.client, &client_ip, ++port ) == ERR_OK,
+                 "Error: could not bind the client" );
+    f.start = now;
+    tcp_connect( f.client, &server_ip, SERVER_PORT, client_connected );
+
+    /* run the link and the timers until the last byte is in */
+    next_tick = now + TCP_TMR_INTERVAL * NSEC_PER_MSEC;
+    last_received = 0;
+    last_progress = now;
+    while( f.done == 0 && f.client != NULL ) {
+        if( vlink.head != NULL && vlink.head->arrive <= next_tick )
+            link_deliver();
+        else {
+            now = next_tick;
+            next_tick += TCP_TMR_INTERVAL * NSEC_PER_MSEC;
+            tcp_tmr();
+        }
+        client_pump( &f );
+
+        if( f.received != last_received ) {
+            last_received = f.received;
+            last_progress = now;
+        }
+        else if( now - last_progress > STALL_NSEC )
+            break;
+    }
+
+    printf( "  %-22s", config->name );
+    if( f.done == 0 ) {
+        printf( " stalled after %u of %u bytes\n", f.received, f.total );
+        failures += 1;
+    }
+    else if( f.client == NULL || f.server == NULL ) {
+        printf( " connection lost\n" );
+        failures += 1;
+    }
+    else {
+        *mbps = f.total * 8.0 * NSEC_PER_SEC / (f.done - f.start) / 1e6;
+        printf( " %9.2f Mb/s  MSS %4u  send buffer %6u  window %6u  scale %u/%u\n", *mbps,
+                f.client->mss, f.client->snd_buf_max, f.server->rcv_wnd_max,
+                f.client->snd_scale, f.server->snd_scale );
+        if( f.client->mss != UMIN( config->mtu - IP_HLEN - TCP_HLEN, TCP_MSS ) ) {
+            fprintf( stderr, "    MSS %u does not fit MTU %u\n", f.client->mss, config->mtu );
+            failures += 1;
+        }
+        if( f.client->snd_scale != f.server->rcv_scale ||
+            f.server->snd_scale != f.client->rcv_scale ||
+            !(f.client->flags & TF_WND_SCALE) ) {
+            fprintf( stderr, "    window scales do not match\n" );
+            failures += 1;
+        }
+    }
+    if( f.corrupt ) {
+        fprintf( stderr, "    %u bytes arrived corrupt\n", f.corrupt );
+        failures += 1;
+    }
+    if( vlink.copied ) {
+        fprintf( stderr, "    %u segments would have been copied to the router\n",
+                 vlink.copied );
+        failures += 1;
+    }
+    if( vlink.oversized ) {
+        fprintf( stderr, "    %u packets exceeded the MTU\n", vlink.oversized );
+        failures += 1;
+    }
+    if( stats.tcp.rexmit != rexmit ) {
+        fprintf( stderr, "    %u segments retransmitted on a lossless link\n",
+                 (unsigned)(uint16_t)(stats.tcp.rexmit - rexmit) );
+        failures += 1;
+    }
+
+    /* tear both ends down and let the resets cross the link */
+    if( f.server != NULL )
+        tcp_abort( f.server );
+    if( f.client != NULL )
+        tcp_abort( f.client );
+    while( vlink.head != NULL )
+        link_deliver();
+    return failures;
+}
+
+static const config_t CONFIGS[] = {
+    { "old fixed sizes",        168, 256, 1024 },
+    { "Ethernet MTU, tuned",   1500,   0,    0 },
+    { "jumbo MTU, tuned",      9000,   0,    0 },
+};
+#define NUM_CONFIGS (sizeof(CONFIGS) / sizeof(CONFIGS[0]))
+
+static const struct { const char* name; uint64_t rate, delay; } LINKS[] = {
+    { "1 Gb/s link, 0.1 ms RTT",  1000000000ULL,    50000ULL },
+    { "100 Mb/s link, 20 ms RTT",  100000000ULL, 10000000ULL },
+};
+#define NUM_LINKS (sizeof(LINKS) / sizeof(LINKS[0]))
+
+/** arguments and results of the thread which runs the transfers */
+typedef struct bench_t {
+    uint32_t total;
+    double   mbps[NUM_LINKS][NUM_CONFIGS];
+    unsigned failures;
+} bench_t;
+
+/**
+ * Runs every config over every link.  This is done on a thread of its own
+ * so that when it exits, the stack's per-thread caches go back to the
+ * pools and the heap before they are checked.
+ */
+static void* bench_thread( void* arg ) {
+    bench_t* b = arg;
+    struct tcp_pcb* listener;
+    struct ip_addr server_ip;
+    unsigned i, j;
+
+    sys_thread_init();
+    server_ip.addr = htonl( SERVER_IP );
+    listener = tcp_new();
+    true_or_die( listener != NULL && tcp_bind( listener, &server_ip, SERVER_PORT ) == ERR_OK,
+                 "Error: could not bind the server" );
+    listener = tcp_listen( listener );
+    tcp_accept( listener, server_accept );
+
+    for( i=0; i<NUM_LINKS; i++ ) {
+        memset( &vlink, 0, sizeof(vlink) );
+        vlink.rate = LINKS[i].rate;
+        vlink.delay = LINKS[i].delay;
+        printf( "%s:\n", LINKS[i].name );
+        for( j=0; j<NUM_CONFIGS; j++ )
+            b->failures += run( listener, &CONFIGS[j], b->total, &b->mbps[i][j] );
+    }
+
+    tcp_close( listener );
+    return NULL;
+}
+
+int main( int argc, char** argv ) {
+    pthread_t thread;
+    uint32_t heap;
+    bench_t b;
+    unsigned i, j;
+    int c;
+
+    memset( &b, 0, sizeof(b) );
+    b.total = 4 << 20;
+    while( (c = getopt( argc, argv, "b:" )) != EOF ) {
+        switch( c ) {
+        case 'b': b.total = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-b bytes_per_transfer]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( b.total >= 1, "Error: need at least one byte per transfer" );
+
+    stats_init();
+    sys_init();
+    mem_init();
+    memp_init();
+    pbuf_init();
+    tcp_init();
+    netif.netmask.addr = htonl( 0xffffff00 );
+    heap = stats.mem.used;
+
+    printf( "%u bytes per transfer\n", b.total );
+    true_or_die( pthread_create( &thread, NULL, bench_thread, &b ) == 0,
+                 "Error: pthread_create failed" );
+    pthread_join( thread, NULL );
+
+    /* tuning must beat the old sizes on every link */
+    for( i=0; i<NUM_LINKS; i++ )
+        for( j=1; j<NUM_CONFIGS; j++ )
+            if( b.mbps[i][j] <= b.mbps[i][0] ) {
+                fprintf( stderr, "%s is no faster than %s on the %s\n",
+                         CONFIGS[j].name, CONFIGS[0].name, LINKS[i].name );
+                b.failures += 1;
+            }
+
+    if( stats.mem.used != heap ) {
+        fprintf( stderr, "%u more bytes of the heap in use than before\n",
+                 (unsigned)(stats.mem.used - heap) );
+        b.failures += 1;
+    }
+    for( i=0; i<MEMP_MAX; i++ )
+        if( stats.memp[i].used != 0 ) {
+            fprintf( stderr, "%u elements of pool %u still in use\n",
+                     (unsigned)stats.memp[i].used, i );
+            b.failures += 1;
+        }
+
+    printf( "%s (%u failures)\n", b.failures ? "FAILED" : "PASSED", b.failures );
+    return b.failures ? 1 : 0;
+}
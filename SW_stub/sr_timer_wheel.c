@@ -0,0 +1,122 @@
+/* Filename: sr_timer_wheel.c */
+
+#include <stddef.h>
+#include "sr_timer_wheel.h"
+
+/** Returns the slot for tick. */
+static tw_timer_t* tw_slot( timer_wheel_t* w, uint64_t tick ) {
+    return &w->slot[tick & (TW_SLOTS - 1)];
+}
+
+/** Appends t to the list headed by head. */
+static void tw_link( tw_timer_t* head, tw_timer_t* t ) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void tw_unlink( tw_timer_t* t ) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+}
+
+void tw_init( timer_wheel_t* w, unsigned tick_ms, uint64_t now_ms ) {
+    unsigned i;
+
+    true_or_die( tick_ms > 0, "Error: a timer wheel tick must be at least 1ms" );
+    for( i=0; i<TW_SLOTS; i++ )
+        w->slot[i].next = w->slot[i].prev = &w->slot[i];
+    w->tick_ms = tick_ms;
+    w->tick = now_ms / tick_ms;
+    w->num_timers = 0;
+}
+
+void tw_timer_init( tw_timer_t* t ) {
+    t->expires_ms = 0;
+    t->next = t->prev = NULL;
+}
+
+bool tw_is_scheduled( const tw_timer_t* t ) {
+    return t->next != NULL;
+}
+
+void tw_schedule( timer_wheel_t* w, tw_timer_t* t, uint64_t expires_ms ) {
+    uint64_t tick;
+
+    if( tw_is_scheduled( t ) )
+        tw_unlink( t );
+    else
+        w->num_timers += 1;
+
+    /* the first tick at or after expires_ms which has not been processed */
+    tick = (expires_ms + w->tick_ms - 1) / w->tick_ms;
+    if( tick <= w->tick )
+        tick = w->tick + 1;
+
+    t->expires_ms = expires_ms;
+    tw_link( tw_slot( w, tick ), t );
+}
+
+void tw_cancel( timer_wheel_t* w, tw_timer_t* t ) {
+    if( tw_is_scheduled( t ) ) {
+        tw_unlink( t );
+        w->num_timers -= 1;
+    }
+}
+
+unsigned tw_advance( timer_wheel_t* w, uint64_t now_ms,
+                     tw_expire_cb cb, void* cb_arg ) {
+    uint64_t now_tick = now_ms / w->tick_ms;
+    tw_timer_t pending, *head, *t;
+    unsigned n = 0;
+
+    /* a long gap visits each slot once rather than going round repeatedly */
+    if( now_tick > w->tick + TW_SLOTS )
+        w->tick = now_tick - TW_SLOTS;
+
+    while( w->tick < now_tick ) {
+        w->tick += 1;
+        head = tw_slot( w, w->tick );
+        if( head->next == head )
+            continue;
+
+        /* move the slot's timers aside so that cb may schedule into it */
+        pending.next = head->next;
+        pending.prev = head->prev;
+        pending.next->prev = &pending;
+        pending.prev->next = &pending;
+        head->next = head->prev = head;
+
+        while( (t = pending.next) != &pending ) {
+            tw_unlink( t );
+            if( t->expires_ms <= now_ms ) {
+                w->num_timers -= 1;
+                n += 1;
+                cb( cb_arg, t, now_ms );
+            }
+            else
+                tw_link( head, t ); /* due on a later turn of the wheel */
+        }
+    }
+
+    return n;
+}
+
+int64_t tw_timeout( timer_wheel_t* w, uint64_t now_ms ) {
+    uint64_t tick;
+
+    if( !w->num_timers )
+        return -1;
+
+    for( tick=w->tick+1; tick<=w->tick+TW_SLOTS; tick++ ) {
+        if( tw_slot( w, tick )->next != tw_slot( w, tick ) ) {
+            if( tick * w->tick_ms <= now_ms )
+                return 0;
+            return tick * w->tick_ms - now_ms;
+        }
+    }
+
+    return 0; /* not reached: some slot holds each timer */
+}
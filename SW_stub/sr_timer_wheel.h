@@ -0,0 +1,79 @@
+/*
+ * Filename: sr_timer_wheel.h
+ * Purpose: Hashed timer wheel.
+ *
+ * Keeping a deadline per object and scanning every object on each tick makes
+ * the cost of a tick grow with the number of objects, even though almost none
+ * of them expire on any given tick.  A timer wheel instead hangs each timer off
+ * the slot of the tick it expires on (modulo the number of slots), so that
+ * scheduling, rescheduling and cancelling a timer are O(1) unlinks and inserts,
+ * and a tick only looks at the timers in its own slot.  Timers further away
+ * than one turn of the wheel share a slot with nearer ones and are simply
+ * skipped until their turn comes round.
+ *
+ * Timers are embedded in the objects they time, so the wheel never allocates.
+ *
+ * Not thread-safe; the owner serializes access.
+ */
+
+#ifndef SR_TIMER_WHEEL_H
+#define SR_TIMER_WHEEL_H
+
+#include "sr_common.h"
+
+/** slots on the wheel (a power of 2) */
+#define TW_SLOTS 256
+
+/** a timer; embed it in the object it times */
+typedef struct tw_timer_t {
+    uint64_t expires_ms;
+    struct tw_timer_t* next;    /* NULL if the timer is not scheduled */
+    struct tw_timer_t* prev;
+} tw_timer_t;
+
+/** called for each timer which expires; it may schedule or cancel any timer */
+typedef void (*tw_expire_cb)( void* arg, tw_timer_t* t, uint64_t now_ms );
+
+/** the wheel */
+typedef struct timer_wheel_t {
+    tw_timer_t slot[TW_SLOTS];  /* head of each slot's circular list */
+    unsigned   tick_ms;         /* time each slot covers */
+    uint64_t   tick;            /* last tick processed */
+    unsigned   num_timers;
+} timer_wheel_t;
+
+/**
+ * Initializes an empty wheel whose slots each cover tick_ms, starting at
+ * now_ms.  Timers fire up to tick_ms after they expire.
+ */
+void tw_init( timer_wheel_t* w, unsigned tick_ms, uint64_t now_ms );
+
+/** Initializes t as not scheduled. */
+void tw_timer_init( tw_timer_t* t );
+
+/** Returns TRUE if t is scheduled. */
+bool tw_is_scheduled( const tw_timer_t* t );
+
+/** Schedules t to expire at expires_ms, rescheduling it if it already was. */
+void tw_schedule( timer_wheel_t* w, tw_timer_t* t, uint64_t expires_ms );
+
+/** Cancels t if it is scheduled. */
+void tw_cancel( timer_wheel_t* w, tw_timer_t* t );
+
+/**
+ * Advances the wheel to now_ms, calling cb for each timer which expired by
+ * then (it is no longer scheduled when cb is called).
+ *
+ * @return number of timers which expired
+ */
+unsigned tw_advance( timer_wheel_t* w, uint64_t now_ms,
+                     tw_expire_cb cb, void* cb_arg );
+
+/**
+ * Returns ms until the wheel next needs advancing, or -1 if no timer is
+ * scheduled.  It may be early (but never late) for timers more than one turn
+ * of the wheel away.
+ */
+int64_t tw_timeout( timer_wheel_t* w, uint64_t now_ms );
+
+#endif /* SR_TIMER_WHEEL_H */
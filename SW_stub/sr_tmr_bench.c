@@ -0,0 +1,388 @@
+/*
+ * Filename: sr_tmr_bench.c
+ * Purpose: Measures how long lwtcp's timers take to run, with 100, 1000, 10000
+ *          and 100000 mostly idle connections open.
+ *
+ * The connections are established with nothing in flight, and one in a
+ * hundred has the application polling it every couple of seconds.  tcp_tmr()
+ * is run with the timer wheel, which only visits the connections with a timer
+ * due, and the timers as they used to be run, stepping through every active
+ * PCB on each fast and slow tick; the cost of a tcp_tmr() is reported for
+ * both.  Both must poll each polled connection as often, and the wheel must
+ * have no timers pending once the connections are closed, nor while they are
+ * idle and unpolled.
+ *
+ * Then a connection acknowledging data it read must send its delayed ACK on
+ * the next fast tick, and connections put in TIME-WAIT a tick apart must each
+ * be freed as soon as they have been in it for 2 MSL.
+ *
+ * Usage: tmr_bench [-n tcp_tmr_calls]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sr_common.h"
+#include "lwip/mem.h"
+#include "lwip/memp.h"
+#include "lwip/pbuf.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+#include "lwip/tcp.h"
+#include "lwtcp_sr_integration.h"
+
+/** the router's address, which every connection is to */
+#define LOCAL_IP       0x0a000101
+
+/** one in this many connections is polled */
+#define POLL_EVERY     100
+
+/** slow ticks between polls */
+#define POLL_INTERVAL  4
+
+/** connections put in TIME-WAIT, fewer than the PCB pool holds */
+#define NUM_TW         8
+
+/** a connection, and what the old timers kept for it */
+typedef struct conn_t {
+    struct tcp_pcb pcb;
+    uint32_t rtime;
+    uint8_t  polltmr;
+    unsigned polls;
+} conn_t;
+
+static unsigned segments_sent;
+static unsigned timer_needed;
+
+/* -- the stack's hooks into the router; only ACKs are ever sent -- */
+
+uint32_t ip_route( struct ip_addr* dest ) {
+    return htonl( LOCAL_IP );
+}
+
+uint16_t ip_route_mtu( struct ip_addr* dest ) {
+    return 0;
+}
+
+err_t sr_lwip_output( struct pbuf* p, struct ip_addr* src, struct ip_addr* dst,
+                      uint8_t proto ) {
+    segments_sent += 1;
+    return ERR_OK;
+}
+
+/** The bench calls tcp_tmr() itself; it only counts when it is asked to. */
+void tcp_timer_needed( void ) {
+    timer_needed += 1;
+}
+
+static uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static err_t conn_poll( void* arg, struct tcp_pcb* pcb ) {
+    ((conn_t*)arg)->polls += 1;
+    return ERR_OK;
+}
+
+/** tcp_slowtmr() as it was, stepping through every active PCB. */
+static void old_slowtmr() {
+    struct tcp_pcb* pcb;
+    conn_t* c;
+    uint8_t pcb_remove;
+
+    ++tcp_ticks;
+    for( pcb=tcp_active_pcbs; pcb!=NULL; pcb=pcb->next ) {
+        c = pcb->callback_arg;
+        pcb_remove = 0;
+        if( pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX )
+            ++pcb_remove;
+        else if( pcb->nrtx == TCP_MAXRTX )
+            ++pcb_remove;
+        else {
+            ++c->rtime;
+            if( pcb->unacked != NULL && c->rtime >= pcb->rto )
+                ++pcb_remove;   /* never: nothing is in flight */
+        }
+        if( pcb->state == FIN_WAIT_2 &&
+            (uint32_t)(tcp_ticks - pcb->tmr) > TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL )
+            ++pcb_remove;
+#if TCP_QUEUE_OOSEQ
+        if( pcb->ooseq != NULL &&
+            (uint32_t)(tcp_ticks - pcb->tmr) >= pcb->rto * TCP_OOSEQ_TIMEOUT )
+            ++pcb_remove;
+#endif
+        if( pcb->state == SYN_RCVD &&
+            (uint32_t)(tcp_ticks - pcb->tmr) > TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL )
+            ++pcb_remove;
+        if( pcb_remove )
+            continue;
+
+        ++c->polltmr;
+        if( c->polltmr >= pcb->pollinterval && pcb->poll != NULL ) {
+            c->polltmr = 0;
+            pcb->poll( pcb->callback_arg, pcb );
+            tcp_output( pcb );
+        }
+    }
+}
+
+/** tcp_fasttmr() as it was, stepping through every active PCB. */
+static void old_fasttmr() {
+    struct tcp_pcb* pcb;
+
+    for( pcb=tcp_active_pcbs; pcb!=NULL; pcb=pcb->next ) {
+        if( pcb->refused_data != NULL || pcb->flags & TF_FIN_REFUSED )
+            tcp_refused_data( pcb );
+        if( pcb->flags & TF_ACK_DELAY ) {
+            tcp_ack_now( pcb );
+            pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
+        }
+    }
+}
+
+/** tcp_tmr() as it was. */
+static void old_tmr() {
+    static uint8_t timer;
+
+    if( ++timer == 10 )
+        timer = 0;
+    if( timer & 1 )
+        old_fasttmr();
+    if( timer == 0 || timer == 5 )
+        old_slowtmr();
+}
+
+/** Opens n established, idle connections, polling one in POLL_EVERY. */
+static conn_t* conns_open( unsigned n, unsigned* failures ) {
+    conn_t* conns;
+    struct tcp_pcb* pcb;
+    unsigned i;
+
+    conns = calloc( n, sizeof(*conns) );
+    true_or_die( conns != NULL, "Error: calloc failed" );
+    for( i=0; i<n; i++ ) {
+        pcb = &conns[i].pcb;
+        pcb->state = ESTABLISHED;
+        pcb->local_ip.addr = htonl( LOCAL_IP );
+        pcb->local_port = 80;
+        pcb->remote_ip.addr = htonl( 0x0b000000 + i );
+        pcb->remote_port = 1024 + i % 50000;
+        pcb->mss = TCP_DEFAULT_MSS;
+        pcb->snd_wnd = pcb->cwnd = TCP_WND;
+        pcb->rcv_wnd = pcb->rcv_wnd_max = TCP_WND;
+        pcb->rto = 3000 / TCP_SLOW_INTERVAL;
+        pcb->tmr = pcb->rtime = pcb->polltmr = tcp_ticks;
+        pcb->callback_arg = &conns[i];
+        TCP_REG( &tcp_active_pcbs, pcb );
+    }
+    if( tcp_timers_pending() ) {
+        fprintf( stderr, "%u idle connections have timers pending\n", n );
+        *failures += 1;
+    }
+    for( i=0; i<n; i+=POLL_EVERY )
+        tcp_poll( &conns[i].pcb, conn_poll, POLL_INTERVAL );
+    return conns;
+}
+
+static void conns_close( conn_t* conns ) {
+    struct tcp_pcb* pcb;
+
+    /* from the front of the list, so each is found at once */
+    while( (pcb = tcp_active_pcbs) != NULL ) {
+        TCP_RMV( &tcp_active_pcbs, pcb );
+        pcb->state = CLOSED;
+    }
+    free( conns );
+}
+
+/** Checks that each polled connection was polled once every POLL_INTERVAL. */
+static void conns_check_polls( conn_t* conns, unsigned n, unsigned slow_ticks,
+                               const char* which, unsigned* failures ) {
+    unsigned i, wrong = 0;
+
+    for( i=0; i<n; i++ ) {
+        if( conns[i].polls != (i % POLL_EVERY ? 0 : slow_ticks / POLL_INTERVAL) )
+            wrong += 1;
+        conns[i].polls = 0;
+    }
+    if( wrong ) {
+        fprintf( stderr, "%u of %u connections polled the wrong number of times by %s\n",
+                 wrong, n, which );
+        *failures += 1;
+    }
+}
+
+/** Times calls calls of tmr with n connections open. */
+static double conns_run( unsigned n, unsigned calls, void (*tmr)(),
+                         const char* which, unsigned* failures ) {
+    conn_t* conns;
+    uint64_t t0, elapsed;
+    unsigned i;
+
+    tcp_init();
+    conns = conns_open( n, failures );
+    t0 = now_nsec();
+    for( i=0; i<calls; i++ )
+        tmr();
+    elapsed = now_nsec() - t0;
+    conns_check_polls( conns, n, tcp_ticks, which, failures );
+    conns_close( conns );
+    if( tcp_timers_pending() ) {
+        fprintf( stderr, "timers pending after closing every connection\n" );
+        *failures += 1;
+    }
+    return (double)elapsed / calls;
+}
+
+/** Opens a connection from the PCB pool, as tcp_listen_input() would. */
+static struct tcp_pcb* pool_open( uint16_t port ) {
+    struct tcp_pcb* pcb;
+
+    pcb = tcp_new();
+    true_or_die( pcb != NULL, "Error: the PCB pool is empty" );
+    pcb->state = ESTABLISHED;
+    pcb->local_ip.addr = htonl( LOCAL_IP );
+    pcb->local_port = 80;
+    pcb->remote_ip.addr = htonl( 0x0c000001 );
+    pcb->remote_port = port;
+    pcb->snd_wnd = TCP_WND;
+    TCP_REG( &tcp_active_pcbs, pcb );
+    return pcb;
+}
+
+/** A delayed ACK must go out on the next fast tick, and only then. */
+static void check_delayed_ack( unsigned* failures ) {
+    struct tcp_pcb* pcb;
+    unsigned needed;
+
+    tcp_init();
+    pcb = pool_open( 1024 );
+    needed = timer_needed;
+    pcb->rcv_wnd -= 1000;
+    tcp_recved( pcb, 1000 );
+    if( !tcp_timers_pending() || timer_needed == needed ) {
+        fprintf( stderr, "no timer asked for with an ACK delayed\n" );
+        *failures += 1;
+    }
+
+    segments_sent = 0;
+    tcp_tmr();
+    if( segments_sent != 1 || pcb->flags & TF_ACK_DELAY ) {
+        fprintf( stderr, "delayed ACK not sent on the next fast tick (%u sent)\n",
+                 segments_sent );
+        *failures += 1;
+    }
+    tcp_tmr();
+    tcp_tmr();
+    if( segments_sent != 1 ) {
+        fprintf( stderr, "%u segments sent for one delayed ACK\n", segments_sent );
+        *failures += 1;
+    }
+    if( tcp_timers_pending() ) {
+        fprintf( stderr, "timers pending with the delayed ACK sent\n" );
+        *failures += 1;
+    }
+
+    tcp_pcb_remove( &tcp_active_pcbs, pcb );
+    memp_free( MEMP_TCP_PCB, pcb );
+}
+
+/** Each connection in TIME-WAIT must be freed once it has been for 2 MSL. */
+static void check_time_wait( unsigned* failures ) {
+    struct tcp_pcb* pcb;
+    uint32_t entered[NUM_TW];
+    unsigned i, tw, expected, wrong = 0, slow_ticks = 0;
+
+    tcp_init();
+    for( i=0; i<NUM_TW; i++ ) {
+        pcb = pool_open( 2000 + i );
+        tcp_pcb_remove( &tcp_active_pcbs, pcb );
+        pcb->state = TIME_WAIT;
+        pcb->tmr = entered[i] = tcp_ticks;
+        TCP_REG( &tcp_tw_pcbs, pcb );
+        tcp_slowtmr();
+    }
+
+    while( tcp_tw_pcbs != NULL && slow_ticks++ < 4 * TCP_MSL / TCP_SLOW_INTERVAL ) {
+        tcp_slowtmr();
+        for( tw=0, pcb=tcp_tw_pcbs; pcb!=NULL; pcb=pcb->next )
+            tw += 1;
+        for( expected=0, i=0; i<NUM_TW; i++ )
+            if( tcp_ticks - entered[i] <= 2 * TCP_MSL / TCP_SLOW_INTERVAL )
+                expected += 1;
+        if( tw != expected )
+            wrong += 1;
+    }
+    if( wrong || tcp_tw_pcbs != NULL ) {
+        fprintf( stderr, "TIME-WAIT connections freed on the wrong tick %u times%s\n",
+                 wrong, tcp_tw_pcbs ? ", and some never" : "" );
+        *failures += 1;
+    }
+    if( tcp_timers_pending() ) {
+        fprintf( stderr, "timers pending with every TIME-WAIT connection freed\n" );
+        *failures += 1;
+    }
+}
+
+/**
+ * Runs the checks on PCBs from the pool.  This is done on a thread of its
+ * own so that when it exits, its cache of PCBs goes back to the pool before
+ * the pool is checked.
+ */
+static void* check_thread( void* arg ) {
+    unsigned* failures = arg;
+
+    check_delayed_ack( failures );
+    check_time_wait( failures );
+    return NULL;
+}
+
+int main( int argc, char** argv ) {
+    static const unsigned SIZES[] = { 100, 1000, 10000, 100000 };
+    unsigned calls = 2000, failures = 0, i;
+    double wheel_ns, old_ns;
+    pthread_t thread;
+    int c;
+
+    while( (c = getopt( argc, argv, "n:" )) != EOF ) {
+        switch( c ) {
+        case 'n': calls = atoi( optarg ); break;
+        default:
+            fprintf( stderr, "Usage: %s [-n tcp_tmr_calls]\n", argv[0] );
+            return 1;
+        }
+    }
+    true_or_die( calls >= 1, "Error: need at least one tcp_tmr() call" );
+
+    stats_init();
+    sys_init();
+    mem_init();
+    memp_init();
+    pbuf_init();
+
+    printf( "%u tcp_tmr() calls, one in %u connections polled, %u slots on the wheel\n",
+            calls, POLL_EVERY, TCP_TIMER_WHEEL_SIZE );
+    for( i=0; i<sizeof(SIZES)/sizeof(SIZES[0]); i++ ) {
+        wheel_ns = conns_run( SIZES[i], calls, tcp_tmr, "the wheel", &failures );
+        old_ns = conns_run( SIZES[i], calls, old_tmr, "the old timers", &failures );
+        printf( "%6u connections: %9.1f ns/tcp_tmr() on the wheel, "
+                "%11.1f ns/tcp_tmr() stepping through them all\n",
+                SIZES[i], wheel_ns, old_ns );
+    }
+
+    true_or_die( pthread_create( &thread, NULL, check_thread, &failures ) == 0,
+                 "Error: could not start the check thread" );
+    pthread_join( thread, NULL );
+    if( stats.memp[MEMP_TCP_PCB].used != 0 ) {
+        fprintf( stderr, "%u PCBs still in use\n", (unsigned)stats.memp[MEMP_TCP_PCB].used );
+        failures += 1;
+    }
+
+    printf( "%s (%u failures)\n", failures ? "FAILED" : "PASSED", failures );
+    return failures ? 1 : 0;
+}